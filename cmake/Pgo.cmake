@@ -0,0 +1,103 @@
+# Runs the profile-guided optimization cycle for the chroma-pgo target, with cmake -P. It builds an instrumented
+# chroma-batch in BINARY_DIR, runs the training job list under every CPU mode so the interpreter, the cached
+# interpreter and the JIT are all profiled, then rebuilds in the same tree with the profiles. GCC looks its profiles
+# up by object path, which is why the instrumented and optimized builds share a tree. Finally it times the job list
+# with the optimized build against a plain release build, and reports the difference.
+
+if (NOT JOBS)
+    message(FATAL_ERROR "Set CHROMA_PGO_JOBS to a chroma-batch job list to train on.")
+endif()
+get_filename_component(JOBS ${JOBS} ABSOLUTE)
+get_filename_component(JOBS_DIR ${JOBS} DIRECTORY)
+
+set(PROFILE_DIR ${BINARY_DIR}/profiles)
+set(BATCH_ARGS)
+if (BIOS)
+    get_filename_component(BIOS ${BIOS} ABSOLUTE)
+    set(BATCH_ARGS --bios ${BIOS})
+endif()
+
+function(run)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        string(REPLACE ";" " " command "${ARGN}")
+        message(FATAL_ERROR "${command} failed: ${result}")
+    endif()
+endfunction()
+
+function(build dir pgo)
+    file(MAKE_DIRECTORY ${dir})
+    execute_process(COMMAND ${CMAKE_COMMAND} ${SOURCE_DIR} -G ${GENERATOR} -DCMAKE_BUILD_TYPE=Release
+                            -DCMAKE_C_COMPILER=${C_COMPILER} -DCMAKE_CXX_COMPILER=${CXX_COMPILER}
+                            -DCHROMA_PGO=${pgo} -DCHROMA_PGO_DIR=${PROFILE_DIR}
+                    WORKING_DIRECTORY ${dir} RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "Configuring ${dir} failed: ${result}")
+    endif()
+    run(${CMAKE_COMMAND} --build ${dir} --target chroma-batch)
+endfunction()
+
+# Runs each job three times on one thread, and returns the total frame rate from chroma-batch's summary line. Any
+# further arguments are passed on to chroma-batch.
+function(time_jobs dir out_var)
+    execute_process(COMMAND ${dir}/src/chroma-batch -j 1 --runs 3 ${BATCH_ARGS} ${ARGN} ${JOBS}
+                    WORKING_DIRECTORY ${JOBS_DIR} OUTPUT_VARIABLE output)
+    string(REGEX MATCH "\"total_fps\": ([0-9]+)\\.([0-9][0-9])" match "${output}")
+    if (NOT match)
+        message(FATAL_ERROR "chroma-batch in ${dir} didn't finish the job list:\n${output}")
+    endif()
+    set(${out_var} ${CMAKE_MATCH_1}.${CMAKE_MATCH_2} PARENT_SCOPE)
+endfunction()
+
+message(STATUS "Building instrumented chroma-batch")
+file(REMOVE_RECURSE ${PROFILE_DIR})
+build(${BINARY_DIR} GENERATE)
+
+# The training runs only need to reach the code, so they run on every host thread.
+foreach(mode interpreter cached jit)
+    message(STATUS "Training with --cpu ${mode}")
+    execute_process(COMMAND ${BINARY_DIR}/src/chroma-batch --cpu ${mode} ${BATCH_ARGS} ${JOBS}
+                    WORKING_DIRECTORY ${JOBS_DIR} OUTPUT_QUIET RESULT_VARIABLE result)
+    # A failed test in the job list is fine for training, but a crash isn't.
+    if (NOT result MATCHES "^[01]$")
+        message(FATAL_ERROR "Training run with --cpu ${mode} failed: ${result}")
+    endif()
+endforeach()
+
+file(GLOB_RECURSE profiles ${PROFILE_DIR}/*.gcda ${PROFILE_DIR}/*.profraw)
+if (NOT profiles)
+    message(FATAL_ERROR "The training runs didn't write any profiles to ${PROFILE_DIR}.")
+endif()
+
+if (CXX_COMPILER_ID MATCHES "Clang")
+    find_program(LLVM_PROFDATA NAMES llvm-profdata)
+    if (NOT LLVM_PROFDATA)
+        message(FATAL_ERROR "llvm-profdata is needed to merge Clang's profiles.")
+    endif()
+    file(GLOB raw_profiles ${PROFILE_DIR}/*.profraw)
+    run(${LLVM_PROFDATA} merge -o ${PROFILE_DIR}/chroma.profdata ${raw_profiles})
+endif()
+
+message(STATUS "Building chroma-batch with the profiles")
+build(${BINARY_DIR} USE)
+
+message(STATUS "Building plain release chroma-batch for comparison")
+build(${BINARY_DIR}-baseline OFF)
+
+message(STATUS "Timing the job list")
+# Comparing against the release build's baseline also prints each job which got faster or slower.
+time_jobs(${BINARY_DIR}-baseline release_fps --save-baseline ${BINARY_DIR}/release.baseline)
+time_jobs(${BINARY_DIR} pgo_fps --baseline ${BINARY_DIR}/release.baseline --tolerance 1)
+
+# CMake only does integer math, so the frame rates are taken in hundredths.
+string(REPLACE "." "" release_centi ${release_fps})
+string(REPLACE "." "" pgo_centi ${pgo_fps})
+math(EXPR speedup "(${pgo_centi} - ${release_centi}) * 1000 / ${release_centi}")
+math(EXPR speedup_whole "${speedup} / 10")
+math(EXPR speedup_tenths "${speedup} % 10")
+string(REGEX REPLACE "^-" "" speedup_tenths ${speedup_tenths})
+if (speedup LESS 0 AND speedup_whole EQUAL 0)
+    set(speedup_whole "-0")
+endif()
+message(STATUS "Release: ${release_fps} fps, PGO: ${pgo_fps} fps, speedup ${speedup_whole}.${speedup_tenths}%")
+message(STATUS "The optimized chroma-batch and libchroma are in ${BINARY_DIR}")
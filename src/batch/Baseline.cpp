@@ -0,0 +1,181 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include "batch/Baseline.h"
+
+namespace Batch {
+
+namespace {
+
+constexpr std::array<const char*, Baseline::num_metrics> metric_names{{"fps", "p99_frame_us",
+                                                                      "instructions_per_frame"}};
+
+// Positive when the metric got worse.
+double Worsening(Baseline::Metric metric, double before, double after) {
+    const double change = (after - before) / before;
+    return (metric == Baseline::Fps) ? -change : change;
+}
+
+} // End anonymous namespace
+
+std::string MachineClass() {
+    std::string model = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0 && line.find(':') != std::string::npos) {
+            model = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+
+    return fmt::format("{} x{}", model, std::thread::hardware_concurrency());
+}
+
+Baseline::Stat MakeStat(const std::vector<double>& samples) {
+    Baseline::Stat stat;
+    if (samples.empty()) {
+        return stat;
+    }
+
+    stat.mean = std::accumulate(samples.cbegin(), samples.cend(), 0.0) / samples.size();
+    if (samples.size() > 1) {
+        const double sum_squares = std::accumulate(samples.cbegin(), samples.cend(), 0.0,
+                                                   [&stat](double sum, double x) {
+            return sum + (x - stat.mean) * (x - stat.mean);
+        });
+        stat.stddev = std::sqrt(sum_squares / (samples.size() - 1));
+    }
+
+    return stat;
+}
+
+Baseline LoadBaseline(const std::string& filename) {
+    std::ifstream baseline_file(filename);
+    if (!baseline_file) {
+        throw std::runtime_error("Error when attempting to open " + filename);
+    }
+
+    Baseline baseline;
+    std::string line;
+    if (!std::getline(baseline_file, line) || line.rfind("machine ", 0) != 0) {
+        throw std::runtime_error(filename + " is not a chroma-batch baseline.");
+    }
+    baseline.machine_class = line.substr(8);
+
+    for (int line_num = 2; std::getline(baseline_file, line); ++line_num) {
+        std::istringstream line_stream{line};
+        std::string rom, frames, movie;
+        Baseline::Entry entry;
+        line_stream >> rom >> frames >> movie;
+        for (auto& stat : entry.stats) {
+            line_stream >> stat.mean >> stat.stddev;
+        }
+        if (!line_stream) {
+            throw std::runtime_error(fmt::format("Invalid baseline on line {} of {}: {}", line_num, filename, line));
+        }
+
+        entry.key = rom + " " + frames + " " + movie;
+        baseline.entries.push_back(std::move(entry));
+    }
+
+    return baseline;
+}
+
+void SaveBaseline(const std::string& filename, const Baseline& baseline) {
+    std::ofstream baseline_file(filename);
+    if (!baseline_file) {
+        throw std::runtime_error("Error when attempting to open " + filename + " for writing.");
+    }
+
+    fmt::print(baseline_file, "machine {}\n", baseline.machine_class);
+    for (const auto& entry : baseline.entries) {
+        fmt::print(baseline_file, "{}", entry.key);
+        for (const auto& stat : entry.stats) {
+            fmt::print(baseline_file, " {:.3f} {:.3f}", stat.mean, stat.stddev);
+        }
+        fmt::print(baseline_file, "\n");
+    }
+}
+
+int CompareBaseline(const Baseline& baseline, const Baseline& current, double tolerance) {
+    if (baseline.machine_class != current.machine_class) {
+        throw std::runtime_error("The baseline was made on \"" + baseline.machine_class + "\", but this is \""
+                                 + current.machine_class + "\".");
+    }
+
+    int regressions = 0;
+    int improvements = 0;
+    for (const auto& entry : current.entries) {
+        const auto base = std::find_if(baseline.entries.cbegin(), baseline.entries.cend(),
+                                       [&entry](const Baseline::Entry& e) { return e.key == entry.key; });
+        if (base == baseline.entries.cend()) {
+            fmt::print(stderr, "{}: not in the baseline\n", entry.key);
+            ++regressions;
+            continue;
+        }
+
+        for (int i = 0; i < Baseline::num_metrics; ++i) {
+            const auto metric = static_cast<Baseline::Metric>(i);
+            const Baseline::Stat& before = base->stats[i];
+            const Baseline::Stat& after = entry.stats[i];
+            // Instruction counts are zero where the host counters aren't available.
+            if (before.mean <= 0.0 || after.mean <= 0.0) {
+                continue;
+            }
+
+            const double noise = 3.0 * std::hypot(before.stddev, after.stddev) / before.mean;
+            const double threshold = std::max(tolerance, noise);
+            const double worsening = Worsening(metric, before.mean, after.mean);
+            if (std::abs(worsening) <= threshold) {
+                continue;
+            }
+
+            const bool regressed = worsening > 0.0;
+            regressions += regressed;
+            improvements += !regressed;
+            fmt::print(stderr, "{}: {} {:.2f} -> {:.2f} ({:+.1f}%, threshold {:.1f}%) {}\n", entry.key,
+                       metric_names[i], before.mean, after.mean, (after.mean - before.mean) / before.mean * 100.0,
+                       threshold * 100.0, regressed ? "REGRESSED" : "improved");
+        }
+    }
+
+    for (const auto& entry : baseline.entries) {
+        const bool present = std::any_of(current.entries.cbegin(), current.entries.cend(),
+                                         [&entry](const Baseline::Entry& e) { return e.key == entry.key; });
+        if (!present) {
+            fmt::print(stderr, "{}: in the baseline but not the job list\n", entry.key);
+            ++regressions;
+        }
+    }
+
+    fmt::print(stderr, "{} regressions, {} improvements against the baseline for {}\n", regressions, improvements,
+               baseline.machine_class);
+    return regressions;
+}
+
+} // End namespace Batch
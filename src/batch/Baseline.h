@@ -0,0 +1,62 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace Batch {
+
+// Performance numbers for each job of a job list on one class of machine, kept so later builds can be checked
+// against them. Each metric is the mean of the job's runs, along with their standard deviation, which is how noisy
+// the metric is on that machine.
+struct Baseline {
+    // Lower frame rates are regressions, and higher frame times and instruction counts are.
+    enum Metric {Fps, P99FrameUs, InstructionsPerFrame, num_metrics};
+
+    struct Stat {
+        double mean = 0.0;
+        double stddev = 0.0;
+    };
+
+    struct Entry {
+        // "<rom> <frames> <movie>", with "-" for no movie.
+        std::string key;
+        std::array<Stat, num_metrics> stats;
+    };
+
+    std::string machine_class;
+    std::vector<Entry> entries;
+};
+
+// The host CPU's model name and thread count. Baselines are only compared on the machine class they were made on.
+std::string MachineClass();
+
+Baseline::Stat MakeStat(const std::vector<double>& samples);
+
+// The first line is "machine <class>", and each line after it is "<key> <mean> <stddev>" for each metric in order.
+// Throw std::runtime_error if the file can't be opened or parsed.
+Baseline LoadBaseline(const std::string& filename);
+void SaveBaseline(const std::string& filename, const Baseline& baseline);
+
+// Prints a line for every job and metric which got worse or better than the noise allows, and a summary at the end,
+// to stderr. A metric's threshold is the larger of the tolerance and three standard deviations of the difference,
+// both as a fraction of the baseline. Returns the number of regressions, counting jobs missing from either side.
+int CompareBaseline(const Baseline& baseline, const Baseline& current, double tolerance);
+
+} // End namespace Batch
@@ -0,0 +1,426 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <fmt/format.h>
+
+#include "batch/BatchJob.h"
+#include "common/HwCounters.h"
+#include "common/PageAlloc.h"
+#include "common/Screenshot.h"
+
+namespace Batch {
+
+namespace {
+
+std::vector<u8> ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+std::vector<u8> ParseHexBytes(const std::string& hex) {
+    if (hex.empty() || hex.size() % 2 != 0) {
+        throw std::invalid_argument("Invalid hex bytes: " + hex);
+    }
+
+    std::vector<u8> bytes;
+    for (std::size_t i = 0; i < hex.size(); i += 2) {
+        std::size_t parsed;
+        bytes.push_back(static_cast<u8>(std::stoul(hex.substr(i, 2), &parsed, 16)));
+        if (parsed != 2) {
+            throw std::invalid_argument("Invalid hex bytes: " + hex);
+        }
+    }
+
+    return bytes;
+}
+
+// Returns false if the token isn't an expectation, in which case it's taken as the movie path.
+bool ParseExpectation(const std::string& token, Expectation& expect) {
+    const std::size_t equals = token.find('=');
+    const std::string key = token.substr(0, equals);
+    const std::string value = (equals == std::string::npos) ? "" : token.substr(equals + 1);
+
+    if (token == "mooneye") {
+        expect.kind = Expectation::Kind::Serial;
+        expect.pass_bytes = {3, 5, 8, 13, 21, 34};
+        expect.fail_bytes = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42};
+    } else if (equals == std::string::npos) {
+        return false;
+    } else if (key == "frame_hash") {
+        expect.kind = Expectation::Kind::FrameHash;
+        expect.frame_hash = std::stoull(value, nullptr, 16);
+    } else if (key == "serial" && !value.empty()) {
+        expect.kind = Expectation::Kind::Serial;
+        expect.pass_bytes.assign(value.cbegin(), value.cend());
+        const std::string failed{"Failed"};
+        expect.fail_bytes.assign(failed.cbegin(), failed.cend());
+    } else if (key.rfind("wram@", 0) == 0 || key.rfind("fastram@", 0) == 0) {
+        expect.kind = Expectation::Kind::Memory;
+        expect.region = (key[0] == 'w') ? CHROMA_MEMORY_WRAM : CHROMA_MEMORY_FAST_RAM;
+        expect.offset = std::stoul(key.substr(key.find('@') + 1), nullptr, 16);
+        expect.pass_bytes = ParseHexBytes(value);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool Contains(const u8* data, std::size_t size, const std::vector<u8>& bytes) {
+    return !bytes.empty() && std::search(data, data + size, bytes.cbegin(), bytes.cend()) != data + size;
+}
+
+Verdict Check(const Expectation& expect, const chroma_instance* instance) {
+    switch (expect.kind) {
+    case Expectation::Kind::FrameHash:
+        return (chroma_get_frame_hash(instance) == expect.frame_hash) ? Verdict::Pass : Verdict::Pending;
+    case Expectation::Kind::Serial: {
+        std::size_t size;
+        const u8* sent = chroma_get_serial_output(instance, &size);
+        if (Contains(sent, size, expect.pass_bytes)) {
+            return Verdict::Pass;
+        }
+        return Contains(sent, size, expect.fail_bytes) ? Verdict::Fail : Verdict::Pending;
+    }
+    case Expectation::Kind::Memory: {
+        std::size_t size;
+        const u8* ram = chroma_get_memory(instance, expect.region, &size);
+        if (expect.offset + expect.pass_bytes.size() > size) {
+            return Verdict::Fail;
+        }
+        return std::equal(expect.pass_bytes.cbegin(), expect.pass_bytes.cend(), ram + expect.offset)
+                   ? Verdict::Pass : Verdict::Pending;
+    }
+    default:
+        return Verdict::Pending;
+    }
+}
+
+} // End anonymous namespace
+
+std::vector<Job> LoadJobList(const std::string& filename) {
+    std::ifstream job_file(filename);
+    if (!job_file) {
+        throw std::runtime_error("Error when attempting to open " + filename);
+    }
+
+    std::vector<Job> jobs;
+    std::string line;
+    for (int line_num = 1; std::getline(job_file, line); ++line_num) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        const std::string invalid_job = fmt::format("Invalid job on line {} of {}: {}", line_num, filename, line);
+        std::istringstream line_stream{line};
+        Job job;
+        if (!(line_stream >> job.rom_path >> job.frames) || job.frames <= 0) {
+            throw std::runtime_error(invalid_job);
+        }
+
+        std::string token;
+        while (line_stream >> token) {
+            try {
+                if (token.rfind("priority=", 0) == 0) {
+                    job.priority = std::stoi(token.substr(9));
+                    continue;
+                } else if (token.rfind("max_seconds=", 0) == 0) {
+                    job.max_seconds = std::stod(token.substr(12));
+                    if (job.max_seconds <= 0.0) {
+                        throw std::runtime_error(invalid_job);
+                    }
+                    continue;
+                }
+            } catch (const std::logic_error&) {
+                throw std::runtime_error(invalid_job);
+            }
+
+            Expectation expect;
+            bool is_expectation;
+            try {
+                is_expectation = ParseExpectation(token, expect);
+            } catch (const std::logic_error&) {
+                // Covers the exceptions from std::stoul as well.
+                throw std::runtime_error(invalid_job);
+            }
+
+            if (is_expectation && job.expect.kind == Expectation::Kind::None) {
+                job.expect = std::move(expect);
+            } else if (!is_expectation && job.movie_path.empty()) {
+                job.movie_path = token;
+            } else {
+                throw std::runtime_error(invalid_job);
+            }
+        }
+
+        jobs.push_back(std::move(job));
+    }
+
+    return jobs;
+}
+
+AssetCache::AssetCache(std::vector<u8> _bios, int _checkpoint_frames)
+        : bios(std::move(_bios))
+        , checkpoint_frames(_checkpoint_frames) {}
+
+template<typename T, typename Load>
+std::shared_ptr<const T> AssetCache::Get(
+        std::unordered_map<std::string, std::shared_future<std::shared_ptr<const T>>>& map,
+        const std::string& path, Load load) {
+    std::promise<std::shared_ptr<const T>> promise;
+    std::shared_future<std::shared_ptr<const T>> future;
+    bool load_here = false;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto it = map.find(path);
+        if (it == map.end()) {
+            it = map.emplace(path, promise.get_future().share()).first;
+            load_here = true;
+        }
+        future = it->second;
+    }
+
+    // Loading happens outside the lock, so other jobs can carry on with what's already loaded.
+    if (load_here) {
+        try {
+            promise.set_value(load());
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    return future.get();
+}
+
+std::shared_ptr<const chroma_rom> AssetCache::Rom(const std::string& path) {
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const chroma_rom>>>* node_roms;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        node_roms = &roms[Common::CurrentNumaNode()];
+    }
+
+    return Get(*node_roms, path, [this, &path]() {
+        const std::vector<u8> rom_bytes = ReadFile(path);
+        chroma_rom* rom = chroma_rom_create(rom_bytes.data(), rom_bytes.size(), bios.data(), bios.size());
+        if (rom == nullptr) {
+            throw std::runtime_error(path + " is neither a GB or GBA game, or it's a GBA game with no BIOS.");
+        }
+
+        return std::shared_ptr<const chroma_rom>(rom, [](const chroma_rom* ptr) {
+            chroma_rom_destroy(const_cast<chroma_rom*>(ptr));
+        });
+    });
+}
+
+std::shared_ptr<const std::vector<Emu::MovieInput>> AssetCache::Movie(const std::string& path) {
+    return Get(movies, path, [&path]() {
+        return std::make_shared<const std::vector<Emu::MovieInput>>(Emu::LoadInputMovie(path));
+    });
+}
+
+std::shared_ptr<const std::vector<u8>> AssetCache::Checkpoint(const std::string& path) {
+    if (checkpoint_frames == 0) {
+        return nullptr;
+    }
+
+    return Get(checkpoints, path, [this, &path]() {
+        const auto rom = Rom(path);
+        const std::unique_ptr<chroma_instance, decltype(&chroma_destroy)> instance{chroma_create_from_rom(rom.get()),
+                                                                                  &chroma_destroy};
+        if (instance == nullptr) {
+            throw std::runtime_error("Could not create an instance for " + path);
+        }
+        chroma_step(instance.get(), 0, checkpoint_frames);
+
+        auto state = std::make_shared<std::vector<u8>>(chroma_save_state(instance.get(), nullptr, 0));
+        chroma_save_state(instance.get(), state->data(), state->size());
+        return std::shared_ptr<const std::vector<u8>>(std::move(state));
+    });
+}
+
+JobRun::JobRun(const Job& _job, std::size_t _index, AssetCache& _assets, const std::string& _screenshot_dir,
+               int _check_state_frames)
+        : job(_job)
+        , index(_index)
+        , assets(_assets)
+        , screenshot_dir(_screenshot_dir)
+        , check_state_frames(_check_state_frames) {}
+
+bool JobRun::RunSlice(int slice_frames, const std::function<bool()>& preempt) {
+    try {
+        Start();
+
+        const Common::HwCounters::Values start_counts = Common::HwCounters::Read();
+        const auto start_time = std::chrono::steady_clock::now();
+
+        bool stopped = false;
+        bool preempted = false;
+        for (int slice_frame = 1; frame < job.frames; ++slice_frame) {
+            for (; next_input < movie->size() && (*movie)[next_input].frame == frame; ++next_input) {
+                const u16 mask = 1 << Emu::ButtonIndex((*movie)[next_input].button);
+                buttons = (*movie)[next_input].press ? (buttons | mask) : (buttons & ~mask);
+            }
+
+            const auto frame_start = std::chrono::steady_clock::now();
+            chroma_run_frame(instance.get(), buttons);
+            const auto frame_end = std::chrono::steady_clock::now();
+            frame_us.push_back(std::chrono::duration<double, std::micro>(frame_end - frame_start).count());
+            result.frames = ++frame;
+            if (const char* hang = chroma_get_hang(instance.get())) {
+                result.hang = hang;
+                result.hang_frame = frame - 1;
+                stopped = true;
+                break;
+            }
+
+            result.verdict = Check(job.expect, instance.get());
+            if (result.verdict != Verdict::Pending) {
+                stopped = true;
+                break;
+            }
+
+            if (job.max_seconds != 0.0
+                    && result.seconds + std::chrono::duration<double>(frame_end - start_time).count()
+                       >= job.max_seconds) {
+                result.out_of_time = frame < job.frames;
+                stopped = true;
+                break;
+            }
+
+            if (check_state_frames != 0 && frame % check_state_frames == 0 && frame < job.frames) {
+                CheckStateRoundTrip();
+            }
+
+            if (slice_frames != 0 && slice_frame % slice_frames == 0 && frame < job.frames && preempt()) {
+                preempted = true;
+                break;
+            }
+        }
+
+        result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        if (Common::HwCounters::Available()[Common::HwCounters::Instructions]) {
+            instructions += Common::HwCounters::Read()[Common::HwCounters::Instructions]
+                            - start_counts[Common::HwCounters::Instructions];
+        }
+
+        if (preempted && !stopped) {
+            Suspend();
+            return false;
+        }
+
+        Finish();
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+
+    instance.reset();
+    rom.reset();
+    movie.reset();
+    return true;
+}
+
+void JobRun::Start() {
+    if (rom == nullptr) {
+        rom = assets.Rom(job.rom_path);
+        movie = job.movie_path.empty() ? std::make_shared<const std::vector<Emu::MovieInput>>()
+                                       : assets.Movie(job.movie_path);
+        frame_us.reserve(job.frames);
+    }
+
+    instance.reset(chroma_create_from_rom(rom.get()));
+    if (instance == nullptr) {
+        throw std::runtime_error("Could not create an instance for " + job.rom_path);
+    }
+    result.system = chroma_get_system(instance.get());
+
+    // A preempted job picks up where it left off, on whichever thread it's resumed on.
+    if (!suspended_state.empty()) {
+        if (chroma_load_state(instance.get(), suspended_state.data(), suspended_state.size()) != 0
+                || chroma_load_host_state(instance.get(), suspended_host_state.data(),
+                                          suspended_host_state.size()) != 0) {
+            throw std::runtime_error("Could not resume a preempted job for " + job.rom_path);
+        }
+        std::vector<u8>().swap(suspended_state);
+        std::vector<u8>().swap(suspended_host_state);
+    } else if (const auto checkpoint = assets.Checkpoint(job.rom_path); checkpoint != nullptr) {
+        if (chroma_load_state(instance.get(), checkpoint->data(), checkpoint->size()) != 0) {
+            throw std::runtime_error("Could not load the init checkpoint for " + job.rom_path);
+        }
+    }
+}
+
+// The host state goes along with the savestate, so the job carries on with the same frame and audio hashes as if
+// it had never stopped.
+void JobRun::Suspend() {
+    suspended_state.resize(chroma_save_state(instance.get(), nullptr, 0));
+    chroma_save_state(instance.get(), suspended_state.data(), suspended_state.size());
+    suspended_host_state.resize(chroma_save_host_state(instance.get(), nullptr, 0));
+    chroma_save_host_state(instance.get(), suspended_host_state.data(), suspended_host_state.size());
+    instance.reset();
+}
+
+void JobRun::CheckStateRoundTrip() {
+    Suspend();
+    const std::vector<u8> state = suspended_state;
+    const std::vector<u8> host_state = suspended_host_state;
+    Start();
+
+    std::vector<u8> reloaded(chroma_save_state(instance.get(), nullptr, 0));
+    chroma_save_state(instance.get(), reloaded.data(), reloaded.size());
+    std::vector<u8> reloaded_host(chroma_save_host_state(instance.get(), nullptr, 0));
+    chroma_save_host_state(instance.get(), reloaded_host.data(), reloaded_host.size());
+    if (reloaded != state || reloaded_host != host_state) {
+        throw std::runtime_error(fmt::format("The savestate from frame {} changed when it was reloaded", frame));
+    }
+}
+
+void JobRun::Finish() {
+    if (Common::HwCounters::Available()[Common::HwCounters::Instructions]) {
+        result.instructions_per_frame = static_cast<double>(instructions) / result.frames;
+    }
+    const auto p99 = frame_us.begin() + frame_us.size() * 99 / 100;
+    std::nth_element(frame_us.begin(), p99, frame_us.end());
+    result.p99_frame_us = *p99;
+    std::vector<double>().swap(frame_us);
+
+    int width, height;
+    const u16* frame_buffer = chroma_get_framebuffer(instance.get(), &width, &height);
+    result.frame_hash = chroma_get_frame_hash(instance.get());
+    result.audio_hash = chroma_get_audio_hash(instance.get());
+
+    if (!screenshot_dir.empty()) {
+        const std::string stem = std::filesystem::path(job.rom_path).stem().string();
+        result.screenshot_path = fmt::format("{}/{}-{}", screenshot_dir, index, stem);
+        std::vector<u8> rgb8_buffer(width * height * 3);
+        Common::BGR5ToRGB8(frame_buffer, width * height, rgb8_buffer.data());
+        Common::WriteImageToFile(rgb8_buffer, result.screenshot_path, width, height);
+        result.screenshot_path += ".png";
+    }
+}
+
+} // End namespace Batch
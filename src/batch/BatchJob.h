@@ -0,0 +1,173 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "emu/HeadlessContext.h"
+#include "lib/chroma.h"
+
+namespace Batch {
+
+// What a test ROM has to do to pass. It's checked after every frame, and the job stops as soon as it's decided.
+struct Expectation {
+    enum class Kind {None, FrameHash, Serial, Memory};
+    Kind kind = Kind::None;
+
+    u64 frame_hash = 0;
+
+    // Serial: passes once the game has sent pass_bytes, and fails once it has sent fail_bytes, if there are any.
+    // Memory: passes once the region holds pass_bytes at the offset.
+    std::vector<u8> pass_bytes;
+    std::vector<u8> fail_bytes;
+    chroma_memory region = CHROMA_MEMORY_WRAM;
+    std::size_t offset = 0;
+};
+
+struct Job {
+    std::string rom_path;
+    int frames;
+    // Empty if the job runs without input.
+    std::string movie_path;
+    Expectation expect;
+    // Jobs with a higher priority are started, and resumed after being preempted, first.
+    int priority = 0;
+    // The host seconds the job may spend running, or 0 for no limit.
+    double max_seconds = 0.0;
+};
+
+// Job lists are text files with one "<rom> <frames> [movie] [expectation] [budgets]" entry per line. Movies are the
+// same text input movies the headless frontend plays. The expectation turns the job into a test, and is one of:
+//     frame_hash=<hex>          the frame hash chroma-batch printed for a known good run
+//     serial=<text>             the game sends the text over the serial port, and fails if it sends "Failed"
+//     mooneye                   the game sends the Fibonacci bytes mooneye-gb tests send when they pass
+//     wram@<hex offset>=<hex>   WRAM holds the given bytes (fastram@ for HRAM or GBA IWRAM)
+// The frame count is the job's frame budget, and it can also be given
+//     priority=<n>              run before jobs with a lower priority (default: 0)
+//     max_seconds=<seconds>     stop the job once it has run for this long
+// Lines starting with # are comments.
+std::vector<Job> LoadJobList(const std::string& filename);
+
+enum class Verdict {Pending, Pass, Fail};
+
+struct JobResult {
+    std::string error;
+    // Set if the watchdog stopped the job, along with the frame the game hung on.
+    std::string hang;
+    int hang_frame = 0;
+    // Set if the job used up its time budget before its frames.
+    bool out_of_time = false;
+    // The number of frames run, which is fewer than the job asked for if it hung or its test was decided early.
+    int frames = 0;
+    // Stays pending for jobs without an expectation, and for tests which ran out of frames.
+    Verdict verdict = Verdict::Pending;
+    int system = CHROMA_SYSTEM_GB;
+    double seconds = 0.0;
+    // The 99th percentile of the host time taken by each frame.
+    double p99_frame_us = 0.0;
+    // Host instructions the job's thread ran per frame, or zero if the host's counters aren't available.
+    double instructions_per_frame = 0.0;
+    u64 frame_hash = 0;
+    u64 audio_hash = 0;
+    std::string screenshot_path;
+};
+
+// Loads each ROM and movie the first time a job asks for it, and shares it with every later job. A job which
+// needs something another thread is still loading waits for it instead of loading it again. ROMs are loaded once
+// per NUMA node, by a job running there, so games read them from local memory.
+class AssetCache {
+public:
+    // The BIOS may be empty, in which case GBA games fail to load. With checkpoint frames, every job of a ROM starts
+    // from a savestate taken that many frames after power on, so the boot only runs once per ROM.
+    AssetCache(std::vector<u8> _bios, int _checkpoint_frames);
+
+    // Throw std::runtime_error if the file can't be loaded.
+    std::shared_ptr<const chroma_rom> Rom(const std::string& path);
+    std::shared_ptr<const std::vector<Emu::MovieInput>> Movie(const std::string& path);
+    // Null without checkpoint frames.
+    std::shared_ptr<const std::vector<u8>> Checkpoint(const std::string& path);
+
+private:
+    const std::vector<u8> bios;
+    const int checkpoint_frames;
+
+    std::mutex mutex;
+    // Keyed by the node the ROM was loaded on.
+    std::map<int, std::unordered_map<std::string, std::shared_future<std::shared_ptr<const chroma_rom>>>> roms;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const std::vector<Emu::MovieInput>>>> movies;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const std::vector<u8>>>> checkpoints;
+
+    template<typename T, typename Load>
+    std::shared_ptr<const T> Get(std::unordered_map<std::string, std::shared_future<std::shared_ptr<const T>>>& map,
+                                 const std::string& path, Load load);
+};
+
+// Runs the job from power on in an instance of its own, a slice at a time. Writes a screenshot of the last frame to
+// the given directory, unless it's empty. Errors are returned in the result rather than thrown. A job which hangs, runs
+// out of time, or passes or fails its test stops early, with the hashes and screenshot of the frame it stopped on.
+//
+// Between slices, the instance is kept as a savestate, so a preempted job only holds onto that much memory.
+//
+// With check state frames, the job is also suspended and resumed in a fresh instance every that many frames, as if
+// it had been preempted, and fails if its state doesn't save back to the same bytes. Its hashes should then match
+// those of the job run straight through.
+class JobRun {
+public:
+    JobRun(const Job& _job, std::size_t _index, AssetCache& _assets, const std::string& _screenshot_dir,
+           int _check_state_frames = 0);
+
+    // Runs the job, stopping after each slice of frames to ask whether to give the thread up. No slice frames runs
+    // the job to the end. Returns true once the job is done.
+    bool RunSlice(int slice_frames, const std::function<bool()>& preempt);
+    const JobResult& Result() const { return result; }
+
+private:
+    const Job& job;
+    const std::size_t index;
+    AssetCache& assets;
+    const std::string screenshot_dir;
+    const int check_state_frames;
+
+    std::shared_ptr<const chroma_rom> rom;
+    std::shared_ptr<const std::vector<Emu::MovieInput>> movie;
+    std::unique_ptr<chroma_instance, decltype(&chroma_destroy)> instance{nullptr, &chroma_destroy};
+    // Only held while the job is preempted.
+    std::vector<u8> suspended_state;
+    std::vector<u8> suspended_host_state;
+
+    int frame = 0;
+    u16 buttons = 0;
+    std::size_t next_input = 0;
+    std::vector<double> frame_us;
+    u64 instructions = 0;
+    JobResult result;
+
+    void Start();
+    void Suspend();
+    void CheckStateRoundTrip();
+    void Finish();
+};
+
+} // End namespace Batch
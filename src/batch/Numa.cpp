@@ -0,0 +1,98 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "batch/Numa.h"
+
+namespace Batch {
+
+namespace {
+
+// Parses a kernel CPU list, like "0-15,32-47".
+std::vector<int> ParseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream stream{list};
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        const std::size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = (dash != std::string::npos) ? std::stoi(range.substr(dash + 1)) : first;
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+} // End anonymous namespace
+
+std::vector<std::vector<int>> NumaNodes() {
+    std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator{"/sys/devices/system/node", error}) {
+        const std::string name = entry.path().filename().string();
+        if (name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+
+        std::ifstream cpulist{entry.path() / "cpulist"};
+        std::string list;
+        // Nodes with memory but no CPUs have an empty list.
+        if (std::getline(cpulist, list) && !list.empty()) {
+            try {
+                nodes.push_back(ParseCpuList(list));
+            } catch (const std::logic_error&) {
+                return {};
+            }
+        }
+    }
+#endif
+
+    if (nodes.size() < 2) {
+        return {};
+    }
+    return nodes;
+}
+
+bool PinThread(const std::vector<int>& cpus) {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+    static_cast<void>(cpus);
+    return false;
+#endif
+}
+
+} // End namespace Batch
@@ -0,0 +1,30 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <vector>
+
+namespace Batch {
+
+// The CPUs of each of the host's NUMA nodes which has any. Empty on hosts with a single node, and outside Linux,
+// where workers are left to the scheduler.
+std::vector<std::vector<int>> NumaNodes();
+
+// Keeps the calling thread on the given CPUs. Returns false if it couldn't be pinned.
+bool PinThread(const std::vector<int>& cpus);
+
+} // End namespace Batch
@@ -0,0 +1,134 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <fmt/format.h>
+
+#include "batch/WorkStealingPool.h"
+#include "batch/Numa.h"
+
+namespace Batch {
+
+WorkStealingPool::WorkStealingPool(unsigned int _num_threads, std::vector<std::vector<int>> _node_cpus)
+        : num_threads(_num_threads)
+        , node_cpus(std::move(_node_cpus))
+        , queues(_num_threads) {}
+
+void WorkStealingPool::Run(std::vector<Task> tasks) {
+    // Dealt out most urgent first, so each queue ends up in priority order and ties run in the order given.
+    std::stable_sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) { return a.priority > b.priority; });
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+        queues[i % num_threads].tasks.push_front(std::move(tasks[i]));
+    }
+    waiting = tasks.size();
+    remaining = tasks.size();
+
+    std::vector<std::thread> workers;
+    for (unsigned int id = 0; id < num_threads; ++id) {
+        workers.emplace_back(&WorkStealingPool::WorkerLoop, this, id);
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::WorkerLoop(unsigned int id) {
+    if (!node_cpus.empty()) {
+        const std::size_t node = id % node_cpus.size();
+        if (!PinThread(node_cpus[node])) {
+            fmt::print(stderr, "Could not pin worker {} to NUMA node {}.\n", id, node);
+        }
+    }
+
+    Task task;
+    while (true) {
+        if (Take(id, task)) {
+            if (task.run()) {
+                if (--remaining == 0) {
+                    WakeIdle();
+                }
+            } else {
+                PutBack(id, std::move(task));
+            }
+            continue;
+        }
+
+        // Nothing is queued, but a task which is still running may be put back.
+        std::unique_lock<std::mutex> lock{idle_mutex};
+        idle_cv.wait(lock, [this]() { return waiting.load() != 0 || remaining.load() == 0; });
+        if (remaining.load() == 0) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::Take(unsigned int id, Task& task) {
+    // Find the queue with the most urgent task, starting with this thread's own so it wins ties.
+    unsigned int best = num_threads;
+    int best_priority = 0;
+    for (unsigned int offset = 0; offset < num_threads; ++offset) {
+        Queue& queue = queues[(id + offset) % num_threads];
+
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        if (!queue.tasks.empty() && (best == num_threads || queue.tasks.back().priority > best_priority)) {
+            best = (id + offset) % num_threads;
+            best_priority = queue.tasks.back().priority;
+        }
+    }
+
+    if (best == num_threads) {
+        return false;
+    }
+
+    // Another thread may have emptied the queue in the meantime, in which case the caller looks again.
+    std::lock_guard<std::mutex> lock{queues[best].mutex};
+    if (queues[best].tasks.empty()) {
+        return false;
+    }
+
+    task = std::move(queues[best].tasks.back());
+    queues[best].tasks.pop_back();
+    --waiting;
+    return true;
+}
+
+void WorkStealingPool::PutBack(unsigned int id, Task task) {
+    {
+        std::lock_guard<std::mutex> lock{queues[id].mutex};
+        auto& tasks = queues[id].tasks;
+        const auto position = std::lower_bound(tasks.begin(), tasks.end(), task.priority,
+                                               [](const Task& queued, int priority) {
+            return queued.priority < priority;
+        });
+        tasks.insert(position, std::move(task));
+    }
+
+    ++waiting;
+    WakeIdle();
+}
+
+void WorkStealingPool::WakeIdle() {
+    // Taking the lock means no idle thread is between checking the counts and going to sleep.
+    {
+        std::lock_guard<std::mutex> lock{idle_mutex};
+    }
+    idle_cv.notify_all();
+}
+
+} // End namespace Batch
@@ -0,0 +1,75 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Batch {
+
+// Runs a fixed set of tasks on a pool of threads. The tasks are dealt out round-robin, and each thread takes the most
+// urgent task waiting, from its own queue if it's as urgent as any other, or else from another thread's. Jobs vary
+// wildly in length, so stealing keeps every thread busy until the last few jobs.
+//
+// A task can also stop partway and ask to be run again, which puts it back behind the waiting tasks of the same
+// priority. Long tasks which do so when other tasks are waiting take turns with them instead of holding a thread.
+//
+// Given the CPUs of each NUMA node, the threads are spread over the nodes and pinned there, so the memory each task
+// allocates and touches first is local to the node it runs on.
+class WorkStealingPool {
+public:
+    struct Task {
+        int priority = 0;
+        // Returns false if the task should be run again later.
+        std::function<bool()> run;
+    };
+
+    explicit WorkStealingPool(unsigned int _num_threads, std::vector<std::vector<int>> _node_cpus = {});
+
+    // Blocks until every task is done.
+    void Run(std::vector<Task> tasks);
+    // Whether any task is waiting for a thread. Running tasks check it before giving their thread up.
+    bool TasksWaiting() const { return waiting.load() != 0; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        // Ordered by priority, with the most urgent at the back.
+        std::deque<Task> tasks;
+    };
+
+    const unsigned int num_threads;
+    const std::vector<std::vector<int>> node_cpus;
+    std::vector<Queue> queues;
+
+    std::atomic<std::size_t> waiting{0};
+    std::atomic<std::size_t> remaining{0};
+    // Idle threads sleep here until a task is put back, or the last one is done.
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+
+    void WorkerLoop(unsigned int id);
+    bool Take(unsigned int id, Task& task);
+    void PutBack(unsigned int id, Task task);
+    void WakeIdle();
+};
+
+} // End namespace Batch
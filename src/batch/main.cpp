@@ -0,0 +1,360 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+#include "batch/Baseline.h"
+#include "batch/BatchJob.h"
+#include "batch/Numa.h"
+#include "batch/WorkStealingPool.h"
+
+namespace {
+
+void DisplayHelp() {
+    fmt::print("Usage: chroma-batch [options] <job list>\n\n");
+    fmt::print("The job list has one \"<rom> <frames> [movie] [expectation]\" job per line. Each job runs from\n");
+    fmt::print("power on in its own instance, and one line of results is printed per job, in job list order.\n\n");
+    fmt::print("A job with an expectation is a test, which stops as soon as it passes or fails, and fails if it\n");
+    fmt::print("runs out of frames first. The expectation is one of:\n");
+    fmt::print("  frame_hash=<hex>              the frame hash printed for a known good run\n");
+    fmt::print("  serial=<text>                 the game sends the text over the serial port (not \"Failed\")\n");
+    fmt::print("  mooneye                       the game sends the bytes mooneye-gb tests send when they pass\n");
+    fmt::print("  wram@<hex offset>=<hex bytes> WRAM holds the bytes (fastram@ for HRAM or GBA IWRAM)\n\n");
+    fmt::print("Besides its frames, a job can be given a budget and a priority, which fails the job once it runs\n");
+    fmt::print("out of time, and runs it before jobs with a lower priority:\n");
+    fmt::print("  max_seconds=<seconds>         the host time the job may spend running\n");
+    fmt::print("  priority=<n>                  higher runs first (default: 0)\n\n");
+    fmt::print("Options:\n");
+    fmt::print("  -h                            display help\n");
+    fmt::print("  -j [N]                        run N jobs at once (default: one per host thread)\n");
+    fmt::print("  --no-numa                     leave the workers unpinned on hosts with several NUMA nodes\n");
+    fmt::print("  --slice [frames]              run jobs this many frames at a time while others are waiting, saving\n");
+    fmt::print("                                and resuming them in turn (default: 3600, 0 runs jobs straight\n");
+    fmt::print("                                through)\n");
+    fmt::print("  --check-states [frames]       also run each job suspended and resumed, as between slices, every\n");
+    fmt::print("                                this many frames, and fail it unless its states reload unchanged\n");
+    fmt::print("                                and its hashes match those of the job run straight through\n");
+    fmt::print("  -o [dir]                      write a screenshot of each job's last frame to dir\n");
+    fmt::print("  --bios [path]                 GBA BIOS (default: gba_bios.bin)\n");
+    fmt::print("  --accuracy [accurate, balanced, fast]\n");
+    fmt::print("                                accuracy and speed trade-offs, as in chroma (default: accurate)\n");
+    fmt::print("  --cpu [interpreter, cached, jit]\n");
+    fmt::print("                                CPU execution mode, which doesn't change the results (default:\n");
+    fmt::print("                                the profile's)\n");
+    fmt::print("  --fixed-point-audio           mix audio through the fixed point IIR filter, so the audio hashes\n");
+    fmt::print("                                match across hosts\n");
+    fmt::print("  --watchdog [frames]           stop jobs which hang for good, or leave the screen off for this\n");
+    fmt::print("                                many frames in a row\n");
+    fmt::print("  --init-checkpoint [frames]    boot each ROM once, for this many frames, and start all of its jobs\n");
+    fmt::print("                                from there, with their frames and movies counted from that point\n");
+    fmt::print("  --runs [N]                    run each job N times, and report the mean and spread of its timings\n");
+    fmt::print("  --save-baseline [file]        save each job's frame rate, 99th percentile frame time and host\n");
+    fmt::print("                                instructions per frame, for this machine class, to the file\n");
+    fmt::print("  --baseline [file]             compare against a saved baseline, and exit with 1 if any job got\n");
+    fmt::print("                                slower by more than the noise between runs and the tolerance\n");
+    fmt::print("  --tolerance [percent]         the smallest change --baseline reports (default: 5)\n");
+}
+
+std::vector<u8> LoadBios(const std::string& bios_path) {
+    std::ifstream bios_file(bios_path, std::ios_base::binary);
+    if (!bios_file) {
+        // GB jobs don't need it, and GBA jobs report the missing BIOS on their own.
+        return {};
+    }
+
+    return std::vector<u8>(std::istreambuf_iterator<char>(bios_file), std::istreambuf_iterator<char>());
+}
+
+} // End anonymous namespace
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> tokens(argv + 1, argv + argc);
+    if (tokens.empty() || std::find(tokens.cbegin(), tokens.cend(), "-h") != tokens.cend()) {
+        DisplayHelp();
+        return 1;
+    }
+
+    unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string screenshot_dir;
+    std::string bios_path = "gba_bios.bin";
+    chroma_profile profile = CHROMA_PROFILE_ACCURATE;
+    std::optional<chroma_cpu_mode> cpu_mode;
+    bool fixed_point_audio = false;
+    int runs = 1;
+    int checkpoint_frames = 0;
+    std::string save_baseline_path;
+    std::string baseline_path;
+    double tolerance = 0.05;
+    bool numa = true;
+    int slice_frames = 3600;
+    int check_state_frames = 0;
+    try {
+        for (std::size_t i = 0; i + 1 < tokens.size(); ++i) {
+            if (tokens[i] == "-j" && i + 2 < tokens.size()) {
+                num_threads = std::stoi(tokens[++i]);
+                if (num_threads == 0 || num_threads > 1024) {
+                    throw std::invalid_argument("Invalid number of jobs specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "--no-numa") {
+                numa = false;
+            } else if (tokens[i] == "--slice" && i + 2 < tokens.size()) {
+                slice_frames = std::stoi(tokens[++i]);
+                if (slice_frames < 0) {
+                    throw std::invalid_argument("Invalid slice frame count specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "--check-states" && i + 2 < tokens.size()) {
+                check_state_frames = std::stoi(tokens[++i]);
+                if (check_state_frames < 1) {
+                    throw std::invalid_argument("Invalid state check frame count specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "-o" && i + 2 < tokens.size()) {
+                screenshot_dir = tokens[++i];
+            } else if (tokens[i] == "--bios" && i + 2 < tokens.size()) {
+                bios_path = tokens[++i];
+            } else if (tokens[i] == "--cpu" && i + 2 < tokens.size()) {
+                const std::string& mode = tokens[++i];
+                if (mode == "interpreter") {
+                    cpu_mode = CHROMA_CPU_INTERPRETER;
+                } else if (mode == "cached") {
+                    cpu_mode = CHROMA_CPU_CACHED;
+                } else if (mode == "jit") {
+                    cpu_mode = CHROMA_CPU_JIT;
+                } else {
+                    throw std::invalid_argument("Invalid CPU execution mode specified: " + mode);
+                }
+            } else if (tokens[i] == "--accuracy" && i + 2 < tokens.size()) {
+                const std::string& name = tokens[++i];
+                if (name == "accurate") {
+                    profile = CHROMA_PROFILE_ACCURATE;
+                } else if (name == "balanced") {
+                    profile = CHROMA_PROFILE_BALANCED;
+                } else if (name == "fast") {
+                    profile = CHROMA_PROFILE_FAST;
+                } else {
+                    throw std::invalid_argument("Invalid accuracy profile specified: " + name);
+                }
+            } else if (tokens[i] == "--fixed-point-audio") {
+                fixed_point_audio = true;
+            } else if (tokens[i] == "--watchdog" && i + 2 < tokens.size()) {
+                const int blank_frames = std::stoi(tokens[++i]);
+                if (blank_frames < 1) {
+                    throw std::invalid_argument("Invalid watchdog frame count specified: " + tokens[i]);
+                }
+                chroma_set_watchdog(blank_frames);
+            } else if (tokens[i] == "--init-checkpoint" && i + 2 < tokens.size()) {
+                checkpoint_frames = std::stoi(tokens[++i]);
+                if (checkpoint_frames < 1) {
+                    throw std::invalid_argument("Invalid checkpoint frame count specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "--runs" && i + 2 < tokens.size()) {
+                runs = std::stoi(tokens[++i]);
+                if (runs < 1 || runs > 1000) {
+                    throw std::invalid_argument("Invalid run count specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "--save-baseline" && i + 2 < tokens.size()) {
+                save_baseline_path = tokens[++i];
+            } else if (tokens[i] == "--baseline" && i + 2 < tokens.size()) {
+                baseline_path = tokens[++i];
+            } else if (tokens[i] == "--tolerance" && i + 2 < tokens.size()) {
+                tolerance = std::stod(tokens[++i]) / 100.0;
+                if (tolerance < 0.0) {
+                    throw std::invalid_argument("Invalid tolerance specified: " + tokens[i]);
+                }
+            } else {
+                throw std::invalid_argument("Invalid option: " + tokens[i]);
+            }
+        }
+    } catch (const std::logic_error& e) {
+        // Covers the exceptions from std::stoi as well.
+        fmt::print("{}\n\n", e.what());
+        DisplayHelp();
+        return 1;
+    }
+
+    // The CPU mode overrides the profile's, whichever order they were given in.
+    chroma_set_profile(profile);
+    if (cpu_mode) {
+        chroma_set_cpu_mode(*cpu_mode);
+    }
+    chroma_set_fixed_point_audio(fixed_point_audio);
+
+    std::vector<Batch::Job> jobs;
+    Batch::Baseline baseline;
+    try {
+        jobs = Batch::LoadJobList(tokens.back());
+        if (!baseline_path.empty()) {
+            baseline = Batch::LoadBaseline(baseline_path);
+        }
+        if (!screenshot_dir.empty()) {
+            std::filesystem::create_directories(screenshot_dir);
+        }
+    } catch (const std::exception& e) {
+        fmt::print("{}\n", e.what());
+        return 1;
+    }
+
+    Batch::AssetCache assets{LoadBios(bios_path), checkpoint_frames};
+    // Every run of every job goes in the pool at once. Only the first run of each writes a screenshot.
+    std::vector<std::vector<Batch::JobResult>> results(runs, std::vector<Batch::JobResult>(jobs.size()));
+    // The twins of the first run's jobs which check savestates.
+    std::vector<Batch::JobResult> check_results(jobs.size());
+
+    // Workers are spread over the NUMA nodes, where each allocates its instances and copies of the ROMs.
+    Batch::WorkStealingPool pool{std::min<unsigned int>(num_threads, std::max<std::size_t>(jobs.size(), 1)),
+                                 numa ? Batch::NumaNodes() : std::vector<std::vector<int>>{}};
+    const auto tasks_waiting = [&pool]() { return pool.TasksWaiting(); };
+
+    std::vector<Batch::WorkStealingPool::Task> tasks;
+    for (int run = 0; run < runs; ++run) {
+        for (std::size_t i = 0; i < jobs.size(); ++i) {
+            auto job_run = std::make_shared<Batch::JobRun>(jobs[i], i, assets, (run == 0) ? screenshot_dir : "");
+            tasks.push_back({jobs[i].priority, [&, job_run, run, i]() {
+                if (!job_run->RunSlice(slice_frames, tasks_waiting)) {
+                    return false;
+                }
+                results[run][i] = job_run->Result();
+                return true;
+            }});
+        }
+    }
+    if (check_state_frames != 0) {
+        for (std::size_t i = 0; i < jobs.size(); ++i) {
+            auto job_run = std::make_shared<Batch::JobRun>(jobs[i], i, assets, "", check_state_frames);
+            tasks.push_back({jobs[i].priority, [&, job_run, i]() {
+                if (!job_run->RunSlice(slice_frames, tasks_waiting)) {
+                    return false;
+                }
+                check_results[i] = job_run->Result();
+                return true;
+            }});
+        }
+    }
+
+    const auto start_time = std::chrono::steady_clock::now();
+    pool.Run(std::move(tasks));
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    int failed = 0;
+    long long total_frames = 0;
+    Batch::Baseline current{Batch::MachineClass(), {}};
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        const Batch::Job& job = jobs[i];
+        const Batch::JobResult& result = results[0][i];
+        if (!result.error.empty()) {
+            ++failed;
+            fmt::print("{{\"job\": {}, \"rom\": \"{}\", \"error\": \"{}\"}}\n", i, job.rom_path, result.error);
+            continue;
+        }
+        if (check_state_frames != 0) {
+            const Batch::JobResult& check = check_results[i];
+            std::string error = check.error;
+            // Time budgets stop the two runs on different frames.
+            if (error.empty() && !check.out_of_time && !result.out_of_time
+                    && (check.frames != result.frames || check.frame_hash != result.frame_hash
+                        || check.audio_hash != result.audio_hash)) {
+                error = fmt::format("Reloading savestates changed the result: frame {} hashes {:016X} {:016X}, "
+                                    "against frame {} hashes {:016X} {:016X} run straight through", check.frames,
+                                    check.frame_hash, check.audio_hash, result.frames, result.frame_hash,
+                                    result.audio_hash);
+            }
+            if (!error.empty()) {
+                ++failed;
+                fmt::print("{{\"job\": {}, \"rom\": \"{}\", \"state_check\": \"{}\"}}\n", i, job.rom_path, error);
+                continue;
+            }
+        }
+        if (result.out_of_time) {
+            ++failed;
+            total_frames += result.frames;
+            fmt::print("{{\"job\": {}, \"rom\": \"{}\", \"out_of_time\": {:.3f}, \"frames\": {}, "
+                       "\"frame_hash\": \"{:016X}\", \"screenshot\": \"{}\"}}\n",
+                       i, job.rom_path, result.seconds, result.frames, result.frame_hash, result.screenshot_path);
+            continue;
+        }
+        if (!result.hang.empty()) {
+            ++failed;
+            total_frames += result.frames;
+            fmt::print("{{\"job\": {}, \"rom\": \"{}\", \"hang\": \"{}\", \"hang_frame\": {}, "
+                       "\"frame_hash\": \"{:016X}\", \"screenshot\": \"{}\"}}\n",
+                       i, job.rom_path, result.hang, result.hang_frame, result.frame_hash, result.screenshot_path);
+            continue;
+        }
+
+        std::string test;
+        if (job.expect.kind != Batch::Expectation::Kind::None) {
+            const bool passed = (result.verdict == Batch::Verdict::Pass);
+            failed += !passed;
+            test = fmt::format("\"test\": \"{}\", ", passed ? "pass" : "fail");
+        }
+
+        std::array<std::vector<double>, Batch::Baseline::num_metrics> samples;
+        for (int run = 0; run < runs; ++run) {
+            const Batch::JobResult& run_result = results[run][i];
+            total_frames += run_result.frames;
+            samples[Batch::Baseline::Fps].push_back(run_result.frames / run_result.seconds);
+            samples[Batch::Baseline::P99FrameUs].push_back(run_result.p99_frame_us);
+            samples[Batch::Baseline::InstructionsPerFrame].push_back(run_result.instructions_per_frame);
+        }
+
+        Batch::Baseline::Entry entry{fmt::format("{} {} {}", job.rom_path, job.frames,
+                                                 job.movie_path.empty() ? "-" : job.movie_path), {}};
+        for (int m = 0; m < Batch::Baseline::num_metrics; ++m) {
+            entry.stats[m] = Batch::MakeStat(samples[m]);
+        }
+
+        fmt::print("{{\"job\": {}, \"rom\": \"{}\", \"movie\": \"{}\", \"system\": \"{}\", {}\"frames\": {}, "
+                   "\"seconds\": {:.3f}, \"fps\": {:.2f}, \"fps_stddev\": {:.2f}, \"p99_frame_us\": {:.1f}, "
+                   "\"instructions_per_frame\": {:.0f}, \"frame_hash\": \"{:016X}\", \"audio_hash\": \"{:016X}\", "
+                   "\"screenshot\": \"{}\"}}\n",
+                   i, job.rom_path, job.movie_path, (result.system == CHROMA_SYSTEM_GBA) ? "gba" : "gb", test,
+                   result.frames, result.seconds, entry.stats[Batch::Baseline::Fps].mean,
+                   entry.stats[Batch::Baseline::Fps].stddev, entry.stats[Batch::Baseline::P99FrameUs].mean,
+                   entry.stats[Batch::Baseline::InstructionsPerFrame].mean, result.frame_hash, result.audio_hash,
+                   result.screenshot_path);
+        current.entries.push_back(std::move(entry));
+    }
+
+    fmt::print("{{\"jobs\": {}, \"failed\": {}, \"threads\": {}, \"seconds\": {:.3f}, \"total_fps\": {:.2f}}}\n",
+               jobs.size(), failed, num_threads, seconds, total_frames / seconds);
+
+    try {
+        if (!save_baseline_path.empty()) {
+            Batch::SaveBaseline(save_baseline_path, current);
+        }
+        if (!baseline_path.empty() && Batch::CompareBaseline(baseline, current, tolerance) != 0) {
+            failed = std::max(failed, 1);
+        }
+    } catch (const std::runtime_error& e) {
+        fmt::print("{}\n", e.what());
+        return 1;
+    }
+
+    return (failed == 0) ? 0 : 1;
+}
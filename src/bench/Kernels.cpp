@@ -0,0 +1,255 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <array>
+#include <cstdint>
+#include <random>
+
+#include "bench/Kernels.h"
+#include "common/BlipBuffer.h"
+#include "common/Resampler.h"
+#include "common/Vec4f.h"
+#include "gb/core/GameBoy.h"
+#include "gb/lcd/Lcd.h"
+#include "gb/memory/Memory.h"
+#include "gba/core/Core.h"
+#include "gba/cpu/Cpu.h"
+#include "gba/lcd/Lcd.h"
+#include "gba/memory/Memory.h"
+
+namespace Bench {
+
+namespace {
+
+// Every kernel cycles through this many inputs, which is a power of two so the index is a mask.
+constexpr std::size_t num_inputs = 0x1000;
+constexpr std::size_t input_mask = num_inputs - 1;
+
+struct Region {
+    u32 base;
+    u32 size;
+};
+
+// Random word aligned addresses spread evenly over the regions, the same on every run.
+std::vector<u32> SampleAddresses(const std::vector<Region>& regions) {
+    std::mt19937 rng{1};
+    std::vector<u32> addrs(num_inputs);
+    for (std::size_t i = 0; i < num_inputs; ++i) {
+        const Region& region = regions[i % regions.size()];
+        addrs[i] = region.base + (rng() % region.size & ~0x3u);
+    }
+    return addrs;
+}
+
+// Square waves on each channel at different pitches and volumes, stepping about as often as the APU's do.
+void FillSquareWaves(std::vector<int>& left, std::vector<int>& right) {
+    for (std::size_t i = 0; i < left.size(); ++i) {
+        left[i] = ((i / 40) % 2 == 0) ? 0x300 : -0x300;
+        right[i] = ((i / 97) % 2 == 0) ? 0x180 : -0x180;
+    }
+}
+
+template<typename Resampler>
+Kernel ResamplerKernel(const std::string& name, Resampler resampler) {
+    std::vector<int> left(Common::IirResampler::input_samples_per_frame);
+    std::vector<int> right(Common::IirResampler::input_samples_per_frame);
+    FillSquareWaves(left, right);
+
+    return {name, [resampler, left, right](u64 ops) mutable {
+        Common::IirResampler::Output output{};
+        u64 sum = 0;
+        for (u64 op = 0; op < ops; ++op) {
+            for (int i = 0; i < Common::IirResampler::input_samples_per_frame; ++i) {
+                resampler.Store(i, left[i], right[i]);
+                if (Common::IirResampler::EndsBlock(i)) {
+                    resampler.FilterBlock(i, output);
+                }
+            }
+            sum += output[0] + output[output.size() - 1];
+        }
+        return sum;
+    }};
+}
+
+} // End anonymous namespace
+
+std::vector<Kernel> Kernels::ForAudio() {
+    // As the cores do, so denormals in the filter tails don't slow the float filters down.
+    Common::Vec4f::SetFlushToZero();
+
+    std::vector<Kernel> kernels;
+    kernels.push_back(ResamplerKernel("iir_resampler", Common::IirResampler{8, false}));
+    kernels.push_back(ResamplerKernel("fixed_iir_resampler", Common::IirResampler{8, true}));
+    kernels.push_back(ResamplerKernel("linear_resampler",
+                                      Common::FirResampler{Common::FirResampler::Kernel::Linear, 8}));
+    kernels.push_back(ResamplerKernel("sinc_resampler", Common::FirResampler{Common::FirResampler::Kernel::Sinc, 8}));
+
+    std::vector<int> left(Common::IirResampler::input_samples_per_frame);
+    std::vector<int> right(Common::IirResampler::input_samples_per_frame);
+    FillSquareWaves(left, right);
+    Common::BlipBuffer blip{Common::IirResampler::input_samples_per_frame,
+                                  Common::IirResampler::output_samples_per_frame,
+                                  8.0f / Common::IirResampler::interpolation_factor};
+    kernels.push_back({"blip_buffer", [blip, left, right](u64 ops) mutable {
+        Common::IirResampler::Output output{};
+        u64 sum = 0;
+        for (u64 op = 0; op < ops; ++op) {
+            for (int i = 0; i < Common::IirResampler::input_samples_per_frame; ++i) {
+                blip.SetAmplitude(i, left[i], right[i]);
+            }
+            blip.ReadFrame(output);
+            sum += output[0] + output[output.size() - 1];
+        }
+        return sum;
+    }});
+
+    return kernels;
+}
+
+std::vector<Kernel> Kernels::ForGba(Gba::Core& core) {
+    Gba::Cpu& cpu = *core.cpu;
+    Gba::Memory& mem = *core.mem;
+    Gba::Lcd& lcd = *core.lcd;
+
+    // Decoding goes over the start of the cartridge, read as ARM words and as pairs of Thumb halfwords.
+    std::vector<u32> opcodes(num_inputs);
+    for (std::size_t i = 0; i < num_inputs; ++i) {
+        opcodes[i] = mem.ReadMem<u32>(0x0800'0000 + static_cast<u32>(i) * 4);
+    }
+
+    // BIOS, EWRAM, IWRAM, IO, palette RAM, VRAM, OAM and ROM.
+    const std::vector<u32> addrs = SampleAddresses({{0x0000'0000, 0x4000}, {0x0200'0000, 0x4'0000},
+                                                    {0x0300'0000, 0x8000}, {0x0400'0000, 0x400},
+                                                    {0x0500'0000, 0x400}, {0x0600'0000, 0x1'8000},
+                                                    {0x0700'0000, 0x400}, {0x0800'0000, 0x4'0000}});
+
+    std::vector<Kernel> kernels;
+    kernels.push_back({"gba_decode_arm", [&cpu, opcodes](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            sum += reinterpret_cast<std::uintptr_t>(cpu.DecodeArm(opcodes[i & input_mask]));
+        }
+        return sum;
+    }});
+    kernels.push_back({"gba_decode_thumb", [&cpu, opcodes](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            const u32 pair = opcodes[(i >> 1) & input_mask];
+            sum += reinterpret_cast<std::uintptr_t>(cpu.DecodeThumb(static_cast<Gba::Thumb>(pair >> (i & 1) * 16)));
+        }
+        return sum;
+    }});
+
+    kernels.push_back({"gba_read_mem_u16", [&mem, addrs](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            sum += mem.ReadMem<u16>(addrs[i & input_mask]);
+        }
+        return sum;
+    }});
+    kernels.push_back({"gba_read_mem_u32", [&mem, addrs](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            sum += mem.ReadMem<u32>(addrs[i & input_mask]);
+        }
+        return sum;
+    }});
+    kernels.push_back({"gba_access_time_u16", [&mem, addrs](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            sum += mem.AccessTime<u16>(addrs[i & input_mask]);
+        }
+        return sum;
+    }});
+    kernels.push_back({"gba_access_time_u32", [&mem, addrs](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            sum += mem.AccessTime<u32>(addrs[i & input_mask]);
+        }
+        return sum;
+    }});
+
+    // A tile row per operation, stepping through the rows of each tile in the first 64KB of VRAM, with every palette
+    // and both flips.
+    kernels.push_back({"gba_tile_pixels_4bpp", [&lcd](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            const int tile = static_cast<int>(i >> 3) & 0x7FF;
+            const auto pixels = lcd.GetTilePixels(tile * 32, false, tile & 1, i & 7, tile & 0xF, 0);
+            sum += pixels[0] + pixels[7];
+        }
+        return sum;
+    }});
+    kernels.push_back({"gba_tile_pixels_8bpp", [&lcd](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            const int tile = static_cast<int>(i >> 3) & 0x3FF;
+            const auto pixels = lcd.GetTilePixels(tile * 64, true, tile & 1, i & 7, 0, 0);
+            sum += pixels[0] + pixels[7];
+        }
+        return sum;
+    }});
+
+    // Redraws the visible lines over the same registers and VRAM. The affine reference points carry on from line to
+    // line as they would on hardware, which only changes which texels are fetched.
+    kernels.push_back({"gba_draw_scanline", [&lcd](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            lcd.draw_line = static_cast<int>(i % Gba::Lcd::v_pixels);
+            lcd.DrawScanline();
+            sum += lcd.back_frame[lcd.draw_line * Gba::Lcd::h_pixels];
+        }
+        return sum;
+    }});
+
+    return kernels;
+}
+
+std::vector<Kernel> Kernels::ForGb(Gb::GameBoy& gameboy) {
+    const Gb::Memory& mem = *gameboy.mem;
+    Gb::Lcd& lcd = *gameboy.lcd;
+
+    std::vector<u16> addrs(num_inputs);
+    std::mt19937 rng{1};
+    for (u16& addr : addrs) {
+        addr = static_cast<u16>(rng());
+    }
+
+    std::vector<Kernel> kernels;
+    kernels.push_back({"gb_read_mem", [&mem, addrs](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            sum += mem.ReadMem(addrs[i & input_mask]);
+        }
+        return sum;
+    }});
+
+    // A row per operation, stepping through the rows of the first 256 tiles in VRAM bank 0.
+    kernels.push_back({"gb_decode_palette_indices", [&mem, &lcd](u64 ops) {
+        u64 sum = 0;
+        for (u64 i = 0; i < ops; ++i) {
+            const u8* tile = mem.VramPointer(static_cast<u16>(0x8000 + ((i >> 3) & 0xFF) * 16), 0);
+            lcd.DecodePaletteIndices(tile, (i & 7) * 2);
+            sum += lcd.pixel_colours[i & 7];
+        }
+        return sum;
+    }});
+
+    return kernels;
+}
+
+} // End namespace Bench
@@ -0,0 +1,52 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Gb { class GameBoy; }
+namespace Gba { class Core; }
+
+namespace Bench {
+
+// A kernel timed on its own. Run does the given number of operations and returns something computed from all of
+// their results, so the compiler can't leave any of them out.
+struct Kernel {
+    std::string name;
+    std::function<u64(u64 ops)> run;
+};
+
+// The hot kernels of both cores. A friend of the classes whose private kernels it times, so that their interfaces
+// don't grow for the benchmark's sake.
+class Kernels {
+public:
+    // One frame of input through each of the audio filters.
+    static std::vector<Kernel> ForAudio();
+    // The decode tables, over the opcodes at the start of the cartridge, and memory reads, access times, tile
+    // decoding and whole scanlines over the core's current state. The core's memory and LCD are used in place, so
+    // the core shouldn't be run again afterwards.
+    static std::vector<Kernel> ForGba(Gba::Core& core);
+    // Memory reads across the address space, and tile row decoding over the core's current VRAM.
+    static std::vector<Kernel> ForGb(Gb::GameBoy& gameboy);
+};
+
+} // End namespace Bench
@@ -0,0 +1,240 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+#include "common/CommonEnums.h"
+#include "common/MappedRom.h"
+#include "common/Movie.h"
+#include "common/Rewind.h"
+#include "common/TraceTrigger.h"
+#include "common/SaveFlusher.h"
+#include "common/Screenshot.h"
+#include "common/AvRecorder.h"
+#include "common/LinkCable.h"
+#include "common/Netplay.h"
+#include "common/RtcSource.h"
+#include "common/Metrics.h"
+#include "common/Watchdog.h"
+#include "bench/Kernels.h"
+#include "emu/HeadlessContext.h"
+#include "gb/core/GameBoy.h"
+#include "gb/memory/CartridgeHeader.h"
+#include "gba/core/Core.h"
+#include "gba/memory/Memory.h"
+
+namespace {
+
+void DisplayHelp() {
+    fmt::print("Usage: chroma-bench [options]\n\n");
+    fmt::print("Times the hot kernels of both cores on their own, and prints one line of results per kernel. The\n");
+    fmt::print("decode tables and the audio filters are always timed. The memory and LCD kernels of a system are\n");
+    fmt::print("timed over the state a game of that system is in after running for a while, so they're only\n");
+    fmt::print("timed when given one.\n\n");
+    fmt::print("Options:\n");
+    fmt::print("  -h                            display help\n");
+    fmt::print("  --gba [rom]                   time the GBA kernels over this game\n");
+    fmt::print("  --gb [rom]                    time the GB kernels over this game\n");
+    fmt::print("  --bios [path]                 GBA BIOS (default: gba_bios.bin)\n");
+    fmt::print("  --frames [N]                  frames to run each game for before timing (default: 300)\n");
+    fmt::print("  --filter [text]               only time kernels whose names contain the text\n");
+    fmt::print("  --min-time [ms]               host time each timed run of a kernel takes at least (default: 200)\n");
+    fmt::print("  --runs [N]                    timed runs of each kernel, of which the median is reported\n");
+    fmt::print("                                (default: 5)\n");
+}
+
+template<typename T>
+Common::RomVector<T> LoadRom(const std::string& rom_path) {
+    return Common::RomVector<T>(std::filesystem::file_size(rom_path) / sizeof(T),
+                                Common::RomAllocator<T>(std::make_shared<Common::MappedRomFile>(rom_path)));
+}
+
+std::vector<u32> LoadBios(const std::string& bios_path) {
+    std::ifstream bios_file(bios_path, std::ios_base::binary);
+    if (!bios_file || std::filesystem::file_size(bios_path) != 0x4000) {
+        throw std::runtime_error("Could not load a 16KB GBA BIOS from " + bios_path);
+    }
+
+    std::vector<u32> bios(0x4000 / sizeof(u32));
+    bios_file.read(reinterpret_cast<char*>(bios.data()), 0x4000);
+    return bios;
+}
+
+// Where each run's result goes, so that none of the work can be optimized away.
+volatile u64 result_sink = 0;
+
+struct Timing {
+    double median_ns;
+    double min_ns;
+    u64 ops;
+};
+
+Timing TimeKernel(const Bench::Kernel& kernel, double min_seconds, int runs) {
+    using Clock = std::chrono::steady_clock;
+    const auto time_ops = [&kernel](u64 ops) {
+        const auto start = Clock::now();
+        result_sink = kernel.run(ops);
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    // Doubles the operations until a run takes long enough for the clock's resolution not to matter. This also
+    // warms the caches and the branch predictors up.
+    u64 ops = 1;
+    while (time_ops(ops) < min_seconds) {
+        ops *= 2;
+    }
+
+    std::vector<double> ns_per_op;
+    for (int run = 0; run < runs; ++run) {
+        ns_per_op.push_back(time_ops(ops) * 1e9 / ops);
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+
+    return {ns_per_op[ns_per_op.size() / 2], ns_per_op.front(), ops};
+}
+
+} // End anonymous namespace
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> tokens(argv + 1, argv + argc);
+    if (std::find(tokens.cbegin(), tokens.cend(), "-h") != tokens.cend()) {
+        DisplayHelp();
+        return 1;
+    }
+
+    std::string gba_path;
+    std::string gb_path;
+    std::string bios_path = "gba_bios.bin";
+    std::string filter;
+    int frames = 300;
+    double min_seconds = 0.2;
+    int runs = 5;
+    try {
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            if (i + 1 == tokens.size()) {
+                throw std::invalid_argument("Invalid option: " + tokens[i]);
+            } else if (tokens[i] == "--gba") {
+                gba_path = tokens[++i];
+            } else if (tokens[i] == "--gb") {
+                gb_path = tokens[++i];
+            } else if (tokens[i] == "--bios") {
+                bios_path = tokens[++i];
+            } else if (tokens[i] == "--frames") {
+                frames = std::stoi(tokens[++i]);
+                if (frames < 0) {
+                    throw std::invalid_argument("Invalid frame count specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "--filter") {
+                filter = tokens[++i];
+            } else if (tokens[i] == "--min-time") {
+                min_seconds = std::stod(tokens[++i]) / 1000.0;
+                if (min_seconds <= 0.0) {
+                    throw std::invalid_argument("Invalid minimum time specified: " + tokens[i]);
+                }
+            } else if (tokens[i] == "--runs") {
+                runs = std::stoi(tokens[++i]);
+                if (runs < 1 || runs > 1000) {
+                    throw std::invalid_argument("Invalid run count specified: " + tokens[i]);
+                }
+            } else {
+                throw std::invalid_argument("Invalid option: " + tokens[i]);
+            }
+        }
+    } catch (const std::logic_error& e) {
+        // Covers the exceptions from std::stoi as well.
+        fmt::print("{}\n\n", e.what());
+        DisplayHelp();
+        return 1;
+    }
+
+    // The cores are kept until every kernel has run, since their kernels use them in place. Both are created with
+    // the accurate profile's settings, on the emulated clock, and without any of the optional features.
+    const Common::RtcSettings rtc_settings{true, Common::RtcSettings::reproducible_epoch};
+    Emu::HeadlessContext gba_frontend;
+    Emu::HeadlessContext gb_frontend;
+    std::vector<u32> bios;
+    Common::RomVector<u16> gba_rom;
+    Common::RomVector<u8> gb_rom;
+    Gb::Console console = Gb::Console::Default;
+    std::unique_ptr<Gb::CartridgeHeader> cart_header;
+    std::unique_ptr<Gba::Core> gba_core;
+    std::unique_ptr<Gb::GameBoy> gameboy;
+
+    std::vector<Bench::Kernel> kernels;
+    try {
+        kernels = Bench::Kernels::ForAudio();
+
+        if (!gba_path.empty()) {
+            bios = LoadBios(bios_path);
+            gba_rom = LoadRom<u16>(gba_path);
+            Gba::Memory::CheckHeader(gba_rom);
+            gba_core = std::make_unique<Gba::Core>(gba_frontend, bios, gba_rom, "", LogLevel::None, LogOverflow::Block,
+                                                   ExecMode::Interpreter, AudioFilter::Iir, 0, false, false, false, 0,
+                                                   0, "", Common::TraceTrigger{}, Common::RewindSettings{}, 0,
+                                                   Common::MovieSettings{}, Common::SaveSettings{},
+                                                   Common::ScreenshotSettings{}, Common::RecordSettings{},
+                                                   Common::LinkSettings{}, Common::NetplaySettings{}, rtc_settings,
+                                                   Common::HugePages::Off, Common::MetricsSettings{},
+                                                   Common::WatchdogSettings{}, false, true);
+            gba_core->RunFrames(frames);
+
+            const auto gba_kernels = Bench::Kernels::ForGba(*gba_core);
+            kernels.insert(kernels.end(), gba_kernels.begin(), gba_kernels.end());
+        }
+
+        if (!gb_path.empty()) {
+            gb_rom = LoadRom<u8>(gb_path);
+            cart_header = std::make_unique<Gb::CartridgeHeader>(console, gb_rom, false);
+            gameboy = std::make_unique<Gb::GameBoy>(console, *cart_header, gb_frontend, "", gb_rom, AudioFilter::Iir,
+                                                    LogLevel::None, LogOverflow::Block, 0, 0, 0,
+                                                    Common::TraceTrigger{}, Common::RewindSettings{}, 0,
+                                                    Common::MovieSettings{}, Common::SaveSettings{},
+                                                    Common::ScreenshotSettings{}, Common::RecordSettings{},
+                                                    Common::LinkSettings{}, Common::NetplaySettings{}, rtc_settings,
+                                                    Common::MetricsSettings{}, Common::WatchdogSettings{},
+                                                    ExecMode::Interpreter, GbRenderer::Scanline, false);
+            gameboy->RunFrames(frames);
+
+            const auto gb_kernels = Bench::Kernels::ForGb(*gameboy);
+            kernels.insert(kernels.end(), gb_kernels.begin(), gb_kernels.end());
+        }
+    } catch (const std::exception& e) {
+        fmt::print("{}\n", e.what());
+        return 1;
+    }
+
+    for (const Bench::Kernel& kernel : kernels) {
+        if (kernel.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        const Timing timing = TimeKernel(kernel, min_seconds, runs);
+        fmt::print("{{\"kernel\": \"{}\", \"ns_per_op\": {:.3f}, \"min_ns_per_op\": {:.3f}, \"ops\": {}}}\n",
+                   kernel.name, timing.median_ns, timing.min_ns, timing.ops);
+    }
+
+    return 0;
+}
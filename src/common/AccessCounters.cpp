@@ -0,0 +1,78 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include "common/AccessCounters.h"
+#include "common/Screenshot.h"
+
+namespace Common {
+
+void AccessCounters::Export(const std::string& prefix,
+                            const std::function<std::string(u32 addr)>& region_name) const {
+    if (!enabled) {
+        fmt::print("Memory access counts aren't compiled in. Build with -DCHROMA_PERF_COUNTERS=ON to get them.\n");
+        return;
+    }
+
+    std::ofstream csv_stream(prefix + ".csv");
+    if (!csv_stream) {
+        throw std::runtime_error("Error when attempting to open " + prefix + ".csv for writing.");
+    }
+
+    fmt::print(csv_stream, "region,page,fetch,read,write,dma_read,dma_write,slow_path\n");
+    std::array<u64, 3> max_counts{};
+    for (std::size_t page = 0; page < pages.size(); ++page) {
+        const auto& counts = pages[page];
+        if (counts[Fetch] + counts[Read] + counts[Write] + counts[DmaRead] + counts[DmaWrite] == 0) {
+            continue;
+        }
+
+        const u32 addr = static_cast<u32>(page << page_shift);
+        fmt::print(csv_stream, "{},0x{:0>8X},{},{},{},{},{},{}\n", region_name(addr), addr, counts[Fetch],
+                   counts[Read], counts[Write], counts[DmaRead], counts[DmaWrite], counts[SlowPath]);
+
+        max_counts[0] = std::max(max_counts[0], counts[Write] + counts[DmaWrite]);
+        max_counts[1] = std::max(max_counts[1], counts[Read] + counts[DmaRead]);
+        max_counts[2] = std::max(max_counts[2], counts[Fetch]);
+    }
+
+    // A log scale, so pages touched a handful of times still show up next to ones hammered every frame.
+    const auto Intensity = [](u64 count, u64 max_count) {
+        if (count == 0) {
+            return u8{0};
+        }
+        return static_cast<u8>(32 + 223 * std::log2(static_cast<double>(count))
+                                       / std::max(std::log2(static_cast<double>(max_count)), 1.0));
+    };
+
+    constexpr int width = 256;
+    const int height = static_cast<int>((pages.size() + width - 1) / width);
+    std::vector<u8> image(width * height * 3, 0);
+    for (std::size_t page = 0; page < pages.size(); ++page) {
+        const auto& counts = pages[page];
+        image[page * 3 + 0] = Intensity(counts[Write] + counts[DmaWrite], max_counts[0]);
+        image[page * 3 + 1] = Intensity(counts[Read] + counts[DmaRead], max_counts[1]);
+        image[page * 3 + 2] = Intensity(counts[Fetch], max_counts[2]);
+    }
+    WriteImageToFile(image, prefix, width, height);
+}
+
+} // End namespace Common
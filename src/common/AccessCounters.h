@@ -0,0 +1,76 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/PerfCounters.h"
+
+namespace Common {
+
+// Guest memory traffic per 4KB page, split by who made the access and what for, to show which regions a game
+// leans on and so which fast paths matter for it. Like PerfCounters, counting is compiled in by the
+// CHROMA_PERF_COUNTERS CMake option; otherwise nothing is allocated and every Add is a no-op.
+class AccessCounters {
+public:
+    // Accesses which missed the page tables and went through the region checks are also counted as SlowPath.
+    enum Kind {Fetch, Read, Write, DmaRead, DmaWrite, SlowPath, num_kinds};
+
+    static constexpr bool enabled = PerfCounters::enabled;
+    static constexpr int page_shift = 12;
+    static constexpr u32 page_size = 1 << page_shift;
+
+    // Covers addresses below 1 << address_bits. Anything above lands in one extra page at the end.
+    explicit AccessCounters(int address_bits) {
+        if constexpr (enabled) {
+            pages.resize((1u << (address_bits - page_shift)) + 1);
+        }
+    }
+
+    void Add(u32 addr, Kind kind, u64 amount = 1) {
+        if constexpr (enabled) {
+            pages[std::min<std::size_t>(addr >> page_shift, pages.size() - 1)][kind] += amount;
+        }
+    }
+
+    // Counts a block of consecutive accesses of access_size bytes each, which may cross pages.
+    void AddRange(u32 addr, u32 bytes, u32 access_size, Kind kind) {
+        if constexpr (enabled) {
+            while (bytes != 0) {
+                const u32 page_bytes = std::min(bytes, page_size - (addr & (page_size - 1)));
+                Add(addr, kind, page_bytes / access_size);
+                addr += page_bytes;
+                bytes -= page_bytes;
+            }
+        }
+    }
+
+    // Writes prefix.csv, with a row per page that was accessed, and prefix.png, with a pixel per page, 256 pages
+    // to a row. Each pixel's red, green and blue are the page's writes, reads and fetches, CPU and DMA together, on
+    // a log scale. Prints a message instead when counting isn't compiled in.
+    void Export(const std::string& prefix, const std::function<std::string(u32 addr)>& region_name) const;
+
+private:
+    std::vector<std::array<u64, num_kinds>> pages;
+};
+
+} // End namespace Common
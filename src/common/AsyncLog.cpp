@@ -0,0 +1,127 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#include "common/AsyncLog.h"
+
+namespace Common {
+
+AsyncLogBuffer::AsyncLogBuffer(const std::string& filename, LogOverflow _overflow)
+        : overflow_policy(_overflow)
+        , file(filename, std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open ./" + filename + " for writing.");
+    }
+
+    setp(staging.data(), staging.data() + staging.size());
+    writer_thread = std::thread{&AsyncLogBuffer::WriterLoop, this};
+}
+
+AsyncLogBuffer::~AsyncLogBuffer() {
+    Submit();
+    quit = true;
+    wake_cv.notify_one();
+    writer_thread.join();
+
+    if (dropped_bytes != 0) {
+        file << "\n" << dropped_bytes << " bytes of log output were dropped because the writer fell behind.\n";
+    }
+}
+
+AsyncLogBuffer::int_type AsyncLogBuffer::overflow(int_type ch) {
+    Submit();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(ch);
+}
+
+int AsyncLogBuffer::sync() {
+    Submit();
+    return 0;
+}
+
+void AsyncLogBuffer::Flush() {
+    Submit();
+    wake_cv.notify_one();
+    while (bytes_written.load(std::memory_order_acquire) != bytes_submitted.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+}
+
+void AsyncLogBuffer::Submit() {
+    const char* data = pbase();
+    std::size_t count = pptr() - pbase();
+    setp(staging.data(), staging.data() + staging.size());
+
+    while (count != 0) {
+        const std::size_t pushed = ring.PushBack(data, count);
+        bytes_submitted.fetch_add(pushed, std::memory_order_relaxed);
+        data += pushed;
+        count -= pushed;
+
+        if (count != 0) {
+            if (overflow_policy == LogOverflow::Drop) {
+                dropped_bytes += count;
+                break;
+            }
+
+            wake_cv.notify_one();
+            std::this_thread::yield();
+        }
+    }
+
+    // Avoid waking the writer for every line; it checks back on its own often enough.
+    if (ring.Size() > ring_size / 4) {
+        wake_cv.notify_one();
+    }
+}
+
+void AsyncLogBuffer::WriterLoop() {
+    std::vector<char> chunk(write_chunk_size);
+    while (true) {
+        const std::size_t count = ring.PopFront(chunk.data(), chunk.size());
+        if (count != 0) {
+            file.write(chunk.data(), count);
+            if (ring.Size() == 0) {
+                file.flush();
+            }
+            bytes_written.fetch_add(count, std::memory_order_release);
+            continue;
+        }
+
+        if (quit) {
+            // Submissions finished before quit was set, so one last empty check means everything is written.
+            if (ring.Size() == 0) {
+                break;
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{wake_mutex};
+        wake_cv.wait_for(lock, std::chrono::milliseconds(10));
+    }
+
+    file.flush();
+}
+
+} // End namespace Common
@@ -0,0 +1,104 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#include "common/CommonTypes.h"
+#include "common/CommonEnums.h"
+#include "common/RingBuffer.h"
+
+namespace Common {
+
+// Moves log file I/O off the emulator thread. Text is staged in a small local buffer, handed to a writer thread
+// through a lock-free ring buffer a batch at a time, and written to disk in large chunks. All logging happens on
+// the emulator thread, so one producer and one consumer is all that's needed. A full ring either blocks the
+// emulator until the writer catches up, or drops the text and counts what was lost.
+class AsyncLogBuffer : public std::streambuf {
+public:
+    AsyncLogBuffer(const std::string& filename, LogOverflow _overflow);
+    ~AsyncLogBuffer() override;
+
+    // Blocks until everything logged so far has reached the file.
+    void Flush();
+
+    u64 DroppedBytes() const { return dropped_bytes; }
+
+protected:
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    static constexpr std::size_t ring_size = 4 * 1024 * 1024;
+    static constexpr std::size_t write_chunk_size = 64 * 1024;
+
+    const LogOverflow overflow_policy;
+    std::ofstream file;
+
+    std::array<char, 4096> staging;
+    SpscRingBuffer<char, ring_size> ring;
+    u64 dropped_bytes = 0;
+
+    std::atomic<u64> bytes_submitted{0};
+    std::atomic<u64> bytes_written{0};
+    std::atomic<bool> quit{false};
+
+    // Only used to let the writer sleep while the ring is empty. The emulator thread never takes the lock.
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    std::thread writer_thread;
+
+    void Submit();
+    void WriterLoop();
+};
+
+// An std::ostream over an AsyncLogBuffer, so fmt::print can write to it like any other stream. A
+// default-constructed stream has no file and silently discards everything, like an unopened std::ofstream.
+class AsyncLogStream : public std::ostream {
+public:
+    AsyncLogStream() : std::ostream(nullptr) {}
+    ~AsyncLogStream() override { rdbuf(nullptr); }
+
+    void Open(const std::string& filename, LogOverflow overflow_policy) {
+        buffer = std::make_unique<AsyncLogBuffer>(filename, overflow_policy);
+        rdbuf(buffer.get());
+    }
+
+    void Flush() {
+        if (buffer != nullptr) {
+            buffer->Flush();
+        }
+    }
+
+    u64 DroppedBytes() const { return (buffer != nullptr) ? buffer->DroppedBytes() : 0; }
+
+private:
+    // Heap allocated, since the ring buffer is several megabytes.
+    std::unique_ptr<AsyncLogBuffer> buffer;
+};
+
+} // End namespace Common
@@ -0,0 +1,266 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <fmt/format.h>
+
+#include "common/AvRecorder.h"
+
+namespace Common {
+
+namespace {
+
+// Everything is written little-endian, like the host.
+template<typename T>
+void AppendValue(std::vector<u8>& buffer, T value) {
+    const std::size_t offset = buffer.size();
+    buffer.resize(offset + sizeof(T));
+    std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template<typename T>
+T ReadValue(const u8* ptr) {
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+std::vector<u8> WavHeader(u32 sample_rate, u32 data_bytes) {
+    std::vector<u8> header;
+    const auto append_tag = [&header](const char* tag) { header.insert(header.end(), tag, tag + 4); };
+
+    append_tag("RIFF");
+    AppendValue<u32>(header, 36 + data_bytes);
+    append_tag("WAVE");
+    append_tag("fmt ");
+    AppendValue<u32>(header, 16);
+    AppendValue<u16>(header, 1);
+    AppendValue<u16>(header, 2);
+    AppendValue<u32>(header, sample_rate);
+    AppendValue<u32>(header, sample_rate * 2 * sizeof(s16));
+    AppendValue<u16>(header, 2 * sizeof(s16));
+    AppendValue<u16>(header, 16);
+    append_tag("data");
+    AppendValue<u32>(header, data_bytes);
+
+    return header;
+}
+
+} // End anonymous namespace
+
+AvRecorder::AvRecorder(const RecordSettings& settings, int width, int height, u32 clock_rate, u32 cycles_per_frame)
+        : piped(!settings.pipe_command.empty())
+        , frame_bytes(static_cast<std::size_t>(width) * height * sizeof(u16)) {
+
+    const u32 sample_rate = static_cast<u32>((static_cast<u64>(samples_per_frame) * clock_rate + cycles_per_frame / 2)
+                                             / cycles_per_frame);
+    if (!settings.stream_command.empty()) {
+        streamer = std::make_unique<AvStreamer>(settings.stream_command, width, height, sample_rate);
+        return;
+    }
+
+    std::vector<u8> header;
+    if (piped) {
+        // An encoder which quits early would otherwise kill the emulator on the next write.
+        std::signal(SIGPIPE, SIG_IGN);
+
+        video_file = popen(settings.pipe_command.c_str(), "w");
+        if (video_file == nullptr) {
+            throw std::runtime_error("Error when attempting to run " + settings.pipe_command);
+        }
+
+        wav_file = std::fopen("record.wav", "wb");
+        if (wav_file == nullptr) {
+            pclose(video_file);
+            throw std::runtime_error("Error when attempting to open record.wav");
+        }
+
+        // The sizes are filled in once the recording ends.
+        wav_sample_rate = sample_rate;
+        header = WavHeader(wav_sample_rate, 0);
+        std::fwrite(header.data(), 1, header.size(), wav_file);
+    } else {
+        video_file = std::fopen(settings.path.c_str(), "wb");
+        if (video_file == nullptr) {
+            throw std::runtime_error("Error when attempting to open " + settings.path);
+        }
+
+        const char magic[] = "CHROMAAV";
+        header.insert(header.end(), magic, magic + 8);
+        AppendValue<u32>(header, 2);
+        AppendValue<u16>(header, width);
+        AppendValue<u16>(header, height);
+        AppendValue<u32>(header, clock_rate);
+        AppendValue<u32>(header, cycles_per_frame);
+        AppendValue<u32>(header, samples_per_frame);
+        std::fwrite(header.data(), 1, header.size(), video_file);
+    }
+
+    filling.reserve(handoff_bytes + width * height * sizeof(u16) + 64);
+    writer_thread = std::thread(&AvRecorder::WriterLoop, this);
+}
+
+AvRecorder::~AvRecorder() {
+    if (streamer != nullptr) {
+        return;
+    }
+
+    Handoff(true);
+    {
+        std::lock_guard<std::mutex> lock{write_mutex};
+        quit = true;
+    }
+    write_cv.notify_all();
+    writer_thread.join();
+
+    if (piped) {
+        // Waits for the encoder to finish.
+        pclose(video_file);
+
+        const std::vector<u8> header = WavHeader(wav_sample_rate, wav_data_bytes);
+        std::fseek(wav_file, 0, SEEK_SET);
+        std::fwrite(header.data(), 1, header.size(), wav_file);
+        std::fclose(wav_file);
+    } else if (std::fclose(video_file) != 0 && !write_failed) {
+        fmt::print("Error: the end of the recording could not be written.\n");
+    }
+}
+
+void AvRecorder::Frame(const u16* frame, u64 hash) {
+    if (streamer != nullptr) {
+        streamer->Frame(frame);
+        return;
+    }
+
+    if (recorded_frame && hash == last_hash) {
+        AppendChunk('R', nullptr, 0);
+        return;
+    }
+
+    AppendChunk('V', frame, frame_bytes);
+    recorded_frame = true;
+    last_hash = hash;
+    if (filling.size() >= handoff_bytes) {
+        Handoff(false);
+    }
+}
+
+void AvRecorder::Audio(const s16* samples, std::size_t count) {
+    if (streamer != nullptr) {
+        streamer->Audio(samples, count);
+        return;
+    }
+
+    AppendChunk('A', samples, count * sizeof(s16));
+}
+
+void AvRecorder::AppendChunk(char tag, const void* data, std::size_t size) {
+    const std::size_t offset = filling.size();
+    filling.resize(offset + 1 + sizeof(u32) + size);
+
+    u8* chunk = filling.data() + offset;
+    chunk[0] = tag;
+    const u32 chunk_size = static_cast<u32>(size);
+    std::memcpy(chunk + 1, &chunk_size, sizeof(u32));
+    if (size != 0) {
+        std::memcpy(chunk + 1 + sizeof(u32), data, size);
+    }
+}
+
+void AvRecorder::Handoff(bool force) {
+    std::unique_lock<std::mutex> lock{write_mutex};
+    if (pending_full) {
+        // The writer hasn't picked up the last buffer yet. Keep filling this one unless it's grown too large.
+        if (!force && filling.size() < max_buffered_bytes) {
+            return;
+        }
+        write_cv.wait(lock, [this] { return !pending_full; });
+    }
+
+    // The writer left its last buffer in pending, so this swap hands over the data without copying it.
+    pending.swap(filling);
+    pending_full = true;
+    filling.clear();
+    lock.unlock();
+    write_cv.notify_all();
+}
+
+void AvRecorder::WriterLoop() {
+    std::vector<u8> writing;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{write_mutex};
+            if (!writing.empty()) {
+                // Give the written buffer back for the emulator to fill next, keeping its capacity.
+                writing.clear();
+                pending.swap(writing);
+                pending_full = false;
+                write_cv.notify_all();
+            }
+
+            write_cv.wait(lock, [this] { return pending_full || quit; });
+            if (!pending_full) {
+                return;
+            }
+
+            writing.swap(pending);
+        }
+
+        WriteChunks(writing);
+    }
+}
+
+void AvRecorder::WriteChunks(const std::vector<u8>& chunks) {
+    if (!piped) {
+        Write(video_file, chunks.data(), chunks.size());
+        return;
+    }
+
+    // The encoder only gets the frames, and the audio goes to its own file.
+    for (std::size_t offset = 0; offset < chunks.size();) {
+        const char tag = chunks[offset];
+        const u32 size = ReadValue<u32>(chunks.data() + offset + 1);
+        const u8* data = chunks.data() + offset + 1 + sizeof(u32);
+
+        if (tag == 'V') {
+            Write(video_file, data, size);
+            last_frame.assign(data, data + size);
+        } else if (tag == 'R') {
+            Write(video_file, last_frame.data(), last_frame.size());
+        } else {
+            Write(wav_file, data, size);
+            wav_data_bytes += size;
+        }
+
+        offset += 1 + sizeof(u32) + size;
+    }
+}
+
+void AvRecorder::Write(std::FILE* file, const void* data, std::size_t size) {
+    if (write_failed) {
+        return;
+    }
+
+    if (std::fwrite(data, 1, size, file) != size) {
+        // Keep the emulator running, but stop trying to write after the first error.
+        fmt::print("Error: could not write to the recording. Recording stopped.\n");
+        write_failed = true;
+    }
+}
+
+} // End namespace Common
@@ -0,0 +1,108 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/AvStreamer.h"
+
+namespace Common {
+
+struct RecordSettings {
+    // Write every emulated frame and its audio to this file. Empty disables recording.
+    std::string path;
+    // Or pipe the raw frames to this command's stdin, and write the audio to ./record.wav.
+    std::string pipe_command;
+    // Or stream to this live encoder, with {audio} standing in for the path of the audio FIFO. See AvStreamer.
+    std::string stream_command;
+
+    bool Enabled() const { return !path.empty() || !pipe_command.empty() || !stream_command.empty(); }
+};
+
+// Records the emulator's output losslessly, for encoding afterwards or by an encoder reading from a pipe. The
+// recording file starts with the "CHROMAAV" magic, followed by the little-endian header
+//     u32 version, u16 width, u16 height, u32 clock rate, u32 cycles per frame, u32 audio samples per frame
+// and then a chunk per frame and per audio buffer, each an ASCII tag, a u32 size in bytes, and the data. 'V' is
+// a frame of BGR555 pixels, 'R' is an empty chunk which repeats the last 'V' frame, and 'A' is interleaved stereo
+// s16 samples. There's one frame per emulated frame whether or not the LCD finished a new one, so the video runs
+// at the clock rate over cycles per frame, in lockstep with the audio. Version 1 recordings have no 'R' chunks.
+// Piped encoders always get whole frames. Streaming hands everything to an AvStreamer instead, which drops frames
+// rather than letting the encoder lag behind.
+//
+// The emulator thread only appends to a buffer, which is handed to the writer thread whole by swapping it with
+// the one the writer has finished with. If the disk can't keep up, the buffer grows rather than stalling the
+// emulator, up to a limit after which it waits for the writer instead of dropping anything.
+class AvRecorder {
+public:
+    static constexpr int samples_per_frame = 800;
+
+    // Throws std::runtime_error if the file can't be created or the command can't be run.
+    AvRecorder(const RecordSettings& settings, int width, int height, u32 clock_rate, u32 cycles_per_frame);
+    ~AvRecorder();
+
+    // The hash identifies the frame, so one which is the same as the last doesn't need to be copied again.
+    void Frame(const u16* frame, u64 hash);
+    void Audio(const s16* samples, std::size_t count);
+
+private:
+    static constexpr std::size_t handoff_bytes = 1024 * 1024;
+    static constexpr std::size_t max_buffered_bytes = 256 * 1024 * 1024;
+
+    const bool piped;
+    const std::size_t frame_bytes;
+    // Only present while streaming, which bypasses everything below.
+    std::unique_ptr<AvStreamer> streamer;
+
+    // Only touched by the emulator thread.
+    std::vector<u8> filling;
+    bool recorded_frame = false;
+    u64 last_hash = 0;
+
+    // Everything below the mutex is shared with the writer thread.
+    std::mutex write_mutex;
+    std::condition_variable write_cv;
+    std::vector<u8> pending;
+    bool pending_full = false;
+    bool quit = false;
+
+    // Only touched by the writer thread once it's started.
+    std::FILE* video_file = nullptr;
+    std::FILE* wav_file = nullptr;
+    u32 wav_sample_rate = 0;
+    u32 wav_data_bytes = 0;
+    bool write_failed = false;
+    // The last frame sent to a piped encoder, for the frames which repeat it.
+    std::vector<u8> last_frame;
+
+    std::thread writer_thread;
+
+    void AppendChunk(char tag, const void* data, std::size_t size);
+    void Handoff(bool force);
+    void WriterLoop();
+    void WriteChunks(const std::vector<u8>& chunks);
+    void Write(std::FILE* file, const void* data, std::size_t size);
+};
+
+} // End namespace Common
@@ -0,0 +1,178 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <csignal>
+#include <filesystem>
+#include <stdexcept>
+#include <fmt/format.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common/AvStreamer.h"
+
+namespace Common {
+
+AvStreamer::AvStreamer(const std::string& command, int width, int height, u32 audio_sample_rate)
+        : frame_bytes(static_cast<std::size_t>(width) * height * sizeof(u16)) {
+    // An encoder which quits early would otherwise kill the emulator on the next write.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::string full_command = command;
+    const std::string placeholder = "{audio}";
+    if (full_command.find(placeholder) != std::string::npos) {
+#if defined(_WIN32)
+        throw std::runtime_error("Streaming audio needs a FIFO, which Windows doesn't have.");
+#else
+        fifo_path = (std::filesystem::temp_directory_path() / fmt::format("chroma-audio-{}", getpid())).string();
+        unlink(fifo_path.c_str());
+        if (mkfifo(fifo_path.c_str(), 0600) != 0) {
+            throw std::runtime_error("Error when attempting to create " + fifo_path);
+        }
+
+        for (std::size_t pos; (pos = full_command.find(placeholder)) != std::string::npos;) {
+            full_command.replace(pos, placeholder.size(), fifo_path);
+        }
+#endif
+    }
+
+    encoder = popen(full_command.c_str(), "w");
+    if (encoder == nullptr) {
+        if (!fifo_path.empty()) {
+            std::error_code error;
+            std::filesystem::remove(fifo_path, error);
+        }
+        throw std::runtime_error("Error when attempting to run " + command);
+    }
+
+    video.Start("", encoder);
+    if (!fifo_path.empty()) {
+        audio.Start(fifo_path, nullptr);
+    }
+
+    fmt::print("Streaming {}x{} bgr555le frames{}.\n", width, height,
+               fifo_path.empty() ? "" : fmt::format(", and s16le stereo audio at {}Hz", audio_sample_rate));
+}
+
+AvStreamer::~AvStreamer() {
+#if !defined(_WIN32)
+    int fifo_fd = -1;
+    if (!fifo_path.empty()) {
+        // The audio thread may still be waiting for the encoder to open the FIFO, which opening it here ends. Once
+        // it's unlinked, an encoder which only gets around to opening it now fails instead of waiting forever for
+        // a writer.
+        fifo_fd = open(fifo_path.c_str(), O_RDONLY | O_NONBLOCK);
+        unlink(fifo_path.c_str());
+    }
+#endif
+
+    video.Stop();
+    audio.Stop();
+
+#if !defined(_WIN32)
+    if (fifo_fd != -1) {
+        close(fifo_fd);
+    }
+#endif
+    // Waits for the encoder to finish.
+    pclose(encoder);
+
+    if (video.Dropped() != 0 || audio.Dropped() != 0) {
+        fmt::print("The encoder fell behind: {} frames and {} audio buffers were dropped.\n", video.Dropped(),
+                   audio.Dropped());
+    }
+}
+
+void AvStreamer::Frame(const u16* frame) {
+    video.Offer(frame, frame_bytes, true, frame_bytes);
+}
+
+void AvStreamer::Audio(const s16* samples, std::size_t count) {
+    if (!fifo_path.empty()) {
+        audio.Offer(samples, count * sizeof(s16), false, max_queued_samples * sizeof(s16));
+    }
+}
+
+void AvStreamer::Pipe::Offer(const void* data, std::size_t size, bool replace, std::size_t max_bytes) {
+    const u8* bytes = static_cast<const u8*>(data);
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!pending.empty() && (replace || pending.size() + size > max_bytes)) {
+            pending.clear();
+            ++dropped;
+        }
+        pending.insert(pending.end(), bytes, bytes + size);
+    }
+    cv.notify_one();
+}
+
+void AvStreamer::Pipe::Start(const std::string& path, std::FILE* opened) {
+    file = opened;
+    thread = std::thread(&Pipe::WriterLoop, this, path);
+}
+
+void AvStreamer::Pipe::Stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        quit = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+void AvStreamer::Pipe::WriterLoop(std::string path) {
+    if (file == nullptr) {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            fmt::print("Error: could not open {} for streaming.\n", path);
+            return;
+        }
+    }
+
+    std::vector<u8> writing;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cv.wait(lock, [this] { return !pending.empty() || quit; });
+            if (pending.empty()) {
+                break;
+            }
+
+            // The buffers trade places, so neither is reallocated once they've grown to a frame.
+            writing.clear();
+            writing.swap(pending);
+        }
+
+        if (std::fwrite(writing.data(), 1, writing.size(), file) != writing.size() || std::fflush(file) != 0) {
+            // Keep the emulator running. Whatever is offered from now on is dropped as it's replaced.
+            fmt::print("Error: could not write to the encoder. Streaming stopped.\n");
+            break;
+        }
+    }
+
+    if (!path.empty()) {
+        std::fclose(file);
+    }
+}
+
+} // End namespace Common
@@ -0,0 +1,79 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Streams the emulator's output to a live encoder for remote play, such as ffmpeg with a hardware H.264 encoder and
+// Opus. Raw BGR555 frames go to the command's stdin, and interleaved stereo s16 audio to a FIFO whose path replaces
+// {audio} in the command. Each pipe has its own writer thread, so an encoder reading one doesn't stall the other.
+//
+// Unlike a recording, nothing is batched: each frame is handed over and flushed as soon as it's finished, and
+// only the newest frame waits to be written. If the encoder falls behind, older frames and audio are dropped
+// instead of queueing up, so the stream never lags further than the encoder itself.
+class AvStreamer {
+public:
+    // Throws std::runtime_error if the command can't be run or the FIFO can't be made.
+    AvStreamer(const std::string& command, int width, int height, u32 audio_sample_rate);
+    ~AvStreamer();
+
+    void Frame(const u16* frame);
+    void Audio(const s16* samples, std::size_t count);
+
+private:
+    // Audio is dropped once this many samples are waiting, a few frames' worth.
+    static constexpr std::size_t max_queued_samples = 4 * 1600;
+
+    class Pipe {
+    public:
+        // A frame replaces whatever is still waiting, while audio is added to it up to the limit.
+        void Offer(const void* data, std::size_t size, bool replace, std::size_t max_bytes);
+        // Opens the file on the writer thread, since a FIFO's open blocks until the encoder opens it too.
+        void Start(const std::string& path, std::FILE* opened);
+        void Stop();
+        u64 Dropped() const { return dropped; }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<u8> pending;
+        bool quit = false;
+        u64 dropped = 0;
+
+        std::FILE* file = nullptr;
+        std::thread thread;
+        void WriterLoop(std::string path);
+    };
+
+    std::FILE* encoder;
+    const std::size_t frame_bytes;
+    std::string fifo_path;
+    Pipe video;
+    Pipe audio;
+};
+
+} // End namespace Common
@@ -0,0 +1,178 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+#include "common/HwCounters.h"
+
+namespace Common {
+
+// Collects the numbers for --bench, which emulates a fixed number of frames and prints a JSON report. Each timed
+// section only costs a branch when no benchmark is running. The totals are atomic because the LCD may be drawing on
+// its own thread, which also means the sections can add up to more than the wall time.
+//
+// With hardware counters enabled, each section also reads the CPU's performance counters on entry and exit. Those
+// are attributed exclusively: while a section runs inside another on the same thread, such as a scanline drawn in
+// the middle of a CPU slice, its events are taken out of the outer section's totals.
+class BenchStats {
+public:
+    // The CPU's wall time is whatever the other sections leave over, so timing a Cpu section only feeds its
+    // hardware counters.
+    enum Section {Cpu, Lcd, Audio, Dma, Present, num_sections};
+
+    explicit BenchStats(int _frames) : frames(_frames) {}
+
+    class Scope {
+    public:
+        Scope(const BenchStats* _stats, Section _section)
+                : stats(_stats)
+                , section(_section)
+                , start_time(stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{}) {
+            if (stats && stats->hw_counters) {
+                last_counts = HwCounters::Read();
+                outer = current;
+                if (outer) {
+                    stats->AddHwCounts(outer->section, outer->last_counts, last_counts);
+                }
+                current = this;
+            }
+        }
+        ~Scope() {
+            if (stats) {
+                const auto elapsed = std::chrono::steady_clock::now() - start_time;
+                stats->section_ns[section].fetch_add(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                        std::memory_order_relaxed);
+
+                if (stats->hw_counters) {
+                    const HwCounters::Values counts = HwCounters::Read();
+                    stats->AddHwCounts(section, last_counts, counts);
+                    if (outer) {
+                        outer->last_counts = counts;
+                    }
+                    current = outer;
+                }
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const BenchStats* stats;
+        Section section;
+        std::chrono::steady_clock::time_point start_time;
+
+        // The counter readings this scope hasn't been credited with yet start here.
+        HwCounters::Values last_counts{};
+        Scope* outer = nullptr;
+        static inline thread_local Scope* current = nullptr;
+    };
+
+    bool Enabled() const { return frames != 0; }
+
+    // Reads the CPU's performance counters around every section as well. This adds a system call or two per
+    // section, so it perturbs the timings a little.
+    void EnableHwCounters() { hw_counters = true; }
+
+    // Times the enclosing block as part of the given section.
+    Scope Time(Section section) const { return Scope{Enabled() ? this : nullptr, section}; }
+
+    void Start() { start_time = std::chrono::steady_clock::now(); }
+
+    // Called after every emulated frame, returns true once the requested number of frames have run.
+    bool FrameDone() { return Enabled() && ++frames_run == frames; }
+
+    // Sections that a core doesn't time are reported as null, and their time is counted as CPU time.
+    void PrintReport(const std::string& system, bool dma_timed) {
+        using namespace std::chrono;
+        const double wall_seconds = duration<double>(steady_clock::now() - start_time).count();
+        fps = frames_run / wall_seconds;
+
+        std::array<double, num_sections> seconds;
+        for (int i = 0; i < num_sections; ++i) {
+            seconds[i] = section_ns[i].load(std::memory_order_relaxed) / 1e9;
+        }
+        const double cpu_seconds = std::max(0.0, wall_seconds - seconds[Lcd] - seconds[Audio] - seconds[Dma]
+                                                     - seconds[Present]);
+
+        fmt::print("{{\"system\": \"{}\", \"frames\": {}, \"seconds\": {:.6f}, \"fps\": {:.2f}, "
+                   "\"realtime_percent\": {:.1f}, \"breakdown_seconds\": {{\"cpu\": {:.6f}, \"lcd\": {:.6f}, "
+                   "\"audio\": {:.6f}, \"dma\": {}, \"present\": {:.6f}}}, \"audio_us_per_frame\": {:.2f}, "
+                   "\"hw_counters\": {}}}\n",
+                   system, frames_run, wall_seconds, fps, fps / 60.0 * 100.0, cpu_seconds, seconds[Lcd],
+                   seconds[Audio], dma_timed ? fmt::format("{:.6f}", seconds[Dma]) : "null", seconds[Present],
+                   (frames_run > 0) ? seconds[Audio] * 1e6 / frames_run : 0.0, HwCountersJson(dma_timed));
+    }
+
+    // The frame rate from the last report.
+    double Fps() const { return fps; }
+
+private:
+    int frames;
+    int frames_run = 0;
+    double fps = 0.0;
+    bool hw_counters = false;
+    std::chrono::steady_clock::time_point start_time;
+    mutable std::array<std::atomic<s64>, num_sections> section_ns{};
+    mutable std::array<std::array<std::atomic<u64>, HwCounters::num_events>, num_sections> hw_counts{};
+
+    void AddHwCounts(Section section, const HwCounters::Values& from, const HwCounters::Values& to) const {
+        for (int i = 0; i < HwCounters::num_events; ++i) {
+            hw_counts[section][i].fetch_add(to[i] - from[i], std::memory_order_relaxed);
+        }
+    }
+
+    // An object per section holding each event's total, or null if the counters weren't enabled or couldn't be
+    // opened. Events the CPU or kernel doesn't support are null too.
+    std::string HwCountersJson(bool dma_timed) const {
+        const auto available = HwCounters::Available();
+        if (!hw_counters || !available[HwCounters::Cycles]) {
+            return "null";
+        }
+
+        constexpr std::array<const char*, num_sections> section_names{{"cpu", "lcd", "audio", "dma", "present"}};
+        std::string json{"{"};
+        for (int section = 0; section < num_sections; ++section) {
+            if (section == Dma && !dma_timed) {
+                continue;
+            }
+            json += fmt::format("{}\"{}\": {{", (section == 0) ? "" : ", ", section_names[section]);
+            for (int i = 0; i < HwCounters::num_events; ++i) {
+                const u64 count = hw_counts[section][i].load(std::memory_order_relaxed);
+                json += fmt::format("{}\"{}\": {}", (i == 0) ? "" : ", ", HwCounters::names[i],
+                                    available[i] ? std::to_string(count) : "null");
+            }
+            const u64 cycles = hw_counts[section][HwCounters::Cycles].load(std::memory_order_relaxed);
+            const u64 instructions = hw_counts[section][HwCounters::Instructions].load(std::memory_order_relaxed);
+            json += fmt::format(", \"ipc\": {:.3f}}}",
+                                (cycles > 0) ? static_cast<double>(instructions) / cycles : 0.0);
+        }
+        return json + "}";
+    }
+};
+
+} // End namespace Common
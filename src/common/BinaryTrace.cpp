@@ -0,0 +1,133 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <fmt/format.h>
+
+#include "common/BinaryTrace.h"
+
+namespace Common {
+
+BinaryTrace::BinaryTrace(const std::string& filename, System system, std::size_t _record_words)
+        : record_words(_record_words)
+        , trace_stream(filename, std::ios::binary)
+        , current_chunk(chunk_words) {
+    if (!trace_stream) {
+        throw std::runtime_error("Error when attempting to open " + filename + " for writing.");
+    }
+
+    const std::array<u32, 2> header{{static_cast<u32>(system), static_cast<u32>(record_words)}};
+    trace_stream.write(magic.data(), magic.size());
+    trace_stream.write(reinterpret_cast<const char*>(header.data()), sizeof(header));
+
+    for (std::size_t i = 1; i < num_chunks; ++i) {
+        free_chunks.emplace_back(chunk_words);
+    }
+
+    writer_thread = std::thread{&BinaryTrace::WriterLoop, this};
+}
+
+BinaryTrace::~BinaryTrace() {
+    {
+        std::lock_guard<std::mutex> lock{chunk_mutex};
+        full_chunks.emplace_back(std::move(current_chunk), chunk_fill);
+        quit_writer = true;
+    }
+    chunk_cv.notify_all();
+    writer_thread.join();
+}
+
+void BinaryTrace::SubmitChunk() {
+    std::unique_lock<std::mutex> lock{chunk_mutex};
+    full_chunks.emplace_back(std::move(current_chunk), chunk_fill);
+    chunk_cv.notify_all();
+
+    chunk_cv.wait(lock, [this] { return !free_chunks.empty(); });
+    current_chunk = std::move(free_chunks.back());
+    free_chunks.pop_back();
+    chunk_fill = 0;
+}
+
+void BinaryTrace::WriterLoop() {
+    std::unique_lock<std::mutex> lock{chunk_mutex};
+    while (true) {
+        chunk_cv.wait(lock, [this] { return quit_writer || !full_chunks.empty(); });
+        if (full_chunks.empty()) {
+            break;
+        }
+
+        auto [chunk, fill] = std::move(full_chunks.front());
+        full_chunks.pop_front();
+
+        // Write without holding the lock, so the emulator can keep submitting chunks.
+        lock.unlock();
+        trace_stream.write(reinterpret_cast<const char*>(chunk.data()), fill * sizeof(u32));
+        lock.lock();
+
+        free_chunks.push_back(std::move(chunk));
+        chunk_cv.notify_all();
+    }
+
+    trace_stream.flush();
+}
+
+void BinaryTrace::Decode(const std::string& filename) {
+    std::ifstream trace_file(filename, std::ios::binary);
+    std::array<char, 8> file_magic;
+    std::array<u32, 2> header;
+    trace_file.read(file_magic.data(), file_magic.size());
+    trace_file.read(reinterpret_cast<char*>(header.data()), sizeof(header));
+    if (!trace_file || file_magic != magic || header[1] == 0 || header[1] > max_record_words) {
+        throw std::runtime_error(filename + " is not a Chroma binary trace.");
+    }
+
+    const auto system = static_cast<System>(header[0]);
+    const std::size_t words = header[1];
+    std::array<u32, max_record_words> record;
+    while (trace_file.read(reinterpret_cast<char*>(record.data()), words * sizeof(u32))) {
+        if (system == System::Gba) {
+            // PC, opcode, CPSR, then R0-R15 if registers were recorded.
+            const bool thumb = record[2] & 0x20;
+            if (thumb) {
+                fmt::print("0x{:0>8X}, T: 0x{:0>4X}", record[0], record[1]);
+            } else {
+                fmt::print("0x{:0>8X}, A: 0x{:0>8X}", record[0], record[1]);
+            }
+            fmt::print(" CPSR=0x{:0>8X}\n", record[2]);
+
+            if (words > 3) {
+                for (int i = 0; i < 16; ++i) {
+                    fmt::print("R{:X}=0x{:0>8X}{}", i, record[3 + i], (i == 4 || i == 9 || i == 15) ? "\n" : ", ");
+                }
+                fmt::print("\n");
+            }
+        } else {
+            // PC, the three bytes from PC onwards, then AF, BC, DE, HL and SP if registers were recorded.
+            fmt::print("0x{:0>4X}: {:0>2X} {:0>2X} {:0>2X}\n", record[0], record[1] & 0xFF, (record[1] >> 8) & 0xFF,
+                       (record[1] >> 16) & 0xFF);
+
+            if (words > 2) {
+                fmt::print("AF=0x{:0>4X} BC=0x{:0>4X} DE=0x{:0>4X} HL=0x{:0>4X} SP=0x{:0>4X}\n\n", record[2],
+                           record[3], record[4], record[5], record[6]);
+            }
+        }
+    }
+}
+
+} // End namespace Common
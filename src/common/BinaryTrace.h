@@ -0,0 +1,81 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// A compact instruction trace, for captures too long for the text log. Every record is the same number of 32-bit
+// words, and records are packed into large chunks which a writer thread flushes to disk, so the emulator thread
+// only ever copies a few words per instruction. If the writer falls behind, the emulator waits for a free chunk
+// rather than dropping records. --decode-trace turns a trace file back into text.
+class BinaryTrace {
+public:
+    enum class System : u32 {Gb, Gba};
+
+    static constexpr std::size_t max_record_words = 20;
+
+    BinaryTrace(const std::string& filename, System system, std::size_t _record_words);
+    ~BinaryTrace();
+
+    void Write(const std::array<u32, max_record_words>& record) {
+        std::copy_n(record.cbegin(), record_words, current_chunk.begin() + chunk_fill);
+        chunk_fill += record_words;
+        if (chunk_fill + record_words > current_chunk.size()) {
+            SubmitChunk();
+        }
+    }
+
+    // Prints a trace file as text.
+    static void Decode(const std::string& filename);
+
+private:
+    static constexpr std::size_t chunk_words = 256 * 1024;
+    static constexpr std::size_t num_chunks = 8;
+    static constexpr std::array<char, 8> magic{{'C', 'H', 'R', 'T', 'R', 'A', 'C', 'E'}};
+
+    const std::size_t record_words;
+    std::ofstream trace_stream;
+
+    std::vector<u32> current_chunk;
+    std::size_t chunk_fill = 0;
+
+    // Chunks waiting to be written, and emptied chunks for the emulator to reuse.
+    std::deque<std::pair<std::vector<u32>, std::size_t>> full_chunks;
+    std::vector<std::vector<u32>> free_chunks;
+    std::mutex chunk_mutex;
+    std::condition_variable chunk_cv;
+    bool quit_writer = false;
+    std::thread writer_thread;
+
+    void SubmitChunk();
+    void WriterLoop();
+};
+
+} // End namespace Common
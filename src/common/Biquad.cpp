@@ -0,0 +1,450 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+#include "common/Biquad.h"
+#include "common/SaveState.h"
+#include "common/Simd.h"
+#include "common/Vec4f.h"
+
+#if defined(CHROMA_SIMD_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace Common {
+
+namespace {
+
+using Matrix = std::array<std::array<double, 4>, 4>;
+using StateVector = std::array<double, 4>;
+
+constexpr double cutoff_frequency = 24000.0;
+
+struct Coefficients {
+    double a0;
+    double a1;
+    // a2 == a0;
+    double b1;
+    double b2;
+};
+
+Coefficients ButterworthLowPass(double k, double q) {
+    const double norm = 1.0 / (1.0 + k / q + k * k);
+    const double a0 = k * k * norm;
+
+    return {a0, 2.0 * a0, 2.0 * (k * k - 1.0) * norm, (1.0 - k / q + k * k) * norm};
+}
+
+// Runs one interpolated sample through the cascade, using the Transposed Direct Form 2 for both biquads. The state
+// holds z1 and z2 of the first biquad, then z1 and z2 of the second.
+std::pair<StateVector, double> FilterSample(const std::array<Coefficients, 2>& biquads, StateVector state,
+                                            double input) {
+    for (int i = 0; i < 2; ++i) {
+        const Coefficients& c = biquads[i];
+        double& z1 = state[i * 2];
+        double& z2 = state[i * 2 + 1];
+
+        const double output = z2 + input * c.a0;
+        z2 = input * c.a1 - output * c.b1 + z1;
+        z1 = input * c.a0 - output * c.b2;
+
+        input = output;
+    }
+
+    return {state, input};
+}
+
+// A biquad in coupled form: the state is rotated by the angle of the poles and scaled by their radius each sample,
+// and the input only feeds the first state variable. Beta scales the state to peak at 1 for a constant input of 1.
+struct CoupledForm {
+    double sigma;
+    double omega;
+    double beta;
+    std::array<double, 2> c;
+    double d;
+};
+
+CoupledForm ToCoupledForm(const Coefficients& coeffs) {
+    CoupledForm form;
+    // The poles are sigma +/- i*omega.
+    form.sigma = -coeffs.b1 / 2.0;
+    form.omega = std::sqrt(coeffs.b2 - form.sigma * form.sigma);
+
+    // The state a constant input settles to, for beta == 1.
+    const double det = (1.0 - form.sigma) * (1.0 - form.sigma) + form.omega * form.omega;
+    form.beta = det / std::max(1.0 - form.sigma, form.omega);
+
+    // Match the first three samples of the impulse response. The rest then follow from the poles.
+    const double h0 = coeffs.a0;
+    const double h1 = coeffs.a1 - coeffs.b1 * h0;
+    const double h2 = coeffs.a0 - coeffs.b1 * h1 - coeffs.b2 * h0;
+    form.d = h0;
+    form.c[0] = h1 / form.beta;
+    form.c[1] = (h2 / form.beta - form.c[0] * form.sigma) / form.omega;
+
+    return form;
+}
+
+// Runs one interpolated sample through the cascade of coupled form biquads. The state holds both state variables
+// of the first biquad, then those of the second.
+std::pair<StateVector, double> FilterSampleCoupled(const std::array<CoupledForm, 2>& biquads, StateVector state,
+                                                   double input) {
+    for (int i = 0; i < 2; ++i) {
+        const CoupledForm& f = biquads[i];
+        const double x1 = state[i * 2];
+        const double x2 = state[i * 2 + 1];
+
+        const double output = f.c[0] * x1 + f.c[1] * x2 + f.d * input;
+        state[i * 2] = f.sigma * x1 - f.omega * x2 + f.beta * input;
+        state[i * 2 + 1] = f.omega * x1 + f.sigma * x2;
+
+        input = output;
+    }
+
+    return {state, input};
+}
+
+// The cascade is linear, so filtering one sample is state' = A * state + B * input, and
+// output = C * state + D * input. Find A, B, C, and D by filtering each basis vector.
+struct StateSpace {
+    Matrix a;
+    StateVector b;
+    StateVector c;
+    double d;
+};
+
+template<typename FilterFunc>
+StateSpace FindStateSpace(FilterFunc filter_sample) {
+    StateSpace system;
+    for (int i = 0; i < 4; ++i) {
+        StateVector basis{};
+        basis[i] = 1.0;
+        std::tie(system.a[i], system.c[i]) = filter_sample(basis, 0.0);
+    }
+    std::tie(system.b, system.d) = filter_sample(StateVector{}, 1.0);
+
+    return system;
+}
+
+StateVector Multiply(const Matrix& matrix, const StateVector& vec) {
+    StateVector result{};
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            result[row] += matrix[col][row] * vec[col];
+        }
+    }
+
+    return result;
+}
+
+double Dot(const StateVector& lhs, const StateVector& rhs) {
+    return lhs[0] * rhs[0] + lhs[1] * rhs[1] + lhs[2] * rhs[2] + lhs[3] * rhs[3];
+}
+
+// Every version does exactly the same float operations in the same order, so the output doesn't depend on the host
+// CPU. FMA is deliberately not used, since it would round differently.
+using AdvanceFunc = void (*)(const std::array<std::array<float, 8>, 5>& step, float* state, const float* input,
+                             int count);
+
+void AdvanceVec4f(const std::array<std::array<float, 8>, 5>& step, float* state, const float* input, int count) {
+    const Vec4f col0 = Vec4f::Load(step[0].data());
+    const Vec4f col1 = Vec4f::Load(step[1].data());
+    const Vec4f col2 = Vec4f::Load(step[2].data());
+    const Vec4f col3 = Vec4f::Load(step[3].data());
+    const Vec4f col_input = Vec4f::Load(step[4].data());
+
+    Vec4f channels[2] = {Vec4f::Load(state), Vec4f::Load(state + 4)};
+
+    for (int i = 0; i < count; ++i) {
+        for (int c = 0; c < 2; ++c) {
+            const Vec4f s = channels[c];
+            const Vec4f sum01 = col0 * s.Spread<0>() + col1 * s.Spread<1>();
+            const Vec4f sum23 = col2 * s.Spread<2>() + col3 * s.Spread<3>();
+            channels[c] = (sum01 + sum23) + col_input * Vec4f::Splat(input[i * 2 + c]);
+        }
+    }
+
+    channels[0].Store(state);
+    channels[1].Store(state + 4);
+}
+
+#if defined(CHROMA_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define CHROMA_BIQUAD_AVX
+
+// Both channels fit in one AVX register. AVX isn't part of the x86-64 baseline, so this is only used if the host
+// has it.
+__attribute__((target("avx")))
+void AdvanceAvx(const std::array<std::array<float, 8>, 5>& step, float* state, const float* input, int count) {
+    const __m256 col0 = _mm256_load_ps(step[0].data());
+    const __m256 col1 = _mm256_load_ps(step[1].data());
+    const __m256 col2 = _mm256_load_ps(step[2].data());
+    const __m256 col3 = _mm256_load_ps(step[3].data());
+    const __m256 col_input = _mm256_load_ps(step[4].data());
+    // Spreads the left input across the low half, and the right input across the high half.
+    const __m256i spread_input = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+
+    __m256 s = _mm256_load_ps(state);
+
+    for (int i = 0; i < count; ++i) {
+        const __m256 in = _mm256_permutevar_ps(_mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(
+                                                                                        input + i * 2))),
+                                               spread_input);
+        const __m256 sum01 = _mm256_add_ps(_mm256_mul_ps(col0, _mm256_permute_ps(s, 0x00)),
+                                           _mm256_mul_ps(col1, _mm256_permute_ps(s, 0x55)));
+        const __m256 sum23 = _mm256_add_ps(_mm256_mul_ps(col2, _mm256_permute_ps(s, 0xAA)),
+                                           _mm256_mul_ps(col3, _mm256_permute_ps(s, 0xFF)));
+        s = _mm256_add_ps(_mm256_add_ps(sum01, sum23), _mm256_mul_ps(col_input, in));
+    }
+
+    _mm256_store_ps(state, s);
+}
+#endif
+
+AdvanceFunc SelectAdvance() {
+#if defined(CHROMA_BIQUAD_AVX)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        return AdvanceAvx;
+    }
+#endif
+
+    return AdvanceVec4f;
+}
+
+const AdvanceFunc advance_impl = SelectAdvance();
+
+s32 ToFixed(double value, int bits) {
+    const double scaled = std::ldexp(value, bits);
+    if (std::abs(scaled) >= 0x7FFF'FFFF) {
+        throw std::invalid_argument("Lowpass filter coefficient out of fixed point range.");
+    }
+    return static_cast<s32>(std::lrint(scaled));
+}
+
+s64 RoundingShift(s64 value, int bits) { return (value + (s64{1} << (bits - 1))) >> bits; }
+
+s32 DotProduct(const s16* input, const s16* taps, int length) {
+    using Simd::U16x8;
+    using Simd::S32x4;
+
+    S32x4 sum = S32x4::Zero();
+    for (int k = 0; k < length; k += 8) {
+        sum = sum + Simd::MulAddPairs(U16x8::Load(reinterpret_cast<const u16*>(input + k)),
+                                      U16x8::Load(reinterpret_cast<const u16*>(taps + k)));
+    }
+
+    std::array<s32, 4> lanes;
+    sum.Store(lanes.data());
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+} // End anonymous namespace
+
+Biquad::Biquad(float sampling_frequency, int _interpolation_factor, float q1, float q2)
+        : interpolation_factor(_interpolation_factor) {
+    if (interpolation_factor < 1 || interpolation_factor > max_interpolation_factor) {
+        throw std::invalid_argument("Unsupported interpolation factor for the lowpass filter.");
+    }
+
+    const double k = std::tan(M_PI * cutoff_frequency / sampling_frequency);
+    const std::array<Coefficients, 2> biquads{{ButterworthLowPass(k, q1), ButterworthLowPass(k, q2)}};
+    const auto [a, b, c, d] = FindStateSpace([&biquads](const StateVector& start, double input) {
+        return FilterSample(biquads, start, input);
+    });
+
+    // Since everything after an input sample is zero, interpolated sample n after the input sample has the
+    // output C * A^n * state + C * A^(n-1) * B * input.
+    Matrix a_power{};
+    StateVector b_power = b;
+    for (int i = 0; i < 4; ++i) {
+        a_power[i][i] = 1.0;
+    }
+
+    for (int n = 0; n < interpolation_factor; ++n) {
+        for (int i = 0; i < 4; ++i) {
+            // Row i of C * A^n is C dotted with column i of A^n.
+            output_state[n][i] = Dot(c, a_power[i]);
+        }
+        output_input[n] = (n == 0) ? d : Dot(c, b_power);
+
+        if (n != 0) {
+            b_power = Multiply(a, b_power);
+        }
+        for (auto& col : a_power) {
+            col = Multiply(a, col);
+        }
+    }
+
+    // a_power is now A^L and b_power is A^(L-1) * B.
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            step[i][j] = step[i][j + 4] = a_power[i][j];
+        }
+        step[4][i] = step[4][i + 4] = b_power[i];
+    }
+}
+
+void Biquad::Advance(const float* input, int count) {
+    advance_impl(step, state.data(), input, count);
+}
+
+std::tuple<float, float> Biquad::Output(int offset, float left_input, float right_input) const {
+    const auto& out = output_state[offset];
+    const float left = (out[0] * state[0] + out[1] * state[1]) + (out[2] * state[2] + out[3] * state[3]);
+    const float right = (out[0] * state[4] + out[1] * state[5]) + (out[2] * state[6] + out[3] * state[7]);
+
+    return {left + output_input[offset] * left_input, right + output_input[offset] * right_input};
+}
+
+FixedBiquad::FixedBiquad(float sampling_frequency, int _interpolation_factor, float q1, float q2, int _max_step)
+        : interpolation_factor(_interpolation_factor)
+        , max_step(_max_step)
+        , state_steps(max_step + 1) {
+    if (interpolation_factor < 1 || interpolation_factor > max_interpolation_factor) {
+        throw std::invalid_argument("Unsupported interpolation factor for the lowpass filter.");
+    }
+
+    // The coefficients are only rounded to fixed point once they've been designed, so the filter's output is the
+    // same on every host unless one of them falls within a rounding error of halfway between two steps.
+    const double k = std::tan(M_PI * cutoff_frequency / sampling_frequency);
+    const std::array<CoupledForm, 2> biquads{{ToCoupledForm(ButterworthLowPass(k, q1)),
+                                              ToCoupledForm(ButterworthLowPass(k, q2))}};
+    const auto [a, b, c, d] = FindStateSpace([&biquads](const StateVector& start, double input) {
+        return FilterSampleCoupled(biquads, start, input);
+    });
+
+    // As for the float filter, step over the interpolated samples of one input sample to find the outputs at each
+    // offset, and the matrix and input vector which step over the whole input sample.
+    Matrix a_power{};
+    StateVector b_power = b;
+    for (int i = 0; i < 4; ++i) {
+        a_power[i][i] = 1.0;
+    }
+
+    for (int n = 0; n < interpolation_factor; ++n) {
+        for (int i = 0; i < 4; ++i) {
+            output_state[n][i] = ToFixed(Dot(c, a_power[i]), coefficient_bits);
+        }
+        output_input[n] = ToFixed((n == 0) ? d : Dot(c, b_power), coefficient_bits);
+
+        if (n != 0) {
+            b_power = Multiply(a, b_power);
+        }
+        for (auto& col : a_power) {
+            col = Multiply(a, col);
+        }
+    }
+    const Matrix step = a_power;
+
+    // An input sample m samples before the end of a run adds step^m * (A^(L-1) * B) to the state.
+    std::array<std::vector<double>, 4> taps;
+    StateVector input_effect = b_power;
+    Matrix step_power{};
+    for (int i = 0; i < 4; ++i) {
+        step_power[i][i] = 1.0;
+    }
+
+    for (int m = 0; m <= max_step; ++m) {
+        for (int row = 0; row < 4; ++row) {
+            for (int col = 0; col < 4; ++col) {
+                state_steps[m][row][col] = ToFixed(step_power[col][row], coefficient_bits);
+            }
+        }
+        for (auto& col : step_power) {
+            col = Multiply(step, col);
+        }
+
+        if (m < max_step) {
+            for (int i = 0; i < 4; ++i) {
+                taps[i].push_back(input_effect[i]);
+            }
+            input_effect = Multiply(step, input_effect);
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        // Any run of s16 samples stays within an s32 if the taps sum to less than 2^16 in magnitude. Leave some
+        // room for them to round up.
+        double tap_sum = 0.0;
+        for (double tap : taps[i]) {
+            tap_sum += std::abs(tap);
+        }
+        tap_shifts[i] = static_cast<int>(std::floor(std::log2(0xFF00 / tap_sum)));
+        if (tap_shifts[i] <= state_bits) {
+            throw std::invalid_argument("Lowpass filter input taps out of fixed point range.");
+        }
+
+        input_taps[i].resize(max_step + 8);
+        for (int m = 0; m < max_step; ++m) {
+            input_taps[i][max_step - 1 - m] = static_cast<s16>(ToFixed(taps[i][m], tap_shifts[i]));
+        }
+    }
+}
+
+void FixedBiquad::Advance(const s16* left_input, const s16* right_input, int count) {
+    if (count == 0) {
+        return;
+    }
+
+    const auto& step = state_steps[count];
+    const int first_tap = max_step - count;
+    const int padded_count = (count + 7) & ~7;
+
+    for (int ch = 0; ch < 2; ++ch) {
+        const s16* input = (ch == 0) ? left_input : right_input;
+        std::array<s64, 4> next;
+        for (int row = 0; row < 4; ++row) {
+            s64 sum = 0;
+            for (int col = 0; col < 4; ++col) {
+                sum += static_cast<s64>(step[row][col]) * state[ch][col];
+            }
+
+            const s64 input_sum = DotProduct(input, &input_taps[row][first_tap], padded_count);
+            next[row] = RoundingShift(sum, coefficient_bits)
+                        + RoundingShift(input_sum, tap_shifts[row] - state_bits);
+        }
+        state[ch] = next;
+    }
+}
+
+std::tuple<s32, s32> FixedBiquad::Output(int offset, s16 left_input, s16 right_input) const {
+    const auto& out = output_state[offset];
+    std::array<s32, 2> result;
+    for (int ch = 0; ch < 2; ++ch) {
+        s64 sum = static_cast<s64>(output_input[offset]) * ((ch == 0) ? left_input : right_input) * (1 << state_bits);
+        for (int i = 0; i < 4; ++i) {
+            sum += static_cast<s64>(out[i]) * state[ch][i];
+        }
+        result[ch] = static_cast<s32>(RoundingShift(sum, coefficient_bits + state_bits));
+    }
+
+    return {result[0], result[1]};
+}
+
+void Biquad::SerializeState(State& serialized) {
+    serialized.Sync(state);
+}
+
+void FixedBiquad::SerializeState(State& serialized) {
+    serialized.Sync(state);
+}
+
+} // End namespace Common
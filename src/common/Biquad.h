@@ -14,141 +14,98 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+
 #pragma once
 
+#include <array>
+#include <tuple>
 #include <vector>
-#include <cmath>
-#include <emmintrin.h>
 
-#include "common/Vec4f.h"
+#include "common/CommonTypes.h"
 
 namespace Common {
 
+class State;
+
+// A 4th order Butterworth lowpass made of two cascaded biquads, for filtering a signal which has been zero-stuffed by
+// an interpolation factor. Running the biquads on every interpolated sample would mostly be filtering zeros, so the
+// cascade is instead treated as one linear system with four state variables, and stepped over a whole input sample
+// (plus its trailing zeros) at a time. The outputs only need to be calculated for the interpolated samples that are
+// kept after decimation.
 class Biquad {
 public:
     Biquad() = default;
-    Biquad(int interpolated_buffer_size, float q1, float q2) {
-        const float sampling_frequency = interpolated_buffer_size * 60.0f;
-        const float k = std::tan(M_PI * cutoff_frequency / sampling_frequency);
-        const float norm1 = 1.0f / (1.0f + k / q1 + k * k);
-        const float norm2 = 1.0f / (1.0f + k / q2 + k * k);
-
-        const Vec4f q_vec{q1, q1, q2, q2};
-        const Vec4f k_vec{k, k, k, k};
-        const Vec4f norm_vec{norm1, norm1, norm2, norm2};
-        constexpr Vec4f two_vec{2, 2, 2, 2};
-        constexpr Vec4f one_vec{1, 1, 1, 1};
-
-        // The coefficients are for a two-pass Butterworth lowpass IIR filter. The first biquad is packed in the
-        // low half of the Vec4f coefficients, and the second biquad in the high half.
-        a0 = k_vec * k_vec * norm_vec;
-        a1 = two_vec * a0;
-        b1 = two_vec * (k_vec * k_vec - one_vec) * norm_vec;
-        b2 = (one_vec - k_vec / q_vec + k_vec * k_vec) * norm_vec;
-    }
-
-    Vec4f Filter(Vec4f input) {
-        // Biquad form used is the Transposed Direct Form 2.
-        const Vec4f in_a0 = input * a0;
-        const Vec4f output = z2 + in_a0;
-        z2 = input * a1 - output * b1 + z1;
-        z1 = in_a0 - output * b2;
-
-        return output;
-    }
-
-    Vec4f FilterLowSample(Vec4f input) {
-        // Make a copy of biquad2's Z values.
-        const Vec4f high_z1 = z1;
-        const Vec4f high_z2 = z2;
-
-        // Filter the low/even sample through biquad1, and copy the unfiltered high/odd sample.
-        const Vec4f high_sample = input;
-        const Vec4f output = Vec4f::Combine(Filter(input), high_sample);
-
-        // Restore biquad2's original Z values, since we just messed them up by filtering the high sample
-        // through biquad2.
-        z1 = Vec4f::Combine(z1, high_z1);
-        z2 = Vec4f::Combine(z2, high_z2);
-
-        return output;
-    }
-
-    Vec4f FilterHighSample(Vec4f input) {
-        // Make a copy of biquad1's Z values.
-        const Vec4f low_z1 = z1;
-        const Vec4f low_z2 = z2;
-
-        // Filter the high/odd sample through biquad2, and copy the low/even sample.
-        const Vec4f low_sample = input;
-        const Vec4f output = Vec4f::Combine(low_sample, Filter(input));
-
-        // Restore biquad1's original Z values, since we just messed them up by filtering the low sample
-        // through biquad1.
-        z1 = Vec4f::Combine(low_z1, z1);
-        z2 = Vec4f::Combine(low_z2, z2);
-
-        return output;
-    }
-
-    static void LowPassFilter(std::vector<Vec4f>& resample_buffer, Biquad& biquad) {
-        // Even numbered stereo samples are packed in the low half of the Vec4f, and odd numbered samples in the
-        // high half. We process the left and right channels in parallel for each stereo sample, and we process
-        // stereo sample i and i+1 in parallel using SIMD.
-
-        // Filter sample 0 through biquad1 by itself.
-        Vec4f filtering_samples = biquad.FilterLowSample(resample_buffer[0]);
-
-        // Now swap the unfiltered sample 1 into the low half of a Vec4f, and the filtered sample 0 into the high half.
-        filtering_samples = Vec4f::Swap(filtering_samples);
-
-        for (unsigned int i = 1; i < resample_buffer.size(); ++i) {
-            // Filter the odd sample through biquad1 and the even sample through biquad2.
-            filtering_samples = biquad.Filter(filtering_samples);
-
-            // Restore the original sample order.
-            filtering_samples = Vec4f::Swap(filtering_samples);
-            // Make a copy of the twice-filtered even sample.
-            Vec4f finished_samples{filtering_samples};
-
-            const Vec4f next_samples = resample_buffer[i];
-
-            // Copy the next even sample to the low half of filtering_samples.
-            filtering_samples = Vec4f::Combine(next_samples, filtering_samples);
-            // Filter the next even sample through biquad1 and the previous odd sample through biquad2.
-            filtering_samples = biquad.Filter(filtering_samples);
-
-            // Reunite the twice-filtered odd sample with the previous even sample.
-            finished_samples = Vec4f::Combine(finished_samples, filtering_samples);
-            resample_buffer[i - 1] = finished_samples;
-
-            // Copy the next odd sample into the low half of filtering_samples and the filtered even sample
-            // into the high half.
-            filtering_samples = Vec4f::CombineAndSwap(filtering_samples, next_samples);
-        }
-
-        // Filter the last odd sample through biquad1 and the last even sample through biquad2.
-        filtering_samples = biquad.Filter(filtering_samples);
-
-        // Restore the original sample order.
-        filtering_samples = Vec4f::Swap(filtering_samples);
-
-        // Run the last odd sample through biquad2 by itself.
-        filtering_samples = biquad.FilterHighSample(filtering_samples);
-        resample_buffer[resample_buffer.size() - 1] = filtering_samples;
-    }
+    Biquad(float sampling_frequency, int _interpolation_factor, float q1, float q2);
+
+    // Filters the given interleaved stereo input samples, and their trailing zeros.
+    void Advance(const float* input, int count);
+
+    // The output for the interpolated sample at the given offset from the next input sample, which is not consumed.
+    std::tuple<float, float> Output(int offset, float left_input, float right_input) const;
+
+    // Only the state is saved. The coefficients come from the constructor.
+    void SerializeState(State& state);
 
 private:
-    static constexpr float cutoff_frequency = 24000.0f;
+    static constexpr int max_interpolation_factor = 16;
+
+    int interpolation_factor = 1;
 
-    Vec4f a0;
-    Vec4f a1;
-    // a2 == a0;
-    Vec4f b1;
-    Vec4f b2;
+    // The left channel's state is in the low half, and the right channel's in the high half.
+    alignas(32) std::array<float, 8> state{};
 
-    Vec4f z1 = {0.0f, 0.0f, 0.0f, 0.0f};
-    Vec4f z2 = {0.0f, 0.0f, 0.0f, 0.0f};
+    // The columns of the matrix which steps the state over one input sample, followed by the effect of the input
+    // sample itself on the state. Each is repeated in both halves, to update both channels at once.
+    alignas(32) std::array<std::array<float, 8>, 5> step{};
+
+    // For each offset, how the state and the input sample contribute to the output.
+    std::array<std::array<float, 4>, max_interpolation_factor> output_state{};
+    std::array<float, max_interpolation_factor> output_input{};
+};
+
+// The same lowpass in fixed point, so its output is bit-exact whatever the host. The state variables of the
+// transposed biquads grow much larger than the signal and cancel each other out, which would waste most of an
+// integer's bits, so each biquad is realised in coupled form instead, whose state stays on the scale of the input.
+// It also steps over a run of input samples at once: the state is multiplied by the step matrix raised to the run's
+// length, and each state variable adds in the run's input through a short FIR filter, with 16-bit taps.
+class FixedBiquad {
+public:
+    FixedBiquad() = default;
+    // Advance takes at most max_step input samples at a time.
+    FixedBiquad(float sampling_frequency, int _interpolation_factor, float q1, float q2, int _max_step);
+
+    // Filters the given input samples of each channel, and their trailing zeros. The inputs are read in groups of 8,
+    // so up to 7 samples past the end must be readable.
+    void Advance(const s16* left_input, const s16* right_input, int count);
+
+    // The rounded output for the interpolated sample at the given offset from the next input sample, which is not
+    // consumed.
+    std::tuple<s32, s32> Output(int offset, s16 left_input, s16 right_input) const;
+
+    void SerializeState(State& state);
+
+private:
+    static constexpr int max_interpolation_factor = 16;
+    // The coefficients are Q30, and the state is kept with 8 fractional bits.
+    static constexpr int coefficient_bits = 30;
+    static constexpr int state_bits = 8;
+
+    int interpolation_factor = 1;
+    int max_step = 0;
+
+    // The left channel's state, then the right's.
+    std::array<std::array<s64, 4>, 2> state{};
+
+    // The matrix which steps the state over each number of input samples from 0 to max_step, by rows.
+    std::vector<std::array<std::array<s32, 4>, 4>> state_steps;
+    // For each state variable, the effect of an input sample max_step - 1 - i samples before the end of a run, so
+    // the taps for a shorter run start partway in. They're followed by zeros to pad the run to a multiple of 8.
+    std::array<std::vector<s16>, 4> input_taps;
+    // The taps are scaled by this many bits, as many as fit without the dot products overflowing.
+    std::array<int, 4> tap_shifts{};
+
+    std::array<std::array<s32, 4>, max_interpolation_factor> output_state{};
+    std::array<s32, max_interpolation_factor> output_input{};
 };
 
 } // End namespace Common
@@ -0,0 +1,138 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "common/CommonTypes.h"
+#include "common/SaveState.h"
+
+namespace Common {
+
+// Band-limited step synthesis. Instead of storing every input sample, only the changes in amplitude are recorded,
+// each one as a band-limited step placed at its exact position between output samples. Integrating the deltas then
+// produces the output samples directly at the output rate.
+class BlipBuffer {
+public:
+    BlipBuffer() = default;
+    BlipBuffer(int _input_samples_per_frame, int _output_samples_per_frame, float _gain)
+            : input_samples_per_frame(_input_samples_per_frame)
+            , output_samples_per_frame(_output_samples_per_frame)
+            , gain(_gain / kernel_unit)
+            , left_deltas(output_samples_per_frame + kernel_width)
+            , right_deltas(output_samples_per_frame + kernel_width) {
+
+        for (int p = 0; p < phases; ++p) {
+            const double fraction = static_cast<double>(p) / phases;
+            std::array<double, kernel_width> impulse;
+            double impulse_sum = 0.0;
+
+            for (int k = 0; k < kernel_width; ++k) {
+                // Distance from the step to this tap, in output samples.
+                const double t = k - half_width - fraction;
+                const double sinc = (t == 0.0) ? 1.0 : std::sin(M_PI * cutoff * t) / (M_PI * cutoff * t);
+                const double window = 0.42 + 0.5 * std::cos(M_PI * t / half_width)
+                                           + 0.08 * std::cos(2.0 * M_PI * t / half_width);
+                impulse[k] = sinc * window;
+                impulse_sum += impulse[k];
+            }
+
+            // Each phase must add up to exactly one unit, otherwise the integrated output would drift.
+            int kernel_sum = 0;
+            for (int k = 0; k < kernel_width; ++k) {
+                kernels[p][k] = static_cast<int>(std::lround(impulse[k] / impulse_sum * kernel_unit));
+                kernel_sum += kernels[p][k];
+            }
+            kernels[p][half_width] += kernel_unit - kernel_sum;
+        }
+    }
+
+    // The time is the index of the input sample within the current frame.
+    void AddDelta(int time, int left_delta, int right_delta) {
+        const u64 position = static_cast<u64>(time) * output_samples_per_frame * phases / input_samples_per_frame;
+        const std::size_t index = position / phases;
+        const auto& kernel = kernels[position % phases];
+
+        for (int k = 0; k < kernel_width; ++k) {
+            left_deltas[index + k] += static_cast<s64>(left_delta) * kernel[k];
+            right_deltas[index + k] += static_cast<s64>(right_delta) * kernel[k];
+        }
+    }
+
+    // Records a delta only if the amplitude differs from the last one.
+    void SetAmplitude(int time, int left, int right) {
+        if (left != left_amplitude || right != right_amplitude) {
+            AddDelta(time, left - left_amplitude, right - right_amplitude);
+            left_amplitude = left;
+            right_amplitude = right;
+        }
+    }
+
+    // Writes one frame of interleaved stereo samples, and carries the tails of the last steps into the next frame.
+    template<std::size_t N>
+    void ReadFrame(std::array<s16, N>& output_buffer) {
+        for (int i = 0; i < output_samples_per_frame; ++i) {
+            left_level += left_deltas[i];
+            right_level += right_deltas[i];
+
+            output_buffer[i * 2] = ClampSample(left_level);
+            output_buffer[i * 2 + 1] = ClampSample(right_level);
+        }
+
+        std::copy(left_deltas.cbegin() + output_samples_per_frame, left_deltas.cend(), left_deltas.begin());
+        std::fill(left_deltas.begin() + kernel_width, left_deltas.end(), 0);
+        std::copy(right_deltas.cbegin() + output_samples_per_frame, right_deltas.cend(), right_deltas.begin());
+        std::fill(right_deltas.begin() + kernel_width, right_deltas.end(), 0);
+    }
+
+    std::size_t Bytes() const { return (left_deltas.capacity() + right_deltas.capacity()) * sizeof(s64); }
+
+    // Saves the steps still to come out and the current levels. The kernels come from the constructor.
+    void SerializeState(State& state) {
+        state.Sync(left_deltas, right_deltas, left_level, right_level, left_amplitude, right_amplitude);
+    }
+
+private:
+    static constexpr int half_width = 8;
+    static constexpr int kernel_width = half_width * 2;
+    static constexpr int phases = 64;
+    static constexpr int kernel_unit = 1 << 14;
+    // Cutoff as a fraction of the output Nyquist frequency, to leave room for the kernel's transition band.
+    static constexpr double cutoff = 0.9;
+
+    int input_samples_per_frame = 1;
+    int output_samples_per_frame = 0;
+    float gain = 0.0f;
+
+    std::array<std::array<int, kernel_width>, phases> kernels{};
+    std::vector<s64> left_deltas;
+    std::vector<s64> right_deltas;
+    s64 left_level = 0;
+    s64 right_level = 0;
+    int left_amplitude = 0;
+    int right_amplitude = 0;
+
+    s16 ClampSample(s64 level) const {
+        return std::clamp(static_cast<int>(std::lround(level * gain)), -0x8000, 0x7FFF);
+    }
+};
+
+} // End namespace Common
@@ -0,0 +1,35 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// A debugger stop, set with --break. Each one is installed as a hook, so only the watched RAM pages and, while any
+// PC is hooked, instruction dispatch are slowed down. Hitting one prints the code around the current instruction and
+// the registers, then pauses the emulator at the end of the frame.
+struct Breakpoint {
+    enum class Type {Exec, Read, Write, Irq};
+
+    Type type = Type::Exec;
+    // The PC for Exec, an inclusive address range for Read and Write, and the IF bit mask for Irq.
+    u32 low = 0;
+    u32 high = 0;
+};
+
+} // End namespace Common
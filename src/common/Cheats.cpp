@@ -0,0 +1,210 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fmt/format.h>
+
+#include "common/Cheats.h"
+
+namespace Common {
+
+namespace {
+
+// The code with the separators taken out, in upper case, or an empty string if anything else isn't a hex digit.
+std::string HexDigits(const std::string& code) {
+    std::string digits;
+    for (const char c : code) {
+        if (c == ' ' || c == '-' || c == '\t' || c == '\r') {
+            continue;
+        } else if (!std::isxdigit(static_cast<unsigned char>(c))) {
+            return "";
+        }
+        digits.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(c))));
+    }
+    return digits;
+}
+
+u32 ParseHex(const std::string& digits, std::size_t pos, std::size_t count) {
+    return std::stoul(digits.substr(pos, count), nullptr, 16);
+}
+
+std::runtime_error InvalidCode(const std::string& code, const std::string& reason) {
+    return std::runtime_error(fmt::format("Invalid cheat code \"{}\": {}.", code, reason));
+}
+
+// GameShark and Action Replay v1/v2 codes are encrypted with TEA, using these seeds unless a DEADFACE code changes
+// them.
+void DecryptGameShark(u32& addr, u32& value) {
+    static constexpr std::array<u32, 4> seeds{0x09F4'FBBD, 0x9681'884A, 0x3520'27E9, 0xF3DE'E5A7};
+    u32 sum = 0xC6EF'3720;
+    for (int i = 0; i < 32; ++i) {
+        value -= ((addr << 4) + seeds[2]) ^ (addr + sum) ^ ((addr >> 5) + seeds[3]);
+        addr -= ((value << 4) + seeds[0]) ^ (value + sum) ^ ((value >> 5) + seeds[1]);
+        sum -= 0x9E37'79B9;
+    }
+}
+
+} // End anonymous namespace
+
+std::vector<Cheat> DecodeGbCheats(const std::vector<std::string>& codes) {
+    std::vector<Cheat> cheats;
+    for (const auto& code : codes) {
+        const std::string digits = HexDigits(code);
+        std::array<u32, 9> d{};
+        for (std::size_t i = 0; i < digits.size() && i < d.size(); ++i) {
+            d[i] = ParseHex(digits, i, 1);
+        }
+
+        Cheat cheat;
+        if (digits.size() == 6 || digits.size() == 9) {
+            // Game Genie: ABC-DEF-GHI patches the ROM with AB at address ~F CDE. The optional GI is the byte being
+            // replaced, rotated left by two and XORed with 0xBA.
+            cheat.type = Cheat::Type::RomPatch;
+            cheat.value = (d[0] << 4) | d[1];
+            cheat.addr = ((d[5] ^ 0xF) << 12) | (d[2] << 8) | (d[3] << 4) | d[4];
+            if (cheat.addr >= 0x8000) {
+                throw InvalidCode(code, "Game Genie codes can only patch ROM");
+            }
+            if (digits.size() == 9) {
+                const u8 compare = (d[6] << 4) | d[8];
+                cheat.compare = static_cast<u8>(((compare >> 2) | (compare << 6)) ^ 0xBA);
+            }
+        } else if (digits.size() == 8) {
+            // GameShark: 01VVLLHH writes VV to address HHLL. The first byte selects the external RAM bank, which
+            // is left to whichever bank the game has mapped.
+            cheat.value = ParseHex(digits, 2, 2);
+            cheat.addr = ParseHex(digits, 4, 2) | (ParseHex(digits, 6, 2) << 8);
+        } else {
+            throw InvalidCode(code, "expected a Game Genie or GameShark code");
+        }
+        cheats.push_back(cheat);
+    }
+
+    return cheats;
+}
+
+std::vector<Cheat> DecodeGbaCheats(const std::vector<std::string>& codes) {
+    std::vector<Cheat> cheats;
+    std::optional<Cheat::Condition> condition;
+    for (const auto& code : codes) {
+        const std::string digits = HexDigits(code);
+        if (digits.size() != 16 && digits.size() != 12) {
+            throw InvalidCode(code, "expected a GameShark, Action Replay or CodeBreaker code");
+        }
+
+        u32 addr = ParseHex(digits, 0, 8);
+        u32 value = ParseHex(digits, 8, digits.size() - 8);
+        Cheat cheat;
+        if (digits.size() == 16) {
+            DecryptGameShark(addr, value);
+            if (addr == 0xDEAD'FACE) {
+                throw InvalidCode(code, "codes which change the encryption seeds aren't supported");
+            } else if (value == 0x001D'C0DE) {
+                // ID code.
+                continue;
+            }
+
+            switch (addr >> 28) {
+            case 0x0:
+            case 0x1:
+            case 0x2:
+                cheat.size = 1 << (addr >> 28);
+                cheat.addr = addr & 0x0FFF'FFFF;
+                cheat.value = value & (0xFFFF'FFFF >> (32 - 8 * cheat.size));
+                break;
+            case 0x6:
+                // Halfword ROM patch, addressed in halfwords.
+                cheat.type = Cheat::Type::RomPatch;
+                cheat.size = 2;
+                cheat.addr = 0x0800'0000 + ((addr & 0x00FF'FFFF) << 1);
+                cheat.value = value & 0xFFFF;
+                break;
+            case 0xD:
+                condition = Cheat::Condition{addr & 0x0FFF'FFFF, static_cast<u16>(value)};
+                continue;
+            case 0xF:
+                // Master code, which tells the device where to hook the game.
+                continue;
+            default:
+                throw InvalidCode(code, fmt::format("GameShark code type {:X} isn't supported", addr >> 28));
+            }
+        } else {
+            switch (addr >> 28) {
+            case 0x0:
+            case 0x1:
+                // Master code.
+                continue;
+            case 0x3:
+            case 0x8:
+                cheat.size = (addr >> 28 == 0x3) ? 1 : 2;
+                cheat.addr = addr & 0x0FFF'FFFF;
+                cheat.value = value & ((cheat.size == 1) ? 0xFF : 0xFFFF);
+                break;
+            case 0x7:
+                condition = Cheat::Condition{addr & 0x0FFF'FFFF, static_cast<u16>(value)};
+                continue;
+            case 0x9:
+                throw InvalidCode(code, "encrypted CodeBreaker codes aren't supported");
+            default:
+                throw InvalidCode(code, fmt::format("CodeBreaker code type {:X} isn't supported", addr >> 28));
+            }
+        }
+
+        if (condition && cheat.type == Cheat::Type::RomPatch) {
+            throw InvalidCode(code, "ROM patches can't be conditional");
+        }
+        cheat.condition = condition;
+        condition.reset();
+        cheats.push_back(cheat);
+    }
+
+    if (condition) {
+        throw InvalidCode(codes.back(), "a conditional code needs a code after it");
+    }
+
+    return cheats;
+}
+
+std::vector<std::string> SplitCheatCodes(const std::string& text) {
+    std::istringstream stream{text};
+    std::vector<std::string> codes;
+    std::string line;
+    while (std::getline(stream, line)) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") != std::string::npos) {
+            codes.push_back(line);
+        }
+    }
+
+    return codes;
+}
+
+std::vector<std::string> LoadCheatFile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    std::ostringstream text;
+    text << file.rdbuf();
+    return SplitCheatCodes(text.str());
+}
+
+} // End namespace Common
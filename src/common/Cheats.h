@@ -0,0 +1,59 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// A decoded cheat code. ROM patches are baked into copies of the patched ROM pages, which the page tables map in
+// place of the originals, so reads cost the same as without cheats. RAM writes are made once per frame before it's
+// emulated, the way the cheat devices do it from their VBlank hook.
+struct Cheat {
+    enum class Type {RamWrite, RomPatch};
+
+    Type type = Type::RamWrite;
+    u32 addr = 0;
+    u32 value = 0;
+    // 1, 2 or 4 bytes. GB cheats are always a single byte.
+    int size = 1;
+    // Game Genie patches with a compare byte only apply to the ROM banks holding that byte at the address.
+    std::optional<u8> compare;
+    // A conditional code before this one, which only lets it apply while the halfword at the address holds the value.
+    struct Condition {
+        u32 addr;
+        u16 value;
+    };
+    std::optional<Condition> condition;
+};
+
+// Both throw std::runtime_error naming the first code that can't be decoded. Codes may contain spaces and dashes.
+// GB: Game Genie (ABC-DEF or ABC-DEF-GHI) and GameShark (01VVLLHH).
+std::vector<Cheat> DecodeGbCheats(const std::vector<std::string>& codes);
+// GBA: GameShark and Action Replay v1/v2 (XXXXXXXX YYYYYYYY, encrypted) and unencrypted CodeBreaker
+// (XXXXXXXX YYYY). Master and ID codes are skipped, since cheats are applied without hooking the game.
+std::vector<Cheat> DecodeGbaCheats(const std::vector<std::string>& codes);
+
+// One code per line. Blank lines and everything after a # are ignored.
+std::vector<std::string> SplitCheatCodes(const std::string& text);
+std::vector<std::string> LoadCheatFile(const std::string& path);
+
+} // End namespace Common
@@ -0,0 +1,59 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Which guest instructions have run, for QA reports. Each core divides the code it can run from into slots, one per
+// place an instruction can start, and sets a slot's bit whenever an instruction there runs. Bits are never cleared,
+// so the map covers everything run since it was created.
+class CodeCoverage {
+public:
+    explicit CodeCoverage(std::size_t slots) : num_slots(slots), bits((slots + 63) / 64) {}
+
+    void Mark(std::size_t slot) { bits[slot / 64] |= u64{1} << (slot % 64); }
+    bool Marked(std::size_t slot) const { return (bits[slot / 64] >> (slot % 64)) & 1; }
+
+    std::size_t Slots() const { return num_slots; }
+    // The number of marked slots between first and last, exclusive of last.
+    std::size_t Count(std::size_t first, std::size_t last) const {
+        std::size_t count = 0;
+        for (std::size_t slot = first; slot < last; ++slot) {
+            if (slot % 64 == 0 && slot + 64 <= last) {
+                count += std::bitset<64>(bits[slot / 64]).count();
+                slot += 63;
+            } else {
+                count += Marked(slot);
+            }
+        }
+
+        return count;
+    }
+
+private:
+    std::size_t num_slots;
+    std::vector<u64> bits;
+};
+
+} // End namespace Common
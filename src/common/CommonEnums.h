@@ -16,4 +16,12 @@
 
 #pragma once
 
-enum class LogLevel {None, Trace, Registers};
+// The binary levels write compact records to ./trace.bin instead of text to ./log.txt.
+enum class LogLevel {None, Trace, Registers, BinaryTrace, BinaryRegisters};
+enum class LogOverflow {Block, Drop};
+enum class ExecMode {Interpreter, Cached, Jit};
+// None skips producing audio output altogether, for runs where nobody listens.
+enum class AudioFilter {Iir, Nearest, Linear, Sinc, Blip, FixedIir, None};
+// The scanline renderer draws each Game Boy line in one go as mode 3 begins. The accurate one splits a line where
+// a register it reads is written partway through drawing it.
+enum class GbRenderer {Scanline, Accurate};
@@ -0,0 +1,54 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Edge coverage of guest code, for fuzzers. Every instruction the CPU runs bumps the hit counter of the edge from
+// the instruction before it, the way AFL instruments native code, so a fuzzer can tell which inputs reach new code
+// or take a branch a new number of times. Edges are hashed into a fixed map, and counters stop at 255.
+class Coverage {
+public:
+    static constexpr std::size_t map_size = 64 * 1024;
+
+    void Visit(u32 pc) {
+        const u32 location = (pc * 0x9E37'79B1) >> 16;
+        u8& counter = map[location ^ previous];
+        counter += (counter != 0xFF);
+        // Shifted so an edge and its reverse, or a jump to itself, land in different counters.
+        previous = location >> 1;
+    }
+
+    void Clear() {
+        map.fill(0);
+        previous = 0;
+    }
+
+    const std::array<u8, map_size>& Map() const { return map; }
+
+private:
+    std::array<u8, map_size> map{};
+    u32 previous = 0;
+};
+
+} // End namespace Common
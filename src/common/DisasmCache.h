@@ -0,0 +1,89 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Remembers the text of disassembled instructions, so tracing a loop formats each instruction once rather than on
+// every pass. Keys must identify the text on their own: an opcode where the text depends only on the opcode, or a
+// ROM offset where it depends on the bytes there. It's open-addressed with a short probe, and a full probe evicts
+// whatever sits in the key's home slot.
+class DisasmCache {
+public:
+    // Returns the cached text, or nullptr if the key isn't cached.
+    const std::string* Find(u64 key) const {
+        const std::size_t home = Home(key);
+        for (std::size_t i = 0; i < max_probe; ++i) {
+            const Slot& slot = slots[(home + i) & slot_mask];
+            if (!slot.used) {
+                return nullptr;
+            } else if (slot.key == key) {
+                return &slot.text;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Copies the text into a slot, reusing the memory of the text it replaces.
+    const std::string& Insert(u64 key, const std::string& text) {
+        const std::size_t home = Home(key);
+        Slot* target = &slots[home];
+        for (std::size_t i = 0; i < max_probe; ++i) {
+            Slot& slot = slots[(home + i) & slot_mask];
+            if (!slot.used || slot.key == key) {
+                target = &slot;
+                break;
+            }
+        }
+
+        target->used = true;
+        target->key = key;
+        target->text = text;
+        return target->text;
+    }
+
+    void Clear() {
+        for (auto& slot : slots) {
+            slot.used = false;
+        }
+    }
+
+private:
+    static constexpr int slot_bits = 12;
+    static constexpr std::size_t slot_mask = (1 << slot_bits) - 1;
+    static constexpr std::size_t max_probe = 4;
+
+    struct Slot {
+        bool used = false;
+        u64 key = 0;
+        std::string text;
+    };
+    std::vector<Slot> slots = std::vector<Slot>(slot_mask + 1);
+
+    static std::size_t Home(u64 key) {
+        return static_cast<std::size_t>((key * 0x9E37'79B9'7F4A'7C15) >> (64 - slot_bits));
+    }
+};
+
+} // End namespace Common
@@ -0,0 +1,82 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace Common {
+
+// Allocates a vector's storage by mapping a file, or from the heap if it has none. File provides Map(bytes), which
+// maps the start of the file, and Unmap(ptr, bytes). Default-constructed elements are left uninitialized when
+// mapped, so sizing a vector over an existing file keeps its contents. Reallocation maps the file again and copies
+// it onto itself, which is harmless but wasteful, so the vectors should be sized once.
+template<typename T, typename File>
+class FileAllocator {
+public:
+    using value_type = T;
+
+    FileAllocator() = default;
+    explicit FileAllocator(std::shared_ptr<File> _file) : file(std::move(_file)) {}
+    template<typename U>
+    FileAllocator(const FileAllocator<U, File>& other) : file(other.file) {}
+
+    T* allocate(std::size_t n) {
+        if (file == nullptr) {
+            return std::allocator<T>{}.allocate(n);
+        }
+        return static_cast<T*>(file->Map(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) {
+        if (file == nullptr) {
+            std::allocator<T>{}.deallocate(ptr, n);
+        } else {
+            file->Unmap(ptr, n * sizeof(T));
+        }
+    }
+
+    template<typename U>
+    void construct(U* ptr) {
+        if (file == nullptr) {
+            ::new(static_cast<void*>(ptr)) U();
+        }
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        ::new(static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+
+    File* MappedFile() const { return file.get(); }
+
+    template<typename U>
+    bool operator==(const FileAllocator<U, File>& other) const { return file == other.file; }
+    template<typename U>
+    bool operator!=(const FileAllocator<U, File>& other) const { return file != other.file; }
+
+private:
+    template<typename U, typename OtherFile>
+    friend class FileAllocator;
+
+    std::shared_ptr<File> file;
+};
+
+} // End namespace Common
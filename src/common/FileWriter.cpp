@@ -0,0 +1,96 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <utility>
+
+#include "common/FileWriter.h"
+#include "common/SaveFlusher.h"
+
+namespace Common {
+
+FileWriter::~FileWriter() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        quit = true;
+    }
+    queue_cv.notify_all();
+
+    if (writer_thread.joinable()) {
+        writer_thread.join();
+    }
+}
+
+void FileWriter::Write(const std::string& path, std::vector<u8>& data) {
+    std::vector<u8> spare;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!writer_thread.joinable()) {
+            writer_thread = std::thread{&FileWriter::WriterLoop, this};
+        }
+
+        queue.push_back({path, std::move(data)});
+        if (!free_buffers.empty()) {
+            spare = std::move(free_buffers.back());
+            free_buffers.pop_back();
+        }
+    }
+    queue_cv.notify_one();
+
+    spare.clear();
+    data = std::move(spare);
+}
+
+void FileWriter::Flush() {
+    std::unique_lock<std::mutex> lock{mutex};
+    done_cv.wait(lock, [this] { return queue.empty() && !writing; });
+}
+
+void FileWriter::WriterLoop() {
+    while (true) {
+        File file;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            queue_cv.wait(lock, [this] { return !queue.empty() || quit; });
+            if (queue.empty()) {
+                return;
+            }
+
+            file = std::move(queue.front());
+            queue.pop_front();
+            writing = true;
+        }
+
+        WriteFileAtomic(file.path, file.data.data(), file.data.size());
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            writing = false;
+            // A couple of spare buffers covers a state being written while the next one is saved.
+            if (free_buffers.size() < 2) {
+                free_buffers.push_back(std::move(file.data));
+            }
+        }
+        done_cv.notify_all();
+    }
+}
+
+FileWriter& SharedFileWriter() {
+    static FileWriter writer;
+    return writer;
+}
+
+} // End namespace Common
@@ -0,0 +1,69 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Writes whole files on a background thread, in the order they were queued, so the emulator thread never waits on
+// storage. Files go through WriteFileAtomic, which prints an error if the write fails. The writer takes the
+// caller's buffer instead of copying it, and hands back one it's finished with, so a caller writing the same kind
+// of file again fills a buffer that's already the right size.
+class FileWriter {
+public:
+    FileWriter() = default;
+    // Writes everything still queued before returning.
+    ~FileWriter();
+
+    // Queues the contents of data to be written to path, and swaps data for an empty buffer with spare capacity.
+    void Write(const std::string& path, std::vector<u8>& data);
+    // Blocks until everything queued so far has been written.
+    void Flush();
+
+private:
+    struct File {
+        std::string path;
+        std::vector<u8> data;
+    };
+
+    std::mutex mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable done_cv;
+    std::deque<File> queue;
+    std::vector<std::vector<u8>> free_buffers;
+    // Set while the writer holds a file it has taken off the queue.
+    bool writing = false;
+    bool quit = false;
+    // Started by the first write.
+    std::thread writer_thread;
+
+    void WriterLoop();
+};
+
+// The writer shared by everything in the process.
+FileWriter& SharedFileWriter();
+
+} // End namespace Common
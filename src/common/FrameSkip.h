@@ -0,0 +1,82 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+#include <fmt/format.h>
+
+namespace Common {
+
+// Decides which emulated frames get drawn. The LCD keeps its timing, interrupts and DMAs on skipped frames, but
+// doesn't generate any pixels, so the last drawn frame stays on screen. The setting is either a fixed number of
+// frames to skip out of every setting + 1, or adaptive, where frames are skipped while emulation can't keep up.
+class FrameSkip {
+public:
+    static constexpr int adaptive = -1;
+    static constexpr int max_skip = 9;
+
+    explicit FrameSkip(int _setting) : setting(_setting) {}
+
+    // Called once per emulated frame, before the LCD starts drawing it.
+    bool SkipNextFrame() {
+        const int frames_to_skip = (setting == adaptive) ? adaptive_skip : setting;
+        if (skipped_frames < frames_to_skip) {
+            ++skipped_frames;
+            return true;
+        }
+
+        skipped_frames = 0;
+        return false;
+    }
+
+    // Called with the time it took to emulate each frame, which drives the adaptive setting.
+    void ReportFrameTime(std::chrono::microseconds frame_time) {
+        if (frame_time > frame_budget) {
+            adaptive_skip = std::min(adaptive_skip + 1, max_skip);
+        } else if (frame_time < frame_budget * 3 / 4) {
+            adaptive_skip = std::max(adaptive_skip - 1, 0);
+        }
+    }
+
+    // Steps through 0 to max_skip, then adaptive, then wraps back to 0.
+    void CycleSetting() {
+        if (setting == adaptive) {
+            setting = 0;
+        } else if (setting == max_skip) {
+            setting = adaptive;
+        } else {
+            ++setting;
+        }
+
+        skipped_frames = 0;
+        adaptive_skip = 0;
+
+        fmt::print("Frameskip changed to {}\n", (setting == adaptive) ? "auto" : std::to_string(setting));
+    }
+
+private:
+    static constexpr std::chrono::microseconds frame_budget{16667};
+
+    int setting;
+    int skipped_frames = 0;
+    int adaptive_skip = 0;
+};
+
+} // End namespace Common
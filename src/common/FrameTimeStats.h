@@ -0,0 +1,90 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Histograms of per-frame host timings, for percentiles that averages hide. The input latency is an estimate:
+// input is polled at the start of each frame and again when the game first reads the buttons, and the frame it
+// affects is shown on the display refresh after it's handed to the frontend, which is assumed to come one refresh
+// period later.
+class FrameTimeStats {
+public:
+    enum Metric {Emulate, Present, InputLatency, num_metrics};
+
+    static constexpr std::chrono::microseconds display_refresh{16667};
+
+    void Record(Metric metric, std::chrono::microseconds time) {
+        const auto bucket = std::min<std::size_t>(std::max<s64>(time.count(), 0) / bucket_us, num_buckets - 1);
+        ++histograms[metric][bucket];
+        ++counts[metric];
+        max_times[metric] = std::max(max_times[metric], time);
+    }
+
+    // The upper edge of the bucket holding the given fraction of samples, which is at most the largest sample.
+    std::chrono::microseconds Percentile(Metric metric, double fraction) const {
+        const u64 target = std::max<u64>(static_cast<u64>(counts[metric] * fraction + 0.5), 1);
+        u64 seen = 0;
+        for (std::size_t i = 0; i < num_buckets; ++i) {
+            seen += histograms[metric][i];
+            if (seen >= target) {
+                return std::min(std::chrono::microseconds{(i + 1) * bucket_us}, max_times[metric]);
+            }
+        }
+
+        return max_times[metric];
+    }
+
+    std::string Report() const {
+        static constexpr std::array<const char*, num_metrics> names{{"emulate", "present", "input_latency"}};
+
+        std::string report{"{"};
+        for (int i = 0; i < num_metrics; ++i) {
+            const auto metric = static_cast<Metric>(i);
+            report += fmt::format("{}\"{}\": {{\"frames\": {}, \"p50_ms\": {:.2f}, \"p95_ms\": {:.2f}, "
+                                  "\"p99_ms\": {:.2f}, \"max_ms\": {:.2f}}}",
+                                  (i == 0) ? "" : ", ", names[i], counts[i], Milliseconds(Percentile(metric, 0.50)),
+                                  Milliseconds(Percentile(metric, 0.95)), Milliseconds(Percentile(metric, 0.99)),
+                                  Milliseconds(max_times[i]));
+        }
+
+        return report + "}";
+    }
+
+private:
+    // 50us buckets up to 100ms, with everything slower in the last bucket.
+    static constexpr std::size_t bucket_us = 50;
+    static constexpr std::size_t num_buckets = 2000;
+
+    std::array<std::array<u32, num_buckets>, num_metrics> histograms{};
+    std::array<u64, num_metrics> counts{};
+    std::array<std::chrono::microseconds, num_metrics> max_times{};
+
+    static double Milliseconds(std::chrono::microseconds time) { return time.count() / 1000.0; }
+};
+
+} // End namespace Common
@@ -0,0 +1,157 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/Hash.h"
+#include "common/SaveState.h"
+
+namespace Common {
+
+namespace {
+
+constexpr u64 prime1 = 0x9E3779B185EBCA87;
+constexpr u64 prime2 = 0xC2B2AE3D27D4EB4F;
+constexpr u64 prime3 = 0x165667B19E3779F9;
+constexpr u64 prime4 = 0x85EBCA77C2B2AE63;
+constexpr u64 prime5 = 0x27D4EB2F165667C5;
+
+constexpr u64 RotateLeft(u64 value, int rotation) { return (value << rotation) | (value >> (64 - rotation)); }
+
+// The hash is defined on little-endian words.
+u64 Read64(const u8* ptr) {
+    u64 value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+u32 Read32(const u8* ptr) {
+    u32 value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+u64 Round(u64 acc, u64 input) {
+    acc += input * prime2;
+    return RotateLeft(acc, 31) * prime1;
+}
+
+u64 MergeRound(u64 acc, u64 lane) {
+    acc ^= Round(0, lane);
+    return acc * prime1 + prime4;
+}
+
+} // End anonymous namespace
+
+u64 XxHash64::Hash(const void* data, std::size_t size, u64 seed) {
+    XxHash64 hash{seed};
+    hash.Update(data, size);
+    return hash.Digest();
+}
+
+void XxHash64::Reset(u64 _seed) {
+    seed = _seed;
+    lanes = {{seed + prime1 + prime2, seed + prime2, seed, seed - prime1}};
+    buffered = 0;
+    total_size = 0;
+}
+
+void XxHash64::Update(const void* data, std::size_t size) {
+    const u8* ptr = static_cast<const u8*>(data);
+    total_size += size;
+
+    // Top up a partial stripe left by the last update first.
+    if (buffered != 0) {
+        const std::size_t fill = std::min(size, buffer.size() - buffered);
+        std::memcpy(buffer.data() + buffered, ptr, fill);
+        buffered += fill;
+        ptr += fill;
+        size -= fill;
+
+        if (buffered < buffer.size()) {
+            return;
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] = Round(lanes[i], Read64(buffer.data() + i * 8));
+        }
+        buffered = 0;
+    }
+
+    for (; size >= 32; ptr += 32, size -= 32) {
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] = Round(lanes[i], Read64(ptr + i * 8));
+        }
+    }
+
+    std::memcpy(buffer.data(), ptr, size);
+    buffered = size;
+}
+
+u64 XxHash64::Digest() const {
+    u64 hash;
+    if (total_size >= 32) {
+        hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12)
+               + RotateLeft(lanes[3], 18);
+        for (const u64 lane : lanes) {
+            hash = MergeRound(hash, lane);
+        }
+    } else {
+        hash = seed + prime5;
+    }
+
+    hash += total_size;
+
+    const u8* ptr = buffer.data();
+    std::size_t remaining = buffered;
+    for (; remaining >= 8; ptr += 8, remaining -= 8) {
+        hash ^= Round(0, Read64(ptr));
+        hash = RotateLeft(hash, 27) * prime1 + prime4;
+    }
+    if (remaining >= 4) {
+        hash ^= Read32(ptr) * prime1;
+        hash = RotateLeft(hash, 23) * prime2 + prime3;
+        ptr += 4;
+        remaining -= 4;
+    }
+    for (; remaining > 0; ++ptr, --remaining) {
+        hash ^= *ptr * prime5;
+        hash = RotateLeft(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+void XxHash64::SerializeState(State& state) {
+    // Only the buffered bytes count, and the rest are whatever earlier updates left there. They're cleared so that
+    // two hashes in the same state save the same bytes.
+    std::fill(buffer.begin() + buffered, buffer.end(), 0);
+    state.Sync(seed, lanes, buffer, buffered, total_size);
+}
+
+void OutputHash::SerializeState(State& state) {
+    state.Sync(frame_hash, audio_hash);
+}
+
+} // End namespace Common
@@ -0,0 +1,77 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+class State;
+
+// XXH64, which hashes several GB/s on a single core. Data can be fed in pieces of any size, and the digest is the
+// same as hashing it all at once.
+class XxHash64 {
+public:
+    explicit XxHash64(u64 _seed = 0) { Reset(_seed); }
+
+    static u64 Hash(const void* data, std::size_t size, u64 seed = 0);
+
+    void Reset(u64 _seed = 0);
+    void Update(const void* data, std::size_t size);
+    u64 Digest() const;
+
+    void SerializeState(State& state);
+
+private:
+    u64 seed;
+    std::array<u64, 4> lanes;
+    std::array<u8, 32> buffer;
+    std::size_t buffered = 0;
+    u64 total_size = 0;
+};
+
+// Hashes of everything a core outputs, so runs can be compared frame by frame without keeping the frames. The
+// frame hash covers the latest frame, while the audio hash covers every sample since power on. The audio hash is kept
+// in savestates, so a run which is saved and loaded partway through still ends on the same hash.
+class OutputHash {
+public:
+    // Returns false if the frame is the same as the last one, so whatever it feeds can skip it.
+    bool Frame(const u16* frame, std::size_t pixels) {
+        const u64 last_hash = std::exchange(frame_hash, XxHash64::Hash(frame, pixels * 2));
+        return frame_hash != last_hash;
+    }
+    void Audio(const s16* samples, std::size_t count) { audio_hash.Update(samples, count * sizeof(s16)); }
+
+    u64 FrameHash() const { return frame_hash; }
+    u64 AudioHash() const { return audio_hash.Digest(); }
+
+    // The frame hash is saved rather than taken again from the loaded frame, as it's still 0 until the first frame is
+    // finished.
+    void SerializeState(State& state);
+
+private:
+    u64 frame_hash = 0;
+    XxHash64 audio_hash;
+};
+
+} // End namespace Common
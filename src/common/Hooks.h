@@ -0,0 +1,124 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <functional>
+#include <unordered_map>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Callbacks into an embedder or the debugger at exact points in the emulation, for when the state at the end of
+// each step isn't enough. Nothing is checked in the hot paths: when the hooks change, each core takes the hooked RAM
+// pages out of its page tables and decodes through tables of hook handlers while any PC is hooked, so only those
+// slow paths ever look here. The LCD hooks are checked once per scanline.
+class Hooks {
+public:
+    using FrameFunc = std::function<void()>;
+    using ExecFunc = std::function<void(u32 pc)>;
+    using AccessFunc = std::function<void(u32 offset)>;
+    using IrqFunc = std::function<void(u32 interrupt_mask)>;
+    using LineFunc = std::function<void(int line)>;
+
+    // The RAM regions which can be watched, the same ones the library exposes. Access hooks are keyed by the byte
+    // offset into the region.
+    enum Region {Wram, FastRam};
+
+    FrameFunc frame_ended;
+    std::unordered_map<u32, ExecFunc> exec;
+    std::array<std::unordered_map<u32, AccessFunc>, 2> reads;
+    std::array<std::unordered_map<u32, AccessFunc>, 2> writes;
+    // Called with the IF bits of the interrupt as the CPU jumps to its handler.
+    IrqFunc irq_taken;
+    // Called as the LCD starts each scanline, including those in vblank, and as each visible line enters hblank.
+    LineFunc line_started;
+    LineFunc hblank_started;
+    // Called as vblank starts, once the finished frame has become the front frame.
+    FrameFunc vblank_started;
+
+    bool ExecHooked() const { return !exec.empty(); }
+    bool ReadsHooked(Region region) const { return !reads[region].empty(); }
+    bool WritesHooked(Region region) const { return !writes[region].empty(); }
+    // Whether any of the bytes in the range are watched. Only called when the hooks change.
+    bool ReadsHooked(Region region, u32 offset, u32 size) const { return AnyInRange(reads[region], offset, size); }
+    bool WritesHooked(Region region, u32 offset, u32 size) const { return AnyInRange(writes[region], offset, size); }
+
+    void FrameEnded() const {
+        if (frame_ended) {
+            frame_ended();
+        }
+    }
+
+    void Executed(u32 pc) const {
+        const auto it = exec.find(pc);
+        if (it != exec.end()) {
+            it->second(pc);
+        }
+    }
+
+    void LineStarted(int line) const {
+        if (line_started) {
+            line_started(line);
+        }
+    }
+
+    void HBlankStarted(int line) const {
+        if (hblank_started) {
+            hblank_started(line);
+        }
+    }
+
+    void VBlankStarted() const {
+        if (vblank_started) {
+            vblank_started();
+        }
+    }
+
+    // Called after the access, with every byte it covered.
+    void Read(Region region, u32 offset, u32 size) const { CallInRange(reads[region], offset, size); }
+    void Written(Region region, u32 offset, u32 size) const { CallInRange(writes[region], offset, size); }
+
+    void InterruptTaken(u32 interrupt_mask) const {
+        if (irq_taken) {
+            irq_taken(interrupt_mask);
+        }
+    }
+
+private:
+    static bool AnyInRange(const std::unordered_map<u32, AccessFunc>& hooks, u32 offset, u32 size) {
+        for (const auto& hook : hooks) {
+            if (hook.first - offset < size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void CallInRange(const std::unordered_map<u32, AccessFunc>& hooks, u32 offset, u32 size) {
+        for (u32 i = 0; i < size; ++i) {
+            const auto it = hooks.find(offset + i);
+            if (it != hooks.end()) {
+                it->second(offset + i);
+            }
+        }
+    }
+};
+
+} // End namespace Common
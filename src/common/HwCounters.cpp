@@ -0,0 +1,134 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common/HwCounters.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#endif
+
+namespace Common {
+
+#ifdef __linux__
+
+namespace {
+
+struct CounterGroup {
+    CounterGroup() {
+        constexpr u64 l1d_read_miss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const std::array<std::pair<u32, u64>, HwCounters::num_events> events{{
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, l1d_read_miss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        }};
+
+        // Cycles leads the group, so the rest are only scheduled alongside it. If it can't be opened, nothing is.
+        int leader = -1;
+        for (int i = 0; i < HwCounters::num_events; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd == -1) {
+                if (leader == -1) {
+                    return;
+                }
+                continue;
+            }
+            if (leader == -1) {
+                leader = fd;
+            }
+            fds[i] = fd;
+            available[i] = true;
+        }
+    }
+
+    ~CounterGroup() {
+        for (int fd : fds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+
+    CounterGroup(const CounterGroup&) = delete;
+    CounterGroup& operator=(const CounterGroup&) = delete;
+
+    HwCounters::Values Read() const {
+        HwCounters::Values values{};
+        if (fds[0] == -1) {
+            return values;
+        }
+
+        // A group read returns the number of events followed by their values, in the order they were opened.
+        std::array<u64, HwCounters::num_events + 1> buffer{};
+        if (read(fds[0], buffer.data(), sizeof(buffer)) <= 0) {
+            return values;
+        }
+        std::size_t next = 1;
+        for (int i = 0; i < HwCounters::num_events; ++i) {
+            if (available[i]) {
+                values[i] = buffer[next++];
+            }
+        }
+        return values;
+    }
+
+    std::array<int, HwCounters::num_events> fds{{-1, -1, -1, -1, -1}};
+    std::array<bool, HwCounters::num_events> available{};
+};
+
+const CounterGroup& ThreadGroup() {
+    thread_local const CounterGroup group;
+    return group;
+}
+
+} // End anonymous namespace
+
+HwCounters::Values HwCounters::Read() {
+    return ThreadGroup().Read();
+}
+
+std::array<bool, HwCounters::num_events> HwCounters::Available() {
+    return ThreadGroup().available;
+}
+
+#else
+
+HwCounters::Values HwCounters::Read() {
+    return {};
+}
+
+std::array<bool, HwCounters::num_events> HwCounters::Available() {
+    return {};
+}
+
+#endif
+
+} // End namespace Common
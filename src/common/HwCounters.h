@@ -0,0 +1,45 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// The CPU's own performance counters, read through perf_event_open on Linux, for breaking --bench results down into
+// cycles, instructions and misses. Each thread opens its own counter group the first time it reads them, and only
+// counts user space so it works without raising perf_event_paranoid. Elsewhere, or when the kernel refuses, every
+// event reads as zero and is reported as unavailable.
+class HwCounters {
+public:
+    enum Event {Cycles, Instructions, BranchMisses, L1dMisses, LlcMisses, num_events};
+
+    using Values = std::array<u64, num_events>;
+
+    // The calling thread's running totals since it first read them.
+    static Values Read();
+
+    // Which events the calling thread's counter group was able to open.
+    static std::array<bool, num_events> Available();
+
+    static constexpr std::array<const char*, num_events> names{{"cycles", "instructions", "branch_misses",
+                                                                 "l1d_misses", "llc_misses"}};
+};
+
+} // End namespace Common
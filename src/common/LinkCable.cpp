@@ -0,0 +1,235 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common/LinkCable.h"
+#include "common/Socket.h"
+
+namespace Common {
+
+namespace {
+
+// Both ends of an in-process link. A port that goes away clears its slot, so the other end never sends to it.
+class LocalPort;
+struct LocalChannel {
+    std::mutex mutex;
+    std::array<LocalPort*, 2> ends{};
+};
+
+class LocalPort : public LinkPort {
+public:
+    LocalPort(int _id, std::shared_ptr<LocalChannel> _channel)
+            : LinkPort(_id)
+            , channel(std::move(_channel)) {
+        channel->ends[Id()] = this;
+    }
+
+    ~LocalPort() override {
+        std::lock_guard<std::mutex> lock{channel->mutex};
+        channel->ends[Id()] = nullptr;
+        if (LocalPort* peer = channel->ends[Id() ^ 1]) {
+            peer->Disconnect();
+        }
+    }
+
+private:
+    std::shared_ptr<LocalChannel> channel;
+
+    void Send(const Packet& packet) override {
+        std::lock_guard<std::mutex> lock{channel->mutex};
+        if (LocalPort* peer = channel->ends[Id() ^ 1]) {
+            peer->Receive(packet);
+        }
+    }
+};
+
+// Packets go over TCP as fixed 17-byte records, and everything queued since the last flush is written at once.
+class SocketPort : public LinkPort {
+public:
+    SocketPort(int _id, int _socket_fd)
+            : LinkPort(_id)
+            , socket_fd(_socket_fd)
+            , receive_thread(&SocketPort::ReceiveLoop, this) {}
+
+    ~SocketPort() override {
+        // Unblocks the receive thread.
+        shutdown(socket_fd, SHUT_RDWR);
+        receive_thread.join();
+        close(socket_fd);
+    }
+
+private:
+    static constexpr std::size_t packet_bytes = 17;
+
+    const int socket_fd;
+    // Only touched by the emulator thread.
+    std::vector<u8> outgoing;
+    std::thread receive_thread;
+
+    void Send(const Packet& packet) override {
+        const std::size_t offset = outgoing.size();
+        outgoing.resize(offset + packet_bytes);
+        u8* ptr = outgoing.data() + offset;
+        ptr[0] = packet.kind;
+        std::memcpy(ptr + 1, &packet.sequence, 4);
+        std::memcpy(ptr + 5, &packet.data, 4);
+        std::memcpy(ptr + 9, &packet.timestamp, 8);
+    }
+
+    void Flush() override {
+        // The receive thread reports a lost connection.
+        SendAll(socket_fd, outgoing.data(), outgoing.size());
+        outgoing.clear();
+    }
+
+    void ReceiveLoop() {
+        std::vector<u8> buffer(4096);
+        std::size_t buffered = 0;
+        while (true) {
+            const ssize_t result = recv(socket_fd, buffer.data() + buffered, buffer.size() - buffered, 0);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            } else if (result <= 0) {
+                break;
+            }
+            buffered += result;
+
+            std::size_t offset = 0;
+            for (; buffered - offset >= packet_bytes; offset += packet_bytes) {
+                const u8* ptr = buffer.data() + offset;
+                Packet packet;
+                packet.kind = ptr[0];
+                std::memcpy(&packet.sequence, ptr + 1, 4);
+                std::memcpy(&packet.data, ptr + 5, 4);
+                std::memcpy(&packet.timestamp, ptr + 9, 8);
+                Receive(packet);
+            }
+
+            std::memmove(buffer.data(), buffer.data() + offset, buffered - offset);
+            buffered -= offset;
+        }
+
+        fmt::print("Link cable disconnected.\n");
+        Disconnect();
+    }
+};
+
+} // End anonymous namespace
+
+std::unique_ptr<LinkPort> LinkPort::Open(const LinkSettings& settings) {
+    if (settings.listen_port != 0) {
+        return std::make_unique<SocketPort>(0, ListenForPeer(settings.listen_port, "a link cable"));
+    } else if (!settings.connect_address.empty()) {
+        return std::make_unique<SocketPort>(1, ConnectToPeer(settings.connect_address));
+    }
+
+    return nullptr;
+}
+
+std::pair<std::unique_ptr<LinkPort>, std::unique_ptr<LinkPort>> LinkPort::CreateLocalPair() {
+    auto channel = std::make_shared<LocalChannel>();
+    return {std::make_unique<LocalPort>(0, channel), std::make_unique<LocalPort>(1, channel)};
+}
+
+void LinkPort::StartTransfer(u32 data, u64 timestamp) {
+    transfer_active = true;
+    SendNow({Packet::Request, ++sequence, data, timestamp});
+}
+
+u32 LinkPort::FinishTransfer() {
+    if (!std::exchange(transfer_active, false)) {
+        return disconnected;
+    }
+
+    const auto give_up = std::chrono::steady_clock::now() + peer_timeout;
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+        if (reply && reply->sequence == sequence) {
+            const u32 data = reply->data;
+            reply.reset();
+            return data;
+        } else if (!connected) {
+            return disconnected;
+        }
+
+        if (!requests.empty()) {
+            // Both sides started a transfer at once, so neither gets anything but 1s. Answering here keeps the
+            // other side from waiting on us while we wait on it.
+            const Packet request = requests.front();
+            requests.pop_front();
+            next_request.store(requests.empty() ? no_request : requests.front().timestamp,
+                               std::memory_order_release);
+            lock.unlock();
+            SendNow({Packet::Reply, request.sequence, disconnected, 0});
+            lock.lock();
+            continue;
+        }
+
+        if (reply_cv.wait_until(lock, give_up) == std::cv_status::timeout
+                && !(reply && reply->sequence == sequence) && requests.empty()) {
+            return disconnected;
+        }
+    }
+}
+
+u32 LinkPort::AnswerRequest(u32 data) {
+    Packet request;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        request = requests.front();
+        requests.pop_front();
+        next_request.store(requests.empty() ? no_request : requests.front().timestamp, std::memory_order_release);
+    }
+
+    SendNow({Packet::Reply, request.sequence, data, 0});
+    return request.data;
+}
+
+void LinkPort::Receive(const Packet& packet) {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (packet.kind == Packet::Request) {
+            requests.push_back(packet);
+            next_request.store(requests.front().timestamp, std::memory_order_release);
+        } else {
+            // Late answers to transfers we gave up on are told apart by their sequence number.
+            reply = packet;
+        }
+    }
+
+    reply_cv.notify_all();
+}
+
+void LinkPort::Disconnect() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        connected = false;
+    }
+
+    reply_cv.notify_all();
+}
+
+} // End namespace Common
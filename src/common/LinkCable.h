@@ -0,0 +1,123 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+struct LinkSettings {
+    // Wait for the other instance to connect on this TCP port. Zero doesn't listen.
+    int listen_port = 0;
+    // Or connect to an instance listening at host:port.
+    std::string connect_address;
+
+    bool Enabled() const { return listen_port != 0 || !connect_address.empty(); }
+};
+
+// One end of a link cable between two instances. The side driving the clock starts a transfer by sending its data
+// along with the timestamp it started at, and collects the other side's data once the bits have had time to shift
+// across, so the round trip overlaps emulating the transfer. The other side answers when its own timestamp
+// reaches the one the transfer started at. If it's behind, the clock side waits for it to catch up, so the two
+// cores only run in lock-step at transfer boundaries and are otherwise as independent as unlinked instances.
+//
+// Timestamps are cycles since power on of whichever system is linked, and both ends must be the same system.
+class LinkPort {
+public:
+    // What's read from a cable with nobody answering on the other end.
+    static constexpr u32 disconnected = 0xFFFFFFFF;
+    static constexpr u64 no_request = std::numeric_limits<u64>::max();
+
+    // Returns nullptr if the settings don't enable the link. Blocks until the other instance has connected, and
+    // throws std::runtime_error if that fails.
+    static std::unique_ptr<LinkPort> Open(const LinkSettings& settings);
+    // Two ports connected within this process. The cores using them must run on their own threads, since either
+    // one can wait for the other.
+    static std::pair<std::unique_ptr<LinkPort>, std::unique_ptr<LinkPort>> CreateLocalPair();
+
+    virtual ~LinkPort() = default;
+
+    // 0 on the listening or first end, 1 on the other. Decides the parent in GBA multiplayer mode.
+    int Id() const { return id; }
+
+    void StartTransfer(u32 data, u64 timestamp);
+    // Waits for the other side's data. Gives up and returns disconnected if no transfer was started, or if the
+    // other side doesn't answer within a second, e.g. because it's paused.
+    u32 FinishTransfer();
+
+    // Cheap enough to check every few cycles.
+    bool RequestDue(u64 timestamp) const { return timestamp >= next_request.load(std::memory_order_acquire); }
+    u64 NextRequestTime() const { return next_request.load(std::memory_order_acquire); }
+    // Answers the other side's due transfer with our data, and returns theirs.
+    u32 AnswerRequest(u32 data);
+
+protected:
+    struct Packet {
+        enum Kind : u8 {Request, Reply};
+
+        u8 kind;
+        u32 sequence;
+        u32 data;
+        u64 timestamp;
+    };
+
+    explicit LinkPort(int _id)
+            : id(_id) {}
+
+    // Packets may be held back until the next flush, so several can go out at once.
+    virtual void Send(const Packet& packet) = 0;
+    virtual void Flush() {}
+
+    // Called by the transport for every packet from the other side, on any thread.
+    void Receive(const Packet& packet);
+    void Disconnect();
+
+private:
+    static constexpr std::chrono::seconds peer_timeout{1};
+
+    const int id;
+
+    // Only touched by the emulator thread.
+    u32 sequence = 0;
+    bool transfer_active = false;
+
+    std::mutex mutex;
+    std::condition_variable reply_cv;
+    std::deque<Packet> requests;
+    std::optional<Packet> reply;
+    bool connected = true;
+    std::atomic<u64> next_request{no_request};
+
+    void SendNow(const Packet& packet) {
+        Send(packet);
+        Flush();
+    }
+};
+
+} // End namespace Common
@@ -0,0 +1,134 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "common/MappedRom.h"
+
+namespace Common {
+
+#if defined(_WIN32)
+
+MappedRomFile::MappedRomFile(const std::string& _path, HugePages _huge_pages)
+        : path(_path)
+        , huge_pages(_huge_pages) {}
+
+MappedRomFile::MappedRomFile(HugePages _huge_pages)
+        : huge_pages(_huge_pages) {}
+
+MappedRomFile::~MappedRomFile() = default;
+
+void* MappedRomFile::Map(std::size_t bytes) {
+    if (path.empty()) {
+        return new char[bytes]();
+    }
+
+    std::ifstream rom_file(path, std::ios_base::binary);
+    if (!rom_file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    char* buffer = new char[bytes];
+    rom_file.read(buffer, bytes);
+    return buffer;
+}
+
+void MappedRomFile::Unmap(void* ptr, std::size_t) {
+    delete[] static_cast<char*>(ptr);
+}
+
+void MappedRomFile::Advise(const void*, std::size_t, RomAdvice) const {}
+
+#else
+
+MappedRomFile::MappedRomFile(const std::string& _path, HugePages _huge_pages)
+        : path(_path)
+        , huge_pages(_huge_pages)
+        , fd(open(path.c_str(), O_RDONLY)) {
+    if (fd == -1) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+}
+
+MappedRomFile::MappedRomFile(HugePages _huge_pages)
+        : huge_pages(_huge_pages) {}
+
+MappedRomFile::~MappedRomFile() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+void* MappedRomFile::Map(std::size_t bytes) {
+    if (FileMapped()) {
+        void* ptr = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::runtime_error("Could not map " + path + " into memory.");
+        }
+
+        return ptr;
+    }
+
+    u8* ptr = static_cast<u8*>(MapPages(bytes, huge_pages));
+    if (fd != -1) {
+        for (std::size_t offset = 0; offset < bytes;) {
+            const ssize_t bytes_read = pread(fd, ptr + offset, bytes - offset, offset);
+            if (bytes_read <= 0) {
+                UnmapPages(ptr, bytes, huge_pages);
+                throw std::runtime_error("Error when attempting to read " + path);
+            }
+            offset += bytes_read;
+        }
+    }
+
+    return ptr;
+}
+
+void MappedRomFile::Unmap(void* ptr, std::size_t bytes) {
+    if (FileMapped()) {
+        munmap(ptr, bytes);
+    } else {
+        UnmapPages(ptr, bytes, huge_pages);
+    }
+}
+
+void MappedRomFile::Advise(const void* ptr, std::size_t bytes, RomAdvice advice) const {
+    if (!FileMapped()) {
+        return;
+    }
+
+    // Mappings start on a page boundary, as madvise requires.
+    void* addr = const_cast<void*>(ptr);
+    if (advice == RomAdvice::Sequential) {
+        madvise(addr, bytes, MADV_SEQUENTIAL);
+        madvise(addr, bytes, MADV_WILLNEED);
+    } else {
+        madvise(addr, bytes, MADV_NORMAL);
+    }
+}
+
+#endif
+
+} // End namespace Common
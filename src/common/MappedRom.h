@@ -0,0 +1,75 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/FileAllocator.h"
+#include "common/PageAlloc.h"
+
+namespace Common {
+
+enum class RomAdvice {Normal, Sequential};
+
+// A ROM file mapped read-only. The mapping is private, so the pages come straight from the page cache and are
+// shared by every instance running the same game, and nothing is read until the game touches it. On Windows the
+// ROM is read into the heap instead.
+// File mappings can't be backed by huge pages, so with them the ROM is read into anonymous memory up front. That
+// trades the sharing for fewer TLB misses. Without a path, the memory is left zeroed for the caller to fill in.
+class MappedRomFile {
+public:
+    explicit MappedRomFile(const std::string& _path, HugePages _huge_pages = HugePages::Off);
+    explicit MappedRomFile(HugePages _huge_pages);
+    ~MappedRomFile();
+
+    MappedRomFile(const MappedRomFile&) = delete;
+    MappedRomFile& operator=(const MappedRomFile&) = delete;
+
+    void* Map(std::size_t bytes);
+    void Unmap(void* ptr, std::size_t bytes);
+
+    // Hints how the first bytes of a mapping are about to be read. Sequential also starts reading them in.
+    void Advise(const void* ptr, std::size_t bytes, RomAdvice advice) const;
+
+private:
+    const std::string path;
+    const HugePages huge_pages;
+    int fd = -1;
+
+    bool FileMapped() const { return fd != -1 && huge_pages == HugePages::Off; }
+};
+
+template<typename T>
+using RomAllocator = FileAllocator<T, MappedRomFile>;
+
+// ROM contents, which are a view of the ROM file when it could be mapped. Never written to.
+template<typename T>
+using RomVector = std::vector<T, RomAllocator<T>>;
+
+template<typename T>
+void AdviseRom(const RomVector<T>& rom, std::size_t bytes, RomAdvice advice) {
+    if (const MappedRomFile* file = rom.get_allocator().MappedFile(); file != nullptr) {
+        file->Advise(rom.data(), std::min(bytes, rom.size() * sizeof(T)), advice);
+    }
+}
+
+} // End namespace Common
@@ -0,0 +1,128 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdexcept>
+#include <fmt/format.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common/MappedSave.h"
+
+namespace Common {
+
+#if defined(_WIN32)
+
+MappedSaveFile::MappedSaveFile(const std::string& _path, const SaveSettings& settings)
+        : path(_path)
+        , policy(settings.msync_policy)
+        , interval(settings.flush_interval) {
+    throw std::runtime_error("Memory-mapped saves are not supported on Windows.");
+}
+
+MappedSaveFile::~MappedSaveFile() = default;
+void* MappedSaveFile::Map(std::size_t) { return nullptr; }
+void MappedSaveFile::Unmap(void*, std::size_t) {}
+void MappedSaveFile::Sync(bool) {}
+void MappedSaveFile::FrameDone(DirtyPages&) {}
+void MappedSaveFile::Truncate(std::size_t) {}
+
+#else
+
+MappedSaveFile::MappedSaveFile(const std::string& _path, const SaveSettings& settings)
+        : path(_path)
+        , policy(settings.msync_policy)
+        , interval(settings.flush_interval)
+        , next_sync(std::chrono::steady_clock::now() + interval) {}
+
+MappedSaveFile::~MappedSaveFile() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+void* MappedSaveFile::Map(std::size_t bytes) {
+    if (fd == -1) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) {
+            throw std::runtime_error("Could not open " + path + " to map the save file.");
+        }
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        throw std::runtime_error("Could not read the size of " + path + ".");
+    }
+
+    if (static_cast<std::size_t>(file_stat.st_size) < bytes && ftruncate(fd, bytes) != 0) {
+        throw std::runtime_error("Could not grow " + path + " to fit the save.");
+    }
+
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + path + " into memory.");
+    }
+
+    mapped_ptr = ptr;
+    mapped_bytes = bytes;
+    return ptr;
+}
+
+void MappedSaveFile::Unmap(void* ptr, std::size_t bytes) {
+    munmap(ptr, bytes);
+    if (ptr == mapped_ptr) {
+        mapped_ptr = nullptr;
+        mapped_bytes = 0;
+    }
+}
+
+void MappedSaveFile::Sync(bool wait) {
+    if (mapped_ptr != nullptr) {
+        msync(mapped_ptr, mapped_bytes, wait ? MS_SYNC : MS_ASYNC);
+    }
+}
+
+void MappedSaveFile::FrameDone(DirtyPages& dirty) {
+    if (!dirty.Any() || policy == SaveSettings::MsyncPolicy::Exit) {
+        return;
+    }
+
+    if (policy == SaveSettings::MsyncPolicy::Interval) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < next_sync) {
+            return;
+        }
+        next_sync = now + interval;
+    }
+
+    Sync(false);
+    dirty.Clear();
+}
+
+void MappedSaveFile::Truncate(std::size_t bytes) {
+    if (fd != -1 && ftruncate(fd, bytes) != 0) {
+        fmt::print("Error: could not truncate {} to the size of the save.\n", path);
+    }
+}
+
+#endif
+
+} // End namespace Common
@@ -0,0 +1,73 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/FileAllocator.h"
+#include "common/SaveFlusher.h"
+
+namespace Common {
+
+// A save file opened for mapping into memory. Every mapping is shared with the file, so the page cache writes
+// the game's saves back to disk on its own, and a crash of the emulator loses nothing. The file isn't opened or
+// created until the save is first mapped, so games which never save don't leave an empty file behind.
+class MappedSaveFile {
+public:
+    MappedSaveFile(const std::string& _path, const SaveSettings& settings);
+    ~MappedSaveFile();
+
+    MappedSaveFile(const MappedSaveFile&) = delete;
+    MappedSaveFile& operator=(const MappedSaveFile&) = delete;
+
+    // Maps the first bytes of the file, growing it first if it's shorter. The contents are left as they are.
+    void* Map(std::size_t bytes);
+    void Unmap(void* ptr, std::size_t bytes);
+
+    // Flushes the newest mapping to disk. An asynchronous sync only schedules the writeback.
+    void Sync(bool wait);
+    // Called once per frame. Schedules a writeback of the dirty pages if the msync policy says it's time.
+    void FrameDone(DirtyPages& dirty);
+    // Cuts the file down to the size of the save, which can be smaller than the last mapping. Called on exit, so
+    // errors are only printed.
+    void Truncate(std::size_t bytes);
+
+private:
+    const std::string path;
+    int fd = -1;
+
+    const SaveSettings::MsyncPolicy policy;
+    const std::chrono::seconds interval;
+    std::chrono::steady_clock::time_point next_sync;
+
+    void* mapped_ptr = nullptr;
+    std::size_t mapped_bytes = 0;
+};
+
+template<typename T>
+using SaveAllocator = FileAllocator<T, MappedSaveFile>;
+
+// Save memory, which lives in the save file itself when saves are memory-mapped.
+template<typename T>
+using SaveVector = std::vector<T, SaveAllocator<T>>;
+
+} // End namespace Common
@@ -0,0 +1,79 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+
+namespace Common {
+
+// The bytes held by each part of an instance, for working out how many instances fit on a host. ROM and BIOS can
+// be shared by every instance in a process, so they're listed separately and left out of the per-instance total.
+class MemoryReport {
+public:
+    void Add(const std::string& component, std::size_t bytes) { Add(components, component, bytes); }
+    void AddShared(const std::string& component, std::size_t bytes) { Add(shared, component, bytes); }
+
+    // Vectors count their capacity, since that's what stays allocated.
+    template<typename T, typename Alloc>
+    void Add(const std::string& component, const std::vector<T, Alloc>& values) {
+        Add(component, values.capacity() * sizeof(T));
+    }
+
+    std::size_t Total() const {
+        std::size_t total = 0;
+        for (const auto& [component, bytes] : components) {
+            total += bytes;
+        }
+        return total;
+    }
+
+    std::string Report() const {
+        return fmt::format("{{\"components\": {{{}}}, \"total\": {}, \"shared\": {{{}}}}}", List(components), Total(),
+                           List(shared));
+    }
+
+private:
+    using Entries = std::vector<std::pair<std::string, std::size_t>>;
+    Entries components;
+    Entries shared;
+
+    static void Add(Entries& entries, const std::string& component, std::size_t bytes) {
+        const auto it = std::find_if(entries.begin(), entries.end(),
+                                     [&component](const auto& entry) { return entry.first == component; });
+        if (it != entries.end()) {
+            it->second += bytes;
+        } else {
+            entries.emplace_back(component, bytes);
+        }
+    }
+
+    static std::string List(const Entries& entries) {
+        std::string list;
+        for (const auto& [component, bytes] : entries) {
+            list += fmt::format("{}\"{}\": {}", list.empty() ? "" : ", ", component, bytes);
+        }
+        return list;
+    }
+};
+
+} // End namespace Common
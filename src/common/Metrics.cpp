@@ -0,0 +1,198 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <fmt/format.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "common/Metrics.h"
+#include "common/Socket.h"
+
+namespace Common {
+
+namespace {
+
+// Full speed, at which the frontend paces each frame to 279680 GBA cycles.
+constexpr double native_fps = 16777216.0 / 279680.0;
+
+// Zero where it can't be measured.
+u64 ResidentBytes() {
+#if defined(__linux__)
+    std::FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return 0;
+    }
+
+    unsigned long total_pages = 0, resident_pages = 0;
+    const int fields = std::fscanf(statm, "%lu %lu", &total_pages, &resident_pages);
+    std::fclose(statm);
+
+    return (fields == 2) ? static_cast<u64>(resident_pages) * sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+} // End anonymous namespace
+
+MetricsServer::MetricsServer(const MetricsSettings& settings, const std::string& _system)
+        : system(_system)
+        , listen_fd(ListenOnPort(settings.port, 8))
+        , last_publish(std::chrono::steady_clock::now()) {
+    server_thread = std::thread{&MetricsServer::ServeLoop, this};
+    fmt::print("Serving metrics at http://localhost:{}/metrics\n", settings.port);
+}
+
+MetricsServer::~MetricsServer() {
+    quit = true;
+    server_thread.join();
+    close(listen_fd);
+}
+
+void MetricsServer::Publish(int new_frames, const PerfCounters& counters, const FrameTimeStats& frame_stats,
+                            u64 audio_underruns, u64 save_flushes) {
+    const auto now = std::chrono::steady_clock::now();
+
+    Sample sample;
+    sample.counters = counters.Totals();
+    static constexpr std::array<double, 3> fractions{{0.50, 0.95, 0.99}};
+    for (std::size_t i = 0; i < fractions.size(); ++i) {
+        sample.frame_time_ms[i] = frame_stats.Percentile(FrameTimeStats::Emulate, fractions[i]).count() / 1000.0;
+    }
+    sample.audio_underruns = audio_underruns;
+    sample.save_flushes = save_flushes;
+
+    std::lock_guard<std::mutex> lock{sample_mutex};
+    const double seconds = std::chrono::duration<double>(now - last_publish).count();
+    if (seconds > 0.0) {
+        fps = new_frames / seconds;
+        instructions_per_second = (sample.counters[PerfCounters::Instructions]
+                                   - latest.counters[PerfCounters::Instructions]) / seconds;
+    }
+
+    frames += new_frames;
+    latest = sample;
+    last_publish = now;
+}
+
+void MetricsServer::ServeLoop() {
+    while (!quit) {
+        // Wake up regularly to check for quitting.
+        pollfd listen_poll{listen_fd, POLLIN, 0};
+        if (poll(&listen_poll, 1, 200) <= 0) {
+            continue;
+        }
+
+        const int socket_fd = accept(listen_fd, nullptr, nullptr);
+        if (socket_fd < 0) {
+            continue;
+        }
+
+        // A client which stops sending mustn't hold up the next scrape for long.
+        timeval timeout{1, 0};
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        Respond(socket_fd);
+        close(socket_fd);
+    }
+}
+
+void MetricsServer::Respond(int socket_fd) {
+    std::string request;
+    std::array<char, 1024> buffer;
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        const ssize_t received = recv(socket_fd, buffer.data(), buffer.size(), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer.data(), received);
+    }
+
+    std::string status, body;
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+        status = "200 OK";
+        body = Render();
+    } else {
+        status = "404 Not Found";
+        body = "Metrics are served at /metrics\n";
+    }
+
+    const std::string response = fmt::format("HTTP/1.1 {}\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                             "Content-Length: {}\r\nConnection: close\r\n\r\n{}",
+                                             status, body.size(), body);
+    SendAll(socket_fd, response.data(), response.size());
+}
+
+std::string MetricsServer::Render() {
+    Sample sample;
+    u64 frame_total;
+    double current_fps, current_ips;
+    {
+        std::lock_guard<std::mutex> lock{sample_mutex};
+        sample = latest;
+        frame_total = frames;
+        current_fps = fps;
+        current_ips = instructions_per_second;
+    }
+
+    std::string text;
+    const auto add = [&text](const char* name, const char* type, const char* help, auto value) {
+        text += fmt::format("# HELP {0} {1}\n# TYPE {0} {2}\n{0} {3}\n", name, help, type, value);
+    };
+
+    text += fmt::format("# HELP chroma_info The system being emulated.\n# TYPE chroma_info gauge\n"
+                        "chroma_info{{system=\"{}\"}} 1\n", system);
+    add("chroma_frames_total", "counter", "Frames emulated.", frame_total);
+    add("chroma_fps", "gauge", "Frames emulated per second over the last 60 frames.", current_fps);
+    add("chroma_speed_percent", "gauge", "Emulation speed as a percentage of the console's.",
+        current_fps / native_fps * 100.0);
+
+    text += "# HELP chroma_frame_time_seconds Host time taken to emulate a frame.\n"
+            "# TYPE chroma_frame_time_seconds summary\n";
+    static constexpr std::array<const char*, 3> quantiles{{"0.5", "0.95", "0.99"}};
+    for (std::size_t i = 0; i < quantiles.size(); ++i) {
+        text += fmt::format("chroma_frame_time_seconds{{quantile=\"{}\"}} {}\n", quantiles[i],
+                            sample.frame_time_ms[i] / 1000.0);
+    }
+
+    add("chroma_audio_underruns_total", "counter", "Audio callbacks which ran out of samples.",
+        sample.audio_underruns);
+    add("chroma_save_flushes_total", "counter", "Background writes of the save file.", sample.save_flushes);
+
+    if (PerfCounters::enabled) {
+        const u64 instructions = sample.counters[PerfCounters::Instructions];
+        const u64 misses = std::min(sample.counters[PerfCounters::DecodeMisses], instructions);
+        add("chroma_instructions_total", "counter", "Guest instructions executed.", instructions);
+        add("chroma_instructions_per_second", "gauge", "Guest instructions executed per second.", current_ips);
+        add("chroma_decode_cache_hit_ratio", "gauge", "Instructions run without being decoded again.",
+            (instructions != 0) ? 1.0 - static_cast<double>(misses) / instructions : 0.0);
+        add("chroma_dma_cycles_total", "counter", "Cycles the CPU spent blocked by DMA.",
+            sample.counters[PerfCounters::DmaCycles] + sample.counters[PerfCounters::HdmaCycles]);
+    }
+
+    if (const u64 resident = ResidentBytes(); resident != 0) {
+        add("process_resident_memory_bytes", "gauge", "Resident memory size in bytes.", resident);
+    }
+
+    return text;
+}
+
+} // End namespace Common
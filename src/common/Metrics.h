@@ -0,0 +1,84 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/CommonTypes.h"
+#include "common/PerfCounters.h"
+#include "common/FrameTimeStats.h"
+
+namespace Common {
+
+struct MetricsSettings {
+    // Serve metrics over HTTP on this TCP port. Zero doesn't serve them.
+    int port = 0;
+
+    bool Enabled() const { return port != 0; }
+};
+
+// Serves the latest sample at /metrics in the Prometheus text format, for watching instances that run headless.
+// Requests are answered on a thread of their own from a copy of the sample, so scraping never stalls emulation.
+// Rates are worked out between consecutive samples.
+class MetricsServer {
+public:
+    // Throws std::runtime_error if the port can't be listened on.
+    MetricsServer(const MetricsSettings& settings, const std::string& _system);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // Called by the emulator thread every so many frames, with its running totals.
+    void Publish(int new_frames, const PerfCounters& counters, const FrameTimeStats& frame_stats,
+                 u64 audio_underruns, u64 save_flushes);
+
+private:
+    const std::string system;
+    int listen_fd;
+    std::atomic<bool> quit{false};
+    std::thread server_thread;
+
+    struct Sample {
+        // Zero unless the perf counters are compiled in.
+        std::array<u64, PerfCounters::num_counters> counters{};
+        // The 50th, 95th and 99th percentile time taken to emulate a frame since power on.
+        std::array<double, 3> frame_time_ms{};
+        u64 audio_underruns = 0;
+        u64 save_flushes = 0;
+    };
+
+    // Everything below the mutex is shared with the server thread.
+    std::mutex sample_mutex;
+    Sample latest;
+    u64 frames = 0;
+    double fps = 0.0;
+    double instructions_per_second = 0.0;
+    std::chrono::steady_clock::time_point last_publish;
+
+    void ServeLoop();
+    void Respond(int socket_fd);
+    std::string Render();
+};
+
+} // End namespace Common
@@ -0,0 +1,357 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include "common/Movie.h"
+#include "common/Hash.h"
+
+namespace Common {
+
+namespace {
+
+constexpr std::array<char, 8> movie_magic{{'C', 'H', 'R', 'M', 'O', 'V', 'I', 'E'}};
+constexpr u32 movie_version = 1;
+constexpr std::array<char, 8> index_magic{{'C', 'H', 'R', 'M', 'V', 'I', 'D', 'X'}};
+constexpr u32 index_version = 1;
+constexpr std::streamoff index_header_size = index_magic.size() + sizeof(index_version);
+
+template<typename T>
+void WriteValue(std::ostream& file, T value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+T ReadValue(std::istream& file) {
+    T value{};
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return value;
+}
+
+// FNV-1a over each frame's button mask, so the running hash is all the state needed to pick it up again.
+u64 HashButtons(u64 hash, u16 buttons) {
+    for (int i = 0; i < 2; ++i) {
+        hash = (hash ^ ((buttons >> (i * 8)) & 0xFF)) * 0x100000001B3;
+    }
+    return hash;
+}
+
+} // End anonymous namespace
+
+std::optional<s64> MovieRtcStart(const MovieSettings& settings, const RtcSettings& rtc_settings) {
+    if (!settings.play_path.empty()) {
+        // The header is checked properly when the movie is loaded.
+        std::ifstream movie_file(settings.play_path, std::ios_base::binary);
+        movie_file.seekg(movie_magic.size() + sizeof(movie_version) + sizeof(State::System));
+        return ReadValue<s64>(movie_file);
+    } else if (!settings.record_path.empty() || rtc_settings.emulated) {
+        using namespace std::chrono;
+        return rtc_settings.epoch.value_or(duration_cast<seconds>(system_clock::now().time_since_epoch()).count());
+    }
+
+    return std::nullopt;
+}
+
+u64 MovieStartHash(s64 rtc_start, const std::vector<u8>& start_state) {
+    return XxHash64::Hash(start_state.data(), start_state.size(), rtc_start);
+}
+
+MovieWriter::MovieWriter(const std::string& filename, State::System system, s64 rtc_start,
+                         const std::vector<u8>& start_state)
+        : movie_file(filename, std::ios_base::binary | std::ios_base::trunc) {
+    if (!movie_file) {
+        throw std::runtime_error("Could not open " + filename + " for writing.");
+    }
+
+    movie_file.write(movie_magic.data(), movie_magic.size());
+    WriteValue(movie_file, movie_version);
+    WriteValue(movie_file, system);
+    WriteValue(movie_file, rtc_start);
+    WriteValue<u64>(movie_file, start_state.size());
+    movie_file.write(reinterpret_cast<const char*>(start_state.data()), start_state.size());
+}
+
+MovieWriter::~MovieWriter() {
+    if (run_length != 0) {
+        WriteRun();
+    }
+}
+
+void MovieWriter::Frame(u16 buttons) {
+    if (run_length != 0 && buttons != run_buttons) {
+        WriteRun();
+        run_length = 0;
+    }
+
+    run_buttons = buttons;
+    ++run_length;
+}
+
+void MovieWriter::WriteRun() {
+    WriteValue(movie_file, run_length);
+    WriteValue(movie_file, run_buttons);
+}
+
+MovieReader::MovieReader(const std::string& filename, State::System system) {
+    std::ifstream movie_file(filename, std::ios_base::binary);
+    if (!movie_file) {
+        throw std::runtime_error("Error when attempting to open " + filename);
+    }
+
+    std::array<char, 8> magic{};
+    movie_file.read(magic.data(), magic.size());
+    const auto version = ReadValue<u32>(movie_file);
+    const auto movie_system = ReadValue<State::System>(movie_file);
+    rtc_start = ReadValue<s64>(movie_file);
+    const auto state_size = ReadValue<u64>(movie_file);
+
+    if (!movie_file || magic != movie_magic) {
+        throw std::runtime_error(filename + " is not a Chroma input movie.");
+    } else if (version != movie_version) {
+        throw std::runtime_error(filename + " is from an incompatible version of Chroma.");
+    } else if (movie_system != system) {
+        throw std::runtime_error(filename + " was recorded on a different system.");
+    }
+
+    start_state.resize(state_size);
+    movie_file.read(reinterpret_cast<char*>(start_state.data()), state_size);
+    if (!movie_file) {
+        throw std::runtime_error(filename + " is truncated.");
+    }
+
+    while (true) {
+        const auto length = ReadValue<u32>(movie_file);
+        const auto buttons = ReadValue<u16>(movie_file);
+        if (!movie_file) {
+            break;
+        }
+        runs.push_back({length, buttons});
+    }
+}
+
+bool MovieReader::Frame(u16& buttons) {
+    if (frames_left_in_run == 0) {
+        if (next_run == runs.size()) {
+            return false;
+        }
+        frames_left_in_run = runs[next_run++].length;
+    }
+
+    buttons = runs[next_run - 1].buttons;
+    --frames_left_in_run;
+    return true;
+}
+
+bool MovieReader::Seek(s64 frame) {
+    for (next_run = 0; next_run < runs.size(); ++next_run) {
+        if (frame < runs[next_run].length) {
+            frames_left_in_run = runs[next_run++].length - frame;
+            return true;
+        }
+        frame -= runs[next_run].length;
+    }
+
+    frames_left_in_run = 0;
+    return frame == 0;
+}
+
+u64 MovieReader::InputHash(s64 frame) const {
+    u64 hash = MovieStartHash(rtc_start, start_state);
+    for (std::size_t run = 0; run < runs.size() && frame > 0; ++run) {
+        for (u32 i = 0; i < runs[run].length && frame > 0; ++i, --frame) {
+            hash = HashButtons(hash, runs[run].buttons);
+        }
+    }
+    return hash;
+}
+
+MovieIndex::MovieIndex(const std::string& movie_path, u64 _start_hash, bool recording, int _interval)
+        : path(movie_path + ".idx")
+        , interval(_interval)
+        , start_hash(_start_hash)
+        , input_hash(_start_hash) {
+    if (!recording) {
+        index_file.open(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    }
+
+    std::array<char, 8> magic{};
+    index_file.read(magic.data(), magic.size());
+    const auto version = ReadValue<u32>(index_file);
+    if (!index_file || magic != index_magic || version != index_version) {
+        // Start a new index in place of a missing or unusable one.
+        index_file.close();
+        index_file.open(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::trunc);
+        if (!index_file) {
+            throw std::runtime_error("Could not open " + path + " for writing.");
+        }
+
+        index_file.write(index_magic.data(), index_magic.size());
+        WriteValue(index_file, index_version);
+        end_offset = index_header_size;
+        return;
+    }
+
+    // Only the keyframe headers are read up front. Anything cut short by an interrupted write is dropped.
+    const auto file_size = static_cast<std::streamoff>(std::filesystem::file_size(path));
+    end_offset = index_header_size;
+    while (true) {
+        const auto entry_frame = ReadValue<s64>(index_file);
+        const auto entry_hash = ReadValue<u64>(index_file);
+        index_file.seekg(sizeof(s32) + sizeof(u16) + sizeof(u64), std::ios_base::cur);
+        const auto compressed_size = ReadValue<u64>(index_file);
+        if (!index_file || compressed_size > static_cast<u64>(file_size - index_file.tellg())) {
+            break;
+        }
+
+        entries.push_back({entry_frame, entry_hash, end_offset});
+        end_offset = index_file.tellg() + static_cast<std::streamoff>(compressed_size);
+        index_file.seekg(end_offset);
+    }
+
+    index_file.clear();
+    if (end_offset != file_size) {
+        std::filesystem::resize_file(path, end_offset);
+    }
+}
+
+bool MovieIndex::KeyframeDue() {
+    if (next_entry < entries.size() && entries[next_entry].frame == frame) {
+        if (entries[next_entry].input_hash == input_hash) {
+            ++next_entry;
+            return false;
+        }
+
+        // The movie's input no longer matches the one indexed, so the rest of the index is stale.
+        Truncate(next_entry);
+    }
+
+    return frame != 0 && frame % interval == 0 && next_entry == entries.size();
+}
+
+void MovieIndex::AddKeyframe(const std::vector<u8>& state, int overspent_cycles, u16 held_buttons) {
+    compressed.resize(compressBound(state.size()));
+    uLongf compressed_size = compressed.size();
+    if (compress2(compressed.data(), &compressed_size, state.data(), state.size(), Z_BEST_SPEED) != Z_OK) {
+        return;
+    }
+
+    index_file.seekp(end_offset);
+    WriteValue(index_file, frame);
+    WriteValue(index_file, input_hash);
+    WriteValue<s32>(index_file, overspent_cycles);
+    WriteValue(index_file, held_buttons);
+    WriteValue<u64>(index_file, state.size());
+    WriteValue<u64>(index_file, compressed_size);
+    index_file.write(reinterpret_cast<const char*>(compressed.data()), compressed_size);
+    index_file.flush();
+    if (!index_file) {
+        // Whatever made it to the file is dropped the next time it's opened.
+        index_file.clear();
+        return;
+    }
+
+    entries.push_back({frame, input_hash, end_offset});
+    next_entry = entries.size();
+    end_offset = index_file.tellp();
+}
+
+void MovieIndex::Frame(u16 buttons) {
+    input_hash = HashButtons(input_hash, buttons);
+    ++frame;
+}
+
+bool MovieIndex::Seek(s64 target_frame, const MovieReader& movie, Keyframe& keyframe) {
+    for (std::size_t i = entries.size(); i-- > 0;) {
+        if (entries[i].frame > target_frame) {
+            continue;
+        }
+
+        if (entries[i].input_hash == movie.InputHash(entries[i].frame) && ReadKeyframe(entries[i], keyframe)) {
+            frame = entries[i].frame;
+            input_hash = entries[i].input_hash;
+            next_entry = i;
+            return true;
+        }
+
+        // A keyframe which doesn't match the movie leaves every later one stale too.
+        Truncate(i);
+    }
+
+    frame = 0;
+    input_hash = start_hash;
+    next_entry = 0;
+    return false;
+}
+
+bool MovieIndex::ReadKeyframe(const Entry& entry, Keyframe& keyframe) {
+    index_file.seekg(entry.offset + sizeof(s64) + sizeof(u64));
+    keyframe.overspent_cycles = ReadValue<s32>(index_file);
+    keyframe.held_buttons = ReadValue<u16>(index_file);
+    const auto state_size = ReadValue<u64>(index_file);
+    const auto compressed_size = ReadValue<u64>(index_file);
+    compressed.resize(compressed_size);
+    index_file.read(reinterpret_cast<char*>(compressed.data()), compressed_size);
+    if (!index_file) {
+        index_file.clear();
+        return false;
+    }
+
+    keyframe.state.resize(state_size);
+    uLongf uncompressed_size = state_size;
+    if (uncompress(keyframe.state.data(), &uncompressed_size, compressed.data(), compressed_size) != Z_OK
+            || uncompressed_size != state_size) {
+        return false;
+    }
+
+    keyframe.frame = entry.frame;
+    return true;
+}
+
+void MovieIndex::Truncate(std::size_t entry) {
+    end_offset = entries[entry].offset;
+    entries.resize(entry);
+    next_entry = std::min(next_entry, entries.size());
+
+    index_file.flush();
+    std::error_code error;
+    std::filesystem::resize_file(path, end_offset, error);
+}
+
+std::unique_ptr<MovieIndex> OpenMovieIndex(const MovieSettings& settings, u64 start_hash) {
+    if (settings.keyframe_interval == 0) {
+        return nullptr;
+    }
+
+    const bool recording = !settings.record_path.empty();
+    try {
+        // Movies run at about 60 frames a second on both systems.
+        return std::make_unique<MovieIndex>(recording ? settings.record_path : settings.play_path, start_hash,
+                                            recording, settings.keyframe_interval * 60);
+    } catch (const std::exception& e) {
+        fmt::print("{} Seeking in the movie won't be indexed.\n", e.what());
+        return nullptr;
+    }
+}
+
+} // End namespace Common
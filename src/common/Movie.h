@@ -0,0 +1,162 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/RtcSource.h"
+#include "common/SaveState.h"
+
+namespace Common {
+
+struct MovieSettings {
+    std::string record_path;
+    std::string play_path;
+    // Start the recording from the game's savestate instead of from power on.
+    bool record_from_state = false;
+    // Seconds of movie between the keyframes of its seek index, or 0 to go without one.
+    int keyframe_interval = 10;
+    // The frame playback starts from.
+    s64 seek_frame = 0;
+};
+
+// The fixed RTC start time for a movie being recorded or played, or for an emulated clock, which the cores need
+// before the cartridge RTC is created. Nullopt if there's neither, so the RTC uses the host clock.
+std::optional<s64> MovieRtcStart(const MovieSettings& settings, const RtcSettings& rtc_settings);
+
+// The hash a movie's input hash starts from, which covers where the movie starts.
+u64 MovieStartHash(s64 rtc_start, const std::vector<u8>& start_state);
+
+// Input movies hold the state of every button on every frame, which makes a run reproducible. Bit n of a frame's
+// button mask is the nth button from Up to Select in Emu::InputEvent. A movie starts either from power on or from
+// an embedded savestate, and the RTC runs from a fixed start time.
+//
+// The file is a "CHRMOVIE" header with the system and RTC start time, the savestate (which is empty for power
+// on), and then the frames as runs of identical button masks.
+class MovieWriter {
+public:
+    MovieWriter(const std::string& filename, State::System system, s64 rtc_start, const std::vector<u8>& start_state);
+    ~MovieWriter();
+
+    void Frame(u16 buttons);
+
+private:
+    std::ofstream movie_file;
+    u16 run_buttons = 0;
+    u32 run_length = 0;
+
+    void WriteRun();
+};
+
+class MovieReader {
+public:
+    MovieReader(const std::string& filename, State::System system);
+
+    s64 RtcStart() const { return rtc_start; }
+    // Empty if the movie starts from power on.
+    const std::vector<u8>& StartState() const { return start_state; }
+
+    // Returns false once the movie is over.
+    bool Frame(u16& buttons);
+    // Moves playback to the start of the given frame. Returns false if the movie is shorter than that.
+    bool Seek(s64 frame);
+    // The hash of the movie's start and of the buttons on every frame before the given one.
+    u64 InputHash(s64 frame) const;
+
+private:
+    s64 rtc_start;
+    std::vector<u8> start_state;
+
+    struct Run {
+        u32 length;
+        u16 buttons;
+    };
+
+    std::vector<Run> runs;
+    std::size_t next_run = 0;
+    u32 frames_left_in_run = 0;
+};
+
+// A seek index for a movie, kept beside it in "<movie>.idx". It holds a compressed savestate every few seconds of
+// the movie, so playback can start from any frame by loading the keyframe before it and fast-forwarding the rest of
+// the way, rather than replaying everything from the start. Keyframes are taken while recording, and while playing
+// past the end of the index, and each is appended as it's taken so an interrupted run still leaves them behind.
+//
+// Every keyframe holds the movie's input hash up to it, so keyframes left over from another movie of the same name
+// are caught and replaced. After the "CHRMVIDX" header, each keyframe is its frame, the input hash, the core's
+// leftover cycles and held buttons, the sizes of the state and of its compressed form, and the compressed state.
+class MovieIndex {
+public:
+    struct Keyframe {
+        s64 frame = 0;
+        // The parts of the core's frame loop which aren't in its savestates.
+        int overspent_cycles = 0;
+        u16 held_buttons = 0;
+        std::vector<u8> state;
+    };
+
+    // A recording always starts a new index. interval is in frames. Throws std::runtime_error if the index can't be
+    // opened.
+    MovieIndex(const std::string& movie_path, u64 start_hash, bool recording, int _interval);
+
+    // Called at the start of every movie frame. True if the frame needs a keyframe, because it's on the interval
+    // and past the end of the index.
+    bool KeyframeDue();
+    void AddKeyframe(const std::vector<u8>& state, int overspent_cycles, u16 held_buttons);
+    // Called with the buttons held on every movie frame.
+    void Frame(u16 buttons);
+
+    // Reads the last keyframe at or before the frame which matches the movie, and carries on indexing from it.
+    // Returns false if there isn't one.
+    bool Seek(s64 target_frame, const MovieReader& movie, Keyframe& keyframe);
+
+private:
+    struct Entry {
+        s64 frame;
+        u64 input_hash;
+        std::streamoff offset;
+    };
+
+    const std::string path;
+    std::fstream index_file;
+    const s64 interval;
+    std::vector<Entry> entries;
+    std::streamoff end_offset = 0;
+    const u64 start_hash;
+
+    s64 frame = 0;
+    u64 input_hash;
+    // The first entry at or after the current frame.
+    std::size_t next_entry = 0;
+    std::vector<u8> compressed;
+
+    bool ReadKeyframe(const Entry& entry, Keyframe& keyframe);
+    // Drops this entry and every one after it.
+    void Truncate(std::size_t entry);
+};
+
+// Opens the seek index for the movie being recorded or played, if the settings ask for one. An index only speeds up
+// seeking, so failing to open one is reported rather than thrown.
+std::unique_ptr<MovieIndex> OpenMovieIndex(const MovieSettings& settings, u64 start_hash);
+
+} // End namespace Common
@@ -0,0 +1,180 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <fmt/format.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common/Netplay.h"
+#include "common/Socket.h"
+
+namespace Common {
+
+namespace {
+
+constexpr std::array<char, 8> netplay_magic{{'C', 'H', 'R', 'O', 'M', 'A', 'N', 'P'}};
+constexpr u32 netplay_version = 1;
+
+// Magic, version, ROM hash, RTC start time.
+constexpr std::size_t hello_bytes = 8 + 4 + 8 + 8;
+// Frame number and buttons, padded to 8 bytes.
+constexpr std::size_t input_bytes = 8;
+
+} // End anonymous namespace
+
+Netplay::Netplay(const NetplaySettings& settings, u64 rom_hash)
+        : rollback_frames(settings.rollback_frames)
+        , socket_fd((settings.listen_port != 0) ? ListenForPeer(settings.listen_port, "netplay")
+                                                : ConnectToPeer(settings.connect_address))
+        , rtc_start(std::chrono::duration_cast<std::chrono::seconds>(
+                      std::chrono::system_clock::now().time_since_epoch()).count())
+        , snapshots(settings.rollback_frames + 1) {
+
+    std::array<u8, hello_bytes> hello;
+    std::memcpy(hello.data(), netplay_magic.data(), 8);
+    std::memcpy(hello.data() + 8, &netplay_version, 4);
+    std::memcpy(hello.data() + 12, &rom_hash, 8);
+    std::memcpy(hello.data() + 20, &rtc_start, 8);
+
+    std::array<u8, hello_bytes> their_hello;
+    std::string error;
+    if (!SendAll(socket_fd, hello.data(), hello.size()) || !ReceiveAll(socket_fd, their_hello.data(), hello_bytes)) {
+        error = "Lost the connection to the other player.";
+    } else if (std::memcmp(their_hello.data(), hello.data(), 12) != 0) {
+        error = "The other player is running an incompatible version of Chroma.";
+    } else if (std::memcmp(their_hello.data() + 12, &rom_hash, 8) != 0) {
+        error = "The other player is running a different game.";
+    }
+
+    if (!error.empty()) {
+        close(socket_fd);
+        throw std::runtime_error(error);
+    }
+
+    if (settings.listen_port == 0) {
+        std::memcpy(&rtc_start, their_hello.data() + 20, 8);
+    }
+
+    receive_thread = std::thread(&Netplay::ReceiveLoop, this);
+}
+
+Netplay::~Netplay() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        closing = true;
+    }
+    // Unblocks the receive thread.
+    shutdown(socket_fd, SHUT_RDWR);
+    receive_thread.join();
+    close(socket_fd);
+
+    fmt::print("Netplay: {} frames, {} rollbacks, {} frames emulated again.\n", frame, rollbacks, resimulated_frames);
+}
+
+void Netplay::ReceiveLoop() {
+    std::array<u8, input_bytes> packet;
+    while (ReceiveAll(socket_fd, packet.data(), packet.size())) {
+        u32 input_frame;
+        u16 buttons;
+        std::memcpy(&input_frame, packet.data(), 4);
+        std::memcpy(&buttons, packet.data() + 4, 2);
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            received.emplace_back(input_frame, buttons);
+            latest_received = input_frame;
+        }
+        received_cv.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        connected = false;
+        if (!closing) {
+            fmt::print("Netplay disconnected, carrying on alone.\n");
+        }
+    }
+    received_cv.notify_one();
+}
+
+bool Netplay::WaitForInputWindow() {
+    bool in_window;
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        in_window = received_cv.wait_for(lock, std::chrono::milliseconds{50}, [this] {
+            return !connected || frame - latest_received <= rollback_frames;
+        });
+        taken.swap(received);
+    }
+
+    TakeReceived();
+    return in_window;
+}
+
+void Netplay::TakeReceived() {
+    for (const auto& [input_frame, buttons] : taken) {
+        remote_inputs[Slot(input_frame)] = buttons;
+        confirmed_frame = input_frame;
+
+        // Only frames which have already been emulated can have been mispredicted.
+        if (input_frame < frame && predicted_inputs[Slot(input_frame)] != buttons
+                && (mispredicted_frame == none || input_frame < mispredicted_frame)) {
+            mispredicted_frame = input_frame;
+        }
+    }
+
+    taken.clear();
+}
+
+s64 Netplay::TakeMisprediction() {
+    return std::exchange(mispredicted_frame, none);
+}
+
+u16 Netplay::RemoteInput(s64 input_frame) const {
+    if (input_frame <= confirmed_frame) {
+        return remote_inputs[Slot(input_frame)];
+    }
+
+    // Players usually hold the same buttons for many frames in a row.
+    return (confirmed_frame == none) ? 0 : remote_inputs[Slot(confirmed_frame)];
+}
+
+u16 Netplay::AdvanceFrame(u16 local_buttons) {
+    local_inputs[Slot(frame)] = local_buttons;
+
+    std::array<u8, input_bytes> packet{};
+    const u32 input_frame = frame;
+    std::memcpy(packet.data(), &input_frame, 4);
+    std::memcpy(packet.data() + 4, &local_buttons, 2);
+    // The receive thread reports a lost connection.
+    SendAll(socket_fd, packet.data(), packet.size());
+
+    return ReplayInput(frame++);
+}
+
+u16 Netplay::ReplayInput(s64 past_frame) {
+    const u16 remote_buttons = RemoteInput(past_frame);
+    predicted_inputs[Slot(past_frame)] = remote_buttons;
+    return local_inputs[Slot(past_frame)] | remote_buttons;
+}
+
+} // End namespace Common
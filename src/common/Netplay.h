@@ -0,0 +1,135 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+struct NetplaySettings {
+    // Wait for the other player to connect on this TCP port. Zero doesn't listen.
+    int listen_port = 0;
+    // Or connect to a player listening at host:port.
+    std::string connect_address;
+    // How many frames the game may run past the other player's last input, predicting what they hold.
+    int rollback_frames = 8;
+
+    bool Enabled() const { return listen_port != 0 || !connect_address.empty(); }
+};
+
+// Rollback netplay for two players sharing one console. Both run the same game from power on, and the game sees
+// the buttons held by either of them. Local input is sent every frame, and the other player's is predicted to be
+// whatever they last held until it arrives. The core keeps a savestate from the start of each frame which could
+// still be mispredicted. When a prediction turns out wrong, it loads the state from the start of that frame and
+// emulates up to the present again with the real input, within the same host frame. Only the last of those
+// frames are drawn, and none make sound.
+//
+// Frames are numbered from zero at power on. The listening player also picks the RTC start time, so cartridge
+// clocks read the same on both ends.
+class Netplay {
+public:
+    static constexpr s64 none = -1;
+
+    // Everything needed to emulate a frame again: the state before it, and what isn't part of savestates.
+    struct Snapshot {
+        std::vector<u8> state;
+        int overspent_cycles;
+        u16 held_buttons;
+    };
+
+    // Blocks until the other player has connected. Throws std::runtime_error if that fails, or if they're running
+    // a different game.
+    Netplay(const NetplaySettings& settings, u64 rom_hash);
+    ~Netplay();
+
+    // Seconds since the Unix epoch, for both players' RTCs.
+    s64 RtcStart() const { return rtc_start; }
+
+    // The next frame to emulate.
+    s64 Frame() const { return frame; }
+    Snapshot& SnapshotAt(s64 snapshot_frame) { return snapshots[snapshot_frame % snapshots.size()]; }
+    std::size_t SnapshotBytes() const {
+        std::size_t bytes = 0;
+        for (const Snapshot& snapshot : snapshots) {
+            bytes += snapshot.state.capacity();
+        }
+        return bytes;
+    }
+
+    // Waits while the next frame would get too far ahead of the other player's input. Returns false if it still
+    // would after a short timeout, so the frontend can carry on handling events.
+    bool WaitForInputWindow();
+    // The earliest frame emulated with a wrong prediction since the last call, or none.
+    s64 TakeMisprediction();
+    // Sends the local input for the next frame, and returns the input to emulate it with.
+    u16 AdvanceFrame(u16 local_buttons);
+    // The input to emulate an earlier frame with again, with the other player's input as it's now known.
+    u16 ReplayInput(s64 past_frame);
+
+    void CountRollback(s64 frames) {
+        ++rollbacks;
+        resimulated_frames += frames;
+    }
+
+private:
+    static constexpr std::size_t history_size = 64;
+
+    const int rollback_frames;
+    int socket_fd;
+    s64 rtc_start;
+
+    // Only touched by the emulator thread.
+    s64 frame = 0;
+    std::array<u16, history_size> local_inputs{};
+    // What was predicted for the other player when each frame was last emulated.
+    std::array<u16, history_size> predicted_inputs{};
+    std::array<u16, history_size> remote_inputs{};
+    s64 confirmed_frame = none;
+    s64 mispredicted_frame = none;
+    std::vector<Snapshot> snapshots;
+    int rollbacks = 0;
+    s64 resimulated_frames = 0;
+
+    // Shared with the receive thread, apart from taken.
+    std::mutex mutex;
+    std::condition_variable received_cv;
+    std::vector<std::pair<s64, u16>> received;
+    // Swapped with the received inputs, so neither side allocates once both have grown.
+    std::vector<std::pair<s64, u16>> taken;
+    s64 latest_received = none;
+    bool connected = true;
+    bool closing = false;
+
+    std::thread receive_thread;
+
+    void ReceiveLoop();
+    void TakeReceived();
+    u16 RemoteInput(s64 input_frame) const;
+    static std::size_t Slot(s64 input_frame) { return input_frame % history_size; }
+};
+
+} // End namespace Common
@@ -0,0 +1,124 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "common/PageAlloc.h"
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+#if defined(_WIN32)
+
+void* MapPages(std::size_t bytes, HugePages) {
+    void* ptr = ::operator new(bytes, std::align_val_t{4096});
+    std::memset(ptr, 0, bytes);
+    return ptr;
+}
+
+void UnmapPages(void* ptr, std::size_t, HugePages) {
+    ::operator delete(ptr, std::align_val_t{4096});
+}
+
+int CurrentNumaNode() {
+    return 0;
+}
+
+#else
+
+namespace {
+
+// The size of a huge page on x86-64 and on ARM64 with 4KB pages.
+constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+
+std::size_t HugePageBytes(std::size_t bytes) {
+    return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+}
+
+} // End anonymous namespace
+
+void* MapPages(std::size_t bytes, HugePages huge_pages) {
+    if (huge_pages == HugePages::Off) {
+        void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    const std::size_t size = HugePageBytes(bytes);
+
+#if defined(MAP_HUGETLB)
+    if (huge_pages == HugePages::Explicit) {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            return ptr;
+        }
+    }
+#endif
+
+    // Map an extra huge page, and trim the ends so what's left starts on a huge page boundary.
+    u8* base = static_cast<u8*>(mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+
+    const std::size_t head = (huge_page_size - reinterpret_cast<std::uintptr_t>(base) % huge_page_size)
+                             % huge_page_size;
+    u8* ptr = base + head;
+    if (head != 0) {
+        munmap(base, head);
+    }
+    if (head != huge_page_size) {
+        munmap(ptr + size, huge_page_size - head);
+    }
+
+#if defined(MADV_HUGEPAGE)
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+    return ptr;
+}
+
+void UnmapPages(void* ptr, std::size_t bytes, HugePages huge_pages) {
+    munmap(ptr, (huge_pages == HugePages::Off) ? bytes : HugePageBytes(bytes));
+}
+
+int CurrentNumaNode() {
+#if defined(__linux__)
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return node;
+    }
+#endif
+    return 0;
+}
+
+#endif
+
+} // End namespace Common
@@ -0,0 +1,62 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace Common {
+
+// Transparent asks the kernel to back the memory with huge pages where it can. Explicit takes them from the pool
+// reserved through vm.nr_hugepages, and falls back to transparent huge pages if the pool is empty.
+enum class HugePages {Off, Transparent, Explicit};
+
+// Maps zeroed, page-aligned anonymous memory. Huge page allocations are rounded up to a whole number of huge pages,
+// and are aligned to them so the kernel can use them for the whole range. Memory that's accessed all over, like
+// guest RAM and ROM, is spread over far fewer TLB entries that way. On systems without huge pages, they're ignored.
+void* MapPages(std::size_t bytes, HugePages huge_pages);
+void UnmapPages(void* ptr, std::size_t bytes, HugePages huge_pages);
+
+// The NUMA node the calling thread is running on, which the pages it touches first are taken from. Always 0 on hosts
+// with a single node, and where the node can't be found.
+int CurrentNumaNode();
+
+template<typename T>
+class PageDeleter {
+public:
+    explicit PageDeleter(HugePages _huge_pages = HugePages::Off) : huge_pages(_huge_pages) {}
+
+    void operator()(T* ptr) const {
+        ptr->~T();
+        UnmapPages(ptr, sizeof(T), huge_pages);
+    }
+
+private:
+    HugePages huge_pages;
+};
+
+template<typename T>
+using PagePtr = std::unique_ptr<T, PageDeleter<T>>;
+
+template<typename T>
+PagePtr<T> MakePagePtr(HugePages huge_pages) {
+    return PagePtr<T>(::new(MapPages(sizeof(T), huge_pages)) T(), PageDeleter<T>(huge_pages));
+}
+
+} // End namespace Common
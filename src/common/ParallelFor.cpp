@@ -0,0 +1,85 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "common/ParallelFor.h"
+
+namespace Common {
+
+ParallelFor::ParallelFor(unsigned int num_threads) {
+    for (unsigned int i = 1; i < num_threads; ++i) {
+        workers.emplace_back(&ParallelFor::WorkerLoop, this);
+    }
+}
+
+ParallelFor::~ParallelFor() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        quit = true;
+    }
+    start_cv.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ParallelFor::Run(std::size_t _count, const std::function<void(std::size_t)>& _task) {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        task = &_task;
+        count = _count;
+        next_index = 0;
+        busy_workers = workers.size();
+        ++generation;
+    }
+    start_cv.notify_all();
+
+    RunTasks();
+
+    std::unique_lock<std::mutex> lock{mutex};
+    done_cv.wait(lock, [this]() { return busy_workers == 0; });
+    task = nullptr;
+}
+
+void ParallelFor::WorkerLoop() {
+    unsigned int last_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            start_cv.wait(lock, [this, last_generation]() { return quit || generation != last_generation; });
+            if (quit) {
+                return;
+            }
+            last_generation = generation;
+        }
+
+        RunTasks();
+
+        std::lock_guard<std::mutex> lock{mutex};
+        if (--busy_workers == 0) {
+            done_cv.notify_one();
+        }
+    }
+}
+
+void ParallelFor::RunTasks() {
+    for (std::size_t i = next_index++; i < count; i = next_index++) {
+        (*task)(i);
+    }
+}
+
+} // End namespace Common
@@ -0,0 +1,64 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Common {
+
+// Runs a task for every index in a range, on a set of threads which persist between runs so that stepping many
+// instances in lockstep doesn't start threads every frame. Threads claim indices from a shared counter, so an index
+// which takes longer than the rest only holds up the thread running it.
+class ParallelFor {
+public:
+    // The calling thread takes part in each run, so num_threads - 1 threads are started.
+    explicit ParallelFor(unsigned int num_threads);
+    ~ParallelFor();
+
+    ParallelFor(const ParallelFor&) = delete;
+    ParallelFor& operator=(const ParallelFor&) = delete;
+
+    // Blocks until task has returned for every index in [0, count).
+    void Run(std::size_t count, const std::function<void(std::size_t)>& task);
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    // Bumped by each run, so a worker can tell a new run from a spurious wakeup.
+    unsigned int generation = 0;
+    unsigned int busy_workers = 0;
+    bool quit = false;
+
+    const std::function<void(std::size_t)>* task = nullptr;
+    std::size_t count = 0;
+    std::atomic<std::size_t> next_index{0};
+
+    void WorkerLoop();
+    void RunTasks();
+};
+
+} // End namespace Common
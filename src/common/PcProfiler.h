@@ -0,0 +1,83 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// A sampling profiler over guest code. The CPU reports how many cycles each instruction took, and every interval
+// cycles the address of the instruction running at the time is added to a histogram. Cycles spent halted or blocked
+// by DMA are sampled under their own keys, so idle loops and busy-waits stand out from time the CPU truly idles.
+class PcProfiler {
+public:
+    // GBA keys have the low bit set for Thumb instructions, which are always at even addresses.
+    static constexpr u32 thumb_bit = 0x1;
+    static constexpr u32 halted_key = 0xFFFF'FFFF;
+    static constexpr u32 dma_key = 0xFFFF'FFFE;
+
+    struct Entry {
+        u32 key;
+        u32 opcode;
+        u64 samples;
+    };
+
+    explicit PcProfiler(int _interval) : interval(_interval), countdown(_interval) {}
+
+    void Tick(int cycles, u32 key, u32 opcode = 0) {
+        countdown -= cycles;
+        while (countdown <= 0) {
+            countdown += interval;
+            auto& entry = histogram[key];
+            entry.key = key;
+            entry.opcode = opcode;
+            ++entry.samples;
+            ++total_samples;
+        }
+    }
+
+    u64 TotalSamples() const { return total_samples; }
+
+    // The histogram as a flat profile, hottest first.
+    std::vector<Entry> SortedEntries() const {
+        std::vector<Entry> entries;
+        entries.reserve(histogram.size());
+        for (const auto& pair : histogram) {
+            entries.push_back(pair.second);
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return (a.samples != b.samples) ? a.samples > b.samples : a.key < b.key;
+        });
+
+        return entries;
+    }
+
+private:
+    const int interval;
+    int countdown;
+    u64 total_samples = 0;
+
+    std::unordered_map<u32, Entry> histogram;
+};
+
+} // End namespace Common
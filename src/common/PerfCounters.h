@@ -0,0 +1,91 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <algorithm>
+
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Per-frame event counts, for telling whether a slow game is bound by the CPU, DMA or the LCD without attaching a
+// profiler. Counting is compiled in by the CHROMA_PERF_COUNTERS CMake option; otherwise every Add is a no-op.
+class PerfCounters {
+public:
+    enum Counter {CpuCycles,
+                  HaltCycles,
+                  DmaCycles,
+                  HdmaCycles,
+                  Instructions,
+                  DecodeMisses,
+                  Scanlines,
+                  Resamples,
+                  num_counters};
+
+#ifdef CHROMA_PERF_COUNTERS
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    void Add(Counter counter, u64 amount = 1) const {
+        if constexpr (enabled) {
+            counts[counter] += amount;
+        }
+    }
+
+    // Called at the end of every emulated frame with the number of cycles it ran for. Cycles not spent halted or
+    // blocked by DMA are counted as CPU cycles.
+    void EndFrame(u64 frame_cycles) {
+        if constexpr (enabled) {
+            counts[CpuCycles] = frame_cycles - counts[HaltCycles] - counts[DmaCycles] - counts[HdmaCycles];
+            last_frame = counts;
+            for (int i = 0; i < num_counters; ++i) {
+                totals[i] += counts[i];
+            }
+            counts.fill(0);
+        }
+    }
+
+    // The counts from the most recently finished frame.
+    const std::array<u64, num_counters>& LastFrame() const { return last_frame; }
+    // The counts summed over every finished frame.
+    const std::array<u64, num_counters>& Totals() const { return totals; }
+
+    std::string Summary() const {
+        const double total = std::max<u64>(last_frame[CpuCycles] + last_frame[HaltCycles] + last_frame[DmaCycles]
+                                           + last_frame[HdmaCycles], 1);
+        return fmt::format(" - cpu {:.0f}% halt {:.0f}% dma {:.0f}% hdma {:.0f}% - {} instrs {} decodes {} lines"
+                           " {} resamples",
+                           last_frame[CpuCycles] * 100 / total, last_frame[HaltCycles] * 100 / total,
+                           last_frame[DmaCycles] * 100 / total, last_frame[HdmaCycles] * 100 / total,
+                           last_frame[Instructions], last_frame[DecodeMisses], last_frame[Scanlines],
+                           last_frame[Resamples]);
+    }
+
+private:
+    mutable std::array<u64, num_counters> counts{};
+    std::array<u64, num_counters> last_frame{};
+    std::array<u64, num_counters> totals{};
+};
+
+} // End namespace Common
@@ -0,0 +1,80 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "common/CommonEnums.h"
+
+namespace Common {
+
+enum class PerfProfile {Accurate, Balanced, Fast};
+
+// Everything which trades accuracy for speed, or which only pays off on some hosts. A profile picks all of them at
+// once, then each can be overridden on its own. New performance features go here with a value for each profile,
+// rather than becoming options of their own.
+//
+// Idle loop skipping isn't among them, since it only skips loops whose outcome is already known and costs nothing
+// when it doesn't apply. On the Game Boy, the cached and JIT modes also catch the hardware up once per block while
+// it has nothing to do, instead of ticking it every M-cycle.
+struct PerfSettings {
+    ExecMode exec_mode = ExecMode::Interpreter;
+    AudioFilter audio_filter = AudioFilter::Iir;
+    GbRenderer gb_renderer = GbRenderer::Accurate;
+    // Draw GBA scanlines on a separate thread, and reuse unchanged ones from the previous frame. The line cache
+    // also keeps each tiled background's whole map decoded, so scrolled lines are copied out of it.
+    bool lcd_thread = false;
+    bool line_cache = false;
+    // Mix and resample GB audio on a separate thread, which puts the audio a frame behind.
+    bool audio_thread = false;
+    // Run the GBA BIOS's copy, decompression and math calls natively. Their timing isn't emulated.
+    bool hle_bios = false;
+    // While a GBA game has the prefetch buffer enabled, every sequential ROM opcode fetch hits it, instead of
+    // timing the buffer.
+    bool ideal_prefetch = false;
+    // Start GBA games at the cartridge entry point with the registers the BIOS would have left, instead of running
+    // the boot intro. The Game Boy always starts past its boot ROM.
+    bool skip_bios = false;
+
+    static constexpr PerfSettings ForProfile(PerfProfile profile) {
+        PerfSettings settings;
+        switch (profile) {
+        case PerfProfile::Accurate:
+            break;
+        case PerfProfile::Balanced:
+            settings.exec_mode = ExecMode::Cached;
+            settings.audio_filter = AudioFilter::Blip;
+            settings.lcd_thread = true;
+            settings.line_cache = true;
+            settings.audio_thread = true;
+            break;
+        case PerfProfile::Fast:
+            settings.exec_mode = ExecMode::Jit;
+            settings.audio_filter = AudioFilter::None;
+            settings.gb_renderer = GbRenderer::Scanline;
+            settings.lcd_thread = true;
+            settings.line_cache = true;
+            settings.audio_thread = true;
+            settings.hle_bios = true;
+            settings.ideal_prefetch = true;
+            settings.skip_bios = true;
+            break;
+        }
+        return settings;
+    }
+};
+
+} // End namespace Common
@@ -0,0 +1,128 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "common/RamDelta.h"
+
+namespace Common {
+
+RamDeltaWriter::RamDeltaWriter(const std::string& filename, bool _compress, const std::vector<Region>& _regions)
+        : compress(_compress)
+        , regions(_regions)
+        , delta_stream(filename, std::ios::binary) {
+    if (!delta_stream) {
+        throw std::runtime_error("Error when attempting to open " + filename + " for writing.");
+    }
+
+    std::vector<u32> header{1, compress ? 1u : 0u, static_cast<u32>(line_size), static_cast<u32>(regions.size())};
+    for (const Region& region : regions) {
+        header.push_back(static_cast<u32>(region.size));
+        shadows.emplace_back(region.size, 0);
+    }
+    delta_stream.write(magic.data(), magic.size());
+    delta_stream.write(reinterpret_cast<const char*>(header.data()), header.size() * sizeof(u32));
+
+    for (std::size_t i = 1; i < num_records; ++i) {
+        free_records.emplace_back();
+    }
+
+    writer_thread = std::thread{&RamDeltaWriter::WriterLoop, this};
+}
+
+RamDeltaWriter::~RamDeltaWriter() {
+    {
+        std::lock_guard<std::mutex> lock{record_mutex};
+        quit_writer = true;
+    }
+    record_cv.notify_all();
+    writer_thread.join();
+}
+
+void RamDeltaWriter::Frame() {
+    current_record.clear();
+    for (std::size_t i = 0; i < regions.size(); ++i) {
+        const u8* data = regions[i].data;
+        u8* shadow = shadows[i].data();
+        const std::size_t size = regions[i].size;
+        const std::size_t num_lines = (size + line_size - 1) / line_size;
+
+        const std::size_t bitmap_start = current_record.size();
+        current_record.resize(bitmap_start + (num_lines + 7) / 8, 0);
+        for (std::size_t line = 0; line < num_lines; ++line) {
+            const std::size_t offset = line * line_size;
+            const std::size_t bytes = std::min(line_size, size - offset);
+            if (std::memcmp(data + offset, shadow + offset, bytes) != 0) {
+                current_record[bitmap_start + line / 8] |= 1 << (line % 8);
+                current_record.insert(current_record.end(), data + offset, data + offset + bytes);
+                std::memcpy(shadow + offset, data + offset, bytes);
+            }
+        }
+    }
+
+    std::unique_lock<std::mutex> lock{record_mutex};
+    full_records.emplace_back(std::move(current_record), frame_number++);
+    record_cv.notify_all();
+
+    // The writer only falls behind if the disk can't keep up, in which case the emulator waits rather than losing
+    // frames.
+    record_cv.wait(lock, [this] { return !free_records.empty(); });
+    current_record = std::move(free_records.back());
+    free_records.pop_back();
+}
+
+void RamDeltaWriter::WriterLoop() {
+    std::vector<u8> compressed;
+    std::unique_lock<std::mutex> lock{record_mutex};
+    while (true) {
+        record_cv.wait(lock, [this] { return quit_writer || !full_records.empty(); });
+        if (full_records.empty()) {
+            break;
+        }
+
+        auto [record, frame] = std::move(full_records.front());
+        full_records.pop_front();
+
+        // Compress and write without holding the lock, so the emulator can keep submitting records.
+        lock.unlock();
+        const u8* stored = record.data();
+        uLongf stored_size = record.size();
+        if (compress) {
+            compressed.resize(compressBound(record.size()));
+            uLongf compressed_size = compressed.size();
+            if (compress2(compressed.data(), &compressed_size, record.data(), record.size(), Z_BEST_SPEED) == Z_OK
+                    && compressed_size < record.size()) {
+                stored = compressed.data();
+                stored_size = compressed_size;
+            }
+        }
+
+        const std::array<u32, 3> header{{frame, static_cast<u32>(record.size()), static_cast<u32>(stored_size)}};
+        delta_stream.write(reinterpret_cast<const char*>(header.data()), sizeof(header));
+        delta_stream.write(reinterpret_cast<const char*>(stored), stored_size);
+        lock.lock();
+
+        free_records.push_back(std::move(record));
+        record_cv.notify_all();
+    }
+
+    delta_stream.flush();
+}
+
+} // End namespace Common
@@ -0,0 +1,81 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Streams the guest RAM bytes which changed each frame to a file, for analytics and training data. At the end of
+// each frame, every 64-byte line of each region is compared against a shadow copy, and the frame's record is a
+// bitmap of the changed lines followed by their new contents. The shadow starts out zeroed, so the first record
+// holds every line that isn't. A writer thread compresses the records with zlib, if asked to, and writes them out.
+//
+// The file starts with the magic, then u32 version, u32 flags (1 if compressed), u32 line size, u32 region count,
+// and the u32 size of each region. Each record is u32 frame number, u32 uncompressed size and u32 stored size,
+// followed by the stored bytes, which weren't compressed if the two sizes match. Uncompressed, a record holds each
+// region's bitmap (a bit per line, lowest bit first) and then its changed lines, region by region. Everything is
+// little endian.
+class RamDeltaWriter {
+public:
+    struct Region {
+        const u8* data;
+        std::size_t size;
+    };
+
+    // The regions must stay valid for the life of the writer.
+    RamDeltaWriter(const std::string& filename, bool _compress, const std::vector<Region>& _regions);
+    ~RamDeltaWriter();
+
+    void Frame();
+
+private:
+    static constexpr std::size_t line_size = 64;
+    static constexpr std::size_t num_records = 16;
+    static constexpr std::array<char, 8> magic{{'C', 'H', 'R', 'D', 'E', 'L', 'T', 'A'}};
+
+    const bool compress;
+    const std::vector<Region> regions;
+    std::vector<std::vector<u8>> shadows;
+    std::ofstream delta_stream;
+
+    u32 frame_number = 0;
+    std::vector<u8> current_record;
+
+    // Records waiting to be written, and written ones for the emulator to reuse.
+    std::deque<std::pair<std::vector<u8>, u32>> full_records;
+    std::vector<std::vector<u8>> free_records;
+    std::mutex record_mutex;
+    std::condition_variable record_cv;
+    bool quit_writer = false;
+    std::thread writer_thread;
+
+    void WriterLoop();
+};
+
+} // End namespace Common
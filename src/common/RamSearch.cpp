@@ -0,0 +1,252 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <stdexcept>
+
+#include "common/RamSearch.h"
+#include "common/CommonFuncs.h"
+#include "common/Simd.h"
+
+namespace Common {
+
+namespace {
+
+using Compare = RamSearch::Compare;
+
+// Values are little endian, like every host Chroma runs on.
+u32 LoadValue(const u8* ptr, unsigned int width) {
+    u32 value = 0;
+    std::memcpy(&value, ptr, width);
+    return value;
+}
+
+bool Holds(u32 lhs, u32 rhs, Compare compare) {
+    switch (compare) {
+    case Compare::Equal:
+        return lhs == rhs;
+    case Compare::NotEqual:
+        return lhs != rhs;
+    case Compare::Less:
+        return lhs < rhs;
+    case Compare::Greater:
+        return lhs > rhs;
+    case Compare::LessEqual:
+        return lhs <= rhs;
+    case Compare::GreaterEqual:
+    default:
+        return lhs >= rhs;
+    }
+}
+
+#if defined(CHROMA_SIMD_SSE2)
+
+// A bit for each byte of a 16 byte block which starts a lane of the given width, in the layout of _mm_movemask_epi8.
+template<unsigned int width>
+constexpr u32 lane_starts = (width == 1) ? 0xFFFF : (width == 2) ? 0x5555 : 0x1111;
+
+template<unsigned int width>
+__m128i SplatLanes(u32 value) {
+    if constexpr (width == 1) {
+        return _mm_set1_epi8(static_cast<char>(value));
+    } else if constexpr (width == 2) {
+        return _mm_set1_epi16(static_cast<s16>(value));
+    } else {
+        return _mm_set1_epi32(static_cast<s32>(value));
+    }
+}
+
+template<unsigned int width>
+__m128i LanesEqual(__m128i lhs, __m128i rhs) {
+    if constexpr (width == 1) {
+        return _mm_cmpeq_epi8(lhs, rhs);
+    } else if constexpr (width == 2) {
+        return _mm_cmpeq_epi16(lhs, rhs);
+    } else {
+        return _mm_cmpeq_epi32(lhs, rhs);
+    }
+}
+
+// SSE2 only compares signed lanes, so the sign bits are flipped first to compare them unsigned.
+template<unsigned int width>
+__m128i LanesGreater(__m128i lhs, __m128i rhs) {
+    const __m128i sign = SplatLanes<width>(1u << (width * 8 - 1));
+    lhs = _mm_xor_si128(lhs, sign);
+    rhs = _mm_xor_si128(rhs, sign);
+    if constexpr (width == 1) {
+        return _mm_cmpgt_epi8(lhs, rhs);
+    } else if constexpr (width == 2) {
+        return _mm_cmpgt_epi16(lhs, rhs);
+    } else {
+        return _mm_cmpgt_epi32(lhs, rhs);
+    }
+}
+
+// The offsets into the block whose lanes compare true, as a bit per byte.
+template<unsigned int width>
+u32 BlockMatches(__m128i lhs, __m128i rhs, Compare compare) {
+    u32 matches;
+    switch (compare) {
+    case Compare::Equal:
+        matches = _mm_movemask_epi8(LanesEqual<width>(lhs, rhs));
+        break;
+    case Compare::NotEqual:
+        matches = ~_mm_movemask_epi8(LanesEqual<width>(lhs, rhs));
+        break;
+    case Compare::Less:
+        matches = _mm_movemask_epi8(LanesGreater<width>(rhs, lhs));
+        break;
+    case Compare::Greater:
+        matches = _mm_movemask_epi8(LanesGreater<width>(lhs, rhs));
+        break;
+    case Compare::LessEqual:
+        matches = ~_mm_movemask_epi8(LanesGreater<width>(lhs, rhs));
+        break;
+    case Compare::GreaterEqual:
+    default:
+        matches = ~_mm_movemask_epi8(LanesGreater<width>(rhs, lhs));
+        break;
+    }
+    return matches & lane_starts<width>;
+}
+
+#endif
+
+// Each word of the bitset covers four 16 byte blocks. A vector pass over a block only sees the values starting at
+// multiples of the width from where it loads, so unaligned candidates take one pass for each byte of the width, each
+// loading one byte further along.
+template<unsigned int width>
+void NarrowCandidates(std::vector<u64>& candidates, std::size_t size, const u8* ram, const u8* rhs, u32 value,
+                      Compare compare) {
+#if defined(CHROMA_SIMD_SSE2)
+    const __m128i splat = SplatLanes<width>(value);
+#endif
+
+    for (std::size_t word = 0; word < candidates.size(); ++word) {
+        const u64 bits = candidates[word];
+        if (bits == 0) {
+            continue;
+        }
+
+        u64 kept = 0;
+        for (unsigned int block = 0; block < 4; ++block) {
+            const u32 block_bits = (bits >> (block * 16)) & 0xFFFF;
+            if (block_bits == 0) {
+                continue;
+            }
+
+            const std::size_t base = word * 64 + block * 16;
+#if defined(CHROMA_SIMD_SSE2)
+            if (base + 16 + width - 1 <= size) {
+                u32 matches = 0;
+                for (unsigned int phase = 0; phase < width; ++phase) {
+                    if (((block_bits >> phase) & lane_starts<width>) == 0) {
+                        continue;
+                    }
+
+                    const __m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ram + base + phase));
+                    const __m128i other = (rhs != nullptr)
+                                          ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + base + phase))
+                                          : splat;
+                    matches |= BlockMatches<width>(lhs, other, compare) << phase;
+                }
+                kept |= static_cast<u64>(matches & block_bits) << (block * 16);
+                continue;
+            }
+#endif
+
+            // The end of the region, or a build without SSE2.
+            for (unsigned int i = 0; i < 16; ++i) {
+                if ((block_bits >> i) & 1) {
+                    const std::size_t offset = base + i;
+                    const u32 other = (rhs != nullptr) ? LoadValue(rhs + offset, width) : value;
+                    if (Holds(LoadValue(ram + offset, width), other, compare)) {
+                        kept |= 1ull << (block * 16 + i);
+                    }
+                }
+            }
+        }
+
+        candidates[word] = kept;
+    }
+
+    static_cast<void>(size);
+}
+
+} // End anonymous namespace
+
+RamSearch::RamSearch(const u8* ram, std::size_t size, unsigned int _width, bool aligned)
+        : width(_width)
+        , previous(ram, ram + size)
+        , candidates((size + 63) / 64) {
+    if (width != 1 && width != 2 && width != 4) {
+        throw std::invalid_argument("RAM search values must be 1, 2 or 4 bytes wide.");
+    }
+
+    const std::size_t step = aligned ? width : 1;
+    for (std::size_t offset = 0; offset + width <= size; offset += step) {
+        candidates[offset / 64] |= 1ull << (offset % 64);
+    }
+}
+
+std::size_t RamSearch::Narrow(const u8* ram, Compare compare) { return Narrow(ram, compare, previous.data(), 0); }
+
+std::size_t RamSearch::Narrow(const u8* ram, Compare compare, u32 value) {
+    const u32 value_mask = (width == 4) ? 0xFFFF'FFFF : (1u << (width * 8)) - 1;
+    return Narrow(ram, compare, nullptr, value & value_mask);
+}
+
+std::size_t RamSearch::Narrow(const u8* ram, Compare compare, const u8* rhs, u32 value) {
+    switch (width) {
+    case 1:
+        NarrowCandidates<1>(candidates, previous.size(), ram, rhs, value, compare);
+        break;
+    case 2:
+        NarrowCandidates<2>(candidates, previous.size(), ram, rhs, value, compare);
+        break;
+    default:
+        NarrowCandidates<4>(candidates, previous.size(), ram, rhs, value, compare);
+        break;
+    }
+
+    std::memcpy(previous.data(), ram, previous.size());
+    return Count();
+}
+
+std::size_t RamSearch::Count() const {
+    std::size_t count = 0;
+    for (const u64 bits : candidates) {
+        count += Popcount(bits);
+    }
+    return count;
+}
+
+std::vector<u32> RamSearch::Candidates(std::size_t max_count) const {
+    std::vector<u32> offsets;
+    for (std::size_t word = 0; word < candidates.size() && offsets.size() < max_count; ++word) {
+        u64 bits = candidates[word];
+        while (bits != 0 && offsets.size() < max_count) {
+            const u64 lowest = bits & (~bits + 1);
+            offsets.push_back(static_cast<u32>(word * 64 + Popcount(lowest - 1)));
+            bits ^= lowest;
+        }
+    }
+    return offsets;
+}
+
+u32 RamSearch::Previous(u32 offset) const { return LoadValue(previous.data() + offset, width); }
+
+} // End namespace Common
@@ -0,0 +1,60 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Finds where a game keeps a value by narrowing down the offsets into a RAM region, one snapshot at a time, e.g.
+// every u16 which went up since the last snapshot. The candidates are a bitset with a bit per byte offset, and each
+// pass compares 16 bytes at a time, skipping any block with no candidates left, so later passes get cheaper as the
+// set shrinks. Values are little endian, like the GB and GBA.
+class RamSearch {
+public:
+    enum class Compare {Equal, NotEqual, Less, Greater, LessEqual, GreaterEqual};
+
+    // Every offset which can hold a whole value starts out as a candidate, or only the multiples of the width if
+    // aligned is set. The width is 1, 2 or 4 bytes.
+    RamSearch(const u8* ram, std::size_t size, unsigned int _width, bool aligned);
+
+    // Keeps the candidates whose value in ram compares true against their value in the last snapshot, or against
+    // the given value, and then takes ram as the new snapshot. Returns the number of candidates left.
+    std::size_t Narrow(const u8* ram, Compare compare);
+    std::size_t Narrow(const u8* ram, Compare compare, u32 value);
+
+    std::size_t Count() const;
+    // The first max_count candidates, in order of offset.
+    std::vector<u32> Candidates(std::size_t max_count) const;
+    // The value at the offset in the last snapshot.
+    u32 Previous(u32 offset) const;
+
+    std::size_t Size() const { return previous.size(); }
+    unsigned int Width() const { return width; }
+
+private:
+    const unsigned int width;
+    std::vector<u8> previous;
+    std::vector<u64> candidates;
+
+    std::size_t Narrow(const u8* ram, Compare compare, const u8* rhs, u32 value);
+};
+
+} // End namespace Common
@@ -0,0 +1,128 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "common/Resampler.h"
+#include "common/SaveState.h"
+#include "common/Simd.h"
+
+namespace Common {
+
+namespace {
+
+constexpr double pi = 3.14159265358979323846;
+
+// The sinc filter's cutoff, and its length in input samples, which sets how sharply it cuts off.
+constexpr double sinc_cutoff_frequency = 19000.0;
+constexpr std::size_t sinc_taps = 2048;
+
+double KernelAt(FirResampler::Kernel kernel, double t) {
+    if (kernel == FirResampler::Kernel::Linear) {
+        return std::max(0.0, 1.0 - std::abs(t));
+    }
+
+    const double half_width = sinc_taps / 2.0;
+    if (std::abs(t) >= half_width) {
+        return 0.0;
+    }
+
+    const double input_frequency = IirResampler::input_samples_per_frame * 60.0;
+    const double cutoff = 2.0 * sinc_cutoff_frequency / input_frequency;
+    const double x = pi * cutoff * t;
+    const double sinc = (t == 0.0) ? 1.0 : std::sin(x) / x;
+    const double window = 0.42 + 0.5 * std::cos(pi * t / half_width) + 0.08 * std::cos(2.0 * pi * t / half_width);
+    return sinc * window;
+}
+
+} // End anonymous namespace
+
+FirResampler::FirResampler(Kernel kernel, int _gain)
+        : gain(_gain)
+        , num_taps((kernel == Kernel::Linear) ? 8 : sinc_taps)
+        , tap_shift((kernel == Kernel::Linear) ? 14 : 15)
+        , taps(phases * num_taps)
+        , left(num_taps + input_samples_per_block)
+        , right(num_taps + input_samples_per_block) {
+
+    // Output samples at phase p fall p/phases after the input sample num_taps/2 before the newest one they use.
+    for (int p = 0; p < phases; ++p) {
+        std::vector<double> phase_taps(num_taps);
+        for (std::size_t k = 0; k < num_taps; ++k) {
+            const double t = static_cast<double>(num_taps / 2) - 1.0 - k + static_cast<double>(p) / phases;
+            phase_taps[k] = KernelAt(kernel, t);
+        }
+
+        // Each phase has unity gain, so a constant input comes out unchanged whatever the phase.
+        const double sum = std::accumulate(phase_taps.cbegin(), phase_taps.cend(), 0.0);
+        for (std::size_t k = 0; k < num_taps; ++k) {
+            taps[p * num_taps + k] = static_cast<s16>(std::lrint(phase_taps[k] / sum * (1 << tap_shift)));
+        }
+    }
+}
+
+s32 FirResampler::DotProduct(const s16* input, const s16* phase_taps) const {
+    using Simd::U16x8;
+    using Simd::S32x4;
+
+    S32x4 sum = S32x4::Zero();
+    for (std::size_t k = 0; k < num_taps; k += 8) {
+        sum = sum + Simd::MulAddPairs(U16x8::Load(reinterpret_cast<const u16*>(input + k)),
+                                      U16x8::Load(reinterpret_cast<const u16*>(phase_taps + k)));
+    }
+
+    std::array<s32, 4> lanes;
+    sum.Store(lanes.data());
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+void FirResampler::FilterBlock(int last_index, IirResampler::Output& output) {
+    const int block = (last_index / input_samples_per_block) % blocks_per_frame;
+    for (int i = 0; i < output_samples_per_block; ++i) {
+        // The input sample the output sample falls after, and how far after it.
+        const int input_index = i * IirResampler::decimation_factor / IirResampler::interpolation_factor;
+        const int phase = i * IirResampler::decimation_factor % IirResampler::interpolation_factor;
+
+        const s16* phase_taps = &taps[phase * num_taps];
+        const s64 left_sample = DotProduct(&left[input_index + 1], phase_taps);
+        const s64 right_sample = DotProduct(&right[input_index + 1], phase_taps);
+
+        // The IIR resampler's gain also makes up for its zero-stuffing.
+        const s64 divisor = static_cast<s64>(IirResampler::interpolation_factor) << tap_shift;
+        const int output_index = block * output_samples_per_block + i;
+        output[output_index * 2] = static_cast<s16>(std::clamp<s64>(left_sample * gain / divisor, -0x8000, 0x7FFF));
+        output[output_index * 2 + 1] = static_cast<s16>(std::clamp<s64>(right_sample * gain / divisor, -0x8000,
+                                                                         0x7FFF));
+    }
+
+    // Keep the end of the input for the next block's filter, and clear the rest for the next block.
+    std::copy(left.cend() - num_taps, left.cend(), left.begin());
+    std::copy(right.cend() - num_taps, right.cend(), right.begin());
+    std::fill(left.begin() + num_taps, left.end(), 0);
+    std::fill(right.begin() + num_taps, right.end(), 0);
+}
+
+void IirResampler::SerializeState(State& state) {
+    state.Sync(buffer, left, right, biquad, fixed_biquad);
+}
+
+void FirResampler::SerializeState(State& state) {
+    state.Sync(left, right);
+}
+
+} // End namespace Common
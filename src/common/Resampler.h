@@ -0,0 +1,234 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+#include "common/CommonEnums.h"
+#include "common/CommonTypes.h"
+#include "common/Biquad.h"
+
+namespace Common {
+
+class State;
+
+// Resamples the 34960 samples the APU generates each frame down to 800 through an IIR lowpass filter. The input is
+// zero-stuffed up to the lcm of the two rates, filtered, and decimated. The interpolated stream lines up with the
+// output every 437 input samples, so each block of 437 is filtered as soon as its last sample arrives, and only one
+// block of input needs to be buffered. The fixed point filter gives the same output on every host, for comparing
+// audio across them.
+class IirResampler {
+public:
+    static constexpr int input_samples_per_frame = 34960;
+    static constexpr int output_samples_per_frame = 800;
+    static constexpr int interpolated_samples_per_frame = std::lcm(output_samples_per_frame,
+                                                                   input_samples_per_frame);
+    static constexpr int interpolation_factor = interpolated_samples_per_frame / input_samples_per_frame;
+    static constexpr int decimation_factor = interpolated_samples_per_frame / output_samples_per_frame;
+    static constexpr int input_samples_per_block = decimation_factor / std::gcd(decimation_factor,
+                                                                                interpolation_factor);
+
+    using Output = std::array<s16, output_samples_per_frame * 2>;
+
+    IirResampler() = default;
+    IirResampler(int _gain, bool _fixed_point)
+            : gain(_gain)
+            , fixed_point(_fixed_point) {
+        if (fixed_point) {
+            // The fixed point filter reads its input in groups of 8.
+            left.resize(input_samples_per_block + 8);
+            right.resize(input_samples_per_block + 8);
+            fixed_biquad = FixedBiquad{interpolated_samples_per_frame * 60.0f, interpolation_factor, q[0], q[1],
+                                       max_samples_between_outputs};
+        } else {
+            buffer.resize(input_samples_per_block * 2);
+            biquad = Biquad{interpolated_samples_per_frame * 60.0f, interpolation_factor, q[0], q[1]};
+        }
+    }
+
+    static constexpr bool Handles(AudioFilter filter) {
+        return filter == AudioFilter::Iir || filter == AudioFilter::FixedIir;
+    }
+    // An unused resampler if the filter isn't one of the IIR ones.
+    static IirResampler ForFilter(AudioFilter filter, int gain) {
+        if (!Handles(filter)) {
+            return IirResampler{};
+        }
+        return IirResampler{gain, filter == AudioFilter::FixedIir};
+    }
+
+    // Stores the input sample with the given index in the frame.
+    void Store(int index, int left_sample, int right_sample) {
+        const int i = index % input_samples_per_block;
+        if (fixed_point) {
+            left[i] = static_cast<s16>(std::clamp(left_sample, -0x8000, 0x7FFF));
+            right[i] = static_cast<s16>(std::clamp(right_sample, -0x8000, 0x7FFF));
+        } else {
+            buffer[i * 2] = left_sample;
+            buffer[i * 2 + 1] = right_sample;
+        }
+    }
+
+    // Whether the input sample with the given index is the last one of its block.
+    static bool EndsBlock(int index) { return index % input_samples_per_block == input_samples_per_block - 1; }
+    // The index of the last input sample in the block containing the given index.
+    static int BlockEnd(int index) { return index - index % input_samples_per_block + input_samples_per_block - 1; }
+
+    // Filters the block ending with the given input sample into its part of the frame's output. Samples in the
+    // block which were never stored are silent.
+    void FilterBlock(int last_index, Output& output) {
+        const int block = (last_index / input_samples_per_block) % blocks_per_frame;
+        int filtered = 0;
+        for (int i = 0; i < output_samples_per_block; ++i) {
+            // The input sample the output sample falls after, and how far after it.
+            const int input_index = i * decimation_factor / interpolation_factor;
+            const int offset = i * decimation_factor % interpolation_factor;
+            const int output_index = block * output_samples_per_block + i;
+
+            if (fixed_point) {
+                fixed_biquad.Advance(&left[filtered], &right[filtered], input_index - filtered);
+                filtered = input_index;
+
+                const auto [left_sample, right_sample] = fixed_biquad.Output(offset, left[input_index],
+                                                                             right[input_index]);
+                output[output_index * 2] = static_cast<s16>(std::clamp(left_sample * gain, -0x8000, 0x7FFF));
+                output[output_index * 2 + 1] = static_cast<s16>(std::clamp(right_sample * gain, -0x8000, 0x7FFF));
+                continue;
+            }
+
+            biquad.Advance(&buffer[filtered * 2], input_index - filtered);
+            filtered = input_index;
+
+            const auto [left_sample, right_sample] = biquad.Output(offset, buffer[input_index * 2],
+                                                                   buffer[input_index * 2 + 1]);
+
+            // Round rather than truncate, which is more accurate in this case.
+            output[output_index * 2] = std::lrint(left_sample) * gain;
+            output[output_index * 2 + 1] = std::lrint(right_sample) * gain;
+        }
+
+        if (fixed_point) {
+            fixed_biquad.Advance(&left[filtered], &right[filtered], input_samples_per_block - filtered);
+            std::fill(left.begin(), left.end(), 0);
+            std::fill(right.begin(), right.end(), 0);
+        } else {
+            biquad.Advance(&buffer[filtered * 2], input_samples_per_block - filtered);
+            std::fill(buffer.begin(), buffer.end(), 0.0f);
+        }
+    }
+
+    std::size_t Bytes() const {
+        return buffer.capacity() * sizeof(float) + (left.capacity() + right.capacity()) * sizeof(s16);
+    }
+
+    // Saves the input waiting for the rest of its block and the filter's state, which decide the next output.
+    void SerializeState(State& state);
+
+private:
+    static constexpr int interpolated_samples_per_block = input_samples_per_block * interpolation_factor;
+    static constexpr int output_samples_per_block = interpolated_samples_per_block / decimation_factor;
+    static constexpr int blocks_per_frame = input_samples_per_frame / input_samples_per_block;
+    static_assert(input_samples_per_frame % input_samples_per_block == 0);
+    // Including the run from the last output to the end of the block.
+    static constexpr int max_samples_between_outputs = (decimation_factor + interpolation_factor - 1)
+                                                       / interpolation_factor;
+
+    int gain = 0;
+    bool fixed_point = false;
+    // Interleaved stereo input samples, for the float filter.
+    std::vector<float> buffer;
+    // Input samples for the fixed point filter, clamped to s16.
+    std::vector<s16> left;
+    std::vector<s16> right;
+
+    // Q values are for a 4th order cascaded Butterworth lowpass filter.
+    // Obtained from http://www.earlevel.com/main/2016/09/29/cascading-filters/.
+    static constexpr std::array<float, 2> q{0.54119610f, 1.3065630f};
+    Biquad biquad;
+    FixedBiquad fixed_biquad;
+};
+
+// Resamples straight from the APU's rate to the output rate through a polyphase FIR filter, without zero-stuffing.
+// Each output sample falls at one of interpolation_factor phases after an input sample, and is the dot product of
+// the input around it with that phase's taps. The taps are 16-bit fixed point, so eight are multiplied at a time.
+// The output is delayed by half the filter's length, so a block can be filtered as soon as its last input sample
+// arrives, like the IIR resampler's, using the end of the blocks before it.
+class FirResampler {
+public:
+    // Linear interpolates between the two input samples around each output sample. Sinc is a Blackman-windowed
+    // sinc lowpass with a cutoff below the output's Nyquist frequency, which keeps the square waves' harmonics from
+    // aliasing, at the cost of a much longer filter.
+    enum class Kernel {Linear, Sinc};
+
+    static constexpr int input_samples_per_block = IirResampler::input_samples_per_block;
+
+    FirResampler() = default;
+    // The gain matches the IIR resampler's, so each tier plays at the same volume.
+    FirResampler(Kernel kernel, int _gain);
+
+    static constexpr bool Handles(AudioFilter filter) {
+        return filter == AudioFilter::Linear || filter == AudioFilter::Sinc;
+    }
+    // An unused resampler if the filter isn't one of the FIR ones.
+    static FirResampler ForFilter(AudioFilter filter, int gain) {
+        if (!Handles(filter)) {
+            return FirResampler{};
+        }
+        return FirResampler{(filter == AudioFilter::Linear) ? Kernel::Linear : Kernel::Sinc, gain};
+    }
+
+    void Store(int index, int left_sample, int right_sample) {
+        const std::size_t i = num_taps + index % input_samples_per_block;
+        left[i] = static_cast<s16>(std::clamp(left_sample, -0x8000, 0x7FFF));
+        right[i] = static_cast<s16>(std::clamp(right_sample, -0x8000, 0x7FFF));
+    }
+
+    // Filters the block ending with the given input sample into its part of the frame's output. Samples in the
+    // block which were never stored are silent.
+    void FilterBlock(int last_index, IirResampler::Output& output);
+
+    std::size_t Bytes() const { return (taps.capacity() + left.capacity() + right.capacity()) * sizeof(s16); }
+
+    void SerializeState(State& state);
+
+private:
+    static constexpr int phases = IirResampler::interpolation_factor;
+    static constexpr int output_samples_per_block = input_samples_per_block * IirResampler::interpolation_factor
+                                                    / IirResampler::decimation_factor;
+    static constexpr int blocks_per_frame = IirResampler::input_samples_per_frame / input_samples_per_block;
+
+    int gain = 0;
+    // A multiple of 8.
+    std::size_t num_taps = 0;
+    // The taps are scaled by this many bits, as many as fit without the dot products overflowing.
+    int tap_shift = 0;
+    // The taps of each phase in turn.
+    std::vector<s16> taps;
+    // The last num_taps input samples of the previous blocks, followed by this block's.
+    std::vector<s16> left;
+    std::vector<s16> right;
+
+    s32 DotProduct(const s16* input, const s16* phase_taps) const;
+};
+
+} // End namespace Common
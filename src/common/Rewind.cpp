@@ -0,0 +1,155 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "common/Rewind.h"
+
+namespace Common {
+
+RewindBuffer::RewindBuffer(const RewindSettings& settings)
+        : budget(settings.budget)
+        , interval(settings.interval)
+        , compress_thread(&RewindBuffer::CompressLoop, this) {}
+
+RewindBuffer::~RewindBuffer() {
+    {
+        std::lock_guard<std::mutex> lock{state_mutex};
+        quit = true;
+    }
+    state_cv.notify_all();
+    compress_thread.join();
+}
+
+void RewindBuffer::Push(std::vector<u8>& state) {
+    {
+        std::unique_lock<std::mutex> lock{state_mutex};
+        // Compressing one snapshot takes far less than a snapshot interval, so this rarely waits.
+        state_cv.wait(lock, [this] { return !pending_full; });
+        pending.swap(state);
+        pending_full = true;
+    }
+    state_cv.notify_all();
+}
+
+std::size_t RewindBuffer::Bytes() {
+    std::unique_lock<std::mutex> lock{state_mutex};
+    state_cv.wait(lock, [this] { return !busy; });
+
+    std::size_t bytes = pending.capacity() + latest.capacity() + incoming.capacity() + xor_buffer.capacity();
+    for (const Delta& delta : deltas) {
+        bytes += delta.compressed.capacity();
+    }
+
+    return bytes;
+}
+
+bool RewindBuffer::Pop(std::vector<u8>& state) {
+    std::unique_lock<std::mutex> lock{state_mutex};
+    state_cv.wait(lock, [this] { return !pending_full && !busy; });
+
+    // The compression thread stays idle until the next Push, which only the caller makes.
+    if (deltas.empty()) {
+        return false;
+    }
+
+    const Delta& delta = deltas.back();
+    xor_buffer.resize(delta.xor_size);
+    uLongf xor_size = delta.xor_size;
+    if (uncompress(xor_buffer.data(), &xor_size, delta.compressed.data(), delta.compressed.size()) != Z_OK
+            || xor_size != delta.xor_size) {
+        throw std::runtime_error("Failed to decompress rewind snapshot.");
+    }
+
+    latest.resize(delta.xor_size, 0);
+    for (std::size_t i = 0; i < delta.xor_size; ++i) {
+        latest[i] ^= xor_buffer[i];
+    }
+    latest.resize(delta.older_size);
+
+    deltas_size -= delta.compressed.size();
+    deltas.pop_back();
+
+    state = latest;
+    return true;
+}
+
+void RewindBuffer::CompressLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{state_mutex};
+            state_cv.wait(lock, [this] { return pending_full || quit; });
+            if (!pending_full) {
+                return;
+            }
+
+            incoming.swap(pending);
+            pending_full = false;
+            busy = true;
+        }
+        state_cv.notify_all();
+
+        AddSnapshot();
+
+        {
+            std::lock_guard<std::mutex> lock{state_mutex};
+            busy = false;
+        }
+        state_cv.notify_all();
+    }
+}
+
+void RewindBuffer::AddSnapshot() {
+    if (!have_latest) {
+        latest.swap(incoming);
+        have_latest = true;
+        return;
+    }
+
+    // XORing the new snapshot with the previous one leaves zeroes wherever nothing changed, which zlib shrinks to
+    // almost nothing. The delta turns the new snapshot back into the previous one.
+    const std::size_t xor_size = std::max(latest.size(), incoming.size());
+    xor_buffer.assign(xor_size, 0);
+    std::copy(latest.cbegin(), latest.cend(), xor_buffer.begin());
+    for (std::size_t i = 0; i < incoming.size(); ++i) {
+        xor_buffer[i] ^= incoming[i];
+    }
+
+    Delta delta{std::vector<u8>(compressBound(xor_size)), xor_size, latest.size()};
+    uLongf compressed_size = delta.compressed.size();
+    if (compress2(delta.compressed.data(), &compressed_size, xor_buffer.data(), xor_size, Z_BEST_SPEED) != Z_OK) {
+        // Without the delta the history can't go back past this point.
+        deltas.clear();
+        deltas_size = 0;
+    } else {
+        delta.compressed.resize(compressed_size);
+        delta.compressed.shrink_to_fit();
+        deltas_size += compressed_size;
+        deltas.push_back(std::move(delta));
+    }
+
+    latest.swap(incoming);
+
+    while (deltas_size > budget && !deltas.empty()) {
+        deltas_size -= deltas.front().compressed.size();
+        deltas.pop_front();
+    }
+}
+
+} // End namespace Common
@@ -0,0 +1,98 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+struct RewindSettings {
+    // Memory to spend on compressed snapshots. Zero disables rewind.
+    std::size_t budget = 0;
+    // Emulated frames between snapshots. Rewinding steps back one snapshot per displayed frame.
+    int interval = 4;
+};
+
+// A history of savestates. Consecutive states are nearly identical, so each snapshot is kept as the XOR of it and
+// the snapshot after it, compressed with zlib, and only the newest snapshot is kept whole. Compression runs on
+// its own thread. The oldest snapshots are thrown away once the compressed deltas exceed the memory budget.
+class RewindBuffer {
+public:
+    explicit RewindBuffer(const RewindSettings& settings);
+    ~RewindBuffer();
+
+    // Counts emulated frames, and returns true when it's time for another snapshot.
+    bool SnapshotDue() {
+        if (++frames_since_snapshot < interval) {
+            return false;
+        }
+        frames_since_snapshot = 0;
+        return true;
+    }
+
+    // Hands a snapshot to the compression thread. The buffer is swapped with one the thread has finished with, so
+    // its contents are unspecified afterwards, but it keeps its capacity.
+    void Push(std::vector<u8>& state);
+    // Steps back to the snapshot before the newest one, and copies it into state. Returns false once the history
+    // is used up.
+    bool Pop(std::vector<u8>& state);
+    // The bytes held by snapshots and the buffers used to compress them. Waits for the compression thread to
+    // finish the snapshot it's on.
+    std::size_t Bytes();
+
+private:
+    const std::size_t budget;
+    const int interval;
+    int frames_since_snapshot = 0;
+
+    struct Delta {
+        std::vector<u8> compressed;
+        std::size_t xor_size;
+        // The size of the older snapshot, which differs when a save memory vector was resized in between.
+        std::size_t older_size;
+    };
+
+    // Everything below the mutex belongs to the compression thread while it's busy.
+    std::mutex state_mutex;
+    std::condition_variable state_cv;
+    std::vector<u8> pending;
+    bool pending_full = false;
+    bool busy = false;
+    bool quit = false;
+
+    std::vector<u8> latest;
+    bool have_latest = false;
+    std::vector<u8> incoming;
+    std::vector<u8> xor_buffer;
+    std::deque<Delta> deltas;
+    std::size_t deltas_size = 0;
+
+    std::thread compress_thread;
+
+    void CompressLoop();
+    void AddSnapshot();
+};
+
+} // End namespace Common
@@ -17,7 +17,9 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <algorithm>
+#include <cstddef>
 
 #include "common/CommonTypes.h"
 
@@ -25,24 +27,50 @@ namespace Common {
 
 template<typename T, int N>
 class RingBuffer {
+    static_assert((N & (N - 1)) == 0, "RingBuffer length must be a power of two.");
+
 public:
     constexpr int Size() const { return size; }
     constexpr T Read() const { return ring_buffer[read_index]; }
 
     constexpr T PopFront() {
-        const T value = ring_buffer[read_index++];
-        read_index %= length;
+        const T value = ring_buffer[read_index];
+        read_index = (read_index + 1) & mask;
         size -= 1;
 
         return value;
     }
 
     constexpr void PushBack(T data) {
-        ring_buffer[write_index++] = std::move(data);
-        write_index %= length;
+        ring_buffer[write_index] = std::move(data);
+        write_index = (write_index + 1) & mask;
         size += 1;
     }
 
+    // Returns the number of elements written, which is less than count if the buffer fills up.
+    constexpr int PushBack(const T* data, int count) {
+        count = std::min(count, length - size);
+        const int first_part = std::min(count, length - write_index);
+        std::copy_n(data, first_part, ring_buffer.begin() + write_index);
+        std::copy_n(data + first_part, count - first_part, ring_buffer.begin());
+
+        write_index = (write_index + count) & mask;
+        size += count;
+        return count;
+    }
+
+    // Returns the number of elements read, which is less than count if the buffer runs dry.
+    constexpr int PopFront(T* data, int count) {
+        count = std::min(count, size);
+        const int first_part = std::min(count, length - read_index);
+        std::copy_n(ring_buffer.begin() + read_index, first_part, data);
+        std::copy_n(ring_buffer.begin(), count - first_part, data + first_part);
+
+        read_index = (read_index + count) & mask;
+        size -= count;
+        return count;
+    }
+
     constexpr void Reset() {
         std::fill(ring_buffer.begin(), ring_buffer.end(), T{});
         read_index = 0;
@@ -50,12 +78,67 @@ public:
         size = 0;
     }
 
+    template<typename State>
+    void SerializeState(State& state) { state.Sync(ring_buffer, read_index, write_index, size); }
+
 private:
     static constexpr int length = N;
+    static constexpr int mask = N - 1;
     std::array<T, length> ring_buffer{};
     int read_index = 0;
     int write_index = 0;
     int size = 0;
 };
 
+// A ring buffer that one thread can write to while another reads from it, without locking. Only the writer
+// advances write_index and only the reader advances read_index, so each side just has to see the other's
+// index after the data it covers.
+template<typename T, std::size_t N>
+class SpscRingBuffer {
+    static_assert((N & (N - 1)) == 0, "SpscRingBuffer length must be a power of two.");
+
+public:
+    std::size_t Size() const {
+        return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire);
+    }
+
+    static constexpr std::size_t Capacity() { return N; }
+
+    // Returns the number of elements written, which is less than count if the buffer fills up.
+    std::size_t PushBack(const T* data, std::size_t count) {
+        const std::size_t write = write_index.load(std::memory_order_relaxed);
+        const std::size_t read = read_index.load(std::memory_order_acquire);
+        count = std::min(count, N - (write - read));
+
+        for (std::size_t i = 0; i < count; ++i) {
+            ring_buffer[(write + i) & mask] = data[i];
+        }
+
+        write_index.store(write + count, std::memory_order_release);
+        return count;
+    }
+
+    // Returns the number of elements read, which is less than count if the buffer runs dry.
+    std::size_t PopFront(T* data, std::size_t count) {
+        const std::size_t read = read_index.load(std::memory_order_relaxed);
+        const std::size_t write = write_index.load(std::memory_order_acquire);
+        count = std::min(count, write - read);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            data[i] = ring_buffer[(read + i) & mask];
+        }
+
+        read_index.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    static constexpr std::size_t mask = N - 1;
+    std::array<T, N> ring_buffer{};
+
+    // The indices count up forever and are masked on access, so a full buffer can be told apart from an empty one.
+    std::atomic<std::size_t> read_index{0};
+    std::atomic<std::size_t> write_index{0};
+};
+
 } // End namespace Common
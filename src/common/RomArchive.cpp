@@ -0,0 +1,306 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "common/RomArchive.h"
+
+namespace Common {
+
+namespace {
+
+constexpr std::size_t in_buffer_size = 64 * 1024;
+
+constexpr u32 zip_local_header_sig = 0x0403'4B50;
+constexpr u32 zip_central_header_sig = 0x0201'4B50;
+constexpr u32 zip_end_sig = 0x0605'4B50;
+constexpr std::size_t zip_local_header_size = 30;
+constexpr std::size_t zip_central_header_size = 46;
+constexpr std::size_t zip_end_size = 22;
+
+// Zip and gzip fields are little-endian.
+u16 Read16(const u8* ptr) {
+    return ptr[0] | (ptr[1] << 8);
+}
+
+u32 Read32(const u8* ptr) {
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (static_cast<u32>(ptr[3]) << 24);
+}
+
+bool HasRomExtension(std::string name) {
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+    for (const std::string extension : {".gb", ".gbc", ".gba"}) {
+        if (name.size() > extension.size() && name.compare(name.size() - extension.size(), std::string::npos,
+                                                           extension) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // End anonymous namespace
+
+RomArchive::RomArchive(const std::string& _path)
+        : path(_path)
+        , file(path, std::ios_base::binary) {
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    std::array<u8, 2> magic{};
+    file.read(reinterpret_cast<char*>(magic.data()), magic.size());
+    if (magic[0] == 0x1F && magic[1] == 0x8B) {
+        OpenGzip();
+    } else {
+        OpenZip();
+    }
+
+    rom_remaining = rom_size;
+}
+
+RomArchive::~RomArchive() {
+    if (stream != nullptr) {
+        inflateEnd(stream.get());
+    }
+}
+
+bool RomArchive::IsArchive(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    std::array<u8, 4> magic{};
+    if (!file.read(reinterpret_cast<char*>(magic.data()), magic.size())) {
+        return false;
+    }
+
+    return (magic[0] == 0x1F && magic[1] == 0x8B) || Read32(magic.data()) == zip_local_header_sig;
+}
+
+void RomArchive::Read(u8* dest, std::size_t bytes) {
+    if (bytes > rom_remaining) {
+        throw std::runtime_error("Tried to read past the end of the ROM in " + path);
+    }
+    rom_remaining -= bytes;
+
+    if (stream == nullptr) {
+        if (!file.read(reinterpret_cast<char*>(dest), bytes)) {
+            throw std::runtime_error(path + " ends before the ROM does.");
+        }
+    } else {
+        ReadInflated(dest, bytes);
+    }
+
+    if (zip_entry) {
+        rom_crc = crc32(rom_crc, dest, bytes);
+    }
+
+    if (rom_remaining == 0) {
+        if (stream != nullptr) {
+            FinishInflate();
+        }
+        if (zip_entry && rom_crc != expected_crc) {
+            throw std::runtime_error("Failed to decompress " + path + ", the file is corrupt.");
+        }
+    }
+}
+
+void RomArchive::ReadInflated(u8* dest, std::size_t bytes) {
+    stream->next_out = dest;
+    stream->avail_out = bytes;
+    while (stream->avail_out != 0) {
+        if (stream->avail_in == 0) {
+            const std::size_t chunk = std::min(in_buffer.size(), compressed_remaining);
+            if (chunk == 0 || !file.read(reinterpret_cast<char*>(in_buffer.data()), chunk)) {
+                throw std::runtime_error(path + " ends before the ROM does.");
+            }
+            compressed_remaining -= chunk;
+
+            stream->next_in = in_buffer.data();
+            stream->avail_in = chunk;
+        }
+
+        const int result = inflate(stream.get(), Z_NO_FLUSH);
+        if (result == Z_STREAM_END && stream->avail_out != 0) {
+            throw std::runtime_error(path + " ends before the ROM does.");
+        } else if (result != Z_OK && result != Z_STREAM_END) {
+            throw std::runtime_error("Failed to decompress " + path + ", the file is corrupt.");
+        }
+    }
+}
+
+void RomArchive::OpenGzip() {
+    file.seekg(0, std::ios_base::end);
+    const std::size_t file_size = file.tellg();
+    if (file_size < 18) {
+        throw std::runtime_error(path + " is too small to be a gzip file.");
+    }
+
+    // The uncompressed size is stored at the very end, modulo 4GB, which is far larger than any ROM.
+    std::array<u8, 4> size_field;
+    file.seekg(file_size - size_field.size());
+    file.read(reinterpret_cast<char*>(size_field.data()), size_field.size());
+    rom_size = Read32(size_field.data());
+
+    file.seekg(0);
+    compressed_remaining = file_size;
+    // zlib parses the gzip header itself.
+    StartInflate(MAX_WBITS + 16);
+}
+
+void RomArchive::OpenZip() {
+    file.seekg(0, std::ios_base::end);
+    const std::size_t file_size = file.tellg();
+
+    // The end of central directory record is at the end of the file, followed by a comment of up to 64KB.
+    if (file_size < zip_end_size) {
+        throw std::runtime_error(path + " is not a valid zip archive.");
+    }
+
+    const std::size_t tail_size = std::min<std::size_t>(file_size, zip_end_size + 0xFFFF);
+    std::vector<u8> tail(tail_size);
+    file.seekg(file_size - tail_size);
+    file.read(reinterpret_cast<char*>(tail.data()), tail_size);
+
+    const u8* end_record = nullptr;
+    for (std::size_t i = tail_size - zip_end_size + 1; i-- > 0;) {
+        if (Read32(tail.data() + i) == zip_end_sig) {
+            end_record = tail.data() + i;
+            break;
+        }
+    }
+    if (end_record == nullptr) {
+        throw std::runtime_error(path + " is not a valid zip archive.");
+    }
+
+    const std::size_t num_entries = Read16(end_record + 10);
+    const std::size_t directory_size = Read32(end_record + 12);
+    const std::size_t directory_offset = Read32(end_record + 16);
+    if (directory_offset + directory_size > file_size) {
+        throw std::runtime_error(path + " is not a valid zip archive.");
+    }
+
+    std::vector<u8> directory(directory_size);
+    file.seekg(directory_offset);
+    file.read(reinterpret_cast<char*>(directory.data()), directory_size);
+
+    const u8* rom_entry = nullptr;
+    const u8* first_file = nullptr;
+    for (std::size_t i = 0, pos = 0; i < num_entries; ++i) {
+        if (pos + zip_central_header_size > directory_size
+                || Read32(directory.data() + pos) != zip_central_header_sig) {
+            throw std::runtime_error(path + " is not a valid zip archive.");
+        }
+
+        const u8* entry = directory.data() + pos;
+        const std::size_t name_size = Read16(entry + 28);
+        if (pos + zip_central_header_size + name_size > directory_size) {
+            throw std::runtime_error(path + " is not a valid zip archive.");
+        }
+
+        const std::string name(reinterpret_cast<const char*>(entry) + zip_central_header_size, name_size);
+        if (!name.empty() && name.back() != '/') {
+            if (first_file == nullptr) {
+                first_file = entry;
+            }
+            if (HasRomExtension(name)) {
+                rom_entry = entry;
+                break;
+            }
+        }
+
+        pos += zip_central_header_size + name_size + Read16(entry + 30) + Read16(entry + 32);
+    }
+
+    if (rom_entry == nullptr) {
+        rom_entry = first_file;
+    }
+    if (rom_entry == nullptr) {
+        throw std::runtime_error(path + " is an empty zip archive.");
+    }
+
+    if (Read16(rom_entry + 8) & 0x1) {
+        throw std::runtime_error(path + " is encrypted.");
+    }
+
+    const u16 method = Read16(rom_entry + 10);
+    // Zip files keep the checksum in the directory instead of the compressed stream, so it's checked by hand.
+    zip_entry = true;
+    expected_crc = Read32(rom_entry + 16);
+    compressed_remaining = Read32(rom_entry + 20);
+    rom_size = Read32(rom_entry + 24);
+
+    // The local header repeats the name, and can have a different extra field than the central directory.
+    const std::size_t local_offset = Read32(rom_entry + 42);
+    std::array<u8, zip_local_header_size> local_header{};
+    file.seekg(local_offset);
+    file.read(reinterpret_cast<char*>(local_header.data()), local_header.size());
+    if (!file || Read32(local_header.data()) != zip_local_header_sig) {
+        throw std::runtime_error(path + " is not a valid zip archive.");
+    }
+    file.seekg(local_offset + zip_local_header_size + Read16(local_header.data() + 26)
+               + Read16(local_header.data() + 28));
+
+    if (method == 8) {
+        StartInflate(-MAX_WBITS);
+    } else if (method != 0 || compressed_remaining != rom_size) {
+        throw std::runtime_error(path + " uses an unsupported compression method.");
+    }
+}
+
+void RomArchive::FinishInflate() {
+    // The checksum follows the compressed data, so inflate has to be run to the end of the stream to verify it.
+    u8 extra_byte;
+    int result = Z_OK;
+    while (result == Z_OK) {
+        if (stream->avail_in == 0 && compressed_remaining != 0) {
+            const std::size_t chunk = std::min(in_buffer.size(), compressed_remaining);
+            if (!file.read(reinterpret_cast<char*>(in_buffer.data()), chunk)) {
+                break;
+            }
+            compressed_remaining -= chunk;
+
+            stream->next_in = in_buffer.data();
+            stream->avail_in = chunk;
+        }
+
+        stream->next_out = &extra_byte;
+        stream->avail_out = 1;
+        result = inflate(stream.get(), Z_NO_FLUSH);
+        if (stream->avail_out == 0) {
+            throw std::runtime_error(path + " is larger than its header says.");
+        }
+    }
+
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error("Failed to decompress " + path + ", the file is corrupt.");
+    }
+}
+
+void RomArchive::StartInflate(int window_bits) {
+    stream = std::make_unique<z_stream>();
+    if (inflateInit2(stream.get(), window_bits) != Z_OK) {
+        stream.reset();
+        throw std::runtime_error("Failed to start decompressing " + path);
+    }
+
+    in_buffer.resize(in_buffer_size);
+}
+
+} // End namespace Common
@@ -0,0 +1,75 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+struct z_stream_s;
+
+namespace Common {
+
+// A ROM stored in a gzip file or a zip archive. The ROM is inflated straight into the caller's buffer as it's read,
+// so its header can be checked before the rest of it is decompressed. In a zip archive, the first file with a GB,
+// GBC or GBA extension is used, or the first file if none of them have one.
+class RomArchive {
+public:
+    explicit RomArchive(const std::string& _path);
+    ~RomArchive();
+
+    RomArchive(const RomArchive&) = delete;
+    RomArchive& operator=(const RomArchive&) = delete;
+
+    // True if the file starts with a gzip or zip signature.
+    static bool IsArchive(const std::string& path);
+
+    // The size of the ROM once it's decompressed.
+    std::size_t Size() const { return rom_size; }
+
+    // Decompresses the next bytes of the ROM into dest. Throws std::runtime_error if the archive is corrupt or ends
+    // before the ROM does. The checksum is verified once the last byte of the ROM has been read.
+    void Read(u8* dest, std::size_t bytes);
+
+private:
+    const std::string path;
+    std::ifstream file;
+    // Null for ROMs stored in a zip archive without compression.
+    std::unique_ptr<z_stream_s> stream;
+    std::vector<u8> in_buffer;
+
+    std::size_t rom_size = 0;
+    std::size_t rom_remaining = 0;
+    std::size_t compressed_remaining = 0;
+
+    bool zip_entry = false;
+    u32 expected_crc = 0;
+    u32 rom_crc = 0;
+
+    void OpenGzip();
+    void OpenZip();
+    void StartInflate(int window_bits);
+    void ReadInflated(u8* dest, std::size_t bytes);
+    void FinishInflate();
+};
+
+} // End namespace Common
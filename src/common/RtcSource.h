@@ -0,0 +1,92 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <optional>
+
+#include "common/CommonTypes.h"
+#include "common/SaveState.h"
+
+namespace Common {
+
+struct RtcSettings {
+    // Run the cartridge clocks on emulated time instead of the host clock, so they advance with the emulated
+    // frames at any speed and read the same on every run.
+    bool emulated = false;
+    // Seconds since the Unix epoch that emulated time starts from. Defaults to the host time at power on.
+    std::optional<s64> epoch;
+
+    // 2000-01-01 00:00:00 UTC, for runs which should give the same results on any day.
+    static constexpr s64 reproducible_epoch = 946684800;
+};
+
+// Where the cartridge real-time clocks get the time from. Normally that's the host clock. Emulated clocks start at
+// a fixed time and advance with emulated frames instead, which input movies and netplay always use so the RTC
+// reads the same on every playback and for both players.
+class RtcSource {
+public:
+    using TimePoint = std::chrono::system_clock::time_point;
+
+    RtcSource() = default;
+    // Seconds since the Unix epoch, or nullopt for the host clock.
+    explicit RtcSource(std::optional<s64> start_time)
+            : fixed(start_time.has_value())
+            , fixed_start(std::chrono::seconds{start_time.value_or(0)}) {}
+
+    bool Fixed() const { return fixed; }
+    s64 FixedStart() const {
+        return std::chrono::duration_cast<std::chrono::seconds>(fixed_start.time_since_epoch()).count();
+    }
+
+    void FrameDone() { ++frames; }
+
+    TimePoint Now() const {
+        if (!fixed) {
+            return std::chrono::system_clock::now();
+        }
+
+        // Both cores run 60 emulated frames per second of host time.
+        using namespace std::chrono;
+        return fixed_start + duration_cast<system_clock::duration>(duration<double>{frames / 60.0});
+    }
+
+    // Fixed clocks use UTC rather than the host's time zone, which could differ between recording and playback.
+    std::tm CalendarTime() const {
+        const std::time_t time = std::chrono::system_clock::to_time_t(Now());
+        return fixed ? *std::gmtime(&time) : *std::localtime(&time);
+    }
+
+    // The start time goes along with the frame count, so a state loaded into a session with an emulated clock
+    // carries on from the time it was saved at. States saved with the host clock leave the start time alone.
+    void SerializeState(State& state) {
+        s64 start = fixed ? FixedStart() : 0;
+        state.Sync(frames, start);
+        if (fixed && start != 0) {
+            fixed_start = TimePoint{std::chrono::seconds{start}};
+        }
+    }
+
+private:
+    const bool fixed = false;
+    TimePoint fixed_start;
+    u64 frames = 0;
+};
+
+} // End namespace Common
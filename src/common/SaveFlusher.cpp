@@ -0,0 +1,142 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <fmt/format.h>
+
+#include "common/SaveFlusher.h"
+
+namespace Common {
+
+void CheckPathIsRegularFile(const std::string& filename) {
+    if (std::filesystem::is_directory(filename)) {
+        throw std::runtime_error("Provided path is a directory: " + filename);
+    } else if (!std::filesystem::is_regular_file(filename)) {
+        throw std::runtime_error("Provided path is not a regular file: " + filename);
+    }
+}
+
+bool WriteFileAtomic(const std::string& path, const u8* data, std::size_t size) {
+    const std::string temp_path = path + ".tmp";
+
+    {
+        std::ofstream temp_file(temp_path, std::ios_base::binary | std::ios_base::trunc);
+        if (!temp_file) {
+            fmt::print("Error: could not open {} for writing.\n", temp_path);
+            return false;
+        }
+
+        temp_file.write(reinterpret_cast<const char*>(data), size);
+        temp_file.flush();
+        if (!temp_file) {
+            fmt::print("Error: could not write to {}.\n", temp_path);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        fmt::print("Error: could not replace {} with the new file: {}\n", path, error.message());
+        return false;
+    }
+
+    return true;
+}
+
+SaveFlusher::SaveFlusher(const std::string& _path, int interval_seconds)
+        : path(_path)
+        , interval(interval_seconds)
+        , next_flush(std::chrono::steady_clock::now() + interval)
+        , writer_thread(&SaveFlusher::WriterLoop, this) {}
+
+SaveFlusher::~SaveFlusher() {
+    {
+        std::lock_guard<std::mutex> lock{write_mutex};
+        quit = true;
+    }
+    write_cv.notify_all();
+    writer_thread.join();
+}
+
+void SaveFlusher::Update(const u8* data, std::size_t size, DirtyPages& dirty, const u8* trailer,
+                         std::size_t trailer_size) {
+    next_flush = std::chrono::steady_clock::now() + interval;
+
+    // Loading a savestate or resizing the save marks every page, so most dirty pages may turn out to be unchanged.
+    bool changed = false;
+    if (mirror.size() != size + trailer_size) {
+        mirror.resize(size + trailer_size);
+        std::copy_n(data, size, mirror.begin());
+        changed = true;
+    } else {
+        for (std::size_t offset = 0; offset < size; offset += DirtyPages::page_size) {
+            if (!dirty.Test(offset >> DirtyPages::page_shift)) {
+                continue;
+            }
+
+            const std::size_t bytes = std::min(DirtyPages::page_size, size - offset);
+            if (std::memcmp(mirror.data() + offset, data + offset, bytes) != 0) {
+                std::memcpy(mirror.data() + offset, data + offset, bytes);
+                changed = true;
+            }
+        }
+    }
+    dirty.Clear();
+
+    if (!changed) {
+        return;
+    }
+
+    std::copy_n(trailer, trailer_size, mirror.begin() + size);
+
+    {
+        // A flush every few seconds is far slower than the writer, so there's never a pending write left to
+        // wait on. If there is, it's simply replaced by the newer one.
+        std::lock_guard<std::mutex> lock{write_mutex};
+        pending = mirror;
+        pending_full = true;
+    }
+    write_cv.notify_all();
+}
+
+void SaveFlusher::WriterLoop() {
+    std::vector<u8> writing;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{write_mutex};
+            write_cv.wait(lock, [this] { return pending_full || quit; });
+            if (!pending_full) {
+                return;
+            }
+
+            writing.swap(pending);
+            pending_full = false;
+        }
+
+        if (WriteFileAtomic(path, writing.data(), writing.size())) {
+            ++flushes;
+        }
+    }
+}
+
+} // End namespace Common
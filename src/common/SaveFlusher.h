@@ -0,0 +1,135 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+struct SaveSettings {
+    // Seconds between background writes of changed save data. Zero only writes the save on exit.
+    int flush_interval = 5;
+
+    // Map the save file into memory instead of writing it out, and schedule writebacks of changed pages on every
+    // frame, every flush_interval seconds, or only on exit.
+    enum class MsyncPolicy {Frame, Interval, Exit};
+    bool mapped = false;
+    MsyncPolicy msync_policy = MsyncPolicy::Exit;
+
+    // File which remembers the save type detected for each GBA game, keyed by a hash of the ROM, so a game with no
+    // save file yet starts out with the right kind and size of save memory. Empty disables it.
+    std::string type_cache_path;
+};
+
+// Which 256-byte pages of a save memory have been written since the last flush. Covers the largest save of
+// either system, a 128KB Flash chip or GB cartridge RAM.
+class DirtyPages {
+public:
+    static constexpr int page_shift = 8;
+    static constexpr std::size_t page_size = 1 << page_shift;
+    static constexpr std::size_t max_bytes = 128 * 1024;
+
+    void Mark(std::size_t offset) {
+        const std::size_t page = offset >> page_shift;
+        bits[page / 64] |= 1ull << (page % 64);
+        any = true;
+    }
+
+    void MarkRange(std::size_t offset, std::size_t bytes) {
+        for (std::size_t page = offset >> page_shift; page <= (offset + bytes - 1) >> page_shift; ++page) {
+            bits[page / 64] |= 1ull << (page % 64);
+        }
+        any = true;
+    }
+
+    void MarkAll() {
+        bits.fill(~0ull);
+        any = true;
+    }
+
+    bool Any() const { return any; }
+    bool Test(std::size_t page) const { return (bits[page / 64] >> (page % 64)) & 1; }
+
+    void Clear() {
+        bits.fill(0);
+        any = false;
+    }
+
+private:
+    std::array<u64, max_bytes / page_size / 64> bits{};
+    bool any = false;
+};
+
+// Throws std::runtime_error if the path is a directory or anything else but a regular file.
+void CheckPathIsRegularFile(const std::string& filename);
+
+// Writes a file without leaving a half-written one behind: the data goes to a temporary file next to it, which is
+// then renamed over the original. Returns false and prints an error if either step fails.
+bool WriteFileAtomic(const std::string& path, const u8* data, std::size_t size);
+
+// Periodically writes save data on its own thread, so games which save often don't stall the emulator and a crash
+// loses at most a few seconds of progress. The emulator thread copies the dirty pages into a mirror of the file,
+// which is only handed to the writer if any of them actually changed.
+class SaveFlusher {
+public:
+    SaveFlusher(const std::string& _path, int interval_seconds);
+    ~SaveFlusher();
+
+    // True once the flush interval has passed since the last flush.
+    bool FlushDue() const { return std::chrono::steady_clock::now() >= next_flush; }
+
+    // Copies the dirty pages of the save into the mirror and clears them. The trailer follows the save data in
+    // the file, e.g. the GB RTC registers, and is rewritten whenever the save data changes.
+    void Update(const u8* data, std::size_t size, DirtyPages& dirty, const u8* trailer = nullptr,
+                std::size_t trailer_size = 0);
+
+    // The number of times the save has been written out so far.
+    u64 Flushes() const { return flushes; }
+
+private:
+    const std::string path;
+    const std::chrono::seconds interval;
+    std::chrono::steady_clock::time_point next_flush;
+
+    // Only touched by the emulator thread.
+    std::vector<u8> mirror;
+
+    // Everything below the mutex is shared with the writer thread.
+    std::mutex write_mutex;
+    std::condition_variable write_cv;
+    std::vector<u8> pending;
+    bool pending_full = false;
+    bool quit = false;
+
+    std::atomic<u64> flushes{0};
+    std::thread writer_thread;
+
+    void WriterLoop();
+};
+
+} // End namespace Common
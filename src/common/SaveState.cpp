@@ -0,0 +1,130 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <zlib.h>
+
+#include "common/SaveState.h"
+#include "common/MappedRom.h"
+
+namespace Common {
+
+std::string StatePath(const std::string& save_path) {
+    if (save_path.empty()) {
+        return "";
+    }
+
+    return save_path.substr(0, save_path.rfind('.')) + ".state";
+}
+
+void WriteStateFile(const std::string& filename, const std::vector<u8>& buffer) {
+    std::ofstream state_file(filename, std::ios_base::binary | std::ios_base::trunc);
+    if (!state_file) {
+        throw std::runtime_error("Could not open " + filename + " for writing.");
+    }
+
+    state_file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    if (!state_file) {
+        throw std::runtime_error("Could not write savestate to " + filename + ".");
+    }
+}
+
+bool ReadStateFile(const std::string& filename, std::vector<u8>& buffer) {
+    std::ifstream state_file(filename, std::ios_base::binary | std::ios_base::ate);
+    if (!state_file) {
+        return false;
+    }
+
+    const std::streamoff size = state_file.tellg();
+    state_file.seekg(0, std::ios_base::beg);
+    buffer.resize(static_cast<std::size_t>(size));
+    state_file.read(reinterpret_cast<char*>(buffer.data()), size);
+    if (!state_file) {
+        throw std::runtime_error("Could not read savestate from " + filename + ".");
+    }
+
+    return true;
+}
+
+namespace {
+
+constexpr std::array<char, 8> suspend_magic{{'C', 'H', 'R', 'S', 'U', 'S', 'P', 'N'}};
+
+// The magic followed by the u64 size of the decompressed state.
+constexpr std::size_t suspend_header_size = suspend_magic.size() + sizeof(u64);
+
+} // End anonymous namespace
+
+std::string SuspendPath(const std::string& save_path) {
+    if (save_path.empty()) {
+        return "";
+    }
+
+    return save_path.substr(0, save_path.rfind('.')) + ".suspend";
+}
+
+void WriteSuspendFile(const std::string& filename, const std::vector<u8>& buffer) {
+    std::vector<u8> compressed(suspend_header_size + compressBound(buffer.size()));
+    uLongf compressed_size = compressed.size() - suspend_header_size;
+    if (compress2(compressed.data() + suspend_header_size, &compressed_size, buffer.data(), buffer.size(),
+                  Z_BEST_SPEED) != Z_OK) {
+        throw std::runtime_error("Failed to compress the suspended state.");
+    }
+
+    const u64 state_size = buffer.size();
+    std::memcpy(compressed.data(), suspend_magic.data(), suspend_magic.size());
+    std::memcpy(compressed.data() + suspend_magic.size(), &state_size, sizeof(u64));
+    compressed.resize(suspend_header_size + compressed_size);
+    WriteStateFile(filename, compressed);
+}
+
+bool ReadSuspendFile(const std::string& filename, std::vector<u8>& buffer) {
+    std::error_code error;
+    const auto file_size = std::filesystem::file_size(filename, error);
+    if (error) {
+        return false;
+    } else if (file_size < suspend_header_size) {
+        throw std::runtime_error(filename + " is truncated.");
+    }
+
+    MappedRomFile file{filename};
+    const std::size_t bytes = static_cast<std::size_t>(file_size);
+    const u8* mapped = static_cast<const u8*>(file.Map(bytes));
+    file.Advise(mapped, bytes, RomAdvice::Sequential);
+
+    u64 state_size;
+    std::memcpy(&state_size, mapped + suspend_magic.size(), sizeof(u64));
+    uLongf decompressed_size = state_size;
+    bool valid = std::memcmp(mapped, suspend_magic.data(), suspend_magic.size()) == 0;
+    if (valid) {
+        buffer.resize(state_size);
+        valid = uncompress(buffer.data(), &decompressed_size, mapped + suspend_header_size,
+                           bytes - suspend_header_size) == Z_OK && decompressed_size == state_size;
+    }
+    file.Unmap(const_cast<u8*>(mapped), bytes);
+
+    if (!valid) {
+        throw std::runtime_error(filename + " is not a valid suspended state.");
+    }
+
+    return true;
+}
+
+} // End namespace Common
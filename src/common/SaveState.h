@@ -0,0 +1,210 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+class State;
+
+template<typename T, typename = void>
+struct HasSerializeState : std::false_type {};
+
+template<typename T>
+struct HasSerializeState<T, std::void_t<decltype(std::declval<T&>().SerializeState(std::declval<State&>()))>>
+        : std::true_type {};
+
+// Saves or loads a savestate. Each component lists its state once, in a SerializeState(State&) function, so
+// saving and loading always agree on the layout. Values are copied straight to or from one contiguous buffer.
+// Caches which can be rebuilt from the saved state are left out, and are invalidated when loading.
+class State {
+public:
+    enum class System : u32 {Gb, Gba};
+
+    // Bump whenever the layout of any component changes. States from other versions are rejected.
+    static constexpr u32 version = 9;
+
+    // Saving replaces the contents of the buffer but keeps its capacity, so snapshotting into the same buffer
+    // every frame doesn't allocate.
+    static State ForSaving(std::vector<u8>& buffer, System system) {
+        buffer.clear();
+        return State{&buffer, buffer, system};
+    }
+
+    static State ForLoading(const std::vector<u8>& buffer, System system) { return State{nullptr, buffer, system}; }
+
+    bool Loading() const { return save_buffer == nullptr; }
+
+    template<typename T>
+    void Sync(T& value) {
+        if constexpr (HasSerializeState<T>::value) {
+            value.SerializeState(*this);
+        } else {
+            static_assert(std::is_trivially_copyable_v<T>, "Savestate values must be trivially copyable.");
+            Bytes(&value, sizeof(T));
+        }
+    }
+
+    template<typename T, std::size_t N>
+    void Sync(std::array<T, N>& values) {
+        if constexpr (std::is_trivially_copyable_v<T> && !HasSerializeState<T>::value) {
+            Bytes(values.data(), sizeof(T) * N);
+        } else {
+            for (auto& value : values) {
+                Sync(value);
+            }
+        }
+    }
+
+    // Vectors may change size, e.g. when EEPROM size detection resizes it, so the size is saved too.
+    template<typename T, typename Alloc>
+    void Sync(std::vector<T, Alloc>& values) {
+        u64 size = values.size();
+        Sync(size);
+        if (Loading()) {
+            if (size > load_buffer.size() - read_pos) {
+                throw std::runtime_error("Savestate is truncated.");
+            }
+            values.resize(size);
+        }
+
+        if constexpr (std::is_trivially_copyable_v<T> && !HasSerializeState<T>::value) {
+            Bytes(values.data(), sizeof(T) * size);
+        } else {
+            for (auto& value : values) {
+                Sync(value);
+            }
+        }
+    }
+
+    // For vectors which must keep their size, because something else holds pointers into them.
+    template<typename T, typename Alloc>
+    void SyncContents(std::vector<T, Alloc>& values) {
+        static_assert(std::is_trivially_copyable_v<T>, "Savestate values must be trivially copyable.");
+        u64 size = values.size();
+        Sync(size);
+        if (size != values.size()) {
+            throw std::runtime_error("Savestate memory size does not match.");
+        }
+
+        Bytes(values.data(), sizeof(T) * values.size());
+    }
+
+    // Saved the same way as the vectors above, so savestates don't depend on how the memory is allocated.
+    template<typename T, std::size_t N>
+    void SyncContents(std::array<T, N>& values) {
+        static_assert(std::is_trivially_copyable_v<T>, "Savestate values must be trivially copyable.");
+        u64 size = N;
+        Sync(size);
+        if (size != N) {
+            throw std::runtime_error("Savestate memory size does not match.");
+        }
+
+        Bytes(values.data(), sizeof(T) * N);
+    }
+
+    // For memory the state doesn't own, such as a frame lent by the frontend. Saved the same way as the vectors.
+    template<typename T>
+    void SyncContents(T* values, std::size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "Savestate values must be trivially copyable.");
+        u64 size = count;
+        Sync(size);
+        if (size != count) {
+            throw std::runtime_error("Savestate memory size does not match.");
+        }
+
+        Bytes(values, sizeof(T) * count);
+    }
+
+    template<typename A, typename B>
+    void Sync(std::pair<A, B>& pair) {
+        Sync(pair.first);
+        Sync(pair.second);
+    }
+
+    template<typename T, typename U, typename... Rest>
+    void Sync(T& first, U& second, Rest&... rest) {
+        Sync(first);
+        Sync(second);
+        (Sync(rest), ...);
+    }
+
+private:
+    std::vector<u8>* const save_buffer;
+    const std::vector<u8>& load_buffer;
+    std::size_t read_pos = 0;
+
+    State(std::vector<u8>* _save_buffer, const std::vector<u8>& _load_buffer, System system)
+            : save_buffer(_save_buffer)
+            , load_buffer(_load_buffer) {
+        std::array<char, 8> magic{{'C', 'H', 'R', 'S', 'T', 'A', 'T', 'E'}};
+        u32 state_version = version;
+        System state_system = system;
+        Sync(magic, state_version, state_system);
+
+        if (Loading()) {
+            if (magic != std::array<char, 8>{{'C', 'H', 'R', 'S', 'T', 'A', 'T', 'E'}}) {
+                throw std::runtime_error("Not a Chroma savestate.");
+            } else if (state_version != version) {
+                throw std::runtime_error("Savestate is from an incompatible version of Chroma.");
+            } else if (state_system != system) {
+                throw std::runtime_error("Savestate is for a different system.");
+            }
+        }
+    }
+
+    void Bytes(void* data, std::size_t size) {
+        if (save_buffer != nullptr) {
+            const std::size_t offset = save_buffer->size();
+            save_buffer->resize(offset + size);
+            std::memcpy(save_buffer->data() + offset, data, size);
+        } else {
+            if (read_pos + size > load_buffer.size()) {
+                throw std::runtime_error("Savestate is truncated.");
+            }
+            std::memcpy(data, load_buffer.data() + read_pos, size);
+            read_pos += size;
+        }
+    }
+};
+
+// Savestates live next to the save game, e.g. "game.sav" -> "game.state". Empty if the game isn't being saved.
+std::string StatePath(const std::string& save_path);
+void WriteStateFile(const std::string& filename, const std::vector<u8>& buffer);
+// Returns false if there is no savestate to load.
+bool ReadStateFile(const std::string& filename, std::vector<u8>& buffer);
+
+// The state a session is suspended to on exit and resumed from on the next launch, e.g. "game.sav" ->
+// "game.suspend". Empty if the game isn't being saved.
+std::string SuspendPath(const std::string& save_path);
+// Suspend files are zlib-compressed savestates, since most of a state is RAM which compresses well.
+void WriteSuspendFile(const std::string& filename, const std::vector<u8>& buffer);
+// Maps the file rather than reading it, and decompresses straight from the mapping. Returns false if there is no
+// suspend file.
+bool ReadSuspendFile(const std::string& filename, std::vector<u8>& buffer);
+
+} // End namespace Common
@@ -16,14 +16,90 @@
 
 #pragma once
 
-#include <vector>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "common/CommonTypes.h"
 
 namespace Common {
 
-void WriteImageToFile(const std::vector<u8>& buffer, const std::string& filename, int width, int height);
+struct ScreenshotSettings {
+    // zlib level of written PNGs, from 0 (stored) to 9 (smallest).
+    int compression = 6;
+    // Write every Nth emulated frame to frame_dump_dir as a numbered PNG. Zero disables frame dumping.
+    int frame_dump_interval = 0;
+    std::string frame_dump_dir = "frames";
+};
+
+// Writes packed 8-bit RGB pixels to filename.png, printing an error if it fails.
+void WriteImageToFile(const std::vector<u8>& buffer, const std::string& filename, int width, int height,
+                      int compression = 6);
+// Converts count BGR555 pixels to 8-bit RGB, writing count * 3 bytes.
+void BGR5ToRGB8(const u16* bgr5, std::size_t count, u8* rgb8);
 std::vector<u8> BGR5ToRGB8(const std::vector<u16>& bgr5_buffer);
 
+// The layouts frames can be handed out in. The cores draw BGR555, and the rest are converted from it.
+enum class PixelFormat {
+    Bgr555,
+    // 3 bytes per pixel, red first.
+    Rgb888,
+    // A u32 per pixel, 0x00RRGGBB in host byte order.
+    Xrgb8888,
+    // 1 byte of BT.601 luma per pixel.
+    Gray8
+};
+
+std::size_t BytesPerPixel(PixelFormat format);
+// Converts count BGR555 pixels to the format, writing count * BytesPerPixel(format) bytes. Every conversion is a
+// single table lookup per pixel, with the tables covering all 32768 colours, so any palette is already in them.
+void ConvertPixels(const u16* bgr5, std::size_t count, PixelFormat format, u8* out);
+
+// Converts and writes screenshots and dumped frames on background threads, so the emulator thread only copies the
+// frame. The threads are started by the first image. Images still queued on destruction are written before it
+// returns.
+class ImageEncoder {
+public:
+    explicit ImageEncoder(const ScreenshotSettings& settings);
+    ~ImageEncoder();
+
+    void Screenshot(const u16* frame, int width, int height, const std::string& filename);
+
+    // True if the frame about to be passed to FrameDone will be dumped.
+    bool FrameDumpDue() const { return dump_interval != 0 && frame_number % dump_interval == 0; }
+    // Called once per emulated frame.
+    void FrameDone(const u16* frame, int width, int height);
+
+private:
+    const int compression;
+    const int dump_interval;
+    const std::string dump_dir;
+    int frame_number = 0;
+
+    struct Image {
+        std::vector<u16> pixels;
+        int width;
+        int height;
+        std::string filename;
+    };
+
+    // Everything below the mutex is shared with the encoder threads.
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable space_cv;
+    std::deque<Image> queue;
+    // Pixel buffers the encoders are done with, so queueing a frame doesn't allocate.
+    std::vector<std::vector<u16>> free_buffers;
+    bool quit = false;
+
+    std::vector<std::thread> encoder_threads;
+
+    void Push(const u16* frame, int width, int height, std::string filename);
+    void EncoderLoop();
+};
+
 } // End namespace Common
@@ -0,0 +1,371 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <cstring>
+
+#include "common/CommonTypes.h"
+
+// Picks the vector backend from what the compiler targets. SSE2 is always there on x86-64 and NEON on AArch64.
+// Defining CHROMA_SIMD_SCALAR beforehand forces the plain C++ backend, which gives the same results on anything.
+#if !defined(CHROMA_SIMD_SCALAR)
+#if defined(__SSE2__) || defined(_M_X64)
+#define CHROMA_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define CHROMA_SIMD_NEON
+#include <arm_neon.h>
+#else
+#define CHROMA_SIMD_SCALAR
+#endif
+#endif
+
+namespace Common::Simd {
+
+// Eight 16-bit lanes. Comparisons produce lane masks, which are 0xFFFF where the condition holds and 0 where it
+// doesn't.
+class U16x8 {
+public:
+    static U16x8 Load(const u16* src);
+    static U16x8 Splat(u16 value);
+    static U16x8 FromLanes(const std::array<u16, 8>& values) { return Load(values.data()); }
+    static U16x8 Zero() { return Splat(0); }
+    void Store(u16* dest) const;
+
+#if defined(CHROMA_SIMD_SSE2)
+    __m128i vec;
+#elif defined(CHROMA_SIMD_NEON)
+    uint16x8_t vec;
+#else
+    std::array<u16, 8> vec;
+#endif
+};
+
+// Four signed 32-bit lanes.
+class S32x4 {
+public:
+    static S32x4 Load(const s32* src);
+    static S32x4 Splat(s32 value);
+    static S32x4 FromLanes(const std::array<s32, 4>& values) { return Load(values.data()); }
+    static S32x4 Zero() { return Splat(0); }
+    void Store(s32* dest) const;
+
+#if defined(CHROMA_SIMD_SSE2)
+    __m128i vec;
+#elif defined(CHROMA_SIMD_NEON)
+    int32x4_t vec;
+#else
+    std::array<s32, 4> vec;
+#endif
+};
+
+// Four float lanes. The operations are plain IEEE single precision ones, so every backend gives the same results.
+class F32x4 {
+public:
+    F32x4() = default;
+    F32x4(float a, float b, float c = 0.0f, float d = 0.0f) { *this = FromLanes({{a, b, c, d}}); }
+    F32x4(int a, int b, int c = 0, int d = 0)
+            : F32x4(static_cast<float>(a), static_cast<float>(b), static_cast<float>(c), static_cast<float>(d)) {}
+
+    static F32x4 Load(const float* src);
+    static F32x4 Splat(float value);
+    static F32x4 FromLanes(const std::array<float, 4>& values) { return Load(values.data()); }
+    void Store(float* dest) const;
+
+    // Copies the given lane to every lane.
+    template<int lane>
+    F32x4 Spread() const;
+
+    F32x4& operator+=(const F32x4& rhs);
+    F32x4& operator-=(const F32x4& rhs);
+    F32x4& operator*=(const F32x4& rhs);
+    F32x4& operator/=(const F32x4& rhs);
+
+    // Denormal results are flushed to zero from then on, on the calling thread.
+    static void SetFlushToZero();
+
+#if defined(CHROMA_SIMD_SSE2)
+    __m128 vec;
+#elif defined(CHROMA_SIMD_NEON)
+    float32x4_t vec;
+#else
+    std::array<float, 4> vec;
+#endif
+};
+
+#if defined(CHROMA_SIMD_SSE2)
+
+inline U16x8 U16x8::Load(const u16* src) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))}; }
+inline U16x8 U16x8::Splat(u16 value) { return {_mm_set1_epi16(static_cast<s16>(value))}; }
+inline void U16x8::Store(u16* dest) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), vec); }
+
+inline U16x8 operator&(U16x8 lhs, U16x8 rhs) { return {_mm_and_si128(lhs.vec, rhs.vec)}; }
+inline U16x8 operator|(U16x8 lhs, U16x8 rhs) { return {_mm_or_si128(lhs.vec, rhs.vec)}; }
+inline U16x8 operator^(U16x8 lhs, U16x8 rhs) { return {_mm_xor_si128(lhs.vec, rhs.vec)}; }
+inline U16x8 operator+(U16x8 lhs, U16x8 rhs) { return {_mm_add_epi16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator-(U16x8 lhs, U16x8 rhs) { return {_mm_sub_epi16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator*(U16x8 lhs, U16x8 rhs) { return {_mm_mullo_epi16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator==(U16x8 lhs, U16x8 rhs) { return {_mm_cmpeq_epi16(lhs.vec, rhs.vec)}; }
+// Clears the lanes of value where the mask is set.
+inline U16x8 AndNot(U16x8 mask, U16x8 value) { return {_mm_andnot_si128(mask.vec, value.vec)}; }
+inline U16x8 ShiftLeft(U16x8 lanes, int shift) { return {_mm_sll_epi16(lanes.vec, _mm_cvtsi32_si128(shift))}; }
+inline U16x8 ShiftRight(U16x8 lanes, int shift) { return {_mm_srl_epi16(lanes.vec, _mm_cvtsi32_si128(shift))}; }
+// Treats the lanes as signed.
+inline U16x8 Min(U16x8 lhs, U16x8 rhs) { return {_mm_min_epi16(lhs.vec, rhs.vec)}; }
+// Interleaves the low (or high) four lanes of a and b, as a0 b0 a1 b1 and so on.
+inline U16x8 ZipLow(U16x8 a, U16x8 b) { return {_mm_unpacklo_epi16(a.vec, b.vec)}; }
+inline U16x8 ZipHigh(U16x8 a, U16x8 b) { return {_mm_unpackhi_epi16(a.vec, b.vec)}; }
+
+inline S32x4 S32x4::Load(const s32* src) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))}; }
+inline S32x4 S32x4::Splat(s32 value) { return {_mm_set1_epi32(value)}; }
+inline void S32x4::Store(s32* dest) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), vec); }
+
+inline S32x4 operator&(S32x4 lhs, S32x4 rhs) { return {_mm_and_si128(lhs.vec, rhs.vec)}; }
+inline S32x4 operator|(S32x4 lhs, S32x4 rhs) { return {_mm_or_si128(lhs.vec, rhs.vec)}; }
+inline S32x4 operator+(S32x4 lhs, S32x4 rhs) { return {_mm_add_epi32(lhs.vec, rhs.vec)}; }
+inline S32x4 operator==(S32x4 lhs, S32x4 rhs) { return {_mm_cmpeq_epi32(lhs.vec, rhs.vec)}; }
+// Sign-extending shift.
+inline S32x4 ShiftRight(S32x4 lanes, int shift) { return {_mm_sra_epi32(lanes.vec, _mm_cvtsi32_si128(shift))}; }
+// Multiplies the lanes of a and b as signed values, and adds each pair of neighbouring products.
+inline S32x4 MulAddPairs(U16x8 a, U16x8 b) { return {_mm_madd_epi16(a.vec, b.vec)}; }
+
+inline F32x4 F32x4::Load(const float* src) { F32x4 result; result.vec = _mm_loadu_ps(src); return result; }
+inline F32x4 F32x4::Splat(float value) { F32x4 result; result.vec = _mm_set1_ps(value); return result; }
+inline void F32x4::Store(float* dest) const { _mm_storeu_ps(dest, vec); }
+
+template<int lane>
+F32x4 F32x4::Spread() const {
+    F32x4 result;
+    result.vec = _mm_shuffle_ps(vec, vec, lane * 0x55);
+    return result;
+}
+
+inline F32x4& F32x4::operator+=(const F32x4& rhs) { vec = _mm_add_ps(vec, rhs.vec); return *this; }
+inline F32x4& F32x4::operator-=(const F32x4& rhs) { vec = _mm_sub_ps(vec, rhs.vec); return *this; }
+inline F32x4& F32x4::operator*=(const F32x4& rhs) { vec = _mm_mul_ps(vec, rhs.vec); return *this; }
+inline F32x4& F32x4::operator/=(const F32x4& rhs) { vec = _mm_div_ps(vec, rhs.vec); return *this; }
+
+inline void F32x4::SetFlushToZero() { _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON); }
+
+#elif defined(CHROMA_SIMD_NEON)
+
+inline U16x8 U16x8::Load(const u16* src) { return {vld1q_u16(src)}; }
+inline U16x8 U16x8::Splat(u16 value) { return {vdupq_n_u16(value)}; }
+inline void U16x8::Store(u16* dest) const { vst1q_u16(dest, vec); }
+
+inline U16x8 operator&(U16x8 lhs, U16x8 rhs) { return {vandq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator|(U16x8 lhs, U16x8 rhs) { return {vorrq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator^(U16x8 lhs, U16x8 rhs) { return {veorq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator+(U16x8 lhs, U16x8 rhs) { return {vaddq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator-(U16x8 lhs, U16x8 rhs) { return {vsubq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator*(U16x8 lhs, U16x8 rhs) { return {vmulq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 operator==(U16x8 lhs, U16x8 rhs) { return {vceqq_u16(lhs.vec, rhs.vec)}; }
+inline U16x8 AndNot(U16x8 mask, U16x8 value) { return {vbicq_u16(value.vec, mask.vec)}; }
+inline U16x8 ShiftLeft(U16x8 lanes, int shift) {
+    return {vshlq_u16(lanes.vec, vdupq_n_s16(static_cast<s16>(shift)))};
+}
+inline U16x8 ShiftRight(U16x8 lanes, int shift) {
+    return {vshlq_u16(lanes.vec, vdupq_n_s16(static_cast<s16>(-shift)))};
+}
+inline U16x8 Min(U16x8 lhs, U16x8 rhs) {
+    return {vreinterpretq_u16_s16(vminq_s16(vreinterpretq_s16_u16(lhs.vec), vreinterpretq_s16_u16(rhs.vec)))};
+}
+inline U16x8 ZipLow(U16x8 a, U16x8 b) { return {vzipq_u16(a.vec, b.vec).val[0]}; }
+inline U16x8 ZipHigh(U16x8 a, U16x8 b) { return {vzipq_u16(a.vec, b.vec).val[1]}; }
+
+inline S32x4 S32x4::Load(const s32* src) { return {vld1q_s32(src)}; }
+inline S32x4 S32x4::Splat(s32 value) { return {vdupq_n_s32(value)}; }
+inline void S32x4::Store(s32* dest) const { vst1q_s32(dest, vec); }
+
+inline S32x4 operator&(S32x4 lhs, S32x4 rhs) { return {vandq_s32(lhs.vec, rhs.vec)}; }
+inline S32x4 operator|(S32x4 lhs, S32x4 rhs) { return {vorrq_s32(lhs.vec, rhs.vec)}; }
+inline S32x4 operator+(S32x4 lhs, S32x4 rhs) { return {vaddq_s32(lhs.vec, rhs.vec)}; }
+inline S32x4 operator==(S32x4 lhs, S32x4 rhs) { return {vreinterpretq_s32_u32(vceqq_s32(lhs.vec, rhs.vec))}; }
+inline S32x4 ShiftRight(S32x4 lanes, int shift) { return {vshlq_s32(lanes.vec, vdupq_n_s32(-shift))}; }
+inline S32x4 MulAddPairs(U16x8 a, U16x8 b) {
+    const int16x8_t lhs = vreinterpretq_s16_u16(a.vec);
+    const int16x8_t rhs = vreinterpretq_s16_u16(b.vec);
+    const int32x4_t low = vmull_s16(vget_low_s16(lhs), vget_low_s16(rhs));
+    const int32x4_t high = vmull_s16(vget_high_s16(lhs), vget_high_s16(rhs));
+    return {vcombine_s32(vpadd_s32(vget_low_s32(low), vget_high_s32(low)),
+                         vpadd_s32(vget_low_s32(high), vget_high_s32(high)))};
+}
+
+inline F32x4 F32x4::Load(const float* src) { F32x4 result; result.vec = vld1q_f32(src); return result; }
+inline F32x4 F32x4::Splat(float value) { F32x4 result; result.vec = vdupq_n_f32(value); return result; }
+inline void F32x4::Store(float* dest) const { vst1q_f32(dest, vec); }
+
+template<int lane>
+F32x4 F32x4::Spread() const {
+    F32x4 result;
+    result.vec = vdupq_n_f32(vgetq_lane_f32(vec, lane));
+    return result;
+}
+
+inline F32x4& F32x4::operator+=(const F32x4& rhs) { vec = vaddq_f32(vec, rhs.vec); return *this; }
+inline F32x4& F32x4::operator-=(const F32x4& rhs) { vec = vsubq_f32(vec, rhs.vec); return *this; }
+inline F32x4& F32x4::operator*=(const F32x4& rhs) { vec = vmulq_f32(vec, rhs.vec); return *this; }
+inline F32x4& F32x4::operator/=(const F32x4& rhs) {
+#if defined(__aarch64__)
+    vec = vdivq_f32(vec, rhs.vec);
+#else
+    for (int i = 0; i < 4; ++i) {
+        vec[i] /= rhs.vec[i];
+    }
+#endif
+    return *this;
+}
+
+inline void F32x4::SetFlushToZero() {
+#if defined(__aarch64__)
+    // Set the FZ bit in the FPCR. 32-bit NEON always flushes denormals to zero.
+    u64 fpcr;
+    asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+    asm volatile("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+#endif
+}
+
+#else
+
+inline U16x8 U16x8::Load(const u16* src) { U16x8 result; std::memcpy(result.vec.data(), src, 16); return result; }
+inline U16x8 U16x8::Splat(u16 value) { U16x8 result; result.vec.fill(value); return result; }
+inline void U16x8::Store(u16* dest) const { std::memcpy(dest, vec.data(), 16); }
+
+template<typename Op>
+U16x8 LaneWise(U16x8 lhs, U16x8 rhs, Op op) {
+    for (int i = 0; i < 8; ++i) {
+        lhs.vec[i] = static_cast<u16>(op(lhs.vec[i], rhs.vec[i]));
+    }
+    return lhs;
+}
+
+inline U16x8 operator&(U16x8 lhs, U16x8 rhs) { return LaneWise(lhs, rhs, [](u16 a, u16 b) { return a & b; }); }
+inline U16x8 operator|(U16x8 lhs, U16x8 rhs) { return LaneWise(lhs, rhs, [](u16 a, u16 b) { return a | b; }); }
+inline U16x8 operator^(U16x8 lhs, U16x8 rhs) { return LaneWise(lhs, rhs, [](u16 a, u16 b) { return a ^ b; }); }
+inline U16x8 operator+(U16x8 lhs, U16x8 rhs) { return LaneWise(lhs, rhs, [](u16 a, u16 b) { return a + b; }); }
+inline U16x8 operator-(U16x8 lhs, U16x8 rhs) { return LaneWise(lhs, rhs, [](u16 a, u16 b) { return a - b; }); }
+inline U16x8 operator*(U16x8 lhs, U16x8 rhs) { return LaneWise(lhs, rhs, [](u16 a, u16 b) { return a * b; }); }
+inline U16x8 operator==(U16x8 lhs, U16x8 rhs) {
+    return LaneWise(lhs, rhs, [](u16 a, u16 b) { return (a == b) ? 0xFFFF : 0x0000; });
+}
+inline U16x8 AndNot(U16x8 mask, U16x8 value) {
+    return LaneWise(mask, value, [](u16 m, u16 v) { return ~m & v; });
+}
+inline U16x8 ShiftLeft(U16x8 lanes, int shift) {
+    return LaneWise(lanes, lanes, [shift](u16 a, u16) { return (shift < 16) ? (a << shift) : 0; });
+}
+inline U16x8 ShiftRight(U16x8 lanes, int shift) {
+    return LaneWise(lanes, lanes, [shift](u16 a, u16) { return (shift < 16) ? (a >> shift) : 0; });
+}
+inline U16x8 Min(U16x8 lhs, U16x8 rhs) {
+    return LaneWise(lhs, rhs, [](u16 a, u16 b) { return (static_cast<s16>(a) < static_cast<s16>(b)) ? a : b; });
+}
+inline U16x8 ZipLow(U16x8 a, U16x8 b) {
+    U16x8 result;
+    for (int i = 0; i < 4; ++i) {
+        result.vec[i * 2] = a.vec[i];
+        result.vec[i * 2 + 1] = b.vec[i];
+    }
+    return result;
+}
+inline U16x8 ZipHigh(U16x8 a, U16x8 b) {
+    U16x8 result;
+    for (int i = 0; i < 4; ++i) {
+        result.vec[i * 2] = a.vec[i + 4];
+        result.vec[i * 2 + 1] = b.vec[i + 4];
+    }
+    return result;
+}
+
+inline S32x4 S32x4::Load(const s32* src) { S32x4 result; std::memcpy(result.vec.data(), src, 16); return result; }
+inline S32x4 S32x4::Splat(s32 value) { S32x4 result; result.vec.fill(value); return result; }
+inline void S32x4::Store(s32* dest) const { std::memcpy(dest, vec.data(), 16); }
+
+template<typename Op>
+S32x4 LaneWise(S32x4 lhs, S32x4 rhs, Op op) {
+    for (int i = 0; i < 4; ++i) {
+        lhs.vec[i] = static_cast<s32>(op(static_cast<u32>(lhs.vec[i]), static_cast<u32>(rhs.vec[i])));
+    }
+    return lhs;
+}
+
+inline S32x4 operator&(S32x4 lhs, S32x4 rhs) { return LaneWise(lhs, rhs, [](u32 a, u32 b) { return a & b; }); }
+inline S32x4 operator|(S32x4 lhs, S32x4 rhs) { return LaneWise(lhs, rhs, [](u32 a, u32 b) { return a | b; }); }
+inline S32x4 operator+(S32x4 lhs, S32x4 rhs) { return LaneWise(lhs, rhs, [](u32 a, u32 b) { return a + b; }); }
+inline S32x4 operator==(S32x4 lhs, S32x4 rhs) {
+    return LaneWise(lhs, rhs, [](u32 a, u32 b) { return (a == b) ? 0xFFFF'FFFF : 0; });
+}
+inline S32x4 ShiftRight(S32x4 lanes, int shift) {
+    for (s32& lane : lanes.vec) {
+        lane >>= (shift < 32) ? shift : 31;
+    }
+    return lanes;
+}
+inline S32x4 MulAddPairs(U16x8 a, U16x8 b) {
+    S32x4 result;
+    for (int i = 0; i < 4; ++i) {
+        // Wraps the same way as the vector instructions when both products are -0x8000 * -0x8000.
+        const u32 sum = static_cast<u32>(static_cast<s16>(a.vec[i * 2]) * static_cast<s16>(b.vec[i * 2]))
+                        + static_cast<u32>(static_cast<s16>(a.vec[i * 2 + 1]) * static_cast<s16>(b.vec[i * 2 + 1]));
+        result.vec[i] = static_cast<s32>(sum);
+    }
+    return result;
+}
+
+inline F32x4 F32x4::Load(const float* src) { F32x4 result; std::memcpy(result.vec.data(), src, 16); return result; }
+inline F32x4 F32x4::Splat(float value) { F32x4 result; result.vec.fill(value); return result; }
+inline void F32x4::Store(float* dest) const { std::memcpy(dest, vec.data(), 16); }
+
+template<int lane>
+F32x4 F32x4::Spread() const { return Splat(vec[lane]); }
+
+template<typename Op>
+F32x4& LaneWise(F32x4& lhs, const F32x4& rhs, Op op) {
+    for (int i = 0; i < 4; ++i) {
+        lhs.vec[i] = op(lhs.vec[i], rhs.vec[i]);
+    }
+    return lhs;
+}
+
+inline F32x4& F32x4::operator+=(const F32x4& rhs) {
+    return LaneWise(*this, rhs, [](float a, float b) { return a + b; });
+}
+inline F32x4& F32x4::operator-=(const F32x4& rhs) {
+    return LaneWise(*this, rhs, [](float a, float b) { return a - b; });
+}
+inline F32x4& F32x4::operator*=(const F32x4& rhs) {
+    return LaneWise(*this, rhs, [](float a, float b) { return a * b; });
+}
+inline F32x4& F32x4::operator/=(const F32x4& rhs) {
+    return LaneWise(*this, rhs, [](float a, float b) { return a / b; });
+}
+
+// Denormals are left alone, which is only slower.
+inline void F32x4::SetFlushToZero() {}
+
+#endif
+
+inline F32x4 operator+(F32x4 lhs, const F32x4& rhs) { return lhs += rhs; }
+inline F32x4 operator-(F32x4 lhs, const F32x4& rhs) { return lhs -= rhs; }
+inline F32x4 operator*(F32x4 lhs, const F32x4& rhs) { return lhs *= rhs; }
+inline F32x4 operator/(F32x4 lhs, const F32x4& rhs) { return lhs /= rhs; }
+
+// Takes each lane from a where the mask is set, and from b where it isn't.
+inline U16x8 Select(U16x8 mask, U16x8 a, U16x8 b) { return (mask & a) | AndNot(mask, b); }
+
+} // End namespace Common::Simd
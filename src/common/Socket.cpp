@@ -0,0 +1,179 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fmt/format.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common/Socket.h"
+
+namespace Common {
+
+namespace {
+
+void DisableNagle(int socket_fd) {
+    const int enable = 1;
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+} // End anonymous namespace
+
+int ListenForPeer(int port, const std::string& purpose) {
+    const int listen_fd = ListenOnPort(port, 1);
+
+    fmt::print("Waiting for the other instance to connect for {} on port {}.\n", purpose, port);
+    int socket_fd;
+    do {
+        socket_fd = accept(listen_fd, nullptr, nullptr);
+    } while (socket_fd < 0 && errno == EINTR);
+    const int error = errno;
+    close(listen_fd);
+
+    if (socket_fd < 0) {
+        throw std::runtime_error(fmt::format("Could not accept a connection: {}", std::strerror(error)));
+    }
+
+    DisableNagle(socket_fd);
+    return socket_fd;
+}
+
+int ListenOnPort(int port, int backlog) {
+    const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error(fmt::format("Could not create a socket: {}", std::strerror(errno)));
+    }
+
+    const int enable = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listen_fd, backlog) != 0) {
+        const int error = errno;
+        close(listen_fd);
+        throw std::runtime_error(fmt::format("Could not listen on port {}: {}", port, std::strerror(error)));
+    }
+
+    return listen_fd;
+}
+
+int ListenOnUnixSocket(const std::string& path, int backlog) {
+    sockaddr_un address{};
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Invalid socket path: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error(fmt::format("Could not create a socket: {}", std::strerror(errno)));
+    }
+
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listen_fd, backlog) != 0) {
+        const int error = errno;
+        close(listen_fd);
+        throw std::runtime_error(fmt::format("Could not listen on {}: {}", path, std::strerror(error)));
+    }
+
+    return listen_fd;
+}
+
+int ConnectToPeer(const std::string& address) {
+    const auto colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("Address must be host:port, got " + address);
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results;
+    if (const int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &results); error != 0) {
+        throw std::runtime_error(fmt::format("Could not resolve {}: {}", address, gai_strerror(error)));
+    }
+
+    int socket_fd = -1;
+    for (const addrinfo* result = results; result != nullptr; result = result->ai_next) {
+        socket_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (socket_fd < 0) {
+            continue;
+        }
+        if (connect(socket_fd, result->ai_addr, result->ai_addrlen) == 0) {
+            break;
+        }
+        close(socket_fd);
+        socket_fd = -1;
+    }
+    freeaddrinfo(results);
+
+    if (socket_fd < 0) {
+        throw std::runtime_error("Could not connect to " + address);
+    }
+
+    DisableNagle(socket_fd);
+    return socket_fd;
+}
+
+bool SendAll(int socket_fd, const void* data, std::size_t size) {
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t result = send(socket_fd, ptr, size, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result <= 0) {
+            return false;
+        }
+        ptr += result;
+        size -= result;
+    }
+
+    return true;
+}
+
+bool ReceiveAll(int socket_fd, void* data, std::size_t size) {
+    char* ptr = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t result = recv(socket_fd, ptr, size, 0);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result <= 0) {
+            return false;
+        }
+        ptr += result;
+        size -= result;
+    }
+
+    return true;
+}
+
+} // End namespace Common
@@ -0,0 +1,41 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Common {
+
+// Blocking TCP connections between two instances, for the link cable and netplay. Both return a connected socket
+// with Nagle's algorithm disabled, since every message is small and something is usually waiting on it, and throw
+// std::runtime_error on failure.
+int ListenForPeer(int port, const std::string& purpose);
+int ConnectToPeer(const std::string& address);
+
+// A socket listening on every interface, for servers which accept any number of connections. Throws
+// std::runtime_error on failure.
+int ListenOnPort(int port, int backlog);
+// The same for a Unix domain socket at the given path, replacing anything left there by an earlier server.
+int ListenOnUnixSocket(const std::string& path, int backlog);
+
+// Both retry interrupted calls. SendAll never raises SIGPIPE. Each returns false once the connection is gone.
+bool SendAll(int socket_fd, const void* data, std::size_t size);
+bool ReceiveAll(int socket_fd, void* data, std::size_t size);
+
+} // End namespace Common
@@ -0,0 +1,105 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common/StepTarget.h"
+
+namespace Common {
+
+StepHook::StepHook(Hooks& _hooks, const StepTarget& _target, std::function<void()> stop)
+        : hooks(_hooks)
+        , target(_target) {
+    switch (target.type) {
+    case StepTarget::Type::VBlank:
+        old_frame_func = hooks.vblank_started;
+        hooks.vblank_started = [this, stop] {
+            if (old_frame_func) {
+                old_frame_func();
+            }
+            stop();
+        };
+        break;
+    case StepTarget::Type::HBlank:
+        old_line_func = hooks.hblank_started;
+        hooks.hblank_started = [this, stop](int line) {
+            if (old_line_func) {
+                old_line_func(line);
+            }
+            stop();
+        };
+        break;
+    case StepTarget::Type::Scanline:
+        old_line_func = hooks.line_started;
+        hooks.line_started = [this, stop](int line) {
+            if (old_line_func) {
+                old_line_func(line);
+            }
+            if (static_cast<u32>(line) == target.value) {
+                stop();
+            }
+        };
+        break;
+    case StepTarget::Type::Irq:
+        old_irq_func = hooks.irq_taken;
+        hooks.irq_taken = [this, stop](u32 interrupt_mask) {
+            if (old_irq_func) {
+                old_irq_func(interrupt_mask);
+            }
+            if (target.value == 0 || (interrupt_mask & target.value)) {
+                stop();
+            }
+        };
+        break;
+    case StepTarget::Type::Pc: {
+        const auto it = hooks.exec.find(target.value);
+        if (it != hooks.exec.end()) {
+            old_exec_func = it->second;
+        }
+        hooks.exec[target.value] = [this, stop](u32 pc) {
+            if (old_exec_func) {
+                old_exec_func(pc);
+            }
+            stop();
+        };
+        break;
+    }
+    }
+}
+
+StepHook::~StepHook() {
+    switch (target.type) {
+    case StepTarget::Type::VBlank:
+        hooks.vblank_started = std::move(old_frame_func);
+        break;
+    case StepTarget::Type::HBlank:
+        hooks.hblank_started = std::move(old_line_func);
+        break;
+    case StepTarget::Type::Scanline:
+        hooks.line_started = std::move(old_line_func);
+        break;
+    case StepTarget::Type::Irq:
+        hooks.irq_taken = std::move(old_irq_func);
+        break;
+    case StepTarget::Type::Pc:
+        if (old_exec_func) {
+            hooks.exec[target.value] = std::move(old_exec_func);
+        } else {
+            hooks.exec.erase(target.value);
+        }
+        break;
+    }
+}
+
+} // End namespace Common
@@ -0,0 +1,58 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <functional>
+
+#include "common/CommonTypes.h"
+#include "common/Hooks.h"
+
+namespace Common {
+
+// Where a sub-frame step stops. VBlank stops once the frame is finished, HBlank as any visible line enters hblank,
+// and Scanline as the given line starts. Irq and Pc stop once the CPU has jumped to an interrupt handler or run the
+// instruction at the address, so the step ends right after the instruction or DMA transfer in progress.
+struct StepTarget {
+    enum class Type {VBlank, HBlank, Scanline, Irq, Pc};
+
+    Type type = Type::VBlank;
+    // The line for Scanline, the IF bit mask for Irq (0 for any interrupt), and the address for Pc.
+    u32 value = 0;
+};
+
+// Adds a hook which calls stop when the target is reached, for as long as it's in scope. Any hook already there is
+// still called first, and put back afterwards. The core has to be told when the PC hooks change, before and after.
+class StepHook {
+public:
+    StepHook(Hooks& _hooks, const StepTarget& _target, std::function<void()> stop);
+    ~StepHook();
+
+    StepHook(const StepHook&) = delete;
+    StepHook& operator=(const StepHook&) = delete;
+
+private:
+    Hooks& hooks;
+    const StepTarget target;
+
+    // Only the one for the target's type is used.
+    Hooks::FrameFunc old_frame_func;
+    Hooks::LineFunc old_line_func;
+    Hooks::IrqFunc old_irq_func;
+    Hooks::ExecFunc old_exec_func;
+};
+
+} // End namespace Common
@@ -0,0 +1,81 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Decides when instruction logging starts. Logging stays off until the condition is met, then logs `after`
+// instructions (or until the log hotkey is pressed, if zero) and rearms. The hotkey condition is the plain
+// toggle, and the hotkey can also start or stop a capture early under any other condition.
+struct TraceTrigger {
+    enum class Condition {Hotkey, PcRange, MemWrite, Irq, Frame};
+
+    Condition condition = Condition::Hotkey;
+    // Inclusive address range for PcRange and MemWrite, the IF bit mask for Irq, and the frame number for Frame.
+    u32 low = 0;
+    u32 high = 0;
+
+    // Instructions to keep from before the trigger, and to log after it.
+    std::size_t before = 0;
+    std::size_t after = 0;
+
+    // Only these conditions need to see every instruction while armed. The rest fire from cold paths, so
+    // an armed trigger leaves the JIT and idle loop detection running.
+    bool WatchesInstructions() const { return condition == Condition::PcRange || before != 0; }
+};
+
+// Keeps the last N instructions before a trigger fires, so the log shows what led up to it.
+template<typename Record>
+class PreTriggerBuffer {
+public:
+    explicit PreTriggerBuffer(std::size_t length) : records(length) {}
+
+    void Push(const Record& record) {
+        if (records.empty()) {
+            return;
+        }
+
+        records[next] = record;
+        next = (next + 1) % records.size();
+        size = std::min(size + 1, records.size());
+    }
+
+    // Calls func on each record from oldest to newest, then empties the buffer.
+    template<typename Func>
+    void Drain(Func func) {
+        const std::size_t first = (next + records.size() - size) % std::max<std::size_t>(records.size(), 1);
+        for (std::size_t i = 0; i < size; ++i) {
+            func(records[(first + i) % records.size()]);
+        }
+
+        size = 0;
+    }
+
+private:
+    std::vector<Record> records;
+    std::size_t next = 0;
+    std::size_t size = 0;
+};
+
+} // End namespace Common
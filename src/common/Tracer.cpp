@@ -0,0 +1,68 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <array>
+#include <stdexcept>
+#include <fmt/ostream.h>
+
+#include "common/Tracer.h"
+
+namespace Common {
+
+Tracer::Tracer(const std::string& filename)
+        : trace_stream(filename)
+        , start_time(std::chrono::steady_clock::now()) {
+    if (!trace_stream) {
+        throw std::runtime_error("Error when attempting to open " + filename + " for writing.");
+    }
+
+    static constexpr std::array<const char*, num_tracks> track_names{{
+        "Frame", "CPU", "LCD", "Audio", "Host", "DMA0", "DMA1", "DMA2", "DMA3"
+    }};
+
+    fmt::print(trace_stream, "[\n");
+    for (int i = 0; i < num_tracks; ++i) {
+        fmt::print(trace_stream, "{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": {}, "
+                                 "\"args\": {{\"name\": \"{}\"}}}},\n", i, track_names[i]);
+    }
+}
+
+Tracer::~Tracer() {
+    // The array format allows the closing bracket to be left off, so the trace stays readable even if the emulator
+    // doesn't exit cleanly. A final metadata event is written so the array doesn't end on a comma.
+    fmt::print(trace_stream, "{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+                             "\"args\": {{\"name\": \"Chroma\"}}}}\n]\n");
+}
+
+void Tracer::Instant(Track track, const char* name, u64 cycle, u32 value) {
+    fmt::print(trace_stream, "{{\"name\": \"{}\", \"ph\": \"i\", \"s\": \"t\", \"ts\": {:.3f}, \"pid\": 0, "
+                             "\"tid\": {}, \"args\": {{\"cycle\": {}, \"value\": {}}}}},\n",
+               name, HostTime(), static_cast<int>(track), cycle, value);
+}
+
+void Tracer::WriteEvent(Track track, const char* name, char phase, u64 cycle) {
+    fmt::print(trace_stream, "{{\"name\": \"{}\", \"ph\": \"{}\", \"ts\": {:.3f}, \"pid\": 0, \"tid\": {}, "
+                             "\"args\": {{\"cycle\": {}}}}},\n",
+               name, phase, HostTime(), static_cast<int>(track), cycle);
+}
+
+double Tracer::HostTime() const {
+    // Trace timestamps are in microseconds.
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+} // End namespace Common
@@ -0,0 +1,51 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include "common/CommonTypes.h"
+
+namespace Common {
+
+// Writes a timeline of emulator events in the Chrome trace event format, which both chrome://tracing and Perfetto
+// can open. Events are placed by host time, and each one records the emulated cycle it happened on. Events are only
+// written from the emulator thread.
+class Tracer {
+public:
+    // Each track is shown as its own thread in the trace viewer.
+    enum Track {Frame, Cpu, Lcd, Audio, Host, Dma0, Dma1, Dma2, Dma3, num_tracks};
+
+    explicit Tracer(const std::string& filename);
+    ~Tracer();
+
+    void Begin(Track track, const char* name, u64 cycle) { WriteEvent(track, name, 'B', cycle); }
+    void End(Track track, const char* name, u64 cycle) { WriteEvent(track, name, 'E', cycle); }
+    void Instant(Track track, const char* name, u64 cycle, u32 value);
+
+private:
+    std::ofstream trace_stream;
+    const std::chrono::steady_clock::time_point start_time;
+
+    void WriteEvent(Track track, const char* name, char phase, u64 cycle);
+    double HostTime() const;
+};
+
+} // End namespace Common
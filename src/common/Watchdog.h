@@ -0,0 +1,64 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <string>
+
+namespace Common {
+
+struct WatchdogSettings {
+    // The number of frames the screen can stay off before the game counts as hung. Zero disables the watchdog.
+    int blank_frames = 0;
+
+    bool Enabled() const { return blank_frames != 0; }
+};
+
+// Catches games which have hung for good, so unattended runs can stop them instead of running them to the end.
+// Nothing is checked in the hot paths: the cores report the states they can never leave as they enter them, from
+// their halt and idle loop paths, and check whether the screen is on once per frame.
+class Watchdog {
+public:
+    explicit Watchdog(const WatchdogSettings& _settings)
+            : settings(_settings) {}
+
+    bool Enabled() const { return settings.Enabled(); }
+    // Whether a hang should still be reported. Callers check this before building the reason.
+    bool Armed() const { return settings.Enabled() && reason.empty(); }
+    bool Tripped() const { return !reason.empty(); }
+    const std::string& Reason() const { return reason; }
+
+    void Hang(const std::string& new_reason) {
+        if (Armed()) {
+            reason = new_reason;
+        }
+    }
+
+    void FrameDone(bool screen_on) {
+        blank_frames = screen_on ? 0 : blank_frames + 1;
+        if (blank_frames == settings.blank_frames && Armed()) {
+            Hang("the screen has been off for " + std::to_string(blank_frames) + " frames.");
+        }
+    }
+
+private:
+    const WatchdogSettings settings;
+    int blank_frames = 0;
+    std::string reason;
+};
+
+} // End namespace Common
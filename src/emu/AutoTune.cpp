@@ -0,0 +1,157 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#include "emu/AutoTune.h"
+#include "emu/ParseOptions.h"
+
+namespace Emu {
+
+namespace {
+
+// Options are only kept if they're at least this much faster, so run-to-run noise doesn't pick them.
+constexpr double min_speedup = 1.03;
+
+struct TuneStep {
+    const char* name;
+    bool gb;
+    bool gba;
+    void (*apply)(Common::PerfSettings&);
+};
+
+// Roughly from the biggest win to the smallest. Skipping the GBA boot intro isn't tried, since it changes the
+// frames by design.
+constexpr std::array<TuneStep, 9> tune_steps{{
+    {"cached CPU", true, true, [](Common::PerfSettings& s) { s.exec_mode = ExecMode::Cached; }},
+    {"JIT", true, true, [](Common::PerfSettings& s) { s.exec_mode = ExecMode::Jit; }},
+    {"scanline renderer", true, false, [](Common::PerfSettings& s) { s.gb_renderer = GbRenderer::Scanline; }},
+    {"LCD thread and line cache", false, true, [](Common::PerfSettings& s) {
+        s.lcd_thread = true;
+        s.line_cache = true;
+    }},
+    {"HLE BIOS", false, true, [](Common::PerfSettings& s) { s.hle_bios = true; }},
+    {"ideal prefetch", false, true, [](Common::PerfSettings& s) { s.ideal_prefetch = true; }},
+    {"audio thread", true, false, [](Common::PerfSettings& s) { s.audio_thread = true; }},
+    {"blip audio filter", true, true, [](Common::PerfSettings& s) { s.audio_filter = AudioFilter::Blip; }},
+}};
+
+} // End anonymous namespace
+
+Common::PerfSettings AutoTune(bool gba, const std::function<TuneRun(const Common::PerfSettings&)>& run) {
+    Common::PerfSettings best;
+    const TuneRun reference = run(best);
+    double best_seconds = reference.seconds;
+    const double frames = reference.frame_hashes.size();
+    fmt::print("{:<26} {:>8.1f} fps\n", "accurate", frames / reference.seconds);
+
+    for (const TuneStep& step : tune_steps) {
+        if (!(gba ? step.gba : step.gb)) {
+            continue;
+        }
+
+        Common::PerfSettings candidate = best;
+        step.apply(candidate);
+        const TuneRun result = run(candidate);
+        fmt::print("{:<26} {:>8.1f} fps, ", step.name, frames / result.seconds);
+
+        const auto mismatch = std::mismatch(reference.frame_hashes.cbegin(), reference.frame_hashes.cend(),
+                                            result.frame_hashes.cbegin(), result.frame_hashes.cend());
+        if (mismatch.first != reference.frame_hashes.cend()) {
+            fmt::print("rejected, frame {} differs\n", mismatch.first - reference.frame_hashes.cbegin());
+        } else if (result.seconds * min_speedup > best_seconds) {
+            fmt::print("not faster\n");
+        } else {
+            fmt::print("kept\n");
+            best = candidate;
+            best_seconds = result.seconds;
+        }
+    }
+
+    fmt::print("Tuned: {:.1f} fps, {:.2f}x the accurate profile\n", frames / best_seconds,
+               reference.seconds / best_seconds);
+    return best;
+}
+
+std::string TunedSettingsPath(const std::string& save_path) {
+    return save_path.substr(0, save_path.rfind('.')) + ".tune";
+}
+
+void SaveTunedSettings(const std::string& path, u64 rom_hash, const Common::PerfSettings& settings) {
+    std::ofstream tune_file(path);
+    if (!tune_file) {
+        throw std::runtime_error("Error when attempting to open " + path + " for writing.");
+    }
+
+    fmt::print(tune_file, "# Performance options picked by --auto-tune for the ROM with this hash.\n");
+    fmt::print(tune_file, "rom_hash {:016X}\n", rom_hash);
+    fmt::print(tune_file, "options");
+    for (const std::string& token : PerfSettingsTokens(settings)) {
+        fmt::print(tune_file, " {}", token);
+    }
+    fmt::print(tune_file, "\n");
+
+    fmt::print("Saved the tuned settings to {}\n", path);
+}
+
+Common::PerfSettings ApplyTunedSettings(const std::vector<std::string>& tokens, const Common::PerfSettings& settings,
+                                        const std::string& path, u64 rom_hash) {
+    std::ifstream tune_file(path);
+    if (!tune_file || Emu::ContainsOption(tokens, "--accuracy")) {
+        return settings;
+    }
+
+    bool hash_matches = false;
+    std::vector<std::string> tuned_tokens;
+    std::string line;
+    while (std::getline(tune_file, line)) {
+        std::istringstream line_stream(line);
+        std::string key;
+        line_stream >> key;
+        if (key == "rom_hash") {
+            std::string hash_string;
+            line_stream >> hash_string;
+            hash_matches = hash_string == fmt::format("{:016X}", rom_hash);
+        } else if (key == "options") {
+            for (std::string token; line_stream >> token;) {
+                tuned_tokens.push_back(token);
+            }
+        }
+    }
+
+    if (!hash_matches) {
+        fmt::print("Ignoring {}, which was tuned for a different ROM\n", path);
+        return settings;
+    }
+
+    try {
+        const Common::PerfSettings tuned = GetPerfSettings(tokens, GetPerfSettings(tuned_tokens));
+        fmt::print("Using the settings tuned for this ROM in {}\n", path);
+        return tuned;
+    } catch (const std::invalid_argument&) {
+        fmt::print("Ignoring {}, which holds invalid options\n", path);
+        return settings;
+    }
+}
+
+} // End namespace Emu
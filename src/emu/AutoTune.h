@@ -0,0 +1,92 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/Hash.h"
+#include "common/PerfSettings.h"
+#include "emu/HeadlessContext.h"
+
+namespace Emu {
+
+struct TuneRun {
+    double seconds;
+    std::vector<u64> frame_hashes;
+};
+
+// Plays the input movie headless for a set number of frames, hashing each frame the core presents.
+class TuningContext : public HeadlessContext {
+public:
+    TuningContext(std::vector<MovieInput> _movie, int _frames, std::size_t _pixels)
+            : HeadlessContext(std::move(_movie))
+            , frames(_frames)
+            , pixels(_pixels) {}
+
+    void RenderFrame(const u16* fb_ptr, bool) noexcept override {
+        if (frame_hashes.size() < frames) {
+            frame_hashes.push_back(Common::XxHash64::Hash(fb_ptr, pixels * sizeof(u16)));
+            if (frame_hashes.size() == frames) {
+                quit(true);
+            }
+        }
+    }
+
+    void RegisterCallback(InputEvent event, std::function<void(bool)> callback) override {
+        if (event == InputEvent::Quit) {
+            quit = callback;
+        }
+        HeadlessContext::RegisterCallback(event, std::move(callback));
+    }
+
+    template <typename Core>
+    TuneRun Run(Core& core) {
+        const auto start_time = std::chrono::steady_clock::now();
+        core.EmulatorLoop();
+        return {std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count(),
+                std::move(frame_hashes)};
+    }
+
+private:
+    const std::size_t frames;
+    const std::size_t pixels;
+    std::vector<u64> frame_hashes;
+    std::function<void(bool)> quit{[](bool) {}};
+};
+
+// Runs the accurate profile, then tries each performance option in turn on top of the fastest settings found so
+// far. An option is kept if the run is faster and every frame matches the accurate run's, so none of the kept
+// options change what the game shows for this input. Prints how each option did as it goes.
+Common::PerfSettings AutoTune(bool gba, const std::function<TuneRun(const Common::PerfSettings&)>& run);
+
+// Tuned settings live next to the save file, keyed by a hash of the ROM so a different ROM with the same name
+// doesn't pick them up.
+std::string TunedSettingsPath(const std::string& save_path);
+void SaveTunedSettings(const std::string& path, u64 rom_hash, const Common::PerfSettings& settings);
+// Starts from the tuned settings for the ROM instead of the accurate profile, unless --accuracy is given. Options
+// for single settings still take precedence.
+Common::PerfSettings ApplyTunedSettings(const std::vector<std::string>& tokens, const Common::PerfSettings& settings,
+                                        const std::string& path, u64 rom_hash);
+
+} // End namespace Emu
@@ -0,0 +1,241 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "common/Simd.h"
+#include "emu/CpuFilter.h"
+
+namespace Emu {
+
+using namespace Common::Simd;
+
+CpuFilter::CpuFilter(int _width, int _height, const DisplaySettings& settings)
+        : width(_width)
+        , height(_height)
+        , scaler(settings.cpu_scaler)
+        , scale((settings.cpu_scaler == DisplaySettings::CpuScaler::None) ? 1 : settings.cpu_scale)
+        , frame_blend(settings.frame_blend) {
+
+    if (frame_blend) {
+        previous_frame.resize(width * height, 0x7FFF);
+        blended_frame.resize(width * height);
+    }
+
+    if (scale != 1) {
+        scaled_frame.resize(OutputWidth() * OutputHeight());
+    }
+
+    if (scaler == DisplaySettings::CpuScaler::Epx && scale == 4) {
+        doubled_frame.resize(width * height * 4);
+    }
+}
+
+const u16* CpuFilter::Process(const u16* frame) {
+    if (frame_blend) {
+        Blend(frame);
+        frame = blended_frame.data();
+    }
+
+    switch (scaler) {
+    case DisplaySettings::CpuScaler::None:
+        return frame;
+    case DisplaySettings::CpuScaler::Nearest:
+        ScaleNearest(frame, scaled_frame.data());
+        break;
+    case DisplaySettings::CpuScaler::Epx:
+        if (scale == 2) {
+            Scale2x(frame, width, height, scaled_frame.data());
+        } else if (scale == 3) {
+            Scale3x(frame, scaled_frame.data());
+        } else {
+            Scale2x(frame, width, height, doubled_frame.data());
+            Scale2x(doubled_frame.data(), width * 2, height * 2, scaled_frame.data());
+        }
+        break;
+    }
+
+    return scaled_frame.data();
+}
+
+void CpuFilter::Blend(const u16* frame) {
+    // Averages each pixel with the same pixel in the last frame, like the slow response of the GB and GBA LCDs.
+    // Games flicker sprites on and off every other frame for transparency, which relies on this. Adding half the XOR
+    // to the AND averages all three channels at once, once the bits the shift moves into the next channel down are
+    // masked off.
+    const U16x8 channel_mask = U16x8::Splat(0x3DEF);
+    for (int i = 0; i < width * height; i += 8) {
+        const U16x8 current = U16x8::Load(frame + i);
+        const U16x8 previous = U16x8::Load(previous_frame.data() + i);
+        const U16x8 average = (current & previous) + (ShiftRight(current ^ previous, 1) & channel_mask);
+        average.Store(blended_frame.data() + i);
+    }
+
+    std::copy_n(frame, width * height, previous_frame.data());
+}
+
+const u16* CpuFilter::Pad(const u16* frame, int frame_width, int frame_height) {
+    const int stride = frame_width + pad * 2;
+    padded_frame.resize(stride * (frame_height + 2));
+
+    for (int y = -1; y <= frame_height; ++y) {
+        const u16* src = frame + std::clamp(y, 0, frame_height - 1) * frame_width;
+        u16* dest = padded_frame.data() + (y + 1) * stride + pad;
+        std::copy_n(src, frame_width, dest);
+        dest[-1] = src[0];
+        dest[frame_width] = src[frame_width - 1];
+    }
+
+    // Points at the first pixel of the frame.
+    return padded_frame.data() + stride + pad;
+}
+
+void CpuFilter::ScaleNearest(const u16* frame, u16* dest) const {
+    const int dest_width = OutputWidth();
+    for (int y = 0; y < height; ++y) {
+        const u16* src = frame + y * width;
+        u16* row = dest + y * scale * dest_width;
+
+        if (scale == 3) {
+            for (int x = 0; x < width; ++x) {
+                std::fill_n(row + x * 3, 3, src[x]);
+            }
+        } else {
+            for (int x = 0; x < width; x += 8) {
+                const U16x8 pixels = U16x8::Load(src + x);
+                const U16x8 low = ZipLow(pixels, pixels);
+                const U16x8 high = ZipHigh(pixels, pixels);
+                if (scale == 2) {
+                    low.Store(row + x * 2);
+                    high.Store(row + x * 2 + 8);
+                } else {
+                    ZipLow(low, low).Store(row + x * 4);
+                    ZipHigh(low, low).Store(row + x * 4 + 8);
+                    ZipLow(high, high).Store(row + x * 4 + 16);
+                    ZipHigh(high, high).Store(row + x * 4 + 24);
+                }
+            }
+        }
+
+        for (int i = 1; i < scale; ++i) {
+            std::copy_n(row, dest_width, row + i * dest_width);
+        }
+    }
+}
+
+void CpuFilter::Scale2x(const u16* frame, int frame_width, int frame_height, u16* dest) {
+    // EPX, also known as Scale2x. Each pixel E becomes four, each of which takes the colour of the two neighbours
+    // it touches if they match each other and not the other two neighbours, which rounds off diagonal edges.
+    //     B         E0 E1
+    //   D E F  ->   E2 E3
+    //     H
+    const u16* src = Pad(frame, frame_width, frame_height);
+    const int stride = frame_width + pad * 2;
+    const int dest_width = frame_width * 2;
+
+    for (int y = 0; y < frame_height; ++y) {
+        const u16* row = src + y * stride;
+        u16* top = dest + y * 2 * dest_width;
+        u16* bottom = top + dest_width;
+
+        for (int x = 0; x < frame_width; x += 8) {
+            const U16x8 b = U16x8::Load(row + x - stride);
+            const U16x8 d = U16x8::Load(row + x - 1);
+            const U16x8 e = U16x8::Load(row + x);
+            const U16x8 f = U16x8::Load(row + x + 1);
+            const U16x8 h = U16x8::Load(row + x + stride);
+
+            const U16x8 db = (d == b);
+            const U16x8 bf = (b == f);
+            const U16x8 dh = (d == h);
+            const U16x8 hf = (h == f);
+
+            const U16x8 e0 = Select(AndNot(bf | dh, db), d, e);
+            const U16x8 e1 = Select(AndNot(db | hf, bf), f, e);
+            const U16x8 e2 = Select(AndNot(db | hf, dh), d, e);
+            const U16x8 e3 = Select(AndNot(bf | dh, hf), f, e);
+
+            ZipLow(e0, e1).Store(top + x * 2);
+            ZipHigh(e0, e1).Store(top + x * 2 + 8);
+            ZipLow(e2, e3).Store(bottom + x * 2);
+            ZipHigh(e2, e3).Store(bottom + x * 2 + 8);
+        }
+    }
+}
+
+void CpuFilter::Scale3x(const u16* frame, u16* dest) {
+    // Scale3x, EPX's rules extended to a 3x3 block. The edge pixels of the block also check the corner neighbours,
+    // so single pixel lines stay one pixel wide.
+    //   A B C       E0 E1 E2
+    //   D E F  ->   E3 E4 E5
+    //   G H I       E6 E7 E8
+    const u16* src = Pad(frame, width, height);
+    const int stride = width + pad * 2;
+    const int dest_width = width * 3;
+
+    for (int y = 0; y < height; ++y) {
+        const u16* row = src + y * stride;
+        u16* out = dest + y * 3 * dest_width;
+
+        for (int x = 0; x < width; x += 8) {
+            const U16x8 a = U16x8::Load(row + x - stride - 1);
+            const U16x8 b = U16x8::Load(row + x - stride);
+            const U16x8 c = U16x8::Load(row + x - stride + 1);
+            const U16x8 d = U16x8::Load(row + x - 1);
+            const U16x8 e = U16x8::Load(row + x);
+            const U16x8 f = U16x8::Load(row + x + 1);
+            const U16x8 g = U16x8::Load(row + x + stride - 1);
+            const U16x8 h = U16x8::Load(row + x + stride);
+            const U16x8 i = U16x8::Load(row + x + stride + 1);
+
+            const U16x8 db = (d == b);
+            const U16x8 bf = (b == f);
+            const U16x8 dh = (d == h);
+            const U16x8 hf = (h == f);
+
+            const U16x8 top_left = AndNot(bf | dh, db);
+            const U16x8 top_right = AndNot(db | hf, bf);
+            const U16x8 bottom_left = AndNot(db | hf, dh);
+            const U16x8 bottom_right = AndNot(bf | dh, hf);
+
+            std::array<std::array<u16, 8>, 9> block;
+            Select(top_left, d, e).Store(block[0].data());
+            Select(AndNot(e == c, top_left) | AndNot(e == a, top_right), b, e).Store(block[1].data());
+            Select(top_right, f, e).Store(block[2].data());
+            Select(AndNot(e == g, top_left) | AndNot(e == a, bottom_left), d, e).Store(block[3].data());
+            e.Store(block[4].data());
+            Select(AndNot(e == i, top_right) | AndNot(e == c, bottom_right), f, e).Store(block[5].data());
+            Select(bottom_left, d, e).Store(block[6].data());
+            Select(AndNot(e == i, bottom_left) | AndNot(e == g, bottom_right), h, e).Store(block[7].data());
+            Select(bottom_right, f, e).Store(block[8].data());
+
+            // There's no three-way interleave, so the blocks are spread out a pixel at a time.
+            for (int lane = 0; lane < 8; ++lane) {
+                for (int block_y = 0; block_y < 3; ++block_y) {
+                    u16* dest_pixel = out + block_y * dest_width + (x + lane) * 3;
+                    for (int block_x = 0; block_x < 3; ++block_x) {
+                        dest_pixel[block_x] = block[block_y * 3 + block_x][lane];
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // End namespace Emu
@@ -0,0 +1,64 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "emu/GlPresenter.h"
+
+namespace Emu {
+
+// Blends and scales frames on the CPU before they're uploaded to the SDL renderer's texture, for machines where
+// the OpenGL presenter isn't an option. It runs on the render thread, so it never holds up the emulator.
+class CpuFilter {
+public:
+    CpuFilter(int _width, int _height, const DisplaySettings& settings);
+
+    int OutputWidth() const { return width * scale; }
+    int OutputHeight() const { return height * scale; }
+
+    // Returns the filtered frame, which stays valid until the next call.
+    const u16* Process(const u16* frame);
+
+private:
+    const int width;
+    const int height;
+    const DisplaySettings::CpuScaler scaler;
+    const int scale;
+    const bool frame_blend;
+
+    std::vector<u16> previous_frame;
+    std::vector<u16> blended_frame;
+    // The source frame with its edge pixels repeated on every side, so the EPX scalers can read the neighbours of
+    // every pixel without bounds checks.
+    std::vector<u16> padded_frame;
+    // Scale4x is Scale2x run twice, and this holds the result of the first pass.
+    std::vector<u16> doubled_frame;
+    std::vector<u16> scaled_frame;
+
+    static constexpr int pad = 8;
+
+    void Blend(const u16* frame);
+    const u16* Pad(const u16* frame, int frame_width, int frame_height);
+    void ScaleNearest(const u16* frame, u16* dest) const;
+    void Scale2x(const u16* frame, int frame_width, int frame_height, u16* dest);
+    void Scale3x(const u16* frame, u16* dest);
+};
+
+} // End namespace Emu
@@ -0,0 +1,99 @@
+// This file is a part of Chroma.
+// Copyright (C) 2016-2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string>
+#include <array>
+#include <functional>
+
+#include "common/CommonTypes.h"
+
+namespace Emu {
+
+enum class InputEvent {Quit,
+                       Pause,
+                       LogLevel,
+                       Fullscreen,
+                       Screenshot,
+                       LcdDebug,
+                       HideWindow,
+                       ShowWindow,
+                       FrameAdvance,
+                       FrameSkip,
+                       FrameStats,
+                       SaveState,
+                       LoadState,
+                       Rewind,
+                       Up,
+                       Left,
+                       Down,
+                       Right,
+                       A,
+                       B,
+                       L,
+                       R,
+                       Start,
+                       Select};
+
+constexpr int input_event_count = static_cast<int>(InputEvent::Select) + 1;
+
+// The buttons run from Up to Select. Input movies store them in this order, one bit each.
+constexpr int button_count = 10;
+constexpr int ButtonIndex(InputEvent button) { return static_cast<int>(button) - static_cast<int>(InputEvent::Up); }
+constexpr InputEvent ButtonFromIndex(int index) {
+    return static_cast<InputEvent>(static_cast<int>(InputEvent::Up) + index);
+}
+
+// Everything the emulator cores need from the outside world: somewhere to send video and audio, and a source of
+// input events.
+class Frontend {
+public:
+    virtual ~Frontend() = default;
+
+    // Presents the frame and paces the emulator. new_frame is false if the frame hasn't changed since the last
+    // call, so it needn't be uploaded or presented again.
+    virtual void RenderFrame(const u16* fb_ptr, bool new_frame) noexcept = 0;
+    // Called when the core swaps buffers. Frontends which present from memory of their own can return a frame of
+    // it for the core to draw the next frame into, so RenderFrame can present the core's frames without copying
+    // them. The finished frame stays the core's front buffer until the next swap, and the frontend mustn't write
+    // to either of them until then. Returns nullptr if the core should keep drawing into its own buffers.
+    virtual u16* NextFrameTarget(const u16*) noexcept { return nullptr; }
+    virtual void ToggleFullscreen() noexcept = 0;
+
+    virtual void PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept = 0;
+    // Frontends which keep less than a frame of audio queued take it in chunks of this many stereo samples, each
+    // sent through PushBackAudioChunk as soon as it's mixed, instead of a frame at a time. Zero means whole frames.
+    virtual int AudioChunkSamples() const noexcept { return 0; }
+    virtual void PushBackAudioChunk(const s16*, int) noexcept {}
+    virtual void UnpauseAudio() noexcept = 0;
+    virtual void PauseAudio() noexcept = 0;
+
+    virtual void RegisterCallback(InputEvent event, std::function<void(bool)> callback) = 0;
+    virtual void PollEvents() = 0;
+    // Polls for button presses only, from partway through emulating a frame. Anything else waits for the next
+    // PollEvents.
+    virtual void LatchInput() {}
+    // Blocks until there's input to poll, while the emulator is paused.
+    virtual void WaitForEvents() noexcept = 0;
+
+    virtual void UpdateFrameTimes(float avg_frame_time, float max_frame_time, const std::string& extra_info = "") = 0;
+
+    // The number of times audio output ran dry since the frontend started.
+    virtual u64 AudioUnderruns() const noexcept { return 0; }
+};
+
+} // End namespace Emu
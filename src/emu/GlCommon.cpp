@@ -0,0 +1,145 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+#include "emu/GlCommon.h"
+
+namespace Emu {
+
+namespace {
+
+constexpr const char* vertex_shader_source = R"(
+out vec2 uv;
+
+void main() {
+    // A single triangle covering the viewport, with the first row of the frame at the top.
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    uv = vec2(position.x, 1.0 - position.y);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+constexpr const char* fragment_shader_source = R"(
+in vec2 uv;
+out vec4 colour;
+
+uniform sampler2D frame;
+uniform vec2 output_size;
+
+vec3 SampleFrame() {
+#ifdef SCALER_SHARP
+    // Bilinear sampling of the frame scaled up to a whole multiple, so only the edges between pixels are blended.
+    vec2 prescale = max(floor(output_size / frame_size), vec2(1.0));
+    vec2 texel = uv * frame_size;
+    vec2 centre_dist = fract(texel) - 0.5;
+    vec2 region_range = 0.5 - 0.5 / prescale;
+    vec2 offset = (centre_dist - clamp(centre_dist, -region_range, region_range)) * prescale + 0.5;
+    return texture(frame, (floor(texel) + offset) / frame_size).rgb;
+#else
+    return texture(frame, uv).rgb;
+#endif
+}
+
+void main() {
+    vec3 c = SampleFrame();
+
+#if defined(COLOUR_GBA)
+    // The GBA screen is dark and has a steep gamma, and its subpixels bleed into each other.
+    vec3 linear = pow(c, vec3(4.0));
+    c = pow(mat3(255.0, 10.0, 50.0, 50.0, 230.0, 10.0, 0.0, 30.0, 220.0) / 255.0 * linear, vec3(1.0 / 2.2));
+    c *= 255.0 / 280.0;
+#elif defined(COLOUR_GBC)
+    // The GBC screen mixes the channels, and saturates a little before full intensity.
+    c = min(mat3(26.0, 0.0, 6.0, 4.0, 24.0, 4.0, 2.0, 8.0, 22.0) * c * (31.0 / 960.0), vec3(1.0));
+#endif
+
+#ifdef SCALER_LCD
+    // Darken towards the edges of each pixel, leaving a grid like the gaps between the LCD's pixels.
+    vec2 edge = abs(fract(uv * frame_size) - 0.5) * 2.0;
+    c *= 1.0 - 0.4 * pow(max(edge.x, edge.y), 6.0);
+#endif
+
+    colour = vec4(c, 1.0);
+}
+)";
+
+GLuint CompileShader(const GlFunctions& gl, GLenum type, const std::string& source) {
+    const GLuint shader = gl.CreateShader(type);
+    const char* source_ptr = source.c_str();
+    gl.ShaderSource(shader, 1, &source_ptr, nullptr);
+    gl.CompileShader(shader);
+
+    GLint compiled = GL_FALSE;
+    gl.GetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        std::vector<char> log(1024);
+        gl.GetShaderInfoLog(shader, log.size(), nullptr, log.data());
+        gl.DeleteShader(shader);
+        throw std::runtime_error(std::string{"Shader compilation failed: "} + log.data());
+    }
+
+    return shader;
+}
+
+} // End anonymous namespace
+
+GLuint CreateFrameProgram(const GlFunctions& gl, int width, int height, GlScaler scaler, bool gba,
+                          bool colour_correction) {
+    std::string defines = fmt::format("#version 330 core\nconst vec2 frame_size = vec2({}.0, {}.0);\n", width,
+                                      height);
+    if (scaler == GlScaler::Sharp) {
+        defines += "#define SCALER_SHARP\n";
+    } else if (scaler == GlScaler::Lcd) {
+        defines += "#define SCALER_LCD\n";
+    }
+    if (colour_correction) {
+        defines += gba ? "#define COLOUR_GBA\n" : "#define COLOUR_GBC\n";
+    }
+
+    const GLuint vertex_shader = CompileShader(gl, GL_VERTEX_SHADER, defines + vertex_shader_source);
+    GLuint fragment_shader;
+    try {
+        fragment_shader = CompileShader(gl, GL_FRAGMENT_SHADER, defines + fragment_shader_source);
+    } catch (const std::runtime_error&) {
+        gl.DeleteShader(vertex_shader);
+        throw;
+    }
+
+    const GLuint program = gl.CreateProgram();
+    gl.AttachShader(program, vertex_shader);
+    gl.AttachShader(program, fragment_shader);
+    gl.LinkProgram(program);
+    // The program keeps the shaders alive for as long as it needs them.
+    gl.DeleteShader(vertex_shader);
+    gl.DeleteShader(fragment_shader);
+
+    GLint linked = GL_FALSE;
+    gl.GetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        std::vector<char> log(1024);
+        gl.GetProgramInfoLog(program, log.size(), nullptr, log.data());
+        gl.DeleteProgram(program);
+        throw std::runtime_error(std::string{"Shader linking failed: "} + log.data());
+    }
+
+    return program;
+}
+
+} // End namespace Emu
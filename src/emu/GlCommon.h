@@ -0,0 +1,102 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <SDL_opengl.h>
+
+namespace Emu {
+
+// How the frame is fitted to the output. Integer scales by whole multiples only. Sharp fills the output by scaling
+// up to the nearest whole multiple and blending only the pixel edges. LCD scales by whole multiples and darkens the
+// gaps between pixels.
+enum class GlScaler {Integer, Sharp, Lcd};
+
+#define GL_FUNCTION_LIST(X) \
+    X(decltype(&glGetIntegerv), GetIntegerv) \
+    X(decltype(&glGenTextures), GenTextures) \
+    X(decltype(&glDeleteTextures), DeleteTextures) \
+    X(decltype(&glBindTexture), BindTexture) \
+    X(decltype(&glTexParameteri), TexParameteri) \
+    X(decltype(&glTexImage2D), TexImage2D) \
+    X(decltype(&glTexSubImage2D), TexSubImage2D) \
+    X(decltype(&glPixelStorei), PixelStorei) \
+    X(decltype(&glViewport), Viewport) \
+    X(decltype(&glClearColor), ClearColor) \
+    X(decltype(&glClear), Clear) \
+    X(decltype(&glDrawArrays), DrawArrays) \
+    X(PFNGLCREATESHADERPROC, CreateShader) \
+    X(PFNGLSHADERSOURCEPROC, ShaderSource) \
+    X(PFNGLCOMPILESHADERPROC, CompileShader) \
+    X(PFNGLGETSHADERIVPROC, GetShaderiv) \
+    X(PFNGLGETSHADERINFOLOGPROC, GetShaderInfoLog) \
+    X(PFNGLDELETESHADERPROC, DeleteShader) \
+    X(PFNGLCREATEPROGRAMPROC, CreateProgram) \
+    X(PFNGLATTACHSHADERPROC, AttachShader) \
+    X(PFNGLLINKPROGRAMPROC, LinkProgram) \
+    X(PFNGLGETPROGRAMIVPROC, GetProgramiv) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, GetProgramInfoLog) \
+    X(PFNGLDELETEPROGRAMPROC, DeleteProgram) \
+    X(PFNGLUSEPROGRAMPROC, UseProgram) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, GetUniformLocation) \
+    X(PFNGLUNIFORM1IPROC, Uniform1i) \
+    X(PFNGLUNIFORM2FPROC, Uniform2f) \
+    X(PFNGLGENVERTEXARRAYSPROC, GenVertexArrays) \
+    X(PFNGLBINDVERTEXARRAYPROC, BindVertexArray) \
+    X(PFNGLDELETEVERTEXARRAYSPROC, DeleteVertexArrays) \
+    X(PFNGLGENBUFFERSPROC, GenBuffers) \
+    X(PFNGLBINDBUFFERPROC, BindBuffer) \
+    X(PFNGLDELETEBUFFERSPROC, DeleteBuffers) \
+    X(PFNGLMAPBUFFERRANGEPROC, MapBufferRange) \
+    X(PFNGLUNMAPBUFFERPROC, UnmapBuffer) \
+    X(PFNGLFENCESYNCPROC, FenceSync) \
+    X(PFNGLCLIENTWAITSYNCPROC, ClientWaitSync) \
+    X(PFNGLDELETESYNCPROC, DeleteSync) \
+    X(PFNGLACTIVETEXTUREPROC, ActiveTexture) \
+    X(PFNGLBINDFRAMEBUFFERPROC, BindFramebuffer)
+
+// Everything is loaded through whatever created the context, so there's no link-time dependency on an OpenGL
+// library.
+struct GlFunctions {
+#define DECLARE_GL_FUNCTION(type, name) type name = nullptr;
+    GL_FUNCTION_LIST(DECLARE_GL_FUNCTION)
+#undef DECLARE_GL_FUNCTION
+
+    // Only needed for the persistently mapped pixel buffer.
+    PFNGLBUFFERSTORAGEPROC BufferStorage = nullptr;
+
+    // Loads every function through get_proc, which takes a name like "glClear". Returns the name of a function the
+    // context doesn't have, or nullptr if it has them all.
+    template<typename GetProc>
+    const char* Load(GetProc get_proc) {
+        const char* missing_function = nullptr;
+#define LOAD_GL_FUNCTION(type, name) \
+        name = reinterpret_cast<type>(get_proc("gl" #name)); \
+        if (name == nullptr) { missing_function = "gl" #name; }
+        GL_FUNCTION_LIST(LOAD_GL_FUNCTION)
+#undef LOAD_GL_FUNCTION
+        BufferStorage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(get_proc("glBufferStorage"));
+        return missing_function;
+    }
+};
+
+// Builds the GLSL 3.30 program which draws a width x height BGR555 frame, bound to texture unit 0, over the whole
+// viewport, with the scaling and colour correction done in the fragment shader. The output_size uniform must be set
+// to the viewport size. Throws std::runtime_error if the shaders don't compile or link.
+GLuint CreateFrameProgram(const GlFunctions& gl, int width, int height, GlScaler scaler, bool gba,
+                          bool colour_correction);
+
+} // End namespace Emu
@@ -0,0 +1,175 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <fmt/format.h>
+
+#include "emu/GlPresenter.h"
+
+namespace Emu {
+
+GlPresenter::GlPresenter(SDL_Window* _window, int _width, int _height, bool gba, const DisplaySettings& settings)
+        : window(_window)
+        , width(_width)
+        , height(_height)
+        , scaler(settings.scaler)
+        , gl(std::make_unique<GlFunctions>()) {
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    context = SDL_GL_CreateContext(window);
+    if (context == nullptr) {
+        throw std::runtime_error(std::string{"SDL_GL_CreateContext Error: "} + SDL_GetError());
+    }
+    SDL_GL_SetSwapInterval(1);
+
+    const char* missing_function = gl->Load(SDL_GL_GetProcAddress);
+    if (missing_function != nullptr) {
+        SDL_GL_DeleteContext(context);
+        throw std::runtime_error(fmt::format("OpenGL 3.3 is required, but {} is missing.", missing_function));
+    }
+
+    try {
+        program = CreateFrameProgram(*gl, width, height, scaler, gba, settings.colour_correction);
+    } catch (const std::runtime_error&) {
+        SDL_GL_DeleteContext(context);
+        throw;
+    }
+    gl->UseProgram(program);
+    gl->Uniform1i(gl->GetUniformLocation(program, "frame"), 0);
+    output_size_uniform = gl->GetUniformLocation(program, "output_size");
+
+    gl->GenVertexArrays(1, &vertex_array);
+
+    gl->GenTextures(1, &texture);
+    gl->BindTexture(GL_TEXTURE_2D, texture);
+    const GLint filter = (scaler == DisplaySettings::Scaler::Sharp) ? GL_LINEAR : GL_NEAREST;
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl->PixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    // Red is in the low bits of a BGR555 pixel, which is the order GL's reversed 1555 format expects.
+    gl->TexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                   nullptr);
+
+    GLint major_version = 0, minor_version = 0;
+    gl->GetIntegerv(GL_MAJOR_VERSION, &major_version);
+    gl->GetIntegerv(GL_MINOR_VERSION, &minor_version);
+    const bool buffer_storage = (major_version > 4 || (major_version == 4 && minor_version >= 4))
+                                || SDL_GL_ExtensionSupported("GL_ARB_buffer_storage");
+
+    if (buffer_storage && gl->BufferStorage != nullptr) {
+        const GLsizeiptr frame_bytes = width * height * sizeof(u16);
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        gl->GenBuffers(1, &pixel_buffer);
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+        gl->BufferStorage(GL_PIXEL_UNPACK_BUFFER, frame_bytes * num_frames, nullptr, flags);
+        void* mapping = gl->MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, frame_bytes * num_frames, flags);
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (mapping != nullptr) {
+            for (int i = 0; i < num_frames; ++i) {
+                mapped_frames[i] = static_cast<u16*>(mapping) + i * width * height;
+                std::fill_n(mapped_frames[i], width * height, 0x7FFF);
+            }
+        } else {
+            gl->DeleteBuffers(1, &pixel_buffer);
+            pixel_buffer = 0;
+        }
+    }
+
+    gl->ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+GlPresenter::~GlPresenter() {
+    for (auto& fence : upload_fences) {
+        if (fence != nullptr) {
+            gl->DeleteSync(fence);
+        }
+    }
+
+    if (pixel_buffer != 0) {
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+        gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        gl->DeleteBuffers(1, &pixel_buffer);
+    }
+
+    gl->DeleteTextures(1, &texture);
+    gl->DeleteVertexArrays(1, &vertex_array);
+    gl->DeleteProgram(program);
+    SDL_GL_DeleteContext(context);
+}
+
+void GlPresenter::Present(int i, const u16* pixels) {
+    gl->BindTexture(GL_TEXTURE_2D, texture);
+    if (pixel_buffer != 0) {
+        // The upload is a GPU copy out of the mapped buffer, which the fence marks the end of.
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+        const std::size_t offset = static_cast<std::size_t>(i) * width * height * sizeof(u16);
+        gl->TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                          reinterpret_cast<const void*>(offset));
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        upload_fences[i] = gl->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    } else {
+        gl->TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
+    }
+
+    int drawable_width = 0, drawable_height = 0;
+    SDL_GL_GetDrawableSize(window, &drawable_width, &drawable_height);
+    gl->Viewport(0, 0, drawable_width, drawable_height);
+    gl->Clear(GL_COLOR_BUFFER_BIT);
+
+    // Keep the aspect ratio and centre the frame, with black bars around it.
+    int output_width, output_height;
+    if (scaler == DisplaySettings::Scaler::Sharp) {
+        const float scale = std::min(static_cast<float>(drawable_width) / width,
+                                     static_cast<float>(drawable_height) / height);
+        output_width = static_cast<int>(width * scale);
+        output_height = static_cast<int>(height * scale);
+    } else {
+        const int scale = std::max(std::min(drawable_width / width, drawable_height / height), 1);
+        output_width = width * scale;
+        output_height = height * scale;
+    }
+
+    gl->Viewport((drawable_width - output_width) / 2, (drawable_height - output_height) / 2, output_width,
+                 output_height);
+    gl->Uniform2f(output_size_uniform, output_width, output_height);
+    gl->BindVertexArray(vertex_array);
+    gl->DrawArrays(GL_TRIANGLES, 0, 3);
+
+    SDL_GL_SwapWindow(window);
+}
+
+void GlPresenter::ReleaseFrame(int i) {
+    if (upload_fences[i] == nullptr) {
+        return;
+    }
+
+    // The upload was queued before the last swap, so it's almost always finished by now.
+    gl->ClientWaitSync(upload_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000);
+    gl->DeleteSync(upload_fences[i]);
+    upload_fences[i] = nullptr;
+}
+
+} // End namespace Emu
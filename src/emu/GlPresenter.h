@@ -0,0 +1,89 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <SDL.h>
+#include <SDL_opengl.h>
+
+#include "common/CommonTypes.h"
+#include "emu/GlCommon.h"
+
+namespace Emu {
+
+struct DisplaySettings {
+    // How the frame is fitted to the window.
+    using Scaler = GlScaler;
+    // How the SDL renderer's frames are scaled on the CPU before SDL's own integer scaling. Nearest repeats each
+    // pixel, and EPX rounds off diagonal edges (Scale2x, Scale3x, or Scale2x twice for 4x).
+    enum class CpuScaler {None, Nearest, Epx};
+
+    // Present through OpenGL instead of the SDL renderer, which the other settings need.
+    bool opengl = false;
+    Scaler scaler = Scaler::Integer;
+    // Mimic the washed out colours of the GBA or GBC screen, which games were designed for.
+    bool colour_correction = false;
+
+    // Only used by the SDL renderer.
+    CpuScaler cpu_scaler = CpuScaler::None;
+    int cpu_scale = 2;
+    // Average each frame with the last one, like the slow LCDs of the real consoles.
+    bool frame_blend = false;
+};
+
+// Draws frames with OpenGL 3.3 on the render thread, with the scaling and colour correction done in the fragment
+// shader. With GL 4.4 or ARB_buffer_storage, the frames live in a persistently mapped pixel buffer, so the core
+// draws each frame straight into memory the GPU uploads the texture from, and the upload runs alongside
+// the next emulated frame.
+class GlPresenter {
+public:
+    static constexpr int num_frames = 4;
+
+    // Must be constructed on the thread which presents. Throws std::runtime_error if the context or shaders can't
+    // be created.
+    GlPresenter(SDL_Window* _window, int _width, int _height, bool gba, const DisplaySettings& settings);
+    ~GlPresenter();
+
+    // Where the emulator should write frame i, or nullptr if there's no mapped buffer.
+    u16* MappedFrame(int i) const { return mapped_frames[i]; }
+
+    // Uploads frame i, from the mapped buffer if there is one or from pixels otherwise, and draws it.
+    void Present(int i, const u16* pixels);
+    // Waits until the GPU has finished reading frame i, so its memory can be handed back to the emulator.
+    void ReleaseFrame(int i);
+
+private:
+    SDL_Window* const window;
+    const int width;
+    const int height;
+    const DisplaySettings::Scaler scaler;
+
+    SDL_GLContext context;
+    std::unique_ptr<GlFunctions> gl;
+
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    GLuint texture = 0;
+    GLuint pixel_buffer = 0;
+    GLint output_size_uniform = -1;
+
+    std::array<u16*, num_frames> mapped_frames{};
+    std::array<GLsync, num_frames> upload_fences{};
+};
+
+} // End namespace Emu
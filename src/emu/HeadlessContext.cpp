@@ -0,0 +1,115 @@
+// This file is a part of Chroma.
+// Copyright (C) 2016-2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <thread>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <fmt/format.h>
+
+#include "emu/HeadlessContext.h"
+
+namespace Emu {
+
+namespace {
+
+std::atomic<bool> interrupted{false};
+
+void HandleInterrupt(int) {
+    interrupted = true;
+}
+
+const std::unordered_map<std::string, InputEvent> movie_buttons{
+    {"up", InputEvent::Up},
+    {"left", InputEvent::Left},
+    {"down", InputEvent::Down},
+    {"right", InputEvent::Right},
+    {"a", InputEvent::A},
+    {"b", InputEvent::B},
+    {"l", InputEvent::L},
+    {"r", InputEvent::R},
+    {"start", InputEvent::Start},
+    {"select", InputEvent::Select},
+};
+
+} // End anonymous namespace
+
+std::vector<MovieInput> LoadInputMovie(const std::string& filename) {
+    std::ifstream movie_file(filename);
+    if (!movie_file) {
+        throw std::runtime_error("Error when attempting to open " + filename);
+    }
+
+    std::vector<MovieInput> movie;
+    std::string line;
+    for (int line_num = 1; std::getline(movie_file, line); ++line_num) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream line_stream{line};
+        int frame;
+        std::string button, action;
+        if (!(line_stream >> frame >> button >> action) || frame < 0 || movie_buttons.count(button) == 0
+                || (action != "press" && action != "release")) {
+            throw std::runtime_error(fmt::format("Invalid input on line {} of {}: {}", line_num, filename, line));
+        }
+
+        if (!movie.empty() && frame < movie.back().frame) {
+            throw std::runtime_error(fmt::format("Input on line {} of {} is out of frame order.", line_num,
+                                                 filename));
+        }
+
+        movie.push_back({frame, movie_buttons.at(button), action == "press"});
+    }
+
+    return movie;
+}
+
+HeadlessContext::HeadlessContext(std::vector<MovieInput> _movie)
+        : movie(std::move(_movie)) {
+    std::signal(SIGINT, HandleInterrupt);
+    std::signal(SIGTERM, HandleInterrupt);
+}
+
+void HeadlessContext::RegisterCallback(InputEvent event, std::function<void(bool)> callback) {
+    input_callbacks[static_cast<int>(event)] = std::move(callback);
+}
+
+void HeadlessContext::PollEvents() {
+    if (interrupted) {
+        input_callbacks[static_cast<int>(InputEvent::Quit)](true);
+    }
+
+    // The cores poll events once per emulated frame.
+    for (; next_input < movie.size() && movie[next_input].frame == frame_count; ++next_input) {
+        input_callbacks[static_cast<int>(movie[next_input].button)](movie[next_input].press);
+    }
+
+    ++frame_count;
+}
+
+void HeadlessContext::WaitForEvents() noexcept {
+    // The only event is an interrupt, which can't wake a wait, so check for it now and then.
+    std::this_thread::sleep_for(std::chrono::milliseconds{48});
+}
+
+} // End namespace Emu
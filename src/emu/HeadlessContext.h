@@ -0,0 +1,68 @@
+// This file is a part of Chroma.
+// Copyright (C) 2016-2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string>
+#include <array>
+#include <vector>
+#include <functional>
+
+#include "common/CommonTypes.h"
+#include "emu/Frontend.h"
+
+namespace Emu {
+
+// One button change from an input movie, applied at the start of the given frame.
+struct MovieInput {
+    int frame;
+    InputEvent button;
+    bool press;
+};
+
+// Input movies are text files with one "<frame> <button> <press|release>" entry per line, in frame order. Lines
+// starting with # are comments.
+std::vector<MovieInput> LoadInputMovie(const std::string& filename);
+
+// A frontend with no window and no audio device. Frames and samples are thrown away, and the emulator runs as
+// fast as it can. Interrupting the process quits the emulator cleanly, so save data still gets written. Input can
+// come from a movie, which makes the run reproducible.
+class HeadlessContext : public Frontend {
+public:
+    explicit HeadlessContext(std::vector<MovieInput> _movie = {});
+
+    void RenderFrame(const u16*, bool) noexcept override {}
+    void ToggleFullscreen() noexcept override {}
+
+    void PushBackAudio(const std::array<s16, 1600>&) noexcept override {}
+    void UnpauseAudio() noexcept override {}
+    void PauseAudio() noexcept override {}
+
+    void RegisterCallback(InputEvent event, std::function<void(bool)> callback) override;
+    void PollEvents() override;
+    void WaitForEvents() noexcept override;
+
+    void UpdateFrameTimes(float, float, const std::string&) override {}
+
+private:
+    std::vector<MovieInput> movie;
+    std::size_t next_input = 0;
+    int frame_count = 0;
+
+    std::array<std::function<void(bool)>, input_event_count> input_callbacks;
+};
+
+} // End namespace Emu
@@ -0,0 +1,169 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <fmt/format.h>
+
+#include "emu/InputBindings.h"
+
+namespace Emu {
+
+namespace {
+
+// The names used in bindings files. The window events can't be bound.
+constexpr const char* action_names[] = {"quit", "pause", "log-level", "fullscreen", "screenshot", "lcd-debug",
+                                        nullptr, nullptr, "frame-advance", "frame-skip", "frame-stats",
+                                        "save-state", "load-state", "rewind", "up", "left", "down", "right", "a",
+                                        "b", "l", "r", "start", "select", "turbo", "slower", "faster"};
+static_assert(std::size(action_names) == InputBindings::num_actions);
+
+struct DefaultKey {
+    int action;
+    SDL_Keycode key;
+};
+
+constexpr DefaultKey default_keys[] = {
+    {static_cast<int>(InputEvent::Quit),         SDLK_q},
+    {static_cast<int>(InputEvent::Pause),        SDLK_p},
+    {static_cast<int>(InputEvent::LogLevel),     SDLK_b},
+    {static_cast<int>(InputEvent::Fullscreen),   SDLK_v},
+    {static_cast<int>(InputEvent::Screenshot),   SDLK_t},
+    {static_cast<int>(InputEvent::LcdDebug),     SDLK_y},
+    {static_cast<int>(InputEvent::FrameAdvance), SDLK_n},
+    {static_cast<int>(InputEvent::FrameSkip),    SDLK_f},
+    {static_cast<int>(InputEvent::FrameStats),   SDLK_g},
+    {static_cast<int>(InputEvent::SaveState),    SDLK_F5},
+    {static_cast<int>(InputEvent::LoadState),    SDLK_F8},
+    {static_cast<int>(InputEvent::Rewind),       SDLK_BACKSPACE},
+    {static_cast<int>(InputEvent::Up),           SDLK_w},
+    {static_cast<int>(InputEvent::Left),         SDLK_a},
+    {static_cast<int>(InputEvent::Down),         SDLK_s},
+    {static_cast<int>(InputEvent::Right),        SDLK_d},
+    {static_cast<int>(InputEvent::A),            SDLK_k},
+    {static_cast<int>(InputEvent::B),            SDLK_j},
+    {static_cast<int>(InputEvent::L),            SDLK_h},
+    {static_cast<int>(InputEvent::R),            SDLK_l},
+    {static_cast<int>(InputEvent::Start),        SDLK_RETURN},
+    {static_cast<int>(InputEvent::Start),        SDLK_i},
+    {static_cast<int>(InputEvent::Select),       SDLK_u},
+    {InputBindings::turbo,                       SDLK_TAB},
+    {InputBindings::slower,                      SDLK_MINUS},
+    {InputBindings::faster,                      SDLK_EQUALS},
+};
+
+// SDL names controller buttons by where they are on an Xbox controller, so A and B are swapped to keep the
+// console's A on the right.
+constexpr std::pair<SDL_GameControllerButton, InputEvent> default_buttons[] = {
+    {SDL_CONTROLLER_BUTTON_DPAD_UP,       InputEvent::Up},
+    {SDL_CONTROLLER_BUTTON_DPAD_LEFT,     InputEvent::Left},
+    {SDL_CONTROLLER_BUTTON_DPAD_DOWN,     InputEvent::Down},
+    {SDL_CONTROLLER_BUTTON_DPAD_RIGHT,    InputEvent::Right},
+    {SDL_CONTROLLER_BUTTON_B,             InputEvent::A},
+    {SDL_CONTROLLER_BUTTON_A,             InputEvent::B},
+    {SDL_CONTROLLER_BUTTON_LEFTSHOULDER,  InputEvent::L},
+    {SDL_CONTROLLER_BUTTON_RIGHTSHOULDER, InputEvent::R},
+    {SDL_CONTROLLER_BUTTON_START,         InputEvent::Start},
+    {SDL_CONTROLLER_BUTTON_BACK,          InputEvent::Select},
+};
+
+} // End anonymous namespace
+
+void InputBindings::LoadDefaults() {
+    key_actions.fill(none);
+    button_actions.fill(none);
+
+    for (const auto& binding : default_keys) {
+        BindKey(binding.action, binding.key);
+    }
+
+    for (const auto& binding : default_buttons) {
+        button_actions[binding.first] = static_cast<s8>(binding.second);
+    }
+}
+
+void InputBindings::LoadFile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    std::array<bool, num_actions> rebound{};
+    std::string line;
+    for (int line_num = 1; std::getline(file, line); ++line_num) {
+        // Files saved on Windows end their lines with "\r\n", and no key name ends in whitespace.
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        // Key names can have spaces in them, so everything after the action is the key.
+        const auto action_end = line.find(' ');
+        const auto input_start = line.find_first_not_of(' ', action_end);
+        const auto invalid_line = [&]() {
+            return std::runtime_error(fmt::format("Invalid binding on line {} of {}: {}", line_num, path, line));
+        };
+        if (action_end == std::string::npos || input_start == std::string::npos) {
+            throw invalid_line();
+        }
+
+        const std::string action_name = line.substr(0, action_end);
+        const auto name_it = std::find_if(std::cbegin(action_names), std::cend(action_names),
+                                          [&action_name](const char* name) {
+                                              return name != nullptr && action_name == name;
+                                          });
+        if (name_it == std::cend(action_names)) {
+            throw invalid_line();
+        }
+        const int action = static_cast<int>(name_it - std::cbegin(action_names));
+
+        if (!rebound[action]) {
+            rebound[action] = true;
+            std::replace(key_actions.begin(), key_actions.end(), static_cast<s8>(action), static_cast<s8>(none));
+            std::replace(button_actions.begin(), button_actions.end(), static_cast<s8>(action),
+                         static_cast<s8>(none));
+        }
+
+        const std::string input_name = line.substr(input_start);
+        if (input_name.compare(0, 4, "pad:") == 0) {
+            const SDL_GameControllerButton button = SDL_GameControllerGetButtonFromString(input_name.c_str() + 4);
+            if (button == SDL_CONTROLLER_BUTTON_INVALID) {
+                throw invalid_line();
+            }
+            button_actions[button] = static_cast<s8>(action);
+        } else {
+            const SDL_Keycode key = SDL_GetKeyFromName(input_name.c_str());
+            if (key == SDLK_UNKNOWN || SDL_GetScancodeFromKey(key) == SDL_SCANCODE_UNKNOWN) {
+                throw invalid_line();
+            }
+            BindKey(action, key);
+        }
+    }
+}
+
+void InputBindings::BindKey(int action, SDL_Keycode key) {
+    // Keys are looked up by scancode, which can index an array, but bound by keycode so the defaults follow the
+    // keyboard layout.
+    const SDL_Scancode scancode = SDL_GetScancodeFromKey(key);
+    if (scancode != SDL_SCANCODE_UNKNOWN) {
+        key_actions[scancode] = static_cast<s8>(action);
+    }
+}
+
+} // End namespace Emu
@@ -0,0 +1,65 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <SDL.h>
+
+#include "common/CommonTypes.h"
+#include "emu/Frontend.h"
+
+namespace Emu {
+
+// Which keys and controller buttons trigger each action. The actions are the cores' input events, in the same
+// order, followed by the speed controls which the SDL frontend handles itself.
+class InputBindings {
+public:
+    static constexpr int turbo = input_event_count;
+    static constexpr int slower = input_event_count + 1;
+    static constexpr int faster = input_event_count + 2;
+    static constexpr int num_actions = input_event_count + 3;
+    static constexpr int none = -1;
+
+    // Binds the default keys and controller buttons. SDL's video subsystem must be initialized first, to translate
+    // the keys into scancodes for the current keyboard layout.
+    void LoadDefaults();
+    // Each line of the file binds an action to a key name as SDL knows it, or to a controller button prefixed with
+    // "pad:", e.g. "a K" or "start pad:start". The first binding of an action replaces its defaults. Throws
+    // std::runtime_error if the file can't be read or has an invalid line.
+    void LoadFile(const std::string& path);
+
+    int KeyAction(SDL_Scancode key) const { return (key < SDL_NUM_SCANCODES) ? key_actions[key] : none; }
+    int ButtonAction(u8 button) const { return (button < SDL_CONTROLLER_BUTTON_MAX) ? button_actions[button] : none; }
+
+    // Held actions matter for as long as they're held, rather than only when they're pressed.
+    static bool Held(int action) {
+        return action >= static_cast<int>(InputEvent::Rewind) && action <= turbo;
+    }
+    static bool Button(int action) {
+        return action >= static_cast<int>(InputEvent::Up) && action <= static_cast<int>(InputEvent::Select);
+    }
+
+private:
+    std::array<s8, SDL_NUM_SCANCODES> key_actions;
+    std::array<s8, SDL_CONTROLLER_BUTTON_MAX> button_actions;
+
+    void BindKey(int action, SDL_Keycode key);
+};
+
+} // End namespace Emu
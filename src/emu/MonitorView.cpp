@@ -0,0 +1,215 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include <fmt/format.h>
+
+#include "emu/MonitorView.h"
+
+namespace Emu {
+
+MonitorView::MonitorView(const std::vector<std::string>& names, unsigned int scale) {
+    tiles.resize(names.size());
+
+    const int columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(names.size()))));
+    const int rows = (static_cast<int>(names.size()) + columns - 1) / columns;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        tiles[i].name = names[i];
+        tiles[i].cell = {static_cast<int>(i % columns) * cell_width, static_cast<int>(i / columns) * cell_height,
+                         cell_width, cell_height};
+    }
+    atlas_width = columns * cell_width;
+    atlas_height = rows * cell_height;
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        throw std::runtime_error(GetSdlErrorString("Init"));
+    }
+
+    // A big grid at the requested scale won't fit on the screen, so shrink it to what will.
+    int window_width = atlas_width * std::max(scale, 1u);
+    int window_height = atlas_height * std::max(scale, 1u);
+    SDL_Rect usable;
+    if (SDL_GetDisplayUsableBounds(0, &usable) == 0 && (window_width > usable.w || window_height > usable.h)) {
+        const double fit = std::min(static_cast<double>(usable.w) / window_width,
+                                    static_cast<double>(usable.h) / window_height);
+        window_width = static_cast<int>(window_width * fit);
+        window_height = static_cast<int>(window_height * fit);
+    }
+
+    window = SDL_CreateWindow("Chroma monitor", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                              window_width, window_height, SDL_WINDOW_RESIZABLE);
+    if (window == nullptr) {
+        SDL_Quit();
+        throw std::runtime_error(GetSdlErrorString("CreateWindow"));
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == nullptr) {
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        throw std::runtime_error(GetSdlErrorString("CreateRenderer"));
+    }
+    SDL_RenderSetLogicalSize(renderer, atlas_width, atlas_height);
+
+    atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR1555, SDL_TEXTUREACCESS_STREAMING,
+                              atlas_width, atlas_height);
+    if (atlas == nullptr) {
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        throw std::runtime_error(GetSdlErrorString("CreateTexture"));
+    }
+
+    // Frames leave the alpha bit clear, so the atlas would be drawn fully transparent under SDL's default blending.
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_NONE);
+
+    // Cells without a segment yet, and the borders around Game Boy frames, stay black.
+    std::vector<u16> black(static_cast<std::size_t>(atlas_width) * atlas_height, 0);
+    SDL_UpdateTexture(atlas, nullptr, black.data(), atlas_width * sizeof(u16));
+}
+
+MonitorView::~MonitorView() {
+    for (const Tile& tile : tiles) {
+        if (tile.segment != nullptr) {
+            UnmapSegment(tile.segment);
+        }
+    }
+
+    SDL_DestroyTexture(atlas);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+void MonitorView::Run() {
+    using Clock = std::chrono::steady_clock;
+
+    MapMissingSegments();
+    auto last_title = Clock::now();
+    auto next_present = last_title;
+
+    while (true) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+                return;
+            }
+        }
+
+        bool changed = false;
+        for (Tile& tile : tiles) {
+            changed |= UploadNewFrame(tile);
+        }
+
+        // Vsync paces the presents on most setups. Without it, don't draw faster than a 60Hz display would.
+        if (changed) {
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, atlas, nullptr, nullptr);
+            SDL_RenderPresent(renderer);
+        }
+        next_present += max_present_interval;
+        const auto now = Clock::now();
+        if (next_present < now) {
+            next_present = now;
+        }
+        std::this_thread::sleep_until(next_present);
+
+        const double seconds = std::chrono::duration<double>(Clock::now() - last_title).count();
+        if (seconds >= 1.0) {
+            MapMissingSegments();
+            UpdateTitle(seconds);
+            last_title = Clock::now();
+        }
+    }
+}
+
+void MonitorView::MapMissingSegments() {
+    for (Tile& tile : tiles) {
+        if (tile.segment != nullptr) {
+            continue;
+        }
+
+        // Until an emulator has finished setting up its segment, it isn't safe to read the frame size.
+        const SharedFrameSegment* segment = MapSegmentForReading(tile.name);
+        if (segment == nullptr) {
+            continue;
+        }
+        if (segment->magic.load(std::memory_order_acquire) != SharedFrameSegment::magic_value
+                || segment->version != SharedFrameSegment::version_value) {
+            UnmapSegment(segment);
+            continue;
+        }
+
+        tile.segment = segment;
+        tile.counted_frames = segment->frame_count.load(std::memory_order_relaxed);
+    }
+}
+
+bool MonitorView::UploadNewFrame(Tile& tile) {
+    if (tile.segment == nullptr) {
+        return false;
+    }
+
+    // The reading half of the segment's seqlock. A frame caught mid-write is skipped and picked up next time.
+    const u32 sequence = tile.segment->frame_sequence.load(std::memory_order_acquire);
+    if (sequence == tile.shown_sequence || (sequence & 1) != 0) {
+        return false;
+    }
+
+    const int width = std::min<int>(tile.segment->width, cell_width);
+    const int height = std::min<int>(tile.segment->height, cell_height);
+    std::copy_n(tile.segment->frame.data(), width * height, tile.pixels.data());
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (tile.segment->frame_sequence.load(std::memory_order_relaxed) != sequence) {
+        return false;
+    }
+    tile.shown_sequence = sequence;
+
+    // Frames smaller than a GBA screen are centred in their cell.
+    const SDL_Rect rect{tile.cell.x + (cell_width - width) / 2, tile.cell.y + (cell_height - height) / 2,
+                        width, height};
+    SDL_UpdateTexture(atlas, &rect, tile.pixels.data(), width * sizeof(u16));
+    return true;
+}
+
+void MonitorView::UpdateTitle(double seconds) {
+    int running = 0;
+    u32 new_frames = 0;
+    for (Tile& tile : tiles) {
+        if (tile.segment == nullptr) {
+            continue;
+        }
+
+        if (tile.segment->exited.load(std::memory_order_acquire) == 0) {
+            ++running;
+        }
+        const u32 frame_count = tile.segment->frame_count.load(std::memory_order_relaxed);
+        // The count starts again from zero when an emulator is restarted on the same segment.
+        const u32 frames = frame_count - tile.counted_frames;
+        new_frames += (static_cast<s32>(frames) < 0) ? frame_count : frames;
+        tile.counted_frames = frame_count;
+    }
+
+    SDL_SetWindowTitle(window, fmt::format("Chroma monitor - {} of {} running - {:.0f} frames/s", running,
+                                           tiles.size(), new_frames / seconds).c_str());
+}
+
+} // End namespace Emu
@@ -0,0 +1,77 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <SDL.h>
+
+#include "common/CommonTypes.h"
+#include "emu/SharedMemoryContext.h"
+
+namespace Emu {
+
+// Watches the --shm segments of other Chroma processes and shows their frames side by side, one tile per segment.
+// Every tile lives in one streaming texture, and only the tiles with a new frame are uploaded, so the whole grid
+// costs one draw and one present per display refresh however many emulators are running or how fast they go.
+// Nothing is written to the segments; the emulators can't tell they're being watched.
+class MonitorView {
+public:
+    // Throws std::runtime_error if SDL can't be initialized or the texture is too large for the renderer.
+    MonitorView(const std::vector<std::string>& names, unsigned int scale);
+    ~MonitorView();
+
+    // Shows the tiles until the window is closed or Escape is pressed.
+    void Run();
+
+private:
+    static constexpr int cell_width = 240;
+    static constexpr int cell_height = 160;
+    static constexpr auto max_present_interval = std::chrono::microseconds{16667};
+
+    struct Tile {
+        std::string name;
+        const SharedFrameSegment* segment = nullptr;
+        SDL_Rect cell;
+
+        // The sequence of the frame last shown, which starts out impossible so the first frame is always taken.
+        u32 shown_sequence = 0xFFFFFFFF;
+        u32 counted_frames = 0;
+        std::array<u16, SharedFrameSegment::max_pixels> pixels;
+    };
+
+    std::vector<Tile> tiles;
+    int atlas_width;
+    int atlas_height;
+
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* atlas = nullptr;
+
+    void MapMissingSegments();
+    bool UploadNewFrame(Tile& tile);
+    void UpdateTitle(double seconds);
+
+    static const std::string GetSdlErrorString(const std::string& error_function) {
+        return {"SDL_" + error_function + " Error: " + SDL_GetError()};
+    }
+};
+
+} // End namespace Emu
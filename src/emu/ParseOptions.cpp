@@ -18,11 +18,17 @@
 #include <stdexcept>
 #include <algorithm>
 #include <filesystem>
+#include <memory>
+#include <array>
+#include <thread>
 #include <fmt/format.h>
 
 #include "gb/memory/CartridgeHeader.h"
 #include "gba/memory/Memory.h"
+#include "common/FrameSkip.h"
+#include "common/RomArchive.h"
 #include "emu/ParseOptions.h"
+#include "emu/SdlContext.h"
 
 namespace Emu {
 
@@ -53,13 +59,162 @@ void DisplayHelp() {
     fmt::print("Options:\n");
     fmt::print("  -h                           display help\n");
     fmt::print("  -m [dmg, cgb, agb]           specify device to emulate\n");
-    fmt::print("  -l [trace, regs]             specify log level (default: none)\n");
+    fmt::print("  -l [trace, regs, binary, binregs]\n");
+    fmt::print("                               specify log level (default: none)\n");
+    fmt::print("                                   binary levels write ./trace.bin instead of ./log.txt\n");
+    fmt::print("  --log-overflow [block, drop] wait for the log writer or drop text when it falls behind\n");
+    fmt::print("                               (default: block)\n");
+    fmt::print("  --trace-on [hotkey, pc:LOW-HIGH, write:ADDR[-ADDR], irq:BIT, frame:N]\n");
+    fmt::print("                               start logging when this happens (default: hotkey, toggle with L)\n");
+    fmt::print("  --trace-window [before,after]\n");
+    fmt::print("                               log this many instructions around each trigger, then rearm\n");
+    fmt::print("                               (default: 0,0, which logs until stopped with L)\n");
+    fmt::print("  --break [pc:ADDR, read:ADDR[-ADDR], write:ADDR[-ADDR], irq:BIT],...\n");
+    fmt::print("                               print the code and registers and pause at the end of the frame when\n");
+    fmt::print("                               any of these happen, watching only WRAM, IWRAM and HRAM\n");
     fmt::print("  -s [1-15]                    specify resolution scale (default: 2)\n");
     fmt::print("  -f                           activate fullscreen mode\n");
-    fmt::print("  --filter [iir, nearest]      choose audio filtering method (default: iir)\n");
+    fmt::print("  --bindings [file]            rebind keys and controller buttons, one \"action key\" per line\n");
+    fmt::print("  --headless                   run as fast as possible with no window or audio\n");
+    fmt::print("  --shm [name]                 run with no window, publishing frames and audio to this POSIX shared\n");
+    fmt::print("                               memory segment and taking input from it, for external harnesses\n");
+    fmt::print("  --monitor [name,...]         open no game, and instead show the frames of these --shm segments\n");
+    fmt::print("                               as tiles in one window\n");
+    fmt::print("  --bench [frames]             run headless for this many frames, then print timings as JSON\n");
+    fmt::print("  --runs [count]               repeat the benchmark from power on this many times (default: 1)\n");
+    fmt::print("  --bench-hw-counters          add the CPU's cycle, instruction and cache miss counts for each part\n");
+    fmt::print("                               of the frame to the --bench report (Linux only)\n");
+    fmt::print("  --profile [cycles]           sample the guest PC every N cycles, written to ./profile.txt on exit\n");
+    fmt::print("  --trace [file]               write a GBA event timeline in Chrome trace format (chrome://tracing)\n");
+    fmt::print("  --movie [file]               run headless, replaying the button presses in this input movie\n");
+    fmt::print("  --accuracy [accurate, balanced, fast]\n");
+    fmt::print("                               pick all of the options marked * below at once (default: accurate)\n");
+    fmt::print("                                   accurate (interpreter, IIR audio, nothing else)\n");
+    fmt::print("                                   balanced (cached CPU, blip audio, LCD thread, line cache and\n");
+    fmt::print("                                             audio thread)\n");
+    fmt::print("                                   fast (JIT, no audio, scanline GB renderer, and every other\n");
+    fmt::print("                                         option marked *)\n");
+    fmt::print("                               the on/off options marked * can be turned off with --no-<option>\n");
+    fmt::print("  --filter [iir, iir-fixed, nearest, linear, sinc, blip]\n");
+    fmt::print("                             * choose audio filtering method (default: iir)\n");
     fmt::print("                                   IIR (slow, better quality)\n");
-    fmt::print("                                   nearest-neighbour (fast, lesser quality)\n");
+    fmt::print("                                   fixed point IIR (same output on every host)\n");
+    fmt::print("                                   nearest-neighbour (fast, lesser quality, GB only)\n");
+    fmt::print("                                   linear interpolation (fast, lesser quality)\n");
+    fmt::print("                                   windowed sinc (slowest, best quality)\n");
+    fmt::print("                                   band-limited steps (fast, better quality)\n");
+    fmt::print("  --no-audio                 * don't produce any audio, and skip the work of mixing it\n");
+    fmt::print("  --latency [1-150]            specify target audio latency in ms (default: 20)\n");
+    fmt::print("  --audio-chunk [32-800]       send audio to the host this many samples at a time, pacing the\n");
+    fmt::print("                               emulator within each frame, which allows latencies below a frame\n");
+    fmt::print("                               (default: 800, a whole frame)\n");
+    fmt::print("  --frameskip [0-9, auto]      skip drawing this many of every N+1 frames, or skip while emulation\n");
+    fmt::print("                               can't keep up (default: 0, cycle at runtime with F)\n");
+    fmt::print("  --speed [0.25-8, unlimited]  emulation speed as a multiple of real time (default: 1)\n");
+    fmt::print("                               step at runtime with - and =, hold Tab to run unlimited\n");
+    fmt::print("  --gl                         present with OpenGL, which the two options below need\n");
+    fmt::print("  --scaler [integer, sharp, lcd]\n");
+    fmt::print("                               fit the frame to the window (default: integer)\n");
+    fmt::print("                                   integer (whole multiples only)\n");
+    fmt::print("                                   sharp (fills the window, blending only pixel edges)\n");
+    fmt::print("                                   lcd (whole multiples, with a grid between pixels)\n");
+    fmt::print("  --colour-correct             mimic the colours of the GBA or GBC screen\n");
+    fmt::print("  --cpu-scaler [nearest, epx]  scale frames on the CPU instead, for when OpenGL isn't available\n");
+    fmt::print("                                   nearest (repeats each pixel)\n");
+    fmt::print("                                   epx (Scale2x and Scale3x, rounds off diagonal edges)\n");
+    fmt::print("  --cpu-scale [2-4]            the multiple the CPU scaler scales by (default: 2)\n");
+    fmt::print("  --frame-blend                blend each frame with the last, like the slow LCDs of the consoles\n");
     fmt::print("  --multicart                  emulate this game using an MBC1M\n");
+    fmt::print("  --cheats [file]              apply the cheat codes in this file, one per line: Game Genie and\n");
+    fmt::print("                               GameShark for GB, and GameShark, Action Replay v1/v2 and\n");
+    fmt::print("                               unencrypted CodeBreaker for GBA\n");
+    fmt::print("  --cpu [interpreter, cached, jit]\n");
+    fmt::print("                             * choose CPU execution mode (default: interpreter)\n");
+    fmt::print("                                   interpreter (decodes every instruction)\n");
+    fmt::print("                                   cached (caches decoded basic blocks)\n");
+    fmt::print("                                   jit (also compiles hot Thumb and SM83 code to x86-64)\n");
+    fmt::print("  --validate                   run the --cpu mode and the interpreter in lockstep, comparing their\n");
+    fmt::print("                               states after every frame, for --bench frames or until they diverge\n");
+    fmt::print("  --auto-tune [frames]         try the options marked * on this many frames, keep the fastest ones\n");
+    fmt::print("                               whose frames all match the accurate profile's, and save them for\n");
+    fmt::print("                               this ROM next to its save file; later runs without --accuracy use\n");
+    fmt::print("                               them\n");
+    fmt::print("  --gb-renderer [scanline, accurate]\n");
+    fmt::print("                             * choose how GB scanlines are drawn (default: accurate)\n");
+    fmt::print("                                   scanline (draws each line in one go as it starts)\n");
+    fmt::print("                                   accurate (splits lines at writes made while drawing them)\n");
+    fmt::print("  --lcd-thread               * draw GBA scanlines on a separate thread\n");
+    fmt::print("  --line-cache               * reuse unchanged GBA scanlines from the previous frame, and draw\n");
+    fmt::print("                                   GBA tiled backgrounds from a decoded copy of the whole map\n");
+    fmt::print("  --audio-thread             * mix GB audio on a separate thread, a frame behind\n");
+    fmt::print("  --hle-bios                 * run the GBA BIOS's copy, decompression, math and halt calls natively\n");
+    fmt::print("  --ideal-prefetch           * let every sequential GBA ROM opcode fetch hit the prefetch buffer\n");
+    fmt::print("  --skip-bios                * start GBA games straight from the cartridge, skipping the boot intro\n");
+    fmt::print("  --huge-pages [transparent, explicit]\n");
+    fmt::print("                               back the ROM and GBA RAM with huge pages, for fewer TLB misses\n");
+    fmt::print("                                   transparent (let the kernel use them where it can)\n");
+    fmt::print("                                   explicit (take them from vm.nr_hugepages, or fall back to\n");
+    fmt::print("                                   transparent if there are none free)\n");
+    fmt::print("  --decode-trace [file]        print a binary trace from -l binary or -l binregs as text\n");
+    fmt::print("  --frame-stats                print frame time percentiles as JSON on exit (or at runtime with G)\n");
+    fmt::print("  --mem-report                 print the bytes held by each part of the emulator as JSON on exit\n");
+    fmt::print("  --access-counts [prefix]     write GBA memory traffic per 4KB page to prefix.csv and a heatmap to\n");
+    fmt::print("                               prefix.png on exit (needs a CHROMA_PERF_COUNTERS build)\n");
+    fmt::print("  --coverage [file]            write which guest instructions ran, disassembled, to this file on exit\n");
+    fmt::print("  --metrics-port [port]        serve Prometheus metrics at http://localhost:port/metrics\n");
+    fmt::print("  --watchdog [frames]          quit when the game hangs for good, or leaves the screen off for this\n");
+    fmt::print("                               many frames in a row\n");
+    fmt::print("  --rewind [MiB]               keep this much compressed history to rewind through, hold Backspace\n");
+    fmt::print("  --rewind-interval [1-60]     frames between rewind snapshots (default: 4)\n");
+    fmt::print("  --run-ahead [0-8]            show the frame this many frames ahead, to hide games' input lag\n");
+    fmt::print("  --record-movie [file]        record the buttons held on every frame, starting from power on\n");
+    fmt::print("  --record-from-state          start the recording from the game's savestate instead\n");
+    fmt::print("  --play-movie [file]          play back a recorded movie, ignoring the keyboard until it ends\n");
+    fmt::print("  --seek-frame [frame]         start playback from this frame of the movie\n");
+    fmt::print("  --movie-keyframes [seconds]  seconds between the savestates kept in the movie's .idx seek index\n");
+    fmt::print("                               (default: 10, 0 for no index)\n");
+    fmt::print("  --save-flush [0-3600]        write changed save data every N seconds in the background\n");
+    fmt::print("                               (default: 5, 0 only saves on exit)\n");
+    fmt::print("  --mmap-save [frame, exit, seconds]\n");
+    fmt::print("                               keep the save in a memory-mapped file instead, and sync it to disk\n");
+    fmt::print("                               every frame, only on exit, or every N seconds\n");
+    fmt::print("  --no-suspend                 boot the game from power on, instead of resuming where the last session\n");
+    fmt::print("                               left off, and don't suspend on exit\n");
+    fmt::print("  --save-type-cache [file]     remember the save type detected for each GBA game in this file, for\n");
+    fmt::print("                               games which don't have a save file yet\n");
+    fmt::print("  --png-level [0-9]            zlib level of screenshots and dumped frames (default: 6, or 1 when\n");
+    fmt::print("                               dumping frames)\n");
+    fmt::print("  --frame-dump [N]             write every Nth frame to ./frames as a numbered PNG\n");
+    fmt::print("  --frame-dump-dir [dir]       write dumped frames to this directory instead\n");
+    fmt::print("  --record [file]              record every frame and the audio losslessly to this file\n");
+    fmt::print("  --record-pipe [command]      pipe raw bgr555le frames to this command, e.g. an ffmpeg rawvideo\n");
+    fmt::print("                               encoder reading from stdin, and write the audio to ./record.wav\n");
+    fmt::print("  --stream [command]           stream raw bgr555le frames to a live encoder's stdin, dropping frames\n");
+    fmt::print("                               rather than lagging, and s16le audio to the FIFO named by {{audio}}\n");
+    fmt::print("  --ram-deltas [file]          write the 64-byte lines of guest RAM which changed each frame to\n");
+    fmt::print("                               this file\n");
+    fmt::print("  --ram-deltas-zlib            compress each frame of --ram-deltas with zlib\n");
+    fmt::print("  --link-listen [port]         wait for another instance to connect a link cable on this port\n");
+    fmt::print("  --link-connect [host:port]   connect a link cable to an instance waiting with --link-listen\n");
+    fmt::print("  --netplay-listen [port]      wait for a second player to connect on this port, to share the game\n");
+    fmt::print("  --netplay-connect [host:port]\n");
+    fmt::print("                               join a player waiting with --netplay-listen\n");
+    fmt::print("  --netplay-frames [1-16]      frames of the other player's input to predict before waiting for\n");
+    fmt::print("                               it (default: 8)\n");
+    fmt::print("  --rtc [host, emulated]       run the cartridge clock on the host clock (default), or on emulated\n");
+    fmt::print("                               time which speeds up and slows down with the game\n");
+    fmt::print("  --rtc-epoch [seconds]        start emulated time at this Unix time instead of at the time of\n");
+    fmt::print("                               power on, implies --rtc emulated\n");
+    fmt::print("  --pin-emu [cpu]              keep the emulation thread on this host CPU\n");
+    fmt::print("  --pin-render [cpu]           keep the render thread on this host CPU\n");
+    fmt::print("  --pin-audio [cpu]            keep the audio thread on this host CPU\n");
+    fmt::print("  --priority [high, realtime]  raise the priority of the emulation, render and audio threads\n");
+    fmt::print("                                   high (lower their nice value)\n");
+    fmt::print("                                   realtime (SCHED_RR, or MMCSS on Windows, best used with the\n");
+    fmt::print("                                   threads pinned to separate CPUs)\n");
+    fmt::print("  --lock-memory                lock all of the emulator's memory into RAM\n");
+    fmt::print("  --low-power                  sleep between frames without spinning, and poll for input less\n");
+    fmt::print("                               while idle, at the cost of less even frame pacing\n");
 }
 
 Gb::Console GetGameBoyType(const std::vector<std::string>& tokens) {
@@ -87,6 +242,10 @@ LogLevel GetLogLevel(const std::vector<std::string>& tokens) {
             return LogLevel::Trace;
         } else if (log_string == "regs" || log_string == "registers") {
             return LogLevel::Registers;
+        } else if (log_string == "binary") {
+            return LogLevel::BinaryTrace;
+        } else if (log_string == "binregs") {
+            return LogLevel::BinaryRegisters;
         } else {
             // Passing the "-l" argument by itself defaults to instruction trace logging.
             return LogLevel::Trace;
@@ -97,6 +256,133 @@ LogLevel GetLogLevel(const std::vector<std::string>& tokens) {
     }
 }
 
+LogOverflow GetLogOverflow(const std::vector<std::string>& tokens) {
+    const std::string overflow_string = Emu::GetOptionParam(tokens, "--log-overflow");
+    if (!overflow_string.empty()) {
+        if (overflow_string == "block") {
+            return LogOverflow::Block;
+        } else if (overflow_string == "drop") {
+            return LogOverflow::Drop;
+        } else {
+            throw std::invalid_argument("Invalid log overflow policy specified: " + overflow_string);
+        }
+    } else {
+        // If no policy specified, never lose log output.
+        return LogOverflow::Block;
+    }
+}
+
+Common::TraceTrigger GetTraceTrigger(const std::vector<std::string>& tokens) {
+    using Condition = Common::TraceTrigger::Condition;
+    Common::TraceTrigger trigger;
+
+    const std::string trigger_string = Emu::GetOptionParam(tokens, "--trace-on");
+    if (!trigger_string.empty() && trigger_string != "hotkey") {
+        const std::size_t colon = trigger_string.find(':');
+        const std::string kind = trigger_string.substr(0, colon);
+        const std::string value = (colon != std::string::npos) ? trigger_string.substr(colon + 1) : "";
+        if (value.empty()) {
+            throw std::invalid_argument("Invalid trace trigger specified: " + trigger_string);
+        }
+
+        // Addresses may be a single value or an inclusive low-high range, in any base std::stoul accepts.
+        const std::size_t dash = value.find('-');
+        trigger.low = std::stoul(value.substr(0, dash), nullptr, 0);
+        trigger.high = (dash != std::string::npos) ? std::stoul(value.substr(dash + 1), nullptr, 0) : trigger.low;
+
+        if (kind == "pc") {
+            trigger.condition = Condition::PcRange;
+        } else if (kind == "write") {
+            trigger.condition = Condition::MemWrite;
+        } else if (kind == "irq") {
+            // Given as the IF bit number.
+            trigger.condition = Condition::Irq;
+            trigger.low = 1u << trigger.low;
+        } else if (kind == "frame") {
+            trigger.condition = Condition::Frame;
+        } else {
+            throw std::invalid_argument("Invalid trace trigger specified: " + trigger_string);
+        }
+
+        if (trigger.high < trigger.low && trigger.condition != Condition::Irq) {
+            throw std::invalid_argument("Invalid trace trigger range specified: " + trigger_string);
+        }
+    }
+
+    const std::string window_string = Emu::GetOptionParam(tokens, "--trace-window");
+    if (!window_string.empty()) {
+        const std::size_t comma = window_string.find(',');
+        trigger.before = std::stoul(window_string.substr(0, comma));
+        trigger.after = (comma != std::string::npos) ? std::stoul(window_string.substr(comma + 1)) : 0;
+    }
+
+    return trigger;
+}
+
+std::vector<Common::Breakpoint> GetBreakpoints(const std::vector<std::string>& tokens) {
+    using Type = Common::Breakpoint::Type;
+    std::vector<Common::Breakpoint> breakpoints;
+
+    const std::string break_string = Emu::GetOptionParam(tokens, "--break");
+    for (std::size_t start = 0; start < break_string.size();) {
+        const std::size_t comma = std::min(break_string.find(',', start), break_string.size());
+        const std::string point_string = break_string.substr(start, comma - start);
+        start = comma + 1;
+
+        const std::size_t colon = point_string.find(':');
+        const std::string kind = point_string.substr(0, colon);
+        const std::string value = (colon != std::string::npos) ? point_string.substr(colon + 1) : "";
+        if (value.empty()) {
+            throw std::invalid_argument("Invalid breakpoint specified: " + point_string);
+        }
+
+        // Addresses are given the same way as for --trace-on.
+        Common::Breakpoint point;
+        const std::size_t dash = value.find('-');
+        point.low = std::stoul(value.substr(0, dash), nullptr, 0);
+        point.high = (dash != std::string::npos) ? std::stoul(value.substr(dash + 1), nullptr, 0) : point.low;
+
+        if (kind == "pc" && dash == std::string::npos) {
+            point.type = Type::Exec;
+        } else if (kind == "read") {
+            point.type = Type::Read;
+        } else if (kind == "write") {
+            point.type = Type::Write;
+        } else if (kind == "irq" && dash == std::string::npos) {
+            point.type = Type::Irq;
+            point.low = 1u << point.low;
+        } else {
+            throw std::invalid_argument("Invalid breakpoint specified: " + point_string);
+        }
+
+        if (point.high < point.low && point.type != Type::Irq) {
+            throw std::invalid_argument("Invalid breakpoint range specified: " + point_string);
+        }
+        breakpoints.push_back(point);
+    }
+
+    return breakpoints;
+}
+
+std::vector<std::string> GetMonitorNames(const std::vector<std::string>& tokens) {
+    std::vector<std::string> names;
+
+    const std::string names_string = Emu::GetOptionParam(tokens, "--monitor");
+    for (std::size_t start = 0; start < names_string.size();) {
+        const std::size_t comma = std::min(names_string.find(',', start), names_string.size());
+        if (comma != start) {
+            names.push_back(names_string.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+
+    if (names.empty()) {
+        throw std::invalid_argument("No shared memory segments given to --monitor.");
+    }
+
+    return names;
+}
+
 unsigned int GetPixelScale(const std::vector<std::string>& tokens) {
     const std::string scale_string = Emu::GetOptionParam(tokens, "-s");
     if (!scale_string.empty()) {
@@ -112,20 +398,631 @@ unsigned int GetPixelScale(const std::vector<std::string>& tokens) {
     }
 }
 
-bool GetFilterEnable(const std::vector<std::string>& tokens) {
+AudioFilter GetAudioFilter(const std::vector<std::string>& tokens, AudioFilter profile_filter) {
+    if (Emu::ContainsOption(tokens, "--no-audio")) {
+        return AudioFilter::None;
+    }
+
     const std::string filter_string = Emu::GetOptionParam(tokens, "--filter");
     if (!filter_string.empty()) {
         if (filter_string == "iir") {
-            return true;
+            return AudioFilter::Iir;
+        } else if (filter_string == "iir-fixed") {
+            return AudioFilter::FixedIir;
         } else if (filter_string == "nearest") {
-            return false;
+            return AudioFilter::Nearest;
+        } else if (filter_string == "linear") {
+            return AudioFilter::Linear;
+        } else if (filter_string == "sinc") {
+            return AudioFilter::Sinc;
+        } else if (filter_string == "blip") {
+            return AudioFilter::Blip;
         } else {
             throw std::invalid_argument("Invalid filter method specified: " + filter_string);
         }
     } else {
-        // If no filter specified, default to using IIR filter.
-        return true;
+        return profile_filter;
+    }
+}
+
+unsigned int GetAudioLatency(const std::vector<std::string>& tokens) {
+    const std::string latency_string = Emu::GetOptionParam(tokens, "--latency");
+    if (!latency_string.empty()) {
+        unsigned int latency = std::stoi(latency_string);
+        if (latency == 0 || latency > 150) {
+            throw std::invalid_argument("Invalid audio latency specified: " + latency_string);
+        }
+
+        return latency;
+    } else {
+        // If no latency specified, default to 20ms.
+        return 20;
+    }
+}
+
+int GetAudioChunk(const std::vector<std::string>& tokens) {
+    const std::string chunk_string = Emu::GetOptionParam(tokens, "--audio-chunk");
+    if (!chunk_string.empty()) {
+        int chunk = std::stoi(chunk_string);
+        if (chunk < 32 || chunk > 800) {
+            throw std::invalid_argument("Invalid audio chunk size specified: " + chunk_string);
+        }
+
+        return chunk;
+    } else {
+        // Otherwise, audio is sent a frame at a time.
+        return 0;
+    }
+}
+
+int GetFrameSkip(const std::vector<std::string>& tokens) {
+    const std::string frame_skip_string = Emu::GetOptionParam(tokens, "--frameskip");
+    if (!frame_skip_string.empty()) {
+        if (frame_skip_string == "auto") {
+            return Common::FrameSkip::adaptive;
+        }
+
+        int frame_skip = std::stoi(frame_skip_string);
+        if (frame_skip < 0 || frame_skip > Common::FrameSkip::max_skip) {
+            throw std::invalid_argument("Invalid frameskip specified: " + frame_skip_string);
+        }
+
+        return frame_skip;
+    } else {
+        // If no frameskip specified, draw every frame.
+        return 0;
+    }
+}
+
+double GetSpeed(const std::vector<std::string>& tokens) {
+    const std::string speed_string = Emu::GetOptionParam(tokens, "--speed");
+    if (!speed_string.empty()) {
+        if (speed_string == "unlimited") {
+            return Emu::SdlContext::unlimited_speed;
+        }
+
+        double speed = std::stod(speed_string);
+        if (speed < 0.25 || speed > Emu::SdlContext::max_speed) {
+            throw std::invalid_argument("Invalid speed specified: " + speed_string);
+        }
+
+        return speed;
+    } else {
+        // If no speed specified, run at full speed.
+        return 1.0;
+    }
+}
+
+int GetBenchFrames(const std::vector<std::string>& tokens) {
+    const std::string frames_string = Emu::GetOptionParam(tokens, "--bench");
+    if (!frames_string.empty()) {
+        int frames = std::stoi(frames_string);
+        if (frames < 1) {
+            throw std::invalid_argument("Invalid benchmark frame count specified: " + frames_string);
+        }
+
+        return frames;
+    } else {
+        // If no frame count specified, run normally.
+        return 0;
+    }
+}
+
+int GetBenchRuns(const std::vector<std::string>& tokens) {
+    const std::string runs_string = Emu::GetOptionParam(tokens, "--runs");
+    if (!runs_string.empty()) {
+        int runs = std::stoi(runs_string);
+        if (runs < 1) {
+            throw std::invalid_argument("Invalid benchmark run count specified: " + runs_string);
+        }
+
+        return runs;
+    } else {
+        // If no run count specified, run the benchmark once.
+        return 1;
+    }
+}
+
+int GetProfileInterval(const std::vector<std::string>& tokens) {
+    const std::string interval_string = Emu::GetOptionParam(tokens, "--profile");
+    if (!interval_string.empty()) {
+        int interval = std::stoi(interval_string);
+        if (interval < 1) {
+            throw std::invalid_argument("Invalid profiling interval specified: " + interval_string);
+        }
+
+        return interval;
+    } else {
+        // If no interval specified, don't profile.
+        return 0;
+    }
+}
+
+Common::RewindSettings GetRewindSettings(const std::vector<std::string>& tokens) {
+    Common::RewindSettings settings;
+
+    const std::string budget_string = Emu::GetOptionParam(tokens, "--rewind");
+    if (!budget_string.empty()) {
+        int budget = std::stoi(budget_string);
+        if (budget < 1 || budget > 4096) {
+            throw std::invalid_argument("Invalid rewind memory budget specified: " + budget_string);
+        }
+
+        settings.budget = static_cast<std::size_t>(budget) * 1024 * 1024;
+    }
+
+    const std::string interval_string = Emu::GetOptionParam(tokens, "--rewind-interval");
+    if (!interval_string.empty()) {
+        int interval = std::stoi(interval_string);
+        if (interval < 1 || interval > 60) {
+            throw std::invalid_argument("Invalid rewind interval specified: " + interval_string);
+        }
+
+        settings.interval = interval;
+    }
+
+    return settings;
+}
+
+int GetRunAhead(const std::vector<std::string>& tokens) {
+    const std::string frames_string = Emu::GetOptionParam(tokens, "--run-ahead");
+    if (!frames_string.empty()) {
+        int frames = std::stoi(frames_string);
+        if (frames < 0 || frames > 8) {
+            throw std::invalid_argument("Invalid run-ahead frame count specified: " + frames_string);
+        }
+
+        return frames;
+    } else {
+        // If no frame count specified, show each frame as it's emulated.
+        return 0;
+    }
+}
+
+Common::MovieSettings GetMovieSettings(const std::vector<std::string>& tokens) {
+    Common::MovieSettings settings;
+    settings.record_path = Emu::GetOptionParam(tokens, "--record-movie");
+    settings.play_path = Emu::GetOptionParam(tokens, "--play-movie");
+    settings.record_from_state = Emu::ContainsOption(tokens, "--record-from-state");
+
+    const std::string keyframes_string = Emu::GetOptionParam(tokens, "--movie-keyframes");
+    if (!keyframes_string.empty()) {
+        settings.keyframe_interval = std::stoi(keyframes_string);
+        if (settings.keyframe_interval < 0 || settings.keyframe_interval > 3600) {
+            throw std::invalid_argument("Invalid movie keyframe interval specified: " + keyframes_string);
+        }
+    }
+
+    const std::string seek_string = Emu::GetOptionParam(tokens, "--seek-frame");
+    if (!seek_string.empty()) {
+        settings.seek_frame = std::stoll(seek_string);
+        if (settings.seek_frame < 0) {
+            throw std::invalid_argument("Invalid movie frame specified: " + seek_string);
+        }
+    }
+
+    if (!settings.record_path.empty() && !settings.play_path.empty()) {
+        throw std::invalid_argument("Can't record and play an input movie at the same time.");
+    } else if (settings.record_from_state && settings.record_path.empty()) {
+        throw std::invalid_argument("--record-from-state needs a movie to record with --record-movie.");
+    } else if (settings.seek_frame != 0 && settings.play_path.empty()) {
+        throw std::invalid_argument("--seek-frame needs a movie to play with --play-movie.");
+    }
+
+    return settings;
+}
+
+Common::SaveSettings GetSaveSettings(const std::vector<std::string>& tokens) {
+    Common::SaveSettings settings;
+
+    const std::string interval_string = Emu::GetOptionParam(tokens, "--save-flush");
+    if (!interval_string.empty()) {
+        int interval = std::stoi(interval_string);
+        if (interval < 0 || interval > 3600) {
+            throw std::invalid_argument("Invalid save flush interval specified: " + interval_string);
+        }
+
+        settings.flush_interval = interval;
+    }
+
+    const std::string mmap_string = Emu::GetOptionParam(tokens, "--mmap-save");
+    if (!mmap_string.empty()) {
+        settings.mapped = true;
+        if (mmap_string == "frame") {
+            settings.msync_policy = Common::SaveSettings::MsyncPolicy::Frame;
+        } else if (mmap_string == "exit") {
+            settings.msync_policy = Common::SaveSettings::MsyncPolicy::Exit;
+        } else {
+            int interval = std::stoi(mmap_string);
+            if (interval < 1 || interval > 3600) {
+                throw std::invalid_argument("Invalid save sync policy specified: " + mmap_string);
+            }
+
+            settings.msync_policy = Common::SaveSettings::MsyncPolicy::Interval;
+            settings.flush_interval = interval;
+        }
+    }
+
+    settings.type_cache_path = Emu::GetOptionParam(tokens, "--save-type-cache");
+
+    return settings;
+}
+
+Common::ScreenshotSettings GetScreenshotSettings(const std::vector<std::string>& tokens) {
+    Common::ScreenshotSettings settings;
+
+    const std::string interval_string = Emu::GetOptionParam(tokens, "--frame-dump");
+    if (!interval_string.empty()) {
+        int interval = std::stoi(interval_string);
+        if (interval < 1 || interval > 3600) {
+            throw std::invalid_argument("Invalid frame dump interval specified: " + interval_string);
+        }
+
+        settings.frame_dump_interval = interval;
+        // Every dumped frame has to be compressed in the time it takes to emulate one, which only the fastest
+        // levels manage.
+        settings.compression = 1;
+    }
+
+    const std::string dir_string = Emu::GetOptionParam(tokens, "--frame-dump-dir");
+    if (!dir_string.empty()) {
+        settings.frame_dump_dir = dir_string;
     }
+
+    const std::string level_string = Emu::GetOptionParam(tokens, "--png-level");
+    if (!level_string.empty()) {
+        int level = std::stoi(level_string);
+        if (level < 0 || level > 9) {
+            throw std::invalid_argument("Invalid PNG compression level specified: " + level_string);
+        }
+
+        settings.compression = level;
+    }
+
+    return settings;
+}
+
+Common::RecordSettings GetRecordSettings(const std::vector<std::string>& tokens) {
+    Common::RecordSettings settings;
+    settings.path = Emu::GetOptionParam(tokens, "--record");
+    settings.pipe_command = Emu::GetOptionParam(tokens, "--record-pipe");
+    settings.stream_command = Emu::GetOptionParam(tokens, "--stream");
+
+    if (!settings.path.empty() + !settings.pipe_command.empty() + !settings.stream_command.empty() > 1) {
+        throw std::invalid_argument("Only one of --record, --record-pipe and --stream can be used at a time.");
+    }
+
+    return settings;
+}
+
+Common::LinkSettings GetLinkSettings(const std::vector<std::string>& tokens) {
+    Common::LinkSettings settings;
+    settings.connect_address = Emu::GetOptionParam(tokens, "--link-connect");
+
+    const std::string port_string = Emu::GetOptionParam(tokens, "--link-listen");
+    if (!port_string.empty()) {
+        int port = std::stoi(port_string);
+        if (port < 1 || port > 65535) {
+            throw std::invalid_argument("Invalid link port specified: " + port_string);
+        }
+
+        settings.listen_port = port;
+    }
+
+    if (settings.listen_port != 0 && !settings.connect_address.empty()) {
+        throw std::invalid_argument("Can't listen for and connect a link cable at the same time.");
+    }
+
+    return settings;
+}
+
+Common::NetplaySettings GetNetplaySettings(const std::vector<std::string>& tokens) {
+    Common::NetplaySettings settings;
+    settings.connect_address = Emu::GetOptionParam(tokens, "--netplay-connect");
+
+    const std::string port_string = Emu::GetOptionParam(tokens, "--netplay-listen");
+    if (!port_string.empty()) {
+        int port = std::stoi(port_string);
+        if (port < 1 || port > 65535) {
+            throw std::invalid_argument("Invalid netplay port specified: " + port_string);
+        }
+
+        settings.listen_port = port;
+    }
+
+    const std::string frames_string = Emu::GetOptionParam(tokens, "--netplay-frames");
+    if (!frames_string.empty()) {
+        int frames = std::stoi(frames_string);
+        if (frames < 1 || frames > 16) {
+            throw std::invalid_argument("Invalid netplay rollback frame count specified: " + frames_string);
+        }
+
+        settings.rollback_frames = frames;
+    }
+
+    if (settings.listen_port != 0 && !settings.connect_address.empty()) {
+        throw std::invalid_argument("Can't listen for and connect to another player at the same time.");
+    }
+
+    return settings;
+}
+
+Common::RtcSettings GetRtcSettings(const std::vector<std::string>& tokens) {
+    Common::RtcSettings settings;
+
+    const std::string rtc_string = Emu::GetOptionParam(tokens, "--rtc");
+    if (!rtc_string.empty()) {
+        if (rtc_string == "host") {
+            settings.emulated = false;
+        } else if (rtc_string == "emulated") {
+            settings.emulated = true;
+        } else {
+            throw std::invalid_argument("Invalid RTC clock specified: " + rtc_string);
+        }
+    }
+
+    const std::string epoch_string = Emu::GetOptionParam(tokens, "--rtc-epoch");
+    if (!epoch_string.empty()) {
+        const s64 epoch = std::stoll(epoch_string);
+        // Zero is left out, since savestates use it to mark a host clock.
+        if (epoch <= 0) {
+            throw std::invalid_argument("Invalid RTC epoch specified: " + epoch_string);
+        } else if (rtc_string == "host") {
+            throw std::invalid_argument("--rtc-epoch can't be used with the host clock.");
+        }
+
+        settings.emulated = true;
+        settings.epoch = epoch;
+    }
+
+    return settings;
+}
+
+DisplaySettings GetDisplaySettings(const std::vector<std::string>& tokens) {
+    DisplaySettings settings;
+
+    const std::string scaler_string = Emu::GetOptionParam(tokens, "--scaler");
+    if (!scaler_string.empty()) {
+        if (scaler_string == "integer") {
+            settings.scaler = DisplaySettings::Scaler::Integer;
+        } else if (scaler_string == "sharp") {
+            settings.scaler = DisplaySettings::Scaler::Sharp;
+        } else if (scaler_string == "lcd") {
+            settings.scaler = DisplaySettings::Scaler::Lcd;
+        } else {
+            throw std::invalid_argument("Invalid scaler specified: " + scaler_string);
+        }
+    }
+
+    settings.colour_correction = Emu::ContainsOption(tokens, "--colour-correct");
+    // Shaders are the only way to do the rest, so asking for them implies OpenGL.
+    settings.opengl = Emu::ContainsOption(tokens, "--gl") || !scaler_string.empty() || settings.colour_correction;
+
+    const std::string cpu_scaler_string = Emu::GetOptionParam(tokens, "--cpu-scaler");
+    if (!cpu_scaler_string.empty()) {
+        if (cpu_scaler_string == "nearest") {
+            settings.cpu_scaler = DisplaySettings::CpuScaler::Nearest;
+        } else if (cpu_scaler_string == "epx") {
+            settings.cpu_scaler = DisplaySettings::CpuScaler::Epx;
+        } else {
+            throw std::invalid_argument("Invalid CPU scaler specified: " + cpu_scaler_string);
+        }
+    }
+
+    const std::string cpu_scale_string = Emu::GetOptionParam(tokens, "--cpu-scale");
+    if (!cpu_scale_string.empty()) {
+        const int cpu_scale = std::stoi(cpu_scale_string);
+        if (cpu_scale < 2 || cpu_scale > 4) {
+            throw std::invalid_argument("Invalid CPU scale specified: " + cpu_scale_string);
+        }
+
+        settings.cpu_scale = cpu_scale;
+    }
+
+    settings.frame_blend = Emu::ContainsOption(tokens, "--frame-blend");
+
+    if (settings.opengl && (settings.cpu_scaler != DisplaySettings::CpuScaler::None || settings.frame_blend)) {
+        throw std::invalid_argument("The CPU filters only work without OpenGL.");
+    }
+
+    return settings;
+}
+
+ExecMode GetExecMode(const std::vector<std::string>& tokens, ExecMode profile_mode) {
+    const std::string mode_string = Emu::GetOptionParam(tokens, "--cpu");
+    if (!mode_string.empty()) {
+        if (mode_string == "interpreter") {
+            return ExecMode::Interpreter;
+        } else if (mode_string == "cached") {
+            return ExecMode::Cached;
+        } else if (mode_string == "jit") {
+            return ExecMode::Jit;
+        } else {
+            throw std::invalid_argument("Invalid CPU execution mode specified: " + mode_string);
+        }
+    } else {
+        return profile_mode;
+    }
+}
+
+GbRenderer GetGbRenderer(const std::vector<std::string>& tokens, GbRenderer profile_renderer) {
+    const std::string renderer_string = Emu::GetOptionParam(tokens, "--gb-renderer");
+    if (!renderer_string.empty()) {
+        if (renderer_string == "scanline") {
+            return GbRenderer::Scanline;
+        } else if (renderer_string == "accurate") {
+            return GbRenderer::Accurate;
+        } else {
+            throw std::invalid_argument("Invalid GB renderer specified: " + renderer_string);
+        }
+    } else {
+        return profile_renderer;
+    }
+}
+
+Common::PerfProfile GetPerfProfile(const std::vector<std::string>& tokens) {
+    const std::string profile_string = Emu::GetOptionParam(tokens, "--accuracy");
+    if (!profile_string.empty()) {
+        if (profile_string == "accurate") {
+            return Common::PerfProfile::Accurate;
+        } else if (profile_string == "balanced") {
+            return Common::PerfProfile::Balanced;
+        } else if (profile_string == "fast") {
+            return Common::PerfProfile::Fast;
+        } else {
+            throw std::invalid_argument("Invalid accuracy profile specified: " + profile_string);
+        }
+    } else {
+        return Common::PerfProfile::Accurate;
+    }
+}
+
+// The on/off settings of PerfSettings, each turned on with --<name> and off with --no-<name>.
+struct PerfToggle {
+    const char* name;
+    bool Common::PerfSettings::*setting;
+};
+
+constexpr std::array<PerfToggle, 6> perf_toggles{{
+    {"lcd-thread", &Common::PerfSettings::lcd_thread},
+    {"line-cache", &Common::PerfSettings::line_cache},
+    {"audio-thread", &Common::PerfSettings::audio_thread},
+    {"hle-bios", &Common::PerfSettings::hle_bios},
+    {"ideal-prefetch", &Common::PerfSettings::ideal_prefetch},
+    {"skip-bios", &Common::PerfSettings::skip_bios},
+}};
+
+Common::PerfSettings GetPerfSettings(const std::vector<std::string>& tokens, const Common::PerfSettings& defaults) {
+    Common::PerfSettings settings = Emu::ContainsOption(tokens, "--accuracy")
+                                    ? Common::PerfSettings::ForProfile(GetPerfProfile(tokens)) : defaults;
+    settings.exec_mode = GetExecMode(tokens, settings.exec_mode);
+    settings.audio_filter = GetAudioFilter(tokens, settings.audio_filter);
+    settings.gb_renderer = GetGbRenderer(tokens, settings.gb_renderer);
+
+    for (const PerfToggle& toggle : perf_toggles) {
+        const bool on = Emu::ContainsOption(tokens, std::string{"--"} + toggle.name);
+        const bool off = Emu::ContainsOption(tokens, std::string{"--no-"} + toggle.name);
+        if (on && off) {
+            throw std::invalid_argument(fmt::format("--{0} and --no-{0} can't be used together.", toggle.name));
+        } else if (on || off) {
+            settings.*toggle.setting = on;
+        }
+    }
+
+    return settings;
+}
+
+std::vector<std::string> PerfSettingsTokens(const Common::PerfSettings& settings) {
+    constexpr std::array<const char*, 3> exec_modes{{"interpreter", "cached", "jit"}};
+    constexpr std::array<const char*, 6> audio_filters{{"iir", "nearest", "linear", "sinc", "blip", "iir-fixed"}};
+    constexpr std::array<const char*, 2> gb_renderers{{"scanline", "accurate"}};
+
+    std::vector<std::string> tokens{"--cpu", exec_modes[static_cast<int>(settings.exec_mode)],
+                                    "--gb-renderer", gb_renderers[static_cast<int>(settings.gb_renderer)]};
+    if (settings.audio_filter == AudioFilter::None) {
+        tokens.emplace_back("--no-audio");
+    } else {
+        tokens.insert(tokens.end(), {"--filter", audio_filters[static_cast<int>(settings.audio_filter)]});
+    }
+
+    for (const PerfToggle& toggle : perf_toggles) {
+        tokens.push_back(std::string{(settings.*toggle.setting) ? "--" : "--no-"} + toggle.name);
+    }
+
+    return tokens;
+}
+
+int GetAutoTuneFrames(const std::vector<std::string>& tokens) {
+    const std::string frames_string = Emu::GetOptionParam(tokens, "--auto-tune");
+    if (!frames_string.empty()) {
+        int frames = std::stoi(frames_string);
+        if (frames < 1) {
+            throw std::invalid_argument("Invalid auto-tune frame count specified: " + frames_string);
+        }
+
+        return frames;
+    } else {
+        return 0;
+    }
+}
+
+ThreadSettings GetThreadSettings(const std::vector<std::string>& tokens) {
+    ThreadSettings settings;
+
+    const std::array<std::string, 3> pin_options{{"--pin-emu", "--pin-render", "--pin-audio"}};
+    const int host_cpus = std::thread::hardware_concurrency();
+    for (std::size_t i = 0; i < pin_options.size(); ++i) {
+        const std::string cpu_string = Emu::GetOptionParam(tokens, pin_options[i]);
+        if (!cpu_string.empty()) {
+            const int cpu = std::stoi(cpu_string);
+            if (cpu < 0 || (host_cpus != 0 && cpu >= host_cpus)) {
+                throw std::invalid_argument("Invalid CPU specified for " + pin_options[i] + ": " + cpu_string);
+            }
+
+            settings.cpus[i] = cpu;
+        }
+    }
+
+    const std::string priority_string = Emu::GetOptionParam(tokens, "--priority");
+    if (!priority_string.empty()) {
+        if (priority_string == "high") {
+            settings.priority = ThreadSettings::Priority::High;
+        } else if (priority_string == "realtime") {
+            settings.priority = ThreadSettings::Priority::Realtime;
+        } else {
+            throw std::invalid_argument("Invalid thread priority specified: " + priority_string);
+        }
+    }
+
+    settings.lock_memory = Emu::ContainsOption(tokens, "--lock-memory");
+    settings.low_power = Emu::ContainsOption(tokens, "--low-power");
+
+    return settings;
+}
+
+Common::HugePages GetHugePages(const std::vector<std::string>& tokens) {
+    const std::string huge_string = Emu::GetOptionParam(tokens, "--huge-pages");
+    if (!huge_string.empty()) {
+        if (huge_string == "transparent") {
+            return Common::HugePages::Transparent;
+        } else if (huge_string == "explicit") {
+            return Common::HugePages::Explicit;
+        } else {
+            throw std::invalid_argument("Invalid huge page mode specified: " + huge_string);
+        }
+    } else {
+        return Common::HugePages::Off;
+    }
+}
+
+Common::MetricsSettings GetMetricsSettings(const std::vector<std::string>& tokens) {
+    Common::MetricsSettings settings;
+
+    const std::string port_string = Emu::GetOptionParam(tokens, "--metrics-port");
+    if (!port_string.empty()) {
+        int port = std::stoi(port_string);
+        if (port < 1 || port > 65535) {
+            throw std::invalid_argument("Invalid metrics port specified: " + port_string);
+        }
+
+        settings.port = port;
+    }
+
+    return settings;
+}
+
+Common::WatchdogSettings GetWatchdogSettings(const std::vector<std::string>& tokens) {
+    Common::WatchdogSettings settings;
+
+    const std::string frames_string = Emu::GetOptionParam(tokens, "--watchdog");
+    if (!frames_string.empty()) {
+        settings.blank_frames = std::stoi(frames_string);
+        if (settings.blank_frames < 1) {
+            throw std::invalid_argument("Invalid watchdog frame count specified: " + frames_string);
+        }
+    }
+
+    return settings;
 }
 
 Gb::Console CheckRomFile(const std::string& rom_path) {
@@ -134,9 +1031,15 @@ Gb::Console CheckRomFile(const std::string& rom_path) {
         throw std::runtime_error("Error when attempting to open " + rom_path);
     }
 
-    CheckPathIsRegularFile(rom_path);
+    Common::CheckPathIsRegularFile(rom_path);
 
-    const auto rom_size = std::filesystem::file_size(rom_path);
+    // Only the header is decompressed from an archive, so the wrong kind of file is rejected before the rest of it.
+    std::unique_ptr<Common::RomArchive> archive;
+    if (Common::RomArchive::IsArchive(rom_path)) {
+        archive = std::make_unique<Common::RomArchive>(rom_path);
+    }
+
+    const auto rom_size = archive ? archive->Size() : std::filesystem::file_size(rom_path);
 
     if (rom_size > 0x2000000) {
         // 32MB is the largest possible GBA game.
@@ -149,8 +1052,12 @@ Gb::Console CheckRomFile(const std::string& rom_path) {
     }
 
     // Read the first 0x134 bytes to check for the Nintendo logos.
-    std::vector<u8> rom_header(0x134);
-    rom_file.read(reinterpret_cast<char*>(rom_header.data()), rom_header.size());
+    Common::RomVector<u8> rom_header(0x134);
+    if (archive) {
+        archive->Read(rom_header.data(), rom_header.size());
+    } else {
+        rom_file.read(reinterpret_cast<char*>(rom_header.data()), rom_header.size());
+    }
 
     if (Gba::Memory::CheckNintendoLogo(rom_header)) {
         return Gb::Console::AGB;
@@ -170,26 +1077,41 @@ Gb::Console CheckRomFile(const std::string& rom_path) {
 }
 
 template<typename T>
-std::vector<T> LoadRom(const std::string& rom_path) {
-    std::ifstream rom_file(rom_path);
-    if (!rom_file) {
-        throw std::runtime_error("Error when attempting to open " + rom_path);
+Common::RomVector<T> LoadRom(const std::string& rom_path, Common::HugePages huge_pages) {
+    if (Common::RomArchive::IsArchive(rom_path)) {
+        // Compressed ROMs can't be mapped, so they're inflated straight into a heap buffer instead.
+        Common::RomArchive archive{rom_path};
+        Common::RomVector<T> rom = (huge_pages == Common::HugePages::Off)
+                                   ? Common::RomVector<T>(archive.Size() / sizeof(T))
+                                   : Common::RomVector<T>(archive.Size() / sizeof(T), Common::RomAllocator<T>(
+                                             std::make_shared<Common::MappedRomFile>(huge_pages)));
+        archive.Read(reinterpret_cast<u8*>(rom.data()), rom.size() * sizeof(T));
+        return rom;
     }
 
     const auto rom_size = std::filesystem::file_size(rom_path);
 
-    std::vector<T> rom_contents(rom_size / sizeof(T));
-    rom_file.read(reinterpret_cast<char*>(rom_contents.data()), rom_size);
-
-    return rom_contents;
+    // The ROM is mapped rather than read, so its pages are only loaded once the game touches them.
+    return Common::RomVector<T>(rom_size / sizeof(T),
+                                Common::RomAllocator<T>(std::make_shared<Common::MappedRomFile>(rom_path,
+                                                                                                huge_pages)));
 }
 
-template std::vector<u8> LoadRom<u8>(const std::string& rom_path);
-template std::vector<u16> LoadRom<u16>(const std::string& rom_path);
+template Common::RomVector<u8> LoadRom<u8>(const std::string& rom_path, Common::HugePages huge_pages);
+template Common::RomVector<u16> LoadRom<u16>(const std::string& rom_path, Common::HugePages huge_pages);
 
 std::string SaveGamePath(const std::string& rom_path) {
     std::size_t last_dot = rom_path.rfind('.');
 
+    // A gzipped ROM usually keeps its own extension in front of ".gz", so replace both.
+    if (last_dot != std::string::npos && rom_path.substr(last_dot) == ".gz" && last_dot > 0) {
+        const std::size_t inner_dot = rom_path.rfind('.', last_dot - 1);
+        const std::size_t last_slash = rom_path.find_last_of("/\\");
+        if (inner_dot != std::string::npos && (last_slash == std::string::npos || inner_dot > last_slash)) {
+            last_dot = inner_dot;
+        }
+    }
+
     if (last_dot == std::string::npos) {
         throw std::runtime_error("No file extension found.");
     }
@@ -218,7 +1140,7 @@ std::vector<u32> LoadGbaBios() {
         throw std::runtime_error("Error when attempting to open gba_bios.bin");
     }
 
-    CheckPathIsRegularFile(bios_path);
+    Common::CheckPathIsRegularFile(bios_path);
 
     const auto bios_size = std::filesystem::file_size(bios_path);
 
@@ -232,13 +1154,4 @@ std::vector<u32> LoadGbaBios() {
     return bios_contents;
 }
 
-void CheckPathIsRegularFile(const std::string& filename) {
-    // Check that the provided path points to a regular file.
-    if (std::filesystem::is_directory(filename)) {
-        throw std::runtime_error("Provided path is a directory: " + filename);
-    } else if (!std::filesystem::is_regular_file(filename)) {
-        throw std::runtime_error("Provided path is not a regular file: " + filename);
-    }
-}
-
 } // End namespace Emu
@@ -21,7 +21,24 @@
 
 #include "common/CommonTypes.h"
 #include "common/CommonEnums.h"
+#include "common/TraceTrigger.h"
+#include "common/Breakpoint.h"
+#include "common/Rewind.h"
+#include "common/Movie.h"
+#include "common/SaveFlusher.h"
+#include "common/MappedRom.h"
+#include "common/Screenshot.h"
+#include "common/AvRecorder.h"
+#include "common/LinkCable.h"
+#include "common/Netplay.h"
+#include "common/RtcSource.h"
+#include "common/PageAlloc.h"
+#include "common/Metrics.h"
+#include "common/Watchdog.h"
+#include "common/PerfSettings.h"
 #include "gb/core/Enums.h"
+#include "emu/GlPresenter.h"
+#include "emu/ThreadSettings.h"
 
 namespace Gb { class CartridgeHeader; }
 
@@ -34,14 +51,43 @@ std::string GetOptionParam(const std::vector<std::string>& tokens, const std::st
 void DisplayHelp();
 Gb::Console GetGameBoyType(const std::vector<std::string>& tokens);
 LogLevel GetLogLevel(const std::vector<std::string>& tokens);
+LogOverflow GetLogOverflow(const std::vector<std::string>& tokens);
+Common::TraceTrigger GetTraceTrigger(const std::vector<std::string>& tokens);
+std::vector<Common::Breakpoint> GetBreakpoints(const std::vector<std::string>& tokens);
+std::vector<std::string> GetMonitorNames(const std::vector<std::string>& tokens);
 unsigned int GetPixelScale(const std::vector<std::string>& tokens);
-bool GetFilterEnable(const std::vector<std::string>& tokens);
+unsigned int GetAudioLatency(const std::vector<std::string>& tokens);
+int GetAudioChunk(const std::vector<std::string>& tokens);
+int GetFrameSkip(const std::vector<std::string>& tokens);
+double GetSpeed(const std::vector<std::string>& tokens);
+int GetBenchFrames(const std::vector<std::string>& tokens);
+int GetBenchRuns(const std::vector<std::string>& tokens);
+int GetProfileInterval(const std::vector<std::string>& tokens);
+Common::RewindSettings GetRewindSettings(const std::vector<std::string>& tokens);
+int GetRunAhead(const std::vector<std::string>& tokens);
+Common::MovieSettings GetMovieSettings(const std::vector<std::string>& tokens);
+Common::SaveSettings GetSaveSettings(const std::vector<std::string>& tokens);
+Common::ScreenshotSettings GetScreenshotSettings(const std::vector<std::string>& tokens);
+Common::RecordSettings GetRecordSettings(const std::vector<std::string>& tokens);
+Common::LinkSettings GetLinkSettings(const std::vector<std::string>& tokens);
+Common::NetplaySettings GetNetplaySettings(const std::vector<std::string>& tokens);
+Common::RtcSettings GetRtcSettings(const std::vector<std::string>& tokens);
+DisplaySettings GetDisplaySettings(const std::vector<std::string>& tokens);
+// Starts from the --accuracy profile if one is given, or from defaults otherwise, then applies the single options.
+Common::PerfSettings GetPerfSettings(const std::vector<std::string>& tokens,
+                                     const Common::PerfSettings& defaults = Common::PerfSettings{});
+// The options which GetPerfSettings turns back into these settings.
+std::vector<std::string> PerfSettingsTokens(const Common::PerfSettings& settings);
+int GetAutoTuneFrames(const std::vector<std::string>& tokens);
+ThreadSettings GetThreadSettings(const std::vector<std::string>& tokens);
+Common::HugePages GetHugePages(const std::vector<std::string>& tokens);
+Common::MetricsSettings GetMetricsSettings(const std::vector<std::string>& tokens);
+Common::WatchdogSettings GetWatchdogSettings(const std::vector<std::string>& tokens);
 
 Gb::Console CheckRomFile(const std::string& filename);
 template<typename T>
-std::vector<T> LoadRom(const std::string& filename);
+Common::RomVector<T> LoadRom(const std::string& filename, Common::HugePages huge_pages);
 std::string SaveGamePath(const std::string& rom_path);
 std::vector<u32> LoadGbaBios();
-void CheckPathIsRegularFile(const std::string& filename);
 
 } // End namespace Emu
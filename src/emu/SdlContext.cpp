@@ -15,55 +15,77 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fmt/format.h>
 
 #include "emu/SdlContext.h"
 
 namespace Emu {
 
-SdlContext::SdlContext(int _width, int _height, unsigned int scale, bool fullscreen)
+SdlContext::SdlContext(int _width, int _height, unsigned int scale, bool fullscreen, unsigned int audio_latency_ms,
+                       double _speed, const DisplaySettings& _display_settings,
+                       const ThreadSettings& _thread_settings, const std::string& bindings_path,
+                       int _audio_chunk_samples)
         : width(_width)
-        , height(_height) {
-
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
+        , height(_height)
+        , thread_settings(_thread_settings)
+        , display_settings(_display_settings)
+        , frame_buffers{std::vector<u16>(width * height, 0x7FFF),
+                        std::vector<u16>(width * height, 0x7FFF),
+                        std::vector<u16>(width * height, 0x7FFF),
+                        std::vector<u16>(width * height, 0x7FFF)}
+        , frame_pointers{{frame_buffers[0].data(), frame_buffers[1].data(), frame_buffers[2].data(),
+                          frame_buffers[3].data()}}
+        , speed(_speed)
+        , target_fill(sample_rate * audio_latency_ms / 1000)
+        , audio_chunk_samples(_audio_chunk_samples) {
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
         throw std::runtime_error(GetSdlErrorString("Init"));
     }
 
+    try {
+        bindings.LoadDefaults();
+        if (!bindings_path.empty()) {
+            bindings.LoadFile(bindings_path);
+        }
+    } catch (const std::runtime_error&) {
+        SDL_Quit();
+        throw;
+    }
+
+    // There's no point showing a CPU-scaled frame any smaller than it was scaled to.
+    if (display_settings.cpu_scaler != DisplaySettings::CpuScaler::None) {
+        scale = std::max(scale, static_cast<unsigned int>(display_settings.cpu_scale));
+    }
+
     window = SDL_CreateWindow("Chroma",
                               SDL_WINDOWPOS_UNDEFINED,
                               SDL_WINDOWPOS_UNDEFINED,
                               width * scale,
                               height * scale,
-                              SDL_WINDOW_OPENGL);
+                              SDL_WINDOW_OPENGL | (display_settings.opengl ? SDL_WINDOW_RESIZABLE : 0));
     if (window == nullptr) {
         SDL_Quit();
         throw std::runtime_error(GetSdlErrorString("CreateWindow"));
     }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (renderer == nullptr) {
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        throw std::runtime_error(GetSdlErrorString("CreateRenderer"));
-    }
+    // The renderer and texture are created and used only on the render thread.
+    std::promise<void> render_init;
+    std::future<void> render_init_result = render_init.get_future();
+    render_thread = std::thread{&SdlContext::RenderLoop, this, std::move(render_init)};
 
-    SDL_RenderSetLogicalSize(renderer, width, height);
-    SDL_RenderSetIntegerScale(renderer, SDL_TRUE);
-
-    texture = SDL_CreateTexture(renderer,
-                                SDL_PIXELFORMAT_ABGR1555,
-                                SDL_TEXTUREACCESS_STREAMING,
-                                width,
-                                height);
-    if (texture == nullptr) {
-        SDL_DestroyRenderer(renderer);
+    try {
+        render_init_result.get();
+    } catch (const std::runtime_error&) {
+        render_thread.join();
         SDL_DestroyWindow(window);
         SDL_Quit();
-        throw std::runtime_error(GetSdlErrorString("CreateTexture"));
+        throw;
     }
 
-    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
-
     if (fullscreen) {
         SDL_ShowCursor(SDL_DISABLE);
         SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN_DESKTOP);
@@ -73,14 +95,19 @@ SdlContext::SdlContext(int _width, int _height, unsigned int scale, bool fullscr
     want.freq = 48000;
     want.format = AUDIO_S16;
     want.channels = 2;
-    want.samples = 1600;
-    want.callback = nullptr; // nullptr for using a queue instead.
+    // A small device buffer keeps the latency down to roughly what's waiting in audio_buffer. It's no larger than
+    // the target latency, so low targets aren't swamped by it.
+    want.samples = 512;
+    while (want.samples > 64 && want.samples > target_fill) {
+        want.samples /= 2;
+    }
+    want.callback = AudioCallback;
+    want.userdata = this;
 
     audio_device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
 
     if (audio_device == 0) {
-        SDL_DestroyTexture(texture);
-        SDL_DestroyRenderer(renderer);
+        StopRenderThread();
         SDL_DestroyWindow(window);
         SDL_Quit();
         throw std::runtime_error(GetSdlErrorString("OpenAudioDevice"));
@@ -93,21 +120,231 @@ SdlContext::~SdlContext() {
         ToggleFullscreen();
     }
 
+    for (SDL_GameController* controller : controllers) {
+        SDL_GameControllerClose(controller);
+    }
+
     SDL_CloseAudioDevice(audio_device);
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
+    StopRenderThread();
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
 
-void SdlContext::RenderFrame(const u16* fb_ptr) noexcept {
-    SDL_LockTexture(texture, nullptr, &texture_pixels, &texture_pitch);
-    memcpy(texture_pixels, fb_ptr, width * height * sizeof(u16));
-    SDL_UnlockTexture(texture);
+void SdlContext::RenderFrame(const u16* fb_ptr, bool new_frame) noexcept {
+    using namespace std::chrono;
+    const double current_speed = CurrentSpeed();
+    const auto now = steady_clock::now();
+
+    // An unchanged frame isn't uploaded or presented again, unless the last new frame was skipped by fast forward.
+    unpresented_frame |= new_frame;
+
+    // Above full speed, frames are only presented as often as the display could show them.
+    const bool fast_forward = current_speed == unlimited_speed || current_speed > 1.0;
+    if (unpresented_frame && (!fast_forward || now - last_present_time >= frame_period)) {
+        last_present_time = now;
+        unpresented_frame = false;
+
+        // A frame the core drew into memory of ours is handed over as it is. Anything else, such as a run-ahead
+        // frame, is copied into a free frame first.
+        int frame = FrameIndex(fb_ptr);
+        if (frame == -1) {
+            // The core's front buffer is its own then, though it may still be drawing into the frame it was lent.
+            front_buffer = -1;
+            {
+                std::lock_guard<std::mutex> lock{render_mutex};
+                frame = FreeBuffer();
+            }
+            std::copy_n(fb_ptr, width * height, frame_pointers[frame]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{render_mutex};
+            ready_buffer.exchange(frame | new_frame_flag);
+        }
+        render_cv.notify_one();
+    }
+
+    chunk_samples_this_frame = 0;
+    if (current_speed == unlimited_speed) {
+        next_frame_time = now;
+        return;
+    }
+
+    const auto period = duration_cast<nanoseconds>(frame_period / current_speed);
+    if (now - next_frame_time > period) {
+        // We've fallen more than a frame behind (or just started), so don't try to catch up.
+        next_frame_time = now;
+    }
+
+    next_frame_time += period;
+    WaitUntil(next_frame_time);
+}
 
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-    SDL_RenderPresent(renderer);
+u16* SdlContext::NextFrameTarget(const u16* finished) noexcept {
+    std::lock_guard<std::mutex> lock{render_mutex};
+    // The frame lent last time is normally the finished one, unless a loaded state sent the core back to its own.
+    front_buffer = FrameIndex(finished);
+    lent_buffer = -1;
+    lent_buffer = FreeBuffer();
+    return frame_pointers[lent_buffer];
+}
+
+int SdlContext::FrameIndex(const u16* frame) const noexcept {
+    for (int i = 0; i < num_frames; ++i) {
+        if (frame_pointers[i] == frame) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SdlContext::FreeBuffer() const noexcept {
+    // At most three frames are ever held, so there's always one left.
+    const int ready = ready_buffer.load() & buffer_index_mask;
+    int i = 0;
+    while (i == lent_buffer || i == front_buffer || i == ready || i == read_buffer) {
+        ++i;
+    }
+    return i;
+}
+
+void SdlContext::WaitUntil(std::chrono::steady_clock::time_point deadline) const noexcept {
+    using namespace std::chrono;
+    if (thread_settings.low_power) {
+        std::this_thread::sleep_until(deadline);
+        return;
+    }
+
+    std::this_thread::sleep_until(deadline - spin_time);
+    while (steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+void SdlContext::RenderLoop(std::promise<void> init_done) noexcept {
+    ConfigureThread(thread_settings, ThreadRole::Render);
+
+    if (display_settings.opengl) {
+        try {
+            gl_presenter = std::make_unique<GlPresenter>(window, width, height, width == 240, display_settings);
+        } catch (const std::runtime_error&) {
+            init_done.set_exception(std::current_exception());
+            return;
+        }
+
+        // The emulator writes straight into the mapped pixel buffer when there is one.
+        for (int i = 0; i < GlPresenter::num_frames; ++i) {
+            if (gl_presenter->MappedFrame(i) != nullptr) {
+                frame_pointers[i] = gl_presenter->MappedFrame(i);
+            }
+        }
+    } else if (!CreateRenderer(init_done)) {
+        return;
+    }
+
+    init_done.set_value();
+
+    while (true) {
+        if (gl_presenter != nullptr) {
+            // The read frame goes back to the emulator on the next swap, so the GPU must be done with it.
+            gl_presenter->ReleaseFrame(read_buffer);
+        }
+
+        bool new_frame;
+        {
+            std::unique_lock<std::mutex> lock{render_mutex};
+            render_cv.wait(lock, [this] {
+                return quit_render || redraw || (ready_buffer.load() & new_frame_flag);
+            });
+            if (quit_render) {
+                break;
+            }
+
+            new_frame = ready_buffer.load() & new_frame_flag;
+            if (new_frame) {
+                read_buffer = ready_buffer.exchange(read_buffer) & buffer_index_mask;
+            }
+            redraw = false;
+        }
+
+        if (gl_presenter != nullptr) {
+            gl_presenter->Present(read_buffer, frame_pointers[read_buffer]);
+            continue;
+        }
+
+        if (!new_frame) {
+            // The window only needs redrawing, and the texture still holds the current frame.
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            SDL_RenderPresent(renderer);
+            continue;
+        }
+
+        const u16* frame = cpu_filter->Process(frame_pointers[read_buffer]);
+        const int frame_width = cpu_filter->OutputWidth();
+        const int frame_height = cpu_filter->OutputHeight();
+
+        SDL_LockTexture(texture, nullptr, &texture_pixels, &texture_pitch);
+        if (texture_pitch == frame_width * static_cast<int>(sizeof(u16))) {
+            std::memcpy(texture_pixels, frame, frame_width * frame_height * sizeof(u16));
+        } else {
+            // Rows of the texture can be padded, in which case the frame has to be copied a row at a time.
+            for (int y = 0; y < frame_height; ++y) {
+                std::memcpy(static_cast<u8*>(texture_pixels) + y * texture_pitch,
+                            frame + y * frame_width, frame_width * sizeof(u16));
+            }
+        }
+        SDL_UnlockTexture(texture);
+
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+
+    if (gl_presenter != nullptr) {
+        gl_presenter.reset();
+    } else {
+        SDL_DestroyTexture(texture);
+        SDL_DestroyRenderer(renderer);
+    }
+}
+
+bool SdlContext::CreateRenderer(std::promise<void>& init_done) noexcept {
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == nullptr) {
+        init_done.set_exception(std::make_exception_ptr(std::runtime_error(GetSdlErrorString("CreateRenderer"))));
+        return false;
+    }
+
+    // The logical size stays at the console's resolution, so a CPU-scaled frame is still only shown at whole
+    // multiples of it.
+    SDL_RenderSetLogicalSize(renderer, width, height);
+    SDL_RenderSetIntegerScale(renderer, SDL_TRUE);
+
+    cpu_filter = std::make_unique<CpuFilter>(width, height, display_settings);
+
+    texture = SDL_CreateTexture(renderer,
+                                SDL_PIXELFORMAT_ABGR1555,
+                                SDL_TEXTUREACCESS_STREAMING,
+                                cpu_filter->OutputWidth(),
+                                cpu_filter->OutputHeight());
+    if (texture == nullptr) {
+        SDL_DestroyRenderer(renderer);
+        init_done.set_exception(std::make_exception_ptr(std::runtime_error(GetSdlErrorString("CreateTexture"))));
+        return false;
+    }
+
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+    return true;
+}
+
+void SdlContext::StopRenderThread() noexcept {
+    {
+        std::lock_guard<std::mutex> lock{render_mutex};
+        quit_render = true;
+    }
+    render_cv.notify_one();
+    render_thread.join();
 }
 
 void SdlContext::ToggleFullscreen() noexcept {
@@ -128,7 +365,75 @@ void SdlContext::ToggleFullscreen() noexcept {
 }
 
 void SdlContext::PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept {
-    SDL_QueueAudio(audio_device, sample_buffer.data(), sample_buffer.size() * sizeof(s16));
+    QueueAudio(sample_buffer.data(), frame_samples);
+}
+
+void SdlContext::PushBackAudioChunk(const s16* samples, int count) noexcept {
+    QueueAudio(samples, count);
+
+    if (CurrentSpeed() != 1.0) {
+        return;
+    }
+
+    // Wait until the chunk's share of the frame has passed. If the emulator has fallen more than a frame behind,
+    // RenderFrame will start over from now, so there's nothing to wait for.
+    using namespace std::chrono;
+    chunk_samples_this_frame = std::min(chunk_samples_this_frame + count, frame_samples);
+    if (steady_clock::now() - next_frame_time < frame_period) {
+        WaitUntil(next_frame_time + frame_period * chunk_samples_this_frame / frame_samples);
+    }
+}
+
+void SdlContext::QueueAudio(const s16* samples, int count) noexcept {
+    if (CurrentSpeed() != 1.0) {
+        // Audio is muted away from full speed, rather than letting the queue overflow or run dry.
+        return;
+    }
+
+    // Nudge the resampling ratio to steer the fill level towards the target latency. The adjustment is small
+    // enough that the pitch change can't be heard.
+    const double fill_error = (static_cast<double>(target_fill) - static_cast<double>(AudioFillLevel()))
+                              / std::max<std::size_t>(target_fill, 1);
+    const double rate_delta = std::clamp(fill_error, -1.0, 1.0) * max_rate_delta;
+    const double step = 1.0 / (1.0 + rate_delta);
+
+    // Linearly interpolate, using the last sample of the previous frame or chunk as the sample before this one's
+    // first. The position carries over, so chunks resample the same as whole frames.
+    int output_samples = 0;
+    for (; resample_position <= count - 1; resample_position += step, ++output_samples) {
+        const int index = static_cast<int>(std::floor(resample_position));
+        const double fraction = resample_position - index;
+
+        for (int c = 0; c < 2; ++c) {
+            const s16 prev = (index < 0) ? last_sample[c] : samples[index * 2 + c];
+            const s16 next = samples[std::min(index + 1, count - 1) * 2 + c];
+            resampled_buffer[output_samples * 2 + c] = static_cast<s16>(std::lround(prev + (next - prev) * fraction));
+        }
+    }
+
+    resample_position -= count;
+    last_sample = {samples[(count - 1) * 2], samples[(count - 1) * 2 + 1]};
+
+    // If the buffer is full, the rest of the frame is dropped.
+    audio_buffer.PushBack(resampled_buffer.data(), output_samples * 2);
+}
+
+void SdlContext::AudioCallback(void* userdata, u8* stream, int len) noexcept {
+    auto& sdl_context = *static_cast<SdlContext*>(userdata);
+    if (!sdl_context.audio_thread_configured) {
+        ConfigureThread(sdl_context.thread_settings, ThreadRole::Audio);
+        sdl_context.audio_thread_configured = true;
+    }
+
+    s16* samples = reinterpret_cast<s16*>(stream);
+    const std::size_t num_samples = len / sizeof(s16);
+
+    // Play silence if the emulator falls behind.
+    const std::size_t popped = sdl_context.audio_buffer.PopFront(samples, num_samples);
+    std::memset(samples + popped, 0, (num_samples - popped) * sizeof(s16));
+    if (popped != num_samples) {
+        ++sdl_context.audio_underruns;
+    }
 }
 
 void SdlContext::UnpauseAudio() noexcept {
@@ -140,139 +445,208 @@ void SdlContext::PauseAudio() noexcept {
 }
 
 void SdlContext::RegisterCallback(InputEvent event, std::function<void(bool)> callback) {
-    input_callbacks.insert({event, callback});
+    input_callbacks[static_cast<int>(event)] = std::move(callback);
 }
 
-void SdlContext::UpdateFrameTimes(float avg_time_us, float max_time_us) {
-    SDL_SetWindowTitle(window, fmt::format("Chroma - avg {:0>4.1f}ms - max {:0>4.1f}ms",
-                                           avg_time_us / 1000, max_time_us / 1000).data());
+void SdlContext::UpdateFrameTimes(float avg_time_us, float max_time_us, const std::string& extra_info) {
+    // The cores report once every 60 frames, which is one second of emulated time.
+    using namespace std::chrono;
+    const auto now = steady_clock::now();
+    const double elapsed = duration<double>(now - last_report_time).count();
+    const double achieved_speed = 1.0 / elapsed;
+    last_report_time = now;
+
+    // As a share of one host CPU, so it can go over 100% with the render and audio threads.
+    const double cpu_seconds = ProcessCpuSeconds();
+    const double cpu_usage = (cpu_seconds - last_report_cpu_seconds) / elapsed * 100.0;
+    last_report_cpu_seconds = cpu_seconds;
+
+    SDL_SetWindowTitle(window, fmt::format("Chroma - avg {:0>4.1f}ms - max {:0>4.1f}ms - {:.2f}x - cpu {:.0f}%{}",
+                                           avg_time_us / 1000, max_time_us / 1000, achieved_speed, cpu_usage,
+                                           extra_info).data());
+}
+
+void SdlContext::StepSpeed(bool faster) {
+    if (faster) {
+        if (speed == unlimited_speed) {
+            return;
+        }
+        const auto next = std::find_if(speed_steps.cbegin(), speed_steps.cend(), [this](double step) {
+            return step > speed || step == unlimited_speed;
+        });
+        speed = *next;
+    } else {
+        if (speed == unlimited_speed) {
+            speed = speed_steps[speed_steps.size() - 2];
+        } else {
+            const auto prev = std::find_if(speed_steps.crbegin(), speed_steps.crend(), [this](double step) {
+                return step < speed && step != unlimited_speed;
+            });
+            if (prev != speed_steps.crend()) {
+                speed = *prev;
+            }
+        }
+    }
+
+    if (speed == unlimited_speed) {
+        fmt::print("Speed changed to unlimited\n");
+    } else {
+        fmt::print("Speed changed to {}x\n", speed);
+    }
 }
 
 void SdlContext::PollEvents() {
+    for (const SDL_Event& e : deferred_events) {
+        HandleEvent(e);
+    }
+    deferred_events.clear();
+
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
-        if (e.type == SDL_QUIT) {
-            input_callbacks[InputEvent::Quit](true);
-        } else if (e.type == SDL_KEYDOWN) {
-            if (e.key.repeat != 0) {
-                continue;
-            }
+        HandleEvent(e);
+    }
+}
+
+void SdlContext::LatchInput() {
+    if (thread_settings.low_power && std::chrono::steady_clock::now() - last_input_time > idle_input_delay) {
+        // The next press is picked up by PollEvents at the end of the frame, which starts polling here again.
+        return;
+    }
 
-            switch (e.key.keysym.sym) {
-            case SDLK_q:
-                if (SDL_GetModState() & KMOD_CTRL) {
-                    input_callbacks[InputEvent::Quit](true);
+    SDL_PumpEvents();
+
+    // Keyboard and controller button events are taken from the queue separately, which can only reorder presses
+    // that arrived within the same poll.
+    constexpr std::array<std::pair<u32, u32>, 2> event_ranges{{{SDL_KEYDOWN, SDL_KEYUP},
+                                                               {SDL_CONTROLLERBUTTONDOWN, SDL_CONTROLLERBUTTONUP}}};
+    std::array<SDL_Event, 16> events;
+    for (const auto& range : event_ranges) {
+        int count;
+        while ((count = SDL_PeepEvents(events.data(), events.size(), SDL_GETEVENT, range.first, range.second)) > 0) {
+            for (int i = 0; i < count; ++i) {
+                if (IsButtonEvent(events[i])) {
+                    HandleEvent(events[i]);
+                } else {
+                    // Commands like loading a state can't happen in the middle of a frame.
+                    deferred_events.push_back(events[i]);
                 }
-                break;
-            case SDLK_p:
-                input_callbacks[InputEvent::Pause](true);
-                break;
-            case SDLK_b:
-                input_callbacks[InputEvent::LogLevel](true);
-                break;
-            case SDLK_v:
-                input_callbacks[InputEvent::Fullscreen](true);
-                break;
-            case SDLK_t:
-                input_callbacks[InputEvent::Screenshot](true);
-                break;
-            case SDLK_y:
-                input_callbacks[InputEvent::LcdDebug](true);
-                break;
-            case SDLK_n:
-                input_callbacks[InputEvent::FrameAdvance](true);
-                break;
+            }
+        }
+    }
+}
 
-            case SDLK_w:
-                input_callbacks[InputEvent::Up](true);
-                break;
-            case SDLK_a:
-                input_callbacks[InputEvent::Left](true);
-                break;
-            case SDLK_s:
-                input_callbacks[InputEvent::Down](true);
-                break;
-            case SDLK_d:
-                input_callbacks[InputEvent::Right](true);
-                break;
+bool SdlContext::IsButtonEvent(const SDL_Event& e) const {
+    if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) {
+        return InputBindings::Button(bindings.KeyAction(e.key.keysym.scancode));
+    } else {
+        return InputBindings::Button(bindings.ButtonAction(e.cbutton.button));
+    }
+}
 
-            case SDLK_k:
-                input_callbacks[InputEvent::A](true);
-                break;
-            case SDLK_j:
-                input_callbacks[InputEvent::B](true);
-                break;
-            case SDLK_h:
-                input_callbacks[InputEvent::L](true);
-                break;
-            case SDLK_l:
-                input_callbacks[InputEvent::R](true);
-                break;
+void SdlContext::HandleEvent(const SDL_Event& e) {
+    switch (e.type) {
+    case SDL_QUIT:
+        Trigger(InputEvent::Quit, true);
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+        // Held keys repeat, but the repeats don't change anything.
+        if (e.key.repeat != 0) {
+            break;
+        }
 
-            case SDLK_RETURN:
-            case SDLK_i:
-                input_callbacks[InputEvent::Start](true);
-                break;
-            case SDLK_u:
-                input_callbacks[InputEvent::Select](true);
-                break;
-            default:
-                break;
+        const int action = bindings.KeyAction(e.key.keysym.scancode);
+        // Quitting from the keyboard needs Ctrl as well, so it isn't hit by accident. The modifiers are taken from the
+        // event, as a deferred event can be handled after Ctrl has already been released.
+        if (action == static_cast<int>(InputEvent::Quit) && !(e.key.keysym.mod & KMOD_CTRL)) {
+            break;
+        }
+
+        ActionInput(action, e.type == SDL_KEYDOWN);
+        break;
+    }
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        ActionInput(bindings.ButtonAction(e.cbutton.button), e.type == SDL_CONTROLLERBUTTONDOWN);
+        break;
+    case SDL_CONTROLLERDEVICEADDED:
+        // Controllers which are already connected at startup are added too.
+        if (SDL_GameController* controller = SDL_GameControllerOpen(e.cdevice.which)) {
+            controllers.push_back(controller);
+        }
+        break;
+    case SDL_CONTROLLERDEVICEREMOVED: {
+        const auto it = std::find(controllers.begin(), controllers.end(),
+                                  SDL_GameControllerFromInstanceID(e.cdevice.which));
+        if (it != controllers.end()) {
+            SDL_GameControllerClose(*it);
+            controllers.erase(it);
+        }
+        break;
+    }
+    case SDL_WINDOWEVENT:
+        switch (e.window.event) {
+        case SDL_WINDOWEVENT_HIDDEN:
+        case SDL_WINDOWEVENT_MINIMIZED:
+            // Some window managers send both, but the cores must only be told once.
+            if (!window_hidden) {
+                window_hidden = true;
+                Trigger(InputEvent::HideWindow, true);
+            }
+            break;
+        case SDL_WINDOWEVENT_SHOWN:
+        case SDL_WINDOWEVENT_RESTORED:
+            if (window_hidden) {
+                window_hidden = false;
+                Trigger(InputEvent::ShowWindow, true);
             }
-        } else if (e.type == SDL_KEYUP) {
-            if (e.key.repeat != 0) {
-                continue;
+            break;
+        case SDL_WINDOWEVENT_EXPOSED:
+        case SDL_WINDOWEVENT_SIZE_CHANGED:
+            // Frames are only presented when they change, so the window has to be redrawn by hand.
+            {
+                std::lock_guard<std::mutex> lock{render_mutex};
+                redraw = true;
             }
+            render_cv.notify_one();
+            break;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+}
 
-            switch (e.key.keysym.sym) {
-            case SDLK_w:
-                input_callbacks[InputEvent::Up](false);
-                break;
-            case SDLK_a:
-                input_callbacks[InputEvent::Left](false);
-                break;
-            case SDLK_s:
-                input_callbacks[InputEvent::Down](false);
-                break;
-            case SDLK_d:
-                input_callbacks[InputEvent::Right](false);
-                break;
+void SdlContext::ActionInput(int action, bool pressed) {
+    if (action == InputBindings::none) {
+        return;
+    }
 
-            case SDLK_k:
-                input_callbacks[InputEvent::A](false);
-                break;
-            case SDLK_j:
-                input_callbacks[InputEvent::B](false);
-                break;
-            case SDLK_h:
-                input_callbacks[InputEvent::L](false);
-                break;
-            case SDLK_l:
-                input_callbacks[InputEvent::R](false);
-                break;
+    last_input_time = std::chrono::steady_clock::now();
 
-            case SDLK_RETURN:
-            case SDLK_i:
-                input_callbacks[InputEvent::Start](false);
-                break;
-            case SDLK_u:
-                input_callbacks[InputEvent::Select](false);
-                break;
-            default:
-                break;
-            }
-        } else if (e.type == SDL_WINDOWEVENT) {
-            switch (e.window.event) {
-            case SDL_WINDOWEVENT_HIDDEN:
-                input_callbacks[InputEvent::HideWindow](true);
-                break;
-            case SDL_WINDOWEVENT_SHOWN:
-                input_callbacks[InputEvent::ShowWindow](true);
-                break;
-            default:
-                break;
-            }
+    u8& held = held_inputs[action];
+    if (pressed) {
+        if (held++ != 0) {
+            return;
+        }
+    } else {
+        // A release can arrive without its press, e.g. for a key that was already down when the window appeared.
+        if (held == 0 || --held != 0) {
+            return;
+        }
+    }
+
+    if (action == InputBindings::turbo) {
+        turbo_held = pressed;
+    } else if (action == InputBindings::slower || action == InputBindings::faster) {
+        if (pressed) {
+            StepSpeed(action == InputBindings::faster);
         }
+    } else if (pressed || InputBindings::Held(action)) {
+        // Commands only happen when they're pressed, but buttons and rewind have to know when they're released.
+        input_callbacks[action](pressed);
     }
 }
 
@@ -18,50 +18,57 @@
 
 #include <string>
 #include <array>
-#include <unordered_map>
+#include <vector>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <SDL.h>
 
 #include "common/CommonTypes.h"
+#include "common/RingBuffer.h"
+#include "emu/CpuFilter.h"
+#include "emu/Frontend.h"
+#include "emu/GlPresenter.h"
+#include "emu/InputBindings.h"
+#include "emu/ThreadSettings.h"
 
 namespace Emu {
 
-enum class InputEvent {Quit,
-                       Pause,
-                       LogLevel,
-                       Fullscreen,
-                       Screenshot,
-                       LcdDebug,
-                       HideWindow,
-                       ShowWindow,
-                       FrameAdvance,
-                       Up,
-                       Left,
-                       Down,
-                       Right,
-                       A,
-                       B,
-                       L,
-                       R,
-                       Start,
-                       Select};
-
-class SdlContext {
+class SdlContext : public Frontend {
 public:
-    SdlContext(int _width, int _height, unsigned int scale, bool fullscreen);
+    static constexpr double unlimited_speed = 0.0;
+    static constexpr double max_speed = 8.0;
+
+    // Throws std::runtime_error if SDL can't be initialized or the bindings file is invalid.
+    SdlContext(int _width, int _height, unsigned int scale, bool fullscreen, unsigned int audio_latency_ms,
+               double _speed, const DisplaySettings& _display_settings, const ThreadSettings& _thread_settings,
+               const std::string& bindings_path, int _audio_chunk_samples);
     ~SdlContext();
 
-    void RenderFrame(const u16* fb_ptr) noexcept;
-    void ToggleFullscreen() noexcept;
+    void RenderFrame(const u16* fb_ptr, bool new_frame) noexcept override;
+    u16* NextFrameTarget(const u16* finished) noexcept override;
+    void ToggleFullscreen() noexcept override;
 
-    void PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept;
-    void UnpauseAudio() noexcept;
-    void PauseAudio() noexcept;
+    void PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept override;
+    int AudioChunkSamples() const noexcept override { return audio_chunk_samples; }
+    void PushBackAudioChunk(const s16* samples, int count) noexcept override;
+    void UnpauseAudio() noexcept override;
+    void PauseAudio() noexcept override;
+    // The number of stereo samples waiting to be played.
+    std::size_t AudioFillLevel() const noexcept { return audio_buffer.Size() / 2; }
+    u64 AudioUnderruns() const noexcept override { return audio_underruns; }
 
-    void RegisterCallback(InputEvent event, std::function<void(bool)> callback);
-    void PollEvents();
+    void RegisterCallback(InputEvent event, std::function<void(bool)> callback) override;
+    void PollEvents() override;
+    void LatchInput() override;
+    void WaitForEvents() noexcept override { SDL_WaitEvent(nullptr); }
 
-    void UpdateFrameTimes(float avg_frame_time, float max_frame_time);
+    void UpdateFrameTimes(float avg_frame_time, float max_frame_time, const std::string& extra_info) override;
 
 private:
     SDL_Window* window;
@@ -75,7 +82,112 @@ private:
     int texture_pitch;
     void* texture_pixels;
 
-    std::unordered_map<InputEvent, std::function<void(bool)>> input_callbacks;
+    const ThreadSettings thread_settings;
+    // Only present when presenting through OpenGL, in which case the renderer and texture aren't created.
+    const DisplaySettings display_settings;
+    std::unique_ptr<GlPresenter> gl_presenter;
+    // Otherwise, frames are blended and scaled by this on the render thread before they're uploaded to the texture.
+    std::unique_ptr<CpuFilter> cpu_filter;
+
+    // Frames are handed to the render thread through the ready buffer, so neither thread ever waits on the other.
+    // The emulator swaps each new frame into the ready buffer, and the render thread swaps the ready buffer with its
+    // read buffer whenever there's a new frame in it. The core draws straight into the frames: one holds its front
+    // buffer, which may also be the ready or read buffer, and another is lent to it to draw the next frame into.
+    // Frames the core didn't draw are copied into whichever frame is free.
+    static constexpr int num_frames = GlPresenter::num_frames;
+    std::array<std::vector<u16>, num_frames> frame_buffers;
+    // Where each frame is actually kept, which is in GPU-visible memory if the GL presenter has it.
+    std::array<u16*, num_frames> frame_pointers;
+    // The frames held by the core, or -1. Only touched by the emulator thread.
+    int lent_buffer = -1;
+    int front_buffer = -1;
+    // Only changed while holding the render mutex.
+    int read_buffer = 1;
+    std::atomic<int> ready_buffer{2};
+    static constexpr int buffer_index_mask = 0x3;
+    static constexpr int new_frame_flag = 0x4;
+
+    int FrameIndex(const u16* frame) const noexcept;
+    // A frame nobody else holds. Must be called with the render mutex held.
+    int FreeBuffer() const noexcept;
+
+    std::thread render_thread;
+    std::mutex render_mutex;
+    std::condition_variable render_cv;
+    bool quit_render = false;
+    // Set when the window needs presenting again without a new frame, e.g. after being uncovered.
+    bool redraw = false;
+    // Only touched by the emulator thread.
+    bool unpresented_frame = true;
+    bool window_hidden = false;
+
+    // Presenting doesn't block the emulator until vblank, so the emulator paces itself against steady_clock
+    // deadlines instead. Each frame of the emulator loop covers 279680 GBA cycles (or 69920 GB cycles, which is the
+    // same length of time), so pacing to that length runs the console at its real clock speed and real ~59.73Hz
+    // refresh rate, whatever the display's refresh rate is. The audio rate control absorbs the difference between
+    // this and the 800 samples of audio per frame.
+    static constexpr std::chrono::nanoseconds frame_period{279680LL * 1'000'000'000 / 16777216};
+    // Sleeps are typically only accurate to a millisecond or so, so the end of each wait is spent spinning.
+    static constexpr std::chrono::microseconds spin_time{1500};
+    std::chrono::steady_clock::time_point next_frame_time;
+    std::chrono::steady_clock::time_point last_present_time;
+    std::chrono::steady_clock::time_point last_report_time;
+    double last_report_cpu_seconds = 0.0;
+
+    // The emulation speed as a multiple of real time, where 0 means as fast as possible. Holding the turbo key
+    // runs as fast as possible regardless, and the speed keys step through speed_steps.
+    static constexpr std::array<double, 6> speed_steps{{0.25, 0.5, 1.0, 2.0, 4.0, unlimited_speed}};
+    double speed;
+    bool turbo_held = false;
+
+    double CurrentSpeed() const noexcept { return turbo_held ? unlimited_speed : speed; }
+    void WaitUntil(std::chrono::steady_clock::time_point deadline) const noexcept;
+    void StepSpeed(bool faster);
+
+    void RenderLoop(std::promise<void> init_done) noexcept;
+    bool CreateRenderer(std::promise<void>& init_done) noexcept;
+    void StopRenderThread() noexcept;
+
+    std::array<std::function<void(bool)>, input_event_count> input_callbacks;
+    InputBindings bindings;
+    std::vector<SDL_GameController*> controllers;
+    // How many keys and controller buttons are holding down each action. Actions only fire when the first is
+    // pressed and the last is released, so holding the same action on two inputs doesn't repeat it.
+    std::array<u8, InputBindings::num_actions> held_inputs{};
+    // Key and controller button events taken from the queue by LatchInput which weren't for buttons.
+    std::vector<SDL_Event> deferred_events;
+    // In low power mode, buttons are only polled between frames once none have been pressed for this long.
+    static constexpr std::chrono::seconds idle_input_delay{10};
+    std::chrono::steady_clock::time_point last_input_time;
+
+    void HandleEvent(const SDL_Event& e);
+    void ActionInput(int action, bool pressed);
+    bool IsButtonEvent(const SDL_Event& e) const;
+    void Trigger(InputEvent event, bool pressed) { input_callbacks[static_cast<int>(event)](pressed); }
+
+    static constexpr int sample_rate = 48000;
+    static constexpr int frame_samples = 800;
+    // The largest resampling ratio adjustment, as a fraction of the frame length.
+    static constexpr double max_rate_delta = 0.005;
+
+    Common::SpscRingBuffer<s16, 16384> audio_buffer;
+    const std::size_t target_fill;
+
+    // With chunks, the queue only has to cover one chunk rather than a whole frame, so the target latency can be
+    // below a frame. The emulator is paced to each chunk's share of the frame as it's sent.
+    const int audio_chunk_samples;
+    int chunk_samples_this_frame = 0;
+
+    std::array<s16, (frame_samples + 8) * 2> resampled_buffer{};
+    std::array<s16, 2> last_sample{};
+    // Where the next resampled sample falls, counting from the last input sample, which is at -1.
+    double resample_position = 0.0;
+    void QueueAudio(const s16* samples, int count) noexcept;
+
+    // SDL starts the audio thread itself, so it's configured on its first callback. Only touched by that thread.
+    bool audio_thread_configured = false;
+    std::atomic<u64> audio_underruns{0};
+    static void AudioCallback(void* userdata, u8* stream, int len) noexcept;
 
     bool FullscreenEnabled() const noexcept { return SDL_GetWindowFlags(window) & SDL_WINDOW_FULLSCREEN_DESKTOP; }
     static const std::string GetSdlErrorString(const std::string& error_function) {
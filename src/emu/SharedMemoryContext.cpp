@@ -0,0 +1,252 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "emu/SharedMemoryContext.h"
+
+namespace Emu {
+
+namespace {
+
+static_assert(std::atomic<u32>::is_always_lock_free && std::atomic<u64>::is_always_lock_free,
+              "The shared memory segment needs lock-free atomics to be shared between processes.");
+
+std::atomic<bool> interrupted{false};
+
+void HandleInterrupt(int) {
+    interrupted = true;
+}
+
+#if defined(__linux__)
+
+// The segment is shared between processes, so these can't use the private futex operations.
+void FutexWait(std::atomic<u32>& word, u32 expected) {
+    // Wake up now and then regardless, so an interrupt is never missed.
+    const timespec timeout{0, 50'000'000};
+    syscall(SYS_futex, reinterpret_cast<u32*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void FutexWake(std::atomic<u32>& word) {
+    syscall(SYS_futex, reinterpret_cast<u32*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+#else
+
+void FutexWait(std::atomic<u32>&, u32) {
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+}
+
+void FutexWake(std::atomic<u32>&) {}
+
+#endif
+
+} // End anonymous namespace
+
+#if defined(_WIN32)
+
+const SharedFrameSegment* MapSegmentForReading(const std::string&) {
+    return nullptr;
+}
+
+void UnmapSegment(const SharedFrameSegment*) {}
+
+SharedMemoryContext::SharedMemoryContext(const std::string& _name, int width, int height)
+        : name(_name)
+        , frame_pixels(width * height) {
+    throw std::runtime_error("Shared memory output is not supported on Windows.");
+}
+
+SharedMemoryContext::~SharedMemoryContext() = default;
+
+#else
+
+namespace {
+
+std::string SegmentPath(const std::string& name) {
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+} // End anonymous namespace
+
+const SharedFrameSegment* MapSegmentForReading(const std::string& name) {
+    const int fd = shm_open(SegmentPath(name).c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    struct stat segment_stat;
+    if (fstat(fd, &segment_stat) != 0 || static_cast<std::size_t>(segment_stat.st_size) < sizeof(SharedFrameSegment)) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, sizeof(SharedFrameSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return (ptr == MAP_FAILED) ? nullptr : static_cast<const SharedFrameSegment*>(ptr);
+}
+
+void UnmapSegment(const SharedFrameSegment* segment) {
+    munmap(const_cast<SharedFrameSegment*>(segment), sizeof(SharedFrameSegment));
+}
+
+SharedMemoryContext::SharedMemoryContext(const std::string& _name, int width, int height)
+        : name(SegmentPath(_name))
+        , frame_pixels(width * height) {
+
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        throw std::runtime_error("Could not open the shared memory segment " + name + ".");
+    }
+
+    struct stat segment_stat;
+    if (fstat(fd, &segment_stat) != 0
+            || (static_cast<std::size_t>(segment_stat.st_size) < sizeof(SharedFrameSegment)
+                && ftruncate(fd, sizeof(SharedFrameSegment)) != 0)) {
+        close(fd);
+        throw std::runtime_error("Could not grow the shared memory segment " + name + " to fit the frame.");
+    }
+
+    void* ptr = mmap(nullptr, sizeof(SharedFrameSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("Could not map the shared memory segment " + name + ".");
+    }
+
+    // A harness may have created the segment first and set its own fields, which are kept. Anything else in the
+    // segment is thrown away.
+    segment = static_cast<SharedFrameSegment*>(ptr);
+    if (segment->magic.load(std::memory_order_acquire) != SharedFrameSegment::magic_value
+            || segment->version != SharedFrameSegment::version_value) {
+        std::memset(ptr, 0, sizeof(SharedFrameSegment));
+    }
+
+    segment->version = SharedFrameSegment::version_value;
+    segment->width = width;
+    segment->height = height;
+    segment->frame_sequence.store(0, std::memory_order_relaxed);
+    segment->frame_count.store(0, std::memory_order_relaxed);
+    segment->exited.store(0, std::memory_order_relaxed);
+    segment->frame.fill(0x7FFF);
+    segment->audio_written.store(0, std::memory_order_relaxed);
+    segment->magic.store(SharedFrameSegment::magic_value, std::memory_order_release);
+
+    std::signal(SIGINT, HandleInterrupt);
+    std::signal(SIGTERM, HandleInterrupt);
+}
+
+SharedMemoryContext::~SharedMemoryContext() {
+    segment->exited.store(1, std::memory_order_release);
+    FutexWake(segment->frame_count);
+    munmap(segment, sizeof(SharedFrameSegment));
+}
+
+#endif
+
+void SharedMemoryContext::RenderFrame(const u16* fb_ptr, bool new_frame) noexcept {
+    if (new_frame) {
+        const u32 sequence = segment->frame_sequence.load(std::memory_order_relaxed);
+        segment->frame_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::copy_n(fb_ptr, frame_pixels, segment->frame.data());
+        segment->frame_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    segment->frame_count.fetch_add(1, std::memory_order_release);
+    FutexWake(segment->frame_count);
+
+    WaitForRunUntil();
+}
+
+void SharedMemoryContext::WaitForRunUntil() noexcept {
+    while (segment->lockstep.load(std::memory_order_acquire) != 0 && !interrupted
+           && segment->quit.load(std::memory_order_relaxed) == 0) {
+        const u32 run_until = segment->run_until.load(std::memory_order_acquire);
+        const u32 frame_count = segment->frame_count.load(std::memory_order_relaxed);
+        if (static_cast<s32>(run_until - frame_count) > 0) {
+            return;
+        }
+
+        FutexWait(segment->run_until, run_until);
+    }
+}
+
+void SharedMemoryContext::PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept {
+    const u64 written = segment->audio_written.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < sample_buffer.size() / 2; ++i) {
+        const std::size_t slot = ((written + i) % SharedFrameSegment::audio_ring_samples) * 2;
+        segment->audio[slot] = sample_buffer[i * 2];
+        segment->audio[slot + 1] = sample_buffer[i * 2 + 1];
+    }
+
+    segment->audio_written.store(written + sample_buffer.size() / 2, std::memory_order_release);
+}
+
+void SharedMemoryContext::RegisterCallback(InputEvent event, std::function<void(bool)> callback) {
+    input_callbacks[static_cast<int>(event)] = std::move(callback);
+}
+
+void SharedMemoryContext::PollEvents() {
+    if (interrupted || segment->quit.load(std::memory_order_relaxed) != 0) {
+        input_callbacks[static_cast<int>(InputEvent::Quit)](true);
+    }
+
+    UpdateButtons();
+}
+
+void SharedMemoryContext::LatchInput() {
+    UpdateButtons();
+}
+
+void SharedMemoryContext::UpdateButtons() {
+    const u32 buttons = segment->buttons.load(std::memory_order_acquire) & ((1 << button_count) - 1);
+    const u32 changed = buttons ^ held_buttons;
+    for (int i = 0; i < button_count; ++i) {
+        if (changed & (1 << i)) {
+            input_callbacks[static_cast<int>(ButtonFromIndex(i))]((buttons >> i) & 0x1);
+        }
+    }
+
+    held_buttons = buttons;
+}
+
+void SharedMemoryContext::WaitForEvents() noexcept {
+    // Nothing in the segment can unpause the emulator, so this only needs to notice an interrupt or a quit.
+    std::this_thread::sleep_for(std::chrono::milliseconds{16});
+}
+
+} // End namespace Emu
@@ -0,0 +1,109 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <string>
+#include <array>
+#include <atomic>
+#include <functional>
+
+#include "common/CommonTypes.h"
+#include "emu/Frontend.h"
+
+namespace Emu {
+
+// The layout of the shared memory segment, for harnesses in other processes to map. Every field is written by
+// only one side: the emulator owns everything up to the audio ring, and the harness owns the rest.
+//
+// The frame is published with a seqlock: frame_sequence is odd while the frame is being written. A reader copies
+// the frame out, and keeps the copy if frame_sequence was even and unchanged before and after. frame_count goes up
+// by one after every emulated frame, and on Linux it's also a futex which is woken each time.
+//
+// Audio is a ring of stereo samples, with audio_written counting every stereo sample ever written. Sample n is at
+// audio[(n % audio_ring_samples) * 2]. A reader more than a ring behind has lost the difference.
+//
+// The harness sets buttons as a bitmask in ButtonIndex order, which the emulator reads at the start of each frame
+// and partway through it. Setting quit stops the emulator. With lockstep set, the emulator waits after each frame
+// until the frame count is less than run_until, which is also a futex on Linux. Both counters wrap, so they're
+// compared by their difference. When the emulator exits, it sets exited and wakes frame_count.
+struct SharedFrameSegment {
+    static constexpr u32 magic_value = 0x4D524843; // "CHRM"
+    static constexpr u32 version_value = 1;
+    static constexpr int max_pixels = 240 * 160;
+    static constexpr int audio_ring_samples = 8192;
+
+    std::atomic<u32> magic;
+    u32 version;
+    u32 width;
+    u32 height;
+
+    std::atomic<u32> frame_sequence;
+    std::atomic<u32> frame_count;
+    std::atomic<u32> exited;
+    std::array<u16, max_pixels> frame;
+
+    std::atomic<u64> audio_written;
+    std::array<s16, audio_ring_samples * 2> audio;
+
+    std::atomic<u32> buttons;
+    std::atomic<u32> quit;
+    std::atomic<u32> lockstep;
+    std::atomic<u32> run_until;
+};
+
+// Maps an existing segment read-only, for watching an emulator without driving it. Returns nullptr if the segment
+// doesn't exist yet or is too small to be one. Always returns nullptr on Windows.
+const SharedFrameSegment* MapSegmentForReading(const std::string& name);
+void UnmapSegment(const SharedFrameSegment* segment);
+
+// A frontend with no window and no audio device, which publishes frames and audio to a POSIX shared memory segment
+// and takes its input from the same segment. The segment is created if it doesn't exist, and left in place on exit
+// so the harness can read the last frame; removing it is up to the harness.
+class SharedMemoryContext : public Frontend {
+public:
+    // Throws std::runtime_error if the segment can't be created or mapped.
+    SharedMemoryContext(const std::string& _name, int width, int height);
+    ~SharedMemoryContext();
+
+    void RenderFrame(const u16* fb_ptr, bool new_frame) noexcept override;
+    void ToggleFullscreen() noexcept override {}
+
+    void PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept override;
+    void UnpauseAudio() noexcept override {}
+    void PauseAudio() noexcept override {}
+
+    void RegisterCallback(InputEvent event, std::function<void(bool)> callback) override;
+    void PollEvents() override;
+    void LatchInput() override;
+    void WaitForEvents() noexcept override;
+
+    void UpdateFrameTimes(float, float, const std::string&) override {}
+
+private:
+    const std::string name;
+    SharedFrameSegment* segment = nullptr;
+    int frame_pixels;
+
+    u32 held_buttons = 0;
+    std::array<std::function<void(bool)>, input_event_count> input_callbacks;
+
+    void UpdateButtons();
+    void WaitForRunUntil() noexcept;
+};
+
+} // End namespace Emu
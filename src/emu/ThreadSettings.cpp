@@ -0,0 +1,160 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <avrt.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+#include "emu/ThreadSettings.h"
+
+namespace Emu {
+
+namespace {
+
+const char* RoleName(ThreadRole role) {
+    switch (role) {
+    case ThreadRole::Emulation:
+        return "emulation";
+    case ThreadRole::Render:
+        return "render";
+    default:
+        return "audio";
+    }
+}
+
+#if defined(_WIN32)
+
+bool PinThread(int cpu) {
+    return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+}
+
+bool RaisePriority(ThreadSettings::Priority priority, ThreadRole role) {
+    if (priority == ThreadSettings::Priority::High) {
+        return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+    }
+
+    // MMCSS boosts the thread for as long as it's registered, so it's never reverted.
+    DWORD task_index = 0;
+    const HANDLE task = AvSetMmThreadCharacteristicsW((role == ThreadRole::Audio) ? L"Pro Audio" : L"Games",
+                                                      &task_index);
+    return task != nullptr
+           && AvSetMmThreadPriority(task, (role == ThreadRole::Render) ? AVRT_PRIORITY_NORMAL : AVRT_PRIORITY_HIGH);
+}
+
+bool LockAllMemory() {
+    // Windows can only lock individual ranges, which would have to be tracked through every allocation.
+    return false;
+}
+
+double CpuSeconds() {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+
+    // The times are in 100ns units.
+    const auto to_ticks = [](const FILETIME& time) {
+        return (static_cast<unsigned long long>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (to_ticks(kernel) + to_ticks(user)) / 1e7;
+}
+
+#else
+
+bool PinThread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+    // macOS and the BSDs only take affinity hints, if anything.
+    static_cast<void>(cpu);
+    return false;
+#endif
+}
+
+bool RaisePriority(ThreadSettings::Priority priority, ThreadRole role) {
+    if (priority == ThreadSettings::Priority::High) {
+#if defined(__linux__)
+        // On Linux, the nice value is per thread, and setpriority takes a thread ID.
+        return setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), -10) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // The audio callback must never miss its deadline, and the emulator has to run before its frame is presented.
+    const int offset = (role == ThreadRole::Audio) ? 3 : (role == ThreadRole::Emulation) ? 2 : 1;
+    sched_param param{};
+    param.sched_priority = sched_get_priority_min(SCHED_RR) + offset;
+    return pthread_setschedparam(pthread_self(), SCHED_RR, &param) == 0;
+}
+
+bool LockAllMemory() {
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+
+double CpuSeconds() {
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+
+    const auto to_seconds = [](const timeval& time) { return time.tv_sec + time.tv_usec / 1e6; };
+    return to_seconds(usage.ru_utime) + to_seconds(usage.ru_stime);
+}
+
+#endif
+
+} // End anonymous namespace
+
+void ConfigureThread(const ThreadSettings& settings, ThreadRole role) noexcept {
+    const int cpu = settings.cpus[static_cast<int>(role)];
+    if (cpu != -1 && !PinThread(cpu)) {
+        fmt::print("Could not pin the {} thread to CPU {}.\n", RoleName(role), cpu);
+    }
+
+    if (settings.priority != ThreadSettings::Priority::Normal && !RaisePriority(settings.priority, role)) {
+        fmt::print("Could not raise the priority of the {} thread. This usually needs root or CAP_SYS_NICE.\n",
+                   RoleName(role));
+    }
+}
+
+void LockMemory(const ThreadSettings& settings) noexcept {
+    if (settings.lock_memory && !LockAllMemory()) {
+        fmt::print("Could not lock memory into RAM. This usually needs a higher RLIMIT_MEMLOCK.\n");
+    }
+}
+
+double ProcessCpuSeconds() noexcept {
+    return CpuSeconds();
+}
+
+} // End namespace Emu
@@ -0,0 +1,54 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+
+namespace Emu {
+
+enum class ThreadRole {Emulation, Render, Audio};
+
+// How the frontend's time-critical threads are scheduled, to keep them from being migrated between cores or
+// preempted by the rest of the system partway through a frame.
+struct ThreadSettings {
+    // High lowers the nice value of the threads. Realtime puts them in SCHED_RR, with audio above emulation above
+    // rendering, or registers them with MMCSS on Windows. Both usually need privileges, and the threads are left
+    // as they were without them.
+    enum class Priority {Normal, High, Realtime};
+
+    // The host CPU the thread of each role is pinned to, indexed by ThreadRole, or -1 to leave it to the scheduler.
+    std::array<int, 3> cpus{{-1, -1, -1}};
+    Priority priority = Priority::Normal;
+    // Lock the whole process into RAM, so none of the memory the threads touch is ever paged out.
+    bool lock_memory = false;
+    // Sleep right up to each frame's deadline instead of spinning through the end of the wait, and stop polling
+    // for input partway through frames once nothing has been pressed for a while. Saves power at the cost of less
+    // even frame pacing.
+    bool low_power = false;
+};
+
+// Applies the settings for the role to the calling thread. Only the thread itself is changed, so threads started
+// before it aren't affected, but threads it starts afterwards inherit them. A warning is printed for each setting
+// which can't be applied.
+void ConfigureThread(const ThreadSettings& settings, ThreadRole role) noexcept;
+// Locks the current and future memory of the process into RAM, if the settings ask for it.
+void LockMemory(const ThreadSettings& settings) noexcept;
+// The host CPU time used so far by all of the process's threads, in seconds.
+double ProcessCpuSeconds() noexcept;
+
+} // End namespace Emu
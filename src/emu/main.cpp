@@ -14,20 +14,97 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <numeric>
 #include <string>
+#include <utility>
 #include <vector>
 #include <stdexcept>
 #include <fmt/format.h>
 
 #include "common/CommonTypes.h"
 #include "common/CommonEnums.h"
+#include "common/BinaryTrace.h"
+#include "common/Cheats.h"
+#include "common/SaveState.h"
 #include "gb/core/Enums.h"
 #include "gb/core/GameBoy.h"
+#include "gb/core/Validator.h"
 #include "gb/memory/CartridgeHeader.h"
 #include "gba/core/Core.h"
+#include "gba/core/Validator.h"
 #include "gba/memory/Memory.h"
 #include "emu/ParseOptions.h"
+#include "emu/AutoTune.h"
 #include "emu/SdlContext.h"
+#include "emu/HeadlessContext.h"
+#include "emu/SharedMemoryContext.h"
+#include "emu/MonitorView.h"
+
+namespace {
+
+std::unique_ptr<Emu::Frontend> MakeFrontend(bool headless, int width, int height, unsigned int pixel_scale,
+                                            bool fullscreen, unsigned int audio_latency, double speed,
+                                            const Emu::DisplaySettings& display_settings,
+                                            const Emu::ThreadSettings& thread_settings,
+                                            const std::string& bindings_path,
+                                            const std::vector<Emu::MovieInput>& movie, int audio_chunk,
+                                            const std::string& shm_name) {
+    if (!shm_name.empty()) {
+        return std::make_unique<Emu::SharedMemoryContext>(shm_name, width, height);
+    } else if (headless) {
+        return std::make_unique<Emu::HeadlessContext>(movie);
+    } else {
+        return std::make_unique<Emu::SdlContext>(width, height, pixel_scale, fullscreen, audio_latency, speed,
+                                                 display_settings, thread_settings, bindings_path, audio_chunk);
+    }
+}
+
+// Runs the benchmark from power on the given number of times, then prints the spread of frame rates along with
+// hashes of the final frame and of all audio, and how long the core took to construct. The hashes should match
+// across runs and machines for the same ROM and input movie.
+template<typename MakeCore>
+void RunBenchmark(int runs, bool hw_counters, const std::vector<Emu::MovieInput>& movie,
+                  const Emu::ThreadSettings& thread_settings, MakeCore make_core) {
+    std::vector<double> fps;
+    std::vector<std::pair<u64, u64>> output_hashes;
+    double startup_seconds = 0.0;
+    for (int i = 0; i < runs; ++i) {
+        Emu::HeadlessContext frontend{movie};
+        const auto startup_time = std::chrono::steady_clock::now();
+        const auto core{make_core(frontend)};
+        startup_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startup_time).count();
+        if (hw_counters) {
+            core->bench.EnableHwCounters();
+        }
+        Emu::ConfigureThread(thread_settings, Emu::ThreadRole::Emulation);
+        core->EmulatorLoop();
+
+        fps.push_back(core->bench.Fps());
+        output_hashes.emplace_back(core->output_hash.FrameHash(), core->output_hash.AudioHash());
+    }
+
+    const double mean = std::accumulate(fps.cbegin(), fps.cend(), 0.0) / runs;
+    const double variance = std::accumulate(fps.cbegin(), fps.cend(), 0.0, [mean](double sum, double x) {
+        return sum + (x - mean) * (x - mean);
+    }) / runs;
+    const auto [min_fps, max_fps] = std::minmax_element(fps.cbegin(), fps.cend());
+    const bool deterministic = std::all_of(output_hashes.cbegin(), output_hashes.cend(),
+                                           [&output_hashes](const auto& hashes) {
+        return hashes == output_hashes[0];
+    });
+
+    fmt::print("{{\"runs\": {}, \"fps_mean\": {:.2f}, \"fps_stddev\": {:.2f}, \"fps_min\": {:.2f}, "
+               "\"fps_max\": {:.2f}, \"frame_hash\": \"{:016X}\", \"audio_hash\": \"{:016X}\", "
+               "\"deterministic\": {}, \"startup_ms\": {:.3f}}}\n",
+               runs, mean, std::sqrt(variance), *min_fps, *max_fps, output_hashes[0].first,
+               output_hashes[0].second, deterministic, startup_seconds / runs * 1000.0);
+}
+
+} // End anonymous namespace
 
 int main(int argc, char** argv) {
     std::vector<std::string> tokens = Emu::GetTokens(argv, argv + argc);
@@ -37,19 +114,123 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (Emu::ContainsOption(tokens, "--decode-trace")) {
+        try {
+            Common::BinaryTrace::Decode(Emu::GetOptionParam(tokens, "--decode-trace"));
+        } catch (const std::runtime_error& e) {
+            fmt::print("{}\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (Emu::ContainsOption(tokens, "--monitor")) {
+        try {
+            Emu::MonitorView monitor{Emu::GetMonitorNames(tokens), Emu::GetPixelScale(tokens)};
+            monitor.Run();
+        } catch (const std::exception& e) {
+            fmt::print("{}\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+
     Gb::Console gameboy_type;
     LogLevel log_level;
+    LogOverflow log_overflow;
+    Common::TraceTrigger trace_trigger;
+    std::vector<Common::Breakpoint> breakpoints;
     unsigned int pixel_scale;
-    bool enable_iir;
+    unsigned int audio_latency;
+    int audio_chunk;
+    std::string shm_name;
+    int frame_skip;
+    double speed;
+    int bench_frames;
+    int bench_runs;
+    bool bench_hw_counters;
+    int profile_interval;
+    Common::RewindSettings rewind_settings;
+    int run_ahead;
+    Common::MovieSettings movie_settings;
+    Common::SaveSettings save_settings;
+    Common::ScreenshotSettings screenshot_settings;
+    Common::RecordSettings record_settings;
+    Common::LinkSettings link_settings;
+    Common::NetplaySettings netplay_settings;
+    Common::RtcSettings rtc_settings;
+    Emu::DisplaySettings display_settings;
+    Emu::ThreadSettings thread_settings;
+    std::vector<Emu::MovieInput> movie;
+    Common::PerfSettings perf_settings;
+    Common::HugePages huge_pages;
+    Common::MetricsSettings metrics_settings;
+    Common::WatchdogSettings watchdog_settings;
     bool fullscreen;
     bool multicart;
+    bool headless;
+    bool frame_stats;
+    bool mem_report;
+    bool validate;
+    int auto_tune_frames;
     try {
         gameboy_type = Emu::GetGameBoyType(tokens);
         log_level = Emu::GetLogLevel(tokens);
+        log_overflow = Emu::GetLogOverflow(tokens);
+        trace_trigger = Emu::GetTraceTrigger(tokens);
+        breakpoints = Emu::GetBreakpoints(tokens);
+        // A trigger needs something to log, so it implies instruction tracing.
+        if (trace_trigger.condition != Common::TraceTrigger::Condition::Hotkey && log_level == LogLevel::None) {
+            log_level = LogLevel::Trace;
+        }
         pixel_scale = Emu::GetPixelScale(tokens);
-        enable_iir = Emu::GetFilterEnable(tokens);
+        audio_latency = Emu::GetAudioLatency(tokens);
+        audio_chunk = Emu::GetAudioChunk(tokens);
+        frame_skip = Emu::GetFrameSkip(tokens);
+        speed = Emu::GetSpeed(tokens);
+        bench_frames = Emu::GetBenchFrames(tokens);
+        bench_runs = Emu::GetBenchRuns(tokens);
+        bench_hw_counters = Emu::ContainsOption(tokens, "--bench-hw-counters");
+        profile_interval = Emu::GetProfileInterval(tokens);
+        rewind_settings = Emu::GetRewindSettings(tokens);
+        run_ahead = Emu::GetRunAhead(tokens);
+        movie_settings = Emu::GetMovieSettings(tokens);
+        save_settings = Emu::GetSaveSettings(tokens);
+        screenshot_settings = Emu::GetScreenshotSettings(tokens);
+        record_settings = Emu::GetRecordSettings(tokens);
+        link_settings = Emu::GetLinkSettings(tokens);
+        // Running ahead replays frames, which would send their transfers over the link cable again.
+        if (link_settings.Enabled() && run_ahead != 0) {
+            throw std::invalid_argument("Run-ahead can't be used with a link cable.");
+        }
+        netplay_settings = Emu::GetNetplaySettings(tokens);
+        // Both players have to emulate exactly the same frames with the same input.
+        if (netplay_settings.Enabled() && (run_ahead != 0 || rewind_settings.budget != 0 || link_settings.Enabled()
+                                           || !movie_settings.record_path.empty()
+                                           || !movie_settings.play_path.empty())) {
+            throw std::invalid_argument("Netplay can't be used with run-ahead, rewind, input movies or a link cable.");
+        }
+        rtc_settings = Emu::GetRtcSettings(tokens);
+        display_settings = Emu::GetDisplaySettings(tokens);
+        perf_settings = Emu::GetPerfSettings(tokens);
+        huge_pages = Emu::GetHugePages(tokens);
+        metrics_settings = Emu::GetMetricsSettings(tokens);
+        watchdog_settings = Emu::GetWatchdogSettings(tokens);
+        thread_settings = Emu::GetThreadSettings(tokens);
         fullscreen = Emu::ContainsOption(tokens, "-f");
         multicart = Emu::ContainsOption(tokens, "--multicart");
+        frame_stats = Emu::ContainsOption(tokens, "--frame-stats");
+        mem_report = Emu::ContainsOption(tokens, "--mem-report");
+        validate = Emu::ContainsOption(tokens, "--validate");
+        auto_tune_frames = Emu::GetAutoTuneFrames(tokens);
+        shm_name = Emu::GetOptionParam(tokens, "--shm");
+        // The harness on the other end of the segment provides the input.
+        if (!shm_name.empty() && (bench_frames != 0 || Emu::ContainsOption(tokens, "--movie"))) {
+            throw std::invalid_argument("--shm can't be used with --bench or --movie.");
+        }
+        // Benchmarks always run uncapped, and the SDL frontend has no way to replay a movie.
+        headless = Emu::ContainsOption(tokens, "--headless") || bench_frames != 0
+                   || Emu::ContainsOption(tokens, "--movie");
     } catch (const std::invalid_argument& e) {
         fmt::print("{}\n\n", e.what());
         Emu::DisplayHelp();
@@ -59,27 +240,224 @@ int main(int argc, char** argv) {
     try {
         const std::string rom_path{tokens.back()};
 
+        const std::string trace_path{Emu::GetOptionParam(tokens, "--trace")};
+        const std::string bindings_path{Emu::GetOptionParam(tokens, "--bindings")};
+        const std::string cheats_path{Emu::GetOptionParam(tokens, "--cheats")};
+        const std::vector<std::string> cheat_codes{cheats_path.empty() ? std::vector<std::string>{}
+                                                                       : Common::LoadCheatFile(cheats_path)};
+        const std::string ram_deltas_path{Emu::GetOptionParam(tokens, "--ram-deltas")};
+        const bool ram_deltas_zlib = Emu::ContainsOption(tokens, "--ram-deltas-zlib");
+        const std::string access_counts_prefix{Emu::GetOptionParam(tokens, "--access-counts")};
+        const std::string coverage_path{Emu::GetOptionParam(tokens, "--coverage")};
+        // Only interactive sessions suspend on exit. Headless runs and harnesses expect to start from power on.
+        const bool suspend = !headless && shm_name.empty() && !Emu::ContainsOption(tokens, "--no-suspend");
+        const std::string movie_path{Emu::GetOptionParam(tokens, "--movie")};
+        if (!movie_path.empty()) {
+            movie = Emu::LoadInputMovie(movie_path);
+        }
+
+        // Benchmarks run the clock on emulated time, so the hashes don't depend on when they're run.
+        const Common::RtcSettings bench_rtc_settings{true,
+                                                     rtc_settings.epoch.value_or(Common::RtcSettings::reproducible_epoch)};
+
         if (Emu::CheckRomFile(rom_path) == Gb::Console::AGB) {
             const std::vector<u32> bios{Emu::LoadGbaBios()};
-            const std::vector<u16> rom{Emu::LoadRom<u16>(rom_path)};
+            const Common::RomVector<u16> rom{Emu::LoadRom<u16>(rom_path, huge_pages)};
             Gba::Memory::CheckHeader(rom);
 
             const std::string save_path{Emu::SaveGamePath(rom_path)};
+            const std::string tune_path{Emu::TunedSettingsPath(save_path)};
+            const u64 rom_hash = Common::XxHash64::Hash(rom.data(), rom.size() * sizeof(u16));
+
+            if (auto_tune_frames != 0) {
+                const auto tune_run = [&](const Common::PerfSettings& settings) {
+                    Emu::TuningContext frontend{movie, auto_tune_frames, 240 * 160};
+                    Gba::Core core{frontend, bios, rom, "", LogLevel::None, log_overflow, settings.exec_mode,
+                                   settings.audio_filter, 0, settings.lcd_thread, settings.line_cache,
+                                   settings.hle_bios, 0, 0, "", Common::TraceTrigger{}, Common::RewindSettings{}, 0,
+                                   Common::MovieSettings{}, save_settings, Common::ScreenshotSettings{},
+                                   Common::RecordSettings{}, Common::LinkSettings{}, Common::NetplaySettings{},
+                                   bench_rtc_settings, huge_pages, Common::MetricsSettings{},
+                                   Common::WatchdogSettings{}, settings.ideal_prefetch, settings.skip_bios};
+                    return frontend.Run(core);
+                };
+                Emu::SaveTunedSettings(tune_path, rom_hash, Emu::AutoTune(true, tune_run));
+                return 0;
+            }
+            perf_settings = Emu::ApplyTunedSettings(tokens, perf_settings, tune_path, rom_hash);
+
+            if (validate) {
+                // Both instances play the same input, and neither writes anything but the diverging state.
+                const auto make_core = [&](Emu::Frontend& frontend, ExecMode mode) {
+                    return std::make_unique<Gba::Core>(frontend, bios, rom, "", LogLevel::None, log_overflow, mode,
+                                                       perf_settings.audio_filter, 0, perf_settings.lcd_thread,
+                                                       perf_settings.line_cache, perf_settings.hle_bios,
+                                                       bench_frames, 0, "", Common::TraceTrigger{},
+                                                       Common::RewindSettings{}, 0,
+                                                       Common::MovieSettings{"", movie_settings.play_path, false, 0},
+                                                       save_settings, Common::ScreenshotSettings{},
+                                                       Common::RecordSettings{}, Common::LinkSettings{},
+                                                       Common::NetplaySettings{}, bench_rtc_settings, huge_pages,
+                                                       Common::MetricsSettings{}, Common::WatchdogSettings{},
+                                                       perf_settings.ideal_prefetch, perf_settings.skip_bios);
+                };
+                Emu::HeadlessContext reference_frontend{movie};
+                Emu::HeadlessContext candidate_frontend{movie};
+                const auto reference{make_core(reference_frontend, ExecMode::Interpreter)};
+                const auto candidate{make_core(candidate_frontend, perf_settings.exec_mode)};
+                const std::string state_path{save_path.substr(0, save_path.rfind('.')) + ".diverged.state"};
+                return Gba::ValidateEngines(*reference, *candidate, bench_frames, state_path) ? 0 : 1;
+            }
+
+            if (bench_frames != 0) {
+                RunBenchmark(bench_runs, bench_hw_counters, movie, thread_settings, [&](Emu::Frontend& frontend) {
+                    return std::make_unique<Gba::Core>(frontend, bios, rom, "", log_level, log_overflow,
+                                                       perf_settings.exec_mode, perf_settings.audio_filter,
+                                                       frame_skip, perf_settings.lcd_thread,
+                                                       perf_settings.line_cache, perf_settings.hle_bios,
+                                                       bench_frames, profile_interval, trace_path, trace_trigger,
+                                                       rewind_settings, run_ahead, movie_settings, save_settings,
+                                                       screenshot_settings, record_settings, Common::LinkSettings{},
+                                                       Common::NetplaySettings{}, bench_rtc_settings, huge_pages,
+                                                       Common::MetricsSettings{}, watchdog_settings,
+                                                       perf_settings.ideal_prefetch, perf_settings.skip_bios);
+                });
+                return 0;
+            }
 
-            Emu::SdlContext sdl_context{240, 160, pixel_scale, fullscreen};
-            Gba::Core gba_core{sdl_context, bios, rom, save_path, log_level};
+            const std::vector<Common::Cheat> cheats{Common::DecodeGbaCheats(cheat_codes)};
+            const auto frontend{MakeFrontend(headless, 240, 160, pixel_scale, fullscreen, audio_latency, speed,
+                                             display_settings, thread_settings, bindings_path, movie,
+                                             audio_chunk, shm_name)};
+            Gba::Core gba_core{*frontend, bios, rom, save_path, log_level, log_overflow, perf_settings.exec_mode,
+                               perf_settings.audio_filter, frame_skip, perf_settings.lcd_thread,
+                               perf_settings.line_cache, perf_settings.hle_bios, bench_frames, profile_interval,
+                               trace_path, trace_trigger, rewind_settings, run_ahead, movie_settings, save_settings,
+                               screenshot_settings, record_settings, link_settings, netplay_settings, rtc_settings,
+                               huge_pages, metrics_settings, watchdog_settings, perf_settings.ideal_prefetch,
+                               perf_settings.skip_bios};
+            gba_core.SetCheats(cheats);
+            gba_core.SetBreakpoints(breakpoints);
+            if (!ram_deltas_path.empty()) {
+                gba_core.StreamRamDeltas(ram_deltas_path, ram_deltas_zlib);
+            }
+            if (suspend) {
+                gba_core.EnableSuspend(Common::SuspendPath(save_path));
+            }
+            if (!coverage_path.empty()) {
+                gba_core.EnableCodeCoverage();
+            }
 
+            // The core's own threads are already running, so they don't inherit the emulation thread's settings.
+            Emu::ConfigureThread(thread_settings, Emu::ThreadRole::Emulation);
+            Emu::LockMemory(thread_settings);
             gba_core.EmulatorLoop();
+            if (frame_stats) {
+                fmt::print("{}\n", gba_core.frame_stats.Report());
+            }
+            if (mem_report) {
+                fmt::print("{}\n", gba_core.ReportMemory().Report());
+            }
+            if (!access_counts_prefix.empty()) {
+                gba_core.ExportAccessCounts(access_counts_prefix);
+            }
+            if (!coverage_path.empty()) {
+                gba_core.WriteCoverageReport(coverage_path);
+            }
         } else {
-            const std::vector<u8> rom{Emu::LoadRom<u8>(rom_path)};
+            const Common::RomVector<u8> rom{Emu::LoadRom<u8>(rom_path, huge_pages)};
             const Gb::CartridgeHeader cart_header{gameboy_type, rom, multicart};
 
             const std::string save_path{Emu::SaveGamePath(rom_path)};
+            const std::string tune_path{Emu::TunedSettingsPath(save_path)};
+            const u64 rom_hash = Common::XxHash64::Hash(rom.data(), rom.size());
+
+            if (auto_tune_frames != 0) {
+                const auto tune_run = [&](const Common::PerfSettings& settings) {
+                    Emu::TuningContext frontend{movie, auto_tune_frames, 160 * 144};
+                    Gb::GameBoy core{gameboy_type, cart_header, frontend, "", rom, settings.audio_filter,
+                                     LogLevel::None, log_overflow, 0, 0, 0, Common::TraceTrigger{},
+                                     Common::RewindSettings{}, 0, Common::MovieSettings{}, save_settings,
+                                     Common::ScreenshotSettings{}, Common::RecordSettings{}, Common::LinkSettings{},
+                                     Common::NetplaySettings{}, bench_rtc_settings, Common::MetricsSettings{},
+                                     Common::WatchdogSettings{}, settings.exec_mode, settings.gb_renderer,
+                                     settings.audio_thread};
+                    return frontend.Run(core);
+                };
+                Emu::SaveTunedSettings(tune_path, rom_hash, Emu::AutoTune(false, tune_run));
+                return 0;
+            }
+            perf_settings = Emu::ApplyTunedSettings(tokens, perf_settings, tune_path, rom_hash);
+
+            if (validate) {
+                const auto make_gameboy = [&](Emu::Frontend& frontend, ExecMode mode) {
+                    return std::make_unique<Gb::GameBoy>(gameboy_type, cart_header, frontend, "", rom,
+                                                         perf_settings.audio_filter, LogLevel::None, log_overflow, 0, bench_frames, 0,
+                                                         Common::TraceTrigger{}, Common::RewindSettings{}, 0,
+                                                         Common::MovieSettings{"", movie_settings.play_path, false, 0},
+                                                         save_settings, Common::ScreenshotSettings{},
+                                                         Common::RecordSettings{}, Common::LinkSettings{},
+                                                         Common::NetplaySettings{}, bench_rtc_settings,
+                                                         Common::MetricsSettings{}, Common::WatchdogSettings{}, mode,
+                                                         perf_settings.gb_renderer, perf_settings.audio_thread);
+                };
+                Emu::HeadlessContext reference_frontend{movie};
+                Emu::HeadlessContext candidate_frontend{movie};
+                const auto reference{make_gameboy(reference_frontend, ExecMode::Interpreter)};
+                const auto candidate{make_gameboy(candidate_frontend, perf_settings.exec_mode)};
+                const std::string state_path{save_path.substr(0, save_path.rfind('.')) + ".diverged.state"};
+                return Gb::ValidateEngines(*reference, *candidate, bench_frames, state_path) ? 0 : 1;
+            }
+
+            if (bench_frames != 0) {
+                RunBenchmark(bench_runs, bench_hw_counters, movie, thread_settings, [&](Emu::Frontend& frontend) {
+                    return std::make_unique<Gb::GameBoy>(gameboy_type, cart_header, frontend, "", rom,
+                                                         perf_settings.audio_filter, log_level, log_overflow,
+                                                         frame_skip, bench_frames, profile_interval, trace_trigger,
+                                                         rewind_settings, run_ahead, movie_settings, save_settings,
+                                                         screenshot_settings, record_settings, Common::LinkSettings{},
+                                                         Common::NetplaySettings{}, bench_rtc_settings,
+                                                         Common::MetricsSettings{}, watchdog_settings,
+                                                         perf_settings.exec_mode, perf_settings.gb_renderer,
+                                                         perf_settings.audio_thread);
+                });
+                return 0;
+            }
 
-            Emu::SdlContext sdl_context{160, 144, pixel_scale, fullscreen};
-            Gb::GameBoy gameboy_core{gameboy_type, cart_header, sdl_context, save_path, rom, enable_iir, log_level};
+            const std::vector<Common::Cheat> cheats{Common::DecodeGbCheats(cheat_codes)};
+            const auto frontend{MakeFrontend(headless, 160, 144, pixel_scale, fullscreen, audio_latency, speed,
+                                             display_settings, thread_settings, bindings_path, movie,
+                                             audio_chunk, shm_name)};
+            Gb::GameBoy gameboy_core{gameboy_type, cart_header, *frontend, save_path, rom, perf_settings.audio_filter,
+                                     log_level, log_overflow, frame_skip, bench_frames, profile_interval,
+                                     trace_trigger, rewind_settings, run_ahead, movie_settings, save_settings,
+                                     screenshot_settings, record_settings, link_settings, netplay_settings,
+                                     rtc_settings, metrics_settings, watchdog_settings, perf_settings.exec_mode,
+                                     perf_settings.gb_renderer, perf_settings.audio_thread};
+            gameboy_core.SetCheats(cheats);
+            gameboy_core.SetBreakpoints(breakpoints);
+            if (!ram_deltas_path.empty()) {
+                gameboy_core.StreamRamDeltas(ram_deltas_path, ram_deltas_zlib);
+            }
+            if (suspend) {
+                gameboy_core.EnableSuspend(Common::SuspendPath(save_path));
+            }
+            if (!coverage_path.empty()) {
+                gameboy_core.EnableCodeCoverage();
+            }
 
+            Emu::ConfigureThread(thread_settings, Emu::ThreadRole::Emulation);
+            Emu::LockMemory(thread_settings);
             gameboy_core.EmulatorLoop();
+            if (frame_stats) {
+                fmt::print("{}\n", gameboy_core.frame_stats.Report());
+            }
+            if (mem_report) {
+                fmt::print("{}\n", gameboy_core.ReportMemory().Report());
+            }
+            if (!coverage_path.empty()) {
+                gameboy_core.WriteCoverageReport(coverage_path);
+            }
         }
     } catch (const std::runtime_error& e) {
         fmt::print("{}\n", e.what());
@@ -0,0 +1,235 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <fmt/format.h>
+
+#include "fuzz/Fuzzer.h"
+
+namespace Fuzz {
+
+namespace {
+
+// Button names as in input movies, in button mask order.
+constexpr std::array<const char*, 10> button_names{{
+    "up", "left", "down", "right", "a", "b", "l", "r", "start", "select"
+}};
+
+// The longest run a mutation makes up. Longer holds come from runs being spliced and grown.
+constexpr int max_run_frames = 60;
+
+std::atomic<bool> interrupted{false};
+
+void HandleInterrupt(int) {
+    interrupted = true;
+}
+
+} // End anonymous namespace
+
+Fuzzer::Fuzzer(chroma_instance* _instance, const std::string& _rom_path, const FuzzSettings& _settings)
+        : instance(_instance)
+        , rom_path(_rom_path)
+        , settings(_settings)
+        , rng(settings.seed) {
+
+    if (!settings.corpus_dir.empty()) {
+        std::filesystem::create_directories(settings.corpus_dir);
+    }
+
+    // Hit counts are only told apart by their power of two bucket, as in AFL, so a loop running once more doesn't
+    // count as new coverage.
+    for (std::size_t count = 0; count < bucket_table.size(); ++count) {
+        if (count <= 2) {
+            bucket_table[count] = count;
+        } else if (count == 3) {
+            bucket_table[count] = 4;
+        } else if (count < 8) {
+            bucket_table[count] = 8;
+        } else if (count < 16) {
+            bucket_table[count] = 16;
+        } else if (count < 32) {
+            bucket_table[count] = 32;
+        } else if (count < 128) {
+            bucket_table[count] = 64;
+        } else {
+            bucket_table[count] = 128;
+        }
+    }
+
+    chroma_step(instance, 0, settings.boot_frames);
+    snapshot.resize(chroma_save_state(instance, nullptr, 0));
+    chroma_save_state(instance, snapshot.data(), snapshot.size());
+
+    chroma_set_coverage(instance, 1);
+    std::size_t map_size;
+    chroma_get_coverage(instance, &map_size);
+    seen_buckets.assign(map_size, 0);
+
+    // The first input holds nothing, so everything the game does on its own counts as seen.
+    corpus.push_back({{0, std::min(max_run_frames, settings.max_frames)}});
+    Execute(corpus.front());
+    SaveInput(corpus.front(), 0);
+}
+
+void Fuzzer::Run() {
+    using namespace std::chrono;
+    std::signal(SIGINT, HandleInterrupt);
+    std::signal(SIGTERM, HandleInterrupt);
+
+    const auto start_time = steady_clock::now();
+    auto report_time = start_time;
+    u64 report_executions = executions;
+    u64 report_frames = frames_run;
+
+    while (!interrupted) {
+        const Input child = Mutate(corpus[RandomIndex(corpus.size())]);
+        if (Execute(child)) {
+            corpus.push_back(child);
+            SaveInput(child, corpus.size() - 1);
+        }
+
+        const auto now = steady_clock::now();
+        const double elapsed = duration<double>(now - start_time).count();
+        const bool done = settings.seconds != 0.0 && elapsed >= settings.seconds;
+        if (done || now - report_time >= seconds{2}) {
+            const double interval = duration<double>(now - report_time).count();
+            fmt::print("{:.0f}s: {} executions ({:.0f}/s, {:.0f} frames/s), corpus {}, {} edges\n", elapsed,
+                       executions, (executions - report_executions) / interval,
+                       (frames_run - report_frames) / interval, corpus.size(), edges_seen);
+            report_time = now;
+            report_executions = executions;
+            report_frames = frames_run;
+        }
+        if (done) {
+            break;
+        }
+    }
+}
+
+Fuzzer::Input Fuzzer::Mutate(const Input& parent) {
+    Input child = parent;
+    const int mutations = 1 + RandomIndex(4);
+    for (int i = 0; i < mutations; ++i) {
+        ButtonRun& run = child[RandomIndex(child.size())];
+        switch (RandomIndex(6)) {
+        case 0:
+            run.buttons ^= 1 << RandomIndex(button_names.size());
+            break;
+        case 1:
+            run.buttons = RandomRun().buttons;
+            break;
+        case 2:
+            run.frames = RandomRun().frames;
+            break;
+        case 3:
+            child.insert(child.begin() + RandomIndex(child.size() + 1), RandomRun());
+            break;
+        case 4:
+            if (child.size() > 1) {
+                child.erase(child.begin() + RandomIndex(child.size()));
+            }
+            break;
+        case 5: {
+            // Carries on from partway through this input with the end of another.
+            const Input& other = corpus[RandomIndex(corpus.size())];
+            child.resize(1 + RandomIndex(child.size()));
+            child.insert(child.end(), other.begin() + RandomIndex(other.size()), other.end());
+            break;
+        }
+        }
+    }
+
+    // Cut down to the longest input allowed.
+    int frames = 0;
+    for (std::size_t i = 0; i < child.size(); ++i) {
+        if (frames + child[i].frames >= settings.max_frames) {
+            child[i].frames = settings.max_frames - frames;
+            child.resize(i + 1);
+            break;
+        }
+        frames += child[i].frames;
+    }
+
+    return child;
+}
+
+Fuzzer::ButtonRun Fuzzer::RandomRun() {
+    return {static_cast<u16>(RandomIndex(1 << button_names.size())), 1 + RandomIndex(max_run_frames)};
+}
+
+bool Fuzzer::Execute(const Input& input) {
+    chroma_load_state(instance, snapshot.data(), snapshot.size());
+    chroma_clear_coverage(instance);
+    for (const ButtonRun& run : input) {
+        chroma_step(instance, run.buttons, run.frames);
+        frames_run += run.frames;
+    }
+    ++executions;
+
+    const u8* map = chroma_get_coverage(instance, nullptr);
+    bool new_coverage = false;
+    for (std::size_t i = 0; i < seen_buckets.size(); ++i) {
+        const u8 bucket = bucket_table[map[i]];
+        if ((bucket & ~seen_buckets[i]) != 0) {
+            edges_seen += (seen_buckets[i] == 0);
+            seen_buckets[i] |= bucket;
+            new_coverage = true;
+        }
+    }
+
+    return new_coverage;
+}
+
+void Fuzzer::SaveInput(const Input& input, std::size_t index) const {
+    if (settings.corpus_dir.empty()) {
+        return;
+    }
+
+    int total_frames = settings.boot_frames;
+    for (const ButtonRun& run : input) {
+        total_frames += run.frames;
+    }
+
+    const std::string path = fmt::format("{}/{:06}.txt", settings.corpus_dir, index);
+    std::ofstream movie_file(path);
+    movie_file << fmt::format("# Replay with the chroma-batch job \"{} {} {}\".\n", rom_path, total_frames, path);
+
+    int frame = settings.boot_frames;
+    u16 held = 0;
+    for (const ButtonRun& run : input) {
+        for (std::size_t b = 0; b < button_names.size(); ++b) {
+            if (((run.buttons ^ held) >> b) & 1) {
+                const bool press = (run.buttons >> b) & 1;
+                movie_file << fmt::format("{} {} {}\n", frame, button_names[b], press ? "press" : "release");
+            }
+        }
+        held = run.buttons;
+        frame += run.frames;
+    }
+
+    if (!movie_file) {
+        throw std::runtime_error("Error when attempting to write " + path);
+    }
+}
+
+} // End namespace Fuzz
@@ -0,0 +1,87 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <array>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "lib/chroma.h"
+
+namespace Fuzz {
+
+struct FuzzSettings {
+    // Frames run from power on, with no buttons held, before the snapshot every input starts from.
+    int boot_frames = 120;
+    // The longest input, in frames.
+    int max_frames = 600;
+    // Host seconds to fuzz for, or 0 to carry on until interrupted.
+    double seconds = 0.0;
+    u64 seed = 1;
+    // Where inputs which reach new coverage are written, or empty to keep them in memory only.
+    std::string corpus_dir;
+};
+
+// Explores a game by fuzzing its input. Every input starts from the same snapshot, which is restored by loading a
+// savestate rather than by booting the game again. The guest code coverage each input reaches is compared against
+// everything seen so far, and inputs which reach new edges, or take one a new number of times, join the corpus to
+// be mutated in turn.
+//
+// Inputs are kept as runs of button masks held for some frames, since games mostly act on buttons held for a while.
+// Corpus inputs are written as input movies from power on, so chroma-batch or the headless frontend can replay them.
+class Fuzzer {
+public:
+    // Boots the game and takes the snapshot. Throws std::runtime_error if the corpus directory can't be created.
+    Fuzzer(chroma_instance* _instance, const std::string& _rom_path, const FuzzSettings& _settings);
+
+    // Fuzzes until the time is up or the process is interrupted, printing progress every few seconds.
+    void Run();
+
+private:
+    struct ButtonRun {
+        u16 buttons;
+        int frames;
+    };
+    using Input = std::vector<ButtonRun>;
+
+    chroma_instance* const instance;
+    const std::string rom_path;
+    const FuzzSettings settings;
+    std::mt19937_64 rng;
+
+    std::vector<u8> snapshot;
+    std::vector<Input> corpus;
+    // The hit count buckets seen so far on each edge, a bit each.
+    std::vector<u8> seen_buckets;
+    std::array<u8, 256> bucket_table;
+    std::size_t edges_seen = 0;
+
+    u64 executions = 0;
+    u64 frames_run = 0;
+
+    Input Mutate(const Input& parent);
+    ButtonRun RandomRun();
+    int RandomIndex(std::size_t size) { return static_cast<int>(rng() % size); }
+    // Runs the input from the snapshot, and returns true if it reached new coverage.
+    bool Execute(const Input& input);
+    void SaveInput(const Input& input, std::size_t index) const;
+};
+
+} // End namespace Fuzz
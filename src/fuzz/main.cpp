@@ -0,0 +1,149 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+#include "fuzz/Fuzzer.h"
+
+namespace {
+
+void DisplayHelp() {
+    fmt::print("Usage: chroma-fuzz [options] <rom>\n\n");
+    fmt::print("Explores a game by fuzzing its input, guided by the guest code each input reaches.\n");
+    fmt::print("Inputs which reach new code are written as input movies, which chroma-batch can replay.\n\n");
+    fmt::print("Options:\n");
+    fmt::print("  -h                            display help\n");
+    fmt::print("  --bios [path]                 GBA BIOS (default: gba_bios.bin)\n");
+    fmt::print("  --accuracy [accurate, balanced, fast]\n");
+    fmt::print("                                accuracy and speed trade-offs, as in chroma (default: fast)\n");
+    fmt::print("  --boot-frames [frames]        frames to run before the snapshot inputs start from (default: 120)\n");
+    fmt::print("  --max-frames [frames]         the longest input (default: 600)\n");
+    fmt::print("  --seconds [seconds]           how long to fuzz for, or 0 until interrupted (default: 0)\n");
+    fmt::print("  --seed [number]               seed for the mutations (default: 1)\n");
+    fmt::print("  -o [path]                     directory to write the corpus to (default: corpus)\n");
+}
+
+std::vector<u8> ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+std::vector<u8> LoadBios(const std::string& bios_path) {
+    std::ifstream bios_file(bios_path, std::ios_base::binary);
+    if (!bios_file) {
+        // GB games don't need it, and creating the instance fails on its own for GBA games without one.
+        return {};
+    }
+
+    return std::vector<u8>(std::istreambuf_iterator<char>(bios_file), std::istreambuf_iterator<char>());
+}
+
+int ParseFrames(const std::string& option, const std::string& value, int min) {
+    const int frames = std::stoi(value);
+    if (frames < min) {
+        throw std::invalid_argument(fmt::format("{} must be at least {}.", option, min));
+    }
+
+    return frames;
+}
+
+struct InstanceDeleter {
+    void operator()(chroma_instance* instance) const { chroma_destroy(instance); }
+};
+
+} // End anonymous namespace
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> tokens(argv + 1, argv + argc);
+    if (tokens.empty() || std::find(tokens.cbegin(), tokens.cend(), "-h") != tokens.cend()) {
+        DisplayHelp();
+        return 1;
+    }
+
+    std::string bios_path = "gba_bios.bin";
+    // Fuzzing wants executions per second more than exact timing, so it runs the fast profile unless told otherwise.
+    chroma_profile profile = CHROMA_PROFILE_FAST;
+    Fuzz::FuzzSettings settings;
+    settings.corpus_dir = "corpus";
+    try {
+        for (std::size_t i = 0; i + 1 < tokens.size(); ++i) {
+            if (tokens[i] == "--bios" && i + 2 < tokens.size()) {
+                bios_path = tokens[++i];
+            } else if (tokens[i] == "--accuracy" && i + 2 < tokens.size()) {
+                const std::string& name = tokens[++i];
+                if (name == "accurate") {
+                    profile = CHROMA_PROFILE_ACCURATE;
+                } else if (name == "balanced") {
+                    profile = CHROMA_PROFILE_BALANCED;
+                } else if (name == "fast") {
+                    profile = CHROMA_PROFILE_FAST;
+                } else {
+                    throw std::invalid_argument("Invalid accuracy profile specified: " + name);
+                }
+            } else if (tokens[i] == "--boot-frames" && i + 2 < tokens.size()) {
+                settings.boot_frames = ParseFrames(tokens[i], tokens[i + 1], 0);
+                ++i;
+            } else if (tokens[i] == "--max-frames" && i + 2 < tokens.size()) {
+                settings.max_frames = ParseFrames(tokens[i], tokens[i + 1], 1);
+                ++i;
+            } else if (tokens[i] == "--seconds" && i + 2 < tokens.size()) {
+                settings.seconds = std::stod(tokens[++i]);
+            } else if (tokens[i] == "--seed" && i + 2 < tokens.size()) {
+                settings.seed = std::stoull(tokens[++i]);
+            } else if (tokens[i] == "-o" && i + 2 < tokens.size()) {
+                settings.corpus_dir = tokens[++i];
+            } else {
+                throw std::invalid_argument("Invalid option: " + tokens[i]);
+            }
+        }
+    } catch (const std::logic_error& e) {
+        // Covers the exceptions from std::stoi as well.
+        fmt::print("{}\n\n", e.what());
+        DisplayHelp();
+        return 1;
+    }
+
+    chroma_set_profile(profile);
+
+    try {
+        const std::string& rom_path = tokens.back();
+        const std::vector<u8> rom = ReadFile(rom_path);
+        const std::vector<u8> bios = LoadBios(bios_path);
+        std::unique_ptr<chroma_instance, InstanceDeleter> instance{chroma_create(rom.data(), rom.size(), bios.data(),
+                                                                                 bios.size())};
+        if (instance == nullptr) {
+            throw std::runtime_error(rom_path + " is neither a GB or GBA game, or it's a GBA game with no BIOS.");
+        }
+
+        Fuzz::Fuzzer{instance.get(), rom_path, settings}.Run();
+    } catch (const std::exception& e) {
+        fmt::print("{}\n", e.what());
+        return 1;
+    }
+}
@@ -14,32 +14,138 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <limits>
+
 #include "gb/audio/Audio.h"
+#include "gb/audio/AudioThread.h"
 #include "gb/core/GameBoy.h"
 #include "gb/memory/Memory.h"
+#include "emu/Frontend.h"
 
 namespace Gb {
 
-Audio::Audio(bool enable_filter, const GameBoy& _gameboy)
+Audio::Audio(AudioFilter _filter, const GameBoy& _gameboy, Role _role, Emu::Frontend* _chunk_frontend)
         : square1(_gameboy.console, false, 0x00, 0x80, 0xF3, 0xFF, 0x00)
         , square2(_gameboy.console, false, 0x00, 0x00, 0x00, 0xFF, 0x00)
         , wave(_gameboy.console, false, 0x00, 0x00, 0x00, 0xFF, 0x00)
         , noise(_gameboy.console, false, 0x00, 0x00, 0x00, 0x00, 0x00)
         , gameboy(_gameboy)
-        , enable_iir(enable_filter)
-        , resample_buffer(enable_iir ? (interpolated_buffer_size / 2) : 0) {
+        , role(_role)
+        , filter(_filter)
+        , resampler(Common::IirResampler::ForFilter(filter, 8))
+        , fir(Common::FirResampler::ForFilter(filter, 8))
+        , blip((filter == AudioFilter::Blip)
+               ? Common::BlipBuffer{samples_per_frame, 800, 8.0f / Common::IirResampler::interpolation_factor}
+               : Common::BlipBuffer{})
+        , chunk_frontend(_chunk_frontend)
+        , chunk_samples((chunk_frontend != nullptr) ? chunk_frontend->AudioChunkSamples() : 0) {
 
     Common::Vec4f::SetFlushToZero();
+
+    if (role == Role::Emulated) {
+        audio_thread = std::make_unique<AudioThread>(filter, gameboy);
+    }
 }
 
 // Needed to declare std::vector with forward-declared type in the header file.
 Audio::~Audio() = default;
 
+void Audio::Sync() {
+    // The APU always updates at 2MHz, regardless of double speed mode. So it updates twice an M-cycle in
+    // single-speed mode, and once an M-cycle in double-speed mode.
+    const u64 ticks = (gameboy.timestamp - last_sync) >> (1 + gameboy.mem->double_speed);
+    last_sync = gameboy.timestamp;
+
+    if (role == Role::Emulated) {
+        RecordTicks(ticks);
+    }
+
+    Run(ticks);
+}
+
+void Audio::EndFrame() {
+    Sync();
+
+    if (role == Role::Emulated) {
+        if (mixer_stale) {
+            RestartMixer();
+        }
+        audio_thread->EndFrame(output_buffer);
+    }
+}
+
+void Audio::RecordTicks(u64 ticks) {
+    if (gameboy.AudioSuppressed()) {
+        // Nothing from these frames is heard, so the mixer skips them and carries on from wherever they leave the
+        // channels.
+        mixer_stale = true;
+        return;
+    }
+
+    if (mixer_stale) {
+        RestartMixer();
+    }
+    audio_thread->RecordTicks(ticks);
+}
+
+void Audio::RestartMixer() {
+    auto state = Common::State::ForSaving(audio_thread->Restart(), Common::State::System::Gb);
+    SerializeState(state);
+    mixer_stale = false;
+}
+
+void Audio::Run(u64 ticks) {
+    while (ticks > 0) {
+        UpdateAudio();
+        ticks -= 1;
+
+        // Between frame sequencer steps and channel timer reloads, the only thing that changes on each tick is the
+        // channel timers, so the following samples are all the same as the one just generated.
+        const u64 quiet_ticks = std::min(ticks, QuietTicks());
+        if (quiet_ticks > 0) {
+            audio_clock += quiet_ticks * 2;
+            if (AudioEnabled()) {
+                square1.AdvanceTimer(quiet_ticks);
+                square2.AdvanceTimer(quiet_ticks);
+                wave.AdvanceTimer(quiet_ticks);
+                noise.AdvanceTimer(quiet_ticks);
+            }
+
+            for (u64 i = 0; i < quiet_ticks && Mixes(); ++i) {
+                QueueSample(last_left_sample, last_right_sample);
+            }
+
+            ticks -= quiet_ticks;
+        }
+    }
+}
+
+u64 Audio::QuietTicks() const {
+    if (!AudioEnabled()) {
+        // Nothing is updated while audio is off.
+        return std::numeric_limits<u64>::max();
+    }
+
+    // The frame sequencer steps every 4096 ticks. The channels only look for edges on its clock bits, which they
+    // have already seen for the current step during the last tick.
+    u64 quiet_ticks = ((0x2000 - (audio_clock & 0x1FFF)) >> 1) - 1;
+
+    quiet_ticks = std::min<u64>(quiet_ticks, square1.TicksUntilTimerReload());
+    quiet_ticks = std::min<u64>(quiet_ticks, square2.TicksUntilTimerReload());
+    quiet_ticks = std::min<u64>(quiet_ticks, wave.TicksUntilTimerReload());
+    quiet_ticks = std::min<u64>(quiet_ticks, noise.TicksUntilTimerReload());
+
+    return quiet_ticks;
+}
+
 void Audio::UpdateAudio() {
     audio_clock += 2;
 
     if (!AudioEnabled()) {
         // Queue silence when audio is off.
+        last_left_sample = 0x00;
+        last_right_sample = 0x00;
         QueueSample(0x00, 0x00);
         return;
     }
@@ -49,6 +155,11 @@ void Audio::UpdateAudio() {
     wave.Update(GetFrameSequencer(), wave_ram);
     noise.Update(GetFrameSequencer(), wave_ram);
 
+    if (!Mixes()) {
+        // The channels still have to run for NR52 and the length counters, but nothing is mixed.
+        return;
+    }
+
     const int sample_channel1 = square1.GenSample();
     const int sample_channel2 = square2.GenSample();
     const int sample_channel3 = wave.GenSample();
@@ -66,6 +177,8 @@ void Audio::UpdateAudio() {
     if (noise.EnabledLeft(sound_select))    { left_sample += sample_channel4; }
     if (noise.EnabledRight(sound_select))   { right_sample += sample_channel4; }
 
+    last_left_sample = left_sample;
+    last_right_sample = right_sample;
     QueueSample(left_sample, right_sample);
 }
 
@@ -94,6 +207,12 @@ void Audio::WriteSoundOn(u8 data) {
 }
 
 void Audio::QueueSample(int left_sample, int right_sample) {
+    // Frames which are only run ahead must not reach the host, or disturb the filters. The mixer is never given
+    // them in the first place.
+    if (!Mixes() || (role == Role::Whole && gameboy.AudioSuppressed())) {
+        return;
+    }
+
     // Multiply the samples by the master volume. This is done after the DAC and after the channels have been
     // mixed, and so the final sample value can be greater than 0x0F.
     left_sample *= MasterVolumeLeft() + 1;
@@ -103,12 +222,32 @@ void Audio::QueueSample(int left_sample, int right_sample) {
     left_sample *= 64;
     right_sample *= 64;
 
-    if (enable_iir) {
-        resample_buffer[sample_counter * interpolation_factor / 2] = Common::Vec4f{left_sample, right_sample};
+    if (Common::IirResampler::Handles(filter) || Common::FirResampler::Handles(filter)) {
+        if (Common::IirResampler::Handles(filter)) {
+            resampler.Store(sample_counter, left_sample, right_sample);
+        } else {
+            fir.Store(sample_counter, left_sample, right_sample);
+        }
+        if (Common::IirResampler::EndsBlock(sample_counter)) {
+            Resample();
+            SendChunk((sample_counter + 1) * 800 / samples_per_frame);
+        }
+        sample_counter += 1;
+
+        if (sample_counter == samples_per_frame) {
+            // The counters belong to the emulator thread.
+            if (role == Role::Whole) {
+                gameboy.counters.Add(Common::PerfCounters::Resamples);
+            }
+            sample_counter = 0;
+        }
+    } else if (filter == AudioFilter::Blip) {
+        blip.SetAmplitude(sample_counter, left_sample, right_sample);
         sample_counter += 1;
 
         if (sample_counter == samples_per_frame) {
             Resample();
+            SendChunk(800);
             sample_counter = 0;
         }
     } else {
@@ -126,26 +265,39 @@ void Audio::QueueSample(int left_sample, int right_sample) {
         if (sample_counter == samples_per_frame) {
             std::copy(sample_buffer.cbegin(), sample_buffer.cend(), output_buffer.begin());
             sample_buffer.clear();
+            SendChunk(800);
             sample_counter = 0;
         }
     }
 }
 
 void Audio::Resample() {
-    Common::Biquad::LowPassFilter(resample_buffer, biquad);
-
-    for (std::size_t i = 0; i < output_buffer.size() / 2; ++i) {
-        const bool index_is_even = (i * decimation_factor) % 2 == 0;
-        auto [left_sample, right_sample] = resample_buffer[i * decimation_factor / 2].UnpackSamples(index_is_even);
+    const auto bench_timer = gameboy.bench.Time(Common::BenchStats::Audio);
+    if (Common::IirResampler::Handles(filter)) {
+        resampler.FilterBlock(sample_counter, output_buffer);
+    } else if (filter == AudioFilter::Blip) {
+        blip.ReadFrame(output_buffer);
+    } else {
+        fir.FilterBlock(sample_counter, output_buffer);
+    }
+}
 
-        output_buffer[i * 2] = left_sample * 8;
-        output_buffer[i * 2 + 1] = right_sample * 8;
+void Audio::SendChunk(int ready) {
+    // The IIR and FIR filters are ready a block at a time, so chunks are rounded up to whole blocks. Nearest and
+    // blip aren't ready until the end of the frame.
+    if (chunk_frontend == nullptr || (ready - chunk_sent < chunk_samples && ready != 800)) {
+        return;
     }
 
-    std::fill(resample_buffer.begin(), resample_buffer.end(), Common::Vec4f{0.0f, 0.0f});
+    chunk_frontend->PushBackAudioChunk(&output_buffer[chunk_sent * 2], ready - chunk_sent);
+    chunk_sent = ready % 800;
 }
 
 void Audio::WriteSoundRegs(const u16 addr, const u8 data) {
+    if (role == Role::Emulated && !mixer_stale) {
+        audio_thread->RecordWrite(addr, data);
+    }
+
     if (!AudioEnabled()) {
         // On DMG, the length counters are still read-writeable when audio is disabled.
         switch (addr) {
@@ -258,4 +410,28 @@ void Audio::WriteSoundRegs(const u16 addr, const u8 data) {
     }
 }
 
+void Audio::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("audio", sizeof(Audio));
+    report.Add("audio", sample_buffer);
+    report.Add("audio", resampler.Bytes() + fir.Bytes() + blip.Bytes());
+}
+
+void Audio::SerializeState(Common::State& state) {
+    // The resampling and filtering state only affects host output, so it's left running.
+    state.Sync(square1, square2, wave, noise, master_volume, sound_select, sound_on, wave_ram, audio_clock,
+               last_sync);
+
+    if (state.Loading()) {
+        // The mixer carries on from the loaded state.
+        mixer_stale = true;
+    }
+}
+
+void Audio::SerializeMixer(Common::State& state) {
+    state.Sync(last_left_sample, last_right_sample, sample_counter, chunk_sent, sample_buffer, resampler, fir, blip);
+    // The filters write the output a block at a time as the APU's frame goes on, so until it ends, the rest of the
+    // buffer still holds the end of the last one.
+    state.Sync(output_buffer);
+}
+
 } // End namespace Gb
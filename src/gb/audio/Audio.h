@@ -17,25 +17,38 @@
 #pragma once
 
 #include <array>
+#include <memory>
 #include <vector>
 #include <numeric>
 
 #include "common/CommonTypes.h"
 #include "common/Vec4f.h"
-#include "common/Biquad.h"
+#include "common/Resampler.h"
+#include "common/BlipBuffer.h"
+#include "common/CommonEnums.h"
+#include "common/MemoryReport.h"
 #include "gb/core/Enums.h"
 #include "gb/audio/Channel.h"
 
+namespace Emu { class Frontend; }
+
 namespace Gb {
 
 class GameBoy;
+class AudioThread;
 
 class Audio {
 public:
-    Audio(bool enable_filter, const GameBoy& _gameboy);
+    // A whole APU runs the channels and mixes their output. With the audio thread, the emulated APU only runs the
+    // channels for their guest-visible state, and the mixer APU on the thread replays its register writes to mix.
+    enum class Role {Whole, Emulated, Mixer};
+
+    // With a chunk frontend, the output is sent to it as soon as each chunk is mixed, instead of leaving the core to
+    // send it a frame at a time.
+    Audio(AudioFilter _filter, const GameBoy& _gameboy, Role _role, Emu::Frontend* _chunk_frontend);
     ~Audio();
 
-    std::array<s16, 1600> output_buffer;
+    std::array<s16, 1600> output_buffer{};
 
     Channel<Gen::Square1> square1;
     Channel<Gen::Square2> square2;
@@ -49,37 +62,69 @@ public:
     std::array<u8, 0x20> wave_ram{{0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF,
                                    0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF}};
 
-    void UpdateAudio();
+    void Sync();
+    // Brings the APU up to date at the end of a frame, leaving that frame's samples in the output buffer. With the
+    // audio thread, it holds the previous frame's samples instead.
+    void EndFrame();
+    bool OutputEnabled() const { return filter != AudioFilter::None; }
+    bool SendsChunks() const { return chunk_frontend != nullptr; }
+    // How long each chunk takes to emulate in single speed mode, at two cycles per APU tick.
+    int ChunkCycles() const { return chunk_samples * (samples_per_frame * 2 / 800); }
 
     u8 ReadSoundOn() const;
     void WriteSoundRegs(const u16 addr, const u8 data);
 
+    void SerializeState(Common::State& state);
+    // The host-side mixer, which savestates leave out. Only for instances which mix on the emulation thread.
+    void SerializeMixer(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
+
 private:
+    friend class AudioThread;
+
     const GameBoy& gameboy;
+    const Role role;
 
     u32 audio_clock = 0;
+    u64 last_sync = 0;
+
+    int last_left_sample = 0x00;
+    int last_right_sample = 0x00;
 
-    // IIR filter
-    static constexpr int samples_per_frame = 34960;
-    static constexpr int interpolated_buffer_size = std::lcm(800, samples_per_frame);
-    static constexpr int interpolation_factor = interpolated_buffer_size / samples_per_frame;
-    static constexpr int decimation_factor = interpolated_buffer_size / 800;
-    const bool enable_iir;
+    void Run(u64 ticks);
+    void UpdateAudio();
+    u64 QuietTicks() const;
+
+    static constexpr int samples_per_frame = Common::IirResampler::input_samples_per_frame;
+    const AudioFilter filter;
+    bool Mixes() const { return filter != AudioFilter::None && role != Role::Emulated; }
+
+    std::unique_ptr<AudioThread> audio_thread;
+    // Set when the mixer has to carry on from a savestate of this APU, rather than from where it left off, after
+    // a state is loaded or while the audio is suppressed.
+    bool mixer_stale = true;
+    void RecordTicks(u64 ticks);
+    void RestartMixer();
     int sample_counter = 0;
 
     std::vector<s16> sample_buffer;
-    std::vector<Common::Vec4f> resample_buffer;
+    Common::IirResampler resampler;
+    Common::FirResampler fir;
 
-    // Q values are for a 4th order cascaded Butterworth lowpass filter.
-    // Obtained from http://www.earlevel.com/main/2016/09/29/cascading-filters/.
-    static constexpr std::array<float, 2> q{0.54119610f, 1.3065630f};
-    Common::Biquad biquad{interpolated_buffer_size, q[0], q[1]};
+    // Scaled to match the volume of the IIR filter's output.
+    Common::BlipBuffer blip;
 
     u32 GetFrameSequencer() const { return audio_clock >> 13; }
 
     void QueueSample(int left_sample, int right_sample);
     void Resample();
 
+    Emu::Frontend* const chunk_frontend;
+    const int chunk_samples;
+    // The output samples before this one have been sent this frame.
+    int chunk_sent = 0;
+    void SendChunk(int ready);
+
     void WriteSoundOn(u8 data);
 
     void ClearRegisters();
@@ -0,0 +1,111 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gb/audio/AudioThread.h"
+#include "gb/audio/Audio.h"
+#include "common/SaveState.h"
+#include "common/Vec4f.h"
+
+namespace Gb {
+
+AudioThread::AudioThread(AudioFilter filter, const GameBoy& gameboy)
+        : mixer(std::make_unique<Audio>(filter, gameboy, Audio::Role::Mixer, nullptr)) {
+    mix_thread = std::thread{&AudioThread::MixLoop, this};
+}
+
+AudioThread::~AudioThread() {
+    {
+        std::lock_guard<std::mutex> lock{mix_mutex};
+        quit_mix = true;
+    }
+    mix_cv.notify_one();
+    mix_thread.join();
+}
+
+std::vector<u8>& AudioThread::Restart() {
+    recording.writes.clear();
+    recording.trailing_ticks = 0;
+    return recording.start_state;
+}
+
+void AudioThread::EndFrame(std::array<s16, 1600>& output) {
+    {
+        std::unique_lock<std::mutex> lock{mix_mutex};
+        mix_done_cv.wait(lock, [this] { return !frame_queued; });
+
+        // Errors from the mixer thread are rethrown on the emulator thread.
+        if (mix_error) {
+            std::rethrow_exception(std::exchange(mix_error, nullptr));
+        }
+
+        output = mixed_output;
+        std::swap(recording, queued);
+        frame_queued = true;
+    }
+    mix_cv.notify_one();
+
+    // The mixer is done with the journal swapped back, so its buffers are reused without allocating.
+    recording.writes.clear();
+    recording.trailing_ticks = 0;
+    recording.start_state.clear();
+}
+
+void AudioThread::MixLoop() {
+    // The flush-to-zero mode is per thread.
+    Common::Vec4f::SetFlushToZero();
+
+    std::unique_lock<std::mutex> lock{mix_mutex};
+    while (true) {
+        mix_cv.wait(lock, [this] { return quit_mix || frame_queued; });
+        if (quit_mix) {
+            return;
+        }
+
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            Mix(queued);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if (error && !mix_error) {
+            mix_error = error;
+        }
+
+        frame_queued = false;
+        mix_done_cv.notify_all();
+    }
+}
+
+void AudioThread::Mix(const Journal& journal) {
+    if (!journal.start_state.empty()) {
+        auto state = Common::State::ForLoading(journal.start_state, Common::State::System::Gb);
+        mixer->SerializeState(state);
+    }
+
+    for (const SoundWrite& write : journal.writes) {
+        mixer->Run(write.ticks);
+        mixer->WriteSoundRegs(write.addr, write.data);
+    }
+    mixer->Run(journal.trailing_ticks);
+
+    mixed_output = mixer->output_buffer;
+}
+
+} // End namespace Gb
@@ -0,0 +1,90 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/CommonEnums.h"
+
+namespace Gb {
+
+class Audio;
+class GameBoy;
+
+// Mixes and resamples the APU's output on a separate thread. The emulated APU still runs the channels for their
+// guest-visible state, and records its register writes in a journal, along with the ticks between them. At the end
+// of each frame the journal is handed to a second APU on this thread, which replays it to produce the samples. The
+// mixer works on one frame while the next is emulated, so its output comes a frame late.
+class AudioThread {
+public:
+    AudioThread(AudioFilter filter, const GameBoy& gameboy);
+    ~AudioThread();
+
+    void RecordTicks(u64 ticks) { recording.trailing_ticks += ticks; }
+    void RecordWrite(u16 addr, u8 data) {
+        recording.writes.push_back({std::exchange(recording.trailing_ticks, 0), addr, data});
+    }
+
+    // Drops the journal so far, and returns the buffer for the savestate of the APU that the mixer carries on from.
+    std::vector<u8>& Restart();
+
+    // Hands over this frame's journal, and fills the output buffer with the samples of the previous frame.
+    void EndFrame(std::array<s16, 1600>& output);
+
+private:
+    struct SoundWrite {
+        u64 ticks;
+        u16 addr;
+        u8 data;
+    };
+
+    struct Journal {
+        std::vector<SoundWrite> writes;
+        // The ticks after the last write.
+        u64 trailing_ticks = 0;
+        std::vector<u8> start_state;
+    };
+
+    std::unique_ptr<Audio> mixer;
+
+    // The recording journal belongs to the emulator thread and the queued one to the mixer thread, so recording
+    // writes takes no locks. They're swapped under the lock once a frame.
+    Journal recording;
+    Journal queued;
+    std::array<s16, 1600> mixed_output{};
+
+    std::thread mix_thread;
+    std::mutex mix_mutex;
+    std::condition_variable mix_cv;
+    std::condition_variable mix_done_cv;
+    bool frame_queued = false;
+    bool quit_mix = false;
+    std::exception_ptr mix_error;
+
+    void MixLoop();
+    void Mix(const Journal& journal);
+};
+
+} // End namespace Gb
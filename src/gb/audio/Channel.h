@@ -19,6 +19,7 @@
 #include <array>
 
 #include "common/CommonTypes.h"
+#include "common/SaveState.h"
 #include "gb/core/Enums.h"
 
 namespace Gb {
@@ -60,8 +61,21 @@ public:
 
     int AccessibleBankOffset() const { return 32 - PlayingBankOffset(); }
 
+    // The number of ticks the timer counts down before it next reloads, during which the channel's output can't
+    // change unless a frame sequencer step or a register write intervenes.
+    u32 TicksUntilTimerReload() const { return period_timer; }
+    void AdvanceTimer(u32 ticks) { period_timer -= ticks; }
+
     void ClearRegisters();
 
+    void SerializeState(Common::State& state) {
+        state.Sync(sweep, sound_length, volume_envelope, frequency_lo, frequency_hi, channel_enabled, period_timer,
+                   wave_pos, length_counter, prev_length_counter_dec, volume, envelope_counter, prev_envelope_inc,
+                   envelope_enabled, shadow_frequency, sweep_counter, prev_sweep_inc, sweep_enabled,
+                   performed_negative_calculation, current_sample, last_played_sample, wave_ram_length_mask, lfsr,
+                   duty_cycle);
+    }
+
 private:
     const Console console;
     const bool gba_mode;
@@ -75,11 +89,11 @@ private:
     static constexpr u32 sweep_clock_bit = 0x02;
 
     // IO registers
-    u8 sweep;
-    u8 sound_length;
-    u8 volume_envelope;
-    u8 frequency_lo;
-    u8 frequency_hi;
+    u8 sweep = 0x00;
+    u8 sound_length = 0x00;
+    u8 volume_envelope = 0x00;
+    u8 frequency_lo = 0x00;
+    u8 frequency_hi = 0x00;
 
     bool channel_enabled = false;
     u32 period_timer = 0;
@@ -111,7 +125,7 @@ private:
     u16 lfsr = 0x0001;
 
     // Duty Cycle
-    std::array<unsigned int, 8> duty_cycle;
+    std::array<unsigned int, 8> duty_cycle{};
 
     void ResetChannel(u32 frame_seq);
     void TimerTick(const std::array<u8, 0x20>& wave_ram);
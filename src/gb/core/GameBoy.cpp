@@ -14,7 +14,11 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
 
 #include "gb/core/GameBoy.h"
 #include "gb/cpu/Cpu.h"
@@ -26,118 +30,853 @@
 #include "gb/hardware/Serial.h"
 #include "gb/hardware/Joypad.h"
 #include "gb/logging/Logging.h"
-#include "emu/SdlContext.h"
+#include "emu/Frontend.h"
 #include "common/Screenshot.h"
+#include "common/AvRecorder.h"
+#include "common/Metrics.h"
+#include "common/SaveState.h"
+#include "common/FileWriter.h"
+#include "common/Rewind.h"
+#include "common/Movie.h"
+#include "common/Netplay.h"
+#include "common/RamDelta.h"
+#include "common/StepTarget.h"
 
 namespace Gb {
 
-GameBoy::GameBoy(const Console _console, const CartridgeHeader& header, Emu::SdlContext& context,
-                 const std::string& save_path, const std::vector<u8>& rom, bool enable_iir, LogLevel log_level)
+GameBoy::GameBoy(const Console _console, const CartridgeHeader& header, Emu::Frontend& _frontend,
+                 const std::string& save_path, const Common::RomVector<u8>& rom, AudioFilter audio_filter,
+                 LogLevel log_level, LogOverflow log_overflow, int frame_skip_setting, int bench_frames,
+                 int profile_interval, const Common::TraceTrigger& trace_trigger,
+                 const Common::RewindSettings& rewind_settings, int _run_ahead_frames,
+                 const Common::MovieSettings& movie_settings, const Common::SaveSettings& save_settings,
+                 const Common::ScreenshotSettings& screenshot_settings,
+                 const Common::RecordSettings& record_settings, const Common::LinkSettings& link_settings,
+                 const Common::NetplaySettings& netplay_settings,
+                 const Common::RtcSettings& rtc_settings, const Common::MetricsSettings& metrics_settings,
+                 const Common::WatchdogSettings& watchdog_settings, ExecMode exec_mode, GbRenderer renderer,
+                 bool audio_thread)
         : console(_console)
         , game_mode(header.game_mode)
-        , timer(std::make_unique<Timer>(*this))
-        , serial(std::make_unique<Serial>(*this))
-        , lcd(std::make_unique<Lcd>(*this))
+        , netplay(netplay_settings.Enabled()
+                          ? std::make_unique<Common::Netplay>(netplay_settings,
+                                                              Common::XxHash64::Hash(rom.data(), rom.size()))
+                          : nullptr)
+        , rtc_source((netplay != nullptr) ? netplay->RtcStart()
+                                          : Common::MovieRtcStart(movie_settings, rtc_settings))
+        , timer(*this)
+        , serial(*this, link_settings)
+        , lcd(std::make_unique<Lcd>(*this, renderer))
         , joypad(std::make_unique<Joypad>(*this))
-        , audio(std::make_unique<Audio>(enable_iir, *this))
-        , mem(std::make_unique<Memory>(header, rom, save_path, *this))
-        , cpu(std::make_unique<Cpu>(*mem, *this))
-        , logging(std::make_unique<Logging>(log_level, *this))
-        , sdl_context(context)
-        , front_buffer(160 * 144) {
+        , audio(std::make_unique<Audio>(audio_filter, *this,
+                                        (audio_thread && audio_filter != AudioFilter::None) ? Audio::Role::Emulated
+                                                                                             : Audio::Role::Whole,
+                                        // The audio thread mixes a frame late, so it can only send whole frames.
+                                        (audio_thread || _frontend.AudioChunkSamples() == 0) ? nullptr : &_frontend))
+        , mem(std::make_unique<Memory>(header, rom, save_path, save_settings, *this))
+        , cpu(std::make_unique<Cpu>(*mem, *this, exec_mode))
+        , logging(std::make_unique<Logging>(log_level, log_overflow, trace_trigger, *this))
+        , bench(bench_frames)
+        , watchdog(watchdog_settings)
+        , profiler((profile_interval != 0) ? std::make_unique<Common::PcProfiler>(profile_interval) : nullptr)
+        , rewind((rewind_settings.budget != 0) ? std::make_unique<Common::RewindBuffer>(rewind_settings) : nullptr)
+        , recorder(record_settings.Enabled()
+                           ? std::make_unique<Common::AvRecorder>(record_settings, 160, 144, 4194304, cycles_per_frame)
+                           : nullptr)
+        , metrics(metrics_settings.Enabled()
+                          ? std::make_unique<Common::MetricsServer>(metrics_settings, ConsoleCgb() ? "cgb" : "dmg")
+                          : nullptr)
+        , frontend(_frontend)
+        , front_buffer(160 * 144)
+        , front_frame(front_buffer.data())
+        , image_encoder(std::make_unique<Common::ImageEncoder>(screenshot_settings))
+        , frame_skip(frame_skip_setting)
+        , state_path(Common::StatePath(save_path))
+        , run_ahead_frames(_run_ahead_frames)
+        , lend_frames(run_ahead_frames == 0) {
 
     RegisterCallbacks();
+    StartMovie(movie_settings);
 }
 
 // Needed to declare std::unique_ptr with forward-declared type in the header file.
 GameBoy::~GameBoy() = default;
 
 void GameBoy::EmulatorLoop() {
-    // The Game Boy executes exactly 70224 cycles per frame. However, the display runs at a rate of ~59.7275Hz
-    // instead of 60Hz, so on a 60Hz monitor we need to execute 69905 cycles per frame to run at the correct speed.
-    // Unfortunately, the sample rate that gives us does not resample nicely to 800 samples per frame at all. So
-    // instead we execute 69920 cycles per frame, which is very close to the correct speed and resamples much
-    // better to our target sample rate.
-    static constexpr int cycles_per_frame = 69920;
-    int overspent_cycles = 0;
-
-    sdl_context.UnpauseAudio();
+    frontend.UnpauseAudio();
 
     using namespace std::chrono;
     auto max_frame_time = 0us;
     auto avg_frame_time = 0us;
     int frame_count = 0;
 
+    bench.Start();
+
     while (!quit) {
         const auto start_time = steady_clock::now();
 
-        sdl_context.PollEvents();
+        frontend.PollEvents();
 
         if (pause && !frame_advance) {
-            SDL_Delay(48);
-            sdl_context.RenderFrame(front_buffer.data());
+            // Nothing changes while paused unless a state is loaded, so sleep until there's more input rather than
+            // presenting the same frame over and over.
+            if (new_frame) {
+                frontend.RenderFrame(front_frame, std::exchange(new_frame, false));
+            }
+            // A quit which was just polled has no more events coming after it to end the wait.
+            if (!quit) {
+                frontend.WaitForEvents();
+            }
             continue;
         }
 
         frame_advance = false;
 
-        joypad->UpdateJoypad();
+        if (rewinding && rewind != nullptr && !MovieActive()) {
+            RewindFrame();
+            continue;
+        }
 
-        // Overspent cycles is always zero or negative.
-        int target_cycles = (cycles_per_frame << mem->double_speed) + overspent_cycles;
-        overspent_cycles = cpu->RunFor(target_cycles);
+        input_latch_armed = !MovieActive() && netplay == nullptr;
+        input_time = start_time;
+        EmulateFrame();
+        input_latch_armed = false;
+        if (watchdog.Tripped()) {
+            throw std::runtime_error("The CPU has hung. Reason: " + watchdog.Reason());
+        }
 
         auto frame_time = duration_cast<microseconds>(steady_clock::now() - start_time);
+        frame_skip.ReportFrameTime(frame_time);
+        frame_stats.Record(Common::FrameTimeStats::Emulate, frame_time);
         max_frame_time = std::max(max_frame_time, frame_time);
         avg_frame_time += frame_time;
         if (++frame_count == 60) {
-            sdl_context.UpdateFrameTimes(avg_frame_time.count() / 60, max_frame_time.count());
+            frontend.UpdateFrameTimes(avg_frame_time.count() / 60, max_frame_time.count(),
+                                      counters.enabled ? counters.Summary() : "");
+            if (metrics != nullptr) {
+                metrics->Publish(60, counters, frame_stats, frontend.AudioUnderruns(), mem->SaveFlushes());
+            }
             max_frame_time = 0us;
             avg_frame_time = 0us;
             frame_count = 0;
         }
 
-        sdl_context.PushBackAudio(audio->output_buffer);
-        sdl_context.RenderFrame(front_buffer.data());
+        if (run_ahead_frames != 0) {
+            RunAhead();
+        }
+
+        const auto present_time = steady_clock::now();
+        {
+            const auto bench_timer = bench.Time(Common::BenchStats::Present);
+            frontend.RenderFrame((run_ahead_frames != 0) ? run_ahead_frame.data() : front_frame,
+                                 std::exchange(new_frame, false));
+        }
+        frame_stats.Record(Common::FrameTimeStats::Present,
+                           duration_cast<microseconds>(steady_clock::now() - present_time));
+        frame_stats.Record(Common::FrameTimeStats::InputLatency,
+                           duration_cast<microseconds>(present_time - input_time) + frame_stats.display_refresh);
+
+        if (bench.FrameDone()) {
+            quit = true;
+        }
+    }
+
+    frontend.PauseAudio();
+
+    if (bench.Enabled()) {
+        // OAM DMA and HDMA run a byte at a time alongside the CPU, so they're too fine-grained to time separately.
+        bench.PrintReport(ConsoleCgb() ? "cgb" : "dmg", false);
+    }
+
+    if (profiler != nullptr) {
+        logging->DumpProfile(*profiler);
+    }
+
+    if (!suspend_path.empty()) {
+        Suspend();
+    }
+}
+
+void GameBoy::RunFrame() {
+    RunFrames(1);
+}
+
+void GameBoy::RunFrames(int count) {
+    frontend.PollEvents();
+    for (int i = 0; i < count; ++i) {
+        // As with run-ahead, whether a frame is drawn is decided at the vblank before it.
+        suppress_video = i < count - 3;
+        EmulateFrame();
+        hooks.FrameEnded();
+    }
+    suppress_video = false;
+
+    if (run_ahead_frames != 0) {
+        RunAhead();
+    }
+
+    frontend.RenderFrame((run_ahead_frames != 0) ? run_ahead_frame.data() : front_frame,
+                         std::exchange(new_frame, false));
+}
+
+void GameBoy::RunUntil(u64 cycle) {
+    StepTo(cycle);
+}
+
+bool GameBoy::RunUntilEvent(const Common::StepTarget& target, u64 max_cycles) {
+    bool reached = false;
+    {
+        const Common::StepHook step_hook{hooks, target, [this, &reached] {
+            reached = true;
+            cpu->stop_requested = true;
+        }};
+        if (target.type == Common::StepTarget::Type::Pc) {
+            HooksChanged();
+        }
+        StepTo(timestamp + max_cycles);
+    }
+    if (target.type == Common::StepTarget::Type::Pc) {
+        HooksChanged();
+    }
+
+    return reached;
+}
+
+void GameBoy::StepTo(u64 end_cycle) {
+    frontend.PollEvents();
+    while (timestamp < end_cycle && !cpu->stop_requested) {
+        if (!mid_frame && !BeginFrame()) {
+            break;
+        }
+
+        const int slice_cycles = static_cast<int>(std::min<u64>(frame_cycles_left, end_cycle - timestamp));
+        {
+            const auto bench_timer = bench.Time(Common::BenchStats::Cpu);
+            frame_cycles_left += RunCpu(slice_cycles) - slice_cycles;
+        }
+        if (frame_cycles_left <= 0) {
+            EndFrame();
+            hooks.FrameEnded();
+        }
+    }
+    cpu->stop_requested = false;
+
+    frontend.RenderFrame(front_frame, std::exchange(new_frame, false));
+}
+
+void GameBoy::HooksChanged() {
+    mem->HooksChanged();
+    cpu->HooksChanged();
+}
+
+void GameBoy::SetCheats(const std::vector<Common::Cheat>& new_cheats) {
+    cheats = new_cheats;
+
+    std::vector<Common::Cheat> rom_patches;
+    for (const auto& cheat : cheats) {
+        if (cheat.type == Common::Cheat::Type::RomPatch) {
+            rom_patches.push_back(cheat);
+        }
+    }
+    mem->PatchRom(rom_patches);
+    cpu->RomPatched();
+    logging->RomPatched();
+}
+
+void GameBoy::SetBreakpoints(const std::vector<Common::Breakpoint>& breakpoints) {
+    using Type = Common::Breakpoint::Type;
+    const u32 num_wram_banks = static_cast<u32>(mem->WramReference().size() / 0x1000);
+    u32 irq_mask = 0;
+    for (const auto& point : breakpoints) {
+        if (point.type == Type::Exec) {
+            hooks.exec[point.low] = [this](u32 pc) { Break(fmt::format("PC 0x{:0>4X}", pc)); };
+            continue;
+        } else if (point.type == Type::Irq) {
+            irq_mask |= point.low;
+            continue;
+        }
+
+        const bool write = point.type == Type::Write;
+        for (u32 addr = point.low; addr <= point.high; ++addr) {
+            // 0xD000-0xDFFF is watched in every switchable WRAM bank.
+            const u32 wram_addr = (addr >= 0xE000 && addr < 0xFE00) ? addr - 0x2000 : addr;
+            std::vector<std::pair<Common::Hooks::Region, u32>> offsets;
+            if (wram_addr >= 0xC000 && wram_addr < 0xD000) {
+                offsets.emplace_back(Common::Hooks::Wram, wram_addr - 0xC000);
+            } else if (wram_addr >= 0xD000 && wram_addr < 0xE000) {
+                for (u32 bank = 1; bank < num_wram_banks; ++bank) {
+                    offsets.emplace_back(Common::Hooks::Wram, 0x1000 * bank + (wram_addr & 0x0FFF));
+                }
+            } else if (addr >= 0xFF80 && addr < 0xFFFF) {
+                offsets.emplace_back(Common::Hooks::FastRam, addr - 0xFF80);
+            } else {
+                throw std::runtime_error(fmt::format("Can't watch 0x{:0>4X}, only WRAM and HRAM can be watched.",
+                                                     addr));
+            }
+
+            for (const auto& [region, offset] : offsets) {
+                auto& watched = write ? hooks.writes[region] : hooks.reads[region];
+                watched[offset] = [this, write, addr](u32) {
+                    Break(fmt::format("{} of 0x{:0>4X}", write ? "write" : "read", addr));
+                };
+            }
+        }
+    }
+
+    if (irq_mask != 0) {
+        hooks.irq_taken = [this, irq_mask](u32 interrupt_mask) {
+            if (interrupt_mask & irq_mask) {
+                Break(fmt::format("IRQ 0x{:0>2X}", interrupt_mask));
+            }
+        };
+    }
+
+    HooksChanged();
+}
+
+void GameBoy::StreamRamDeltas(const std::string& path, bool compress) {
+    const auto& ext_ram = mem->ExtRamReference();
+    ram_deltas = std::make_unique<Common::RamDeltaWriter>(path, compress, std::vector<Common::RamDeltaWriter::Region>{
+        {mem->WramReference().data(), mem->WramReference().size()},
+        {mem->HramReference().data(), mem->HramReference().size()},
+        {ext_ram.data(), ext_ram.size()},
+    });
+}
+
+void GameBoy::EnableCodeCoverage() {
+    if (code_coverage == nullptr) {
+        code_coverage = std::make_unique<Common::CodeCoverage>(mem->CodeSlots());
+    }
+}
+
+void GameBoy::WriteCoverageReport(const std::string& path) {
+    if (code_coverage != nullptr) {
+        logging->WriteCoverageReport(*code_coverage, path);
+    }
+}
+
+void GameBoy::EnableSuspend(const std::string& path) {
+    if (path.empty() || MovieActive() || netplay != nullptr) {
+        return;
+    }
+
+    suspend_path = path;
+    try {
+        if (Common::ReadSuspendFile(suspend_path, state_buffer)) {
+            LoadState(state_buffer);
+            // The file is written again on exit. Until then, a session which crashes boots normally next time
+            // instead of resuming into the same state again.
+            std::remove(suspend_path.c_str());
+            fmt::print("Resumed from {}\n", suspend_path);
+        }
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to resume: {}\n", error.what());
+    }
+}
+
+void GameBoy::Suspend() {
+    try {
+        SaveState(state_buffer);
+        Common::WriteSuspendFile(suspend_path, state_buffer);
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to suspend: {}\n", error.what());
+    }
+}
+
+void GameBoy::Break(const std::string& reason) {
+    // Also keeps the reads made while printing the break from breaking again.
+    if (break_hit) {
+        return;
+    }
+
+    break_hit = true;
+    pause = true;
+    logging->PrintBreak(reason);
+}
+
+void GameBoy::ApplyCheats() {
+    for (const auto& cheat : cheats) {
+        if (cheat.type == Common::Cheat::Type::RamWrite) {
+            mem->WriteMem(static_cast<u16>(cheat.addr), static_cast<u8>(cheat.value));
+        }
+    }
+}
+
+void GameBoy::PollLatchedInput() {
+    input_latch_armed = false;
+    input_time = std::chrono::steady_clock::now();
+    frontend.LatchInput();
+}
+
+void GameBoy::EmulateFrame() {
+    // A frame left partway through by sub-frame stepping is finished rather than started again.
+    if (!mid_frame && !BeginFrame()) {
+        return;
+    }
+
+    {
+        const auto bench_timer = bench.Time(Common::BenchStats::Cpu);
+        frame_cycles_left = RunCpu(frame_cycles_left);
+    }
+    EndFrame();
+}
+
+bool GameBoy::BeginFrame() {
+    if (netplay != nullptr && !NetplayFrame()) {
+        // Still waiting for the other player to catch up.
+        return false;
+    }
+    if (movie_index != nullptr && movie_index->KeyframeDue()) {
+        SaveState(state_buffer);
+        movie_index->AddKeyframe(state_buffer, overspent_cycles, held_buttons);
+    }
+    if (movie_reader != nullptr) {
+        PlayMovieFrame();
+    }
+    if (movie_writer != nullptr) {
+        movie_writer->Frame(held_buttons);
+    }
+    if (movie_index != nullptr) {
+        movie_index->Frame(held_buttons);
+    }
+
+    joypad->UpdateJoypad();
+    break_hit = false;
+    ApplyCheats();
+
+    // Overspent cycles is always zero or negative.
+    frame_target_cycles = (cycles_per_frame << mem->double_speed) + overspent_cycles;
+    frame_cycles_left = frame_target_cycles;
+    mid_frame = true;
+    logging->FrameStarted();
+    return true;
+}
+
+void GameBoy::EndFrame() {
+    mid_frame = false;
+    overspent_cycles = frame_cycles_left;
+    rtc_source.FrameDone();
+    watchdog.FrameDone(lcd->LcdEnabled());
+    counters.EndFrame(frame_target_cycles - overspent_cycles);
+
+    // Bring the APU up to date so the output buffer contains the full frame.
+    audio->EndFrame();
+    if (audio->OutputEnabled()) {
+        output_hash.Audio(audio->output_buffer.data(), audio->output_buffer.size());
+        if (!audio->SendsChunks()) {
+            frontend.PushBackAudio(audio->output_buffer);
+        }
+    }
+
+    image_encoder->FrameDone(front_frame, 160, 144);
+    if (recorder != nullptr) {
+        recorder->Frame(front_frame, output_hash.FrameHash());
+        if (audio->OutputEnabled()) {
+            recorder->Audio(audio->output_buffer.data(), audio->output_buffer.size());
+        }
+    }
+
+    if (rewind != nullptr && rewind->SnapshotDue()) {
+        SaveState(rewind_state);
+        rewind->Push(rewind_state);
+    }
+    if (ram_deltas != nullptr) {
+        ram_deltas->Frame();
+    }
+    mem->FlushSaveData();
+}
+
+int GameBoy::RunCpu(int cycles) {
+    return audio->SendsChunks() ? RunInChunks(cycles) : cpu->RunFor(cycles);
+}
+
+int GameBoy::RunInChunks(int target_cycles) {
+    // The APU is otherwise only brought up to date when the game touches it, so it's synced after each chunk's
+    // worth of cycles to send that chunk on time.
+    const int chunk_cycles = audio->ChunkCycles() << mem->double_speed;
+    int remaining_cycles = target_cycles;
+    while (remaining_cycles > 0 && !cpu->stop_requested) {
+        const int run_cycles = std::min(remaining_cycles, chunk_cycles);
+        remaining_cycles += cpu->RunFor(run_cycles) - run_cycles;
+        audio->Sync();
     }
 
-    sdl_context.PauseAudio();
+    return remaining_cycles;
 }
 
 void GameBoy::RegisterCallbacks() {
     using Emu::InputEvent;
 
-    sdl_context.RegisterCallback(InputEvent::Quit,         [this](bool) { quit = true; });
-    sdl_context.RegisterCallback(InputEvent::Pause,        [this](bool) { pause = !pause; });
-    sdl_context.RegisterCallback(InputEvent::LogLevel,     [this](bool) { logging->SwitchLogLevel(); });
-    sdl_context.RegisterCallback(InputEvent::Fullscreen,   [this](bool) { sdl_context.ToggleFullscreen(); });
-    sdl_context.RegisterCallback(InputEvent::Screenshot,   [this](bool) { Screenshot(); });
-    sdl_context.RegisterCallback(InputEvent::LcdDebug,     [this](bool) { lcd->DumpEverything(); });
-    sdl_context.RegisterCallback(InputEvent::HideWindow,   [this](bool) { old_pause = pause; pause = true; });
-    sdl_context.RegisterCallback(InputEvent::ShowWindow,   [this](bool) { pause = old_pause; });
-    sdl_context.RegisterCallback(InputEvent::FrameAdvance, [this](bool) { frame_advance = true; });
+    frontend.RegisterCallback(InputEvent::Quit,         [this](bool) { quit = true; });
+    frontend.RegisterCallback(InputEvent::Pause,        [this](bool) { pause = !pause; });
+    frontend.RegisterCallback(InputEvent::LogLevel,     [this](bool) { logging->SwitchLogLevel(); });
+    frontend.RegisterCallback(InputEvent::Fullscreen,   [this](bool) { frontend.ToggleFullscreen(); });
+    frontend.RegisterCallback(InputEvent::Screenshot,   [this](bool) { Screenshot(); });
+    frontend.RegisterCallback(InputEvent::LcdDebug,     [this](bool) { lcd->DumpEverything(); });
+    frontend.RegisterCallback(InputEvent::HideWindow,   [this](bool) { old_pause = pause; pause = true; });
+    frontend.RegisterCallback(InputEvent::ShowWindow,   [this](bool) { pause = old_pause; });
+    frontend.RegisterCallback(InputEvent::FrameAdvance, [this](bool) { frame_advance = true; });
+    frontend.RegisterCallback(InputEvent::FrameSkip,    [this](bool) { frame_skip.CycleSetting(); });
+    frontend.RegisterCallback(InputEvent::FrameStats,   [this](bool) { fmt::print("{}\n", frame_stats.Report()); });
+    frontend.RegisterCallback(InputEvent::SaveState,    [this](bool) { SaveStateFile(); });
+    frontend.RegisterCallback(InputEvent::LoadState,    [this](bool) { LoadStateFile(); });
+    frontend.RegisterCallback(InputEvent::Rewind,       [this](bool press) { rewinding = press; });
+
+    for (int i = 0; i < Emu::button_count; ++i) {
+        const auto button = Emu::ButtonFromIndex(i);
+        frontend.RegisterCallback(button, [this, button](bool press) { ButtonInput(button, press); });
+    }
+}
+
+void GameBoy::ButtonInput(Emu::InputEvent button, bool press) {
+    if (netplay != nullptr) {
+        const int index = Emu::ButtonIndex(button);
+        local_buttons = press ? (local_buttons | (1 << index)) : (local_buttons & ~(1 << index));
+    } else if (movie_reader == nullptr) {
+        // While a movie plays, it's the only source of input.
+        PressButton(button, press);
+    }
+}
+
+void GameBoy::PressButton(Emu::InputEvent button, bool press) {
+    using Emu::InputEvent;
+
+    const int index = Emu::ButtonIndex(button);
+    held_buttons = press ? (held_buttons | (1 << index)) : (held_buttons & ~(1 << index));
+
+    switch (button) {
+    case InputEvent::Up:
+        joypad->Press(Joypad::Up, press);
+        break;
+    case InputEvent::Left:
+        joypad->Press(Joypad::Left, press);
+        break;
+    case InputEvent::Down:
+        joypad->Press(Joypad::Down, press);
+        break;
+    case InputEvent::Right:
+        joypad->Press(Joypad::Right, press);
+        break;
+    case InputEvent::A:
+        joypad->Press(Joypad::A, press);
+        break;
+    case InputEvent::B:
+        joypad->Press(Joypad::B, press);
+        break;
+    case InputEvent::Start:
+        joypad->Press(Joypad::Start, press);
+        break;
+    case InputEvent::Select:
+        joypad->Press(Joypad::Select, press);
+        break;
+    default:
+        // The Game Boy has no L or R buttons.
+        break;
+    }
+}
 
-    sdl_context.RegisterCallback(InputEvent::Up,     [this](bool press) { joypad->Press(Joypad::Up, press); });
-    sdl_context.RegisterCallback(InputEvent::Left,   [this](bool press) { joypad->Press(Joypad::Left, press); });
-    sdl_context.RegisterCallback(InputEvent::Down,   [this](bool press) { joypad->Press(Joypad::Down, press); });
-    sdl_context.RegisterCallback(InputEvent::Right,  [this](bool press) { joypad->Press(Joypad::Right, press); });
-    sdl_context.RegisterCallback(InputEvent::A,      [this](bool press) { joypad->Press(Joypad::A, press); });
-    sdl_context.RegisterCallback(InputEvent::B,      [this](bool press) { joypad->Press(Joypad::B, press); });
-    sdl_context.RegisterCallback(InputEvent::L,      [](bool) { });
-    sdl_context.RegisterCallback(InputEvent::R,      [](bool) { });
-    sdl_context.RegisterCallback(InputEvent::Start,  [this](bool press) { joypad->Press(Joypad::Start, press); });
-    sdl_context.RegisterCallback(InputEvent::Select, [this](bool press) { joypad->Press(Joypad::Select, press); });
+u16* GameBoy::SwapBuffers(u16* finished, std::vector<u16>& back_buffer) {
+    u16* next = lend_frames ? frontend.NextFrameTarget(finished) : nullptr;
+    if (next == nullptr) {
+        // The LCD's buffer and the front buffer take turns, whichever one isn't holding the finished frame.
+        next = (finished == front_buffer.data()) ? back_buffer.data() : front_buffer.data();
+    }
+    front_frame = finished;
+
+    // Static screens, like menus and text boxes, give the same frame over and over, which needn't be presented
+    // again.
+    if (output_hash.Frame(front_frame, front_buffer.size())) {
+        new_frame = true;
+    }
+    return next;
 }
 
-void GameBoy::SwapBuffers(std::vector<u16>& back_buffer) {
-    front_buffer.swap(back_buffer);
+bool GameBoy::SkipNextFrame() {
+    // Every frame is drawn while recording, so frame skip doesn't leave gaps in the video.
+    return suppress_video || (recorder == nullptr && frame_skip.SkipNextFrame());
 }
 
 void GameBoy::Screenshot() const {
-    Common::WriteImageToFile(Common::BGR5ToRGB8(front_buffer), "screenshot", 160, 144);
+    image_encoder->Screenshot(front_frame, 160, 144, "screenshot");
+}
+
+void GameBoy::SaveState(std::vector<u8>& buffer) {
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gb);
+    SerializeState(state);
+}
+
+void GameBoy::LoadState(const std::vector<u8>& buffer) {
+    // A bad state can be rejected partway through, so keep the current state to fall back on.
+    SaveState(fallback_state);
+
+    try {
+        auto state = Common::State::ForLoading(buffer, Common::State::System::Gb);
+        SerializeState(state);
+    } catch (const std::runtime_error&) {
+        auto state = Common::State::ForLoading(fallback_state, Common::State::System::Gb);
+        SerializeState(state);
+        throw;
+    }
+}
+
+void GameBoy::SaveHostState(std::vector<u8>& buffer) {
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gb);
+    SerializeHostState(state);
+}
+
+void GameBoy::LoadHostState(const std::vector<u8>& buffer) {
+    auto state = Common::State::ForLoading(buffer, Common::State::System::Gb);
+    SerializeHostState(state);
+}
+
+void GameBoy::SerializeHostState(Common::State& state) {
+    state.Sync(overspent_cycles, mid_frame, frame_cycles_left, frame_target_cycles);
+    audio->SerializeMixer(state);
+}
+
+Common::MemoryReport GameBoy::ReportMemory() const {
+    Common::MemoryReport report;
+    report.Add("core", sizeof(GameBoy));
+    mem->ReportMemory(report);
+    cpu->ReportMemory(report);
+    lcd->ReportMemory(report);
+    audio->ReportMemory(report);
+    report.Add("frame_buffers", front_buffer);
+    report.Add("frame_buffers", run_ahead_frame);
+    report.Add("savestates", state_buffer);
+    report.Add("savestates", fallback_state);
+    report.Add("savestates", rewind_state);
+    report.Add("savestates", run_ahead_state);
+    if (rewind != nullptr) {
+        report.Add("rewind", rewind->Bytes());
+    }
+    if (netplay != nullptr) {
+        report.Add("netplay", netplay->SnapshotBytes());
+    }
+
+    return report;
+}
+
+void GameBoy::SerializeState(Common::State& state) {
+    // The console and game mode are fixed by the cartridge, so they're only checked.
+    Console state_console = console;
+    state.Sync(state_console);
+    if (state_console != console) {
+        throw std::runtime_error("Savestate is for a different Game Boy model.");
+    }
+
+    state.Sync(timestamp, lcd_on_when_stopped, rtc_source);
+    state.Sync(*cpu, *mem, *lcd, *audio, timer, serial, *joypad);
+    state.Sync(output_hash);
+    if (state.Loading()) {
+        // The frontend may still be presenting a frame it lent, so a loaded frame goes back in the core's own buffer.
+        front_frame = front_buffer.data();
+    }
+    state.SyncContents(front_frame, front_buffer.size());
+    // A loaded state comes with its own frame.
+    if (state.Loading()) {
+        new_frame = true;
+    }
+}
+
+void GameBoy::RunAhead() {
+    // The frame just emulated is the real one. Emulate a few more with the same input to show where it leads, then
+    // go back. Games which act on input a frame or two after reading it respond that much sooner.
+    SaveState(run_ahead_state);
+
+    int ahead_overspent_cycles = overspent_cycles;
+    suppress_audio = true;
+    for (int i = 0; i < run_ahead_frames; ++i) {
+        // Whether a frame is drawn is decided at the vblank before it, which can come two host frames before the
+        // one it finishes in. So only the ahead frames which can't end up being presented are skipped.
+        suppress_video = i < run_ahead_frames - 3;
+        ahead_overspent_cycles = cpu->RunFor((cycles_per_frame << mem->double_speed) + ahead_overspent_cycles);
+        rtc_source.FrameDone();
+    }
+    suppress_video = false;
+    suppress_audio = false;
+
+    run_ahead_frame.assign(front_frame, front_frame + front_buffer.size());
+
+    // Run ahead states were made by this core, so they're loaded without keeping a fallback.
+    auto state = Common::State::ForLoading(run_ahead_state, Common::State::System::Gb);
+    SerializeState(state);
+}
+
+void GameBoy::RewindFrame() {
+    // Rewind snapshots were made by this core, so they're loaded without keeping a fallback.
+    if (rewind->Pop(rewind_state)) {
+        auto state = Common::State::ForLoading(rewind_state, Common::State::System::Gb);
+        SerializeState(state);
+    }
+
+    frontend.RenderFrame(front_frame, std::exchange(new_frame, false));
+}
+
+void GameBoy::StartMovie(const Common::MovieSettings& movie_settings) {
+    if (!movie_settings.play_path.empty()) {
+        movie_reader = std::make_unique<Common::MovieReader>(movie_settings.play_path, Common::State::System::Gb);
+        if (!movie_reader->StartState().empty()) {
+            LoadState(movie_reader->StartState());
+        }
+        movie_index = Common::OpenMovieIndex(movie_settings, movie_reader->InputHash(0));
+        if (movie_settings.seek_frame != 0) {
+            SeekMovie(movie_settings.seek_frame);
+        }
+    } else if (!movie_settings.record_path.empty()) {
+        std::vector<u8> start_state;
+        if (movie_settings.record_from_state) {
+            if (!Common::ReadStateFile(state_path, start_state)) {
+                throw std::runtime_error("No savestate found at " + state_path + " to record from.");
+            }
+            LoadState(start_state);
+        }
+        movie_writer = std::make_unique<Common::MovieWriter>(movie_settings.record_path, Common::State::System::Gb,
+                                                             rtc_source.FixedStart(), start_state);
+        movie_index = Common::OpenMovieIndex(movie_settings,
+                                             Common::MovieStartHash(rtc_source.FixedStart(), start_state));
+    }
+}
+
+void GameBoy::PlayMovieFrame() {
+    u16 buttons;
+    if (!movie_reader->Frame(buttons)) {
+        fmt::print("Input movie finished.\n");
+        movie_reader.reset();
+        movie_index.reset();
+        return;
+    }
+
+    SetButtons(buttons);
+}
+
+void GameBoy::SeekMovie(s64 frame) {
+    if (!movie_reader->Seek(frame)) {
+        throw std::runtime_error("The input movie ends before frame " + std::to_string(frame) + ".");
+    }
+
+    Common::MovieIndex::Keyframe keyframe;
+    if (movie_index != nullptr && movie_index->Seek(frame, *movie_reader, keyframe)) {
+        LoadState(keyframe.state);
+        overspent_cycles = keyframe.overspent_cycles;
+        held_buttons = keyframe.held_buttons;
+    }
+    movie_reader->Seek(keyframe.frame);
+
+    // The rest of the way is played without sound, and only the last few frames are drawn.
+    suppress_audio = true;
+    for (s64 i = keyframe.frame; i < frame; ++i) {
+        suppress_video = i < frame - 3;
+        EmulateFrame();
+    }
+    suppress_video = false;
+    suppress_audio = false;
+}
+
+void GameBoy::SetButtons(u16 buttons) {
+    for (int i = 0; i < Emu::button_count; ++i) {
+        if ((buttons ^ held_buttons) & (1 << i)) {
+            PressButton(Emu::ButtonFromIndex(i), buttons & (1 << i));
+        }
+    }
+}
+
+bool GameBoy::NetplayFrame() {
+    if (!netplay->WaitForInputWindow()) {
+        return false;
+    }
+
+    const s64 mispredicted_frame = netplay->TakeMisprediction();
+    if (mispredicted_frame != Common::Netplay::none) {
+        Resimulate(mispredicted_frame);
+    }
+
+    SaveSnapshot(netplay->Frame());
+    SetButtons(netplay->AdvanceFrame(local_buttons));
+    return true;
+}
+
+void GameBoy::SaveSnapshot(s64 frame) {
+    Common::Netplay::Snapshot& snapshot = netplay->SnapshotAt(frame);
+    SaveState(snapshot.state);
+    snapshot.overspent_cycles = overspent_cycles;
+    snapshot.held_buttons = held_buttons;
+}
+
+void GameBoy::Resimulate(s64 from_frame) {
+    // Snapshots were made by this core, so they're loaded without keeping a fallback.
+    const Common::Netplay::Snapshot& start = netplay->SnapshotAt(from_frame);
+    auto state = Common::State::ForLoading(start.state, Common::State::System::Gb);
+    SerializeState(state);
+    overspent_cycles = start.overspent_cycles;
+    held_buttons = start.held_buttons;
+
+    const s64 to_frame = netplay->Frame();
+    netplay->CountRollback(to_frame - from_frame);
+
+    suppress_audio = true;
+    for (s64 frame = from_frame; frame < to_frame; ++frame) {
+        if (frame != from_frame) {
+            SaveSnapshot(frame);
+        }
+
+        // As with run-ahead, only the frames which could end up being presented are drawn.
+        suppress_video = frame < to_frame - 3;
+        SetButtons(netplay->ReplayInput(frame));
+        joypad->UpdateJoypad();
+        overspent_cycles = cpu->RunFor((cycles_per_frame << mem->double_speed) + overspent_cycles);
+        rtc_source.FrameDone();
+    }
+    suppress_video = false;
+    suppress_audio = false;
+}
+
+void GameBoy::SaveStateFile() {
+    if (state_path.empty()) {
+        return;
+    }
+
+    try {
+        SaveState(state_buffer);
+        // Written in the background. If the write fails, the writer prints why.
+        Common::SharedFileWriter().Write(state_path, state_buffer);
+        fmt::print("Saving state to {}\n", state_path);
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to save state: {}\n", error.what());
+    }
+}
+
+void GameBoy::LoadStateFile() {
+    if (state_path.empty()) {
+        return;
+    } else if (MovieActive()) {
+        fmt::print("Can't load a savestate during an input movie.\n");
+        return;
+    } else if (netplay != nullptr) {
+        fmt::print("Can't load a savestate during netplay.\n");
+        return;
+    }
+
+    try {
+        // A state saved just before may still be on its way to the file.
+        Common::SharedFileWriter().Flush();
+        if (!Common::ReadStateFile(state_path, state_buffer)) {
+            fmt::print("No savestate found at {}\n", state_path);
+            return;
+        }
+        LoadState(state_buffer);
+        fmt::print("Loaded state from {}\n", state_path);
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to load state: {}\n", error.what());
+    }
 }
 
 void GameBoy::HardwareTick(unsigned int cycles) {
+    // The APU, timer, serial port and LCD catch up to the timestamp whenever their registers are accessed. The timer,
+    // serial port and LCD are still stepped on the cycles where they have something to do, to request interrupts on
+    // the right cycle.
+    timestamp += cycles;
+
     for (; cycles != 0; cycles -= 4) {
         // Enable interrupts if EI was previously called.
         cpu->EnableInterruptsDelayed();
@@ -145,33 +884,51 @@ void GameBoy::HardwareTick(unsigned int cycles) {
         // Update the rest of the system hardware.
         mem->UpdateOamDma();
         mem->UpdateHdma();
-        timer->UpdateTimer();
-        serial->UpdateSerial();
-        lcd->UpdateLcd();
-
-        // The APU always updates at 2MHz, regardless of double speed mode. So we need to update it twice an M-cycle
-        // in single-speed mode.
-        for (int i = 0; i < (2 >> mem->double_speed); ++i) {
-            audio->UpdateAudio();
-        }
+        timer.Tick(timestamp - cycles + 4);
+        serial.Tick(timestamp - cycles + 4);
+        lcd->Tick(timestamp - cycles + 4);
 
         mem->IF_written_this_cycle = false;
     }
 }
 
 void GameBoy::HaltedTick(unsigned int cycles) {
+    timestamp += cycles;
+
     for (; cycles != 0; cycles -= 4) {
         // Update the rest of the system hardware.
-        timer->UpdateTimer();
-        serial->UpdateSerial();
-        lcd->UpdateLcd();
+        timer.Tick(timestamp - cycles + 4);
+        serial.Tick(timestamp - cycles + 4);
+        lcd->Tick(timestamp - cycles + 4);
+    }
+}
 
-        // The APU always updates at 2MHz, regardless of double speed mode. So we need to update it twice an M-cycle
-        // in single-speed mode.
-        for (int i = 0; i < (2 >> mem->double_speed); ++i) {
-            audio->UpdateAudio();
+u64 GameBoy::QuietCycles() const {
+    return std::min({lcd->QuietTicks(), timer.QuietTicks(), serial.QuietTicks()}) * 4;
+}
+
+int GameBoy::HaltedFor(int cycles, bool wake_on_interrupt) {
+    // Runs the hardware for the given number of cycles, or until an enabled interrupt is requested. In between the
+    // cycles where the LCD, timer or serial port has something to do, the ticks are skipped all at once.
+    int halted_cycles = 0;
+    while (halted_cycles < cycles) {
+        HaltedTick(4);
+        halted_cycles += 4;
+
+        if (wake_on_interrupt && mem->RequestedEnabledInterrupts()) {
+            break;
+        }
+
+        const u64 remaining_ticks = (std::max(cycles - halted_cycles, 0) + 3) / 4;
+        const u64 quiet_ticks = std::min({remaining_ticks, lcd->QuietTicks(), timer.QuietTicks(),
+                                          serial.QuietTicks()});
+        if (quiet_ticks > 0) {
+            timestamp += quiet_ticks * 4;
+            halted_cycles += quiet_ticks * 4;
         }
     }
+
+    return halted_cycles;
 }
 
 bool GameBoy::JoypadPress() const {
@@ -183,14 +940,20 @@ void GameBoy::StopLcd() {
     lcd_on_when_stopped = lcd->lcdc & 0x80;
 
     // Turn off the LCD.
+    lcd->Sync();
     lcd->lcdc &= 0x7F;
+    lcd->ScheduleEvent();
 }
 
 void GameBoy::SpeedSwitch() {
+    // The APU's tick rate relative to the CPU changes with the speed switch, so it has to catch up first.
+    audio->Sync();
+    lcd->Sync();
     mem->ToggleCpuSpeed();
 
     // If the LCD was on when we entered STOP mode, turn it back on.
     lcd->lcdc |= lcd_on_when_stopped;
+    lcd->ScheduleEvent();
 }
 
 } // End namespace Gb
@@ -0,0 +1,123 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <array>
+#include <vector>
+#include <fmt/format.h>
+
+#include "gb/core/Validator.h"
+#include "gb/core/GameBoy.h"
+#include "gb/cpu/Cpu.h"
+#include "gb/memory/Memory.h"
+#include "gb/lcd/Lcd.h"
+#include "gb/audio/Audio.h"
+#include "gb/hardware/Timer.h"
+#include "gb/hardware/Serial.h"
+#include "gb/hardware/Joypad.h"
+#include "common/SaveState.h"
+
+namespace Gb {
+
+namespace {
+
+template<typename T>
+std::vector<u8> ComponentState(T& component) {
+    std::vector<u8> buffer;
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gb);
+    state.Sync(component);
+    return buffer;
+}
+
+void ReportComponents(GameBoy& reference, GameBoy& candidate) {
+    const std::vector<std::pair<const char*, bool>> components{
+        {"rtc",    ComponentState(reference.rtc_source) != ComponentState(candidate.rtc_source)},
+        {"cpu",    ComponentState(*reference.cpu) != ComponentState(*candidate.cpu)},
+        {"memory", ComponentState(*reference.mem) != ComponentState(*candidate.mem)},
+        {"lcd",    ComponentState(*reference.lcd) != ComponentState(*candidate.lcd)},
+        {"audio",  ComponentState(*reference.audio) != ComponentState(*candidate.audio)},
+        {"timer",  ComponentState(reference.timer) != ComponentState(candidate.timer)},
+        {"serial", ComponentState(reference.serial) != ComponentState(candidate.serial)},
+        {"joypad", ComponentState(*reference.joypad) != ComponentState(*candidate.joypad)},
+        {"frame",  reference.output_hash.FrameHash() != candidate.output_hash.FrameHash()},
+    };
+
+    std::string diverged;
+    for (const auto& [name, differs] : components) {
+        if (differs) {
+            diverged += diverged.empty() ? name : std::string{", "} + name;
+        }
+    }
+    fmt::print("Diverged: {}\n", diverged);
+
+    fmt::print("Cycle:      {:>10}  {:>10}\n", reference.timestamp, candidate.timestamp);
+    fmt::print("PC:             0x{:0>4X}      0x{:0>4X}\n", reference.cpu->GetPc(), candidate.cpu->GetPc());
+    constexpr std::array<const char*, 5> reg_names{{"AF:", "BC:", "DE:", "HL:", "SP:"}};
+    const Registers& reference_regs = reference.cpu->GetRegisters();
+    const Registers& candidate_regs = candidate.cpu->GetRegisters();
+    for (std::size_t i = 0; i < 5; ++i) {
+        if (reference_regs.reg16[i] != candidate_regs.reg16[i]) {
+            fmt::print("{:<12}    0x{:0>4X}      0x{:0>4X}\n", reg_names[i], reference_regs.reg16[i],
+                       candidate_regs.reg16[i]);
+        }
+    }
+}
+
+// CGB WRAM has more banks than fit in the address space, so RAM is reported by its offset rather than its address.
+void ReportRam(const char* name, const std::vector<u8>& reference, const std::vector<u8>& candidate) {
+    for (std::size_t i = 0; i < reference.size(); ++i) {
+        if (reference[i] != candidate[i]) {
+            fmt::print("{:<11} +0x{:0>4X}: 0x{:0>2X}  0x{:0>2X}\n", name, i, reference[i], candidate[i]);
+            return;
+        }
+    }
+}
+
+} // End anonymous namespace
+
+bool ValidateEngines(GameBoy& reference, GameBoy& candidate, int frames, const std::string& state_path) {
+    std::vector<u8> start_state;
+    std::vector<u8> reference_state;
+    std::vector<u8> candidate_state;
+
+    for (int frame = 0; frames == 0 || frame < frames; ++frame) {
+        reference.SaveState(start_state);
+
+        reference.RunFrame();
+        candidate.RunFrame();
+
+        reference.SaveState(reference_state);
+        candidate.SaveState(candidate_state);
+        if (reference_state == candidate_state
+                && reference.output_hash.FrameHash() == candidate.output_hash.FrameHash()) {
+            continue;
+        }
+
+        fmt::print("The modes diverged in frame {}. Reference first, then the mode being validated.\n", frame);
+        ReportComponents(reference, candidate);
+
+        ReportRam("WRAM", reference.mem->WramReference(), candidate.mem->WramReference());
+        ReportRam("HRAM", reference.mem->HramReference(), candidate.mem->HramReference());
+
+        Common::WriteStateFile(state_path, start_state);
+        fmt::print("Wrote the state from the start of frame {} to {}\n", frame, state_path);
+        return false;
+    }
+
+    fmt::print("The modes agreed for all {} frames.\n", frames);
+    return true;
+}
+
+} // End namespace Gb
@@ -0,0 +1,92 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gb/cpu/BlockCache.h"
+#include "gb/cpu/Cpu.h"
+#include "gb/memory/Memory.h"
+
+namespace Gb {
+
+BlockCache::BlockCache(const Memory& _mem)
+        : mem(_mem) {}
+
+Block& BlockCache::Lookup(u16 addr) {
+    const std::size_t rom_offset = mem.RomOffset(addr);
+    const std::size_t bank_num = rom_offset / bank_size;
+    if (bank_num >= banks.size()) {
+        banks.resize(bank_num + 1);
+    }
+    if (banks[bank_num] == nullptr) {
+        banks[bank_num] = std::make_unique<Bank>();
+    }
+
+    Bank& bank = *banks[bank_num];
+    u16& index = bank.block_index[rom_offset % bank_size];
+    if (index == 0) {
+        bank.blocks.push_back(Decode(addr));
+        index = bank.blocks.size();
+    }
+
+    return bank.blocks[index - 1];
+}
+
+Block BlockCache::Decode(u16 addr) const {
+    // Blocks end at the end of a bank, since the next bank mapped there could be any of them.
+    const unsigned int bank_end = (addr < bank_size) ? bank_size : 2 * bank_size;
+
+    Block block;
+    unsigned int op_addr = addr;
+    while (block.ops.size() < max_block_ops) {
+        const u8 opcode = mem.ReadMem(op_addr);
+        const Cpu::BlockOpInfo* info = &Cpu::block_table[opcode];
+        if (opcode == 0xCB && op_addr + 1 < bank_end) {
+            info = &Cpu::cb_block_table[mem.ReadMem(op_addr + 1)];
+        }
+
+        if (info->handler == nullptr || op_addr + info->length > bank_end) {
+            break;
+        }
+
+        u16 immediate = 0;
+        if (info->length == 2) {
+            immediate = mem.ReadMem(op_addr + 1);
+        } else if (info->length == 3) {
+            immediate = mem.ReadMem(op_addr + 1) | (mem.ReadMem(op_addr + 2) << 8);
+        }
+
+        block.ops.push_back({info->handler, immediate, opcode, static_cast<u8>(info->length),
+                             static_cast<u8>(info->cycles)});
+        op_addr += info->length;
+    }
+
+    return block;
+}
+
+void BlockCache::ReportMemory(Common::MemoryReport& report) const {
+    std::size_t bytes = sizeof(BlockCache) + banks.capacity() * sizeof(std::unique_ptr<Bank>);
+    for (const auto& bank : banks) {
+        if (bank != nullptr) {
+            bytes += sizeof(Bank) + bank->blocks.capacity() * sizeof(Block);
+            for (const Block& block : bank->blocks) {
+                bytes += block.ops.capacity() * sizeof(DecodedOp);
+            }
+        }
+    }
+
+    report.Add("block_cache", bytes);
+}
+
+} // End namespace Gb
@@ -0,0 +1,80 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/MemoryReport.h"
+
+namespace Gb {
+
+class Cpu;
+class Memory;
+struct JitRun;
+
+// A decoded instruction, with its immediate already read.
+struct DecodedOp {
+    void (*handler)(Cpu& cpu, u16 immediate);
+    u16 immediate;
+    u8 opcode;
+    u8 length;
+    u8 cycles;
+};
+
+// A run of instructions which only touch registers. It's empty if the first instruction can't be part of one.
+struct Block {
+    std::vector<DecodedOp> ops;
+
+    // Only used by the JIT, which counts how often the block runs until it's hot enough to compile.
+    u16 hits = 0;
+    const JitRun* run = nullptr;
+
+    // Set once the block's instructions have been marked in the code coverage map.
+    bool covered = false;
+};
+
+// Caches the blocks decoded from ROM. They're kept by their offset in the ROM rather than by address, so switching
+// banks never has to throw any of them away.
+class BlockCache {
+public:
+    explicit BlockCache(const Memory& _mem);
+
+    // Returns the block starting at the given address, which must be in ROM, in whichever banks are mapped now.
+    Block& Lookup(u16 addr);
+
+    void ReportMemory(Common::MemoryReport& report) const;
+
+private:
+    const Memory& mem;
+
+    static constexpr std::size_t bank_size = 0x4000;
+    static constexpr std::size_t max_block_ops = 32;
+
+    // Banks are only allocated once code runs from them. An index of 0 means no block has been decoded there yet.
+    struct Bank {
+        std::array<u16, bank_size> block_index{};
+        std::vector<Block> blocks;
+    };
+    std::vector<std::unique_ptr<Bank>> banks;
+
+    Block Decode(u16 addr) const;
+};
+
+} // End namespace Gb
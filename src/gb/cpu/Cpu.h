@@ -16,13 +16,25 @@
 
 #pragma once
 
+#include <array>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "common/CommonTypes.h"
+#include "common/CommonEnums.h"
+#include "common/MemoryReport.h"
 #include "gb/core/Enums.h"
 
+namespace Common { class State; }
+
 namespace Gb {
 
 class Memory;
 class GameBoy;
+class BlockCache;
+class Jit;
+struct Block;
 
 // Declared outside of class for Logging.
 union Registers {
@@ -32,14 +44,33 @@ union Registers {
 
 class Cpu {
 public:
-    Cpu(Memory& _mem, GameBoy& _gameboy);
+    Cpu(Memory& _mem, GameBoy& _gameboy, ExecMode exec_mode);
+    ~Cpu();
+
+    // Set by sub-frame stepping to end RunFor after the current instruction, and cleared again by it.
+    bool stop_requested = false;
 
     int RunFor(int cycles);
     void EnableInterruptsDelayed();
 
+    void SerializeState(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
+    void HooksChanged();
+    // Throws away every block and compiled run, which may have been decoded from ROM that cheats have now patched.
+    void RomPatched();
+
+    u16 GetPc() const { return pc; }
+    const Registers& GetRegisters() const { return regs; }
+
 private:
+    friend class BlockCache;
+
     Memory& mem;
     GameBoy& gameboy;
+    // Only present in the cached and JIT execution modes.
+    std::unique_ptr<BlockCache> block_cache;
+    // Only present in the JIT execution mode, on hosts it can generate code for.
+    std::unique_ptr<Jit> jit;
 
     // Registers
     u16 pc = 0x0100;
@@ -54,10 +85,89 @@ private:
 
     // Interpreter execution
     enum class CpuMode {Running, Halted, HaltBug, Stopped};
+    // Set while any PC is hooked. Blocks don't stop between instructions, so they're left to the interpreter.
+    bool exec_hooked = false;
     CpuMode cpu_mode = CpuMode::Running;
     unsigned int speed_switch_cycles = 0;
     unsigned int ExecuteNext(const u8 opcode);
-    void StoppedTick();
+    int StoppedTick(int cycles);
+
+    // Opcode dispatch. Each handler is generated from its opcode at compile time, and returns any cycles it took
+    // beyond those listed in its table entry.
+    using OpHandler = unsigned int (*)(Cpu& cpu);
+    struct OpInfo {
+        OpHandler handler;
+        unsigned int cycles;
+    };
+
+    static const std::array<OpInfo, 256> op_table;
+    static const std::array<OpInfo, 256> cb_table;
+
+    template<u8 opcode>
+    static unsigned int Op(Cpu& cpu);
+    template<u8 opcode>
+    static unsigned int CbOp(Cpu& cpu);
+
+    template<std::size_t... opcodes>
+    static constexpr std::array<OpInfo, 256> MakeOpTable(std::index_sequence<opcodes...>);
+    template<std::size_t... opcodes>
+    static constexpr std::array<OpInfo, 256> MakeCbTable(std::index_sequence<opcodes...>);
+
+    // Cached execution. Instructions which only touch registers are decoded into blocks ahead of time, with their
+    // immediates already read. Nothing else in the system can see them execute, so while the hardware has nothing
+    // to do, a block runs without ticking it and the hardware catches up once at the end. The handler is null for
+    // any instruction which can't be part of a block.
+    using BlockHandler = void (*)(Cpu& cpu, u16 immediate);
+    struct BlockOpInfo {
+        BlockHandler handler;
+        unsigned int length;
+        unsigned int cycles;
+    };
+
+    static const std::array<BlockOpInfo, 256> block_table;
+    static const std::array<BlockOpInfo, 256> cb_block_table;
+
+    template<u8 opcode>
+    static void BlockOp(Cpu& cpu, u16 immediate);
+    template<u8 opcode>
+    static void CbBlockOp(Cpu& cpu, u16 immediate);
+
+    template<std::size_t... opcodes>
+    static constexpr std::array<BlockOpInfo, 256> MakeBlockTable(std::index_sequence<opcodes...>);
+    template<std::size_t... opcodes>
+    static constexpr std::array<BlockOpInfo, 256> MakeCbBlockTable(std::index_sequence<opcodes...>);
+
+    bool CanRunBlock() const;
+    int RunBlock(Block& block, int cycles);
+    void MarkCode(u16 addr);
+
+    // Register codes as they are encoded in opcodes. Code 6 refers to (HL) and has no register here.
+    static constexpr Reg8Addr Reg8Operand(unsigned int code) {
+        constexpr std::array<Reg8Addr, 8> operands{{B, C, D, E, H, L, F, A}};
+        return operands[code];
+    }
+    static constexpr Reg16Addr Reg16Operand(unsigned int code) {
+        constexpr std::array<Reg16Addr, 4> operands{{BC, DE, HL, SP}};
+        return operands[code];
+    }
+    static constexpr Reg16Addr StackOperand(unsigned int code) {
+        constexpr std::array<Reg16Addr, 4> operands{{BC, DE, HL, AF}};
+        return operands[code];
+    }
+
+    // Condition codes NZ, Z, NC, and C.
+    template<unsigned int cc>
+    bool Condition() const {
+        if constexpr (cc == 0) {
+            return !Zero();
+        } else if constexpr (cc == 1) {
+            return Zero();
+        } else if constexpr (cc == 2) {
+            return !Carry();
+        } else {
+            return Carry();
+        }
+    }
 
     // Interrupts
     bool interrupt_master_enable = true;
@@ -65,6 +175,39 @@ private:
 
     int HandleInterrupts();
 
+    // Idle loop detection. A short backward jump, or a jump to itself, whose body only reads ROM, WRAM, or HRAM and
+    // only writes A and F can't leave the loop until an interrupt handler changes memory. Once an iteration ends in
+    // the same state it started in, the following iterations are replayed from a record of it instead of being
+    // executed.
+    struct IdleStep {
+        u16 pc;
+        u16 af;
+        unsigned int cycles;
+    };
+
+    struct IdleLoop {
+        bool recording = false;
+        u16 target = 0x0000;
+        u16 jump_addr = 0x0000;
+        std::array<u16, 5> regs{};
+        std::vector<IdleStep> steps;
+    };
+
+    IdleLoop idle_loop;
+    static constexpr u16 max_idle_loop_bytes = 16;
+    static constexpr std::size_t max_idle_loop_steps = 32;
+
+    int FollowIdleLoop(u16 instr_pc, u16 instr_af, unsigned int instr_cycles, int cycles);
+    int ReplayIdleLoop(int cycles);
+    bool IdleLoopBodySafe(u16 target, u16 jump_addr) const;
+    int IdleLoopSafeLength(u16 addr) const;
+    static bool IdleLoopSafeRead(u16 addr) {
+        return addr < 0x8000 || (addr >= 0xC000 && addr < 0xFE00) || (addr >= 0xFF80 && addr < 0xFFFF);
+    }
+    std::array<u16, 5> RegisterSnapshot() const {
+        return {{regs.reg16[AF], regs.reg16[BC], regs.reg16[DE], regs.reg16[HL], regs.reg16[SP]}};
+    }
+
     // Memory access
     u8 ReadMemAndTick(const u16 addr);
     void WriteMemAndTick(const u16 addr, const u8 val);
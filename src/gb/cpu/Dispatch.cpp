@@ -0,0 +1,495 @@
+// This file is a part of Chroma.
+// Copyright (C) 2016-2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdexcept>
+#include <utility>
+
+#include "gb/cpu/Cpu.h"
+#include "gb/memory/Memory.h"
+#include "gb/core/GameBoy.h"
+
+namespace Gb {
+
+namespace {
+
+// The cycles taken by each opcode, including the opcode fetch. Conditional jumps, calls, and returns are listed
+// with their not-taken timing, and the handlers return the extra cycles taken by the branch. The CB prefix is 0
+// here, as its handler returns the whole cost of the suffixed instruction. Unknown opcodes are also 0.
+constexpr std::array<unsigned int, 256> op_cycles{{
+//   x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+      4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0x
+      4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 1x
+      8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 2x
+      8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 3x
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 4x
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 5x
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 6x
+      8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 7x
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 8x
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 9x
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Ax
+      4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // Bx
+      8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  0, 12, 24,  8, 16, // Cx
+      8, 12, 12,  0, 12, 16,  8, 16,  8, 16, 12,  0, 12,  0,  8, 16, // Dx
+     12, 12,  8,  0,  0, 16,  8, 16, 16,  4, 16,  0,  0,  0,  8, 16, // Ex
+     12, 12,  8,  4,  0, 16,  8, 16, 12,  8, 16,  4,  0,  0,  8, 16, // Fx
+}};
+
+// CB opcodes take 8 cycles on a register, 12 to test a bit in memory, and 16 to modify memory.
+constexpr unsigned int CbCycles(unsigned int opcode) {
+    if ((opcode & 0x7) != 0x6) {
+        return 8;
+    }
+    return ((opcode >> 6) == 1) ? 12 : 16;
+}
+
+// The length, including immediates, of the instructions which only touch registers and so can be part of a cached
+// block, and 0 for the rest. These are the 8-bit loads, ALU operations, INCs and DECs which don't go through (HL),
+// the loads of immediates into registers, INC RR and DEC RR, the accumulator rotates and flag operations, LD SP, HL,
+// and NOP.
+constexpr unsigned int BlockOpLength(unsigned int opcode) {
+    const unsigned int x = opcode >> 6;
+    const unsigned int y = (opcode >> 3) & 0x7;
+    const unsigned int z = opcode & 0x7;
+
+    if (x == 1) {
+        return (y != 6 && z != 6) ? 1 : 0;
+    } else if (x == 2) {
+        return (z != 6) ? 1 : 0;
+    } else if (x == 0) {
+        if (z == 1) {
+            return ((y & 0x1) == 0) ? 3 : 0;
+        } else if (z == 3 || z == 7 || opcode == 0x00) {
+            return 1;
+        } else if ((z == 4 || z == 5) && y != 6) {
+            return 1;
+        } else if (z == 6 && y != 6) {
+            return 2;
+        }
+        return 0;
+    } else if (z == 6) {
+        return 2;
+    }
+
+    return (opcode == 0xF9) ? 1 : 0;
+}
+
+} // End anonymous namespace
+
+// Opcodes are decoded at compile time from their x (bits 7-6), y (bits 5-3), and z (bits 2-0) fields, following
+// the usual Z80 decoding scheme. In y and z, register code 6 is the memory at (HL).
+template<u8 opcode>
+unsigned int Cpu::Op(Cpu& cpu) {
+    constexpr unsigned int x = opcode >> 6;
+    constexpr unsigned int y = (opcode >> 3) & 0x7;
+    constexpr unsigned int z = opcode & 0x7;
+    constexpr unsigned int p = y >> 1;
+    constexpr unsigned int q = y & 0x1;
+
+    if constexpr (opcode == 0x76) {
+        // HALT
+        cpu.Halt();
+    } else if constexpr (x == 1) {
+        // LD R, R
+        if constexpr (y == 6) {
+            cpu.Load8IntoMem(cpu.regs.reg16[HL], Reg8Operand(z));
+        } else if constexpr (z == 6) {
+            cpu.Load8FromMem(Reg8Operand(y), cpu.regs.reg16[HL]);
+        } else {
+            cpu.Load8(Reg8Operand(y), Reg8Operand(z));
+        }
+    } else if constexpr (x == 2) {
+        // ALU A, R
+        if constexpr (z == 6) {
+            constexpr std::array<void (Cpu::*)(), 8> alu_ops{{
+                &Cpu::AddFromMemAtHL, &Cpu::AddFromMemAtHLWithCarry, &Cpu::SubFromMemAtHL,
+                &Cpu::SubFromMemAtHLWithCarry, &Cpu::AndFromMemAtHL, &Cpu::XorFromMemAtHL, &Cpu::OrFromMemAtHL,
+                &Cpu::CompareFromMemAtHL
+            }};
+            (cpu.*alu_ops[y])();
+        } else {
+            constexpr std::array<void (Cpu::*)(Reg8Addr), 8> alu_ops{{
+                &Cpu::Add, &Cpu::AddWithCarry, &Cpu::Sub, &Cpu::SubWithCarry, &Cpu::And, &Cpu::Xor, &Cpu::Or,
+                &Cpu::Compare
+            }};
+            (cpu.*alu_ops[y])(Reg8Operand(z));
+        }
+    } else if constexpr (x == 0 && z == 0) {
+        if constexpr (y == 0) {
+            // NOP
+        } else if constexpr (y == 1) {
+            // LD (nn), SP
+            cpu.LoadSPIntoMem(cpu.GetImmediateWord());
+        } else if constexpr (y == 2) {
+            // STOP
+            cpu.Stop();
+        } else if constexpr (y == 3) {
+            // JR n
+            cpu.RelativeJump(cpu.GetImmediateByte());
+        } else {
+            // JR cc, n
+            if (cpu.Condition<y - 4>()) {
+                cpu.RelativeJump(cpu.GetImmediateByte());
+                return 4;
+            }
+            cpu.gameboy.HardwareTick(4);
+            ++cpu.pc;
+        }
+    } else if constexpr (x == 0 && z == 1) {
+        if constexpr (q == 0) {
+            // LD RR, nn
+            cpu.Load16Immediate(Reg16Operand(p), cpu.GetImmediateWord());
+        } else {
+            // ADD HL, RR
+            cpu.AddHL(Reg16Operand(p));
+        }
+    } else if constexpr (x == 0 && z == 2) {
+        // LD (RR), A and LD A, (RR), where HL is incremented or decremented for p == 2 and p == 3.
+        if constexpr (q == 0) {
+            if constexpr (p == 0) {
+                cpu.Load8IntoMem(cpu.regs.reg16[BC], A);
+            } else if constexpr (p == 1) {
+                cpu.Load8IntoMem(cpu.regs.reg16[DE], A);
+            } else if constexpr (p == 2) {
+                cpu.Load8IntoMem(cpu.regs.reg16[HL]++, A);
+            } else {
+                cpu.Load8IntoMem(cpu.regs.reg16[HL]--, A);
+            }
+        } else {
+            if constexpr (p == 0) {
+                cpu.Load8FromMem(A, cpu.regs.reg16[BC]);
+            } else if constexpr (p == 1) {
+                cpu.Load8FromMem(A, cpu.regs.reg16[DE]);
+            } else if constexpr (p == 2) {
+                cpu.Load8FromMem(A, cpu.regs.reg16[HL]++);
+            } else {
+                cpu.Load8FromMem(A, cpu.regs.reg16[HL]--);
+            }
+        }
+    } else if constexpr (x == 0 && z == 3) {
+        // INC RR and DEC RR
+        if constexpr (q == 0) {
+            cpu.IncReg16(Reg16Operand(p));
+        } else {
+            cpu.DecReg16(Reg16Operand(p));
+        }
+    } else if constexpr (x == 0 && z == 4) {
+        // INC R
+        if constexpr (y == 6) {
+            cpu.IncMemAtHL();
+        } else {
+            cpu.IncReg8(Reg8Operand(y));
+        }
+    } else if constexpr (x == 0 && z == 5) {
+        // DEC R
+        if constexpr (y == 6) {
+            cpu.DecMemAtHL();
+        } else {
+            cpu.DecReg8(Reg8Operand(y));
+        }
+    } else if constexpr (x == 0 && z == 6) {
+        // LD R, n
+        if constexpr (y == 6) {
+            cpu.Load8IntoMemImmediate(cpu.regs.reg16[HL], cpu.GetImmediateByte());
+        } else {
+            cpu.Load8Immediate(Reg8Operand(y), cpu.GetImmediateByte());
+        }
+    } else if constexpr (x == 0 && z == 7) {
+        // The accumulator rotates always reset the zero flag, unlike their CB counterparts.
+        if constexpr (y == 0) {
+            cpu.RotateLeft(A);
+            cpu.SetZero(false);
+        } else if constexpr (y == 1) {
+            cpu.RotateRight(A);
+            cpu.SetZero(false);
+        } else if constexpr (y == 2) {
+            cpu.RotateLeftThroughCarry(A);
+            cpu.SetZero(false);
+        } else if constexpr (y == 3) {
+            cpu.RotateRightThroughCarry(A);
+            cpu.SetZero(false);
+        } else if constexpr (y == 4) {
+            cpu.DecimalAdjustA();
+        } else if constexpr (y == 5) {
+            cpu.ComplementA();
+        } else if constexpr (y == 6) {
+            cpu.SetCarry();
+        } else {
+            cpu.ComplementCarry();
+        }
+    } else if constexpr (z == 0) {
+        if constexpr (y < 4) {
+            // RET cc
+            cpu.gameboy.HardwareTick(4);
+            if (cpu.Condition<y>()) {
+                cpu.Return();
+                return 12;
+            }
+        } else if constexpr (y == 4) {
+            // LD (0xFF00+n), A
+            cpu.Load8IntoMem(0xFF00 + cpu.GetImmediateByte(), A);
+        } else if constexpr (y == 5) {
+            // ADD SP, n
+            cpu.AddSP(cpu.GetImmediateByte());
+        } else if constexpr (y == 6) {
+            // LD A, (0xFF00+n)
+            cpu.Load8FromMem(A, 0xFF00 + cpu.GetImmediateByte());
+        } else {
+            // LD HL, SP+n
+            cpu.LoadSPnIntoHL(cpu.GetImmediateByte());
+        }
+    } else if constexpr (z == 1) {
+        if constexpr (q == 0) {
+            // POP RR
+            cpu.Pop(StackOperand(p));
+        } else if constexpr (p == 0) {
+            // RET
+            cpu.Return();
+        } else if constexpr (p == 1) {
+            // RETI
+            cpu.Return();
+            cpu.interrupt_master_enable = true;
+        } else if constexpr (p == 2) {
+            // JP (HL)
+            cpu.JumpToHL();
+        } else {
+            // LD SP, HL
+            cpu.LoadHLIntoSP();
+        }
+    } else if constexpr (z == 2) {
+        if constexpr (y < 4) {
+            // JP cc, nn
+            if (cpu.Condition<y>()) {
+                cpu.Jump(cpu.GetImmediateWord());
+                return 4;
+            }
+            cpu.gameboy.HardwareTick(8);
+            cpu.pc += 2;
+        } else if constexpr (y == 4) {
+            // LD (0xFF00+C), A
+            cpu.Load8IntoMem(0xFF00 + cpu.regs.reg8[C], A);
+        } else if constexpr (y == 5) {
+            // LD (nn), A
+            cpu.Load8IntoMem(cpu.GetImmediateWord(), A);
+        } else if constexpr (y == 6) {
+            // LD A, (0xFF00+C)
+            cpu.Load8FromMem(A, 0xFF00 + cpu.regs.reg8[C]);
+        } else {
+            // LD A, (nn)
+            cpu.Load8FromMem(A, cpu.GetImmediateWord());
+        }
+    } else if constexpr (opcode == 0xC3) {
+        // JP nn
+        cpu.Jump(cpu.GetImmediateWord());
+    } else if constexpr (opcode == 0xCB) {
+        // Get opcode suffix from next byte.
+        const OpInfo& op = cb_table[cpu.GetImmediateByte()];
+        return op.cycles + op.handler(cpu);
+    } else if constexpr (opcode == 0xF3) {
+        // DI
+        cpu.interrupt_master_enable = false;
+    } else if constexpr (opcode == 0xFB) {
+        // EI -- Enable interrupts after the next instruction is executed.
+        cpu.enable_interrupts_delayed = true;
+    } else if constexpr (z == 4 && y < 4) {
+        // CALL cc, nn
+        if (cpu.Condition<y>()) {
+            cpu.Call(cpu.GetImmediateWord());
+            return 12;
+        }
+        cpu.gameboy.HardwareTick(8);
+        cpu.pc += 2;
+    } else if constexpr (z == 5 && q == 0) {
+        // PUSH RR
+        cpu.Push(StackOperand(p));
+    } else if constexpr (opcode == 0xCD) {
+        // CALL nn
+        cpu.Call(cpu.GetImmediateWord());
+    } else if constexpr (z == 6) {
+        // ALU A, n
+        constexpr std::array<void (Cpu::*)(u8), 8> alu_ops{{
+            &Cpu::AddImmediate, &Cpu::AddImmediateWithCarry, &Cpu::SubImmediate, &Cpu::SubImmediateWithCarry,
+            &Cpu::AndImmediate, &Cpu::XorImmediate, &Cpu::OrImmediate, &Cpu::CompareImmediate
+        }};
+        (cpu.*alu_ops[y])(cpu.GetImmediateByte());
+    } else if constexpr (z == 7) {
+        // RST n
+        cpu.Call(y * 8);
+    } else {
+        throw std::runtime_error("The CPU has hung. Reason: unknown opcode.");
+    }
+
+    return 0;
+}
+
+template<u8 opcode>
+unsigned int Cpu::CbOp(Cpu& cpu) {
+    constexpr unsigned int x = opcode >> 6;
+    constexpr unsigned int y = (opcode >> 3) & 0x7;
+    constexpr unsigned int z = opcode & 0x7;
+
+    if constexpr (x == 0) {
+        // Rotates and shifts
+        if constexpr (z == 6) {
+            constexpr std::array<void (Cpu::*)(), 8> shift_ops{{
+                &Cpu::RotateLeftMemAtHL, &Cpu::RotateRightMemAtHL, &Cpu::RotateLeftMemAtHLThroughCarry,
+                &Cpu::RotateRightMemAtHLThroughCarry, &Cpu::ShiftLeftMemAtHL, &Cpu::ShiftRightArithmeticMemAtHL,
+                &Cpu::SwapMemAtHL, &Cpu::ShiftRightLogicalMemAtHL
+            }};
+            (cpu.*shift_ops[y])();
+        } else {
+            constexpr std::array<void (Cpu::*)(Reg8Addr), 8> shift_ops{{
+                &Cpu::RotateLeft, &Cpu::RotateRight, &Cpu::RotateLeftThroughCarry, &Cpu::RotateRightThroughCarry,
+                &Cpu::ShiftLeft, &Cpu::ShiftRightArithmetic, &Cpu::SwapNybbles, &Cpu::ShiftRightLogical
+            }};
+            (cpu.*shift_ops[y])(Reg8Operand(z));
+        }
+    } else if constexpr (x == 1) {
+        // BIT b, R
+        if constexpr (z == 6) {
+            cpu.TestBitOfMemAtHL(y);
+        } else {
+            cpu.TestBit(y, Reg8Operand(z));
+        }
+    } else if constexpr (x == 2) {
+        // RES b, R
+        if constexpr (z == 6) {
+            cpu.ResetBitOfMemAtHL(y);
+        } else {
+            cpu.ResetBit(y, Reg8Operand(z));
+        }
+    } else {
+        // SET b, R
+        if constexpr (z == 6) {
+            cpu.SetBitOfMemAtHL(y);
+        } else {
+            cpu.SetBit(y, Reg8Operand(z));
+        }
+    }
+
+    return 0;
+}
+
+// Only called for the opcodes BlockOpLength accepts. Their immediates have already been read, and any internal delays
+// are counted in the block's cycles along with the fetches.
+template<u8 opcode>
+void Cpu::BlockOp(Cpu& cpu, u16 immediate) {
+    constexpr unsigned int x = opcode >> 6;
+    constexpr unsigned int y = (opcode >> 3) & 0x7;
+    constexpr unsigned int z = opcode & 0x7;
+    constexpr unsigned int p = y >> 1;
+    constexpr unsigned int q = y & 0x1;
+
+    if constexpr (x == 0 && z == 1) {
+        // LD RR, nn
+        cpu.Load16Immediate(Reg16Operand(p), immediate);
+    } else if constexpr (x == 0 && z == 3) {
+        // INC RR and DEC RR
+        if constexpr (q == 0) {
+            ++cpu.regs.reg16[Reg16Operand(p)];
+        } else {
+            --cpu.regs.reg16[Reg16Operand(p)];
+        }
+    } else if constexpr (x == 0 && z == 6) {
+        // LD R, n
+        cpu.Load8Immediate(Reg8Operand(y), immediate);
+    } else if constexpr (x == 3 && z == 6) {
+        // ALU A, n
+        constexpr std::array<void (Cpu::*)(u8), 8> alu_ops{{
+            &Cpu::AddImmediate, &Cpu::AddImmediateWithCarry, &Cpu::SubImmediate, &Cpu::SubImmediateWithCarry,
+            &Cpu::AndImmediate, &Cpu::XorImmediate, &Cpu::OrImmediate, &Cpu::CompareImmediate
+        }};
+        (cpu.*alu_ops[y])(immediate);
+    } else if constexpr (opcode == 0xF9) {
+        // LD SP, HL
+        cpu.regs.reg16[SP] = cpu.regs.reg16[HL];
+    } else {
+        // The rest never tick the hardware themselves.
+        Op<opcode>(cpu);
+    }
+}
+
+template<u8 opcode>
+void Cpu::CbBlockOp(Cpu& cpu, u16) {
+    CbOp<opcode>(cpu);
+}
+
+template<std::size_t... opcodes>
+constexpr std::array<Cpu::OpInfo, 256> Cpu::MakeOpTable(std::index_sequence<opcodes...>) {
+    return {{{&Op<opcodes>, op_cycles[opcodes]}...}};
+}
+
+template<std::size_t... opcodes>
+constexpr std::array<Cpu::OpInfo, 256> Cpu::MakeCbTable(std::index_sequence<opcodes...>) {
+    return {{{&CbOp<opcodes>, CbCycles(opcodes)}...}};
+}
+
+template<std::size_t... opcodes>
+constexpr std::array<Cpu::BlockOpInfo, 256> Cpu::MakeBlockTable(std::index_sequence<opcodes...>) {
+    return {{{(BlockOpLength(opcodes) != 0) ? &BlockOp<opcodes> : nullptr, BlockOpLength(opcodes),
+              op_cycles[opcodes]}...}};
+}
+
+template<std::size_t... opcodes>
+constexpr std::array<Cpu::BlockOpInfo, 256> Cpu::MakeCbBlockTable(std::index_sequence<opcodes...>) {
+    return {{{((opcodes & 0x7) != 0x6) ? &CbBlockOp<opcodes> : nullptr, 2, CbCycles(opcodes)}...}};
+}
+
+const std::array<Cpu::OpInfo, 256> Cpu::op_table = MakeOpTable(std::make_index_sequence<256>{});
+const std::array<Cpu::OpInfo, 256> Cpu::cb_table = MakeCbTable(std::make_index_sequence<256>{});
+const std::array<Cpu::BlockOpInfo, 256> Cpu::block_table = MakeBlockTable(std::make_index_sequence<256>{});
+const std::array<Cpu::BlockOpInfo, 256> Cpu::cb_block_table = MakeCbBlockTable(std::make_index_sequence<256>{});
+
+#if defined(GB_THREADED_DISPATCH) && defined(__GNUC__)
+
+// Expands X for every opcode from 00 to FF, as two hex digits.
+#define GB_OPCODE_ROW(X, hi) X(hi##0) X(hi##1) X(hi##2) X(hi##3) X(hi##4) X(hi##5) X(hi##6) X(hi##7) \
+                             X(hi##8) X(hi##9) X(hi##A) X(hi##B) X(hi##C) X(hi##D) X(hi##E) X(hi##F)
+#define GB_OPCODES(X) GB_OPCODE_ROW(X, 0) GB_OPCODE_ROW(X, 1) GB_OPCODE_ROW(X, 2) GB_OPCODE_ROW(X, 3) \
+                      GB_OPCODE_ROW(X, 4) GB_OPCODE_ROW(X, 5) GB_OPCODE_ROW(X, 6) GB_OPCODE_ROW(X, 7) \
+                      GB_OPCODE_ROW(X, 8) GB_OPCODE_ROW(X, 9) GB_OPCODE_ROW(X, A) GB_OPCODE_ROW(X, B) \
+                      GB_OPCODE_ROW(X, C) GB_OPCODE_ROW(X, D) GB_OPCODE_ROW(X, E) GB_OPCODE_ROW(X, F)
+#define GB_OPCODE_LABEL(n) &&op_##n,
+#define GB_OPCODE_CASE(n) op_##n: return op_cycles[0x##n] + Op<0x##n>(*this);
+
+// Jumping straight to a label lets the compiler inline every handler into the dispatch, instead of calling
+// through the table.
+unsigned int Cpu::ExecuteNext(const u8 opcode) {
+    static void* const labels[256] = {GB_OPCODES(GB_OPCODE_LABEL)};
+
+    gameboy.HardwareTick(4);
+
+    goto *labels[opcode];
+    GB_OPCODES(GB_OPCODE_CASE)
+}
+
+#undef GB_OPCODE_CASE
+#undef GB_OPCODE_LABEL
+#undef GB_OPCODES
+#undef GB_OPCODE_ROW
+
+#else
+
+unsigned int Cpu::ExecuteNext(const u8 opcode) {
+    gameboy.HardwareTick(4);
+
+    const OpInfo& op = op_table[opcode];
+    return op.cycles + op.handler(*this);
+}
+
+#endif
+
+} // End namespace Gb
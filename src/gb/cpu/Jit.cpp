@@ -0,0 +1,353 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <array>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "gb/cpu/Jit.h"
+#include "gb/cpu/BlockCache.h"
+
+namespace Gb {
+
+namespace {
+
+// Byte offsets of the guest registers in Registers. Register code 6 is (HL), which never reaches the JIT.
+constexpr u8 reg_f = 0;
+constexpr u8 reg_a = 1;
+constexpr std::array<u8, 8> reg8_offsets{{3, 2, 5, 4, 7, 6, 0, 1}};
+constexpr std::array<u8, 4> reg16_offsets{{2, 4, 6, 8}};
+
+constexpr u8 zero_flag = 0x80, sub_flag = 0x40, half_flag = 0x20, carry_flag = 0x10;
+constexpr u8 all_flags = 0xF0;
+
+// x86 8-bit ALU opcodes in their "r8, r/m8" form, in the order of the SM83's ADD, ADC, SUB, SBC, AND, XOR, OR, and
+// CP. The "al, imm8" form is the same opcode plus 2.
+constexpr std::array<u8, 8> alu_ops{{0x02, 0x12, 0x2A, 0x1A, 0x22, 0x32, 0x0A, 0x3A}};
+
+// How one instruction reads and writes the guest flags. The written flags in from_host are taken from the host's
+// flags after the instruction, which match the SM83's zero, half carry and carry for 8-bit arithmetic. The rest of
+// the written flags are set to value.
+struct FlagUsage {
+    u8 written;
+    u8 read;
+    u8 from_host;
+    u8 value;
+};
+
+FlagUsage GetFlagUsage(u8 opcode) {
+    const unsigned int x = opcode >> 6;
+    const unsigned int y = (opcode >> 3) & 0x7;
+    const unsigned int z = opcode & 0x7;
+
+    if (x == 2 || (x == 3 && z == 6)) {
+        switch (y) {
+        case 0:
+            return {all_flags, 0, zero_flag | half_flag | carry_flag, 0};
+        case 1:
+            return {all_flags, carry_flag, zero_flag | half_flag | carry_flag, 0};
+        case 2:
+        case 7:
+            return {all_flags, 0, zero_flag | half_flag | carry_flag, sub_flag};
+        case 3:
+            return {all_flags, carry_flag, zero_flag | half_flag | carry_flag, sub_flag};
+        case 4:
+            return {all_flags, 0, zero_flag, half_flag};
+        default:
+            return {all_flags, 0, zero_flag, 0};
+        }
+    } else if (x == 0 && (z == 4 || z == 5)) {
+        return {zero_flag | sub_flag | half_flag, 0, zero_flag | half_flag, (z == 5) ? sub_flag : u8{0}};
+    } else if (opcode == 0x2F) {
+        // CPL
+        return {sub_flag | half_flag, 0, 0, sub_flag | half_flag};
+    } else if (opcode == 0x37) {
+        // SCF
+        return {sub_flag | half_flag | carry_flag, 0, 0, carry_flag};
+    } else if (opcode == 0x3F) {
+        // CCF, whose carry is handled on its own.
+        return {sub_flag | half_flag | carry_flag, carry_flag, 0, 0};
+    }
+
+    return {0, 0, 0, 0};
+}
+
+// Only instructions which can be part of a block get here, so (HL) operands have already been ruled out.
+bool Supported(u8 opcode) {
+    const unsigned int x = opcode >> 6;
+    const unsigned int z = opcode & 0x7;
+
+    if (x == 1 || x == 2) {
+        return true;
+    } else if (x == 3) {
+        return z == 6 || opcode == 0xF9;
+    }
+
+    // Everything but the accumulator rotates and DAA.
+    return z != 7 || opcode == 0x2F || opcode == 0x37 || opcode == 0x3F;
+}
+
+class Emitter {
+public:
+    std::vector<u8> code;
+
+    void Prologue() {
+#if defined(_WIN32)
+        // mov r8, rcx
+        Bytes({0x49, 0x89, 0xC8});
+#else
+        // mov r8, rdi
+        Bytes({0x49, 0x89, 0xF8});
+#endif
+    }
+
+    void Ret() { Bytes({0xC3}); }
+
+    // mov al, [r8 + offset]
+    void LoadByte(u8 offset) { Bytes({0x41, 0x8A, 0x40, offset}); }
+    // mov [r8 + offset], al
+    void StoreByte(u8 offset) { Bytes({0x41, 0x88, 0x40, offset}); }
+    // op al, [r8 + offset]
+    void AluByte(u8 op, u8 offset) { Bytes({0x41, op, 0x40, offset}); }
+    // op al, imm8
+    void AluImm(u8 op, u8 imm) { Bytes({static_cast<u8>(op + 2), imm}); }
+    // inc/dec byte [r8 + offset]
+    void IncByte(u8 offset, bool dec) { Bytes({0x41, 0xFE, static_cast<u8>(dec ? 0x48 : 0x40), offset}); }
+    // mov byte [r8 + offset], imm8
+    void MovByteImm(u8 offset, u8 imm) { Bytes({0x41, 0xC6, 0x40, offset, imm}); }
+    // xor byte [r8 + offset], imm8
+    void XorByteImm(u8 offset, u8 imm) { Bytes({0x41, 0x80, 0x70, offset, imm}); }
+
+    // mov word [r8 + offset], imm16
+    void MovWordImm(u8 offset, u16 imm) {
+        Bytes({0x66, 0x41, 0xC7, 0x40, offset, static_cast<u8>(imm), static_cast<u8>(imm >> 8)});
+    }
+    // inc/dec word [r8 + offset]
+    void IncWord(u8 offset, bool dec) { Bytes({0x66, 0x41, 0xFF, static_cast<u8>(dec ? 0x48 : 0x40), offset}); }
+    // mov ax, [r8 + from]; mov [r8 + to], ax
+    void CopyWord(u8 to, u8 from) { Bytes({0x66, 0x41, 0x8B, 0x40, from, 0x66, 0x41, 0x89, 0x40, to}); }
+
+    // Load the guest carry flag into the host carry flag: mov cl, [r8 + F]; shr cl, 5
+    void LoadCarry() { Bytes({0x41, 0x8A, 0x48, reg_f, 0xC0, 0xE9, 0x05}); }
+
+    // Write the flags in mask to the guest F register.
+    void StoreFlags(const FlagUsage& usage, u8 mask) {
+        const u8 host = usage.from_host & mask;
+        const u8 value = usage.value & mask;
+
+        if (host == 0) {
+            // and byte [r8 + F], ~mask
+            Bytes({0x41, 0x80, 0x60, reg_f, static_cast<u8>(~mask)});
+            if (value != 0) {
+                // or byte [r8 + F], value
+                Bytes({0x41, 0x80, 0x48, reg_f, value});
+            }
+            return;
+        }
+
+        // pushfq; pop rcx; xor edx, edx
+        Bytes({0x9C, 0x59, 0x31, 0xD2});
+        if (host & zero_flag) {
+            // ZF is bit 6: mov eax, ecx; and eax, 0x40; shl eax, 1; or edx, eax
+            Bytes({0x89, 0xC8, 0x83, 0xE0, 0x40, 0xD1, 0xE0, 0x09, 0xC2});
+        }
+        if (host & half_flag) {
+            // AF is bit 4: mov eax, ecx; and eax, 0x10; shl eax, 1; or edx, eax
+            Bytes({0x89, 0xC8, 0x83, 0xE0, 0x10, 0xD1, 0xE0, 0x09, 0xC2});
+        }
+        if (host & carry_flag) {
+            // CF is bit 0: mov eax, ecx; and eax, 0x01; shl eax, 4; or edx, eax
+            Bytes({0x89, 0xC8, 0x83, 0xE0, 0x01, 0xC1, 0xE0, 0x04, 0x09, 0xC2});
+        }
+
+        // mov al, [r8 + F]; and al, ~mask; or al, dl
+        Bytes({0x41, 0x8A, 0x40, reg_f, 0x24, static_cast<u8>(~mask), 0x08, 0xD0});
+        if (value != 0) {
+            // or al, value
+            Bytes({0x0C, value});
+        }
+        StoreByte(reg_f);
+    }
+
+private:
+    void Bytes(std::initializer_list<u8> values) { code.insert(code.end(), values); }
+};
+
+void EmitInstruction(Emitter& e, const DecodedOp& op, u8 flag_mask) {
+    const u8 opcode = op.opcode;
+    const unsigned int x = opcode >> 6;
+    const unsigned int y = (opcode >> 3) & 0x7;
+    const unsigned int z = opcode & 0x7;
+    const unsigned int p = y >> 1;
+    const unsigned int q = y & 0x1;
+    const FlagUsage usage = GetFlagUsage(opcode);
+
+    if (x == 1) {
+        // LD R, R
+        e.LoadByte(reg8_offsets[z]);
+        e.StoreByte(reg8_offsets[y]);
+    } else if (x == 2 || (x == 3 && z == 6)) {
+        // ALU A, R and ALU A, n. The result is stored with a MOV, which leaves the host flags alone.
+        e.LoadByte(reg_a);
+        if (usage.read & carry_flag) {
+            e.LoadCarry();
+        }
+        if (x == 2) {
+            e.AluByte(alu_ops[y], reg8_offsets[z]);
+        } else {
+            e.AluImm(alu_ops[y], static_cast<u8>(op.immediate));
+        }
+        if (y != 7) {
+            e.StoreByte(reg_a);
+        }
+    } else if (opcode == 0xF9) {
+        // LD SP, HL
+        e.CopyWord(reg16_offsets[3], reg16_offsets[2]);
+    } else if (z == 1) {
+        // LD RR, nn
+        e.MovWordImm(reg16_offsets[p], op.immediate);
+    } else if (z == 3) {
+        // INC RR and DEC RR
+        e.IncWord(reg16_offsets[p], q == 1);
+    } else if (z == 4 || z == 5) {
+        // INC R and DEC R, which leave the carry flag alone on both the SM83 and the host.
+        e.IncByte(reg8_offsets[y], z == 5);
+    } else if (z == 6) {
+        // LD R, n
+        e.MovByteImm(reg8_offsets[y], static_cast<u8>(op.immediate));
+    } else if (opcode == 0x2F) {
+        // CPL
+        e.XorByteImm(reg_a, 0xFF);
+    } else if (opcode == 0x3F) {
+        // CCF
+        if (flag_mask & carry_flag) {
+            e.XorByteImm(reg_f, carry_flag);
+        }
+        flag_mask &= ~carry_flag;
+    }
+
+    if (flag_mask != 0) {
+        e.StoreFlags(usage, flag_mask);
+    }
+}
+
+} // End anonymous namespace
+
+Jit::Jit() {
+#if !defined(__x86_64__) && !defined(_M_X64)
+    throw std::runtime_error("The JIT is only available on x86-64 hosts.");
+#endif
+
+#if defined(_WIN32)
+    code_buffer = static_cast<u8*>(VirtualAlloc(nullptr, code_buffer_size, MEM_COMMIT | MEM_RESERVE,
+                                                PAGE_EXECUTE_READWRITE));
+    if (code_buffer == nullptr) {
+        throw std::runtime_error("Failed to allocate executable memory for the JIT.");
+    }
+#else
+    void* buffer = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (buffer == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate executable memory for the JIT.");
+    }
+    code_buffer = static_cast<u8*>(buffer);
+#endif
+}
+
+Jit::~Jit() {
+#if defined(_WIN32)
+    VirtualFree(code_buffer, 0, MEM_RELEASE);
+#else
+    munmap(code_buffer, code_buffer_size);
+#endif
+}
+
+const JitRun* Jit::Lookup(Block& block) {
+    if (block.run != nullptr || block.hits == not_compilable) {
+        return block.run;
+    }
+
+    if (++block.hits < hot_threshold) {
+        return nullptr;
+    }
+
+    block.run = Compile(block);
+    if (block.run == nullptr) {
+        block.hits = not_compilable;
+    }
+
+    return block.run;
+}
+
+const JitRun* Jit::Compile(const Block& block) {
+    std::size_t length = 0;
+    while (length < block.ops.size() && Supported(block.ops[length].opcode)) {
+        ++length;
+    }
+
+    // A single instruction runs just as well through its handler.
+    if (length < 2) {
+        return nullptr;
+    }
+
+    // Working backwards, an instruction only has to store the flags which are read or still live at the end of
+    // the run before the next instruction to write them.
+    std::vector<u8> flag_masks(length);
+    u8 live = all_flags;
+    for (std::size_t i = length; i-- > 0;) {
+        const FlagUsage usage = GetFlagUsage(block.ops[i].opcode);
+        flag_masks[i] = usage.written & live;
+        live = (live & ~usage.written) | usage.read;
+    }
+
+    Emitter e;
+    e.Prologue();
+    JitRun run{nullptr, 0, static_cast<unsigned int>(length), 0, 0};
+    for (std::size_t i = 0; i < length; ++i) {
+        const DecodedOp& op = block.ops[i];
+        EmitInstruction(e, op, flag_masks[i]);
+        run.length += op.length;
+        run.cycles_before_last = run.cycles;
+        run.cycles += op.cycles;
+    }
+    e.Ret();
+
+    if (code_offset + e.code.size() > code_buffer_size) {
+        return nullptr;
+    }
+
+    std::memcpy(code_buffer + code_offset, e.code.data(), e.code.size());
+    run.func = reinterpret_cast<void(*)(u8*)>(code_buffer + code_offset);
+    code_offset += e.code.size();
+
+    runs.push_back(std::make_unique<JitRun>(run));
+    return runs.back().get();
+}
+
+void Jit::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("jit", sizeof(Jit) + runs.size() * sizeof(JitRun));
+    // The code buffer is only reserved up front, so just the part that's been written to is resident.
+    report.Add("jit", code_offset);
+}
+
+} // End namespace Gb
@@ -0,0 +1,75 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "common/MemoryReport.h"
+
+namespace Gb {
+
+struct Block;
+
+// A compiled run of instructions from the start of a block.
+struct JitRun {
+    void (*func)(u8* regs);
+    unsigned int length;
+    unsigned int instructions;
+    unsigned int cycles;
+    // The cycles taken before the last instruction of the run executes.
+    unsigned int cycles_before_last;
+};
+
+// Translates hot blocks into x86-64, from their start up to the first instruction which isn't an 8-bit load, ALU
+// operation, INC or DEC, or a 16-bit load, INC or DEC. The guest registers stay in memory and are addressed
+// through a pointer held in R8, and only the flags which a later instruction of the run doesn't overwrite are
+// stored. Whatever is left of a block goes through the cached interpreter.
+class Jit {
+public:
+    Jit();
+    ~Jit();
+
+    // The generated code is x86-64, so other hosts stick to the cached interpreter.
+#if defined(__x86_64__) || defined(_M_X64)
+    static constexpr bool host_supported = true;
+#else
+    static constexpr bool host_supported = false;
+#endif
+
+    // Returns the block's run if it has been compiled, otherwise counts the execution towards compiling it.
+    const JitRun* Lookup(Block& block);
+
+    void ReportMemory(Common::MemoryReport& report) const;
+
+private:
+    std::vector<std::unique_ptr<JitRun>> runs;
+
+    u8* code_buffer = nullptr;
+    std::size_t code_offset = 0;
+
+    // Game Boy games hold little enough code that the buffer isn't flushed. Once it's full, blocks which haven't
+    // been compiled yet stay on the cached interpreter.
+    static constexpr std::size_t code_buffer_size = 4 * 1024 * 1024;
+    static constexpr u16 hot_threshold = 16;
+    static constexpr u16 not_compilable = 0xFFFF;
+
+    const JitRun* Compile(const Block& block);
+};
+
+} // End namespace Gb
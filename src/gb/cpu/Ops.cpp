@@ -15,6 +15,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdexcept>
+#include <string>
 
 #include "gb/cpu/Cpu.h"
 #include "gb/memory/Memory.h"
@@ -619,6 +620,9 @@ void Cpu::Halt() {
         cpu_mode = CpuMode::HaltBug;
     } else {
         cpu_mode = CpuMode::Halted;
+        if (!mem.AnyInterruptEnabled() && gameboy.watchdog.Armed()) {
+            gameboy.watchdog.Hang("halt mode was entered with no interrupts enabled.");
+        }
     }
 }
 
@@ -639,7 +643,11 @@ void Cpu::Stop() {
         // A speed switch takes 128*1024-80=130992 cycles to complete, plus 4 cycles to decode the STOP instruction.
         speed_switch_cycles = 130992;
     } else if ((mem.ReadMem(0xFF00) & 0x30) == 0x30) {
-        throw std::runtime_error("The CPU has hung. Reason: STOP mode was entered with all joypad inputs disabled.");
+        const std::string reason{"STOP mode was entered with all joypad inputs disabled."};
+        if (!gameboy.watchdog.Enabled()) {
+            throw std::runtime_error("The CPU has hung. Reason: " + reason);
+        }
+        gameboy.watchdog.Hang(reason);
     }
 
     cpu_mode = CpuMode::Stopped;
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "common/CommonTypes.h"
+#include "common/SaveState.h"
 #include "gb/core/Enums.h"
 
 namespace Gb {
@@ -70,6 +71,10 @@ public:
 
     bool JoypadPress() const { return (p1 & 0x0F) != 0x0F; }
 
+    void SerializeState(Common::State& state) {
+        state.Sync(p1, button_states, was_unset, prev_interrupt_signal);
+    }
+
     // ******** Joypad I/O register ********
     // P1 register: 0xFF00
     //     bit 5: P15 Select Button Keys (0=Select)
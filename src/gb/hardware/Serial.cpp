@@ -14,12 +14,64 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <limits>
+
 #include "gb/hardware/Serial.h"
 #include "gb/core/GameBoy.h"
 #include "gb/memory/Memory.h"
+#include "common/LinkCable.h"
 
 namespace Gb {
 
+Serial::Serial(GameBoy& _gameboy, const Common::LinkSettings& link_settings)
+        : gameboy(_gameboy)
+        , link(Common::LinkPort::Open(link_settings)) {}
+
+// Needed to declare std::unique_ptr with forward-declared type in the header file.
+Serial::~Serial() = default;
+
+void Serial::ConnectLink(std::unique_ptr<Common::LinkPort> port) {
+    Sync();
+    link = std::move(port);
+    ScheduleEvent();
+}
+
+void Serial::Sync() {
+    SyncTo(gameboy.timestamp);
+}
+
+void Serial::SyncTo(u64 cycle) {
+    u64 ticks = (cycle - last_sync) / 4;
+    last_sync += ticks * 4;
+
+    while (ticks > 0) {
+        const u64 quiet_ticks = std::min(ticks, TicksUntilEvent());
+        if (quiet_ticks > 0) {
+            SkipTicks(quiet_ticks);
+            ticks -= quiet_ticks;
+        } else {
+            UpdateSerial();
+            ticks -= 1;
+        }
+    }
+
+    ScheduleEvent();
+}
+
+void Serial::ScheduleEvent() {
+    const u64 quiet_ticks = TicksUntilEvent();
+    if (quiet_ticks == std::numeric_limits<u64>::max()) {
+        next_event = quiet_ticks;
+    } else {
+        next_event = last_sync + (quiet_ticks + 1) * 4;
+    }
+}
+
+u64 Serial::QuietTicks() const {
+    return (next_event > gameboy.timestamp) ? (next_event - gameboy.timestamp - 1) / 4 : 0;
+}
+
 void Serial::UpdateSerial() {
     // Serial clock advances with the system clock.
     serial_clock += 4;
@@ -36,6 +88,11 @@ void Serial::UpdateSerial() {
 
     prev_transfer_signal = transfer_signal;
 
+    // The other Game Boy clocks a whole byte across at once, when we reach the time it started the transfer.
+    if (link != nullptr && link->RequestDue(gameboy.timestamp)) {
+        ReceiveTransfer();
+    }
+
     bool serial_inc = (serial_clock & SelectClockBit()) && UsingInternalClock();
 
     // When using the internal clock, a falling edge on bit 7 of the serial clock causes the internal transfer
@@ -47,21 +104,93 @@ void Serial::UpdateSerial() {
     prev_inc = serial_inc;
 }
 
+u64 Serial::TicksUntilEvent() const {
+    // The other side of a link cable can send a byte at any time.
+    if (link != nullptr || (bits_to_shift == 0 && (serial_control & 0x80))) {
+        return 0;
+    }
+
+    // A glitched edge after a write to SC has to be stepped through, as does a bit shifting on this tick.
+    if (prev_inc != ((serial_clock & SelectClockBit()) && UsingInternalClock())
+            || (bits_to_shift > 0 && prev_transfer_signal && !transfer_signal)) {
+        return 0;
+    }
+
+    // Without a transfer in progress, or without the internal clock to drive it, nothing happens.
+    if (bits_to_shift == 0 || !UsingInternalClock()) {
+        return std::numeric_limits<u64>::max();
+    }
+
+    // A bit shifts on the tick after the transfer signal falls, which is every second edge of the clock bit.
+    const u64 edge_period = SelectClockBit() * 2;
+    const u64 first_edge = (edge_period - serial_clock % edge_period) / 4;
+
+    return (transfer_signal) ? first_edge : first_edge + edge_period / 4;
+}
+
+void Serial::SkipTicks(u64 ticks) {
+    // Between shifts, the only thing that happens is the transfer signal toggling on each falling edge of the
+    // clock bit. The serial clock wraps at a multiple of every edge period.
+    const u64 clock_start = serial_clock;
+    const u64 clock_end = clock_start + ticks * 4;
+    if (UsingInternalClock()) {
+        const u64 edge_period = SelectClockBit() * 2;
+        const u64 edges = clock_end / edge_period - clock_start / edge_period;
+        const u64 edges_before_last = (clock_end - 4) / edge_period - clock_start / edge_period;
+
+        prev_transfer_signal = transfer_signal ^ (edges_before_last & 1);
+        transfer_signal = transfer_signal ^ (edges & 1);
+    } else {
+        prev_transfer_signal = transfer_signal;
+    }
+
+    serial_clock = static_cast<u8>(clock_end);
+    prev_inc = (serial_clock & SelectClockBit()) && UsingInternalClock();
+}
+
 void Serial::ShiftSerialBit() {
+    // With a link cable, the whole byte is sent when the first bit shifts out, and the other side's byte replaces
+    // SB once the last one has shifted in.
+    if (bits_to_shift == 8) {
+        if (link != nullptr) {
+            link->StartTransfer(serial_data, gameboy.timestamp);
+        }
+        if (sent_bytes.size() < max_sent_bytes) {
+            sent_bytes.push_back(serial_data);
+        }
+    }
+
     // Shift the most significant bit out of SB.
     serial_data <<= 1;
 
-    // Since we are always emulating a disconnected serial port at the moment, place a 1 in the least significant
-    // bit of SB.
+    // While the other side's bits are in flight, or when the serial port is disconnected, place a 1 in the least
+    // significant bit of SB.
     serial_data |= 0x01;
 
     if (--bits_to_shift == 0) {
         // The transfer has completed.
+        if (link != nullptr) {
+            serial_data = static_cast<u8>(link->FinishTransfer());
+        }
         serial_control &= 0x7F;
         gameboy.mem->RequestInterrupt(Interrupt::Serial);
     }
 }
 
+void Serial::ReceiveTransfer() {
+    // Only a transfer waiting on the external clock takes part. Otherwise the other side reads all 1s, as if
+    // nothing were plugged in.
+    if ((serial_control & 0x81) != 0x80) {
+        link->AnswerRequest(Common::LinkPort::disconnected);
+        return;
+    }
+
+    serial_data = static_cast<u8>(link->AnswerRequest(serial_data));
+    bits_to_shift = 0;
+    serial_control &= 0x7F;
+    gameboy.mem->RequestInterrupt(Interrupt::Serial);
+}
+
 u8 Serial::SelectClockBit() const {
     // In CBG mode, bit 1 of SC can be used to set the speed of the serial transfer. The transfer runs at the usual 
     // speed (using bit 7 of the serial clock) if it's 0, and runs fast (using bit 2 of the serial clock) if it's 1.
@@ -16,21 +16,58 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "common/CommonTypes.h"
+#include "common/SaveState.h"
 #include "gb/core/Enums.h"
 
+namespace Common {
+class LinkPort;
+struct LinkSettings;
+} // End namespace Common
+
 namespace Gb {
 
 class GameBoy;
 
 class Serial {
 public:
-    explicit Serial(GameBoy& _gameboy)
-            : gameboy(_gameboy) {}
+    Serial(GameBoy& _gameboy, const Common::LinkSettings& link_settings);
+    ~Serial();
 
-    void UpdateSerial();
+    // The serial port is only brought up to date when SC is written, or on the cycles it starts, shifts or
+    // receives a transfer. Writes to SC must be followed by a call to ScheduleEvent.
+    void Sync();
+    void Tick(u64 cycle) {
+        if (cycle >= next_event) {
+            SyncTo(cycle);
+        }
+    }
+    void ScheduleEvent();
+    // The number of upcoming ticks before the serial port next needs to be stepped.
+    u64 QuietTicks() const;
+
+    // Replaces whatever the link cable was connected to before.
+    void ConnectLink(std::unique_ptr<Common::LinkPort> port);
+
+    // Every byte the game has started sending since power on, up to a limit, for test ROMs which report their
+    // results over the serial port. It isn't part of savestates.
+    const std::vector<u8>& SentBytes() const { return sent_bytes; }
 
-    void InitSerialClock(u8 init_val) { serial_clock = init_val; }
+    void InitSerialClock(u8 init_val) {
+        serial_clock = init_val;
+        ScheduleEvent();
+    }
+
+    void SerializeState(Common::State& state) {
+        state.Sync(serial_data, serial_control, serial_clock, bits_to_shift, prev_inc, transfer_signal,
+                   prev_transfer_signal, last_sync);
+        if (state.Loading()) {
+            ScheduleEvent();
+        }
+    }
 
     // ******** Serial I/O registers ********
     // SB register: 0xFF01
@@ -42,6 +79,8 @@ public:
     u8 serial_control = 0x00;
 private:
     GameBoy& gameboy;
+    // Only present while a link cable is connected.
+    std::unique_ptr<Common::LinkPort> link;
 
     u8 serial_clock = 0x00;
     int bits_to_shift = 0;
@@ -50,7 +89,20 @@ private:
     bool transfer_signal = false;
     bool prev_transfer_signal = false;
 
+    u64 last_sync = 0;
+    u64 next_event = 0;
+
+    static constexpr std::size_t max_sent_bytes = 0x10000;
+    std::vector<u8> sent_bytes;
+
+    void SyncTo(u64 cycle);
+    void UpdateSerial();
+    // The number of upcoming ticks which can't start, shift or receive a transfer, and skipping them.
+    u64 TicksUntilEvent() const;
+    void SkipTicks(u64 ticks);
+
     void ShiftSerialBit();
+    void ReceiveTransfer();
     u8 SelectClockBit() const;
     bool UsingInternalClock() const { return serial_control & 0x01; }
 };
@@ -14,12 +14,76 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <limits>
+
 #include "gb/hardware/Timer.h"
 #include "gb/core/GameBoy.h"
 #include "gb/memory/Memory.h"
 
 namespace Gb {
 
+void Timer::Sync() {
+    SyncTo(gameboy.timestamp);
+}
+
+void Timer::SyncTo(u64 cycle) {
+    u64 ticks = (cycle - last_sync) / 4;
+    last_sync += ticks * 4;
+
+    while (ticks > 0) {
+        u64 steady_ticks = 0;
+        if (Steady()) {
+            // Stop short of the falling edge which overflows TIMA, so it goes through the full overflow procedure.
+            steady_ticks = (TimerEnabled()) ? std::min(ticks, TicksUntilOverflowEdge() - 1) : ticks;
+        }
+
+        if (steady_ticks == 0) {
+            UpdateTimer();
+            ticks -= 1;
+            continue;
+        }
+
+        const u64 div_start = divider;
+        const u64 div_end = div_start + steady_ticks * 4;
+        if (TimerEnabled()) {
+            // DIV wraps at a multiple of every edge period, so the unwrapped values give the same edge count.
+            const u64 edge_period = select_div_bit[tac & 0x03] * 2;
+            tima += div_end / edge_period - div_start / edge_period;
+        }
+
+        divider = static_cast<u16>(div_end);
+        prev_tima_val = tima;
+        prev_tima_inc = DivFrequencyBitSet() && TimerEnabled();
+        ticks -= steady_ticks;
+    }
+
+    ScheduleEvent();
+}
+
+void Timer::ScheduleEvent() {
+    if (!Steady()) {
+        // Step through the overflow procedure and any glitched edges one cycle at a time.
+        next_event = last_sync + 4;
+    } else if (!TimerEnabled()) {
+        next_event = std::numeric_limits<u64>::max();
+    } else {
+        // The interrupt is requested on the cycle after the overflow.
+        next_event = last_sync + (TicksUntilOverflowEdge() + 1) * 4;
+    }
+}
+
+u64 Timer::QuietTicks() const {
+    return (next_event > gameboy.timestamp) ? (next_event - gameboy.timestamp - 1) / 4 : 0;
+}
+
+u64 Timer::TicksUntilOverflowEdge() const {
+    const unsigned int edge_period = select_div_bit[tac & 0x03] * 2;
+    const u64 first_edge = (edge_period - (divider & (edge_period - 1))) / 4;
+
+    return first_edge + (0xFF - tima) * static_cast<u64>(edge_period / 4);
+}
+
 void Timer::UpdateTimer() {
     // DIV increments by 1 each clock cycle.
     divider += 4;
@@ -19,6 +19,7 @@
 #include <array>
 
 #include "common/CommonTypes.h"
+#include "common/SaveState.h"
 
 namespace Gb {
 
@@ -29,7 +30,25 @@ public:
     explicit Timer(GameBoy& _gameboy)
             : gameboy(_gameboy) {}
 
-    void UpdateTimer();
+    // The timer is only brought up to date when its registers are accessed, or on the cycle it requests an
+    // interrupt. Writes to the registers must be followed by a call to ScheduleEvent.
+    void Sync();
+    void Tick(u64 cycle) {
+        if (cycle >= next_event) {
+            SyncTo(cycle);
+        }
+    }
+    void ScheduleEvent();
+    // The number of upcoming ticks before the timer next needs to be stepped.
+    u64 QuietTicks() const;
+
+    void SerializeState(Common::State& state) {
+        state.Sync(divider, tima, tma, tac, prev_tima_inc, tima_overflow, tima_overflow_not_interrupted,
+                   prev_tima_val, last_sync);
+        if (state.Loading()) {
+            ScheduleEvent();
+        }
+    }
 
     // ******** Timer I/O registers ********
     // DIV register: 0xFF04
@@ -50,10 +69,23 @@ private:
     bool tima_overflow_not_interrupted = false;
     u8 prev_tima_val = 0x00;
 
+    u64 last_sync = 0;
+    u64 next_event = 0;
+
     const std::array<unsigned int, 4> select_div_bit{{0x0200, 0x0008, 0x0020, 0x0080}};
 
     bool DivFrequencyBitSet() const { return select_div_bit[tac & 0x03] & divider; }
     bool TimerEnabled() const { return tac & 0x04; }
+    // Outside of the few cycles around an overflow or a register write, TIMA just increments on every falling
+    // edge of the selected DIV bit, so any number of cycles can be skipped at once.
+    bool Steady() const {
+        return !tima_overflow && !tima_overflow_not_interrupted
+               && prev_tima_inc == (DivFrequencyBitSet() && TimerEnabled());
+    }
+    u64 TicksUntilOverflowEdge() const;
+
+    void SyncTo(u64 cycle);
+    void UpdateTimer();
 };
 
 } // End namespace Gb
@@ -24,11 +24,13 @@
 namespace Gb {
 
 void Lcd::DumpBackBuffer() const {
-    Common::WriteImageToFile(Common::BGR5ToRGB8(back_buffer), "screenshot", 160, 144);
+    std::vector<u8> rgb8(160 * 144 * 3);
+    Common::BGR5ToRGB8(back_frame, 160 * 144, rgb8.data());
+    Common::WriteImageToFile(rgb8, "screenshot", 160, 144);
 }
 
 void Lcd::DumpBgWin(u16 start_addr, const std::string& filename) {
-    tile_data.clear();
+    std::vector<BgAttrs> tile_map_data;
     // Get BG/Window tile map.
     std::size_t tile_map_len = tile_map_row_len * tile_map_row_len;
     std::vector<u8> tile_map(tile_map_len);
@@ -36,7 +38,7 @@ void Lcd::DumpBgWin(u16 start_addr, const std::string& filename) {
 
     if (gameboy.GameModeDmg()) {
         for (std::size_t i = 0; i < tile_map.size(); ++i) {
-            tile_data.emplace_back(tile_map[i]);
+            tile_map_data.emplace_back(tile_map[i]);
         }
     } else {
         // Get BG tile attributes.
@@ -44,31 +46,28 @@ void Lcd::DumpBgWin(u16 start_addr, const std::string& filename) {
         gameboy.mem->CopyFromVram(start_addr, tile_map_len, 1, tile_attrs.begin());
 
         for (std::size_t i = 0; i < tile_map.size(); ++i) {
-            tile_data.emplace_back(tile_map[i], tile_attrs[i]);
+            tile_map_data.emplace_back(tile_map[i], tile_attrs[i]);
         }
     }
 
-    FetchTiles();
+    for (auto& bg_tile : tile_map_data) {
+        bg_tile.tile_num = BgTileNum(bg_tile);
+    }
 
     std::vector<u16> bg_buffer(256 * 256);
 
     std::size_t buffer_pixel = 0;
     for (std::size_t i = 0; i < 32; ++i) {
         for (std::size_t row = 0; row < 8; ++row) {
-            auto tile_iter = tile_data.begin() + i * 32;
+            auto tile_iter = tile_map_data.cbegin() + i * 32;
 
             for (std::size_t j = 0; j < 32; ++j) {
-                std::size_t tile_row = row * 2;
-                // If this tile has the Y flip flag set, decode the mirrored row in the other half of the tile.
-                DecodePaletteIndices(tile_iter->tile, (tile_iter->y_flip) ? (14 - tile_row) : tile_row);
-
-                // If this tile has the X flip flag set, reverse the pixels.
-                if (tile_iter->x_flip) {
-                    std::reverse(pixel_colours.begin(), pixel_colours.end());
-                }
+                // If this tile has the Y flip flag set, get the mirrored row in the other half of the tile. The cache
+                // also holds the reversed rows used for the X flip flag.
+                LoadTileRow(tile_iter->tile_num, (tile_iter->y_flip) ? (7 - row) : row, tile_iter->x_flip);
 
                 if (gameboy.GameModeDmg()) {
-                    GetPixelColoursFromPaletteDmg(bg_palette_dmg, false);
+                    GetPixelColoursFromPaletteDmg(0, false);
                 } else {
                     GetPixelColoursFromPaletteCgb(tile_iter->palette_num, false);
                 }
@@ -87,13 +86,11 @@ void Lcd::DumpBgWin(u16 start_addr, const std::string& filename) {
 }
 
 void Lcd::DumpTileSet(int bank) {
-    std::vector<u8> tileset(0x17FF);
-    gameboy.mem->CopyFromVram(0x8000, 0x1800, bank, tileset.begin());
+    const u8* tileset = gameboy.mem->VramPointer(0x8000, bank);
 
     // 24 rows of 16 tiles.
     std::vector<u16> buffer(192*128);
 
-    std::array<u8, tile_bytes> tile;
     std::size_t buffer_pixel = 0;
 
     for (std::size_t i = 0; i < 24; ++i) {
@@ -104,9 +101,7 @@ void Lcd::DumpTileSet(int bank) {
             std::size_t tile_index = i * tile_bytes * 16;
             for (std::size_t j = 0; j < 16; ++j) {
                 std::size_t tile_row = row * 2;
-                // If this tile has the Y flip flag set, decode the mirrored row in the other half of the tile.
-                std::copy_n(tileset.begin() + tile_index + j * tile_bytes, tile_bytes, tile.begin());
-                DecodePaletteIndices(tile, tile_row);
+                DecodePaletteIndices(tileset + tile_index + j * tile_bytes, tile_row);
 
                 u8 palette = 0xE4;
                 for (auto& colour : pixel_colours) {
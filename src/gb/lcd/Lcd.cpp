@@ -15,10 +15,14 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
+#include <array>
+#include <limits>
 
 #include "gb/lcd/Lcd.h"
 #include "gb/core/GameBoy.h"
 #include "gb/memory/Memory.h"
+#include "common/SaveState.h"
+#include "common/Simd.h"
 
 namespace Gb {
 
@@ -49,9 +53,16 @@ SpriteAttrs::SpriteAttrs(u8 y, u8 x, u8 index, u8 attrs, GameMode game_mode)
     }
 };
 
-Lcd::Lcd(GameBoy& _gameboy)
+Lcd::Lcd(GameBoy& _gameboy, GbRenderer _renderer)
         : gameboy(_gameboy)
-        , back_buffer(160 * 144) {}
+        , renderer(_renderer)
+        , back_buffer(160 * 144)
+        , back_frame(back_buffer.data()) {
+
+    for (std::size_t i = 0; i < obj_palette_data.size(); i += 2) {
+        UpdateCgbColour(true, i);
+    }
+}
 
 void Lcd::UpdateLcd() {
     if (!LcdEnabled()) {
@@ -68,12 +79,22 @@ void Lcd::UpdateLcd() {
         // is entered. However, doing this causes most of Mooneye-GB's STAT timing tests to fail.
         if (scanline_cycles == ((gameboy.GameModeDmg() || gameboy.mem->double_speed) ? 4 : 0)) {
             SetStatMode(2);
-        } else if (scanline_cycles == ((gameboy.GameModeDmg()) ? 84 : (80 << gameboy.mem->double_speed))) {
+        } else if (scanline_cycles == Mode3StartCycles()) {
             SetStatMode(3);
-            RenderScanline();
+            if (skip_frame) {
+                SkipScanline();
+            } else if (renderer == GbRenderer::Accurate) {
+                line_pixels_drawn = 0;
+            } else {
+                RenderScanline();
+            }
         } else if (scanline_cycles == Mode3Cycles()) {
+            if (line_pixels_drawn < 160) {
+                DrawLineUpTo(160);
+            }
             SetStatMode(0);
             gameboy.mem->SignalHdma();
+            gameboy.hooks.HBlankStarted(current_scanline);
         }
     } else if (current_scanline == 144) {
         if (scanline_cycles == 0 && gameboy.ConsoleCgb()) {
@@ -86,14 +107,86 @@ void Lcd::UpdateLcd() {
                 stat_interrupt_signal |= Mode2CheckEnabled();
             }
 
-            // Swap front and back buffers now that we've completed a frame.
-            gameboy.SwapBuffers(back_buffer);
+            // Swap front and back buffers now that we've completed a frame. The front buffer keeps the last drawn
+            // frame if this one was skipped.
+            if (!skip_frame) {
+                back_frame = gameboy.SwapBuffers(back_frame, back_buffer);
+            }
+            skip_frame = gameboy.SkipNextFrame();
+            gameboy.hooks.VBlankStarted();
         }
     }
 
     CheckStatInterruptSignal();
 }
 
+void Lcd::Sync() {
+    SyncTo(gameboy.timestamp);
+}
+
+void Lcd::SyncTo(u64 cycle) {
+    u64 ticks = (cycle - last_sync) / 4;
+    last_sync += ticks * 4;
+
+    // Nothing at all happens while the LCD is off.
+    while (ticks > 0 && LcdEnabled()) {
+        const u64 quiet_ticks = std::min(ticks, TicksUntilEvent());
+        scanline_cycles += quiet_ticks * 4;
+        ticks -= quiet_ticks;
+
+        if (ticks > 0) {
+            UpdateLcd();
+            ticks -= 1;
+        }
+    }
+
+    ScheduleEvent();
+}
+
+void Lcd::ScheduleEvent() {
+    const u64 quiet_ticks = TicksUntilEvent();
+    if (quiet_ticks == std::numeric_limits<u64>::max()) {
+        next_event = quiet_ticks;
+    } else {
+        next_event = last_sync + (quiet_ticks + 1) * 4;
+    }
+}
+
+u64 Lcd::QuietTicks() const {
+    return (next_event > gameboy.timestamp) ? (next_event - gameboy.timestamp - 1) / 4 : 0;
+}
+
+u64 Lcd::TicksUntilEvent() const {
+    if (!LcdEnabled()) {
+        return std::numeric_limits<u64>::max();
+    }
+
+    // The LY=LYC and STAT signals have to have settled since the last change to LY, the STAT mode, or STAT.
+    if (ly != ly_last_cycle || ly_compare_equal_forced_zero || LyCompareEqual() != (ly_compare == ly)
+            || stat_interrupt_signal || prev_interrupt_signal != StatSignal()) {
+        return 0;
+    }
+
+    // Everything else happens on particular scanline cycles. Not all of them apply to every scanline and device,
+    // but stopping short at one of them costs a single tick.
+    const int double_speed = gameboy.mem->double_speed;
+    const std::array<int, 9> event_cycles{{4, 8, 12, 80, 84, 80 << double_speed, Mode3Cycles(), 452,
+                                           456 << double_speed}};
+
+    int next_cycle = std::numeric_limits<int>::max();
+    for (const int cycle : event_cycles) {
+        if (cycle > scanline_cycles) {
+            next_cycle = std::min(next_cycle, cycle);
+        }
+    }
+
+    if (next_cycle == std::numeric_limits<int>::max()) {
+        return 0;
+    }
+
+    return (next_cycle - scanline_cycles) / 4 - 1;
+}
+
 void Lcd::WriteLcdc(u8 data) {
     const bool lcd_was_enabled = LcdEnabled();
     const bool window_was_enabled = WindowEnabled();
@@ -117,11 +210,12 @@ void Lcd::UpdatePowerOnState(bool was_enabled) {
         ly = 0;
         SetStatMode(0);
         stat_interrupt_signal = 0;
+        line_pixels_drawn = 160;
         prev_interrupt_signal = 0;
 
         // Clear the framebuffer.
-        std::fill_n(back_buffer.begin(), 160 * 144, 0x7FFF);
-        gameboy.SwapBuffers(back_buffer);
+        std::fill_n(back_frame, 160 * 144, 0x7FFF);
+        back_frame = gameboy.SwapBuffers(back_frame, back_buffer);
 
         // An in-progress HDMA will transfer one block after the LCD switches off.
         gameboy.mem->SignalHdma();
@@ -160,7 +254,23 @@ void Lcd::UpdateLy() {
         } else {
             current_scanline = ++ly;
         }
+
+        gameboy.hooks.LineStarted(current_scanline);
+    }
+}
+
+bool Lcd::Mode3Within(int cycles) const {
+    if (!LcdEnabled()) {
+        return false;
+    } else if (current_scanline <= 143) {
+        return true;
     }
+
+    // Mode 3 can't begin before the start of scanline 0. The scanline cycle count may not have caught up with the
+    // current tick, so the time since the last sync is counted as well.
+    const int scanline_length = 456 << gameboy.mem->double_speed;
+    const int unsynced_cycles = static_cast<int>(gameboy.timestamp - last_sync);
+    return cycles >= (154 - current_scanline) * scanline_length - scanline_cycles - unsynced_cycles;
 }
 
 int Lcd::Line153Cycles() const {
@@ -176,6 +286,10 @@ int Lcd::Line153Cycles() const {
     }
 }
 
+int Lcd::Mode3StartCycles() const {
+    return gameboy.GameModeDmg() ? 84 : (80 << gameboy.mem->double_speed);
+}
+
 int Lcd::Mode3Cycles() const {
     // The cycles taken by mode 3 increase by a number of factors.
     int cycles = 256 << gameboy.mem->double_speed;
@@ -252,11 +366,13 @@ void Lcd::UpdateLyCompareSignal() {
     }
 }
 
+bool Lcd::StatSignal() const {
+    return (Mode0CheckEnabled() && StatMode() == 0) || (Mode1CheckEnabled() && StatMode() == 1)
+           || (Mode2CheckEnabled() && StatMode() == 2) || (LyCompareCheckEnabled() && LyCompareEqual());
+}
+
 void Lcd::CheckStatInterruptSignal() {
-    stat_interrupt_signal |= (Mode0CheckEnabled() && StatMode() == 0);
-    stat_interrupt_signal |= (Mode1CheckEnabled() && StatMode() == 1);
-    stat_interrupt_signal |= (Mode2CheckEnabled() && StatMode() == 2);
-    stat_interrupt_signal |= (LyCompareCheckEnabled() && LyCompareEqual());
+    stat_interrupt_signal |= StatSignal();
 
     // The STAT interrupt is triggered on a rising edge of the STAT interrupt signal, which is a 4 way logical OR
     // between each STAT check. As a result, if two events which would have triggered a STAT interrupt happen on
@@ -296,6 +412,74 @@ void Lcd::UpdateWindowPosition(bool was_enabled) {
 }
 
 void Lcd::RenderScanline() {
+    const auto bench_timer = gameboy.bench.Time(Common::BenchStats::Lcd);
+    gameboy.counters.Add(Common::PerfCounters::Scanlines);
+
+    RenderRow();
+
+    // The last 8 pixels of the row buffer are extra off-the-end space to simplify the background & window
+    // rendering code, and so they are discarded.
+    std::copy(row_buffer.begin(), row_buffer.end() - 8, back_frame + ly * 160);
+}
+
+void Lcd::CatchUpLine() {
+    if (renderer != GbRenderer::Accurate) {
+        return;
+    }
+
+    Sync();
+    if (line_pixels_drawn < 160) {
+        DrawLineUpTo(CurrentPixel());
+    }
+}
+
+void Lcd::DrawLineUpTo(std::size_t end_pixel) {
+    if (end_pixel <= line_pixels_drawn) {
+        return;
+    }
+
+    const auto bench_timer = gameboy.bench.Time(Common::BenchStats::Lcd);
+
+    // Each part renders the whole row with the registers as they are now, and keeps only its own pixels. Lines
+    // without mid-line writes are drawn in one part, the same as the scanline renderer. The window only moves down
+    // once the line is finished, if any part of the line drew it.
+    const u8 line_window_progress = window_progress;
+    RenderRow();
+    window_line_drawn |= (window_progress != line_window_progress);
+    window_progress = line_window_progress;
+
+    std::copy(row_buffer.begin() + line_pixels_drawn, row_buffer.begin() + end_pixel,
+              back_frame + ly * 160 + line_pixels_drawn);
+    line_pixels_drawn = static_cast<u8>(end_pixel);
+
+    if (end_pixel == 160) {
+        gameboy.counters.Add(Common::PerfCounters::Scanlines);
+        if (window_line_drawn) {
+            ++window_progress;
+        }
+        window_line_drawn = false;
+    }
+}
+
+std::size_t Lcd::CurrentPixel() const {
+    // Mode 3 spends 12 dots fetching the first tiles and discards the pixels scrolled off by SCX before it outputs
+    // one pixel per dot. Sprite fetch stalls aren't accounted for.
+    const int dots = (scanline_cycles - Mode3StartCycles()) >> gameboy.mem->double_speed;
+    return std::clamp(dots - 12 - scroll_x % 8, 0, 160);
+}
+
+void Lcd::RenderRow() {
+    // The game mode is fixed for the whole run, so the renderer is instantiated for each mode and picked here once
+    // per scanline, rather than checking the mode again for every tile and sprite.
+    if (gameboy.GameModeDmg()) {
+        RenderScanlineIn<GameMode::DMG>();
+    } else {
+        RenderScanlineIn<GameMode::CGB>();
+    }
+}
+
+template<GameMode M>
+void Lcd::RenderScanlineIn() {
     std::size_t num_bg_pixels;
     if (WindowEnabled()) {
         num_bg_pixels = (window_x < 7) ? 0 : window_x - 7;
@@ -303,54 +487,61 @@ void Lcd::RenderScanline() {
         num_bg_pixels = 160;
     }
 
-    if (gameboy.GameModeDmg()) {
-        if (BgEnabled()) {
-            RenderBackground(num_bg_pixels);
-        } else {
-            // If disabled, we need to blank what isn't covered by the window.
-            std::fill_n(row_buffer.begin(), num_bg_pixels, 0x7FFF);
-        }
+    if (M == GameMode::CGB || BgEnabled()) {
+        RenderBackground<M>(num_bg_pixels);
     } else {
-        RenderBackground(num_bg_pixels);
+        // If disabled, we need to blank what isn't covered by the window.
+        std::fill_n(row_buffer.begin(), num_bg_pixels, 0x7FFF);
     }
 
-    // On CGB in DMG mode, disabling the background will also disable the window.
-    if (gameboy.ConsoleCgb() && gameboy.GameModeDmg()) {
-        if (BgEnabled() && WindowEnabled()) {
-            RenderWindow(num_bg_pixels);
-        }
-    } else {
-        if (WindowEnabled()) {
-            RenderWindow(num_bg_pixels);
-        }
+    if (WindowDrawn()) {
+        RenderWindow<M>(num_bg_pixels);
     }
 
     if (SpritesEnabled()) {
-        RenderSprites();
+        RenderSprites<M>();
+    }
+}
+
+void Lcd::SkipScanline() {
+    // Nothing is drawn, but the window progress still has to advance as if it had been.
+    if (WindowDrawn()) {
+        ++window_progress;
     }
+}
 
-    // Copy the row buffer into the back buffer. The last 8 pixels of the row buffer are extra off-the-end space
-    // to simplify the background & window rendering code, and so they are discarded.
-    std::copy(row_buffer.begin(), row_buffer.end() - 8, back_buffer.begin() + ly * 160);
+bool Lcd::WindowDrawn() const {
+    // On CGB in DMG mode, disabling the background will also disable the window.
+    if (gameboy.ConsoleCgb() && gameboy.GameModeDmg()) {
+        return BgEnabled() && WindowEnabled();
+    } else {
+        return WindowEnabled();
+    }
 }
 
+template<GameMode M>
 void Lcd::RenderBackground(std::size_t num_bg_pixels) {
     // The background is composed of 32x32 tiles. The scroll registers (SCY and SCX) allow the top-left corner of
     // the screen to be positioned anywhere on the background, and the background wraps around when it hits the edge.
 
+    if (renderer == GbRenderer::Scanline) {
+        RenderBackgroundFromMap<M>(num_bg_pixels);
+        return;
+    }
+
     // Determine which row we need to fetch from the current values of SCY and LY.
     unsigned int row_num = ((scroll_y + ly) / 8) % tile_map_row_len;
-    InitTileMap(BgTileMapStartAddr() + row_num * tile_map_row_len);
+    InitTileMap<M>(BgTileMapStartAddr() + row_num * tile_map_row_len);
 
     FetchTiles();
 
     // Determine which row of pixels we're on, and in which tile we start reading data.
-    std::size_t tile_row = ((scroll_y + ly) % 8) * 2;
+    std::size_t tile_row = (scroll_y + ly) % 8;
     std::size_t start_tile = scroll_x / 8;
     auto tile_iter = tile_data.begin() + start_tile;
 
     // If necessary, throw away the first few pixels of the first tile, based on SCX.
-    std::size_t row_pixel = RenderFirstTile(0, start_tile, tile_row, scroll_x % 8);
+    std::size_t row_pixel = RenderFirstTile<M>(0, start_tile, tile_row, scroll_x % 8);
 
     // Increment the tile index to the next tile, and wrap around if we hit the end.
     if (++tile_iter == tile_data.end()) {
@@ -358,13 +549,9 @@ void Lcd::RenderBackground(std::size_t num_bg_pixels) {
     }
 
     while (row_pixel < num_bg_pixels) {
-        // If this tile has the Y flip flag set, decode the mirrored row in the other half of the tile.
-        DecodePaletteIndices(tile_iter->tile, (tile_iter->y_flip) ? (14 - tile_row) : tile_row);
-
-        // If this tile has the X flip flag set, reverse the pixels.
-        if (tile_iter->x_flip) {
-            std::reverse(pixel_colours.begin(), pixel_colours.end());
-        }
+        // If this tile has the Y flip flag set, get the mirrored row in the other half of the tile. The cache
+        // also holds the reversed rows used for the X flip flag.
+        LoadTileRow(tile_iter->tile_num, (tile_iter->y_flip) ? (7 - tile_row) : tile_row, tile_iter->x_flip);
 
         // Record the palette index for each pixel and the bg priority bit.
         for (const auto& pixel_colour : pixel_colours) {
@@ -372,11 +559,7 @@ void Lcd::RenderBackground(std::size_t num_bg_pixels) {
         }
         row_pixel -= 8;
 
-        if (gameboy.GameModeDmg()) {
-            GetPixelColoursFromPaletteDmg(bg_palette_dmg, false);
-        } else {
-            GetPixelColoursFromPaletteCgb(tile_iter->palette_num, false);
-        }
+        GetPixelColoursFromPalette<M>(tile_iter->palette_num, false);
 
         // Copy the pixels to the row buffer.
         for (const auto& pixel_colour : pixel_colours) {
@@ -389,13 +572,85 @@ void Lcd::RenderBackground(std::size_t num_bg_pixels) {
     }
 }
 
+template<GameMode M>
+void Lcd::RenderBackgroundFromMap(std::size_t num_bg_pixels) {
+    if (map_pixels.empty()) {
+        map_pixels.resize(2 * map_pixels_wide * map_pixels_wide);
+        map_cells.resize(2 * tile_map_row_len * tile_map_row_len);
+    }
+
+    const int layout = TileDataStartAddr() | (M == GameMode::CGB);
+    if (layout != map_layout) {
+        for (auto& cell : map_cells) {
+            cell.decoded = false;
+        }
+        map_row_generations.fill(unchecked_row);
+        map_layout = layout;
+    }
+
+    const std::size_t map_num = (BgTileMapStartAddr() == 0x9C00) ? 1 : 0;
+    const u8 map_y = scroll_y + ly;
+    auto& row_generation = map_row_generations[map_num * tile_map_row_len + map_y / 8];
+    if (row_generation != vram_generation) {
+        UpdateMapRow<M>(map_num, map_y / 8);
+        row_generation = vram_generation;
+    }
+
+    // The map x coordinate wraps around at 256 on its own.
+    const u8* map_row = map_pixels.data() + (map_num * map_pixels_wide + map_y) * map_pixels_wide;
+    const u16* colours = (M == GameMode::DMG) ? dmg_bg_colours.data() : bg_colours.data();
+    u8 map_x = scroll_x;
+    for (std::size_t pixel = 0; pixel < num_bg_pixels; ++pixel, ++map_x) {
+        const u8 map_pixel = map_row[map_x];
+        row_bg_info[pixel] = ((map_pixel & 0x03) << 1) | (map_pixel >> 5);
+        row_buffer[pixel] = colours[map_pixel & 0x1F];
+    }
+}
+
+template<GameMode M>
+void Lcd::UpdateMapRow(std::size_t map_num, std::size_t cell_row) {
+    const u16 tile_map_addr = 0x9800 + map_num * 0x400 + cell_row * tile_map_row_len;
+    const u8* row_tile_map = gameboy.mem->VramPointer(tile_map_addr, 0);
+    const u8* row_attr_map = (M == GameMode::CGB) ? gameboy.mem->VramPointer(tile_map_addr, 1) : nullptr;
+
+    for (std::size_t cell_col = 0; cell_col < tile_map_row_len; ++cell_col) {
+        const u8 attrs = (M == GameMode::CGB) ? row_attr_map[cell_col] : 0x00;
+        const BgAttrs bg_tile = (M == GameMode::CGB) ? BgAttrs(row_tile_map[cell_col], attrs)
+                                                     : BgAttrs(row_tile_map[cell_col]);
+        const std::size_t tile_num = BgTileNum(bg_tile);
+
+        auto& cell = map_cells[(map_num * tile_map_row_len + cell_row) * tile_map_row_len + cell_col];
+        if (cell.decoded && cell.index == bg_tile.index && cell.attrs == attrs
+                && cell.tile_generation == tile_generations[tile_num]) {
+            continue;
+        }
+        cell = MapCell{bg_tile.index, attrs, tile_generations[tile_num], true};
+
+        if (tile_dirty[tile_num]) {
+            DecodeTile(tile_num);
+        }
+
+        const auto& decoded_tile = decoded_tiles[tile_num];
+        const u8 tile_bits = (bg_tile.palette_num << 2) | (bg_tile.above_sprites << 5);
+        u8* dest = map_pixels.data() + (map_num * map_pixels_wide + cell_row * 8) * map_pixels_wide + cell_col * 8;
+        for (std::size_t row = 0; row < 8; ++row, dest += map_pixels_wide) {
+            const std::size_t tile_row = (bg_tile.y_flip) ? (7 - row) : row;
+            const auto& indices = (bg_tile.x_flip) ? decoded_tile.flipped_rows[tile_row] : decoded_tile.rows[tile_row];
+            for (std::size_t i = 0; i < 8; ++i) {
+                dest[i] = indices[i] | tile_bits;
+            }
+        }
+    }
+}
+
+template<GameMode M>
 void Lcd::RenderWindow(std::size_t num_bg_pixels) {
     // The window is composed of 32x32 tiles (of which only 21x18 tiles can be seen). Unlike the background, the
     // window cannot be scrolled; it is always displayed from its top-left corner and does not wrap around.
     // Instead, the position of its top-left corner can be set with the WY and WX registers.
 
     // Determine which row we need to fetch from the current internal value of the window progression.
-    InitTileMap(WindowTileMapStartAddr() + (window_progress / 8) * tile_map_row_len);
+    InitTileMap<M>(WindowTileMapStartAddr() + (window_progress / 8) * tile_map_row_len);
 
     FetchTiles();
 
@@ -404,21 +659,17 @@ void Lcd::RenderWindow(std::size_t num_bg_pixels) {
     // drawing from the row at which it left off; hence, the window progress must be tracked separately of LY.
 
     // Determine which row of pixels we're on.
-    std::size_t tile_row = ((window_progress) % 8) * 2;
+    std::size_t tile_row = window_progress % 8;
     auto tile_iter = tile_data.begin();
 
     // If necessary, throw away the first few pixels of the first tile, based on WX.
-    std::size_t row_pixel = RenderFirstTile(num_bg_pixels, 0, tile_row, (window_x < 7) ? 7 - window_x : 0);
+    std::size_t row_pixel = RenderFirstTile<M>(num_bg_pixels, 0, tile_row, (window_x < 7) ? 7 - window_x : 0);
     ++tile_iter;
 
     while (row_pixel < 160) {
-        // If this tile has the Y flip flag set, decode the mirrored row in the other half of the tile.
-        DecodePaletteIndices(tile_iter->tile, (tile_iter->y_flip) ? (14 - tile_row) : tile_row);
-
-        // If this tile has the X flip flag set, reverse the pixels.
-        if (tile_iter->x_flip) {
-            std::reverse(pixel_colours.begin(), pixel_colours.end());
-        }
+        // If this tile has the Y flip flag set, get the mirrored row in the other half of the tile. The cache
+        // also holds the reversed rows used for the X flip flag.
+        LoadTileRow(tile_iter->tile_num, (tile_iter->y_flip) ? (7 - tile_row) : tile_row, tile_iter->x_flip);
 
         // Record the palette index for each pixel and the bg priority bit.
         for (const auto& pixel_colour : pixel_colours) {
@@ -426,11 +677,7 @@ void Lcd::RenderWindow(std::size_t num_bg_pixels) {
         }
         row_pixel -= 8;
 
-        if (gameboy.GameModeDmg()) {
-            GetPixelColoursFromPaletteDmg(bg_palette_dmg, false);
-        } else {
-            GetPixelColoursFromPaletteCgb(tile_iter->palette_num, false);
-        }
+        GetPixelColoursFromPalette<M>(tile_iter->palette_num, false);
 
         // Copy the pixels to the row buffer.
         for (const auto& pixel_colour : pixel_colours) {
@@ -444,17 +691,14 @@ void Lcd::RenderWindow(std::size_t num_bg_pixels) {
     ++window_progress;
 }
 
+template<GameMode M>
 std::size_t Lcd::RenderFirstTile(std::size_t start_pixel, std::size_t start_tile, std::size_t tile_row,
                                  std::size_t throwaway) {
     auto& bg_tile = tile_data[start_tile];
 
-    // If this tile has the Y flip flag set, decode the mirrored row in the other half of the tile.
-    DecodePaletteIndices(bg_tile.tile, (bg_tile.y_flip) ? (14 - tile_row) : tile_row);
-
-    // If this tile has the X flip flag set, reverse the pixels.
-    if (bg_tile.x_flip) {
-        std::reverse(pixel_colours.begin(), pixel_colours.end());
-    }
+    // If this tile has the Y flip flag set, get the mirrored row in the other half of the tile. The cache
+    // also holds the reversed rows used for the X flip flag.
+    LoadTileRow(bg_tile.tile_num, (bg_tile.y_flip) ? (7 - tile_row) : tile_row, bg_tile.x_flip);
 
     // Record the palette index for each pixel and the bg priority bit.
     for (std::size_t pixel = throwaway; pixel < 8; ++pixel) {
@@ -462,11 +706,7 @@ std::size_t Lcd::RenderFirstTile(std::size_t start_pixel, std::size_t start_tile
     }
     start_pixel -= 8 - throwaway;
 
-    if (gameboy.GameModeDmg()) {
-        GetPixelColoursFromPaletteDmg(bg_palette_dmg, false);
-    } else {
-        GetPixelColoursFromPaletteCgb(bg_tile.palette_num, false);
-    }
+    GetPixelColoursFromPalette<M>(bg_tile.palette_num, false);
 
     // Throw away the first pixels of the tile.
     for (std::size_t pixel = throwaway; pixel < 8; ++pixel) {
@@ -477,14 +717,17 @@ std::size_t Lcd::RenderFirstTile(std::size_t start_pixel, std::size_t start_tile
     return start_pixel;
 }
 
+template<GameMode M>
 void Lcd::RenderSprites() {
-    SearchOam();
+    SearchOam<M>();
 
     FetchSpriteTiles();
 
     // Each row of 8 pixels in a tile is 2 bytes. The first byte contains the low bit of the palette index for
     // each pixel, and the second byte contains the high bit of the palette index.
-    for (const auto& sa : oam_sprites) {
+    for (std::size_t i = 0; i < num_oam_sprites; ++i) {
+        const auto& sa = oam_sprites[i];
+
         // Determine which row of the sprite tile is being drawn.
         std::size_t tile_row = (ly - (sa.y_pos - 16));
 
@@ -493,37 +736,15 @@ void Lcd::RenderSprites() {
             tile_row = (SpriteSize() - 1) - tile_row;
         }
 
-        // Two bytes per tile row.
-        tile_row *= 2;
-
-        DecodePaletteIndices(sa.sprite_tiles, tile_row);
-
-        if (gameboy.GameModeDmg()) {
-            GetPixelColoursFromPaletteDmg((sa.palette_num) ? obj_palette_dmg1 : obj_palette_dmg0, true);
-        } else {
-            GetPixelColoursFromPaletteCgb(sa.palette_num, true);
-        }
-
-        // If this sprite has the X flip flag set, reverse the pixels.
-        if (sa.x_flip) {
-            std::reverse(pixel_colours.begin(), pixel_colours.end());
-        }
-
-        auto pixel_iter = pixel_colours.cbegin(), pixel_end_iter = pixel_colours.cend();
+        // The second tile of an 8x16 sprite holds its bottom 8 rows.
+        LoadTileRow(sa.tile_num + tile_row / 8, tile_row % 8, sa.x_flip);
 
-        // If the sprite's X position is less than 8 or greater than 159, part of the sprite will be cut off.
-        std::size_t row_pixel = sa.x_pos - 8;
-        if (sa.x_pos < 8) {
-            pixel_iter += 8 - sa.x_pos;
-            row_pixel = 0;
-        } else if (sa.x_pos > 160) {
-            pixel_end_iter -= (sa.x_pos - 160);
-        }
+        GetPixelColoursFromPalette<M>(sa.palette_num, true);
 
         // If the sprite is drawn below the background, then it is only drawn on pixels of colour 0 for the palette
         // of that tile.
         u16 bg_colour_mask = 0x0000, bg_priority_mask = 0x0000;
-        if (gameboy.GameModeCgb()) {
+        if (M == GameMode::CGB) {
             // If the BG is "disabled" on CGB, both BG and OAM priority flags are ignored and the sprite is drawn
             // above the background.
             if (BgEnabled()) {
@@ -538,143 +759,276 @@ void Lcd::RenderSprites() {
             bg_colour_mask = 0x0006;
         }
 
-        while (pixel_iter != pixel_end_iter) {
-            bool pixel_transparent = *pixel_iter & 0x8000;
+        if (sa.x_pos >= 8) {
+            // The row buffers have 8 pixels of spare space past the right edge, so sprites cut off on the right
+            // still merge all 8 pixels at once.
+            MergeSpriteRow(sa.x_pos - 8, bg_colour_mask, bg_priority_mask);
+            continue;
+        }
+
+        // Sprites with an X position less than 8 are cut off on the left.
+        std::size_t row_pixel = 0;
+        for (std::size_t pixel = 8 - sa.x_pos; pixel < 8; ++pixel, ++row_pixel) {
+            bool pixel_transparent = pixel_colours[pixel] & 0x8000;
             u16 per_pixel_mask = bg_colour_mask | ((row_bg_info[row_pixel] & bg_priority_mask) ? 0x0006 : 0x0000);
 
             if (!pixel_transparent && (row_bg_info[row_pixel] & per_pixel_mask) == 0) {
-                row_buffer[row_pixel] = *pixel_iter;
+                row_buffer[row_pixel] = pixel_colours[pixel];
             }
-            ++pixel_iter;
-            ++row_pixel;
         }
     }
 }
 
+void Lcd::MergeSpriteRow(std::size_t row_pixel, u16 bg_colour_mask, u16 bg_priority_mask) {
+    // Each lane works out whether its sprite pixel is drawn: it has to be opaque, and the BG colour under it has
+    // to be 0 if the sprite is behind the BG, or if the BG tile has its priority bit set and priority is honoured.
+    using Lanes = Common::Simd::U16x8;
+    const Lanes sprite = Lanes::Load(pixel_colours.data());
+    const Lanes bg_info = Lanes::Load(row_bg_info.data() + row_pixel);
+
+    const Lanes bg_has_priority = AndNot((bg_info & Lanes::Splat(bg_priority_mask)) == Lanes::Zero(),
+                                         Lanes::Splat(0x0006));
+    const Lanes bg_colour_hides = bg_info & (Lanes::Splat(bg_colour_mask) | bg_has_priority);
+    const Lanes transparent = (sprite & Lanes::Splat(0x8000)) == Lanes::Splat(0x8000);
+    const Lanes drawn = AndNot(transparent, bg_colour_hides == Lanes::Zero());
+
+    const Lanes row = Lanes::Load(row_buffer.data() + row_pixel);
+    ((sprite & drawn) | AndNot(drawn, row)).Store(row_buffer.data() + row_pixel);
+}
+
+template<GameMode M>
 void Lcd::SearchOam() {
+    gameboy.mem->FlushOamDma();
+
     // The sprite_gap is the distance between the bottom of the sprite and its Y position (8 for 8x8, 0 for 8x16).
     unsigned int sprite_gap = SpriteSize() % 16;
     // The tile index mask is 0xFF for 8x8, 0xFE for 8x16.
     u8 index_mask = (sprite_gap >> 3) | 0xFE;
 
     // Store the first 10 sprites from OAM which are on this scanline.
-    oam_sprites.clear();
+    num_oam_sprites = 0;
     for (std::size_t i = 0; i < oam.size(); i += 4) {
         // Check that the sprite is not off the screen.
         if (oam[i] > sprite_gap && oam[i] < 160) {
             // Check that the sprite is on the current scanline.
             if (ly < oam[i] - sprite_gap && static_cast<int>(ly) >= static_cast<int>(oam[i]) - 16) {
-                oam_sprites.emplace_front(oam[i], oam[i+1], oam[i+2] & index_mask, oam[i+3], gameboy.game_mode);
+                oam_sprites[num_oam_sprites++] = SpriteAttrs(oam[i], oam[i+1], oam[i+2] & index_mask, oam[i+3], M);
             }
         }
 
-        if (oam_sprites.size() == 10) {
+        if (num_oam_sprites == max_sprites_per_line) {
             break;
         }
     }
 
+    // Sprites are drawn in decreasing OAM position, so that the ones with a lower position end up on top.
+    const auto sprites_begin = oam_sprites.begin();
+    std::reverse(sprites_begin, sprites_begin + num_oam_sprites);
+
     // Remove all sprites with an off-screen X position.
-    oam_sprites.erase(std::remove_if(oam_sprites.begin(), oam_sprites.end(), [](SpriteAttrs sa) {
-                          return sa.x_pos >= 168 || sa.x_pos == 0;
-                      }),
-                      oam_sprites.end());
+    const auto sprites_end = std::remove_if(sprites_begin, sprites_begin + num_oam_sprites, [](const SpriteAttrs& sa) {
+        return sa.x_pos >= 168 || sa.x_pos == 0;
+    });
+    num_oam_sprites = sprites_end - sprites_begin;
 
-    if (gameboy.GameModeDmg()) {
+    if (M == GameMode::DMG) {
         // Sprite are drawn in descending X order. If two sprites overlap, the one that has a lower position in OAM
         // is drawn on top. oam_sprites already contains the sprites for this line in decreasing OAM position, so
         // we sort them by decreasing X position. In CGB mode, sprites are always drawn according to OAM position.
-        std::stable_sort(oam_sprites.begin(), oam_sprites.end(), [](SpriteAttrs sa1, SpriteAttrs sa2) {
-            return sa2.x_pos < sa1.x_pos;
-        });
+        // An insertion sort is stable and, unlike std::stable_sort, never allocates a buffer.
+        for (std::size_t i = 1; i < num_oam_sprites; ++i) {
+            for (std::size_t j = i; j > 0 && oam_sprites[j - 1].x_pos < oam_sprites[j].x_pos; --j) {
+                std::swap(oam_sprites[j - 1], oam_sprites[j]);
+            }
+        }
     }
 }
 
+template<GameMode M>
 void Lcd::InitTileMap(u16 tile_map_addr) {
     // The tile maps are located at 0x9800-0x9BFF and 0x9C00-0x9FFF. They consist of 32 rows of 32 bytes each
     // which index the tileset.
 
     // Get the current row of tile indices from VRAM.
-    std::array<u8, tile_map_row_len> row_tile_map;
-    gameboy.mem->CopyFromVram(tile_map_addr, tile_map_row_len, 0, row_tile_map.begin());
-
-    tile_data.clear();
+    const u8* row_tile_map = gameboy.mem->VramPointer(tile_map_addr, 0);
 
-    if (gameboy.GameModeDmg()) {
-        for (std::size_t i = 0; i < row_tile_map.size(); ++i) {
-            tile_data.emplace_back(row_tile_map[i]);
+    if (M == GameMode::DMG) {
+        for (std::size_t i = 0; i < tile_map_row_len; ++i) {
+            tile_data[i] = BgAttrs(row_tile_map[i]);
         }
     } else {
         // Get the current row of background tile attributes from VRAM.
-        std::array<u8, tile_map_row_len> row_attr_map;
-        gameboy.mem->CopyFromVram(tile_map_addr, tile_map_row_len, 1, row_attr_map.begin());
+        const u8* row_attr_map = gameboy.mem->VramPointer(tile_map_addr, 1);
 
-        for (std::size_t i = 0; i < row_tile_map.size(); ++i) {
-            tile_data.emplace_back(row_tile_map[i], row_attr_map[i]);
+        for (std::size_t i = 0; i < tile_map_row_len; ++i) {
+            tile_data[i] = BgAttrs(row_tile_map[i], row_attr_map[i]);
         }
     }
 }
 
 void Lcd::FetchTiles() {
+    for (auto& bg_tile : tile_data) {
+        bg_tile.tile_num = BgTileNum(bg_tile);
+    }
+}
+
+std::size_t Lcd::BgTileNum(const BgAttrs& bg_tile) const {
     // The background tiles are located at either 0x8000-0x8FFF or 0x8800-0x97FF. For the first region, the
     // tile map indices are unsigned offsets from 0x8000; for the second region, the indices are signed
     // offsets from 0x9000.
 
     u16 region_start_addr = TileDataStartAddr();
+    u16 tile_addr;
     if (region_start_addr == 0x9000) {
         // Signed tile data region.
-        for (auto& bg_tile : tile_data) {
-            u16 tile_addr = region_start_addr + static_cast<s8>(bg_tile.index) * static_cast<s8>(tile_bytes);
-            gameboy.mem->CopyFromVram(tile_addr, tile_bytes, bg_tile.bank_num, bg_tile.tile.begin());
-        }
+        tile_addr = region_start_addr + static_cast<s8>(bg_tile.index) * static_cast<s8>(tile_bytes);
     } else {
         // Unsigned tile data region.
-        for (auto& bg_tile : tile_data) {
-            u16 tile_addr = region_start_addr + bg_tile.index * tile_bytes;
-            gameboy.mem->CopyFromVram(tile_addr, tile_bytes, bg_tile.bank_num, bg_tile.tile.begin());
-        }
+        tile_addr = region_start_addr + bg_tile.index * tile_bytes;
     }
+
+    return TileNum(tile_addr, bg_tile.bank_num);
 }
 
 void Lcd::FetchSpriteTiles() {
-    std::size_t tile_size = tile_bytes;
-    if (SpriteSize() == 16) {
-        tile_size *= 2;
-    }
-
     // Sprite tiles can only be located in 0x8000-0x8FFF.
-    for (auto& sa : oam_sprites) {
+    for (std::size_t i = 0; i < num_oam_sprites; ++i) {
+        auto& sa = oam_sprites[i];
         u16 tile_addr = 0x8000 | (static_cast<u16>(sa.tile_index) << 4);
-        gameboy.mem->CopyFromVram(tile_addr, tile_size, sa.bank_num, sa.sprite_tiles.begin());
+        sa.tile_num = TileNum(tile_addr, sa.bank_num);
     }
 }
 
-void Lcd::GetPixelColoursFromPaletteDmg(u8 palette, bool sprite) {
-    for (auto& colour : pixel_colours) {
-        if (sprite && colour == 0) {
-            // Palette index 0 is transparent for sprites. Set the alpha bit.
-            colour |= 0x8000;
-        } else {
-            colour = shades[(palette >> (colour * 2)) & 0x03];
-        }
+void Lcd::LoadTileRow(std::size_t tile_num, std::size_t row, bool x_flip) {
+    if (tile_dirty[tile_num]) {
+        DecodeTile(tile_num);
     }
+
+    const auto& indices = (x_flip) ? decoded_tiles[tile_num].flipped_rows[row] : decoded_tiles[tile_num].rows[row];
+    std::copy(indices.cbegin(), indices.cend(), pixel_colours.begin());
 }
 
-void Lcd::GetPixelColoursFromPaletteCgb(int palette_num, bool sprite) {
-    if (sprite) {
-        for (auto& colour : pixel_colours) {
-            if (colour == 0) {
-                // Palette index 0 is transparent for sprites. Set the alpha bit.
-                colour |= 0x8000;
-            } else {
-                std::size_t index = palette_num * 8 + colour * 2;
-                colour = (static_cast<u16>((obj_palette_data[index + 1] & 0x7F)) << 8) | obj_palette_data[index];
-            }
-        }
+void Lcd::DecodeTile(std::size_t tile_num) {
+    const u8* tile = gameboy.mem->VramPointer(0x8000 + (tile_num % tiles_per_bank) * tile_bytes,
+                                              tile_num / tiles_per_bank);
+    auto& decoded_tile = decoded_tiles[tile_num];
+
+    for (std::size_t row = 0; row < 8; ++row) {
+        DecodePaletteIndices(tile, row * 2);
+        std::copy(pixel_colours.cbegin(), pixel_colours.cend(), decoded_tile.rows[row].begin());
+        std::copy(pixel_colours.crbegin(), pixel_colours.crend(), decoded_tile.flipped_rows[row].begin());
+    }
+
+    tile_dirty[tile_num] = false;
+}
+
+void Lcd::UpdateDmgColours() {
+    for (std::size_t i = 0; i < dmg_bg_colours.size(); ++i) {
+        dmg_bg_colours[i] = shades[(bg_palette_dmg >> (i * 2)) & 0x03];
+        dmg_obj_colours[i] = shades[(obj_palette_dmg0 >> (i * 2)) & 0x03];
+        dmg_obj_colours[i + 4] = shades[(obj_palette_dmg1 >> (i * 2)) & 0x03];
+    }
+
+    // Palette index 0 is transparent for sprites. Set the alpha bit.
+    dmg_obj_colours[0] = 0x8000;
+    dmg_obj_colours[4] = 0x8000;
+}
+
+void Lcd::UpdateCgbColour(bool sprite, std::size_t data_index) {
+    const auto& palette_data = (sprite) ? obj_palette_data : bg_palette_data;
+    auto& colours = (sprite) ? obj_colours : bg_colours;
+
+    // Each colour is two bytes of palette data.
+    const std::size_t index = data_index & ~0x01;
+    const std::size_t colour = index / 2;
+
+    if (sprite && colour % 4 == 0) {
+        // Palette index 0 is transparent for sprites. Set the alpha bit.
+        colours[colour] = 0x8000;
     } else {
-        for (auto& colour : pixel_colours) {
-            std::size_t index = palette_num * 8 + colour * 2;
-            colour = (static_cast<u16>((bg_palette_data[index + 1] & 0x7F)) << 8) | bg_palette_data[index];
+        colours[colour] = (static_cast<u16>((palette_data[index + 1] & 0x7F)) << 8) | palette_data[index];
+    }
+}
+
+template<GameMode M>
+void Lcd::GetPixelColoursFromPalette(int palette_num, bool sprite) {
+    if constexpr (M == GameMode::DMG) {
+        GetPixelColoursFromPaletteDmg(palette_num, sprite);
+    } else {
+        GetPixelColoursFromPaletteCgb(palette_num, sprite);
+    }
+}
+
+void Lcd::GetPixelColoursFromPaletteDmg(int palette_num, bool sprite) {
+    MapPaletteIndices(((sprite) ? dmg_obj_colours.data() : dmg_bg_colours.data()) + palette_num * 4);
+}
+
+void Lcd::GetPixelColoursFromPaletteCgb(int palette_num, bool sprite) {
+    MapPaletteIndices(((sprite) ? obj_colours.data() : bg_colours.data()) + palette_num * 4);
+}
+
+void Lcd::DecodePaletteIndices(const u8* tile, const std::size_t tile_row) {
+    // Each row of 8 pixels in a tile is 2 bytes. The first byte contains the low bit of the palette index for
+    // each pixel, and the second byte contains the high bit of the palette index. Each byte is broadcast to all 8
+    // lanes, and each lane tests the bit belonging to its pixel, leftmost pixel in bit 7.
+    using Lanes = Common::Simd::U16x8;
+    const Lanes pixel_bits = Lanes::FromLanes({{0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01}});
+    const Lanes lsb = Lanes::Splat(tile[tile_row]) & pixel_bits;
+    const Lanes msb = Lanes::Splat(tile[tile_row + 1]) & pixel_bits;
+
+    // A lane is all ones if its bit is set, so shift that down to the palette index bit.
+    const Lanes lo = ShiftRight(lsb == pixel_bits, 15);
+    const Lanes hi = ShiftLeft(ShiftRight(msb == pixel_bits, 15), 1);
+
+    (lo | hi).Store(pixel_colours.data());
+}
+
+void Lcd::MapPaletteIndices(const u16* colours) {
+    // Replace the palette indices in pixel_colours with their colours, selecting each colour with a mask of the
+    // lanes holding its index.
+    using Lanes = Common::Simd::U16x8;
+    const Lanes indices = Lanes::Load(pixel_colours.data());
+
+    Lanes result = Lanes::Zero();
+    for (int i = 0; i < 4; ++i) {
+        result = result | ((indices == Lanes::Splat(i)) & Lanes::Splat(colours[i]));
+    }
+
+    result.Store(pixel_colours.data());
+}
+
+void Lcd::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("lcd", sizeof(Lcd));
+    report.Add("frame_buffers", back_buffer);
+    report.Add("bg_map_cache", map_pixels);
+    report.Add("bg_map_cache", map_cells);
+}
+
+void Lcd::SerializeState(Common::State& state) {
+    state.Sync(oam, lcdc, stat, scroll_y, scroll_x, ly, ly_compare, bg_palette_dmg, obj_palette_dmg0,
+               obj_palette_dmg1, window_y, window_x);
+    state.Sync(bg_palette_index, bg_palette_data, obj_palette_index, obj_palette_data);
+    state.Sync(scanline_cycles, current_scanline, stat_interrupt_signal, prev_interrupt_signal, ly_last_cycle,
+               ly_compare_equal_forced_zero, last_sync);
+    state.Sync(oam_sprites, num_oam_sprites, skip_frame, window_progress, window_was_disabled, line_pixels_drawn,
+               window_line_drawn);
+    if (state.Loading()) {
+        // Loaded into the LCD's own buffer, as the frontend may hold on to any memory it lent.
+        back_frame = back_buffer.data();
+    }
+    state.SyncContents(back_frame, back_buffer.size());
+
+    if (state.Loading()) {
+        // The resolved colours and decoded tiles are rebuilt from the restored registers and VRAM.
+        UpdateDmgColours();
+        for (std::size_t i = 0; i < bg_palette_data.size(); i += 2) {
+            UpdateCgbColour(false, i);
+            UpdateCgbColour(true, i);
         }
+        tile_dirty = MakeAllDirty();
+        map_layout = -1;
+
+        ScheduleEvent();
     }
 }
 
@@ -18,50 +18,92 @@
 
 #include <vector>
 #include <array>
-#include <deque>
 #include <string>
 
+#include "common/CommonEnums.h"
 #include "common/CommonTypes.h"
+#include "common/MemoryReport.h"
 #include "gb/core/Enums.h"
 
+namespace Common { class State; }
+namespace Bench { class Kernels; }
+
 namespace Gb {
 
 class GameBoy;
 
 struct BgAttrs {
+    BgAttrs() = default;
     explicit BgAttrs(u8 tile_index);
     BgAttrs(u8 tile_index, u8 attrs);
 
-    const u8 index = 0, above_sprites = 0;
-    const bool y_flip = false, x_flip = false;
-    const int palette_num = 0, bank_num = 0;
+    u8 index = 0, above_sprites = 0;
+    bool y_flip = false, x_flip = false;
+    int palette_num = 0, bank_num = 0;
 
-    std::array<u8, 16> tile;
+    // Index into the decoded tile cache.
+    std::size_t tile_num = 0;
 };
 
 struct SpriteAttrs {
+    SpriteAttrs() = default;
     SpriteAttrs(u8 y, u8 x, u8 index, u8 attrs, GameMode game_mode);
 
-    u8 y_pos, x_pos, tile_index;
-    bool behind_bg, y_flip, x_flip;
-    int palette_num, bank_num;
+    u8 y_pos = 0, x_pos = 0, tile_index = 0;
+    bool behind_bg = false, y_flip = false, x_flip = false;
+    int palette_num = 0, bank_num = 0;
 
-    std::array<u8, 32> sprite_tiles;
+    // Index into the decoded tile cache. 8x16 sprites also use the next tile.
+    std::size_t tile_num = 0;
 };
 
 class Lcd {
-public:
-    explicit Lcd(GameBoy& _gameboy);
+    friend class Bench::Kernels;
 
-    void UpdateLcd();
+public:
+    Lcd(GameBoy& _gameboy, GbRenderer _renderer);
+
+    // Most ticks only advance the scanline cycle count, so the LCD is only stepped on the ticks where the mode, LY,
+    // or the STAT signal can change. Anything which reads the scanline cycle count, or changes the registers those
+    // events depend on, must call Sync first and ScheduleEvent after.
+    void Sync();
+    void Tick(u64 cycle) {
+        if (cycle >= next_event) {
+            SyncTo(cycle);
+        }
+    }
+    void ScheduleEvent();
+    // The number of upcoming ticks before the LCD next needs to be stepped.
+    u64 QuietTicks() const;
 
     void WriteLcdc(u8 data);
     void WriteWy(u8 data);
     void WriteWx(u8 data);
     void SetStatSignal() { stat_interrupt_signal = true; }
+    bool Mode3Within(int cycles) const;
+    // Called before writes to the registers the renderer reads. With the accurate renderer, the line being drawn is
+    // drawn up to the current pixel with the old values first.
+    void CatchUpLine();
+    bool LcdEnabled() const { return lcdc & 0x80; }
+
+    // Called after writes to the palette registers, to refresh the resolved colours.
+    void UpdateDmgColours();
+    void UpdateCgbColour(bool sprite, std::size_t data_index);
+
+    // Called for every write to VRAM, to mark the decoded tile it belongs to as stale.
+    void VramWritten(u16 addr, int bank_num) {
+        ++vram_generation;
+        if (addr < 0x9800) {
+            tile_dirty[TileNum(addr, bank_num)] = true;
+            ++tile_generations[TileNum(addr, bank_num)];
+        }
+    }
 
     void DumpEverything();
 
+    void SerializeState(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
+
     // ******** OAM ********
     // The Object Attribute Memory (OAM) contains 40 sprite attributes each 4 bytes long.
     // Byte 0: the Y position of the sprite, minus 16.
@@ -148,15 +190,23 @@ public:
 
 private:
     GameBoy& gameboy;
+    const GbRenderer renderer;
 
     int scanline_cycles = 452;
     u8 current_scanline = 0;
+    u64 last_sync = 0;
+    u64 next_event = 0;
+    void SyncTo(u64 cycle);
+    void UpdateLcd();
+    u64 TicksUntilEvent() const;
     void UpdateLy();
     int Line153Cycles() const;
+    int Mode3StartCycles() const;
     int Mode3Cycles() const;
     void StrangeLy();
 
     bool stat_interrupt_signal = false, prev_interrupt_signal = false;
+    bool StatSignal() const;
     void CheckStatInterruptSignal();
 
     // LY=LYC interrupt
@@ -169,45 +219,128 @@ private:
     static constexpr std::size_t tile_bytes = 16;
     const std::array<u16, 4> shades{{0x7FFF, 0x56B5, 0x294A, 0x0000}};
 
-    std::vector<BgAttrs> tile_data;
-    std::deque<SpriteAttrs> oam_sprites;
+    // The colours of each palette, resolved from the palette registers, with 4 consecutive colours per palette.
+    // Colour 0 of the sprite palettes is always transparent, so it holds the alpha bit instead.
+    std::array<u16, 4> dmg_bg_colours{};
+    std::array<u16, 8> dmg_obj_colours{};
+    std::array<u16, 32> bg_colours{};
+    std::array<u16, 32> obj_colours{};
+
+    // Both are rebuilt every scanline, so they're kept inline to avoid allocating. A tile map row is 32 tiles, and
+    // at most 10 sprites can be drawn on a scanline.
+    static constexpr std::size_t max_sprites_per_line = 10;
+    std::array<BgAttrs, tile_map_row_len> tile_data;
+    std::array<SpriteAttrs, max_sprites_per_line> oam_sprites;
+    std::size_t num_oam_sprites = 0;
 
     std::array<u16, 8> pixel_colours;
-    std::array<u16, 168> row_buffer;
-    std::array<u16, 168> row_bg_info;
+    std::array<u16, 168> row_buffer{};
+    std::array<u16, 168> row_bg_info{};
     std::vector<u16> back_buffer;
+    // Where the frame is being drawn, which is either buffer of the core's or memory lent by the frontend.
+    u16* back_frame;
+    // Decided at the start of each frame. Skipped frames keep their timing, but nothing is drawn.
+    bool skip_frame = false;
 
     u8 window_progress = 0x00;
     bool window_was_disabled = false;
 
+    // The accurate renderer draws a line when mode 3 ends, or in parts at the writes made while drawing it. This is
+    // how far the current line has been drawn, or 160 if no line is being drawn.
+    u8 line_pixels_drawn = 160;
+    bool window_line_drawn = false;
+
     void UpdatePowerOnState(bool was_enabled);
     void UpdateWindowPosition(bool was_enabled);
 
     void RenderScanline();
+    void DrawLineUpTo(std::size_t end_pixel);
+    std::size_t CurrentPixel() const;
+    void RenderRow();
+    void SkipScanline();
+    bool WindowDrawn() const;
+
+    // The renderer is instantiated once per game mode, so the per-tile work doesn't check the mode.
+    template<GameMode M>
+    void RenderScanlineIn();
+    template<GameMode M>
     void RenderBackground(std::size_t num_bg_pixels);
+    template<GameMode M>
     void RenderWindow(std::size_t num_bg_pixels);
+    template<GameMode M>
     std::size_t RenderFirstTile(std::size_t start_pixel, std::size_t start_tile, std::size_t tile_row,
                                 std::size_t throwaway);
+    template<GameMode M>
     void RenderSprites();
+    template<GameMode M>
     void SearchOam();
+    // Draws the sprite row in pixel_colours over the 8 pixels of the row buffer starting at row_pixel.
+    void MergeSpriteRow(std::size_t row_pixel, u16 bg_colour_mask, u16 bg_priority_mask);
+    template<GameMode M>
     void InitTileMap(u16 tile_map_addr);
     void FetchTiles();
-    void FetchSpriteTiles();
-    void GetPixelColoursFromPaletteDmg(u8 palette, bool sprite);
-    void GetPixelColoursFromPaletteCgb(int palette_num, bool sprite);
-    template<std::size_t N>
-    void DecodePaletteIndices(const std::array<u8, N>& tile, const std::size_t tile_row) {
-        // Get the two bytes containing the row of the tile.
-        const u8 lsb = tile[tile_row], msb = tile[tile_row + 1];
-
-        // Each row of 8 pixels in a tile is 2 bytes. The first byte contains the low bit of the palette index for
-        // each pixel, and the second byte contains the high bit of the palette index.
-        for (std::size_t j = 0; j < 7; ++j) {
-            pixel_colours[j] = ((lsb >> (7-j)) & 0x01) | ((msb >> (6-j)) & 0x02);
+    std::size_t BgTileNum(const BgAttrs& bg_tile) const;
+
+    // Decoded tile cache. Each of the 384 tiles in both VRAM banks is kept as rows of palette indices, along with
+    // the reversed rows for x-flipped tiles. Tiles are decoded again the next time they're drawn after a write.
+    static constexpr std::size_t tiles_per_bank = 384;
+    struct DecodedTile {
+        std::array<std::array<u8, 8>, 8> rows;
+        std::array<std::array<u8, 8>, 8> flipped_rows;
+    };
+
+    std::array<DecodedTile, 2 * tiles_per_bank> decoded_tiles;
+    std::array<bool, 2 * tiles_per_bank> tile_dirty = MakeAllDirty();
+
+    static constexpr std::size_t TileNum(u16 tile_addr, int bank_num) {
+        return bank_num * tiles_per_bank + ((tile_addr - 0x8000) >> 4);
+    }
+    static constexpr std::array<bool, 2 * tiles_per_bank> MakeAllDirty() {
+        std::array<bool, 2 * tiles_per_bank> init{};
+        for (auto& dirty : init) {
+            dirty = true;
         }
-        pixel_colours[7] = (lsb & 0x01) | ((msb << 1) & 0x02); // Can't shift right by -1...
+        return init;
     }
 
+    // Write counts for all of VRAM and for each tile, which only go up.
+    u64 vram_generation = 0;
+    std::array<u32, 2 * tiles_per_bank> tile_generations{};
+
+    // The scanline renderer keeps both tile maps decoded, 256x256 pixels each, so a background line is a wrapped
+    // copy of one map row. Each pixel holds its palette index in bits 0-1, its palette number in bits 2-4 and its
+    // BG priority in bit 5. Each cell remembers the map entry and tile write count it was decoded from, and each
+    // row of cells is checked against them again after any VRAM write.
+    struct MapCell {
+        u8 index = 0, attrs = 0;
+        u32 tile_generation = 0;
+        bool decoded = false;
+    };
+
+    static constexpr std::size_t map_pixels_wide = 256;
+    static constexpr u64 unchecked_row = ~0ull;
+    std::vector<u8> map_pixels;
+    std::vector<MapCell> map_cells;
+    std::array<u64, 2 * tile_map_row_len> map_row_generations;
+    // The tile data region and game mode the maps were decoded with.
+    int map_layout = -1;
+
+    template<GameMode M>
+    void RenderBackgroundFromMap(std::size_t num_bg_pixels);
+    template<GameMode M>
+    void UpdateMapRow(std::size_t map_num, std::size_t cell_row);
+
+    // Loads a row of a tile's palette indices into pixel_colours.
+    void LoadTileRow(std::size_t tile_num, std::size_t row, bool x_flip);
+    void DecodeTile(std::size_t tile_num);
+    void FetchSpriteTiles();
+    template<GameMode M>
+    void GetPixelColoursFromPalette(int palette_num, bool sprite);
+    void GetPixelColoursFromPaletteDmg(int palette_num, bool sprite);
+    void GetPixelColoursFromPaletteCgb(int palette_num, bool sprite);
+    void DecodePaletteIndices(const u8* tile, const std::size_t tile_row);
+    void MapPaletteIndices(const u16* colours);
+
     // STAT functions
     void SetStatMode(unsigned int mode) { stat = (stat & 0xFC) | mode; }
     unsigned int StatMode() const { return stat & 0x03; }
@@ -226,7 +359,6 @@ private:
     u16 TileDataStartAddr() const { return (lcdc & 0x10) ? 0x8000 : 0x9000; }
     bool WindowEnabled() const { return (lcdc & 0x20) && (window_x < 167) && (ly >= window_y); }
     u16 WindowTileMapStartAddr() const { return (lcdc & 0x40) ? 0x9C00 : 0x9800; }
-    bool LcdEnabled() const { return lcdc & 0x80; }
 
     // Graphics data debug functions
     void DumpBackBuffer() const;
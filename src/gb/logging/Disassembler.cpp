@@ -14,6 +14,8 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <iterator>
+
 #include "gb/logging/Logging.h"
 #include "gb/core/GameBoy.h"
 #include "gb/memory/Memory.h"
@@ -21,11 +23,11 @@
 namespace Gb {
 
 std::string Logging::NextByteAsStr(const u16 pc) const {
-    return fmt::format("0x{0:0>2X}", gameboy.mem->ReadMem(pc + 1));
+    return fmt::format("0x{0:0>2X}", ReadCode(pc + 1));
 }
 
 std::string Logging::NextSignedByteAsStr(const u16 pc) const {
-    const s8 sbyte = gameboy.mem->ReadMem(pc + 1);
+    const s8 sbyte = ReadCode(pc + 1);
     if (sbyte < 0) {
         return fmt::format("-0x{0:0>2X}", (~sbyte) + 1);
     } else {
@@ -34,152 +36,176 @@ std::string Logging::NextSignedByteAsStr(const u16 pc) const {
 }
 
 std::string Logging::NextWordAsStr(const u16 pc) const {
-    return fmt::format("0x{0:0>4X}", (gameboy.mem->ReadMem(pc + 2) << 8) | gameboy.mem->ReadMem(pc + 1));
+    return fmt::format("0x{0:0>4X}", (ReadCode(pc + 2) << 8) | ReadCode(pc + 1));
 }
 
 void Logging::LoadString(const std::string& into, const std::string& from) {
-    fmt::print(log_stream, "LD {}, {}", into, from);
+    fmt::format_to(std::back_inserter(instr_text), "LD {}, {}", into, from);
 }
 
 void Logging::LoadIncString(const std::string& into, const std::string& from) {
-    fmt::print(log_stream, "LDI {}, {}", into, from);
+    fmt::format_to(std::back_inserter(instr_text), "LDI {}, {}", into, from);
 }
 
 void Logging::LoadDecString(const std::string& into, const std::string& from) {
-    fmt::print(log_stream, "LDD {}, {}", into, from);
+    fmt::format_to(std::back_inserter(instr_text), "LDD {}, {}", into, from);
 }
 
 void Logging::LoadHighString(const std::string& into, const std::string& from) {
-    fmt::print(log_stream, "LDH {}, {}", into, from);
+    fmt::format_to(std::back_inserter(instr_text), "LDH {}, {}", into, from);
 }
 
 void Logging::PushString(const std::string& reg) {
-    fmt::print(log_stream, "PUSH {}", reg);
+    fmt::format_to(std::back_inserter(instr_text), "PUSH {}", reg);
 }
 
 void Logging::PopString(const std::string& reg) {
-    fmt::print(log_stream, "POP {}", reg);
+    fmt::format_to(std::back_inserter(instr_text), "POP {}", reg);
 }
 
 void Logging::AddString(const std::string& from) {
-    fmt::print(log_stream, "ADD A, {}", from);
+    fmt::format_to(std::back_inserter(instr_text), "ADD A, {}", from);
 }
 
 void Logging::AddString(const std::string& into, const std::string& from) {
-    fmt::print(log_stream, "ADD {}, {}", into, from);
+    fmt::format_to(std::back_inserter(instr_text), "ADD {}, {}", into, from);
 }
 
 void Logging::AdcString(const std::string& from) {
-    fmt::print(log_stream, "ADC A, {}", from);
+    fmt::format_to(std::back_inserter(instr_text), "ADC A, {}", from);
 }
 
 void Logging::SubString(const std::string& from) {
-    fmt::print(log_stream, "SUB A, {}", from);
+    fmt::format_to(std::back_inserter(instr_text), "SUB A, {}", from);
 }
 
 void Logging::SbcString(const std::string& from) {
-    fmt::print(log_stream, "SBC A, {}", from);
+    fmt::format_to(std::back_inserter(instr_text), "SBC A, {}", from);
 }
 
 void Logging::AndString(const std::string& with) {
-    fmt::print(log_stream, "AND {}", with);
+    fmt::format_to(std::back_inserter(instr_text), "AND {}", with);
 }
 
 void Logging::OrString(const std::string& with) {
-    fmt::print(log_stream, "OR {}", with);
+    fmt::format_to(std::back_inserter(instr_text), "OR {}", with);
 }
 
 void Logging::XorString(const std::string& with) {
-    fmt::print(log_stream, "XOR {}", with);
+    fmt::format_to(std::back_inserter(instr_text), "XOR {}", with);
 }
 
 void Logging::CompareString(const std::string& with) {
-    fmt::print(log_stream, "CP {}", with);
+    fmt::format_to(std::back_inserter(instr_text), "CP {}", with);
 }
 
 void Logging::IncString(const std::string& reg) {
-    fmt::print(log_stream, "INC {}", reg);
+    fmt::format_to(std::back_inserter(instr_text), "INC {}", reg);
 }
 
 void Logging::DecString(const std::string& reg) {
-    fmt::print(log_stream, "DEC {}", reg);
+    fmt::format_to(std::back_inserter(instr_text), "DEC {}", reg);
 }
 
 void Logging::JumpString(const std::string& addr) {
-    fmt::print(log_stream, "JP {}", addr);
+    fmt::format_to(std::back_inserter(instr_text), "JP {}", addr);
 }
 
 void Logging::JumpString(const std::string& cond, const std::string& addr) {
-    fmt::print(log_stream, "JP {}, {}", cond, addr);
+    fmt::format_to(std::back_inserter(instr_text), "JP {}, {}", cond, addr);
 }
 
 void Logging::RelJumpString(const std::string& addr) {
-    fmt::print(log_stream, "JR {}", addr);
+    fmt::format_to(std::back_inserter(instr_text), "JR {}", addr);
 }
 
 void Logging::RelJumpString(const std::string& cond, const std::string& addr) {
-    fmt::print(log_stream, "JR {}, {}", cond, addr);
+    fmt::format_to(std::back_inserter(instr_text), "JR {}, {}", cond, addr);
 }
 
 void Logging::CallString(const std::string& addr) {
-    fmt::print(log_stream, "CALL {}", addr);
+    fmt::format_to(std::back_inserter(instr_text), "CALL {}", addr);
 }
 
 void Logging::CallString(const std::string& cond, const std::string& addr) {
-    fmt::print(log_stream, "CALL {}, {}", cond, addr);
+    fmt::format_to(std::back_inserter(instr_text), "CALL {}, {}", cond, addr);
 }
 
 void Logging::ReturnInterruptString(const std::string& reti) {
-    fmt::print(log_stream, "RET{}", reti);
+    fmt::format_to(std::back_inserter(instr_text), "RET{}", reti);
 }
 
 void Logging::ReturnCondString(const std::string& cond) {
-    fmt::print(log_stream, "RET {}", cond);
+    fmt::format_to(std::back_inserter(instr_text), "RET {}", cond);
 }
 
 void Logging::RestartString(const std::string& addr) {
-    fmt::print(log_stream, "RST {}", addr);
+    fmt::format_to(std::back_inserter(instr_text), "RST {}", addr);
 }
 
 void Logging::RotLeftString(const std::string& carry, const std::string& reg) {
-    fmt::print(log_stream, "RL{} {}", carry, reg);
+    fmt::format_to(std::back_inserter(instr_text), "RL{} {}", carry, reg);
 }
 
 void Logging::RotRightString(const std::string& carry, const std::string& reg) {
-    fmt::print(log_stream, "RR{} {}", carry, reg);
+    fmt::format_to(std::back_inserter(instr_text), "RR{} {}", carry, reg);
 }
 
 void Logging::ShiftLeftString(const std::string& reg) {
-    fmt::print(log_stream, "SLA {}", reg);
+    fmt::format_to(std::back_inserter(instr_text), "SLA {}", reg);
 }
 
 void Logging::ShiftRightString(const std::string& a_or_l, const std::string& reg) {
-    fmt::print(log_stream, "SR{} {}", a_or_l, reg);
+    fmt::format_to(std::back_inserter(instr_text), "SR{} {}", a_or_l, reg);
 }
 
 void Logging::SwapString(const std::string& reg) {
-    fmt::print(log_stream, "SWAP {}", reg);
+    fmt::format_to(std::back_inserter(instr_text), "SWAP {}", reg);
 }
 
 void Logging::TestBitString(const std::string& bit, const std::string& reg) {
-    fmt::print(log_stream, "BIT {}, {}", bit, reg);
+    fmt::format_to(std::back_inserter(instr_text), "BIT {}, {}", bit, reg);
 }
 
 void Logging::ResetBitString(const std::string& bit, const std::string& reg) {
-    fmt::print(log_stream, "RES {}, {}", bit, reg);
+    fmt::format_to(std::back_inserter(instr_text), "RES {}, {}", bit, reg);
 }
 
 void Logging::SetBitString(const std::string& bit, const std::string& reg) {
-    fmt::print(log_stream, "SET {}, {}", bit, reg);
+    fmt::format_to(std::back_inserter(instr_text), "SET {}, {}", bit, reg);
 }
 
 void Logging::UnknownOpcodeString(const u8 opcode) {
-    fmt::print(log_stream, "Unknown Opcode: 0x{0:0>2X}", opcode);
+    fmt::format_to(std::back_inserter(instr_text), "Unknown Opcode: 0x{0:0>2X}", opcode);
+}
+
+u8 Logging::ReadCode(const u16 addr) const {
+    if (report_rom_offset != no_rom_offset) {
+        const auto& rom = gameboy.mem->RomReference();
+        const std::size_t offset = report_rom_offset + static_cast<u16>(addr - report_pc);
+        return (offset < rom.size()) ? rom[offset] : 0xFF;
+    }
+
+    return gameboy.mem->ReadMem(addr);
 }
 
 void Logging::Disassemble(const u16 pc) {
-    fmt::print(log_stream, "0x{0:0>4X}: ", pc);
-    switch (gameboy.mem->ReadMem(pc)) {
+    fmt::print(log_stream, "0x{:0>4X}: {}\n", pc, InstructionText(pc));
+}
+
+const std::string& Logging::InstructionText(const u16 pc) {
+    // ROM text is cached by its offset in the ROM, which names the bank too. Code in RAM can change under us, and an
+    // instruction whose operands run past its bank would depend on what's mapped after it, so neither is cached.
+    const bool cacheable = (pc < 0x3FFE) || (pc >= 0x4000 && pc < 0x7FFE);
+    const u64 key = (report_rom_offset != no_rom_offset) ? report_rom_offset : gameboy.mem->RomOffset(pc);
+    if (cacheable) {
+        if (const std::string* text = text_cache.Find(key)) {
+            return *text;
+        }
+    }
+
+    instr_text.clear();
+    switch (ReadCode(pc)) {
     // ******** 8-bit loads ********
     // LD R, n -- Load immediate value n into register R
     case 0x06:
@@ -923,7 +949,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Set appropriately
     case 0x27:
-        fmt::print(log_stream, "DAA");
+        fmt::format_to(std::back_inserter(instr_text), "DAA");
         break;
     // CPL -- Complement the value in register A.
     // Flags:
@@ -932,7 +958,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Set
     //     C: Unchanged
     case 0x2F:
-        fmt::print(log_stream, "CPL");
+        fmt::format_to(std::back_inserter(instr_text), "CPL");
         break;
     // SCF -- Set the carry flag.
     // Flags:
@@ -941,7 +967,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Set
     case 0x37:
-        fmt::print(log_stream, "SCF");
+        fmt::format_to(std::back_inserter(instr_text), "SCF");
         break;
     // CCF -- Complement the carry flag.
     // Flags:
@@ -950,7 +976,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Complemented
     case 0x3F:
-        fmt::print(log_stream, "CCF");
+        fmt::format_to(std::back_inserter(instr_text), "CCF");
         break;
 
     // ******** Rotates and Shifts ********
@@ -961,7 +987,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Set to value in bit 7 before the rotate
     case 0x07:
-        fmt::print(log_stream, "RLCA");
+        fmt::format_to(std::back_inserter(instr_text), "RLCA");
         break;
     // RLA -- Left rotate A through the carry flag.
     // Flags:
@@ -970,7 +996,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Set to value in bit 7 before the rotate
     case 0x17:
-        fmt::print(log_stream, "RLA");
+        fmt::format_to(std::back_inserter(instr_text), "RLA");
         break;
     // RRCA -- Right rotate A.
     // Flags:
@@ -979,7 +1005,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Set to value in bit 0 before the rotate
     case 0x0F:
-        fmt::print(log_stream, "RRCA");
+        fmt::format_to(std::back_inserter(instr_text), "RRCA");
         break;
     // RRA -- Right rotate A through the carry flag.
     // Flags:
@@ -988,7 +1014,7 @@ void Logging::Disassemble(const u16 pc) {
     //     H: Reset
     //     C: Set to value in bit 0 before the rotate
     case 0x1F:
-        fmt::print(log_stream, "RRA");
+        fmt::format_to(std::back_inserter(instr_text), "RRA");
         break;
 
     // ******** Jumps ********
@@ -1126,29 +1152,29 @@ void Logging::Disassemble(const u16 pc) {
     // ******** System Control ********
     // NOP -- No operation.
     case 0x00:
-        fmt::print(log_stream, "NOP");
+        fmt::format_to(std::back_inserter(instr_text), "NOP");
         break;
     // HALT -- Put CPU into lower power mode until an interrupt occurs.
     case 0x76:
-        fmt::print(log_stream, "HALT");
+        fmt::format_to(std::back_inserter(instr_text), "HALT");
         break;
     // STOP -- Halt both the CPU and LCD until a button is pressed.
     case 0x10:
-        fmt::print(log_stream, "STOP {}", NextByteAsStr(pc));
+        fmt::format_to(std::back_inserter(instr_text), "STOP {}", NextByteAsStr(pc));
         break;
     // DI -- Disable interrupts.
     case 0xF3:
-        fmt::print(log_stream, "DI");
+        fmt::format_to(std::back_inserter(instr_text), "DI");
         break;
     // EI -- Enable interrupts after the next instruction is executed.
     case 0xFB:
-        fmt::print(log_stream, "EI");
+        fmt::format_to(std::back_inserter(instr_text), "EI");
         break;
 
     // ******** CB prefix opcodes ********
     case 0xCB:
         // Get opcode suffix from next byte.
-        switch (gameboy.mem->ReadMem(pc + 1)) {
+        switch (ReadCode(pc + 1)) {
         // ******** Rotates and Shifts ********
         // RLC R -- Left rotate the value in register R.
         // Flags:
@@ -1986,11 +2012,11 @@ void Logging::Disassemble(const u16 pc) {
         break;
 
     default:
-        UnknownOpcodeString(gameboy.mem->ReadMem(pc));
+        UnknownOpcodeString(ReadCode(pc));
         break;
     }
 
-    fmt::print(log_stream, "\n");
+    return cacheable ? text_cache.Insert(key, instr_text) : instr_text;
 }
 
 } // End namespace Gb
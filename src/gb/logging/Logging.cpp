@@ -15,6 +15,8 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
+#include <iostream>
+#include <iterator>
 #include <stdexcept>
 
 #include "gb/logging/Logging.h"
@@ -24,46 +26,90 @@
 
 namespace Gb {
 
-Logging::Logging(LogLevel level, const GameBoy& _gameboy)
+Logging::Logging(LogLevel level, LogOverflow log_overflow, const Common::TraceTrigger& _trigger,
+                 const GameBoy& _gameboy)
         : gameboy(_gameboy)
-        , alt_level(level) {
+        , alt_level(level)
+        , trigger(_trigger)
+        , pre_trigger(trigger.before) {
     // Leave log_stream unopened if logging disabled.
     if (level != LogLevel::None) {
-        log_stream = std::ofstream("log.txt");
+        log_stream.Open("log.txt", log_overflow);
+    }
 
-        if (!log_stream) {
-            throw std::runtime_error("Error when attempting to open ./log.txt for writing.");
-        }
+    if (level == LogLevel::BinaryTrace || level == LogLevel::BinaryRegisters) {
+        // PC and the opcode bytes, optionally followed by AF, BC, DE, HL, and SP.
+        const std::size_t record_words = (level == LogLevel::BinaryRegisters) ? 7 : 2;
+        binary_trace = std::make_unique<Common::BinaryTrace>("trace.bin", Common::BinaryTrace::System::Gb,
+                                                             record_words);
     }
 }
 
 void Logging::LogInstruction(const Registers& regs, const u16 pc) {
-    if (log_level == LogLevel::None) {
+    if (log_level == LogLevel::None && !CheckTrigger(regs, pc)) {
+        return;
+    } else if (log_level == LogLevel::BinaryTrace || log_level == LogLevel::BinaryRegisters) {
+        WriteBinaryRecord(regs, pc);
+        CaptureLogged();
         return;
     }
 
     Disassemble(pc);
 
     if (log_level == LogLevel::Registers) {
-        fmt::print(log_stream,  "A=0x{0:0>2X}", regs.reg8[1]);
-        fmt::print(log_stream, " B=0x{0:0>2X}", regs.reg8[3]);
-        fmt::print(log_stream, " C=0x{0:0>2X}", regs.reg8[2]);
-        fmt::print(log_stream, " D=0x{0:0>2X}", regs.reg8[5]);
-        fmt::print(log_stream, " E=0x{0:0>2X}", regs.reg8[4]);
-        fmt::print(log_stream, " H=0x{0:0>2X}", regs.reg8[7]);
-        fmt::print(log_stream, " L=0x{0:0>2X}", regs.reg8[6]);
-        fmt::print(log_stream, " SP=0x{0:0>4X}", regs.reg16[4]);
-        fmt::print(log_stream, " IF=0x{0:0>2X}", gameboy.mem->ReadMem(0xFF0F));
-        fmt::print(log_stream, " IE=0x{0:0>2X} ", gameboy.mem->ReadMem(0xFFFF));
-        fmt::print(log_stream, "{}", (regs.reg8[0] & 0x80) ? "Z" : "");
-        fmt::print(log_stream, "{}", (regs.reg8[0] & 0x40) ? "N" : "");
-        fmt::print(log_stream, "{}", (regs.reg8[0] & 0x20) ? "H" : "");
-        fmt::print(log_stream, "{}", (regs.reg8[0] & 0x10) ? "C" : "");
-        fmt::print(log_stream, "\n\n");
+        LogRegisters(regs);
+    }
+
+    CaptureLogged();
+}
+
+void Logging::LogRegisters(const Registers& regs) {
+    register_text.clear();
+    fmt::format_to(std::back_inserter(register_text),
+                   "A=0x{:0>2X} B=0x{:0>2X} C=0x{:0>2X} D=0x{:0>2X} E=0x{:0>2X} H=0x{:0>2X} L=0x{:0>2X} SP=0x{:0>4X}"
+                   " IF=0x{:0>2X} IE=0x{:0>2X} {}{}{}{}\n\n",
+                   regs.reg8[1], regs.reg8[3], regs.reg8[2], regs.reg8[5], regs.reg8[4], regs.reg8[7], regs.reg8[6],
+                   regs.reg16[4], gameboy.mem->ReadMem(0xFF0F), gameboy.mem->ReadMem(0xFFFF),
+                   (regs.reg8[0] & 0x80) ? "Z" : "", (regs.reg8[0] & 0x40) ? "N" : "",
+                   (regs.reg8[0] & 0x20) ? "H" : "", (regs.reg8[0] & 0x10) ? "C" : "");
+    log_stream.write(register_text.data(), register_text.size());
+}
+
+void Logging::PrintBreak(const std::string& reason) {
+    // Disassemble writes to the log stream, so point it at stdout for the duration.
+    log_stream.Flush();
+    std::streambuf* const log_buffer = log_stream.rdbuf(std::cout.rdbuf());
+
+    const u16 pc = gameboy.cpu->GetPc();
+    fmt::print(log_stream, "Break on {} at 0x{:0>4X}\n", reason, pc);
+    Disassemble(pc);
+    LogRegisters(gameboy.cpu->GetRegisters());
+
+    log_stream.flush();
+    log_stream.rdbuf(log_buffer);
+}
+
+void Logging::WriteBinaryRecord(const Registers& regs, const u16 pc) {
+    std::array<u32, Common::BinaryTrace::max_record_words> record;
+    record[0] = pc;
+    record[1] = gameboy.mem->ReadMem(pc) | (gameboy.mem->ReadMem(pc + 1) << 8) | (gameboy.mem->ReadMem(pc + 2) << 16);
+    if (log_level == LogLevel::BinaryRegisters) {
+        for (int i = 0; i < 5; ++i) {
+            record[2 + i] = regs.reg16[i];
+        }
     }
+
+    binary_trace->Write(record);
 }
 
 void Logging::LogInterrupt() {
+    if (trigger.condition == Common::TraceTrigger::Condition::Irq && Armed()) {
+        const u8 interrupt_mask = gameboy.mem->ReadMem(0xFF0F) & gameboy.mem->ReadMem(0xFFFF);
+        if (interrupt_mask & trigger.low) {
+            StartCapture(fmt::format("IRQ 0x{:0>2X}", interrupt_mask));
+        }
+    }
+
     if (log_level == LogLevel::None) {
         return;
     }
@@ -95,13 +141,125 @@ void Logging::LogHalt() {
     halt_cycles = 0;
 }
 
+void Logging::DumpProfile(const Common::PcProfiler& profiler) {
+    std::ofstream profile_stream("profile.txt");
+    if (!profile_stream) {
+        throw std::runtime_error("Error when attempting to open ./profile.txt for writing.");
+    }
+
+    // Disassemble writes to the log stream, so point it at the profile for the duration.
+    log_stream.Flush();
+    std::streambuf* const log_buffer = log_stream.rdbuf(profile_stream.rdbuf());
+
+    const double total = std::max<u64>(profiler.TotalSamples(), 1);
+    for (const auto& entry : profiler.SortedEntries()) {
+        fmt::print(log_stream, "{:>6.2f}% {:>10} ", entry.samples * 100 / total, entry.samples);
+
+        if (entry.key == Common::PcProfiler::halted_key) {
+            fmt::print(log_stream, "(halted)\n");
+        } else if (entry.key == Common::PcProfiler::dma_key) {
+            fmt::print(log_stream, "(hdma)\n");
+        } else {
+            Disassemble(static_cast<u16>(entry.key));
+        }
+    }
+
+    log_stream.rdbuf(log_buffer);
+}
+
+void Logging::WriteCoverageReport(const Common::CodeCoverage& coverage, const std::string& path) {
+    std::ofstream report(path);
+    if (!report) {
+        throw std::runtime_error("Error when attempting to open " + path + " for writing.");
+    }
+
+    const std::size_t rom_size = gameboy.mem->RomReference().size();
+    const std::size_t hram_start = rom_size + gameboy.mem->WramReference().size();
+    fmt::print(report, "ROM:  {} instructions run, of {} bytes\n", coverage.Count(0, rom_size), rom_size);
+    fmt::print(report, "WRAM: {} instructions run\n", coverage.Count(rom_size, hram_start));
+    fmt::print(report, "HRAM: {} instructions run\n\n", coverage.Count(hram_start, coverage.Slots()));
+
+    for (std::size_t offset = 0; offset < rom_size; ++offset) {
+        if (coverage.Marked(offset)) {
+            // Each bank is shown at the address it's mapped to.
+            report_rom_offset = offset;
+            report_pc = (offset < 0x4000) ? offset : 0x4000 | (offset & 0x3FFF);
+            fmt::print(report, "ROM{:0>3X}:{:0>4X}  {}\n", offset / 0x4000, report_pc, InstructionText(report_pc));
+        }
+    }
+    report_rom_offset = no_rom_offset;
+
+    for (std::size_t slot = rom_size; slot < coverage.Slots(); ++slot) {
+        if (!coverage.Marked(slot)) {
+            continue;
+        }
+
+        if (slot >= hram_start) {
+            const u16 addr = 0xFF80 + (slot - hram_start);
+            fmt::print(report, "HRAM:{:0>4X}  {}\n", addr, InstructionText(addr));
+            continue;
+        }
+
+        const std::size_t wram_offset = slot - rom_size;
+        const unsigned int bank = wram_offset / 0x1000;
+        const u16 addr = ((bank == 0) ? 0xC000 : 0xD000) | (wram_offset & 0x0FFF);
+        if (bank == 0 || bank == gameboy.mem->WramBank()) {
+            fmt::print(report, "WRAM{}:{:0>4X}  {}\n", bank, addr, InstructionText(addr));
+        } else {
+            fmt::print(report, "WRAM{}:{:0>4X}  (bank not mapped)\n", bank, addr);
+        }
+    }
+}
+
+bool Logging::CheckTrigger(const Registers& regs, const u16 pc) {
+    if (!Armed() || !trigger.WatchesInstructions()) {
+        return false;
+    }
+
+    if (trigger.condition == Common::TraceTrigger::Condition::PcRange && pc >= trigger.low && pc <= trigger.high) {
+        StartCapture(fmt::format("PC 0x{:0>4X}", pc));
+        return true;
+    }
+
+    pre_trigger.Push({{regs.reg16[0], regs.reg16[1], regs.reg16[2], regs.reg16[3], regs.reg16[4]}, pc});
+    return false;
+}
+
+void Logging::StartCapture(const std::string& reason) {
+    std::swap(log_level, alt_level);
+    fmt::print(log_stream, "Trace triggered by {}\n", reason);
+
+    // Replay the instructions leading up to the trigger before counting down the capture window. They are
+    // disassembled from the memory mapped now, which only matters if the game switched banks in the meantime.
+    capture_remaining = 0;
+    pre_trigger.Drain([this](const TraceRecord& record) {
+        Registers regs;
+        std::copy(record.regs.cbegin(), record.regs.cend(), regs.reg16);
+        LogInstruction(regs, record.pc);
+    });
+    capture_remaining = trigger.after;
+}
+
+void Logging::CaptureLogged() {
+    if (capture_remaining != 0 && --capture_remaining == 0) {
+        // Rearm for the next trigger.
+        std::swap(log_level, alt_level);
+        fmt::print(log_stream, "Trace window ended\n");
+    }
+}
+
 void Logging::SwitchLogLevel() {
     // Don't spam if logging not enabled.
     if (log_level == alt_level) {
         return;
     }
 
-    std::swap(log_level, alt_level);
+    if (log_level == LogLevel::None) {
+        StartCapture("hotkey");
+    } else {
+        std::swap(log_level, alt_level);
+        capture_remaining = 0;
+    }
 
     auto LogLevelString = [log_level = this->log_level]() {
         switch (log_level) {
@@ -111,6 +269,10 @@ void Logging::SwitchLogLevel() {
             return "Trace";
         case LogLevel::Registers:
             return "Registers";
+        case LogLevel::BinaryTrace:
+            return "Binary Trace";
+        case LogLevel::BinaryRegisters:
+            return "Binary Registers";
         default:
             return "";
         }
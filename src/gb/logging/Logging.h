@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <array>
+#include <memory>
 #include <string>
 #include <fstream>
 #include <utility>
@@ -23,6 +25,12 @@
 
 #include "common/CommonTypes.h"
 #include "common/CommonEnums.h"
+#include "common/DisasmCache.h"
+#include "common/AsyncLog.h"
+#include "common/BinaryTrace.h"
+#include "common/PcProfiler.h"
+#include "common/CodeCoverage.h"
+#include "common/TraceTrigger.h"
 
 namespace Gb {
 
@@ -31,8 +39,9 @@ union Registers;
 
 class Logging {
 public:
-    Logging(LogLevel level, const GameBoy& _gameboy);
+    Logging(LogLevel level, LogOverflow log_overflow, const Common::TraceTrigger& _trigger, const GameBoy& _gameboy);
 
+    bool LoggingEnabled() const { return log_level != LogLevel::None || (Armed() && trigger.WatchesInstructions()); }
     void LogInstruction(const Registers& regs, const u16 pc);
     void LogInterrupt();
 
@@ -52,9 +61,35 @@ public:
     void LogHalt();
 
     void Disassemble(const u16 pc);
+    // Cheats can patch the ROM, which would leave stale text in the disassembly cache.
+    void RomPatched() { text_cache.Clear(); }
 
     void SwitchLogLevel();
 
+    // Trace trigger checks, called from the memory write and frame paths.
+    void MemoryWritten(u16 addr) {
+        if (trigger.condition == Common::TraceTrigger::Condition::MemWrite && addr >= trigger.low
+                && addr <= trigger.high && Armed()) {
+            StartCapture(fmt::format("write to 0x{:0>4X}", addr));
+        }
+    }
+
+    void FrameStarted() {
+        if (trigger.condition == Common::TraceTrigger::Condition::Frame && frame_number++ == trigger.low
+                && Armed()) {
+            StartCapture(fmt::format("frame {}", trigger.low));
+        }
+    }
+
+    // Writes the profile to ./profile.txt, with each sampled instruction disassembled from the currently mapped
+    // memory, so samples from other ROM banks show the instruction in the bank mapped at exit.
+    void DumpProfile(const Common::PcProfiler& profiler);
+    // Writes a summary of the code coverage and every instruction which ran to the file. ROM instructions are
+    // disassembled from the ROM itself, whichever bank is mapped, and RAM instructions from what's there now.
+    void WriteCoverageReport(const Common::CodeCoverage& coverage, const std::string& path);
+    // Prints why the debugger broke, the instruction at the PC, and the registers to stdout.
+    void PrintBreak(const std::string& reason);
+
 private:
     const GameBoy& gameboy;
 
@@ -63,7 +98,43 @@ private:
 
     int halt_cycles = 0;
 
-    std::ofstream log_stream;
+    struct TraceRecord {
+        std::array<u16, 5> regs;
+        u16 pc;
+    };
+
+    const Common::TraceTrigger trigger;
+    Common::PreTriggerBuffer<TraceRecord> pre_trigger;
+    std::size_t capture_remaining = 0;
+    u32 frame_number = 0;
+
+    // Armed while a log level is configured but logging is currently off.
+    bool Armed() const { return log_level == LogLevel::None && alt_level != LogLevel::None; }
+    // Returns true if the instruction should be logged.
+    bool CheckTrigger(const Registers& regs, const u16 pc);
+    void StartCapture(const std::string& reason);
+    void LogRegisters(const Registers& regs);
+    void CaptureLogged();
+
+    Common::AsyncLogStream log_stream;
+    std::unique_ptr<Common::BinaryTrace> binary_trace;
+
+    void WriteBinaryRecord(const Registers& regs, const u16 pc);
+
+    // Text of ROM instructions, keyed by ROM offset.
+    Common::DisasmCache text_cache;
+    std::string instr_text;
+    std::string register_text;
+
+    // The returned text is only valid until the next call.
+    const std::string& InstructionText(const u16 pc);
+
+    // While writing a coverage report, instructions are read straight from the ROM, with the instruction at
+    // report_pc taken from this offset. Otherwise it's no_rom_offset, and they're read from mapped memory.
+    static constexpr std::size_t no_rom_offset = ~std::size_t{0};
+    std::size_t report_rom_offset = no_rom_offset;
+    u16 report_pc = 0;
+    u8 ReadCode(const u16 addr) const;
 
     std::string NextByteAsStr(const u16 pc) const;
     std::string NextSignedByteAsStr(const u16 pc) const;
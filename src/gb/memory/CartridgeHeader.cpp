@@ -23,7 +23,10 @@
 
 namespace Gb {
 
-CartridgeHeader::CartridgeHeader(Console& console, const std::vector<u8>& rom, bool multicart_requested) {
+CartridgeHeader::CartridgeHeader(Console& console, const Common::RomVector<u8>& rom, bool multicart_requested) {
+    // The header is read front to back before anything else touches the ROM.
+    Common::AdviseRom(rom, 0x150, Common::RomAdvice::Sequential);
+
     // Determine if this game enables CGB functions. A value of 0xC0 implies the game is CGB-only, and
     // 0x80 implies it can also run on pre-CGB devices. They both have the same effect, as it's up to
     // the game to test if it is running on a pre-CGB device.
@@ -66,9 +69,12 @@ CartridgeHeader::CartridgeHeader(Console& console, const std::vector<u8>& rom, b
     if (mbc_mode == MBC::MBC2 && ext_ram_present) {
         ram_size = 0x200;
     }
+
+    // Games jump between banks from here on.
+    Common::AdviseRom(rom, 0x150, Common::RomAdvice::Normal);
 }
 
-void CartridgeHeader::GetRamSize(const std::vector<u8>& rom) {
+void CartridgeHeader::GetRamSize(const Common::RomVector<u8>& rom) {
     // The RAM size identifier is at 0x0149 in cartridge header.
     switch (rom[0x0149]) {
     case 0x00:
@@ -102,7 +108,7 @@ void CartridgeHeader::GetRamSize(const std::vector<u8>& rom) {
     }
 }
 
-void CartridgeHeader::GetMbcType(const std::vector<u8>& rom) {
+void CartridgeHeader::GetMbcType(const Common::RomVector<u8>& rom) {
     // The MBC type is at 0x0147. The MBC identifier also tells us if this cartridge contains external RAM.
     switch (rom[0x0147]) {
     case 0x00:
@@ -227,7 +233,7 @@ void CartridgeHeader::GetMbcType(const std::vector<u8>& rom) {
     }
 }
 
-void CartridgeHeader::HeaderChecksum(const std::vector<u8>& rom) const {
+void CartridgeHeader::HeaderChecksum(const Common::RomVector<u8>& rom) const {
     u8 checksum = 0;
     for (std::size_t i = 0x0134; i < 0x014D; ++i) {
         checksum -= rom[i] + 1;
@@ -240,7 +246,7 @@ void CartridgeHeader::HeaderChecksum(const std::vector<u8>& rom) const {
     }
 }
 
-bool CartridgeHeader::CheckNintendoLogo(const Console console, const std::vector<u8>& rom) noexcept {
+bool CartridgeHeader::CheckNintendoLogo(const Console console, const Common::RomVector<u8>& rom) noexcept {
     // Calculate the FNV-1a hash of the first or second half of the region in the ROM header where the Nintendo logo
     // is supposed to be (0x0104-0x0133) and compare it to a precalculated hash of the expected logo.
     static constexpr u32 logo_first_half_hash = 0x14BDDD1B;
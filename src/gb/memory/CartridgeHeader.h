@@ -19,15 +19,16 @@
 #include <vector>
 
 #include "common/CommonTypes.h"
+#include "common/MappedRom.h"
 #include "gb/core/Enums.h"
 
 namespace Gb {
 
 class CartridgeHeader {
 public:
-    CartridgeHeader(Console& console, const std::vector<u8>& rom, bool multicart_requested);
+    CartridgeHeader(Console& console, const Common::RomVector<u8>& rom, bool multicart_requested);
 
-    static bool CheckNintendoLogo(const Console console, const std::vector<u8>& rom) noexcept;
+    static bool CheckNintendoLogo(const Console console, const Common::RomVector<u8>& rom) noexcept;
 
     GameMode game_mode;
     MBC mbc_mode;
@@ -38,9 +39,9 @@ public:
     bool rumble_present = false;
 
 private:
-    void GetRamSize(const std::vector<u8>& rom);
-    void GetMbcType(const std::vector<u8>& rom);
-    void HeaderChecksum(const std::vector<u8>& rom) const;
+    void GetRamSize(const Common::RomVector<u8>& rom);
+    void GetMbcType(const Common::RomVector<u8>& rom);
+    void HeaderChecksum(const Common::RomVector<u8>& rom) const;
 };
 
 } // End namespace Gb
@@ -25,11 +25,28 @@ namespace Gb {
 void Memory::UpdateOamDma() {
     if (oam_dma_state == DmaState::Starting) {
         if (bytes_read != 0) {
+            if (oam_dma_deferred) {
+                // The transfer was restarted, so the byte read last cycle is never written.
+                WriteDeferredOam(bytes_read - 1);
+                oam_transfer_byte = oam_dma_buffer[bytes_read - 1];
+                oam_dma_deferred = false;
+            }
+
             oam_transfer_addr = static_cast<u16>(oam_dma_start) << 8;
             bytes_read = 0;
         } else {
-            // No write on the startup cycle.
-            oam_transfer_byte = DmaCopy(oam_transfer_addr);
+            // The VRAM bus can still be written by HDMA, and what HDMA/GDMA reads from 0xE000-0xFFFF depends on
+            // whether it is active, so those sources are read one byte per cycle.
+            oam_dma_deferred = oam_transfer_addr < 0x8000
+                               || (oam_transfer_addr >= 0xA000 && oam_transfer_addr < 0xE000);
+            if (oam_dma_deferred) {
+                for (unsigned int i = 0; i < oam_dma_buffer.size(); ++i) {
+                    oam_dma_buffer[i] = DmaCopy(oam_transfer_addr + i);
+                }
+            } else {
+                // No write on the startup cycle.
+                oam_transfer_byte = DmaCopy(oam_transfer_addr);
+            }
             ++bytes_read;
 
             oam_dma_state = DmaState::Active;
@@ -48,24 +65,41 @@ void Memory::UpdateOamDma() {
             } else {
                 dma_bus_block = Bus::External;
             }
+            UpdatePageTables();
         }
     } else if (oam_dma_state == DmaState::Active) {
-        // Write the byte which was read last cycle to OAM.
-        gameboy.lcd->oam[bytes_read - 1] = oam_transfer_byte;
+        if (oam_dma_deferred) {
+            // OAM is only written when the LCD searches it, or once the transfer is done.
+            if (bytes_read == 160) {
+                WriteDeferredOam(160);
+                oam_transfer_byte = oam_dma_buffer[159];
+                oam_dma_deferred = false;
+            }
+        } else {
+            // Write the byte which was read last cycle to OAM.
+            gameboy.lcd->oam[bytes_read - 1] = oam_transfer_byte;
+        }
 
         if (bytes_read == 160) {
             // Don't read on the last cycle.
             oam_dma_state = DmaState::Inactive;
             dma_bus_block = Bus::None;
+            UpdatePageTables();
             return;
         }
 
         // Read the next byte.
-        oam_transfer_byte = DmaCopy(oam_transfer_addr + bytes_read);
+        if (!oam_dma_deferred) {
+            oam_transfer_byte = DmaCopy(oam_transfer_addr + bytes_read);
+        }
         ++bytes_read;
     }
 }
 
+void Memory::WriteDeferredOam(unsigned int num_bytes) {
+    std::copy_n(oam_dma_buffer.cbegin(), num_bytes, gameboy.lcd->oam.begin());
+}
+
 void Memory::UpdateHdma() {
     if (hdma_reg_written) {
         if (hdma_state == DmaState::Inactive) {
@@ -120,9 +154,6 @@ void Memory::InitHdma() {
 }
 
 void Memory::ExecuteHdma() {
-    u16 hdma_source = (static_cast<u16>(hdma_source_hi) << 8) | hdma_source_lo;
-    u16 hdma_dest = (static_cast<u16>(hdma_dest_hi | 0x80) << 8) | hdma_dest_lo;
-
     // The HDMA circuit always functions at a fixed speed. Every m-cycle it transfers two bytes in single speed
     // mode and one byte in double speed mode. However, if there is only one byte left to transfer (or one hblank byte
     // left for HDMA) then only one byte will be transferred in single speed mode.
@@ -131,13 +162,32 @@ void Memory::ExecuteHdma() {
     if (hdma_type == HdmaType::Hdma) {
         num_bytes = std::min(num_bytes, hblank_bytes);
         hblank_bytes -= num_bytes;
+    } else if (gdma_copied_bytes == 0 && !gameboy.lcd->Mode3Within((bytes_to_copy << double_speed) * 2)) {
+        // The CPU is stalled for the whole GDMA, so nothing else can touch the source or destination. If the LCD
+        // won't block VRAM before the copy ends, the whole copy is done now, and the remaining cycles only stall.
+        gdma_copied_bytes = bytes_to_copy;
+        CopyHdmaBytes(bytes_to_copy);
     }
 
     bytes_to_copy -= num_bytes;
 
+    if (gdma_copied_bytes != 0) {
+        gdma_copied_bytes -= num_bytes;
+    } else {
+        CopyHdmaBytes(num_bytes);
+    }
+
+    hdma_control = ((bytes_to_copy / 16) - 1) & 0x7F;
+}
+
+void Memory::CopyHdmaBytes(int num_bytes) {
+    u16 hdma_source = (static_cast<u16>(hdma_source_hi) << 8) | hdma_source_lo;
+    u16 hdma_dest = (static_cast<u16>(hdma_dest_hi | 0x80) << 8) | hdma_dest_lo;
+
     for (int i = 0; i < num_bytes; ++i) {
         if ((gameboy.lcd->stat & 0x03) != 3) {
             vram[hdma_dest - 0x8000 + 0x2000 * vram_bank_num] = DmaCopy(hdma_source);
+            gameboy.lcd->VramWritten(hdma_dest, vram_bank_num);
         }
 
         // Mask hdma_dest so it wraps around to the beginning of VRAM in case it increments past 0x9FFF.
@@ -149,8 +199,6 @@ void Memory::ExecuteHdma() {
     hdma_source_hi = hdma_source >> 8;
     hdma_dest_lo = hdma_dest & 0x00FF;
     hdma_dest_hi = (hdma_dest >> 8) & 0x1F;
-
-    hdma_control = ((bytes_to_copy / 16) - 1) & 0x7F;
 }
 
 void Memory::SignalHdma() {
@@ -163,16 +211,10 @@ void Memory::SignalHdma() {
 u8 Memory::DmaCopy(const u16 addr) const {
     if (addr < 0x4000) {
         // ROM0 bank
-        if (mbc_mode == MBC::MBC1) {
-            return rom[addr + 0x4000 * ((ram_bank_num << 5) & (num_rom_banks - 1))];
-        } else if (mbc_mode == MBC::MBC1M) {
-            return rom[addr + 0x4000 * ((ram_bank_num << 4) & (num_rom_banks - 1))];
-        } else {
-            return rom[addr];
-        }
+        return rom[addr + rom0_offset];
     } else if (addr < 0x8000) {
         // ROM1 bank
-        return rom[addr + 0x4000 * ((rom_bank_num & (num_rom_banks - 1)) - 1)];
+        return rom[addr + rom1_offset];
     } else if (addr < 0xA000) {
         // VRAM -- switchable in CGB mode
         // Not accessible during screen mode 3. HDMA/GDMA cannot read VRAM.
@@ -22,7 +22,6 @@
 #include "gb/memory/Memory.h"
 #include "gb/memory/CartridgeHeader.h"
 #include "gb/memory/Rtc.h"
-#include "emu/ParseOptions.h"
 
 namespace Gb {
 
@@ -34,11 +33,12 @@ void Memory::ReadSaveFile(unsigned int cart_ram_size) {
     std::ifstream save_file(save_path);
     if (!save_file) {
         // Save file doesn't exist.
+        ReserveRtcData(cart_ram_size);
         ext_ram.resize(cart_ram_size);
         return;
     }
 
-    Emu::CheckPathIsRegularFile(save_path);
+    Common::CheckPathIsRegularFile(save_path);
 
     const auto save_size = std::filesystem::file_size(save_path);
 
@@ -47,59 +47,145 @@ void Memory::ReadSaveFile(unsigned int cart_ram_size) {
                                  save_size));
     }
 
-    ext_ram.resize(save_size);
-    save_file.read(reinterpret_cast<char*>(ext_ram.data()), save_size);
-
+    std::size_t expected_size = cart_ram_size;
     if (rtc_present) {
         // Account for size of RTC save data, if present at the end of the save file.
-        if (ext_ram.size() % 0x400 == 0x30) {
-            cart_ram_size += 0x30;
+        if (save_size % 0x400 == Rtc::save_data_size) {
+            expected_size += Rtc::save_data_size;
         }
     }
 
-    if (cart_ram_size != ext_ram.size()) {
+    if (expected_size != save_size) {
         throw std::runtime_error("Save game size does not match external RAM size given in cartridge header.");
     }
+
+    ReserveRtcData(cart_ram_size);
+    ext_ram.resize(save_size);
+    if (save_map == nullptr) {
+        save_file.read(reinterpret_cast<char*>(ext_ram.data()), save_size);
+    }
+}
+
+void Memory::ReserveRtcData(std::size_t ram_size) {
+    // Appending the RTC data must not reallocate a mapped save, since that would grow the file past the size of
+    // the save.
+    if (rtc_present) {
+        ext_ram.reserve(ram_size + Rtc::save_data_size);
+    }
 }
 
 void Memory::WriteSaveFile() {
-    if (ext_ram_present) {
-        std::ofstream save_ostream(save_path);
+    // Benchmarks run without a save path, so every run starts from the same state.
+    if (ext_ram_present && !save_path.empty()) {
+        if (rtc_present) {
+            rtc->AppendRtcData(ext_ram);
+        }
 
-        if (!save_ostream) {
-            fmt::print("Error: could not open {} to write save file to disk.\n", save_path);
+        if (save_map != nullptr) {
+            save_map->Sync(true);
+            save_map->Truncate(ext_ram.size());
         } else {
-            if (rtc_present) {
-                rtc->AppendRtcData(ext_ram);
-            }
+            Common::WriteFileAtomic(save_path, ext_ram.data(), ext_ram.size());
+        }
+    }
+}
+
+void Memory::FlushSaveData() {
+    if (save_map != nullptr) {
+        save_map->FrameDone(save_dirty);
+        return;
+    }
+
+    if (save_flusher == nullptr || !save_dirty.Any() || !save_flusher->FlushDue()) {
+        return;
+    }
+
+    Common::SaveVector<u8> rtc_data;
+    if (rtc_present) {
+        rtc->AppendRtcData(rtc_data);
+    }
 
-            save_ostream.write(reinterpret_cast<const char*>(ext_ram.data()), ext_ram.size());
-            save_ostream.flush();
+    save_flusher->Update(ext_ram.data(), ext_ram.size(), save_dirty, rtc_data.data(), rtc_data.size());
+}
+
+template<MBC M>
+constexpr Memory::MbcHandlers Memory::MakeMbcHandlers() {
+    return {&Memory::ReadExternalRam<M>, &Memory::WriteExternalRam<M>, &Memory::WriteMbcControlRegisters<M>,
+            &Memory::Rom0Bank<M>, &Memory::MappedExternalRam<M>};
+}
+
+Memory::MbcHandlers Memory::SelectMbcHandlers(MBC mbc) {
+    switch (mbc) {
+    case MBC::MBC1:
+        return MakeMbcHandlers<MBC::MBC1>();
+    case MBC::MBC1M:
+        return MakeMbcHandlers<MBC::MBC1M>();
+    case MBC::MBC2:
+        return MakeMbcHandlers<MBC::MBC2>();
+    case MBC::MBC3:
+        return MakeMbcHandlers<MBC::MBC3>();
+    case MBC::MBC5:
+        return MakeMbcHandlers<MBC::MBC5>();
+    default:
+        return MakeMbcHandlers<MBC::None>();
+    }
+}
+
+template<MBC M>
+int Memory::Rom0Bank() const {
+    // In MBC1 and MBC1M, the upper bank bits also switch ROM0 when the RAM bank mode is set.
+    if constexpr (M == MBC::MBC1) {
+        return (ram_bank_num << 5) & (num_rom_banks - 1);
+    } else if constexpr (M == MBC::MBC1M) {
+        return (ram_bank_num << 4) & (num_rom_banks - 1);
+    } else {
+        return 0;
+    }
+}
+
+template<MBC M>
+int Memory::ExternalRamOffset(const u16 addr) const {
+    if constexpr (M == MBC::MBC5) {
+        if (rumble_present) {
+            // Carts with rumble cannot use bit 4 of the RAM bank register for bank selection.
+            return addr - 0xA000 + 0x2000 * ((ram_bank_num & 0x07) & (num_ram_banks - 1));
         }
     }
+
+    return addr - 0xA000 + 0x2000 * (ram_bank_num & (num_ram_banks - 1));
 }
 
+template<MBC M>
+const u8* Memory::MappedExternalRam() const {
+    // MBC2 RAM only holds nibbles, and on MBC3 bit 4 of the RAM bank number selects the RTC registers instead.
+    if constexpr (M == MBC::None || M == MBC::MBC2) {
+        return nullptr;
+    } else {
+        if (!ext_ram_enabled || (M == MBC::MBC3 && (ram_bank_num & 0x08))) {
+            return nullptr;
+        }
+
+        // The whole bank has to be backed by the RAM, so small and out of bounds banks go through the region checks.
+        const std::size_t bank_offset = ExternalRamOffset<M>(0xA000);
+        if (bank_offset + 0x2000 > ext_ram.size()) {
+            return nullptr;
+        }
+
+        return ext_ram.data() + bank_offset;
+    }
+}
+
+template<MBC M>
 u8 Memory::ReadExternalRam(const u16 addr) const {
-    if (ext_ram_enabled) {
-        u16 adjusted_addr = addr - 0xA000 + 0x2000 * (ram_bank_num & (num_ram_banks - 1));
-
-        switch (mbc_mode) {
-        case MBC::MBC1:
-        case MBC::MBC1M:
-            // Out of bounds reads return 0xFF.
-            if (adjusted_addr < ext_ram.size()) {
-                return ext_ram[adjusted_addr];
-            } else {
-                return 0xFF;
-            }
-        case MBC::MBC2:
-            // MBC2 RAM range is only A000-A1FF.
-            if (adjusted_addr < ext_ram.size()) {
-                return ext_ram[adjusted_addr] & 0xF0;
-            } else {
-                return 0xFF;
-            }
-        case MBC::MBC3:
+    // Reads from this region when the RAM banks are disabled or not present return 0xFF.
+    if constexpr (M == MBC::None) {
+        return 0xFF;
+    } else {
+        if (!ext_ram_enabled) {
+            return 0xFF;
+        }
+
+        if constexpr (M == MBC::MBC3) {
             // Bit 4 of the RAM bank number is set for RTC registers, and unset for RAM banks.
             if (ram_bank_num & 0x08) {
                 if (!rtc_present) {
@@ -121,56 +207,33 @@ u8 Memory::ReadExternalRam(const u16 addr) const {
                     // I'm assuming an invalid register value (0x0D-0x0F) returns 0xFF, needs confirmation though.
                     return 0xFF;
                 }
-            } else {
-                // Out of bounds reads return 0xFF.
-                if (adjusted_addr < ext_ram.size()) {
-                    return ext_ram[adjusted_addr];
-                } else {
-                    return 0xFF;
-                }
-            }
-        case MBC::MBC5:
-            if (rumble_present) {
-                // Carts with rumble cannot use bit 4 of the RAM bank register for bank selection.
-                adjusted_addr = addr - 0xA000 + 0x2000 * ((ram_bank_num & 0x07) & (num_ram_banks - 1));
-            }
-
-            // Out of bounds reads return 0xFF.
-            if (adjusted_addr < ext_ram.size()) {
-                return ext_ram[adjusted_addr];
-            } else {
-                return 0xFF;
             }
+        }
 
-        default:
+        // Out of bounds reads return 0xFF.
+        const std::size_t adjusted_addr = ExternalRamOffset<M>(addr);
+        if (adjusted_addr >= ext_ram.size()) {
             return 0xFF;
         }
-    } else {
-        // Reads from this region when the RAM banks are disabled or not present return 0xFF.
-        return 0xFF;
+
+        if constexpr (M == MBC::MBC2) {
+            // MBC2 RAM range is only A000-A1FF.
+            return ext_ram[adjusted_addr] & 0xF0;
+        } else {
+            return ext_ram[adjusted_addr];
+        }
     }
 }
 
+template<MBC M>
 void Memory::WriteExternalRam(const u16 addr, const u8 data) {
     // Writes are ignored if external RAM is disabled or not present.
-    if (ext_ram_enabled) {
-        u16 adjusted_addr = addr - 0xA000 + 0x2000 * (ram_bank_num & (num_ram_banks - 1));
-
-        switch (mbc_mode) {
-        case MBC::MBC1:
-        case MBC::MBC1M:
-            // Ignore out-of-bounds writes.
-            if (adjusted_addr < ext_ram.size()) {
-                ext_ram[adjusted_addr] = data;
-            }
-            break;
-        case MBC::MBC2:
-            // MBC2 RAM range is only A000-A1FF. Only the lower nibble of the bytes in this region are used.
-            if (adjusted_addr < ext_ram.size()) {
-                ext_ram[adjusted_addr] = data & 0x0F;
-            }
-            break;
-        case MBC::MBC3:
+    if constexpr (M != MBC::None) {
+        if (!ext_ram_enabled) {
+            return;
+        }
+
+        if constexpr (M == MBC::MBC3) {
             // Bit 4 of the RAM bank number is set for RTC registers, and unset for RAM banks.
             if (ram_bank_num & 0x08) {
                 if (rtc_present) {
@@ -196,35 +259,29 @@ void Memory::WriteExternalRam(const u16 addr, const u8 data) {
                         break;
                     }
                 }
-            } else {
-                // Ignore out-of-bounds writes.
-                if (adjusted_addr < ext_ram.size()) {
-                    ext_ram[adjusted_addr] = data;
-                }
-            }
-            break;
-        case MBC::MBC5:
-            if (rumble_present) {
-                // Carts with rumble cannot use bit 4 of the RAM bank register for bank selection.
-                adjusted_addr = addr - 0xA000 + 0x2000 * ((ram_bank_num & 0x07) & (num_ram_banks - 1));
+                return;
             }
+        }
 
-            // Ignore out-of-bounds writes.
-            if (adjusted_addr < ext_ram.size()) {
-                ext_ram[adjusted_addr] = data;
-            }
-            break;
+        // Ignore out-of-bounds writes.
+        const std::size_t adjusted_addr = ExternalRamOffset<M>(addr);
+        if (adjusted_addr >= ext_ram.size()) {
+            return;
+        }
 
-        default:
-            break;
+        if constexpr (M == MBC::MBC2) {
+            // MBC2 RAM range is only A000-A1FF. Only the lower nibble of the bytes in this region are used.
+            ext_ram[adjusted_addr] = data & 0x0F;
+        } else {
+            ext_ram[adjusted_addr] = data;
         }
+        save_dirty.Mark(adjusted_addr);
     }
 }
 
+template<MBC M>
 void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
-    switch (mbc_mode) {
-    case MBC::MBC1:
-    case MBC::MBC1M:
+    if constexpr (M == MBC::MBC1 || M == MBC::MBC1M) {
         if (addr < 0x2000) {
             // RAM enable register -- RAM read/write is enabled if a byte with lower nibble 0xA is written.
             if (ext_ram_present && (data & 0x0F) == 0x0A) {
@@ -237,7 +294,7 @@ void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
 
             // In MBC1, the lower 5 bits of the written value give the lower 5 bits of the ROM1 bank number.
             // In MBC1M, the 4th bit is ignored.
-            if (mbc_mode == MBC::MBC1) {
+            if constexpr (M == MBC::MBC1) {
                 rom_bank_num = (rom_bank_num & 0x60) | (data & 0x1F);
             } else {
                 rom_bank_num = (rom_bank_num & 0x30) | (data & 0x0F);
@@ -258,9 +315,9 @@ void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
                 ram_bank_num = upper_bits;
             }
 
-            if (mbc_mode == MBC::MBC1) {
+            if constexpr (M == MBC::MBC1) {
                 rom_bank_num = (rom_bank_num & 0x1F) | upper_bits << 5;
-            } else if (mbc_mode == MBC::MBC1M) {
+            } else {
                 rom_bank_num = (rom_bank_num & 0x0F) | upper_bits << 4;
             }
         } else if (addr < 0x8000) {
@@ -277,8 +334,7 @@ void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
                 ram_bank_num = 0x00;
             }
         }
-        break;
-    case MBC::MBC2:
+    } else if constexpr (M == MBC::MBC2) {
         if (addr < 0x2000) {
             // RAM enable register -- RAM banking is enabled if a byte with lower nibble 0xA is written
             // The least significant bit of the upper address byte must be zero to enable or disable external ram.
@@ -300,8 +356,7 @@ void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
             }
         }
         // MBC2 does not have RAM banking.
-        break;
-    case MBC::MBC3:
+    } else if constexpr (M == MBC::MBC3) {
         if (addr < 0x2000) {
             // RAM banking and RTC registers enable register -- enabled if a byte with lower nibble 0xA is written.
             if (ext_ram_present && (data & 0x0F) == 0x0A) {
@@ -333,8 +388,7 @@ void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
                 rtc->latch_last_value_written = data;
             }
         }
-        break;
-    case MBC::MBC5:
+    } else if constexpr (M == MBC::MBC5) {
         if (addr < 0x2000) {
             // RAM banking enable register -- enabled if a byte with lower nibble 0xA is written.
             if (ext_ram_present && (data & 0x0F) == 0x0A) {
@@ -362,12 +416,10 @@ void Memory::WriteMbcControlRegisters(const u16 addr, const u8 data) {
             // they cannot have more than 8 RAM banks.
             ram_bank_num = data & 0x0F;
         }
-        break;
-
-    default:
-        // Carts with no MBC ignore writes here.
-        break;
     }
+    // Carts with no MBC ignore writes here.
+
+    UpdatePageTables();
 }
 
 } // End namespace Gb
@@ -23,13 +23,15 @@
 #include "gb/hardware/Timer.h"
 #include "gb/hardware/Serial.h"
 #include "gb/hardware/Joypad.h"
+#include "gb/logging/Logging.h"
+#include "common/SaveState.h"
 
 namespace Gb {
 
-Memory::Memory(const CartridgeHeader& header, const std::vector<u8>& _rom, const std::string& _save_path,
-               GameBoy& _gameboy)
+Memory::Memory(const CartridgeHeader& header, const Common::RomVector<u8>& _rom, const std::string& _save_path,
+               const Common::SaveSettings& save_settings, GameBoy& _gameboy)
         : gameboy(_gameboy)
-        , mbc_mode(header.mbc_mode)
+        , mbc(SelectMbcHandlers(header.mbc_mode))
         , ext_ram_present(header.ext_ram_present)
         , rtc_present(header.rtc_present)
         , rumble_present(header.rumble_present)
@@ -39,17 +41,35 @@ Memory::Memory(const CartridgeHeader& header, const std::vector<u8>& _rom, const
         , vram((gameboy.GameModeDmg()) ? 0x2000 : 0x4000)
         , wram((gameboy.GameModeDmg()) ? 0x2000 : 0x8000)
         , hram(0x7F)
+        , save_map((save_settings.mapped && header.ext_ram_present && !_save_path.empty())
+                   ? std::make_shared<Common::MappedSaveFile>(_save_path, save_settings) : nullptr)
+        , ext_ram(Common::SaveAllocator<u8>(save_map))
         , save_path(_save_path) {
 
     IORegisterInit();
+    PopulateIOTables();
     VramInit();
     ReadSaveFile(header.ram_size);
     if (rtc_present) {
-        rtc = std::make_unique<Rtc>(ext_ram);
+        rtc = std::make_unique<Rtc>(ext_ram, gameboy.rtc_source);
+
+        if (save_map != nullptr) {
+            // Write the RTC data into the mapped file straight away, so it's never missing or stale after a crash.
+            rtc->AppendRtcData(ext_ram);
+            ext_ram.resize(ext_ram.size() - Rtc::save_data_size);
+        }
+    }
+
+    UpdatePageTables();
+
+    if (save_settings.flush_interval != 0 && save_map == nullptr && ext_ram_present && !save_path.empty()) {
+        save_flusher = std::make_unique<Common::SaveFlusher>(save_path, save_settings.flush_interval);
     }
 }
 
 Memory::~Memory() {
+    // Finish any background write first, so it can't land on top of the final one.
+    save_flusher.reset();
     WriteSaveFile();
 }
 
@@ -57,7 +77,7 @@ void Memory::IORegisterInit() {
     if (gameboy.GameModeDmg()) {
         if (gameboy.ConsoleDmg()) {
             gameboy.joypad->p1 = 0xCF; // DMG starts with joypad inputs enabled.
-            gameboy.timer->divider = 0xABCC;
+            gameboy.timer.divider = 0xABCC;
 
             oam_dma_start = 0xFF;
 
@@ -68,7 +88,7 @@ void Memory::IORegisterInit() {
             gameboy.lcd->obj_palette_dmg1 = 0xFF;
         } else {
             gameboy.joypad->p1 = 0xFF; // CGB starts with joypad inputs disabled, even in DMG mode.
-            gameboy.timer->divider = 0x267C;
+            gameboy.timer.divider = 0x267C;
 
             oam_dma_start = 0x00;
 
@@ -80,7 +100,7 @@ void Memory::IORegisterInit() {
         }
     } else {
         gameboy.joypad->p1 = 0xFF; // Probably?
-        gameboy.timer->divider = 0x1EA0;
+        gameboy.timer.divider = 0x1EA0;
 
         oam_dma_start = 0x00;
 
@@ -91,8 +111,10 @@ void Memory::IORegisterInit() {
         gameboy.lcd->obj_palette_dmg1 = 0x00;
     }
 
+    gameboy.lcd->UpdateDmgColours();
+
     // I'm assuming the initial value of the internal serial clock is equal to the lower byte of DIV.
-    gameboy.serial->InitSerialClock(static_cast<u8>(gameboy.timer->divider));
+    gameboy.serial.InitSerialClock(static_cast<u8>(gameboy.timer.divider));
 }
 
 void Memory::VramInit() {
@@ -145,26 +167,102 @@ void Memory::VramInit() {
     }
 }
 
+void Memory::UpdatePageTables() {
+    read_pages.fill(nullptr);
+    write_pages.fill(nullptr);
+
+    rom0_offset = 0x4000 * (this->*mbc.rom0_bank)();
+    rom1_offset = 0x4000 * ((rom_bank_num & (num_rom_banks - 1)) - 1);
+
+    // While OAM DMA is reading from the external bus, the whole bus is blocked.
+    if (dma_bus_block == Bus::External) {
+        return;
+    }
+
+    // The vectors are never resized, so pointers into them stay valid. ROM pages past the end of the file are left
+    // to the region checks.
+    for (u16 addr = 0x0000; addr < 0x8000; addr += 0x1000) {
+        const std::size_t rom_addr = addr + ((addr < 0x4000) ? rom0_offset : rom1_offset);
+        if (rom_addr + 0x1000 <= rom.size()) {
+            read_pages[addr >> page_shift] = rom.data() + rom_addr;
+            if (!patched_rom_pages.empty()) {
+                const auto patched = patched_rom_pages.find(rom_addr);
+                if (patched != patched_rom_pages.end()) {
+                    read_pages[addr >> page_shift] = patched->second.data();
+                }
+            }
+        }
+    }
+
+    if (const u8* ext_ram_bank = (this->*mbc.mapped_ram)()) {
+        read_pages[0xA] = ext_ram_bank;
+        read_pages[0xB] = ext_ram_bank + 0x1000;
+    }
+
+    // 0xE000-0xEFFF echoes WRAM bank 0. The echo of bank 1 shares its page with OAM.
+    // Pages holding a hooked address are left out of the table for that kind of access.
+    const std::size_t wram1_offset = 0x1000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1);
+    u8* wram0 = wram.data();
+    u8* wram1 = wram.data() + wram1_offset;
+    const auto& hooks = gameboy.hooks;
+    const bool wram0_read_hooked = wram_read_hooked && hooks.ReadsHooked(Common::Hooks::Wram, 0, 0x1000);
+    const bool wram1_read_hooked = wram_read_hooked && hooks.ReadsHooked(Common::Hooks::Wram, wram1_offset, 0x1000);
+    const bool wram0_hooked = wram_hooked && hooks.WritesHooked(Common::Hooks::Wram, 0, 0x1000);
+    const bool wram1_hooked = wram_hooked && hooks.WritesHooked(Common::Hooks::Wram, wram1_offset, 0x1000);
+    read_pages[0xC] = read_pages[0xE] = wram0_read_hooked ? nullptr : wram0;
+    read_pages[0xD] = wram1_read_hooked ? nullptr : wram1;
+    write_pages[0xC] = write_pages[0xE] = wram0_hooked ? nullptr : wram0;
+    write_pages[0xD] = wram1_hooked ? nullptr : wram1;
+}
+
+void Memory::HooksChanged() {
+    wram_read_hooked = gameboy.hooks.ReadsHooked(Common::Hooks::Wram);
+    hram_read_hooked = gameboy.hooks.ReadsHooked(Common::Hooks::FastRam);
+    wram_hooked = gameboy.hooks.WritesHooked(Common::Hooks::Wram);
+    hram_hooked = gameboy.hooks.WritesHooked(Common::Hooks::FastRam);
+    UpdatePageTables();
+}
+
+void Memory::PatchRom(const std::vector<Common::Cheat>& patches) {
+    patched_rom_pages.clear();
+    for (const auto& patch : patches) {
+        // Patches of 0x0000-0x3FFF only apply to bank 0, and patches of 0x4000-0x7FFF to every other bank.
+        const std::size_t end_addr = (patch.addr < 0x4000) ? patch.addr + 1 : rom.size();
+        for (std::size_t rom_addr = patch.addr; rom_addr < end_addr && rom_addr < rom.size(); rom_addr += 0x4000) {
+            if (patch.compare && rom[rom_addr] != *patch.compare) {
+                continue;
+            }
+
+            const std::size_t page_addr = rom_addr & ~static_cast<std::size_t>(page_mask);
+            auto& page = patched_rom_pages[page_addr];
+            if (page.empty()) {
+                page.assign(rom.begin() + page_addr, rom.begin() + page_addr + 0x1000);
+            }
+            page[rom_addr & page_mask] = static_cast<u8>(patch.value);
+        }
+    }
+
+    UpdatePageTables();
+}
+
 u8 Memory::ReadMem(const u16 addr) const {
+    if (const u8* page = read_pages[addr >> page_shift]) {
+        return page[addr & page_mask];
+    }
+
     if (addr < 0x8000) {
         // ROM
         if (dma_bus_block != Bus::External) {
             if (addr < 0x4000) {
                 // ROM0 bank
-                if (mbc_mode == MBC::MBC1) {
-                    return rom[addr + 0x4000 * ((ram_bank_num << 5) & (num_rom_banks - 1))];
-                } else if (mbc_mode == MBC::MBC1M) {
-                    return rom[addr + 0x4000 * ((ram_bank_num << 4) & (num_rom_banks - 1))];
-                } else {
-                    return rom[addr];
-                }
+                return rom[addr + rom0_offset];
             } else {
                 // ROM1 bank
-                return rom[addr + 0x4000 * ((rom_bank_num & (num_rom_banks - 1)) - 1)];
+                return rom[addr + rom1_offset];
             }
         } else {
             // If OAM DMA is currently transferring from the external bus, return the last byte read by the DMA.
-            return oam_transfer_byte;
+            return OamTransferByte();
         }
     } else if (addr < 0xA000) {
         // VRAM -- switchable in CGB mode
@@ -177,29 +275,37 @@ u8 Memory::ReadMem(const u16 addr) const {
             }
         } else {
             // If OAM DMA is currently transferring from VRAM, return the last byte read by the DMA.
-            return oam_transfer_byte;
+            return OamTransferByte();
         }
     } else if (addr < 0xFE00) {
         if (dma_bus_block != Bus::External) {
             if (addr < 0xC000) {
                 // External RAM bank.
                 return ReadExternalRam(addr);
-            } else if (addr < 0xD000) {
+            }
+
+            std::size_t wram_addr;
+            if (addr < 0xD000) {
                 // WRAM bank 0
-                return wram[addr - 0xC000];
+                wram_addr = addr - 0xC000;
             } else if (addr < 0xE000) {
                 // WRAM bank 1 (switchable from 1-7 in CGB mode)
-                return wram[addr - 0xC000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1)];
+                wram_addr = addr - 0xC000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1);
             } else if (addr < 0xF000) {
                 // Echo of C000-DDFF
-                return wram[addr - 0xE000];
+                wram_addr = addr - 0xE000;
             } else {
                 // Echo of C000-DDFF
-                return wram[addr - 0xE000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1)];
+                wram_addr = addr - 0xE000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1);
+            }
+
+            if (wram_read_hooked) {
+                gameboy.hooks.Read(Common::Hooks::Wram, wram_addr, 1);
             }
+            return wram[wram_addr];
         } else {
             // If OAM DMA is currently transferring from the external bus, return the last byte read by the DMA.
-            return oam_transfer_byte;
+            return OamTransferByte();
         }
     } else if (addr < 0xFF00) {
         if (addr < 0xFEA0) {
@@ -224,6 +330,9 @@ u8 Memory::ReadMem(const u16 addr) const {
             return ReadIORegisters(addr);
         } else if (addr < 0xFFFF) {
             // High RAM
+            if (hram_read_hooked) {
+                gameboy.hooks.Read(Common::Hooks::FastRam, addr - 0xFF80, 1);
+            }
             return hram[addr - 0xFF80];
         } else {
             // Interrupt enable (IE) register
@@ -233,6 +342,13 @@ u8 Memory::ReadMem(const u16 addr) const {
 }
 
 void Memory::WriteMem(const u16 addr, const u8 data) {
+    gameboy.logging->MemoryWritten(addr);
+
+    if (u8* page = write_pages[addr >> page_shift]) {
+        page[addr & page_mask] = data;
+        return;
+    }
+
     if (addr < 0x8000) {
         // MBC control registers -- writes to this region do not write the ROM.
         // If OAM DMA is currently transferring from the external bus, the write is ignored.
@@ -245,6 +361,7 @@ void Memory::WriteMem(const u16 addr, const u8 data) {
         if (dma_bus_block != Bus::Vram && (gameboy.lcd->stat & 0x03) != 3) {
             // Not accessible during screen mode 3.
             vram[addr - 0x8000 + 0x2000 * vram_bank_num] = data;
+            gameboy.lcd->VramWritten(addr, vram_bank_num);
         }
     } else if (addr < 0xFE00) {
         // If OAM DMA is currently transferring from the external bus, the write is ignored.
@@ -252,18 +369,26 @@ void Memory::WriteMem(const u16 addr, const u8 data) {
             if (addr < 0xC000) {
                 // External RAM bank.
                 WriteExternalRam(addr, data);
-            } else if (addr < 0xD000) {
-                // WRAM bank 0
-                wram[addr - 0xC000] = data;
-            } else if (addr < 0xE000) {
-                // WRAM bank 1 (switchable from 1-7 in CGB mode)
-                wram[addr - 0xC000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1)] = data;
-            } else if (addr < 0xF000) {
-                // Echo of C000-DDFF
-                wram[addr - 0xE000] = data;
             } else {
-                // Echo of C000-DDFF
-                wram[addr - 0xE000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1)] = data;
+                std::size_t wram_addr;
+                if (addr < 0xD000) {
+                    // WRAM bank 0
+                    wram_addr = addr - 0xC000;
+                } else if (addr < 0xE000) {
+                    // WRAM bank 1 (switchable from 1-7 in CGB mode)
+                    wram_addr = addr - 0xC000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1);
+                } else if (addr < 0xF000) {
+                    // Echo of C000-DDFF
+                    wram_addr = addr - 0xE000;
+                } else {
+                    // Echo of C000-DDFF
+                    wram_addr = addr - 0xE000 + 0x1000 * ((wram_bank_num == 0) ? 0 : wram_bank_num - 1);
+                }
+
+                wram[wram_addr] = data;
+                if (wram_hooked) {
+                    gameboy.hooks.Written(Common::Hooks::Wram, wram_addr, 1);
+                }
             }
         }
     } else if (addr < 0xFF00) {
@@ -287,376 +412,388 @@ void Memory::WriteMem(const u16 addr, const u8 data) {
         } else if (addr < 0xFFFF) {
             // High RAM
             hram[addr - 0xFF80] = data;
+            if (hram_hooked) {
+                gameboy.hooks.Written(Common::Hooks::FastRam, addr - 0xFF80, 1);
+            }
         } else {
             // Interrupt enable (IE) register
             interrupt_enable = data;
+            UpdateInterruptLine();
         }
     }
 }
 
 u8 Memory::ReadIORegisters(const u16 addr) const {
-    switch (addr) {
-    case P1:
-        return gameboy.joypad->p1 | 0xC0;
-    case SB:
-        return gameboy.serial->serial_data;
-    case SC:
-        return gameboy.serial->serial_control | ((gameboy.GameModeCgb()) ? 0x7C : 0x7E);
-    case DIV:
-        return static_cast<u8>(gameboy.timer->divider >> 8);
-    case TIMA:
-        return gameboy.timer->tima;
-    case TMA:
-        return gameboy.timer->tma;
-    case TAC:
-        return gameboy.timer->tac | 0xF8;
-    case IF:
-        return interrupt_flags | 0xE0;
-    case NR10:
-        return gameboy.audio->square1.ReadSweepCgb();
-    case NR11:
-        return gameboy.audio->square1.ReadSoundLengthCgb();
-    case NR12:
-        return gameboy.audio->square1.ReadEnvelopeCgb();
-    case NR13:
-        // This register is write-only.
-        return 0xFF;
-    case NR14:
-        return gameboy.audio->square1.ReadResetCgb();
-    case NR21:
-        return gameboy.audio->square2.ReadSoundLengthCgb();
-    case NR22:
-        return gameboy.audio->square2.ReadEnvelopeCgb();
-    case NR23:
-        // This register is write-only.
-        return 0xFF;
-    case NR24:
-        return gameboy.audio->square2.ReadResetCgb();
-    case NR30:
-        return gameboy.audio->wave.ReadSweepCgb();
-    case NR31:
-        // This register is write-only.
-        return 0xFF;
-    case NR32:
-        return gameboy.audio->wave.ReadEnvelopeCgb();
-    case NR33:
-        // This register is write-only.
-        return 0xFF;
-    case NR34:
-        return gameboy.audio->wave.ReadResetCgb();
-    case NR41:
-        // This register is write-only.
-        return 0xFF;
-    case NR42:
-        return gameboy.audio->noise.ReadEnvelopeCgb();
-    case NR43:
-        return gameboy.audio->noise.ReadNoiseControlCgb();
-    case NR44:
-        return gameboy.audio->noise.ReadResetCgb();
-    case NR50:
-        return gameboy.audio->master_volume;
-    case NR51:
-        return gameboy.audio->sound_select;
-    case NR52:
-        return gameboy.audio->ReadSoundOn();
-    case WAVE_0: case WAVE_1: case WAVE_2: case WAVE_3: case WAVE_4: case WAVE_5: case WAVE_6: case WAVE_7:
-    case WAVE_8: case WAVE_9: case WAVE_A: case WAVE_B: case WAVE_C: case WAVE_D: case WAVE_E: case WAVE_F:
-        return gameboy.audio->wave_ram[addr - WAVE_0];
-    case LCDC:
-        return gameboy.lcd->lcdc;
-    case STAT:
-        return gameboy.lcd->stat | 0x80;
-    case SCY:
-        return gameboy.lcd->scroll_y;
-    case SCX:
-        return gameboy.lcd->scroll_x;
-    case LY:
-        return gameboy.lcd->ly;
-    case LYC:
-        return gameboy.lcd->ly_compare;
-    case DMA:
-        return oam_dma_start;
-    case BGP:
-        return gameboy.lcd->bg_palette_dmg;
-    case OBP0:
-        return gameboy.lcd->obj_palette_dmg0;
-    case OBP1:
-        return gameboy.lcd->obj_palette_dmg1;
-    case WY:
-        return gameboy.lcd->window_y;
-    case WX:
-        return gameboy.lcd->window_x;
-    case KEY1:
-        return speed_switch | ((gameboy.GameModeCgb()) ? 0x7E : 0xFF);
-    case VBK:
-        if (gameboy.ConsoleCgb()) {
-            // CGB in DMG mode always has bank 0 selected.
-            return ((gameboy.GameModeCgb()) ? (static_cast<u8>(vram_bank_num) | 0xFE) : 0xFE);
-        } else {
-            return 0xFF;
-        }
-    case HDMA1:
-        // This register is write-only.
-        return 0xFF;
-    case HDMA2:
-        // This register is write-only.
-        return 0xFF;
-    case HDMA3:
-        // This register is write-only.
-        return 0xFF;
-    case HDMA4:
-        // This register is write-only.
-        return 0xFF;
-    case HDMA5:
-        return ((gameboy.GameModeCgb()) ? hdma_control : 0xFF);
-    case RP:
-        return ((gameboy.GameModeCgb()) ? (infrared | 0x3C) : 0xFF);
-    case BGPI:
-        if (gameboy.ConsoleCgb()) {
-            return gameboy.lcd->bg_palette_index | 0x40;
-        } else {
-            return 0xFF;
-        }
-    case BGPD:
-        // Palette RAM is not accessible during mode 3.
-        if (gameboy.GameModeCgb() && (gameboy.lcd->stat & 0x03) != 3) {
-            return gameboy.lcd->bg_palette_data[gameboy.lcd->bg_palette_index & 0x3F];
-        } else {
-            return 0xFF;
-        }
-    case OBPI:
-        if (gameboy.ConsoleCgb()) {
-            return gameboy.lcd->obj_palette_index | 0x40;
-        } else {
-            return 0xFF;
-        }
-    case OBPD:
-        // Palette RAM is not accessible during mode 3.
-        if (gameboy.GameModeCgb() && (gameboy.lcd->stat & 0x03) != 3) {
-            return gameboy.lcd->obj_palette_data[gameboy.lcd->obj_palette_index & 0x3F];
-        } else {
-            return 0xFF;
-        }
-    case SVBK:
-        return ((gameboy.GameModeCgb()) ? (static_cast<u8>(wram_bank_num) | 0xF8) : 0xFF);
-    case UNDOC0:
-        return ((gameboy.GameModeCgb()) ? (undocumented[0] | 0xFE) : 0xFF);
-    case UNDOC1:
-        return ((gameboy.ConsoleCgb()) ? undocumented[1] : 0xFF);
-    case UNDOC2:
-        return ((gameboy.ConsoleCgb()) ? undocumented[2] : 0xFF);
-    case UNDOC3:
-        return ((gameboy.GameModeCgb()) ? undocumented[3] : 0xFF);
-    case UNDOC4:
-        return ((gameboy.ConsoleCgb()) ? (undocumented[4] | 0x8F) : 0xFF);
-    case UNDOC5:
-    case UNDOC6:
-        return ((gameboy.ConsoleCgb()) ? 0x00 : 0xFF);
-
-    // Unused/unusable I/O registers all return 0xFF when read.
-    default:
-        return 0xFF;
-    }
+    return io_reads[addr - io_base](*this, addr);
 }
 
 void Memory::WriteIORegisters(const u16 addr, const u8 data) {
-    switch (addr) {
-    case P1:
-        gameboy.joypad->p1 = (gameboy.joypad->p1 & 0x0F) | (data & 0x30);
-        gameboy.joypad->UpdateJoypad();
-        break;
-    case SB:
-        gameboy.serial->serial_data = data;
-        break;
-    case SC:
-        gameboy.serial->serial_control = data & ((gameboy.GameModeCgb()) ? 0x83 : 0x81);
-        break;
-    case DIV:
+    io_writes[addr - io_base](*this, addr, data);
+}
+
+void Memory::PopulateIOTables() {
+    // Unused/unusable I/O registers all return 0xFF when read, and ignore writes. So do write-only registers.
+    io_reads.fill([](const Memory&, u16) -> u8 { return 0xFF; });
+    io_writes.fill([](Memory&, u16, u8) {});
+
+    const auto read = [this](u16 addr, IOReadHandler handler) { io_reads[addr - io_base] = handler; };
+    const auto write = [this](u16 addr, IOWriteHandler handler) { io_writes[addr - io_base] = handler; };
+
+    read(P1, [](const Memory& mem, u16) -> u8 { return mem.gameboy.joypad->p1 | 0xC0; });
+    write(P1, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.LatchInput();
+        mem.gameboy.joypad->p1 = (mem.gameboy.joypad->p1 & 0x0F) | (data & 0x30);
+        mem.gameboy.joypad->UpdateJoypad();
+    });
+
+    read(SB, [](const Memory& mem, u16) -> u8 { return mem.gameboy.serial.serial_data; });
+    write(SB, [](Memory& mem, u16, u8 data) { mem.gameboy.serial.serial_data = data; });
+
+    if (gameboy.GameModeCgb()) {
+        read(SC, [](const Memory& mem, u16) -> u8 { return mem.gameboy.serial.serial_control | 0x7C; });
+        write(SC, [](Memory& mem, u16, u8 data) {
+            mem.gameboy.serial.Sync();
+            mem.gameboy.serial.serial_control = data & 0x83;
+            mem.gameboy.serial.ScheduleEvent();
+        });
+    } else {
+        read(SC, [](const Memory& mem, u16) -> u8 { return mem.gameboy.serial.serial_control | 0x7E; });
+        write(SC, [](Memory& mem, u16, u8 data) {
+            mem.gameboy.serial.Sync();
+            mem.gameboy.serial.serial_control = data & 0x81;
+            mem.gameboy.serial.ScheduleEvent();
+        });
+    }
+
+    read(DIV, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.timer.Sync();
+        return static_cast<u8>(mem.gameboy.timer.divider >> 8);
+    });
+    write(DIV, [](Memory& mem, u16, u8) {
         // DIV is set to zero on any write.
-        gameboy.timer->divider = 0x0000;
-        break;
-    case TIMA:
-        gameboy.timer->tima = data;
-        break;
-    case TMA:
-        gameboy.timer->tma = data;
-        break;
-    case TAC:
-        gameboy.timer->tac = data & 0x07;
-        break;
-    case IF:
+        mem.gameboy.timer.Sync();
+        mem.gameboy.timer.divider = 0x0000;
+        mem.gameboy.timer.ScheduleEvent();
+    });
+    read(TIMA, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.timer.Sync();
+        return mem.gameboy.timer.tima;
+    });
+    write(TIMA, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.timer.Sync();
+        mem.gameboy.timer.tima = data;
+        mem.gameboy.timer.ScheduleEvent();
+    });
+    read(TMA, [](const Memory& mem, u16) -> u8 { return mem.gameboy.timer.tma; });
+    write(TMA, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.timer.Sync();
+        mem.gameboy.timer.tma = data;
+        mem.gameboy.timer.ScheduleEvent();
+    });
+    read(TAC, [](const Memory& mem, u16) -> u8 { return mem.gameboy.timer.tac | 0xF8; });
+    write(TAC, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.timer.Sync();
+        mem.gameboy.timer.tac = data & 0x07;
+        mem.gameboy.timer.ScheduleEvent();
+    });
+
+    read(IF, [](const Memory& mem, u16) -> u8 { return mem.interrupt_flags | 0xE0; });
+    write(IF, [](Memory& mem, u16, u8 data) {
         // If an instruction writes to IF on the same machine cycle an interrupt would have been triggered, the
         // written value remains in IF.
-        interrupt_flags = data & 0x1F;
-        IF_written_this_cycle = true;
-        break;
-    case NR10:
-    case NR11:
-    case NR12:
-    case NR13:
-    case NR14:
-    case NR21:
-    case NR22:
-    case NR23:
-    case NR24:
-    case NR30:
-    case NR31:
-    case NR32:
-    case NR33:
-    case NR34:
-    case NR41:
-    case NR42:
-    case NR43:
-    case NR44:
-    case NR50:
-    case NR51:
-    case NR52:
-    case WAVE_0: case WAVE_1: case WAVE_2: case WAVE_3: case WAVE_4: case WAVE_5: case WAVE_6: case WAVE_7:
-    case WAVE_8: case WAVE_9: case WAVE_A: case WAVE_B: case WAVE_C: case WAVE_D: case WAVE_E: case WAVE_F:
-        gameboy.audio->WriteSoundRegs(addr, data);
-        break;
-    case LCDC:
-        gameboy.lcd->WriteLcdc(data);
-        break;
-    case STAT:
-        gameboy.lcd->stat = (data & 0x78) | (gameboy.lcd->stat & 0x07);
+        mem.interrupt_flags = data & 0x1F;
+        mem.IF_written_this_cycle = true;
+        mem.UpdateInterruptLine();
+    });
+
+    // The APU is only brought up to date when its registers are accessed, including the unused and write-only
+    // ones.
+    for (u16 reg = NR10; reg <= WAVE_F; ++reg) {
+        read(reg, [](const Memory& mem, u16) -> u8 {
+            mem.gameboy.audio->Sync();
+            return 0xFF;
+        });
+    }
+    for (const u16 reg : {NR10, NR11, NR12, NR13, NR14, NR21, NR22, NR23, NR24, NR30, NR31, NR32, NR33, NR34, NR41,
+                          NR42, NR43, NR44, NR50, NR51, NR52}) {
+        write(reg, [](Memory& mem, u16 addr, u8 data) {
+            mem.gameboy.audio->Sync();
+            mem.gameboy.audio->WriteSoundRegs(addr, data);
+        });
+    }
+    for (u16 reg = WAVE_0; reg <= WAVE_F; ++reg) {
+        read(reg, [](const Memory& mem, u16 addr) -> u8 {
+            mem.gameboy.audio->Sync();
+            return mem.gameboy.audio->wave_ram[addr - WAVE_0];
+        });
+        write(reg, [](Memory& mem, u16 addr, u8 data) {
+            mem.gameboy.audio->Sync();
+            mem.gameboy.audio->WriteSoundRegs(addr, data);
+        });
+    }
+
+    read(NR10, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square1.ReadSweepCgb();
+    });
+    read(NR11, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square1.ReadSoundLengthCgb();
+    });
+    read(NR12, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square1.ReadEnvelopeCgb();
+    });
+    read(NR14, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square1.ReadResetCgb();
+    });
+    read(NR21, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square2.ReadSoundLengthCgb();
+    });
+    read(NR22, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square2.ReadEnvelopeCgb();
+    });
+    read(NR24, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->square2.ReadResetCgb();
+    });
+    read(NR30, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->wave.ReadSweepCgb();
+    });
+    read(NR32, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->wave.ReadEnvelopeCgb();
+    });
+    read(NR34, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->wave.ReadResetCgb();
+    });
+    read(NR42, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->noise.ReadEnvelopeCgb();
+    });
+    read(NR43, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->noise.ReadNoiseControlCgb();
+    });
+    read(NR44, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->noise.ReadResetCgb();
+    });
+    read(NR50, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->master_volume;
+    });
+    read(NR51, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->sound_select;
+    });
+    read(NR52, [](const Memory& mem, u16) -> u8 {
+        mem.gameboy.audio->Sync();
+        return mem.gameboy.audio->ReadSoundOn();
+    });
+
+    read(LCDC, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->lcdc; });
+    write(LCDC, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->Sync();
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->WriteLcdc(data);
+        mem.gameboy.lcd->ScheduleEvent();
+    });
+    read(STAT, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->stat | 0x80; });
+    write(STAT, [](Memory& mem, u16, u8 data) {
+        Lcd& lcd = *mem.gameboy.lcd;
+        lcd.Sync();
+        lcd.stat = (data & 0x78) | (lcd.stat & 0x07);
         // On DMG, if the STAT register is written during mode 1 or 0 while the LCD is on, bit 1 of the IF register
         // is set. This causes a STAT interrupt if it's enabled in IE.
-        if (gameboy.ConsoleDmg() && (gameboy.lcd->lcdc & 0x80) && !(gameboy.lcd->stat & 0x02)) {
-            gameboy.lcd->SetStatSignal();
-        }
-        break;
-    case SCY:
-        gameboy.lcd->scroll_y = data;
-        break;
-    case SCX:
-        gameboy.lcd->scroll_x = data;
-        break;
-    case LY:
-        // This register is read only.
-        break;
-    case LYC:
-        gameboy.lcd->ly_compare = data;
-        break;
-    case DMA:
-        oam_dma_start = data;
-        oam_dma_state = DmaState::Starting;
-        break;
-    case BGP:
-        gameboy.lcd->bg_palette_dmg = data;
-        break;
-    case OBP0:
-        gameboy.lcd->obj_palette_dmg0 = data;
-        break;
-    case OBP1:
-        gameboy.lcd->obj_palette_dmg1 = data;
-        break;
-    case WY:
-        gameboy.lcd->WriteWy(data);
-        break;
-    case WX:
-        gameboy.lcd->WriteWx(data);
-        break;
-    case KEY1:
-        speed_switch = (speed_switch & 0x80) | (data & 0x01);
-        break;
-    case VBK:
-        if (gameboy.GameModeCgb()) {
-            vram_bank_num = data & 0x01;
-        }
-        break;
-    case HDMA1:
-        hdma_source_hi = data;
-        break;
-    case HDMA2:
-        hdma_source_lo = data & 0xF0;
-        break;
-    case HDMA3:
-        hdma_dest_hi = data & 0x1F;
-        break;
-    case HDMA4:
-        hdma_dest_lo = data & 0xF0;
-        break;
-    case HDMA5:
-        hdma_control = data;
-        if (gameboy.GameModeCgb()) {
-            hdma_reg_written = true;
-        }
-        break;
-    case RP:
-        if (gameboy.GameModeCgb()) {
-            infrared = (infrared & 0x02) | (data & 0xC1);
-        }
-        break;
-    case BGPI:
-        if (gameboy.GameModeCgb()) {
-            gameboy.lcd->bg_palette_index = data & 0xBF;
-        }
-        break;
-    case BGPD:
+        if (mem.gameboy.ConsoleDmg() && (lcd.lcdc & 0x80) && !(lcd.stat & 0x02)) {
+            lcd.SetStatSignal();
+        }
+        lcd.ScheduleEvent();
+    });
+    read(SCY, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->scroll_y; });
+    write(SCY, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->scroll_y = data;
+    });
+    read(SCX, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->scroll_x; });
+    write(SCX, [](Memory& mem, u16, u8 data) {
+        // The length of mode 3 depends on SCX.
+        mem.gameboy.lcd->Sync();
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->scroll_x = data;
+        mem.gameboy.lcd->ScheduleEvent();
+    });
+    // LY is read only.
+    read(LY, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->ly; });
+    read(LYC, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->ly_compare; });
+    write(LYC, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->Sync();
+        mem.gameboy.lcd->ly_compare = data;
+        mem.gameboy.lcd->ScheduleEvent();
+    });
+    read(DMA, [](const Memory& mem, u16) -> u8 { return mem.oam_dma_start; });
+    write(DMA, [](Memory& mem, u16, u8 data) {
+        mem.oam_dma_start = data;
+        mem.oam_dma_state = DmaState::Starting;
+    });
+    read(BGP, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->bg_palette_dmg; });
+    write(BGP, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->bg_palette_dmg = data;
+        mem.gameboy.lcd->UpdateDmgColours();
+    });
+    read(OBP0, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->obj_palette_dmg0; });
+    write(OBP0, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->obj_palette_dmg0 = data;
+        mem.gameboy.lcd->UpdateDmgColours();
+    });
+    read(OBP1, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->obj_palette_dmg1; });
+    write(OBP1, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->obj_palette_dmg1 = data;
+        mem.gameboy.lcd->UpdateDmgColours();
+    });
+    read(WY, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->window_y; });
+    write(WY, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->WriteWy(data);
+    });
+    read(WX, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->window_x; });
+    write(WX, [](Memory& mem, u16, u8 data) {
+        mem.gameboy.lcd->CatchUpLine();
+        mem.gameboy.lcd->WriteWx(data);
+    });
+
+    write(KEY1, [](Memory& mem, u16, u8 data) { mem.speed_switch = (mem.speed_switch & 0x80) | (data & 0x01); });
+
+    // The HDMA source and destination registers are write-only, and are writable even in DMG mode.
+    write(HDMA1, [](Memory& mem, u16, u8 data) { mem.hdma_source_hi = data; });
+    write(HDMA2, [](Memory& mem, u16, u8 data) { mem.hdma_source_lo = data & 0xF0; });
+    write(HDMA3, [](Memory& mem, u16, u8 data) { mem.hdma_dest_hi = data & 0x1F; });
+    write(HDMA4, [](Memory& mem, u16, u8 data) { mem.hdma_dest_lo = data & 0xF0; });
+    write(HDMA5, [](Memory& mem, u16, u8 data) { mem.hdma_control = data; });
+
+    if (gameboy.ConsoleCgb()) {
+        // CGB in DMG mode always has VRAM bank 0 selected.
+        read(VBK, [](const Memory&, u16) -> u8 { return 0xFE; });
+        read(BGPI, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->bg_palette_index | 0x40; });
+        read(OBPI, [](const Memory& mem, u16) -> u8 { return mem.gameboy.lcd->obj_palette_index | 0x40; });
+
+        read(UNDOC1, [](const Memory& mem, u16) -> u8 { return mem.undocumented[1]; });
+        write(UNDOC1, [](Memory& mem, u16, u8 data) { mem.undocumented[1] = data; });
+        read(UNDOC2, [](const Memory& mem, u16) -> u8 { return mem.undocumented[2]; });
+        write(UNDOC2, [](Memory& mem, u16, u8 data) { mem.undocumented[2] = data; });
+        read(UNDOC4, [](const Memory& mem, u16) -> u8 { return mem.undocumented[4] | 0x8F; });
+        write(UNDOC4, [](Memory& mem, u16, u8 data) { mem.undocumented[4] = data & 0x70; });
+        // UNDOC5 and UNDOC6 are read only.
+        read(UNDOC5, [](const Memory&, u16) -> u8 { return 0x00; });
+        read(UNDOC6, [](const Memory&, u16) -> u8 { return 0x00; });
+    }
+
+    if (!gameboy.GameModeCgb()) {
+        return;
+    }
+
+    read(KEY1, [](const Memory& mem, u16) -> u8 { return mem.speed_switch | 0x7E; });
+    read(VBK, [](const Memory& mem, u16) -> u8 { return static_cast<u8>(mem.vram_bank_num) | 0xFE; });
+    write(VBK, [](Memory& mem, u16, u8 data) { mem.vram_bank_num = data & 0x01; });
+    read(HDMA5, [](const Memory& mem, u16) -> u8 { return mem.hdma_control; });
+    write(HDMA5, [](Memory& mem, u16, u8 data) {
+        mem.hdma_control = data;
+        mem.hdma_reg_written = true;
+    });
+    read(RP, [](const Memory& mem, u16) -> u8 { return mem.infrared | 0x3C; });
+    write(RP, [](Memory& mem, u16, u8 data) { mem.infrared = (mem.infrared & 0x02) | (data & 0xC1); });
+
+    write(BGPI, [](Memory& mem, u16, u8 data) { mem.gameboy.lcd->bg_palette_index = data & 0xBF; });
+    read(BGPD, [](const Memory& mem, u16) -> u8 {
         // Palette RAM is not accessible during mode 3.
-        if (gameboy.GameModeCgb() && (gameboy.lcd->stat & 0x03) != 3) {
-            gameboy.lcd->bg_palette_data[gameboy.lcd->bg_palette_index & 0x3F] = data;
+        const Lcd& lcd = *mem.gameboy.lcd;
+        return ((lcd.stat & 0x03) != 3) ? lcd.bg_palette_data[lcd.bg_palette_index & 0x3F] : 0xFF;
+    });
+    write(BGPD, [](Memory& mem, u16, u8 data) {
+        Lcd& lcd = *mem.gameboy.lcd;
+        if ((lcd.stat & 0x03) != 3) {
+            lcd.bg_palette_data[lcd.bg_palette_index & 0x3F] = data;
+            lcd.UpdateCgbColour(false, lcd.bg_palette_index & 0x3F);
             // Increment index if auto-increment specified.
-            if (gameboy.lcd->bg_palette_index & 0x80) {
-                gameboy.lcd->bg_palette_index = (gameboy.lcd->bg_palette_index + 1) & 0xBF;
+            if (lcd.bg_palette_index & 0x80) {
+                lcd.bg_palette_index = (lcd.bg_palette_index + 1) & 0xBF;
             }
         }
-        break;
-    case OBPI:
-        if (gameboy.GameModeCgb()) {
-            gameboy.lcd->obj_palette_index = data & 0xBF;
-        }
-        break;
-    case OBPD:
+    });
+    write(OBPI, [](Memory& mem, u16, u8 data) { mem.gameboy.lcd->obj_palette_index = data & 0xBF; });
+    read(OBPD, [](const Memory& mem, u16) -> u8 {
         // Palette RAM is not accessible during mode 3.
-        if (gameboy.GameModeCgb() && (gameboy.lcd->stat & 0x03) != 3) {
-            gameboy.lcd->obj_palette_data[gameboy.lcd->obj_palette_index & 0x3F] = data;
+        const Lcd& lcd = *mem.gameboy.lcd;
+        return ((lcd.stat & 0x03) != 3) ? lcd.obj_palette_data[lcd.obj_palette_index & 0x3F] : 0xFF;
+    });
+    write(OBPD, [](Memory& mem, u16, u8 data) {
+        Lcd& lcd = *mem.gameboy.lcd;
+        if ((lcd.stat & 0x03) != 3) {
+            lcd.obj_palette_data[lcd.obj_palette_index & 0x3F] = data;
+            lcd.UpdateCgbColour(true, lcd.obj_palette_index & 0x3F);
             // Increment index if auto-increment specified.
-            if (gameboy.lcd->obj_palette_index & 0x80) {
-                gameboy.lcd->obj_palette_index = (gameboy.lcd->obj_palette_index + 1) & 0xBF;
+            if (lcd.obj_palette_index & 0x80) {
+                lcd.obj_palette_index = (lcd.obj_palette_index + 1) & 0xBF;
             }
         }
-        break;
-    case SVBK:
-        if (gameboy.GameModeCgb()) {
-            wram_bank_num = data & 0x07;
-        }
-        break;
-    case UNDOC0:
-        if (gameboy.GameModeCgb()) {
-            undocumented[0] = data & 0x01;
-        }
-        break;
-    case UNDOC1:
-        if (gameboy.ConsoleCgb()) {
-            undocumented[1] = data;
-        }
-        break;
-    case UNDOC2:
-        if (gameboy.ConsoleCgb()) {
-            undocumented[2] = data;
-        }
-        break;
-    case UNDOC3:
-        if (gameboy.GameModeCgb()) {
-            undocumented[3] = data;
-        }
-        break;
-    case UNDOC4:
-        if (gameboy.ConsoleCgb()) {
-            undocumented[4] = data & 0x70;
-        }
-        break;
-    case UNDOC5:
-        // This register is read only.
-        break;
-    case UNDOC6:
-        // This register is read only.
-        break;
-
-    default:
-        break;
+    });
+    read(SVBK, [](const Memory& mem, u16) -> u8 { return static_cast<u8>(mem.wram_bank_num) | 0xF8; });
+    write(SVBK, [](Memory& mem, u16, u8 data) {
+        mem.wram_bank_num = data & 0x07;
+        mem.UpdatePageTables();
+    });
+
+    read(UNDOC0, [](const Memory& mem, u16) -> u8 { return mem.undocumented[0] | 0xFE; });
+    write(UNDOC0, [](Memory& mem, u16, u8 data) { mem.undocumented[0] = data & 0x01; });
+    read(UNDOC3, [](const Memory& mem, u16) -> u8 { return mem.undocumented[3]; });
+    write(UNDOC3, [](Memory& mem, u16, u8 data) { mem.undocumented[3] = data; });
+}
+
+void Memory::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("memory", sizeof(Memory));
+    report.Add("guest_ram", vram);
+    report.Add("guest_ram", wram);
+    report.Add("guest_ram", hram);
+    report.Add("save", ext_ram);
+    report.AddShared("rom", rom.size());
+}
+
+void Memory::SerializeState(Common::State& state) {
+    // The page tables point into the memory vectors, so they have to keep their sizes.
+    state.SyncContents(vram);
+    state.SyncContents(wram);
+    state.SyncContents(hram);
+    state.SyncContents(ext_ram);
+
+    state.Sync(double_speed, IF_written_this_cycle, interrupt_flags, interrupt_enable);
+    UpdateInterruptLine();
+    // OAM is saved with the LCD, so it needs to be up to date.
+    if (!state.Loading()) {
+        FlushOamDma();
+    }
+    state.Sync(oam_dma_state, dma_bus_block, oam_transfer_addr, oam_transfer_byte, bytes_read, oam_dma_deferred,
+               oam_dma_buffer);
+    state.Sync(hdma_state, hdma_type, hdma_reg_written, bytes_to_copy, hblank_bytes, gdma_copied_bytes);
+    state.Sync(oam_dma_start, speed_switch, vram_bank_num, hdma_source_hi, hdma_source_lo, hdma_dest_hi,
+               hdma_dest_lo, hdma_control, infrared, wram_bank_num, undocumented);
+    state.Sync(rom_bank_num, ram_bank_num, ext_ram_enabled, upper_bits, ram_bank_mode);
+
+    if (rtc_present) {
+        state.Sync(*rtc);
+    }
+
+    if (state.Loading()) {
+        UpdatePageTables();
+        save_dirty.MarkAll();
     }
 }
 
@@ -20,10 +20,18 @@
 #include <array>
 #include <algorithm>
 #include <memory>
+#include <unordered_map>
 
 #include "common/CommonTypes.h"
+#include "common/Cheats.h"
+#include "common/SaveFlusher.h"
+#include "common/MappedSave.h"
+#include "common/MappedRom.h"
+#include "common/MemoryReport.h"
 #include "gb/core/Enums.h"
 
+namespace Common { class State; }
+
 namespace Gb {
 
 class CartridgeHeader;
@@ -32,14 +40,36 @@ class Rtc;
 
 class Memory {
 public:
-    Memory(const CartridgeHeader& header, const std::vector<u8>& _rom, const std::string& _save_path,
-           GameBoy& _gameboy);
+    Memory(const CartridgeHeader& header, const Common::RomVector<u8>& _rom, const std::string& _save_path,
+           const Common::SaveSettings& save_settings, GameBoy& _gameboy);
     ~Memory();
 
     unsigned int double_speed = 0;
 
     u8 ReadMem(const u16 addr) const;
     void WriteMem(const u16 addr, const u8 data);
+    // The offset in the ROM of a ROM address, with the banks mapped now.
+    std::size_t RomOffset(const u16 addr) const { return addr + ((addr < 0x4000) ? rom0_offset : rom1_offset); }
+
+    // Code coverage slots, one per byte an instruction can start at: the ROM by offset, then WRAM by bank, then
+    // HRAM. Code running from anywhere else isn't covered.
+    static constexpr std::size_t no_code_slot = ~std::size_t{0};
+    std::size_t CodeSlots() const { return rom.size() + wram.size() + hram.size(); }
+    std::size_t CodeSlot(const u16 addr) const {
+        if (addr < 0x8000) {
+            const std::size_t offset = RomOffset(addr);
+            return (offset < rom.size()) ? offset : no_code_slot;
+        } else if (addr >= 0xC000 && addr < 0xFE00) {
+            const std::size_t bank = ((addr & 0x1000) == 0) ? 0 : WramBank();
+            return rom.size() + 0x1000 * bank + (addr & 0x0FFF);
+        } else if (addr >= 0xFF80 && addr < 0xFFFF) {
+            return rom.size() + wram.size() + (addr - 0xFF80);
+        }
+
+        return no_code_slot;
+    }
+    // The WRAM bank mapped at 0xD000.
+    unsigned int WramBank() const { return std::max(wram_bank_num, 1u); }
 
     void ToggleCpuSpeed() {
         speed_switch = (speed_switch ^ 0x80) & 0x80;
@@ -48,53 +78,139 @@ public:
 
     // Interrupt functions
     void RequestInterrupt(Interrupt intr) {
-        if (!IF_written_this_cycle) { interrupt_flags |= static_cast<unsigned int>(intr); }
+        if (!IF_written_this_cycle) {
+            interrupt_flags |= static_cast<unsigned int>(intr);
+            UpdateInterruptLine();
+        }
     }
     void ClearInterrupt(Interrupt intr) {
-        if (!IF_written_this_cycle) { interrupt_flags &= ~static_cast<unsigned int>(intr); }
+        if (!IF_written_this_cycle) {
+            interrupt_flags &= ~static_cast<unsigned int>(intr);
+            UpdateInterruptLine();
+        }
     }
     bool IsPending(Interrupt intr) const {
         return interrupt_flags & interrupt_enable & static_cast<unsigned int>(intr);
     }
-    bool RequestedEnabledInterrupts() const { return interrupt_flags & interrupt_enable; }
+    bool RequestedEnabledInterrupts() const { return interrupt_line; }
+    bool AnyInterruptEnabled() const { return interrupt_enable & 0x1F; }
     bool IF_written_this_cycle = false;
 
     // DMA functions
     void UpdateOamDma();
     void UpdateHdma();
+    bool OamDmaInProgress() const { return oam_dma_state != DmaState::Inactive; }
     bool HdmaInProgress() const { return hdma_state == DmaState::Active || hdma_state == DmaState::Starting; }
     void SignalHdma();
+    // Brings OAM up to date with a deferred OAM DMA, for when the LCD needs to look at it.
+    void FlushOamDma() {
+        if (oam_dma_deferred) {
+            WriteDeferredOam(bytes_read - 1);
+        }
+    }
 
     // LCD functions
     template<typename DestIter>
     void CopyFromVram(const u16 start_addr, const std::size_t num_bytes, const int bank_num, DestIter dest) const {
         std::copy_n(vram.cbegin() + (start_addr - 0x8000) + 0x2000 * bank_num, num_bytes, dest);
     }
+    const u8* VramPointer(const u16 addr, const int bank_num) const {
+        return vram.data() + (addr - 0x8000) + 0x2000 * bank_num;
+    }
+
+    // Called once per frame. Hands the external RAM pages written since the last flush to the background writer.
+    void FlushSaveData();
+    u64 SaveFlushes() const { return save_flusher ? save_flusher->Flushes() : 0; }
+
+    void SerializeState(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
+
+    // Views of guest RAM for embedders. The vectors are never resized, so these stay valid. Neither region holds
+    // cached code, so embedders can write to them directly.
+    const std::vector<u8>& WramReference() const { return wram; }
+    const std::vector<u8>& HramReference() const { return hram; }
+    std::vector<u8>& WramReference() { return wram; }
+    std::vector<u8>& HramReference() { return hram; }
+    // Read only, since writes to external RAM have to mark the save dirty. Empty if the cartridge has none.
+    const Common::SaveVector<u8>& ExtRamReference() const { return ext_ram; }
+    const Common::RomVector<u8>& RomReference() const { return rom; }
+
+    // Rebuilds the page tables, leaving out the WRAM pages with access hooks so those accesses reach the checks in
+    // ReadMem and WriteMem.
+    void HooksChanged();
+    // Replaces the cheats' ROM patches, and maps in copies of the ROM pages they touch with the patches applied.
+    void PatchRom(const std::vector<Common::Cheat>& patches);
 
 private:
     GameBoy& gameboy;
 
-    const MBC mbc_mode;
+    // The MBC can't change after the cartridge is loaded, so its handlers are picked once at construction.
+    struct MbcHandlers {
+        u8 (Memory::*read_ram)(const u16 addr) const;
+        void (Memory::*write_ram)(const u16 addr, const u8 data);
+        void (Memory::*write_control)(const u16 addr, const u8 data);
+        int (Memory::*rom0_bank)() const;
+        // Returns the external RAM bank mapped at 0xA000, or nullptr if reads have to go through read_ram.
+        const u8* (Memory::*mapped_ram)() const;
+    };
+    const MbcHandlers mbc;
     const bool ext_ram_present;
     const bool rtc_present;
     const bool rumble_present;
     const int num_rom_banks;
     const int num_ram_banks;
 
-    const std::vector<u8>& rom;
+    const Common::RomVector<u8>& rom;
     std::vector<u8> vram;
     std::vector<u8> wram;
     std::vector<u8> hram;
-    std::vector<u8> ext_ram;
+    // Only present when saves are memory-mapped, in which case ext_ram lives in the save file.
+    std::shared_ptr<Common::MappedSaveFile> save_map;
+    Common::SaveVector<u8> ext_ram;
     std::unique_ptr<Rtc> rtc;
 
-    const std::string& save_path;
+    const std::string save_path;
+    Common::DirtyPages save_dirty;
+    // Only present when periodic flushing is enabled and the game is being saved to a regular file.
+    std::unique_ptr<Common::SaveFlusher> save_flusher;
+
+    // ROM, WRAM and plain external RAM banks are read through this table of 4KB pages, and WRAM is also written
+    // through it. The banks only change on MBC, SVBK, and OAM DMA writes, so the table is rebuilt then. A null entry
+    // means the page has to go through the region checks: VRAM is locked during mode 3, external RAM writes mark the
+    // save dirty and may hit the RTC, and 0xF000-0xFFFF holds OAM and the I/O registers.
+    static constexpr int page_shift = 12;
+    static constexpr u16 page_mask = (1 << page_shift) - 1;
+    std::array<const u8*, 16> read_pages{};
+    std::array<u8*, 16> write_pages{};
+    // Byte offsets of the banks currently mapped at 0x0000 and 0x4000.
+    std::size_t rom0_offset = 0;
+    std::size_t rom1_offset = 0;
+    // Whether any write (or read) hooks are set in each region. HRAM is never in the page table, so its accesses
+    // check these.
+    bool wram_hooked = false;
+    bool hram_hooked = false;
+    bool wram_read_hooked = false;
+    bool hram_read_hooked = false;
+    // Patched copies of the 4KB ROM pages touched by cheats, keyed by their offset into the ROM.
+    std::unordered_map<std::size_t, std::vector<u8>> patched_rom_pages;
+
+    void UpdatePageTables();
 
     // Init functions
     void IORegisterInit();
     void VramInit();
 
     // I/O register functions
+    // Accesses to 0xFF00-0xFF7F are dispatched through a table with a handler for each register. The console and
+    // game mode can't change after power on, so the handlers for the current mode are picked once at construction.
+    // HRAM and IE are handled by ReadMem/WriteMem before getting here.
+    using IOReadHandler = u8 (*)(const Memory& mem, u16 addr);
+    using IOWriteHandler = void (*)(Memory& mem, u16 addr, u8 data);
+    static constexpr u16 io_base = 0xFF00;
+    std::array<IOReadHandler, 0x80> io_reads;
+    std::array<IOWriteHandler, 0x80> io_writes;
+
+    void PopulateIOTables();
     u8 ReadIORegisters(const u16 addr) const;
     void WriteIORegisters(const u16 addr, const u8 data);
 
@@ -104,27 +220,56 @@ private:
     DmaState oam_dma_state = DmaState::Inactive;
     Bus dma_bus_block = Bus::None;
 
-    u16 oam_transfer_addr;
-    u8 oam_transfer_byte;
+    u16 oam_transfer_addr = 0;
+    u8 oam_transfer_byte = 0;
     unsigned int bytes_read = 160;
 
+    // When OAM DMA reads from ROM, cartridge RAM or WRAM, nothing can change the source while the bus is blocked,
+    // so it's copied in one go when the transfer starts.
+    bool oam_dma_deferred = false;
+    std::array<u8, 160> oam_dma_buffer{};
+
+    u8 OamTransferByte() const { return (oam_dma_deferred) ? oam_dma_buffer[bytes_read - 1] : oam_transfer_byte; }
+    void WriteDeferredOam(unsigned int num_bytes);
+
     enum class HdmaType {Gdma, Hdma};
     DmaState hdma_state = DmaState::Inactive;
-    HdmaType hdma_type;
+    HdmaType hdma_type = HdmaType::Gdma;
     bool hdma_reg_written = false;
     int bytes_to_copy = 0, hblank_bytes = 0;
+    // The number of bytes of a GDMA which have already been copied ahead of time.
+    int gdma_copied_bytes = 0;
 
     void InitHdma();
     void ExecuteHdma();
+    void CopyHdmaBytes(int num_bytes);
     u8 DmaCopy(const u16 addr) const;
 
     // MBC/Saving functions
     void ReadSaveFile(unsigned int cart_ram_size);
+    void ReserveRtcData(std::size_t ram_size);
     void WriteSaveFile();
 
+    static MbcHandlers SelectMbcHandlers(MBC mbc_mode);
+    template<MBC M>
+    static constexpr MbcHandlers MakeMbcHandlers();
+
+    u8 ReadExternalRam(const u16 addr) const { return (this->*mbc.read_ram)(addr); }
+    void WriteExternalRam(const u16 addr, const u8 data) { (this->*mbc.write_ram)(addr, data); }
+    void WriteMbcControlRegisters(const u16 addr, const u8 data) { (this->*mbc.write_control)(addr, data); }
+
+    template<MBC M>
     u8 ReadExternalRam(const u16 addr) const;
+    template<MBC M>
     void WriteExternalRam(const u16 addr, const u8 data);
+    template<MBC M>
     void WriteMbcControlRegisters(const u16 addr, const u8 data);
+    template<MBC M>
+    int Rom0Bank() const;
+    template<MBC M>
+    int ExternalRamOffset(const u16 addr) const;
+    template<MBC M>
+    const u8* MappedExternalRam() const;
 
 public:
     // IO registers
@@ -191,7 +336,7 @@ public:
     static constexpr u16 LY     = 0xFF44;
     static constexpr u16 LYC    = 0xFF45;
     static constexpr u16 DMA    = 0xFF46;
-    u8 oam_dma_start;
+    u8 oam_dma_start = 0x00;
     static constexpr u16 BGP    = 0xFF47;
     static constexpr u16 OBP0   = 0xFF48;
     static constexpr u16 OBP1   = 0xFF49;
@@ -227,6 +372,11 @@ public:
 
     u8 interrupt_enable = 0x00;
 
+    // Whether IF & IE is non-zero, which the CPU checks between every instruction. It's only recomputed when either
+    // register changes.
+    bool interrupt_line = false;
+    void UpdateInterruptLine() { interrupt_line = interrupt_flags & interrupt_enable; }
+
     // Undocumented CGB registers
     static constexpr u16 UNDOC0 = 0xFF6C;
     static constexpr u16 UNDOC1 = 0xFF72;
@@ -17,15 +17,19 @@
 #include <fmt/format.h>
 
 #include "gb/memory/Rtc.h"
+#include "common/SaveState.h"
 
 namespace Gb {
 
-Rtc::Rtc(std::vector<u8>& save_game) {
-    if ((save_game.size() % 0x400) != 0x30) {
+Rtc::Rtc(Common::SaveVector<u8>& save_game, const Common::RtcSource& _source)
+        : source(_source)
+        , reference_time(source.Now())
+        , halted_time(reference_time) {
+    if ((save_game.size() % 0x400) != save_data_size) {
         fmt::print("No RTC save data found. RTC initialized to default time.\n");
     } else {
         LoadRtcData(save_game);
-        save_game.erase(save_game.cend() - 0x30, save_game.cend());
+        save_game.erase(save_game.cend() - save_data_size, save_game.cend());
     }
 }
 
@@ -54,10 +58,10 @@ void Rtc::SetFlags(u8 value) {
     if ((flags & 0x40) ^ (value & 0x40)) {
         if (value & 0x40) {
             // Halt the RTC.
-            halted_time = std::chrono::steady_clock::now();
+            halted_time = source.Now();
         } else {
             // Unhalt the RTC.
-            auto elapsed_time_halted = std::chrono::steady_clock::now() - halted_time;
+            auto elapsed_time_halted = source.Now() - halted_time;
             reference_time = reference_time + elapsed_time_halted;
         }
     }
@@ -69,11 +73,11 @@ std::chrono::seconds Rtc::CurrentInternalTime() const {
     if (flags & 0x40) {
         return std::chrono::duration_cast<std::chrono::seconds>(halted_time - reference_time);
     } else {
-        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - reference_time);
+        return std::chrono::duration_cast<std::chrono::seconds>(source.Now() - reference_time);
     }
 }
 
-void Rtc::LoadRtcData(const std::vector<u8>& save_game) {
+void Rtc::LoadRtcData(const Common::SaveVector<u8>& save_game) {
     const std::size_t save_size = save_game.size();
 
     // Load the latched time first.
@@ -121,14 +125,12 @@ void Rtc::LoadRtcData(const std::vector<u8>& save_game) {
 
     // Get elapsed time between last save and now.
     auto saved_system_time = std::chrono::system_clock::from_time_t(static_cast<std::time_t>(save_timestamp));
-    auto elapsed_real_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
-                                 std::chrono::system_clock::now() - saved_system_time
-                             );
+    auto elapsed_real_time = source.Now() - saved_system_time;
 
     reference_time -= elapsed_real_time;
 }
 
-void Rtc::AppendRtcData(std::vector<u8>& save_game) const {
+void Rtc::AppendRtcData(Common::SaveVector<u8>& save_game) const {
     // Since it's not actually part of the external RAM address space, the saved format of the RTC state is up
     // to the implementation. There is a somewhat-agreed upon format between emulators that was put in place
     // by either VBA or BGB ages ago.
@@ -142,7 +144,7 @@ void Rtc::AppendRtcData(std::vector<u8>& save_game) const {
     AppendTimeStamp(save_game);
 }
 
-void Rtc::AppendRtcRegs(std::vector<u8>& save_file, std::chrono::seconds save_time) const {
+void Rtc::AppendRtcRegs(Common::SaveVector<u8>& save_file, std::chrono::seconds save_time) const {
     PushBackAs32Bits(save_file, GetTimeValue<Seconds>(save_time));
     PushBackAs32Bits(save_file, GetTimeValue<Minutes>(save_time));
     PushBackAs32Bits(save_file, GetTimeValue<Hours>(save_time));
@@ -150,8 +152,8 @@ void Rtc::AppendRtcRegs(std::vector<u8>& save_file, std::chrono::seconds save_ti
     PushBackAs32Bits(save_file, flags);
 }
 
-void Rtc::AppendTimeStamp(std::vector<u8>& save_file) const {
-    const u64 timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+void Rtc::AppendTimeStamp(Common::SaveVector<u8>& save_file) const {
+    const u64 timestamp = std::chrono::system_clock::to_time_t(source.Now());
 
     save_file.push_back(static_cast<u8>(timestamp));
     save_file.push_back(static_cast<u8>(timestamp >> 8));
@@ -163,11 +165,26 @@ void Rtc::AppendTimeStamp(std::vector<u8>& save_file) const {
     save_file.push_back(static_cast<u8>(timestamp >> 56));
 }
 
-void Rtc::PushBackAs32Bits(std::vector<u8>& save_file, const u8 value) const {
+void Rtc::PushBackAs32Bits(Common::SaveVector<u8>& save_file, const u8 value) const {
     save_file.push_back(value);
     save_file.push_back(0);
     save_file.push_back(0);
     save_file.push_back(0);
 }
 
+void Rtc::SerializeState(Common::State& state) {
+    // The RTC runs off the RTC source, so save the time it reads rather than the source's time points. It
+    // resumes from that time when the state is loaded.
+    s64 internal_seconds = CurrentInternalTime().count();
+    s64 latched_seconds = latched_time.count();
+    state.Sync(internal_seconds, latched_seconds, flags, latch_last_value_written);
+
+    if (state.Loading()) {
+        const auto now = source.Now();
+        reference_time = now - std::chrono::seconds{internal_seconds};
+        halted_time = now;
+        latched_time = std::chrono::seconds{latched_seconds};
+    }
+}
+
 } // End namespace Gb
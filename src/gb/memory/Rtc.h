@@ -20,19 +20,26 @@
 #include <vector>
 
 #include "common/CommonTypes.h"
+#include "common/RtcSource.h"
+#include "common/MappedSave.h"
 
 namespace Gb {
 
 class Rtc {
 public:
-    explicit Rtc(std::vector<u8>& save_game);
+    Rtc(Common::SaveVector<u8>& save_game, const Common::RtcSource& _source);
+
+    // The RTC registers and a timestamp, appended to the end of the save.
+    static constexpr std::size_t save_data_size = 0x30;
 
     void LatchCurrentTime();
     u8 GetFlags() const { return flags | 0x3E; }
     void SetFlags(u8 value);
 
-    void LoadRtcData(const std::vector<u8>& save_game);
-    void AppendRtcData(std::vector<u8>& save_game) const;
+    void LoadRtcData(const Common::SaveVector<u8>& save_game);
+    void AppendRtcData(Common::SaveVector<u8>& save_game) const;
+
+    void SerializeState(Common::State& state);
 
     template<typename T>
     u8 GetLatchedTime() const {
@@ -61,9 +68,11 @@ public:
     using Hours = RtcDuration<std::chrono::hours, 24>;
     using Days = RtcDuration<std::chrono::duration<long, std::ratio<86400>>, 256>;
 private:
+    const Common::RtcSource& source;
+
     // The reference time is 0 seconds, 0 minutes, 0 hours, and 0 days in the MBC3 RTC time.
-    std::chrono::time_point<std::chrono::steady_clock> reference_time{std::chrono::steady_clock::now()};
-    std::chrono::time_point<std::chrono::steady_clock> halted_time{std::chrono::steady_clock::now()};
+    Common::RtcSource::TimePoint reference_time;
+    Common::RtcSource::TimePoint halted_time;
     std::chrono::seconds latched_time{0};
 
     // bit 0: MSB(it) of Day Counter
@@ -78,9 +87,9 @@ private:
 
     std::chrono::seconds CurrentInternalTime() const;
 
-    void AppendRtcRegs(std::vector<u8>& save_file, std::chrono::seconds save_time) const;
-    void AppendTimeStamp(std::vector<u8>& save_file) const;
-    void PushBackAs32Bits(std::vector<u8>& save_file, const u8 value) const;
+    void AppendRtcRegs(Common::SaveVector<u8>& save_file, std::chrono::seconds save_time) const;
+    void AppendTimeStamp(Common::SaveVector<u8>& save_file) const;
+    void PushBackAs32Bits(Common::SaveVector<u8>& save_file, const u8 value) const;
 };
 
 } // End namespace Gb
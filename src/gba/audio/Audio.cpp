@@ -15,21 +15,36 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
+#include <limits>
+#include <tuple>
 
 #include "gba/audio/Audio.h"
 #include "gba/core/Core.h"
 #include "gba/hardware/Dma.h"
 #include "gba/memory/Memory.h"
+#include "common/Tracer.h"
+#include "emu/Frontend.h"
 
 namespace Gba {
 
-Audio::Audio(Core& _core)
+Audio::Audio(AudioFilter _filter, Core& _core, Emu::Frontend* _chunk_frontend)
         : square1(Gb::Console::AGB, true, 0x00, 0x00, 0x00, 0x00, 0x00)
         , square2(Gb::Console::AGB, true, 0x00, 0x00, 0x00, 0x00, 0x00)
         , wave(Gb::Console::AGB, true, 0x00, 0x00, 0x00, 0x00, 0x00)
         , noise(Gb::Console::AGB, true, 0x00, 0x00, 0x00, 0x00, 0x00)
         , core(_core)
-        , resample_buffer(interpolated_buffer_size / 2) {
+        , output_enabled(_filter != AudioFilter::None)
+        , enable_blip(_filter == AudioFilter::Blip)
+        , enable_fir(Common::FirResampler::Handles(_filter))
+        , resampler((output_enabled && !enable_blip && !enable_fir)
+                    ? Common::IirResampler{4, _filter == AudioFilter::FixedIir}
+                    : Common::IirResampler{})
+        , fir(Common::FirResampler::ForFilter(_filter, 4))
+        , blip(enable_blip
+               ? Common::BlipBuffer{samples_per_frame, 800, 4.0f / Common::IirResampler::interpolation_factor}
+               : Common::BlipBuffer{})
+        , chunk_frontend(_chunk_frontend)
+        , chunk_samples((chunk_frontend != nullptr) ? chunk_frontend->AudioChunkSamples() : 0) {
 
     Common::Vec4f::SetFlushToZero();
 }
@@ -42,10 +57,25 @@ void Audio::Update(int cycles) {
 
     if (!AudioEnabled()) {
         // Queue silence while audio is disabled.
-        sample_count += updated_clock / 8 - audio_clock / 8;
-        if (sample_count >= samples_per_frame) {
-            Resample();
-            sample_count %= samples_per_frame;
+        if (output_enabled && !core.AudioSuppressed()) {
+            const int silent_samples = updated_clock / 8 - audio_clock / 8;
+            if (enable_blip) {
+                blip.SetAmplitude(sample_count, 0, 0);
+            } else {
+                for (int i = Common::IirResampler::BlockEnd(sample_count); i < sample_count + silent_samples;
+                     i += Common::IirResampler::input_samples_per_block) {
+                    FilterBlock(i);
+                }
+            }
+
+            sample_count += silent_samples;
+            if (sample_count >= samples_per_frame) {
+                Resample();
+                if (enable_blip) {
+                    SendChunk(800);
+                }
+                sample_count %= samples_per_frame;
+            }
         }
 
         audio_clock = updated_clock;
@@ -53,95 +83,202 @@ void Audio::Update(int cycles) {
     }
 
     // The APU runs at 2MHz, so it only updates every 8 cycles.
-    while (audio_clock / 8 < updated_clock / 8) {
+    u64 ticks = updated_clock / 8 - audio_clock / 8;
+    while (ticks > 0) {
         audio_clock += 8;
+        ticks -= 1;
+
+        square1.Update(GetFrameSequencer(), wave_ram);
+        square2.Update(GetFrameSequencer(), wave_ram);
+        wave.Update(GetFrameSequencer(), wave_ram);
+        noise.Update(GetFrameSequencer(), wave_ram);
 
         int left_sample = 0;
         int right_sample = 0;
+        if (output_enabled) {
+            std::tie(left_sample, right_sample) = MixSample();
+        }
 
-        for (int f = 0; f < 2; ++f) {
-            const int fifo_sample = (fifos[f].ReadCurrentSample(audio_clock) << 2) >> FifoVolume(f);
+        // Until the next FIFO sample, frame sequencer step, or channel timer reload, the only thing that changes on
+        // each tick is the channel timers, so the following samples are all the same as the one just mixed.
+        const u64 quiet_ticks = std::min(ticks, QuietTicks());
+        if (quiet_ticks > 0) {
+            audio_clock += quiet_ticks * 8;
+            square1.AdvanceTimer(quiet_ticks);
+            square2.AdvanceTimer(quiet_ticks);
+            wave.AdvanceTimer(quiet_ticks);
+            noise.AdvanceTimer(quiet_ticks);
+            ticks -= quiet_ticks;
+        }
 
-            if (FifoEnabledLeft(f)) {
-                left_sample += fifo_sample;
-            }
+        QueueSamples(left_sample, right_sample, 1 + quiet_ticks);
+    }
 
-            if (FifoEnabledRight(f)) {
-                right_sample += fifo_sample;
-            }
+    audio_clock = updated_clock;
+}
+
+std::tuple<int, int> Audio::MixSample() {
+    int left_sample = 0;
+    int right_sample = 0;
+
+    for (int f = 0; f < 2; ++f) {
+        const int fifo_sample = (fifos[f].ReadCurrentSample(audio_clock) << 2) >> FifoVolume(f);
+
+        if (FifoEnabledLeft(f)) {
+            left_sample += fifo_sample;
         }
 
-        square1.Update(GetFrameSequencer(), wave_ram);
-        square2.Update(GetFrameSequencer(), wave_ram);
-        wave.Update(GetFrameSequencer(), wave_ram);
-        noise.Update(GetFrameSequencer(), wave_ram);
+        if (FifoEnabledRight(f)) {
+            right_sample += fifo_sample;
+        }
+    }
+
+    const int sample_square1 = square1.GenSample();
+    const int sample_square2 = square2.GenSample();
+    const int sample_wave = wave.GenSample();
+    const int sample_noise = noise.GenSample();
 
-        const int sample_square1 = square1.GenSample();
-        const int sample_square2 = square2.GenSample();
-        const int sample_wave = wave.GenSample();
-        const int sample_noise = noise.GenSample();
+    int left_psg_sample = 0;
+    int right_psg_sample = 0;
 
-        int left_psg_sample = 0;
-        int right_psg_sample = 0;
+    const u8 enabled_channels = PsgEnabledChannels();
 
-        const u8 enabled_channels = PsgEnabledChannels();
+    if (square1.EnabledLeft(enabled_channels))  { left_psg_sample += sample_square1; }
+    if (square1.EnabledRight(enabled_channels)) { right_psg_sample += sample_square1; }
+    if (square2.EnabledLeft(enabled_channels))  { left_psg_sample += sample_square2; }
+    if (square2.EnabledRight(enabled_channels)) { right_psg_sample += sample_square2; }
+    if (wave.EnabledLeft(enabled_channels))     { left_psg_sample += sample_wave; }
+    if (wave.EnabledRight(enabled_channels))    { right_psg_sample += sample_wave; }
+    if (noise.EnabledLeft(enabled_channels))    { left_psg_sample += sample_noise; }
+    if (noise.EnabledRight(enabled_channels))   { right_psg_sample += sample_noise; }
 
-        if (square1.EnabledLeft(enabled_channels))  { left_psg_sample += sample_square1; }
-        if (square1.EnabledRight(enabled_channels)) { right_psg_sample += sample_square1; }
-        if (square2.EnabledLeft(enabled_channels))  { left_psg_sample += sample_square2; }
-        if (square2.EnabledRight(enabled_channels)) { right_psg_sample += sample_square2; }
-        if (wave.EnabledLeft(enabled_channels))     { left_psg_sample += sample_wave; }
-        if (wave.EnabledRight(enabled_channels))    { right_psg_sample += sample_wave; }
-        if (noise.EnabledLeft(enabled_channels))    { left_psg_sample += sample_noise; }
-        if (noise.EnabledRight(enabled_channels))   { right_psg_sample += sample_noise; }
+    left_psg_sample *= PsgVolumeLeft() + 1;
+    right_psg_sample *= PsgVolumeRight() + 1;
 
-        left_psg_sample *= PsgVolumeLeft() + 1;
-        right_psg_sample *= PsgVolumeRight() + 1;
+    left_sample += left_psg_sample >> PsgMixerVolume();
+    right_sample += right_psg_sample >> PsgMixerVolume();
 
-        left_sample += left_psg_sample >> PsgMixerVolume();
-        right_sample += right_psg_sample >> PsgMixerVolume();
+    return {ClampSample(left_sample), ClampSample(right_sample)};
+}
 
-        left_sample = ClampSample(left_sample);
-        right_sample = ClampSample(right_sample);
+u64 Audio::QuietTicks() const {
+    // The frame sequencer steps every 4096 ticks. The channels only look for edges on its clock bits, which they
+    // have already seen for the current step during the last tick.
+    u64 quiet_ticks = (0x7FFF - (audio_clock & 0x7FFF)) / 8;
+
+    for (const Fifo& fifo : fifos) {
+        quiet_ticks = std::min(quiet_ticks, fifo.TicksUntilNextSample(audio_clock));
+    }
 
-        resample_buffer[sample_count * interpolation_factor / 2] = Common::Vec4f{left_sample, right_sample};
-        sample_count += 1;
+    quiet_ticks = std::min<u64>(quiet_ticks, square1.TicksUntilTimerReload());
+    quiet_ticks = std::min<u64>(quiet_ticks, square2.TicksUntilTimerReload());
+    quiet_ticks = std::min<u64>(quiet_ticks, wave.TicksUntilTimerReload());
+    quiet_ticks = std::min<u64>(quiet_ticks, noise.TicksUntilTimerReload());
+
+    return quiet_ticks;
+}
+
+void Audio::QueueSamples(int left_sample, int right_sample, int count) {
+    // Frames which are only run ahead must not reach the host, or disturb the filters.
+    if (!output_enabled || core.AudioSuppressed()) {
+        return;
+    }
+
+    while (count > 0) {
+        const int span_end = std::min(sample_count + count, samples_per_frame);
+        if (enable_blip) {
+            // The blip buffer only records changes in amplitude.
+            blip.SetAmplitude(sample_count, left_sample, right_sample);
+        } else {
+            for (int i = sample_count; i < span_end; ++i) {
+                if (enable_fir) {
+                    fir.Store(i, left_sample, right_sample);
+                } else {
+                    resampler.Store(i, left_sample, right_sample);
+                }
+                if (Common::IirResampler::EndsBlock(i)) {
+                    FilterBlock(i);
+                }
+            }
+        }
+
+        count -= span_end - sample_count;
+        sample_count = span_end;
 
         if (sample_count == samples_per_frame) {
             Resample();
+            if (enable_blip) {
+                SendChunk(800);
+            }
             sample_count = 0;
         }
     }
-
-    audio_clock = updated_clock;
 }
 
 void Audio::Resample() {
-    Common::Biquad::LowPassFilter(resample_buffer, biquad);
+    const auto bench_timer = core.bench.Time(Common::BenchStats::Audio);
+    core.counters.Add(Common::PerfCounters::Resamples);
+    if (core.tracer != nullptr) {
+        core.tracer->Begin(Common::Tracer::Audio, "resample", core.scheduler.Timestamp());
+    }
 
-    for (int i = 0; i < 800; ++i) {
-        const bool index_is_even = (i * decimation_factor) % 2 == 0;
-        auto [left_sample, right_sample] = resample_buffer[i * decimation_factor / 2].UnpackSamples(index_is_even);
+    // The IIR and FIR filters have already written the frame's output block by block.
+    if (enable_blip) {
+        blip.ReadFrame(output_buffer);
+    }
 
-        output_buffer[i * 2] = left_sample * 4;
-        output_buffer[i * 2 + 1] = right_sample * 4;
+    if (core.tracer != nullptr) {
+        core.tracer->End(Common::Tracer::Audio, "resample", core.scheduler.Timestamp());
     }
 
     core.PushBackAudio(output_buffer);
-    std::fill(resample_buffer.begin(), resample_buffer.end(), Common::Vec4f{0.0f, 0.0f});
 }
 
-int Audio::NextEvent() {
-    const int remaining_samples = samples_per_frame - sample_count;
+void Audio::FilterBlock(int last_sample) {
+    {
+        const auto bench_timer = core.bench.Time(Common::BenchStats::Audio);
+        if (enable_fir) {
+            fir.FilterBlock(last_sample, output_buffer);
+        } else {
+            resampler.FilterBlock(last_sample, output_buffer);
+        }
+    }
+
+    SendChunk((last_sample % samples_per_frame + 1) * 800 / samples_per_frame);
+}
+
+void Audio::SendChunk(int ready) {
+    // The IIR and FIR filters are ready a block at a time, so chunks are rounded up to whole blocks. Blip isn't
+    // ready until the end of the frame.
+    if (chunk_frontend == nullptr || (ready - chunk_sent < chunk_samples && ready != 800)) {
+        return;
+    }
+
+    chunk_frontend->PushBackAudioChunk(&output_buffer[chunk_sent * 2], ready - chunk_sent);
+    chunk_sent = ready % 800;
+}
+
+void Audio::Sync() {
+    Update(core.scheduler.Elapsed(Event::Audio));
+    core.scheduler.ScheduleIn(Event::Audio, NextEvent());
+}
+
+int Audio::NextEvent() const {
+    int remaining_samples = samples_per_frame - sample_count;
+    if (chunk_frontend != nullptr && output_enabled) {
+        // Wake up for each chunk, so it's sent on time even if nothing else updates the APU.
+        remaining_samples = std::min(remaining_samples, chunk_samples * (samples_per_frame / 800));
+    }
     int next_event_cycles = remaining_samples * 8 - audio_clock % 8;
+    const u64 timestamp = core.scheduler.Timestamp();
 
-    for (int f = 0; f < 2; ++f) {
+    // FIFO samples only need to be mixed on time if there's output to mix them into.
+    for (int f = 0; f < 2 && output_enabled; ++f) {
         const int fifo_timer = FifoTimerSelect(f);
-        const int next_timer_event_cycles =
-            core.next_timer_event_cycles[fifo_timer] - core.timer_cycle_counter[fifo_timer];
+        const u64 timer_deadline = core.scheduler.Deadline(TimerEvent(fifo_timer));
 
-        if (next_timer_event_cycles != 0) {
-            next_event_cycles = std::min(next_event_cycles, next_timer_event_cycles);
+        if (timer_deadline > timestamp && timer_deadline - timestamp < static_cast<u64>(next_event_cycles)) {
+            next_event_cycles = timer_deadline - timestamp;
         }
 
         if (fifo_timer == FifoTimerSelect(1)) {
@@ -154,9 +291,7 @@ int Audio::NextEvent() {
 }
 
 u16 Audio::ReadSoundOn() {
-    Update(core.audio_cycle_counter);
-    core.audio_cycle_counter = 0;
-    core.next_audio_event_cycles = NextEvent();
+    Sync();
 
     return sound_on | square1.EnabledFlag() | square2.EnabledFlag() | wave.EnabledFlag() | noise.EnabledFlag();
 }
@@ -187,7 +322,12 @@ void Audio::ConsumeSample(int f, u64 timer_clock) {
         return;
     }
 
-    fifos[f].PopSample(timer_clock);
+    if (output_enabled) {
+        fifos[f].PopSample(timer_clock);
+    } else {
+        // The sample would never be played, but taking it out of the FIFO still decides when DMA refills it.
+        fifos[f].DropSample();
+    }
 
     if (fifos[f].NeedsMoreSamples()) {
         for (int i = 1; i < 3; ++i) {
@@ -230,6 +370,16 @@ s32 Fifo::ReadCurrentSample(u64 audio_clock) {
     return playing_sample;
 }
 
+u64 Fifo::TicksUntilNextSample(u64 audio_clock) const {
+    if (play_queue.Size() == 0) {
+        return std::numeric_limits<u64>::max();
+    }
+
+    // The number of ticks before the one on which the queued sample starts playing.
+    const u64 start_time = play_queue.Read().second;
+    return (start_time > audio_clock) ? (start_time - audio_clock - 1) / 8 : 0;
+}
+
 void Fifo::PopSample(u64 timer_clock) {
     if (fifo_buffer.Size() == 0) {
         // Play silence if the fifo is empty.
@@ -243,6 +393,12 @@ void Fifo::PopSample(u64 timer_clock) {
     play_queue.PushBack({sample, timer_clock});
 }
 
+void Fifo::DropSample() {
+    if (fifo_buffer.Size() != 0) {
+        fifo_buffer.PopFront();
+    }
+}
+
 void Fifo::Write(u16 data, u16 mask_8bit) {
     if (fifo_buffer.Size() == fifo_length) {
         // The fifo is full.
@@ -272,7 +428,7 @@ void Fifo::Reset() {
 }
 
 void Audio::WriteSoundRegs(const u32 addr, const u16 data, const u16 mask) {
-    Update(core.audio_cycle_counter);
+    Update(core.scheduler.Elapsed(Event::Audio));
 
     const bool write_low_byte = (mask & 0x00FF) == 0x00FF;
     const bool write_high_byte = (mask & 0xFF00) == 0xFF00;
@@ -310,8 +466,7 @@ void Audio::WriteSoundRegs(const u32 addr, const u16 data, const u16 mask) {
             break;
         }
 
-        core.audio_cycle_counter = 0;
-        core.next_audio_event_cycles = NextEvent();
+        core.scheduler.ScheduleIn(Event::Audio, NextEvent());
 
         return;
     }
@@ -424,8 +579,26 @@ void Audio::WriteSoundRegs(const u32 addr, const u16 data, const u16 mask) {
         break;
     }
 
-    core.audio_cycle_counter = 0;
-    core.next_audio_event_cycles = NextEvent();
+    core.scheduler.ScheduleIn(Event::Audio, NextEvent());
+}
+
+void Audio::SerializeState(Common::State& state) {
+    // The resampling and filtering state only affects host output, so it's left running.
+    state.Sync(psg_control, fifo_control, sound_on, soundbias, square1, square2, wave, noise, wave_ram, fifos,
+               audio_clock);
+}
+
+void Audio::SerializeMixer(Common::State& state) {
+    state.Sync(sample_count, chunk_sent, resampler, fir, blip);
+}
+
+void Audio::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("audio", sizeof(Audio));
+    report.Add("audio", resampler.Bytes() + fir.Bytes() + blip.Bytes());
+}
+
+void Fifo::SerializeState(Common::State& state) {
+    state.Sync(fifo_buffer, play_queue, playing_sample);
 }
 
 } // End namespace Gba
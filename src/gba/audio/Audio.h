@@ -19,14 +19,20 @@
 #include <array>
 #include <vector>
 #include <numeric>
+#include <tuple>
 
 #include "common/CommonTypes.h"
 #include "common/Vec4f.h"
 #include "common/RingBuffer.h"
-#include "common/Biquad.h"
+#include "common/Resampler.h"
+#include "common/BlipBuffer.h"
+#include "common/CommonEnums.h"
+#include "common/MemoryReport.h"
 #include "gba/memory/IOReg.h"
 #include "gb/audio/Channel.h"
 
+namespace Emu { class Frontend; }
+
 namespace Gba {
 
 class Core;
@@ -34,9 +40,15 @@ class Core;
 class Fifo {
 public:
     s32 ReadCurrentSample(u64 audio_clock);
+    // The number of 8-cycle ticks after audio_clock during which the playing sample stays the same.
+    u64 TicksUntilNextSample(u64 audio_clock) const;
     void PopSample(u64 timer_clock);
+    void DropSample();
     void Write(u16 data, u16 mask_8bit);
+    // Pushes a sound DMA's words in one go. As with Write, whatever doesn't fit is dropped.
+    void WriteBlock(const s8* samples, int count) { fifo_buffer.PushBack(samples, count); }
     void Reset();
+    void SerializeState(Common::State& state);
     bool NeedsMoreSamples() const { return fifo_buffer.Size() <= 16; }
 
 private:
@@ -51,7 +63,9 @@ private:
 
 class Audio {
 public:
-    explicit Audio(Core& _core);
+    // With a chunk frontend, the output is sent to it as soon as each chunk is mixed, instead of a frame at a time
+    // through the core.
+    Audio(AudioFilter _filter, Core& _core, Emu::Frontend* _chunk_frontend);
     ~Audio();
 
     IOReg psg_control  = {0x0000, 0xFF77, 0xFF77};
@@ -70,8 +84,13 @@ public:
     std::array<s16, 1600> output_buffer;
 
     void Update(int cycles);
+    void Sync();
     void ConsumeSample(int f, u64 timer_clock);
-    int NextEvent();
+    int NextEvent() const;
+    void SerializeState(Common::State& state);
+    // The host-side mixer, which savestates leave out.
+    void SerializeMixer(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
 
     void WriteSoundRegs(const u32 addr, const u16 data, const u16 mask);
 
@@ -80,24 +99,38 @@ public:
     void WriteFifoControl(u16 data, u16 mask);
     int FifoTimerSelect(int f) const { return (fifo_control >> (10 + 4 * f)) & 0x1; }
 
+    bool SendsChunks() const { return chunk_frontend != nullptr; }
+
 private:
     Core& core;
 
     int sample_count = 0;
     u64 audio_clock = 0;
 
-    static constexpr int samples_per_frame = 34960;
-    static constexpr int interpolated_buffer_size = std::lcm(800, samples_per_frame);
-    static constexpr int interpolation_factor = interpolated_buffer_size / samples_per_frame;
-    static constexpr int decimation_factor = interpolated_buffer_size / 800;
-    std::vector<Common::Vec4f> resample_buffer;
+    static constexpr int samples_per_frame = Common::IirResampler::input_samples_per_frame;
+    // Nothing is mixed without output, but the channels still run for their guest-visible state.
+    const bool output_enabled;
+    // There's no nearest-neighbour path for the GBA, so that option uses the IIR filter.
+    const bool enable_blip;
+    const bool enable_fir;
+    Common::IirResampler resampler;
+    Common::FirResampler fir;
 
-    // Q values are for a 4th order cascaded Butterworth lowpass filter.
-    // Obtained from http://www.earlevel.com/main/2016/09/29/cascading-filters/.
-    static constexpr std::array<float, 2> q{0.54119610f, 1.3065630f};
-    Common::Biquad biquad{interpolated_buffer_size, q[0], q[1]};
+    // Scaled to match the volume of the IIR filter's output.
+    Common::BlipBuffer blip;
 
+    std::tuple<int, int> MixSample();
+    u64 QuietTicks() const;
+    void QueueSamples(int left_sample, int right_sample, int count);
+
+    void FilterBlock(int last_sample);
     void Resample();
+
+    Emu::Frontend* const chunk_frontend;
+    const int chunk_samples;
+    // The output samples before this one have been sent this frame.
+    int chunk_sent = 0;
+    void SendChunk(int ready);
     int ClampSample(int sample) const;
 
     u64 GetFrameSequencer() const { return audio_clock >> 15; }
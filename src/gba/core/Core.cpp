@@ -15,10 +15,18 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <utility>
+#include <fmt/format.h>
 
 #include "gba/core/Core.h"
 #include "gba/memory/Memory.h"
 #include "gba/cpu/Cpu.h"
+#include "gba/cpu/BlockCache.h"
+#include "gba/cpu/Jit.h"
 #include "gba/cpu/Disassembler.h"
 #include "gba/lcd/Lcd.h"
 #include "gba/audio/Audio.h"
@@ -26,159 +34,896 @@
 #include "gba/hardware/Dma.h"
 #include "gba/hardware/Keypad.h"
 #include "gba/hardware/Serial.h"
-#include "emu/SdlContext.h"
+#include "emu/Frontend.h"
 #include "common/Screenshot.h"
+#include "common/AvRecorder.h"
+#include "common/Metrics.h"
+#include "common/Tracer.h"
+#include "common/SaveState.h"
+#include "common/FileWriter.h"
+#include "common/Rewind.h"
+#include "common/Movie.h"
+#include "common/Netplay.h"
+#include "common/RamDelta.h"
+#include "common/StepTarget.h"
 
 namespace Gba {
 
-Core::Core(Emu::SdlContext& context, const std::vector<u32>& bios, const std::vector<u16>& rom,
-           const std::string& save_path, LogLevel level)
-        : mem(std::make_unique<Memory>(bios, rom, save_path, *this))
-        , cpu(std::make_unique<Cpu>(*mem, *this))
-        , disasm(std::make_unique<Disassembler>(level, *this))
-        , lcd(std::make_unique<Lcd>(mem->PramReference(), mem->VramReference(), mem->OamReference(), *this))
-        , audio(std::make_unique<Audio>(*this))
-        , timers{{0, *this}, {1, *this}, {2, *this}, {3, *this}}
-        , dma{{0, *this}, {1, *this}, {2, *this}, {3, *this}}
+Core::Core(Emu::Frontend& _frontend, const std::vector<u32>& bios, const Common::RomVector<u16>& rom,
+           const std::string& save_path, LogLevel level, LogOverflow log_overflow, ExecMode exec_mode,
+           AudioFilter audio_filter, int frame_skip_setting, bool lcd_thread, bool line_cache, bool hle_bios,
+           int bench_frames, int profile_interval, const std::string& trace_path,
+           const Common::TraceTrigger& trace_trigger,
+           const Common::RewindSettings& rewind_settings, int _run_ahead_frames,
+           const Common::MovieSettings& movie_settings, const Common::SaveSettings& save_settings,
+           const Common::ScreenshotSettings& screenshot_settings,
+           const Common::RecordSettings& record_settings, const Common::LinkSettings& link_settings,
+           const Common::NetplaySettings& netplay_settings,
+           const Common::RtcSettings& rtc_settings, Common::HugePages huge_pages,
+           const Common::MetricsSettings& metrics_settings, const Common::WatchdogSettings& watchdog_settings,
+           bool ideal_prefetch, bool skip_bios)
+        : mem(std::make_unique<Memory>(bios, rom, save_path, save_settings, huge_pages, *this, ideal_prefetch))
+        , cpu(std::make_unique<Cpu>(*mem, *this, hle_bios))
+        , block_cache((exec_mode != ExecMode::Interpreter) ? std::make_unique<BlockCache>(*cpu, *mem) : nullptr)
+        , jit((exec_mode == ExecMode::Jit && Jit::host_supported) ? std::make_unique<Jit>(*block_cache) : nullptr)
+        , disasm(std::make_unique<Disassembler>(level, log_overflow, trace_trigger, *this))
+        , lcd(std::make_unique<Lcd>(mem->RamReference(), *this, lcd_thread, line_cache))
+        , audio(std::make_unique<Audio>(audio_filter, *this,
+                                        (_frontend.AudioChunkSamples() != 0) ? &_frontend : nullptr))
         , keypad(std::make_unique<Keypad>(*this))
-        , serial(std::make_unique<Serial>(*this))
-        , sdl_context(context)
-        , front_buffer(Lcd::h_pixels * Lcd::v_pixels, 0x7FFF) {
+        , serial(std::make_unique<Serial>(*this, link_settings))
+        , timers{{{0, *this}, {1, *this}, {2, *this}, {3, *this}}}
+        , dma{{{0, *this}, {1, *this}, {2, *this}, {3, *this}}}
+        , netplay(netplay_settings.Enabled()
+                          ? std::make_unique<Common::Netplay>(netplay_settings,
+                                                              Common::XxHash64::Hash(rom.data(), rom.size() * 2))
+                          : nullptr)
+        , rtc_source((netplay != nullptr) ? netplay->RtcStart()
+                                          : Common::MovieRtcStart(movie_settings, rtc_settings))
+        , bench(bench_frames)
+        , watchdog(watchdog_settings)
+        , profiler((profile_interval != 0) ? std::make_unique<Common::PcProfiler>(profile_interval) : nullptr)
+        , tracer(!trace_path.empty() ? std::make_unique<Common::Tracer>(trace_path) : nullptr)
+        , rewind((rewind_settings.budget != 0) ? std::make_unique<Common::RewindBuffer>(rewind_settings) : nullptr)
+        , recorder(record_settings.Enabled()
+                           ? std::make_unique<Common::AvRecorder>(record_settings, Lcd::h_pixels, Lcd::v_pixels,
+                                                                         16777216, cycles_per_frame)
+                           : nullptr)
+        , metrics(metrics_settings.Enabled() ? std::make_unique<Common::MetricsServer>(metrics_settings, "gba")
+                                             : nullptr)
+        , frontend(_frontend)
+        , front_buffer(Lcd::h_pixels * Lcd::v_pixels, 0x7FFF)
+        , front_frame(front_buffer.data())
+        , image_encoder(std::make_unique<Common::ImageEncoder>(screenshot_settings))
+        , frame_skip(frame_skip_setting)
+        , state_path(Common::StatePath(save_path))
+        , run_ahead_frames(_run_ahead_frames)
+        , lend_frames(run_ahead_frames == 0 && !line_cache) {
+
+    mem->PopulateIOTables();
+    scheduler.ScheduleIn(Event::Lcd, lcd->NextEvent());
+    scheduler.ScheduleIn(Event::Audio, audio->NextEvent());
+    serial->PollLink();
+    if (skip_bios) {
+        SkipBios();
+    }
 
     RegisterCallbacks();
+    StartMovie(movie_settings);
 }
 
 // Needed to declare std::unique_ptr with forward-declared type in the header file.
 Core::~Core() = default;
 
 void Core::EmulatorLoop() {
-    constexpr int cycles_per_frame = 279680;
-    int overspent_cycles = 0;
-
     using namespace std::chrono;
     auto max_frame_time = 0us;
     auto avg_frame_time = 0us;
     int frame_count = 0;
 
-    sdl_context.UnpauseAudio();
+    frontend.UnpauseAudio();
+    bench.Start();
 
     while (!quit) {
         const auto start_time = steady_clock::now();
 
-        sdl_context.PollEvents();
+        frontend.PollEvents();
 
         if (pause && !frame_advance) {
-            SDL_Delay(48);
-            sdl_context.RenderFrame(front_buffer.data());
+            // Nothing changes while paused unless a state is loaded, so sleep until there's more input rather than
+            // presenting the same frame over and over.
+            if (new_frame) {
+                frontend.RenderFrame(front_frame, std::exchange(new_frame, false));
+            }
+            // A quit which was just polled has no more events coming after it to end the wait.
+            if (!quit) {
+                frontend.WaitForEvents();
+            }
             continue;
         }
 
         frame_advance = false;
 
-        keypad->CheckKeypadInterrupt();
+        if (rewinding && rewind != nullptr && !MovieActive()) {
+            RewindFrame();
+            continue;
+        }
 
-        // Overspent cycles is always zero or negative.
-        int target_cycles = cycles_per_frame + overspent_cycles;
-        overspent_cycles = cpu->Execute(target_cycles);
+        input_latch_armed = !MovieActive() && netplay == nullptr;
+        input_time = start_time;
+        EmulateFrame();
+        input_latch_armed = false;
+        if (watchdog.Tripped()) {
+            throw std::runtime_error("The CPU has hung. Reason: " + watchdog.Reason());
+        }
 
         auto frame_time = duration_cast<microseconds>(steady_clock::now() - start_time);
+        frame_skip.ReportFrameTime(frame_time);
+        frame_stats.Record(Common::FrameTimeStats::Emulate, frame_time);
         max_frame_time = std::max(max_frame_time, frame_time);
         avg_frame_time += frame_time;
         if (++frame_count == 60) {
-            sdl_context.UpdateFrameTimes(avg_frame_time.count() / 60, max_frame_time.count());
+            std::string extra_info;
+            if (lcd->LineCacheEnabled()) {
+                extra_info = fmt::format(" - {:.0f}% lines reused", lcd->TakeLineReuseRatio() * 100);
+            }
+            if (counters.enabled) {
+                extra_info += counters.Summary();
+            }
+            frontend.UpdateFrameTimes(avg_frame_time.count() / 60, max_frame_time.count(), extra_info);
+            if (metrics != nullptr) {
+                metrics->Publish(60, counters, frame_stats, frontend.AudioUnderruns(), mem->SaveFlushes());
+            }
             max_frame_time = 0us;
             avg_frame_time = 0us;
             frame_count = 0;
         }
 
-        sdl_context.RenderFrame(front_buffer.data());
+        if (run_ahead_frames != 0) {
+            RunAhead();
+        }
+
+        if (tracer != nullptr) {
+            tracer->Begin(Common::Tracer::Host, "present", scheduler.Timestamp());
+        }
+        const auto present_time = steady_clock::now();
+        {
+            const auto bench_timer = bench.Time(Common::BenchStats::Present);
+            frontend.RenderFrame((run_ahead_frames != 0) ? run_ahead_frame.data() : front_frame,
+                                 std::exchange(new_frame, false));
+        }
+        frame_stats.Record(Common::FrameTimeStats::Present,
+                           duration_cast<microseconds>(steady_clock::now() - present_time));
+        frame_stats.Record(Common::FrameTimeStats::InputLatency,
+                           duration_cast<microseconds>(present_time - input_time) + frame_stats.display_refresh);
+        if (tracer != nullptr) {
+            tracer->End(Common::Tracer::Host, "present", scheduler.Timestamp());
+        }
+
+        if (bench.FrameDone()) {
+            quit = true;
+        }
+    }
+
+    frontend.PauseAudio();
+
+    if (bench.Enabled()) {
+        lcd->SyncRender();
+        bench.PrintReport("gba", true);
+    }
+
+    if (profiler != nullptr) {
+        disasm->DumpProfile(*profiler);
+    }
+
+    if (!suspend_path.empty()) {
+        Suspend();
+    }
+}
+
+void Core::RunFrame() {
+    RunFrames(1);
+}
+
+void Core::RunFrames(int count) {
+    frontend.PollEvents();
+    for (int i = 0; i < count; ++i) {
+        // As with run-ahead, whether a frame is drawn is decided at the vblank before it.
+        suppress_video = i < count - 3;
+        EmulateFrame();
+        hooks.FrameEnded();
+    }
+    suppress_video = false;
+
+    if (run_ahead_frames != 0) {
+        RunAhead();
+    }
+
+    frontend.RenderFrame((run_ahead_frames != 0) ? run_ahead_frame.data() : front_frame,
+                         std::exchange(new_frame, false));
+}
+
+void Core::RunUntil(u64 cycle) {
+    StepTo(cycle);
+}
+
+bool Core::RunUntilEvent(const Common::StepTarget& target, u64 max_cycles) {
+    bool reached = false;
+    {
+        const Common::StepHook step_hook{hooks, target, [this, &reached] {
+            reached = true;
+            cpu->stop_requested = true;
+        }};
+        if (target.type == Common::StepTarget::Type::Pc) {
+            HooksChanged();
+        }
+        StepTo(scheduler.Timestamp() + max_cycles);
+    }
+    if (target.type == Common::StepTarget::Type::Pc) {
+        HooksChanged();
+    }
+
+    return reached;
+}
+
+void Core::StepTo(u64 end_cycle) {
+    frontend.PollEvents();
+    while (scheduler.Timestamp() < end_cycle && !cpu->stop_requested) {
+        if (!mid_frame && !BeginFrame()) {
+            break;
+        }
+
+        const int slice_cycles = static_cast<int>(std::min<u64>(frame_cycles_left, end_cycle - scheduler.Timestamp()));
+        {
+            const auto bench_timer = bench.Time(Common::BenchStats::Cpu);
+            frame_cycles_left += cpu->Execute(slice_cycles) - slice_cycles;
+        }
+        if (frame_cycles_left <= 0) {
+            EndFrame();
+            hooks.FrameEnded();
+        }
     }
+    cpu->stop_requested = false;
+
+    frontend.RenderFrame(front_frame, std::exchange(new_frame, false));
+}
 
-    sdl_context.PauseAudio();
+void Core::HooksChanged() {
+    mem->HooksChanged();
+    cpu->HooksChanged();
 }
 
-void Core::UpdateHardware(int cycles) {
-    lcd_cycle_counter += cycles;
-    if (lcd_cycle_counter >= next_lcd_event_cycles) {
-        lcd->Update(lcd_cycle_counter);
-        lcd_cycle_counter = 0;
-        next_lcd_event_cycles = lcd->NextEvent();
+void Core::SetCheats(const std::vector<Common::Cheat>& new_cheats) {
+    cheats = new_cheats;
+
+    std::vector<Common::Cheat> rom_patches;
+    for (const auto& cheat : cheats) {
+        if (cheat.type == Common::Cheat::Type::RomPatch) {
+            rom_patches.push_back(cheat);
+        }
     }
+    mem->PatchRom(rom_patches);
+    cpu->RomPatched();
+}
+
+void Core::SetBreakpoints(const std::vector<Common::Breakpoint>& breakpoints) {
+    using Type = Common::Breakpoint::Type;
+    u32 irq_mask = 0;
+    for (const auto& point : breakpoints) {
+        if (point.type == Type::Exec) {
+            hooks.exec[point.low] = [this](u32 addr) { Break(fmt::format("PC 0x{:0>8X}", addr)); };
+            continue;
+        } else if (point.type == Type::Irq) {
+            irq_mask |= point.low;
+            continue;
+        }
 
-    for (int i = 0; i < 4; ++i) {
-        auto& timer = timers[i];
-        if (timer.TimerNotRunning()) {
-            timer.InactiveTick(cycles);
-        } else {
-            timer_cycle_counter[i] += cycles;
+        const bool write = point.type == Type::Write;
+        for (u64 addr = point.low; addr <= point.high; ++addr) {
+            Common::Hooks::Region region;
+            u32 base;
+            u32 offset;
+            if ((addr >> 24) == (BaseAddr::XRam >> 24)) {
+                region = Common::Hooks::Wram;
+                base = BaseAddr::XRam;
+                offset = static_cast<u32>(addr % sizeof(GuestRam::xram));
+            } else if ((addr >> 24) == (BaseAddr::IRam >> 24)) {
+                region = Common::Hooks::FastRam;
+                base = BaseAddr::IRam;
+                offset = static_cast<u32>(addr % sizeof(GuestRam::iram));
+            } else {
+                throw std::runtime_error(fmt::format("Can't watch 0x{:0>8X}, only EWRAM and IWRAM can be watched.",
+                                                     addr));
+            }
 
-            if (timer_cycle_counter[i] >= next_timer_event_cycles[i]) {
-                timer.Tick(timer_cycle_counter[i]);
-                timer_cycle_counter[i] = 0;
-                next_timer_event_cycles[i] = timer.NextEvent();
+            auto& watched = write ? hooks.writes[region] : hooks.reads[region];
+            watched[offset] = [this, write, base](u32 hook_offset) {
+                Break(fmt::format("{} of 0x{:0>8X}", write ? "write" : "read", base + hook_offset));
+            };
+        }
+    }
+
+    if (irq_mask != 0) {
+        hooks.irq_taken = [this, irq_mask](u32 interrupt_mask) {
+            if (interrupt_mask & irq_mask) {
+                Break(fmt::format("IRQ 0x{:0>4X}", interrupt_mask));
             }
+        };
+    }
+
+    HooksChanged();
+}
+
+void Core::StreamRamDeltas(const std::string& path, bool compress) {
+    const GuestRam& ram = mem->RamReference();
+    ram_deltas = std::make_unique<Common::RamDeltaWriter>(path, compress, std::vector<Common::RamDeltaWriter::Region>{
+        {reinterpret_cast<const u8*>(ram.xram.data()), sizeof(ram.xram)},
+        {reinterpret_cast<const u8*>(ram.iram.data()), sizeof(ram.iram)},
+    });
+}
+
+void Core::ExportAccessCounts(const std::string& prefix) const {
+    access_counters.Export(prefix, [](u32 addr) -> std::string {
+        static constexpr std::array<const char*, 16> region_names{{
+            "bios", "unused", "ewram", "iwram", "io", "palette", "vram", "oam",
+            "rom_ws0", "rom_ws0", "rom_ws1", "rom_ws1", "rom_ws2", "rom_ws2", "sram", "sram"
+        }};
+        return (addr >> 24 < region_names.size()) ? region_names[addr >> 24] : "unmapped";
+    });
+}
+
+void Core::EnableCodeCoverage() {
+    if (code_coverage == nullptr) {
+        code_coverage = std::make_unique<Common::CodeCoverage>(mem->CodeSlots());
+    }
+}
+
+void Core::WriteCoverageReport(const std::string& path) {
+    if (code_coverage != nullptr) {
+        disasm->WriteCoverageReport(*code_coverage, path);
+    }
+}
+
+void Core::EnableSuspend(const std::string& path) {
+    if (path.empty() || MovieActive() || netplay != nullptr) {
+        return;
+    }
+
+    suspend_path = path;
+    try {
+        if (Common::ReadSuspendFile(suspend_path, state_buffer)) {
+            LoadState(state_buffer);
+            // The file is written again on exit. Until then, a session which crashes boots normally next time
+            // instead of resuming into the same state again.
+            std::remove(suspend_path.c_str());
+            fmt::print("Resumed from {}\n", suspend_path);
         }
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to resume: {}\n", error.what());
     }
+}
+
+void Core::Suspend() {
+    try {
+        SaveState(state_buffer);
+        Common::WriteSuspendFile(suspend_path, state_buffer);
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to suspend: {}\n", error.what());
+    }
+}
 
-    audio_cycle_counter += cycles;
-    if (audio_cycle_counter >= next_audio_event_cycles) {
-        audio->Update(audio_cycle_counter);
-        audio_cycle_counter = 0;
-        next_audio_event_cycles = audio->NextEvent();
+void Core::Break(const std::string& reason) {
+    // Also keeps the reads made while printing the break from breaking again.
+    if (break_hit) {
+        return;
     }
 
-    mem->DelayedSaveOp(cycles);
+    break_hit = true;
+    pause = true;
+    disasm->PrintBreak(reason);
 }
 
-int Core::HaltCycles(int remaining_cpu_cycles) const {
-    int halt_cycles = next_lcd_event_cycles - lcd_cycle_counter;
+void Core::SkipBios() {
+    cpu->SkipBios();
+    // POSTFLG marks the boot as done, and the BIOS raises the sound bias to its midpoint to avoid a pop later.
+    mem->WriteMem<u8>(HALTCNT, 0x01);
+    mem->WriteMem<u16>(SOUNDBIAS, 0x0200);
+}
+
+void Core::ApplyCheats() {
+    for (const auto& cheat : cheats) {
+        if (cheat.type != Common::Cheat::Type::RamWrite) {
+            continue;
+        }
+        if (cheat.condition && mem->ReadMem<u16>(cheat.condition->addr) != cheat.condition->value) {
+            continue;
+        }
+
+        switch (cheat.size) {
+        case 1:
+            mem->WriteMem<u8>(cheat.addr, static_cast<u8>(cheat.value));
+            break;
+        case 2:
+            mem->WriteMem<u16>(cheat.addr, static_cast<u16>(cheat.value));
+            break;
+        default:
+            mem->WriteMem<u32>(cheat.addr, cheat.value);
+            break;
+        }
+    }
+}
+
+void Core::PollLatchedInput() {
+    input_latch_armed = false;
+    input_time = std::chrono::steady_clock::now();
+    frontend.LatchInput();
+}
+
+void Core::EmulateFrame() {
+    // A frame left partway through by sub-frame stepping is finished rather than started again.
+    if (!mid_frame && !BeginFrame()) {
+        return;
+    }
+
+    {
+        const auto bench_timer = bench.Time(Common::BenchStats::Cpu);
+        frame_cycles_left = cpu->Execute(frame_cycles_left);
+    }
+    EndFrame();
+}
+
+bool Core::BeginFrame() {
+    if (netplay != nullptr && !NetplayFrame()) {
+        // Still waiting for the other player to catch up.
+        return false;
+    }
+    if (movie_index != nullptr && movie_index->KeyframeDue()) {
+        SaveState(state_buffer);
+        movie_index->AddKeyframe(state_buffer, overspent_cycles, held_buttons);
+    }
+    if (movie_reader != nullptr) {
+        PlayMovieFrame();
+    }
+    if (movie_writer != nullptr) {
+        movie_writer->Frame(held_buttons);
+    }
+    if (movie_index != nullptr) {
+        movie_index->Frame(held_buttons);
+    }
+
+    keypad->CheckKeypadInterrupt();
+    break_hit = false;
+    ApplyCheats();
+
+    // Overspent cycles is always zero or negative.
+    frame_target_cycles = cycles_per_frame + overspent_cycles;
+    frame_cycles_left = frame_target_cycles;
+    mid_frame = true;
+    disasm->FrameStarted();
+    if (tracer != nullptr) {
+        tracer->Begin(Common::Tracer::Frame, "frame", scheduler.Timestamp());
+    }
+    return true;
+}
+
+void Core::EndFrame() {
+    mid_frame = false;
+    overspent_cycles = frame_cycles_left;
+    rtc_source.FrameDone();
+    watchdog.FrameDone(!lcd->ForcedBlank());
+    if (tracer != nullptr) {
+        tracer->End(Common::Tracer::Frame, "frame", scheduler.Timestamp());
+    }
+    counters.EndFrame(frame_target_cycles - overspent_cycles);
+
+    if (image_encoder->FrameDumpDue()) {
+        lcd->SyncRender();
+    }
+    image_encoder->FrameDone(front_frame, Lcd::h_pixels, Lcd::v_pixels);
+    if (recorder != nullptr) {
+        recorder->Frame(front_frame, output_hash.FrameHash());
+    }
 
-    int next_event_cycles = next_audio_event_cycles - audio_cycle_counter;
-    if (next_event_cycles != 0) {
-        halt_cycles = std::min(halt_cycles, next_event_cycles);
+    if (rewind != nullptr && rewind->SnapshotDue()) {
+        SaveState(rewind_state);
+        rewind->Push(rewind_state);
+    }
+    if (ram_deltas != nullptr) {
+        ram_deltas->Frame();
     }
+    mem->FlushSaveData();
+}
 
-    for (int i = 0; i < 4; ++i) {
-        next_event_cycles = next_timer_event_cycles[i] - timer_cycle_counter[i];
-        if (next_event_cycles != 0) {
-            halt_cycles = std::min(halt_cycles, next_event_cycles);
+void Core::RunEvents() {
+    if (scheduler.EventDue(Event::Lcd)) {
+        lcd->Update(scheduler.Elapsed(Event::Lcd));
+        scheduler.ScheduleIn(Event::Lcd, lcd->NextEvent());
+    }
+
+    for (auto& timer : timers) {
+        if (scheduler.EventDue(TimerEvent(timer.id))) {
+            timer.Sync();
+            timer.ScheduleNextEvent();
         }
     }
 
-    return std::min(halt_cycles, remaining_cpu_cycles);
+    if (scheduler.EventDue(Event::Audio)) {
+        audio->Sync();
+    }
+
+    if (scheduler.EventDue(Event::Serial)) {
+        serial->FinishTransfer();
+    }
+
+    if (scheduler.EventDue(Event::LinkPoll)) {
+        serial->PollLink();
+    }
+
+    if (scheduler.EventDue(Event::SaveOp)) {
+        scheduler.Unschedule(Event::SaveOp);
+        mem->DelayedSaveOp();
+    }
+}
+
+int Core::HaltCycles(int remaining_cpu_cycles) const {
+    return std::min<u64>(scheduler.CyclesUntilNextEvent(), remaining_cpu_cycles);
 }
 
 void Core::PushBackAudio(const std::array<s16, 1600>& sample_buffer) {
-    sdl_context.PushBackAudio(sample_buffer);
+    output_hash.Audio(sample_buffer.data(), sample_buffer.size());
+    if (recorder != nullptr) {
+        recorder->Audio(sample_buffer.data(), sample_buffer.size());
+    }
+    if (!audio->SendsChunks()) {
+        frontend.PushBackAudio(sample_buffer);
+    }
 }
 
 void Core::RegisterCallbacks() {
     using Emu::InputEvent;
 
-    sdl_context.RegisterCallback(InputEvent::Quit,         [this](bool) { quit = true; });
-    sdl_context.RegisterCallback(InputEvent::Pause,        [this](bool) { pause = !pause; });
-    sdl_context.RegisterCallback(InputEvent::LogLevel,     [this](bool) { disasm->SwitchLogLevel(); });
-    sdl_context.RegisterCallback(InputEvent::Fullscreen,   [this](bool) { sdl_context.ToggleFullscreen(); });
-    sdl_context.RegisterCallback(InputEvent::Screenshot,   [this](bool) { Screenshot(); });
-    sdl_context.RegisterCallback(InputEvent::LcdDebug,     [this](bool) { lcd->DumpDebugInfo(); Screenshot(); });
-    sdl_context.RegisterCallback(InputEvent::HideWindow,   [this](bool) { old_pause = pause; pause = true; });
-    sdl_context.RegisterCallback(InputEvent::ShowWindow,   [this](bool) { pause = old_pause; });
-    sdl_context.RegisterCallback(InputEvent::FrameAdvance, [this](bool) { frame_advance = true; });
-
-    sdl_context.RegisterCallback(InputEvent::Up,     [this](bool press) { keypad->Press(Keypad::Up, press); });
-    sdl_context.RegisterCallback(InputEvent::Left,   [this](bool press) { keypad->Press(Keypad::Left, press); });
-    sdl_context.RegisterCallback(InputEvent::Down,   [this](bool press) { keypad->Press(Keypad::Down, press); });
-    sdl_context.RegisterCallback(InputEvent::Right,  [this](bool press) { keypad->Press(Keypad::Right, press); });
-    sdl_context.RegisterCallback(InputEvent::A,      [this](bool press) { keypad->Press(Keypad::A, press); });
-    sdl_context.RegisterCallback(InputEvent::B,      [this](bool press) { keypad->Press(Keypad::B, press); });
-    sdl_context.RegisterCallback(InputEvent::L,      [this](bool press) { keypad->Press(Keypad::L, press); });
-    sdl_context.RegisterCallback(InputEvent::R,      [this](bool press) { keypad->Press(Keypad::R, press); });
-    sdl_context.RegisterCallback(InputEvent::Start,  [this](bool press) { keypad->Press(Keypad::Start, press); });
-    sdl_context.RegisterCallback(InputEvent::Select, [this](bool press) { keypad->Press(Keypad::Select, press); });
+    frontend.RegisterCallback(InputEvent::Quit,         [this](bool) { quit = true; });
+    frontend.RegisterCallback(InputEvent::Pause,        [this](bool) { pause = !pause; });
+    frontend.RegisterCallback(InputEvent::LogLevel,     [this](bool) { disasm->SwitchLogLevel(); });
+    frontend.RegisterCallback(InputEvent::Fullscreen,   [this](bool) { frontend.ToggleFullscreen(); });
+    frontend.RegisterCallback(InputEvent::Screenshot,   [this](bool) { Screenshot(); });
+    frontend.RegisterCallback(InputEvent::LcdDebug,     [this](bool) { lcd->DumpDebugInfo(); Screenshot(); });
+    frontend.RegisterCallback(InputEvent::HideWindow,   [this](bool) { old_pause = pause; pause = true; });
+    frontend.RegisterCallback(InputEvent::ShowWindow,   [this](bool) { pause = old_pause; });
+    frontend.RegisterCallback(InputEvent::FrameAdvance, [this](bool) { frame_advance = true; });
+    frontend.RegisterCallback(InputEvent::FrameSkip,    [this](bool) { frame_skip.CycleSetting(); });
+    frontend.RegisterCallback(InputEvent::FrameStats,   [this](bool) { fmt::print("{}\n", frame_stats.Report()); });
+    frontend.RegisterCallback(InputEvent::SaveState,    [this](bool) { SaveStateFile(); });
+    frontend.RegisterCallback(InputEvent::LoadState,    [this](bool) { LoadStateFile(); });
+    frontend.RegisterCallback(InputEvent::Rewind,       [this](bool press) { rewinding = press; });
+
+    for (int i = 0; i < Emu::button_count; ++i) {
+        const auto button = Emu::ButtonFromIndex(i);
+        frontend.RegisterCallback(button, [this, button](bool press) { ButtonInput(button, press); });
+    }
+}
+
+void Core::ButtonInput(Emu::InputEvent button, bool press) {
+    if (netplay != nullptr) {
+        const int index = Emu::ButtonIndex(button);
+        local_buttons = press ? (local_buttons | (1 << index)) : (local_buttons & ~(1 << index));
+    } else if (movie_reader == nullptr) {
+        // While a movie plays, it's the only source of input.
+        PressButton(button, press);
+    }
+}
+
+void Core::PressButton(Emu::InputEvent button, bool press) {
+    constexpr std::array<Keypad::Button, Emu::button_count> keypad_buttons{{
+        Keypad::Up, Keypad::Left, Keypad::Down, Keypad::Right, Keypad::A, Keypad::B, Keypad::L, Keypad::R,
+        Keypad::Start, Keypad::Select
+    }};
+
+    const int index = Emu::ButtonIndex(button);
+    held_buttons = press ? (held_buttons | (1 << index)) : (held_buttons & ~(1 << index));
+    keypad->Press(keypad_buttons[index], press);
+}
+
+u16* Core::SwapBuffers(u16* finished, std::vector<u16>& back_buffer) {
+    u16* next = lend_frames ? frontend.NextFrameTarget(finished) : nullptr;
+    if (next == nullptr) {
+        next = (finished == front_buffer.data()) ? back_buffer.data() : front_buffer.data();
+    }
+    front_frame = finished;
+
+    // Only a frame which differs from the one before it needs presenting.
+    if (output_hash.Frame(front_frame, front_buffer.size())) {
+        new_frame = true;
+    }
+    return next;
 }
 
 void Core::Screenshot() const {
-    Common::WriteImageToFile(Common::BGR5ToRGB8(front_buffer), "screenshot", 240, 160);
+    image_encoder->Screenshot(front_frame, Lcd::h_pixels, Lcd::v_pixels, "screenshot");
+}
+
+void Core::SaveState(std::vector<u8>& buffer) {
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gba);
+    SerializeState(state);
+}
+
+void Core::LoadState(const std::vector<u8>& buffer) {
+    // A bad state can be rejected partway through, so keep the current state to fall back on.
+    SaveState(fallback_state);
+
+    try {
+        auto state = Common::State::ForLoading(buffer, Common::State::System::Gba);
+        SerializeState(state);
+    } catch (const std::runtime_error&) {
+        auto state = Common::State::ForLoading(fallback_state, Common::State::System::Gba);
+        SerializeState(state);
+        throw;
+    }
+}
+
+void Core::SaveHostState(std::vector<u8>& buffer) {
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gba);
+    SerializeHostState(state);
+}
+
+void Core::LoadHostState(const std::vector<u8>& buffer) {
+    auto state = Common::State::ForLoading(buffer, Common::State::System::Gba);
+    SerializeHostState(state);
+}
+
+void Core::SerializeHostState(Common::State& state) {
+    state.Sync(overspent_cycles, mid_frame, frame_cycles_left, frame_target_cycles);
+    audio->SerializeMixer(state);
+}
+
+Common::MemoryReport Core::ReportMemory() const {
+    Common::MemoryReport report;
+    report.Add("core", sizeof(Core));
+    mem->ReportMemory(report);
+    report.Add("cpu", sizeof(Cpu));
+    if (block_cache != nullptr) {
+        block_cache->ReportMemory(report);
+    }
+    if (jit != nullptr) {
+        jit->ReportMemory(report);
+    }
+    lcd->ReportMemory(report);
+    audio->ReportMemory(report);
+    report.Add("frame_buffers", front_buffer);
+    report.Add("frame_buffers", run_ahead_frame);
+    report.Add("savestates", state_buffer);
+    report.Add("savestates", fallback_state);
+    report.Add("savestates", rewind_state);
+    report.Add("savestates", run_ahead_state);
+    if (rewind != nullptr) {
+        report.Add("rewind", rewind->Bytes());
+    }
+    if (netplay != nullptr) {
+        report.Add("netplay", netplay->SnapshotBytes());
+    }
+
+    return report;
+}
+
+void Core::SerializeState(Common::State& state) {
+    // The render thread must not be touching the LCD state while it's copied or replaced.
+    lcd->SyncRender();
+
+    state.Sync(scheduler, rtc_source, *cpu, *mem, *lcd, *audio);
+    for (auto& timer : timers) {
+        state.Sync(timer);
+    }
+    for (auto& channel : dma) {
+        state.Sync(channel);
+    }
+    state.Sync(*keypad, *serial);
+    state.Sync(output_hash);
+    if (state.Loading()) {
+        // The frontend may still be presenting a frame it lent, so a loaded frame goes back in the core's own buffer.
+        front_frame = front_buffer.data();
+    }
+    state.SyncContents(front_frame, front_buffer.size());
+    // A loaded state comes with its own frame.
+    if (state.Loading()) {
+        new_frame = true;
+    }
+
+    if (state.Loading() && block_cache != nullptr) {
+        block_cache->InvalidateRam();
+    }
+}
+
+void Core::RunAhead() {
+    // The frame just emulated is the real one. Emulate a few more with the same input to show where it leads, then
+    // go back. Games which act on input a frame or two after reading it respond that much sooner.
+    SaveState(run_ahead_state);
+
+    int ahead_overspent_cycles = overspent_cycles;
+    suppress_audio = true;
+    for (int i = 0; i < run_ahead_frames; ++i) {
+        // Whether a frame is drawn is decided at the vblank before it, which can come two host frames before the
+        // one it finishes in. So only the ahead frames which can't end up being presented are skipped.
+        suppress_video = i < run_ahead_frames - 3;
+        ahead_overspent_cycles = cpu->Execute(cycles_per_frame + ahead_overspent_cycles);
+        rtc_source.FrameDone();
+    }
+    suppress_video = false;
+    suppress_audio = false;
+
+    lcd->SyncRender();
+    run_ahead_frame.assign(front_frame, front_frame + front_buffer.size());
+
+    // Run ahead states were made by this core, so they're loaded without keeping a fallback.
+    auto state = Common::State::ForLoading(run_ahead_state, Common::State::System::Gba);
+    SerializeState(state);
+}
+
+void Core::RewindFrame() {
+    // Rewind snapshots were made by this core, so they're loaded without keeping a fallback.
+    if (rewind->Pop(rewind_state)) {
+        auto state = Common::State::ForLoading(rewind_state, Common::State::System::Gba);
+        SerializeState(state);
+    }
+
+    frontend.RenderFrame(front_frame, std::exchange(new_frame, false));
+}
+
+void Core::StartMovie(const Common::MovieSettings& movie_settings) {
+    if (!movie_settings.play_path.empty()) {
+        movie_reader = std::make_unique<Common::MovieReader>(movie_settings.play_path, Common::State::System::Gba);
+        if (!movie_reader->StartState().empty()) {
+            LoadState(movie_reader->StartState());
+        }
+        movie_index = Common::OpenMovieIndex(movie_settings, movie_reader->InputHash(0));
+        if (movie_settings.seek_frame != 0) {
+            SeekMovie(movie_settings.seek_frame);
+        }
+    } else if (!movie_settings.record_path.empty()) {
+        std::vector<u8> start_state;
+        if (movie_settings.record_from_state) {
+            if (!Common::ReadStateFile(state_path, start_state)) {
+                throw std::runtime_error("No savestate found at " + state_path + " to record from.");
+            }
+            LoadState(start_state);
+        }
+        movie_writer = std::make_unique<Common::MovieWriter>(movie_settings.record_path, Common::State::System::Gba,
+                                                             rtc_source.FixedStart(), start_state);
+        movie_index = Common::OpenMovieIndex(movie_settings,
+                                             Common::MovieStartHash(rtc_source.FixedStart(), start_state));
+    }
+}
+
+void Core::PlayMovieFrame() {
+    u16 buttons;
+    if (!movie_reader->Frame(buttons)) {
+        fmt::print("Input movie finished.\n");
+        movie_reader.reset();
+        movie_index.reset();
+        return;
+    }
+
+    SetButtons(buttons);
+}
+
+void Core::SeekMovie(s64 frame) {
+    if (!movie_reader->Seek(frame)) {
+        throw std::runtime_error("The input movie ends before frame " + std::to_string(frame) + ".");
+    }
+
+    Common::MovieIndex::Keyframe keyframe;
+    if (movie_index != nullptr && movie_index->Seek(frame, *movie_reader, keyframe)) {
+        LoadState(keyframe.state);
+        overspent_cycles = keyframe.overspent_cycles;
+        held_buttons = keyframe.held_buttons;
+    }
+    movie_reader->Seek(keyframe.frame);
+
+    // The rest of the way is played without sound, and only the last few frames are drawn.
+    suppress_audio = true;
+    for (s64 i = keyframe.frame; i < frame; ++i) {
+        suppress_video = i < frame - 3;
+        EmulateFrame();
+    }
+    suppress_video = false;
+    suppress_audio = false;
+}
+
+void Core::SetButtons(u16 buttons) {
+    for (int i = 0; i < Emu::button_count; ++i) {
+        if ((buttons ^ held_buttons) & (1 << i)) {
+            PressButton(Emu::ButtonFromIndex(i), buttons & (1 << i));
+        }
+    }
+}
+
+bool Core::NetplayFrame() {
+    if (!netplay->WaitForInputWindow()) {
+        return false;
+    }
+
+    const s64 mispredicted_frame = netplay->TakeMisprediction();
+    if (mispredicted_frame != Common::Netplay::none) {
+        Resimulate(mispredicted_frame);
+    }
+
+    SaveSnapshot(netplay->Frame());
+    SetButtons(netplay->AdvanceFrame(local_buttons));
+    return true;
+}
+
+void Core::SaveSnapshot(s64 frame) {
+    Common::Netplay::Snapshot& snapshot = netplay->SnapshotAt(frame);
+    SaveState(snapshot.state);
+    snapshot.overspent_cycles = overspent_cycles;
+    snapshot.held_buttons = held_buttons;
+}
+
+void Core::Resimulate(s64 from_frame) {
+    // Snapshots were made by this core, so they're loaded without keeping a fallback.
+    const Common::Netplay::Snapshot& start = netplay->SnapshotAt(from_frame);
+    auto state = Common::State::ForLoading(start.state, Common::State::System::Gba);
+    SerializeState(state);
+    overspent_cycles = start.overspent_cycles;
+    held_buttons = start.held_buttons;
+
+    const s64 to_frame = netplay->Frame();
+    netplay->CountRollback(to_frame - from_frame);
+
+    suppress_audio = true;
+    for (s64 frame = from_frame; frame < to_frame; ++frame) {
+        if (frame != from_frame) {
+            SaveSnapshot(frame);
+        }
+
+        // As with run-ahead, only the frames which could end up being presented are drawn.
+        suppress_video = frame < to_frame - 3;
+        SetButtons(netplay->ReplayInput(frame));
+        keypad->CheckKeypadInterrupt();
+        overspent_cycles = cpu->Execute(cycles_per_frame + overspent_cycles);
+        rtc_source.FrameDone();
+    }
+    suppress_video = false;
+    suppress_audio = false;
+}
+
+void Core::SaveStateFile() {
+    if (state_path.empty()) {
+        return;
+    }
+
+    try {
+        SaveState(state_buffer);
+        // Written in the background. If the write fails, the writer prints why.
+        Common::SharedFileWriter().Write(state_path, state_buffer);
+        fmt::print("Saving state to {}\n", state_path);
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to save state: {}\n", error.what());
+    }
+}
+
+void Core::LoadStateFile() {
+    if (state_path.empty()) {
+        return;
+    } else if (MovieActive()) {
+        fmt::print("Can't load a savestate during an input movie.\n");
+        return;
+    } else if (netplay != nullptr) {
+        fmt::print("Can't load a savestate during netplay.\n");
+        return;
+    }
+
+    try {
+        // A state saved just before may still be on its way to the file.
+        Common::SharedFileWriter().Flush();
+        if (!Common::ReadStateFile(state_path, state_buffer)) {
+            fmt::print("No savestate found at {}\n", state_path);
+            return;
+        }
+        LoadState(state_buffer);
+        fmt::print("Loaded state from {}\n", state_path);
+    } catch (const std::runtime_error& error) {
+        fmt::print("Failed to load state: {}\n", error.what());
+    }
 }
 
 } // End namespace Gba
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <string>
@@ -23,61 +24,294 @@
 
 #include "common/CommonTypes.h"
 #include "common/CommonEnums.h"
+#include "common/FrameSkip.h"
+#include "common/BenchStats.h"
+#include "common/PerfCounters.h"
+#include "common/PcProfiler.h"
+#include "common/Coverage.h"
+#include "common/CodeCoverage.h"
+#include "common/FrameTimeStats.h"
+#include "common/Hash.h"
+#include "common/AccessCounters.h"
+#include "common/RtcSource.h"
+#include "common/Watchdog.h"
+#include "common/Hooks.h"
+#include "common/Cheats.h"
+#include "common/Breakpoint.h"
+#include "common/MappedRom.h"
+#include "common/MemoryReport.h"
+#include "gba/core/Scheduler.h"
+#include "gba/hardware/Timer.h"
+#include "gba/hardware/Dma.h"
 
-namespace Emu { class SdlContext; }
+namespace Emu { class Frontend; enum class InputEvent; }
+namespace Common {
+class Tracer;
+struct TraceTrigger;
+class State;
+class RewindBuffer;
+struct RewindSettings;
+class MovieReader;
+class MovieWriter;
+class MovieIndex;
+struct MovieSettings;
+struct SaveSettings;
+class ImageEncoder;
+struct ScreenshotSettings;
+class AvRecorder;
+struct RecordSettings;
+struct LinkSettings;
+class Netplay;
+struct NetplaySettings;
+class MetricsServer;
+class RamDeltaWriter;
+struct MetricsSettings;
+struct StepTarget;
+} // End namespace Common
 
 namespace Gba {
 
 class Memory;
 class Cpu;
+class BlockCache;
+class Jit;
 class Disassembler;
 class Lcd;
 class Audio;
-class Timer;
-class Dma;
 class Keypad;
 class Serial;
 
 class Core {
 public:
-    Core(Emu::SdlContext& context, const std::vector<u32>& bios, const std::vector<u16>& rom,
-         const std::string& save_path, LogLevel level);
+    Core(Emu::Frontend& _frontend, const std::vector<u32>& bios, const Common::RomVector<u16>& rom,
+         const std::string& save_path, LogLevel level, LogOverflow log_overflow, ExecMode exec_mode,
+         AudioFilter audio_filter, int frame_skip_setting, bool lcd_thread, bool line_cache, bool hle_bios,
+         int bench_frames, int profile_interval, const std::string& trace_path,
+         const Common::TraceTrigger& trace_trigger,
+         const Common::RewindSettings& rewind_settings, int _run_ahead_frames,
+         const Common::MovieSettings& movie_settings, const Common::SaveSettings& save_settings,
+         const Common::ScreenshotSettings& screenshot_settings, const Common::RecordSettings& record_settings,
+         const Common::LinkSettings& link_settings, const Common::NetplaySettings& netplay_settings,
+         const Common::RtcSettings& rtc_settings, Common::HugePages huge_pages,
+         const Common::MetricsSettings& metrics_settings, const Common::WatchdogSettings& watchdog_settings,
+         bool ideal_prefetch, bool skip_bios);
     ~Core();
 
+    // Set by embedders, which call HooksChanged after changing which addresses are hooked. Declared before the
+    // memory, which checks it when building its page tables.
+    Common::Hooks hooks;
+
     std::unique_ptr<Memory> mem;
     std::unique_ptr<Cpu> cpu;
+    // Only present when running with cached blocks or the JIT, respectively.
+    std::unique_ptr<BlockCache> block_cache;
+    std::unique_ptr<Jit> jit;
     std::unique_ptr<Disassembler> disasm;
     std::unique_ptr<Lcd> lcd;
     std::unique_ptr<Audio> audio;
-    std::vector<Timer> timers;
-    std::vector<Dma> dma;
     std::unique_ptr<Keypad> keypad;
     std::unique_ptr<Serial> serial;
 
-    int next_lcd_event_cycles = 0;
-    int lcd_cycle_counter = 0;
-    int next_audio_event_cycles = 0;
-    int audio_cycle_counter = 0;
-    std::array<int, 4> next_timer_event_cycles{};
-    std::array<int, 4> timer_cycle_counter{};
+    // The scheduler, timers and DMA channels are touched on nearly every cycle, so they're kept inline, next to
+    // each other, rather than behind pointers of their own.
+    Scheduler scheduler;
+    std::array<Timer, 4> timers;
+    std::array<Dma, 4> dma;
+    // Only present during netplay. It's connected before the RTC source, which takes its start time from it.
+    std::unique_ptr<Common::Netplay> netplay;
+    Common::RtcSource rtc_source;
+    Common::BenchStats bench;
+    Common::PerfCounters counters;
+    // Covers the 28-bit address space the GBA decodes.
+    Common::AccessCounters access_counters{28};
+    Common::FrameTimeStats frame_stats;
+    Common::OutputHash output_hash;
+    Common::Watchdog watchdog;
+    // Only present when profiling guest code.
+    std::unique_ptr<Common::PcProfiler> profiler;
+    // Only present while collecting coverage for a fuzzer.
+    std::unique_ptr<Common::Coverage> coverage;
+    // Only present while recording which instructions have run, for a coverage report.
+    std::unique_ptr<Common::CodeCoverage> code_coverage;
+    // Only present when writing a timeline trace.
+    std::unique_ptr<Common::Tracer> tracer;
+    // Only present when rewind is enabled.
+    std::unique_ptr<Common::RewindBuffer> rewind;
+    // Only present while recording video and audio.
+    std::unique_ptr<Common::AvRecorder> recorder;
+    // Only present when serving metrics.
+    std::unique_ptr<Common::MetricsServer> metrics;
+    // Only present while streaming RAM deltas.
+    std::unique_ptr<Common::RamDeltaWriter> ram_deltas;
 
     void EmulatorLoop();
-    void UpdateHardware(int cycles);
+    // Runs a single frame for frontends which drive the core themselves: polls the frontend once for input, then
+    // renders the frame to it. There's no pausing, rewinding or frame pacing.
+    void RunFrame();
+    // Runs count frames with the same input. Only the frames which could end up being presented are drawn.
+    void RunFrames(int count);
+    // Sub-frame stepping, for tools which act partway through frames. Each call polls the frontend once for input,
+    // and renders the latest frame to it at the end. A frame left partway through is finished by the next call or
+    // RunFrame, so the two can be mixed freely. Run-ahead isn't applied.
+    // Runs until the scheduler's timestamp reaches the cycle, or a little past it, since neither instructions nor
+    // DMA transfers are split.
+    void RunUntil(u64 cycle);
+    // Runs until the target is reached, or for at most max_cycles. Returns whether the target was reached.
+    bool RunUntilEvent(const Common::StepTarget& target, u64 max_cycles);
+    // Moves the hooked RAM pages out of the page tables and swaps in the hook handlers, or puts them back.
+    void HooksChanged();
+    // Replaces the active cheats. ROM patches take effect straight away, and RAM writes from the next frame.
+    void SetCheats(const std::vector<Common::Cheat>& new_cheats);
+    const std::vector<Common::Cheat>& Cheats() const { return cheats; }
+    // Adds the debugger's breakpoints and watchpoints as hooks. Throws std::runtime_error if a watchpoint isn't in
+    // EWRAM or IWRAM.
+    void SetBreakpoints(const std::vector<Common::Breakpoint>& breakpoints);
+    // Writes the lines of EWRAM and IWRAM which changed to the file at the end of every frame.
+    void StreamRamDeltas(const std::string& path, bool compress);
+    // Writes the memory traffic counted so far to prefix.csv and prefix.png, in builds with counting compiled in.
+    void ExportAccessCounts(const std::string& prefix) const;
+    // Records which instructions run from now on. Once on, it stays on.
+    void EnableCodeCoverage();
+    // Writes how many instructions have run from each region, and a disassembly of each of them, to the file.
+    // Throws std::runtime_error if it can't be written.
+    void WriteCoverageReport(const std::string& path);
+    // Resumes from the suspend file, if there is one, and suspends to it again when the emulator loop exits, so the
+    // next launch picks up where this one left off instead of booting the game again.
+    void EnableSuspend(const std::string& path);
+    void UpdateHardware(int cycles) {
+        // The hardware is only brought up to date once the earliest scheduled event is due.
+        scheduler.Advance(cycles);
+        if (scheduler.EventPending()) {
+            RunEvents();
+        }
+    }
     int HaltCycles(int remaining_cpu_cycles) const;
-    void SwapBuffers(std::vector<u16>& back_buffer) { front_buffer.swap(back_buffer); }
+    // Input is polled again at the game's first read of KEYINPUT in a frame, so buttons pressed while the frame
+    // was being emulated still make it in.
+    void LatchInput() {
+        if (input_latch_armed) {
+            PollLatchedInput();
+        }
+    }
+    // Takes the frame the LCD just finished, and returns where it should draw the next one.
+    u16* SwapBuffers(u16* finished, std::vector<u16>& back_buffer);
+    // Every frame is drawn while recording, so frame skip doesn't leave gaps in the video.
+    bool SkipNextFrame() { return suppress_video || (recorder == nullptr && frame_skip.SkipNextFrame()); }
+    // True while emulating frames whose audio will be thrown away, so no samples need to be produced.
+    bool AudioSuppressed() const { return suppress_audio; }
     void PushBackAudio(const std::array<s16, 1600>& sample_buffer);
     void Screenshot() const;
 
+    // The latest frame, which loading a state replaces.
+    const u16* FrontFrame() const { return front_frame; }
+
+    // Savestates are a single flat buffer. Saving into the same buffer again reuses its memory.
+    void SaveState(std::vector<u8>& buffer);
+    // Throws std::runtime_error if the buffer doesn't hold a valid GBA savestate.
+    void LoadState(const std::vector<u8>& buffer);
+    // What savestates leave to the host, in the same format: how far through a frame the core is, along with the
+    // cycles the last frame ran over, and the resampler and filter history behind the audio output. Loading it after
+    // a state carries on exactly as the instance which saved them would have, down to the frame and audio hashes.
+    // Throws std::runtime_error if the buffer doesn't hold a valid host state for this system.
+    void SaveHostState(std::vector<u8>& buffer);
+    void LoadHostState(const std::vector<u8>& buffer);
+
+    // The bytes currently held by each part of this instance.
+    Common::MemoryReport ReportMemory() const;
+
 private:
-    Emu::SdlContext& sdl_context;
+    static constexpr int cycles_per_frame = 279680;
+
+    Emu::Frontend& frontend;
     std::vector<u16> front_buffer;
+    // The latest frame, which is in the front buffer, the LCD's back buffer, or memory lent by the frontend.
+    u16* front_frame;
+    // Set whenever the front buffer changes, and cleared once it's been presented.
+    bool new_frame = true;
+    std::unique_ptr<Common::ImageEncoder> image_encoder;
+    Common::FrameSkip frame_skip;
+    const std::string state_path;
+    // Empty unless suspending on exit.
+    std::string suspend_path;
+    std::vector<u8> state_buffer;
+    // The state before a load, to go back to if the load fails. Kept between loads so they don't allocate.
+    std::vector<u8> fallback_state;
+
+    // Always zero or negative, the cycles the last frame ran past its end.
+    int overspent_cycles = 0;
+    // Set while sub-frame stepping has left a frame partway through, with this many cycles still to run.
+    bool mid_frame = false;
+    int frame_cycles_left = 0;
+    // The cycles the current frame started with, after taking off those the last frame overspent.
+    int frame_target_cycles = 0;
 
     bool quit = false;
     bool pause = false;
     bool old_pause = false;
     bool frame_advance = false;
+    bool rewinding = false;
+    std::vector<u8> rewind_state;
+
+    // Only present while recording or playing back an input movie, respectively.
+    std::unique_ptr<Common::MovieWriter> movie_writer;
+    std::unique_ptr<Common::MovieReader> movie_reader;
+    // Only present alongside a movie, when it has a seek index.
+    std::unique_ptr<Common::MovieIndex> movie_index;
+    // One bit per button, in movie order.
+    u16 held_buttons = 0;
+
+    std::vector<Common::Cheat> cheats;
+    // Set by the first breakpoint hit in a frame. The emulator can only stop at the end of the frame, so any more
+    // hits before then aren't shown.
+    bool break_hit = false;
+    // The buttons held on this host, which netplay combines with the other player's at the start of each frame.
+    u16 local_buttons = 0;
+
+    // Only armed by the emulator loop, while there's no movie or netplay session that needs the input fixed at
+    // the start of the frame.
+    bool input_latch_armed = false;
+    // When the input the current frame acts on was polled.
+    std::chrono::steady_clock::time_point input_time;
+
+    const int run_ahead_frames;
+    bool suppress_video = false;
+    bool suppress_audio = false;
+    std::vector<u8> run_ahead_state;
+    std::vector<u16> run_ahead_frame;
+    // Whether to draw into memory lent by the frontend. Not with run-ahead, which presents a copy of the frame, nor
+    // with the line cache, which reuses lines left in the back buffer from two frames before.
+    const bool lend_frames;
 
+    void EmulateFrame();
+    // Returns false if netplay is still waiting for the other player, in which case the frame doesn't start.
+    bool BeginFrame();
+    void EndFrame();
+    // Runs frames and parts of frames until the timestamp reaches the end cycle or the CPU is asked to stop.
+    void StepTo(u64 end_cycle);
+    void ApplyCheats();
+    void SkipBios();
+    void Break(const std::string& reason);
+    void RunEvents();
     void RegisterCallbacks();
+    void SerializeState(Common::State& state);
+    void SerializeHostState(Common::State& state);
+    void SaveStateFile();
+    void LoadStateFile();
+    void Suspend();
+    void RewindFrame();
+    void RunAhead();
+    void PollLatchedInput();
+    void StartMovie(const Common::MovieSettings& movie_settings);
+    void PlayMovieFrame();
+    // Starts playback from the frame, from the last keyframe before it in the movie's index if there is one.
+    void SeekMovie(s64 frame);
+    void SetButtons(u16 buttons);
+    bool NetplayFrame();
+    void SaveSnapshot(s64 frame);
+    void Resimulate(s64 from_frame);
+    bool MovieActive() const { return movie_reader != nullptr || movie_writer != nullptr; }
+    void ButtonInput(Emu::InputEvent button, bool press);
+    void PressButton(Emu::InputEvent button, bool press);
 };
 
 } // End namespace Gba
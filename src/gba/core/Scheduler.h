@@ -0,0 +1,90 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <limits>
+
+#include "common/CommonTypes.h"
+#include "common/SaveState.h"
+
+namespace Gba {
+
+// Events are serviced in the order they are declared when several of them are due at the same time.
+enum class Event {Lcd,
+                  Timer0,
+                  Timer1,
+                  Timer2,
+                  Timer3,
+                  Audio,
+                  Serial,
+                  LinkPoll,
+                  SaveOp,
+                  NumEvents};
+
+constexpr Event TimerEvent(int id) { return static_cast<Event>(static_cast<int>(Event::Timer0) + id); }
+
+class Scheduler {
+public:
+    static constexpr u64 never = std::numeric_limits<u64>::max();
+
+    // The absolute number of cycles emulated since power on.
+    u64 Timestamp() const { return timestamp; }
+    void Advance(int cycles) { timestamp += cycles; }
+
+    bool EventPending() const { return timestamp >= next_deadline; }
+    bool EventDue(Event event) const { return timestamp >= deadlines[Index(event)]; }
+
+    u64 Deadline(Event event) const { return deadlines[Index(event)]; }
+    u64 CyclesUntilNextEvent() const { return EventPending() ? 0 : next_deadline - timestamp; }
+
+    // The number of cycles since the event was last scheduled, i.e. since the hardware it belongs to was last
+    // brought up to date.
+    int Elapsed(Event event) const { return timestamp - last_sync[Index(event)]; }
+
+    void Schedule(Event event, u64 deadline) {
+        deadlines[Index(event)] = deadline;
+        last_sync[Index(event)] = timestamp;
+        next_deadline = *std::min_element(deadlines.cbegin(), deadlines.cend());
+    }
+
+    void ScheduleIn(Event event, int cycles) { Schedule(event, timestamp + cycles); }
+    void Unschedule(Event event) { Schedule(event, never); }
+
+    void SerializeState(Common::State& state) { state.Sync(deadlines, last_sync, next_deadline, timestamp); }
+
+private:
+    static constexpr std::size_t num_events = static_cast<std::size_t>(Event::NumEvents);
+
+    // There is only a handful of event sources, so a flat array of deadlines with a cached minimum beats a heap.
+    std::array<u64, num_events> deadlines = MakeDeadlines();
+    std::array<u64, num_events> last_sync{};
+    u64 next_deadline = never;
+    u64 timestamp = 0;
+
+    static constexpr std::size_t Index(Event event) { return static_cast<std::size_t>(event); }
+    static constexpr std::array<u64, num_events> MakeDeadlines() {
+        std::array<u64, num_events> init{};
+        for (auto& deadline : init) {
+            deadline = never;
+        }
+        return init;
+    }
+};
+
+} // End namespace Gba
@@ -0,0 +1,142 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <vector>
+#include <fmt/format.h>
+
+#include "gba/core/Validator.h"
+#include "gba/core/Core.h"
+#include "gba/cpu/Cpu.h"
+#include "gba/memory/Memory.h"
+#include "gba/lcd/Lcd.h"
+#include "gba/audio/Audio.h"
+#include "gba/hardware/Timer.h"
+#include "gba/hardware/Dma.h"
+#include "gba/hardware/Keypad.h"
+#include "gba/hardware/Serial.h"
+#include "common/SaveState.h"
+
+namespace Gba {
+
+namespace {
+
+template<typename T>
+std::vector<u8> ComponentState(T& component) {
+    std::vector<u8> buffer;
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gba);
+    state.Sync(component);
+    return buffer;
+}
+
+// Timers and DMA channels can't be default constructed, so they're synced one at a time like in Core::SaveState.
+template<typename T, std::size_t N>
+std::vector<u8> ComponentState(std::array<T, N>& components) {
+    std::vector<u8> buffer;
+    auto state = Common::State::ForSaving(buffer, Common::State::System::Gba);
+    for (auto& component : components) {
+        state.Sync(component);
+    }
+    return buffer;
+}
+
+void ReportComponents(Core& reference, Core& candidate) {
+    const std::vector<std::pair<const char*, bool>> components{
+        {"scheduler", ComponentState(reference.scheduler) != ComponentState(candidate.scheduler)},
+        {"rtc",       ComponentState(reference.rtc_source) != ComponentState(candidate.rtc_source)},
+        {"cpu",       ComponentState(*reference.cpu) != ComponentState(*candidate.cpu)},
+        {"memory",    ComponentState(*reference.mem) != ComponentState(*candidate.mem)},
+        {"lcd",       ComponentState(*reference.lcd) != ComponentState(*candidate.lcd)},
+        {"audio",     ComponentState(*reference.audio) != ComponentState(*candidate.audio)},
+        {"timers",    ComponentState(reference.timers) != ComponentState(candidate.timers)},
+        {"dma",       ComponentState(reference.dma) != ComponentState(candidate.dma)},
+        {"keypad",    ComponentState(*reference.keypad) != ComponentState(*candidate.keypad)},
+        {"serial",    ComponentState(*reference.serial) != ComponentState(*candidate.serial)},
+        {"frame",     reference.output_hash.FrameHash() != candidate.output_hash.FrameHash()},
+    };
+
+    std::string diverged;
+    for (const auto& [name, differs] : components) {
+        if (differs) {
+            diverged += diverged.empty() ? name : std::string{", "} + name;
+        }
+    }
+    fmt::print("Diverged: {}\n", diverged);
+
+    fmt::print("Cycle:      {:>10}  {:>10}\n", reference.scheduler.Timestamp(), candidate.scheduler.Timestamp());
+    fmt::print("PC:         0x{:0>8X}  0x{:0>8X}\n", reference.cpu->GetPc(), candidate.cpu->GetPc());
+    fmt::print("CPSR:       0x{:0>8X}  0x{:0>8X}\n", reference.cpu->GetCpsr(), candidate.cpu->GetCpsr());
+    const auto& reference_regs = reference.cpu->GetRegisters();
+    const auto& candidate_regs = candidate.cpu->GetRegisters();
+    for (std::size_t i = 0; i < reference_regs.size(); ++i) {
+        if (reference_regs[i] != candidate_regs[i]) {
+            fmt::print("R{:<2}         0x{:0>8X}  0x{:0>8X}\n", i, reference_regs[i], candidate_regs[i]);
+        }
+    }
+}
+
+template<typename T, std::size_t N>
+void ReportRam(const char* name, u32 base_addr, const std::array<T, N>& reference, const std::array<T, N>& candidate) {
+    for (std::size_t i = 0; i < N; ++i) {
+        if (reference[i] != candidate[i]) {
+            fmt::print("{:<11} 0x{:0>8X}: 0x{:0>{}X}  0x{:0>{}X}\n", name, base_addr + i * sizeof(T),
+                       reference[i], sizeof(T) * 2, candidate[i], sizeof(T) * 2);
+            return;
+        }
+    }
+}
+
+} // End anonymous namespace
+
+bool ValidateEngines(Core& reference, Core& candidate, int frames, const std::string& state_path) {
+    std::vector<u8> start_state;
+    std::vector<u8> reference_state;
+    std::vector<u8> candidate_state;
+
+    for (int frame = 0; frames == 0 || frame < frames; ++frame) {
+        reference.SaveState(start_state);
+
+        reference.RunFrame();
+        candidate.RunFrame();
+
+        reference.SaveState(reference_state);
+        candidate.SaveState(candidate_state);
+        if (reference_state == candidate_state
+                && reference.output_hash.FrameHash() == candidate.output_hash.FrameHash()) {
+            continue;
+        }
+
+        fmt::print("The engines diverged in frame {}. Reference first, then the engine being validated.\n", frame);
+        ReportComponents(reference, candidate);
+
+        const GuestRam& reference_ram = reference.mem->RamReference();
+        const GuestRam& candidate_ram = candidate.mem->RamReference();
+        ReportRam("XRAM", BaseAddr::XRam, reference_ram.xram, candidate_ram.xram);
+        ReportRam("IRAM", BaseAddr::IRam, reference_ram.iram, candidate_ram.iram);
+        ReportRam("PRAM", BaseAddr::PRam, reference_ram.pram, candidate_ram.pram);
+        ReportRam("VRAM", BaseAddr::VRam, reference_ram.vram, candidate_ram.vram);
+        ReportRam("OAM", BaseAddr::Oam, reference_ram.oam, candidate_ram.oam);
+
+        Common::WriteStateFile(state_path, start_state);
+        fmt::print("Wrote the state from the start of frame {} to {}\n", frame, state_path);
+        return false;
+    }
+
+    fmt::print("The engines agreed for all {} frames.\n", frames);
+    return true;
+}
+
+} // End namespace Gba
@@ -0,0 +1,37 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <string>
+
+namespace Gba {
+
+class Core;
+
+// Runs two instances of the same game in lockstep from power on, one on the interpreter and one on a faster CPU
+// engine, and compares their whole state after every frame. The engines only have to agree at the end of each time
+// slice, since the JIT runs several instructions at a time, so a frame is the finest step both can be stopped at
+// without changing how they run. Both instances must have been created with the same input and a reproducible
+// clock. Runs for the given number of frames, or forever if it's 0.
+//
+// At the first frame where the states differ, prints which parts of the state diverged, the registers and first
+// differing RAM address of each, and writes the reference state from the start of that frame to state_path, so the
+// frame can be replayed with either engine. Returns false if the engines diverged.
+bool ValidateEngines(Core& reference, Core& candidate, int frames, const std::string& state_path);
+
+} // End namespace Gba
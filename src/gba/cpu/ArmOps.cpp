@@ -14,6 +14,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <array>
 #include <bitset>
 #include <cassert>
 
@@ -447,7 +448,7 @@ int Cpu::Arm_WriteStatusReg(bool write_spsr, u32 mask, u32 value) {
 
         // The thumb bit is masked out when writing the CPSR.
         psr_mask &= ~thumb_mode;
-        cpsr = (value & psr_mask) | (cpsr & ~psr_mask);
+        SetCpsr((value & psr_mask) | (Cpsr() & ~psr_mask));
     }
 
     return 0;
@@ -768,15 +769,16 @@ int Cpu::Arm_Ldm(Condition, bool pre_indexed, bool increment, bool exception_ret
         CpuModeSwitch(CpuMode::User);
     }
 
+    // Reads must be aligned.
+    std::array<u32, 15> data;
+    const int count = rlist.count() - rlist[pc];
     // One internal cycle to transfer the last loaded value to the destination register.
-    int cycles = 1;
+    int cycles = 1 + mem.ReadBlock(addr, data.data(), count);
+    addr += 4 * count;
 
-    for (Reg i = 0; i < 15; ++i) {
+    for (Reg i = 0, j = 0; i < 15; ++i) {
         if (rlist[i]) {
-            // Reads must be aligned.
-            regs[i] = mem.ReadMem<u32>(addr);
-            cycles += mem.AccessTime<u32>(addr);
-            addr += 4;
+            regs[i] = data[j++];
         }
     }
 
@@ -1014,21 +1016,21 @@ int Cpu::Arm_Stm(Condition, bool pre_indexed, bool increment, bool store_user_re
     regs[pc] += 4;
     pc_written = true;
 
-    int cycles = 0;
+    // Writes are always aligned.
+    std::array<u32, 16> data;
+    int count = 0;
     for (Reg i = 0; i < 16; ++i) {
         if (rlist[i]) {
-            // Writes are always aligned.
             if (i == n && writeback && n != LowestSetBit(reg_list)) {
                 // Store the new Rn value if it's not the first register in the list.
                 // Writeback isn't allowed when storing user regs, so we don't have to worry about that.
-                mem.WriteMem(addr, static_cast<u32>(regs[n] + offset));
+                data[count++] = regs[n] + offset;
             } else {
-                mem.WriteMem(addr, regs[i]);
+                data[count++] = regs[i];
             }
-            cycles += mem.AccessTime<u32>(addr);
-            addr += 4;
         }
     }
+    const int cycles = mem.WriteBlock(addr, data.data(), count);
 
     if (store_user_regs) {
         CpuModeSwitch(current_cpu_mode);
@@ -1162,7 +1164,7 @@ int Cpu::Arm_Mrs(Condition, bool read_spsr, Reg d) {
         regs[d] = spsr[CurrentCpuModeIndex()];
     } else {
         // The CPSR is read with the thumb bit masked out.
-        regs[d] = cpsr & ~thumb_mode;
+        regs[d] = Cpsr() & ~thumb_mode;
     }
 
     return 0;
@@ -1176,8 +1178,9 @@ int Cpu::Arm_MsrReg(Condition, bool write_spsr, u32 mask, Reg n) {
     return Arm_WriteStatusReg(write_spsr, mask, regs[n]);
 }
 
-int Cpu::Arm_Swi(Condition, u32) {
-    return TakeException(CpuMode::Svc);
+int Cpu::Arm_Swi(Condition, u32 imm) {
+    // The BIOS only looks at the top byte of the comment field.
+    return SoftwareInterrupt((imm >> 16) & 0xFF);
 }
 
 int Cpu::Arm_Undefined(u32) {
@@ -0,0 +1,586 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "gba/cpu/Cpu.h"
+#include "gba/memory/Memory.h"
+
+namespace Gba {
+
+namespace {
+
+// Rough cycle counts of the BIOS routines, which run out of the BIOS with no wait states. The accesses to the
+// game's buffers are charged on top of these at their real access times.
+// Taking the SWI, dispatching it through the BIOS, and returning from it.
+constexpr int swi_cycles = 26;
+// Each step of the BIOS's shift-and-subtract division loop.
+constexpr int div_step_cycles = 13;
+constexpr int sqrt_bit_cycles = 8;
+constexpr int arctan_cycles = 60;
+// The loop overhead for each unit copied by CpuSet, and for each group of 8 words copied by CpuFastSet.
+constexpr int copy_unit_cycles = 6;
+constexpr int fast_copy_block_cycles = 8;
+// Building one affine matrix.
+constexpr int affine_cycles = 40;
+// Decoding each byte of decompressed output.
+constexpr int decompress_byte_cycles = 8;
+
+enum BiosCall : u32 {Halt           = 0x02,
+                     IntrWait       = 0x04,
+                     VBlankIntrWait = 0x05,
+                     Div            = 0x06,
+                     DivArm         = 0x07,
+                     Sqrt           = 0x08,
+                     ArcTan         = 0x09,
+                     ArcTan2        = 0x0A,
+                     CpuSet         = 0x0B,
+                     CpuFastSet     = 0x0C,
+                     BgAffineSet    = 0x0E,
+                     ObjAffineSet   = 0x0F,
+                     Lz77UnCompWram = 0x11,
+                     Lz77UnCompVram = 0x12,
+                     HuffUnComp     = 0x13,
+                     RlUnCompWram   = 0x14,
+                     RlUnCompVram   = 0x15};
+
+constexpr s32 min_s32 = static_cast<s32>(0x8000'0000);
+
+// The flags the game's interrupt handler sets for IntrWait, in the mirror of the top of IWRAM.
+constexpr u32 intr_check_addr = 0x0300'7FF8;
+constexpr u32 ime_addr = 0x0400'0208;
+constexpr u32 haltcnt_addr = 0x0400'0301;
+
+// The BIOS works in 32-bit registers, so products and shifts wrap around.
+s32 Mul(s32 a, s32 b) {
+    return static_cast<s32>(static_cast<u32>(a) * static_cast<u32>(b));
+}
+
+s32 Shl(s32 a, int shift) {
+    return static_cast<s32>(static_cast<u32>(a) << shift);
+}
+
+int BitLength(u64 value) {
+    int bits = 0;
+    for (; value != 0; value >>= 1) {
+        ++bits;
+    }
+    return bits;
+}
+
+// The BIOS's sine table, in 1.14 fixed point with 256 steps per turn.
+s32 Sine(u32 angle) {
+    static const std::array<s16, 256> sine_table = []() {
+        constexpr double pi = 3.14159265358979323846;
+        std::array<s16, 256> table{};
+        for (std::size_t i = 0; i < table.size(); ++i) {
+            table[i] = static_cast<s16>(std::lround(std::sin(i * 2.0 * pi / 256.0) * 0x4000));
+        }
+        return table;
+    }();
+
+    return sine_table[angle & 0xFF];
+}
+
+s32 Cosine(u32 angle) {
+    return Sine(angle + 64);
+}
+
+// The BIOS's polynomial approximation of arctangent, for a 1.14 fixed point ratio between -1 and 1.
+s32 ArcTanPoly(s32 i, s32& a, s32& b) {
+    a = -(Mul(i, i) >> 14);
+    b = (Mul(0xA9, a) >> 14) + 0x390;
+    for (const s32 coefficient : {0x91C, 0xFB6, 0x16AA, 0x2081, 0x3651, 0xA2F9}) {
+        b = (Mul(b, a) >> 14) + coefficient;
+    }
+    return Mul(i, b) >> 16;
+}
+
+s32 ArcTanOfRatio(s32 numerator, s32 denominator) {
+    s32 a, b;
+    const s32 ratio = (numerator == min_s32 && denominator == -1) ? numerator : numerator / denominator;
+    return ArcTanPoly(ratio, a, b);
+}
+
+template <typename T>
+T Read(Memory& mem, u32 addr, int& cycles) {
+    cycles += mem.AccessTime<T>(addr);
+    return mem.ReadMem<T>(addr);
+}
+
+template <typename T>
+void Write(Memory& mem, u32 addr, T data, int& cycles) {
+    cycles += mem.AccessTime<T>(addr);
+    mem.WriteMem<T>(addr, data);
+}
+
+template <typename T>
+int CopyUnits(Memory& mem, u32 src, u32 dst, u32 count, bool fill) {
+    src &= ~(sizeof(T) - 1);
+    dst &= ~(sizeof(T) - 1);
+
+    int cycles = 0;
+    const T fill_value = (fill) ? Read<T>(mem, src, cycles) : 0;
+    for (u32 i = 0; i < count; ++i) {
+        const T data = (fill) ? fill_value : Read<T>(mem, src + i * sizeof(T), cycles);
+        Write<T>(mem, dst + i * sizeof(T), data, cycles);
+    }
+
+    return cycles;
+}
+
+// The BIOS refuses to copy or decompress anything out of the BIOS itself.
+bool BiosProtected(u32 src) {
+    return (src & 0x0E00'0000) == 0;
+}
+
+} // End anonymous namespace
+
+bool Cpu::HleBiosCall(u32 number) {
+    switch (number) {
+    case BiosCall::Halt:
+    case IntrWait:
+    case VBlankIntrWait:
+    case Div:
+    case DivArm:
+    case Sqrt:
+    case ArcTan:
+    case ArcTan2:
+    case CpuSet:
+    case CpuFastSet:
+    case BgAffineSet:
+    case ObjAffineSet:
+    case Lz77UnCompWram:
+    case Lz77UnCompVram:
+    case HuffUnComp:
+    case RlUnCompWram:
+    case RlUnCompVram:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int Cpu::SoftwareInterrupt(u32 number) {
+    if (!hle_bios || !HleBiosCall(number)) {
+        return TakeException(CpuMode::Svc);
+    }
+
+    int cycles = swi_cycles;
+    switch (number) {
+    case BiosCall::Halt:
+        Write<u8>(mem, haltcnt_addr, 0, cycles);
+        break;
+    case IntrWait:
+        cycles += BiosIntrWait(regs[0] != 0, regs[1]);
+        break;
+    case VBlankIntrWait:
+        regs[0] = 1;
+        regs[1] = 1;
+        cycles += BiosIntrWait(true, 1);
+        break;
+    case Div:
+        cycles += BiosDiv(regs[0], regs[1]);
+        break;
+    case DivArm:
+        cycles += BiosDiv(regs[1], regs[0]);
+        break;
+    case Sqrt:
+        cycles += BiosSqrt();
+        break;
+    case ArcTan:
+        cycles += BiosArcTan();
+        break;
+    case ArcTan2:
+        cycles += BiosArcTan2();
+        break;
+    case CpuSet:
+        cycles += BiosCpuSet();
+        break;
+    case CpuFastSet:
+        cycles += BiosCpuFastSet();
+        break;
+    case BgAffineSet:
+        cycles += BiosBgAffineSet();
+        break;
+    case ObjAffineSet:
+        cycles += BiosObjAffineSet();
+        break;
+    case Lz77UnCompWram:
+    case Lz77UnCompVram:
+        cycles += BiosLz77UnComp(number == Lz77UnCompVram);
+        break;
+    case HuffUnComp:
+        cycles += BiosHuffUnComp();
+        break;
+    case RlUnCompWram:
+    case RlUnCompVram:
+        cycles += BiosRlUnComp(number == RlUnCompVram);
+        break;
+    default:
+        break;
+    }
+
+    // Reads from the BIOS return what they would after the BIOS returned from the SWI.
+    last_bios_fetch = 0xE3A02004;
+
+    return cycles;
+}
+
+int Cpu::BiosIntrWait(bool discard, u16 wanted) {
+    const u32 swi_addr = regs[pc] - (ThumbMode() ? 4 : 8);
+    int cycles = 0;
+
+    // The BIOS discards the old flags once, on entry. It then loops on halt until the game's interrupt handler
+    // sets one of the wanted flags. Here the loop is the SWI itself: the CPU halts with the PC back on the SWI, so
+    // returning from the interrupt which woke it runs the SWI again, and that run only rechecks the flags.
+    const bool resuming = intr_wait_addr == swi_addr;
+    intr_wait_addr = no_intr_wait;
+    u16 intr_check = Read<u16>(mem, intr_check_addr, cycles);
+    if (discard && !resuming) {
+        intr_check &= ~wanted;
+        Write<u16>(mem, intr_check_addr, intr_check, cycles);
+    }
+
+    Write<u16>(mem, ime_addr, 1, cycles);
+    const u16 matched = intr_check & wanted;
+    if (matched != 0) {
+        Write<u16>(mem, intr_check_addr, intr_check ^ matched, cycles);
+        return cycles;
+    }
+
+    intr_wait_addr = swi_addr;
+    Write<u8>(mem, haltcnt_addr, 0, cycles);
+    return cycles + (ThumbMode() ? Thumb_BranchWritePC(swi_addr) : Arm_BranchWritePC(swi_addr));
+}
+
+int Cpu::BiosDiv(s32 numerator, s32 denominator) {
+    s32 quotient, remainder;
+    if (denominator == 0) {
+        // The BIOS never leaves its division loop, so any answer will do.
+        quotient = (numerator < 0) ? -1 : 1;
+        remainder = numerator;
+    } else if (numerator == min_s32 && denominator == -1) {
+        quotient = numerator;
+        remainder = 0;
+    } else {
+        quotient = numerator / denominator;
+        remainder = numerator % denominator;
+    }
+
+    regs[0] = quotient;
+    regs[1] = remainder;
+    regs[3] = (quotient < 0) ? 0 - static_cast<u32>(quotient) : quotient;
+
+    // The division loop runs once for each bit of the quotient.
+    const int steps = BitLength(std::abs(static_cast<s64>(numerator)))
+                      - BitLength(std::abs(static_cast<s64>(denominator))) + 1;
+    return std::max(steps, 1) * div_step_cycles;
+}
+
+int Cpu::BiosSqrt() {
+    const u32 value = regs[0];
+    u32 remainder = value;
+    u32 root = 0;
+    for (u32 bit = 1u << 30; bit != 0; bit >>= 2) {
+        if (remainder >= root + bit) {
+            remainder -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+
+    regs[0] = root;
+
+    return BitLength(value) * sqrt_bit_cycles;
+}
+
+int Cpu::BiosArcTan() {
+    s32 a, b;
+    regs[0] = ArcTanPoly(regs[0], a, b);
+    regs[1] = a;
+    regs[3] = b;
+
+    return arctan_cycles;
+}
+
+int Cpu::BiosArcTan2() {
+    const s64 x = static_cast<s32>(regs[0]);
+    const s64 y = static_cast<s32>(regs[1]);
+    const s32 y_ratio = Shl(static_cast<s32>(y), 14);
+    const s32 x_ratio = Shl(static_cast<s32>(x), 14);
+
+    // Each octant divides the smaller coordinate by the larger one, so the ratio stays between -1 and 1.
+    s32 angle;
+    if (y == 0) {
+        angle = (x >= 0) ? 0x0000 : 0x8000;
+    } else if (x == 0) {
+        angle = (y >= 0) ? 0x4000 : 0xC000;
+    } else if (y >= 0) {
+        if (x >= 0 && x >= y) {
+            angle = ArcTanOfRatio(y_ratio, x);
+        } else if (x < 0 && -x >= y) {
+            angle = ArcTanOfRatio(y_ratio, x) + 0x8000;
+        } else {
+            angle = 0x4000 - ArcTanOfRatio(x_ratio, y);
+        }
+    } else {
+        if (x <= 0 && -x > -y) {
+            angle = ArcTanOfRatio(y_ratio, x) + 0x8000;
+        } else if (x > 0 && x >= -y) {
+            angle = ArcTanOfRatio(y_ratio, x) + 0x1'0000;
+        } else {
+            angle = 0xC000 - ArcTanOfRatio(x_ratio, y);
+        }
+    }
+
+    regs[0] = angle & 0xFFFF;
+
+    // The ratio takes a division with a 15-bit quotient.
+    return arctan_cycles + 15 * div_step_cycles;
+}
+
+int Cpu::BiosCpuSet() {
+    if (BiosProtected(regs[0])) {
+        return 0;
+    }
+
+    const u32 count = regs[2] & 0x1F'FFFF;
+    const bool fill = regs[2] & 0x0100'0000;
+    int cycles = count * copy_unit_cycles;
+    if (regs[2] & 0x0400'0000) {
+        cycles += CopyUnits<u32>(mem, regs[0], regs[1], count, fill);
+    } else {
+        cycles += CopyUnits<u16>(mem, regs[0], regs[1], count, fill);
+    }
+
+    return cycles;
+}
+
+int Cpu::BiosCpuFastSet() {
+    if (BiosProtected(regs[0])) {
+        return 0;
+    }
+
+    // Words are copied 8 at a time, so the count is rounded up to a multiple of 8.
+    const u32 count = ((regs[2] & 0x1F'FFFF) + 7) & ~0x7;
+    const bool fill = regs[2] & 0x0100'0000;
+
+    return count / 8 * fast_copy_block_cycles + CopyUnits<u32>(mem, regs[0], regs[1], count, fill);
+}
+
+int Cpu::BiosBgAffineSet() {
+    int cycles = 0;
+    u32 src = regs[0];
+    u32 dst = regs[1];
+    for (u32 i = 0; i < regs[2]; ++i, src += 20, dst += 16) {
+        const u32 origin_x = Read<u32>(mem, src, cycles);
+        const u32 origin_y = Read<u32>(mem, src + 4, cycles);
+        const s32 centre_x = static_cast<s16>(Read<u16>(mem, src + 8, cycles));
+        const s32 centre_y = static_cast<s16>(Read<u16>(mem, src + 10, cycles));
+        const s32 scale_x = static_cast<s16>(Read<u16>(mem, src + 12, cycles));
+        const s32 scale_y = static_cast<s16>(Read<u16>(mem, src + 14, cycles));
+        const u32 angle = Read<u16>(mem, src + 16, cycles) >> 8;
+
+        const s32 pa = Mul(scale_x, Cosine(angle)) >> 14;
+        const s32 pb = -(Mul(scale_x, Sine(angle)) >> 14);
+        const s32 pc_term = Mul(scale_y, Sine(angle)) >> 14;
+        const s32 pd = Mul(scale_y, Cosine(angle)) >> 14;
+
+        // The reference point is the origin in the background, less the rotated and scaled centre on the screen.
+        Write<u16>(mem, dst, pa, cycles);
+        Write<u16>(mem, dst + 2, pb, cycles);
+        Write<u16>(mem, dst + 4, pc_term, cycles);
+        Write<u16>(mem, dst + 6, pd, cycles);
+        Write<u32>(mem, dst + 8, origin_x - (Mul(pa, centre_x) + Mul(pb, centre_y)), cycles);
+        Write<u32>(mem, dst + 12, origin_y - (Mul(pc_term, centre_x) + Mul(pd, centre_y)), cycles);
+
+        cycles += affine_cycles;
+    }
+
+    return cycles;
+}
+
+int Cpu::BiosObjAffineSet() {
+    int cycles = 0;
+    u32 src = regs[0];
+    u32 dst = regs[1];
+    const u32 stride = regs[3];
+    for (u32 i = 0; i < regs[2]; ++i, src += 8, dst += 4 * stride) {
+        const s32 scale_x = static_cast<s16>(Read<u16>(mem, src, cycles));
+        const s32 scale_y = static_cast<s16>(Read<u16>(mem, src + 2, cycles));
+        const u32 angle = Read<u16>(mem, src + 4, cycles) >> 8;
+
+        Write<u16>(mem, dst, Mul(scale_x, Cosine(angle)) >> 14, cycles);
+        Write<u16>(mem, dst + stride, -(Mul(scale_x, Sine(angle)) >> 14), cycles);
+        Write<u16>(mem, dst + 2 * stride, Mul(scale_y, Sine(angle)) >> 14, cycles);
+        Write<u16>(mem, dst + 3 * stride, Mul(scale_y, Cosine(angle)) >> 14, cycles);
+
+        cycles += affine_cycles;
+    }
+
+    return cycles;
+}
+
+int Cpu::BiosLz77UnComp(bool vram) {
+    if (BiosProtected(regs[0])) {
+        return 0;
+    }
+
+    int cycles = 0;
+    u32 src = regs[0];
+    const u32 size = Read<u32>(mem, src, cycles) >> 8;
+    src += 4;
+
+    std::vector<u8> data;
+    data.reserve(size);
+    while (data.size() < size) {
+        const u8 flags = Read<u8>(mem, src++, cycles);
+        for (int i = 7; i >= 0 && data.size() < size; --i) {
+            if (!(flags & (1 << i))) {
+                data.push_back(Read<u8>(mem, src++, cycles));
+                continue;
+            }
+
+            // A set flag means the next two bytes copy a run of earlier output.
+            const u8 first = Read<u8>(mem, src++, cycles);
+            const u8 second = Read<u8>(mem, src++, cycles);
+            const std::size_t distance = (((first & 0xF) << 8) | second) + 1;
+            const int length = (first >> 4) + 3;
+            for (int j = 0; j < length && data.size() < size; ++j) {
+                const u8 value = (distance <= data.size()) ? data[data.size() - distance] : 0;
+                data.push_back(value);
+            }
+        }
+    }
+
+    return cycles + BiosWriteDecompressed(data, (vram) ? 2 : 1);
+}
+
+int Cpu::BiosHuffUnComp() {
+    if (BiosProtected(regs[0])) {
+        return 0;
+    }
+
+    int cycles = 0;
+    const u32 header = Read<u32>(mem, regs[0], cycles);
+    const int data_bits = ((header & 0xF) == 4) ? 4 : 8;
+    const u32 size = header >> 8;
+
+    // The tree follows its size byte, and the bitstream of 32-bit words follows the tree.
+    const u32 tree_root = regs[0] + 5;
+    u32 bitstream = regs[0] + 4 + (Read<u8>(mem, regs[0] + 4, cycles) + 1) * 2;
+
+    std::vector<u8> data;
+    data.reserve(size + 3);
+    u32 node_addr = tree_root;
+    u8 node = Read<u8>(mem, node_addr, cycles);
+    u32 out_word = 0;
+    int out_bits = 0;
+    // A tree can't be deeper than it has nodes, so a deeper path means the tree is garbage.
+    int depth = 0;
+    while (data.size() < size && depth < 512) {
+        const u32 word = Read<u32>(mem, bitstream, cycles);
+        bitstream += 4;
+
+        for (int i = 31; i >= 0 && data.size() < size && depth < 512; --i) {
+            const int bit = (word >> i) & 1;
+            const u32 child_addr = (node_addr & ~0x1) + (node & 0x3F) * 2 + 2 + bit;
+
+            if (!(node & (0x80 >> bit))) {
+                node_addr = child_addr;
+                node = Read<u8>(mem, node_addr, cycles);
+                ++depth;
+                continue;
+            }
+
+            out_word |= (Read<u8>(mem, child_addr, cycles) & ((1 << data_bits) - 1)) << out_bits;
+            out_bits += data_bits;
+            if (out_bits == 32) {
+                for (int j = 0; j < 4; ++j) {
+                    data.push_back(out_word >> (j * 8));
+                }
+                out_word = 0;
+                out_bits = 0;
+            }
+
+            node_addr = tree_root;
+            node = Read<u8>(mem, node_addr, cycles);
+            depth = 0;
+        }
+    }
+
+    return cycles + BiosWriteDecompressed(data, 4);
+}
+
+int Cpu::BiosRlUnComp(bool vram) {
+    if (BiosProtected(regs[0])) {
+        return 0;
+    }
+
+    int cycles = 0;
+    u32 src = regs[0];
+    const u32 size = Read<u32>(mem, src, cycles) >> 8;
+    src += 4;
+
+    std::vector<u8> data;
+    data.reserve(size);
+    while (data.size() < size) {
+        // A set top bit means a run of one repeated byte, otherwise a run of uncompressed bytes.
+        const u8 flag = Read<u8>(mem, src++, cycles);
+        if (flag & 0x80) {
+            const u8 value = Read<u8>(mem, src++, cycles);
+            for (int i = 0; i < (flag & 0x7F) + 3 && data.size() < size; ++i) {
+                data.push_back(value);
+            }
+        } else {
+            for (int i = 0; i < (flag & 0x7F) + 1 && data.size() < size; ++i) {
+                data.push_back(Read<u8>(mem, src++, cycles));
+            }
+        }
+    }
+
+    return cycles + BiosWriteDecompressed(data, (vram) ? 2 : 1);
+}
+
+int Cpu::BiosWriteDecompressed(const std::vector<u8>& data, int unit_size) {
+    // VRAM can't be written a byte at a time, so the VRAM versions write whole halfwords.
+    int cycles = data.size() * decompress_byte_cycles;
+    for (std::size_t i = 0; i < data.size(); i += unit_size) {
+        u32 value = 0;
+        for (int j = 0; j < unit_size && i + j < data.size(); ++j) {
+            value |= data[i + j] << (j * 8);
+        }
+
+        const u32 addr = regs[1] + i;
+        if (unit_size == 1) {
+            Write<u8>(mem, addr, value, cycles);
+        } else if (unit_size == 2) {
+            Write<u16>(mem, addr, value, cycles);
+        } else {
+            Write<u32>(mem, addr, value, cycles);
+        }
+    }
+
+    return cycles;
+}
+
+} // End namespace Gba
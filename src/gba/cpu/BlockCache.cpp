@@ -0,0 +1,223 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gba/cpu/BlockCache.h"
+#include "gba/cpu/Cpu.h"
+#include "gba/memory/Memory.h"
+
+namespace Gba {
+
+BlockCache::BlockCache(Cpu& _cpu, Memory& _mem)
+        : cpu(_cpu)
+        , mem(_mem) {}
+
+template <typename T>
+const CachedOp<T>* BlockCache::LookupSlow(u32 addr) {
+    if (!Cacheable(addr)) {
+        return nullptr;
+    }
+
+    const u32 fetch_addr = addr;
+    addr = CanonicalAddr(addr);
+    const u32 page_addr = addr & page_mask;
+
+    auto& map = Pages<T>();
+    if (map.last_page == nullptr || map.last_page_addr != page_addr) {
+        auto& page = map.pages[page_addr];
+        if (page == nullptr) {
+            page = std::make_unique<CodePage<T>>();
+            if (page_addr < BaseAddr::IO) {
+                const std::size_t ram_page = RamPageIndex(page_addr);
+                code_page_bits[ram_page / 64] |= u64{1} << (ram_page % 64);
+            }
+        }
+
+        map.last_page_addr = page_addr;
+        map.last_page = page.get();
+    }
+
+    const std::size_t index = (addr & ~page_mask) / sizeof(T);
+    const auto& op = map.last_page->ops[index];
+    if (op.handler == nullptr) {
+        DecodeBlock(*map.last_page, addr);
+    }
+
+    // The next op is followed through the address it was fetched from, so mirrors can't be mixed up.
+    if (index + 1 < map.last_page->ops.size()) {
+        map.next_addr = fetch_addr + sizeof(T);
+        map.next_op = &op + 1;
+    } else {
+        map.next_addr = no_next_addr;
+    }
+
+    return &op;
+}
+
+template const CachedOp<Thumb>* BlockCache::LookupSlow<Thumb>(u32 addr);
+template const CachedOp<Arm>* BlockCache::LookupSlow<Arm>(u32 addr);
+
+bool BlockCache::Cacheable(u32 addr) {
+    switch (addr >> 24) {
+    case BaseAddr::XRam >> 24:
+    case BaseAddr::IRam >> 24:
+        return true;
+    case 0x8:
+        // The GPIO registers are mapped into the first page of ROM, so reads from it can change.
+        return (addr & page_mask) != BaseAddr::Rom;
+    case 0x9:
+    case 0xA:
+    case 0xB:
+    case 0xC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+u32 BlockCache::CanonicalAddr(u32 addr) {
+    // EWRAM and IWRAM are mirrored, so writes through one mirror must invalidate code fetched through another.
+    switch (addr >> 24) {
+    case BaseAddr::XRam >> 24:
+        return BaseAddr::XRam | (addr & (256 * kbyte - 1));
+    case BaseAddr::IRam >> 24:
+        return BaseAddr::IRam | (addr & (32 * kbyte - 1));
+    default:
+        return addr;
+    }
+}
+
+template <typename T>
+void BlockCache::DecodeBlock(CodePage<T>& page, u32 addr) {
+    for (u32 i = (addr & ~page_mask) / sizeof(T); i < page.ops.size(); ++i, addr += sizeof(T)) {
+        auto& op = page.ops[i];
+        if (op.handler != nullptr) {
+            // The rest of this block was decoded as part of an earlier one.
+            break;
+        }
+
+        op.opcode = mem.ReadMem<T>(addr);
+        if constexpr (std::is_same_v<T, Thumb>) {
+            op.handler = cpu.DecodeThumb(op.opcode);
+        } else {
+            op.handler = cpu.DecodeArm(op.opcode);
+        }
+        op.fetch_cycles = FetchCycles<T>(addr);
+
+        if (EndsBlock(op.opcode)) {
+            break;
+        }
+    }
+}
+
+template <typename T>
+int BlockCache::FetchCycles(u32 addr) const {
+    switch (addr >> 24) {
+    case BaseAddr::XRam >> 24:
+        return 3 << (sizeof(T) / 4);
+    case BaseAddr::IRam >> 24:
+        return 1;
+    default:
+        // ROM fetch timings depend on the state of the prefetch buffer.
+        return 0;
+    }
+}
+
+bool BlockCache::EndsBlock(Thumb opcode) {
+    // Conditional branches, SWI, B, BL, BX, and hi register operations or POPs which write to the PC.
+    // This may end blocks early, which is harmless.
+    return (opcode & 0xF000) == 0xD000
+        || (opcode & 0xE000) == 0xE000
+        || (opcode & 0xFF00) == 0x4700
+        || (opcode & 0xFC87) == 0x4487
+        || (opcode & 0xFF00) == 0xBD00;
+}
+
+bool BlockCache::EndsBlock(Arm opcode) {
+    // B, BL, BX, SWI, undefined instructions, LDMs which load the PC, and any data processing or load instruction
+    // which has the PC as its destination.
+    return (opcode & 0x0E00'0000) == 0x0A00'0000
+        || (opcode & 0x0C00'0000) == 0x0C00'0000
+        || (opcode & 0x0FFF'FFF0) == 0x012F'FF10
+        || (opcode & 0x0E10'8000) == 0x0810'8000
+        || ((opcode & 0x0C00'0000) == 0x0000'0000 && (opcode & 0x0000'F000) == 0x0000'F000)
+        || ((opcode & 0x0C10'F000) == 0x0410'F000)
+        || ((opcode & 0x0E00'0010) == 0x0600'0010);
+}
+
+void BlockCache::InvalidatePage(u32 addr, std::size_t page) {
+    const u32 page_addr = CanonicalAddr(addr) & page_mask;
+
+    thumb_pages.pages.erase(page_addr);
+    if (thumb_pages.last_page_addr == page_addr) {
+        thumb_pages.last_page = nullptr;
+    }
+    thumb_pages.next_addr = no_next_addr;
+
+    arm_pages.pages.erase(page_addr);
+    if (arm_pages.last_page_addr == page_addr) {
+        arm_pages.last_page = nullptr;
+    }
+    arm_pages.next_addr = no_next_addr;
+
+    code_page_bits[page / 64] &= ~(u64{1} << (page % 64));
+    code_invalidated(page_addr, page_size);
+}
+
+void BlockCache::InvalidateRange(u32 addr, u32 bytes) {
+    addr = CanonicalAddr(addr);
+    const u32 page_addr = addr & page_mask;
+    ClearOps(thumb_pages, page_addr, addr & ~page_mask, bytes);
+    ClearOps(arm_pages, page_addr, addr & ~page_mask, bytes);
+    code_invalidated(addr, bytes);
+}
+
+template <typename T>
+void BlockCache::ClearOps(PageMap<T>& map, u32 page_addr, u32 offset, u32 bytes) {
+    const auto it = map.pages.find(page_addr);
+    if (it == map.pages.end()) {
+        return;
+    }
+
+    // Every op is decoded on its own, so only the ones overwritten need decoding again. The blocks around them
+    // stay as they are, and decoding picks up again at the first cleared op.
+    auto& ops = it->second->ops;
+    for (u32 i = offset / sizeof(T); i <= (offset + bytes - 1) / sizeof(T); ++i) {
+        ops[i] = CachedOp<T>{};
+    }
+}
+
+void BlockCache::InvalidateRam() {
+    for (std::size_t page = 0; page < xram_pages + iram_pages; ++page) {
+        if (code_page_bits[page / 64] & (u64{1} << (page % 64))) {
+            const u32 addr = (page < xram_pages) ? BaseAddr::XRam + (page << page_shift)
+                                                 : BaseAddr::IRam + ((page - xram_pages) << page_shift);
+            InvalidatePage(addr, page);
+        }
+    }
+}
+
+void BlockCache::Clear() {
+    thumb_pages = PageMap<Thumb>{};
+    arm_pages = PageMap<Arm>{};
+    code_page_bits.fill(0);
+}
+
+void BlockCache::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("block_cache", sizeof(BlockCache) + thumb_pages.pages.size() * sizeof(CodePage<Thumb>)
+                              + arm_pages.pages.size() * sizeof(CodePage<Arm>));
+}
+
+} // End namespace Gba
@@ -0,0 +1,161 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+
+#include "common/CommonTypes.h"
+#include "common/MemoryReport.h"
+#include "gba/cpu/CpuDefs.h"
+#include "gba/memory/MemDefs.h"
+
+namespace Gba {
+
+class Cpu;
+class Memory;
+
+template <typename T>
+using Handler = int(*)(Cpu& cpu, T opcode);
+
+// A decoded opcode. Handlers extract their operands with compile-time masks, so the opcode itself is the operand
+// storage. RAM fetch timings don't depend on the prefetch buffer and are precomputed; ROM timings are not.
+template <typename T>
+struct CachedOp {
+    T opcode = 0;
+    Handler<T> handler = nullptr;
+    int fetch_cycles = 0;
+};
+
+// Caches basic blocks of decoded instructions from ROM, EWRAM, and IWRAM. Blocks never cross a page, and each page
+// holds a table of the decoded opcodes within it, so looking up the next instruction of a block is a single index.
+class BlockCache {
+public:
+    BlockCache(Cpu& _cpu, Memory& _mem);
+
+    // Returns null if the address is not in a cacheable region.
+    template <typename T>
+    const CachedOp<T>* Lookup(u32 addr) {
+        // Fetches are nearly always sequential, so the op after the last one looked up is checked first.
+        auto& map = Pages<T>();
+        if (addr == map.next_addr && map.next_op->handler != nullptr) {
+            const u32 next_addr = addr + sizeof(T);
+            map.next_addr = ((next_addr & ~page_mask) != 0) ? next_addr : no_next_addr;
+            return map.next_op++;
+        }
+
+        return LookupSlow<T>(addr);
+    }
+
+    // Called for every write to EWRAM or IWRAM, to throw away the decoded ops it overwrote. Writes to pages which
+    // hold no code only cost a bit test. The write must not cross a page.
+    void CodeWritten(u32 addr, u32 bytes) {
+        const std::size_t page = RamPageIndex(addr);
+        if (code_page_bits[page / 64] & (u64{1} << (page % 64))) {
+            InvalidateRange(addr, bytes);
+        }
+    }
+
+    // Throws away every block decoded from RAM, e.g. after loading a savestate.
+    void InvalidateRam();
+    // Throws away every block, for when the CPU switches decode tables.
+    void Clear();
+
+    void ReportMemory(Common::MemoryReport& report) const;
+
+    // Called with the canonical address and size of each range of code that gets invalidated.
+    std::function<void(u32, u32)> code_invalidated{[](u32, u32) {}};
+
+    static constexpr int page_shift = 8;
+    static constexpr u32 page_size = 1 << page_shift;
+    static constexpr u32 page_mask = ~(page_size - 1);
+
+    static bool Cacheable(u32 addr);
+    static u32 CanonicalAddr(u32 addr);
+
+private:
+    Cpu& cpu;
+    Memory& mem;
+
+    static constexpr std::size_t xram_pages = (256 * kbyte) >> page_shift;
+    static constexpr std::size_t iram_pages = (32 * kbyte) >> page_shift;
+
+    template <typename T>
+    struct CodePage {
+        std::array<CachedOp<T>, page_size / sizeof(T)> ops{};
+    };
+
+    static constexpr u32 no_next_addr = 1;
+
+    template <typename T>
+    struct PageMap {
+        std::unordered_map<u32, std::unique_ptr<CodePage<T>>> pages;
+
+        // Consecutive fetches are nearly always from the same page, so skip the hash lookup for them.
+        u32 last_page_addr = 0;
+        CodePage<T>* last_page = nullptr;
+
+        // The address and op following the last lookup, as long as it's on the same page. No fetch is ever from
+        // an odd address, so that marks the end of a page.
+        u32 next_addr = no_next_addr;
+        const CachedOp<T>* next_op = nullptr;
+    };
+
+    PageMap<Thumb> thumb_pages;
+    PageMap<Arm> arm_pages;
+
+    // One bit per EWRAM and IWRAM page, set while any ops are decoded from it. Only 144 bytes, so the store path
+    // check stays in L1.
+    std::array<u64, (xram_pages + iram_pages) / 64> code_page_bits{};
+
+    static std::size_t RamPageIndex(u32 addr) {
+        if ((addr >> 24) == (BaseAddr::XRam >> 24)) {
+            return (addr & (256 * kbyte - 1)) >> page_shift;
+        } else {
+            return xram_pages + ((addr & (32 * kbyte - 1)) >> page_shift);
+        }
+    }
+
+    template <typename T>
+    PageMap<T>& Pages() {
+        if constexpr (std::is_same_v<T, Thumb>) {
+            return thumb_pages;
+        } else {
+            return arm_pages;
+        }
+    }
+
+    template <typename T>
+    const CachedOp<T>* LookupSlow(u32 addr);
+    template <typename T>
+    void DecodeBlock(CodePage<T>& page, u32 addr);
+    template <typename T>
+    int FetchCycles(u32 addr) const;
+
+    static bool EndsBlock(Thumb opcode);
+    static bool EndsBlock(Arm opcode);
+
+    void InvalidatePage(u32 addr, std::size_t page);
+    void InvalidateRange(u32 addr, u32 bytes);
+    template <typename T>
+    void ClearOps(PageMap<T>& map, u32 page_addr, u32 offset, u32 bytes);
+};
+
+} // End namespace Gba
@@ -16,42 +16,96 @@
 
 #include <algorithm>
 #include <cassert>
+#include <type_traits>
+#include <fmt/format.h>
 
 #include "gba/cpu/Cpu.h"
 #include "gba/cpu/Instruction.h"
 #include "gba/cpu/Disassembler.h"
+#include "gba/cpu/Jit.h"
 #include "gba/core/Core.h"
 #include "gba/memory/Memory.h"
 #include "gba/hardware/Dma.h"
+#include "common/Tracer.h"
+#include "common/SaveState.h"
 
 namespace Gba {
 
-Cpu::Cpu(Memory& _mem, Core& _core)
+namespace {
+
+// Bit n of each entry is whether the condition passes when the NZCV flags are n.
+constexpr std::array<u16, 16> MakeConditionTable() {
+    std::array<u16, 16> table{};
+    for (u32 nzcv = 0; nzcv < 16; ++nzcv) {
+        const bool n = nzcv & 0x8, z = nzcv & 0x4, c = nzcv & 0x2, v = nzcv & 0x1;
+        const bool passed[16] = {z,            !z,
+                                 c,            !c,
+                                 n,            !n,
+                                 v,            !v,
+                                 c && !z,      !(c && !z),
+                                 n == v,       n != v,
+                                 n == v && !z, !(n == v && !z),
+                                 true,         true};
+        for (int cond = 0; cond < 16; ++cond) {
+            table[cond] |= passed[cond] << nzcv;
+        }
+    }
+    return table;
+}
+
+constexpr std::array<u16, 16> condition_table = MakeConditionTable();
+
+} // End anonymous namespace
+
+Cpu::Cpu(Memory& _mem, Core& _core, bool _hle_bios)
         : mem(_mem)
         , core(_core)
-        , thumb_instructions(GetThumbInstructionTable<Cpu>())
-        , arm_instructions(GetArmInstructionTable<Cpu>()) {
-
-    PopulateThumbDecodeTable();
-}
+        , thumb_decode_table(&GetThumbDecodeTable<Cpu>())
+        , arm_decode_table(&GetArmDecodeTable())
+        , hle_bios(_hle_bios) {}
 
 // Needed to declare std::vector with forward-declared type in the header file.
 Cpu::~Cpu() = default;
 
+void Cpu::SkipBios() {
+    // The BIOS sets up the IRQ, supervisor and user/system stacks at the top of IWRAM, and returns to the
+    // cartridge in System mode with interrupts enabled and every other register cleared.
+    sp_banked[CpuModeIndex(CpuMode::Irq)] = 0x0300'7FA0;
+    sp_banked[CpuModeIndex(CpuMode::Svc)] = 0x0300'7FE0;
+    sp_banked[CpuModeIndex(CpuMode::User)] = 0x0300'7F00;
+    regs.fill(0);
+    regs[sp] = 0x0300'7F00;
+    SetCpsr(static_cast<u32>(CpuMode::System));
+
+    // The last BIOS opcode fetched is the one which returned to the cartridge, and reads of the BIOS from outside
+    // of it return that.
+    last_bios_fetch = 0xE129'F000;
+
+    regs[pc] = 0x0800'0000;
+    FlushPipeline();
+}
+
 int Cpu::Execute(int cycles) {
-    while (cycles > 0) {
+    while (cycles > 0 && !stop_requested) {
         int cycles_taken = 0;
 
         if (dma_active) {
             // The CPU is blocked while DMA is active.
             // Higher priority DMAs preempt lower priority ones, where DMA0 is the highest priority.
+            // A DMA can only be preempted by a trigger from an event, so chunks starting before the next
+            // event can run in one go.
+            const int cycle_limit = std::min<u64>(cycles, core.scheduler.CyclesUntilNextEvent());
             for (auto& dma : core.dma) {
                 if (dma.Active()) {
-                    cycles_taken = dma.Run();
+                    cycles_taken = dma.Run(cycle_limit);
                     break;
                 }
             }
 
+            core.counters.Add(Common::PerfCounters::DmaCycles, cycles_taken);
+            if (core.profiler != nullptr) {
+                core.profiler->Tick(cycles_taken, Common::PcProfiler::dma_key);
+            }
             core.UpdateHardware(cycles_taken);
             cycles -= cycles_taken;
             continue;
@@ -61,10 +115,13 @@ int Cpu::Execute(int cycles) {
             if (halted) {
                 halted = false;
                 core.disasm->LogHalt();
+                if (core.tracer != nullptr) {
+                    core.tracer->End(Common::Tracer::Cpu, "halt", core.scheduler.Timestamp());
+                }
             }
 
             if (InterruptsEnabled()) {
-                cycles_taken += TakeException(CpuMode::Irq);
+                cycles_taken += TakeIrq();
             }
         }
 
@@ -72,15 +129,43 @@ int Cpu::Execute(int cycles) {
             const int halt_cycles = core.HaltCycles(cycles);
             core.UpdateHardware(halt_cycles);
             core.disasm->IncHaltCycles(halt_cycles);
+            core.counters.Add(Common::PerfCounters::HaltCycles, halt_cycles);
+            if (core.profiler != nullptr) {
+                core.profiler->Tick(halt_cycles, Common::PcProfiler::halted_key);
+            }
             cycles -= halt_cycles;
             continue;
         }
 
+        const u32 instr_addr = regs[pc] - (ThumbMode() ? 4 : 8);
+        const int start_cycles = cycles;
+        u32 profile_key;
+        u32 profile_opcode;
+        if (core.coverage != nullptr) {
+            core.coverage->Visit(instr_addr | ThumbMode());
+        }
+        if (core.code_coverage != nullptr) {
+            ThumbMode() ? MarkCode<Thumb>(instr_addr) : MarkCode<Arm>(instr_addr);
+        }
         if (ThumbMode()) {
+            if (core.jit != nullptr && cycles_taken == 0 && !core.disasm->LoggingEnabled()
+                    && core.coverage == nullptr) {
+                const int jit_cycles = RunJit(cycles);
+                if (jit_cycles != 0) {
+                    if (core.profiler != nullptr) {
+                        // The whole run is attributed to its first instruction.
+                        core.profiler->Tick(jit_cycles, instr_addr | Common::PcProfiler::thumb_bit, pipeline[1]);
+                    }
+                    cycles -= jit_cycles;
+                    continue;
+                }
+            }
+
             pipeline[0] = pipeline[1];
             pipeline[1] = pipeline[2];
-            pipeline[2] = mem.ReadMem<Thumb>(regs[pc]);
-            cycles_taken += mem.AccessTime<Thumb>(regs[pc], AccessType::Opcode);
+            thumb_handlers[0] = thumb_handlers[1];
+            thumb_handlers[1] = thumb_handlers[2];
+            cycles_taken += FetchOpcode<Thumb>(2);
 
             // Sync hardware after the prefetch.
             core.UpdateHardware(cycles_taken);
@@ -88,9 +173,15 @@ int Cpu::Execute(int cycles) {
             cycles_taken = 0;
 
             const Thumb opcode = pipeline[0];
-            core.disasm->DisassembleThumb(opcode, regs, cpsr);
-            const auto& impl = DecodeThumb(opcode);
-            cycles_taken += impl(*this, opcode);
+            if (core.disasm->LoggingEnabled()) {
+                core.disasm->DisassembleThumb(opcode, regs, Cpsr());
+            }
+            const ThumbHandler handler = (thumb_handlers[0] != nullptr) ? thumb_handlers[0] : DecodeThumb(opcode);
+            cycles_taken += handler(*this, opcode);
+            core.counters.Add(Common::PerfCounters::Instructions);
+            core.counters.Add(Common::PerfCounters::DecodeMisses, thumb_handlers[0] == nullptr);
+            profile_key = instr_addr | Common::PcProfiler::thumb_bit;
+            profile_opcode = opcode;
 
             if (!pc_written) {
                 // Only increment the PC if the executing instruction didn't change it.
@@ -99,8 +190,9 @@ int Cpu::Execute(int cycles) {
         } else {
             pipeline[0] = pipeline[1];
             pipeline[1] = pipeline[2];
-            pipeline[2] = mem.ReadMem<Arm>(regs[pc]);
-            cycles_taken += mem.AccessTime<Arm>(regs[pc], AccessType::Opcode);
+            arm_handlers[0] = arm_handlers[1];
+            arm_handlers[1] = arm_handlers[2];
+            cycles_taken += FetchOpcode<Arm>(2);
 
             // Sync hardware after the prefetch.
             core.UpdateHardware(cycles_taken);
@@ -108,12 +200,20 @@ int Cpu::Execute(int cycles) {
             cycles_taken = 0;
 
             const Arm opcode = pipeline[0];
-            core.disasm->DisassembleArm(opcode, regs, cpsr);
+            if (core.disasm->LoggingEnabled()) {
+                core.disasm->DisassembleArm(opcode, regs, Cpsr());
+            }
 
-            if (ConditionPassed(GetCondition(opcode))) {
-                const auto& impl = DecodeArm(opcode);
-                cycles_taken += impl(*this, opcode);
+            // Almost every ARM opcode is unconditional.
+            const Condition cond = GetCondition(opcode);
+            if (cond == Condition::Always || ConditionPassed(cond)) {
+                const ArmHandler handler = (arm_handlers[0] != nullptr) ? arm_handlers[0] : DecodeArm(opcode);
+                cycles_taken += handler(*this, opcode);
+                core.counters.Add(Common::PerfCounters::DecodeMisses, arm_handlers[0] == nullptr);
             }
+            core.counters.Add(Common::PerfCounters::Instructions);
+            profile_key = instr_addr;
+            profile_opcode = opcode;
 
             if (!pc_written) {
                 // Only increment the PC if the executing instruction didn't change it.
@@ -127,52 +227,142 @@ int Cpu::Execute(int cycles) {
             cycles -= cycles_taken;
         }
 
+        if (pc_written && !core.disasm->LoggingEnabled()) {
+            cycles -= SkipIdleLoop(instr_addr, cycles);
+        }
+
+        if (core.profiler != nullptr) {
+            // Skipped idle loop iterations are attributed to the branch that closes the loop.
+            core.profiler->Tick(start_cycles - cycles, profile_key, profile_opcode);
+        }
+
         pc_written = false;
     }
 
-    // Return the number of overspent cycles.
+    // Return the number of overspent cycles, or the cycles left over if a stop was requested.
     return cycles;
 }
 
-void Cpu::PopulateThumbDecodeTable() {
-    // The lower 6 bits of all Thumb opcodes are variable, so we only need to use the top 10 bits to identify
-    // which instruction implementation to use.
-    for (u16 opcode = 0; opcode < 0x400; ++opcode) {
-        for (const auto& instr : thumb_instructions) {
-            if (instr.Match(opcode << 6)) {
-                thumb_decode_table[opcode] = &instr.impl_func;
+Cpu::ArmDecodeTable::ArmDecodeTable(ArmHandler hook)
+        : instructions(GetArmInstructionTable<Cpu>()) {
+    constexpr Arm index_mask = 0x0FF0'00F0;
+
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const Arm index_bits = ((i & 0xFF0) << 16) | ((i & 0xF) << 4);
+        auto& entry = entries[i];
+        entry.first_candidate = candidates.size();
+
+        // The instructions are sorted by the number of fixed bits, so candidates are added in the order they
+        // need to be matched. Stop once we reach an instruction which matches every opcode with these index bits.
+        for (const auto& instr : instructions) {
+            if (!instr.Match(index_bits, index_mask)) {
+                continue;
+            }
+
+            candidates.push_back(&instr);
+            if (instr.MatchesAll(~index_mask)) {
                 break;
             }
         }
+
+        entry.num_candidates = candidates.size() - entry.first_candidate;
+        if (entry.num_candidates == 1) {
+            entry.handler = candidates.back()->impl_func;
+        }
+        if (hook != nullptr) {
+            entry.handler = hook;
+        }
     }
 }
 
-const std::function<int(Cpu& cpu, Thumb opcode)>& Cpu::DecodeThumb(Thumb opcode) const {
-    return *thumb_decode_table[opcode >> 6];
+const Cpu::ArmDecodeTable& Cpu::GetArmDecodeTable() {
+    static const ArmDecodeTable decode_table;
+    return decode_table;
+}
+
+const Cpu::ArmDecodeTable& Cpu::GetHookedArmDecodeTable() {
+    static const ArmDecodeTable decode_table{&ExecHook<Arm>};
+    return decode_table;
+}
+
+const std::array<Cpu::ThumbHandler, 0x400>& Cpu::GetHookedThumbDecodeTable() {
+    static const std::array<ThumbHandler, 0x400> decode_table = [] {
+        std::array<ThumbHandler, 0x400> table;
+        table.fill(&ExecHook<Thumb>);
+        return table;
+    }();
+    return decode_table;
 }
 
-const std::function<int(Cpu& cpu, Arm opcode)>& Cpu::DecodeArm(Arm opcode) {
-    int opcode_hash = ((opcode >> 16) ^ opcode) * 0x45D9F3B;
-    opcode_hash = ((opcode_hash >> 16) ^ opcode_hash) * 0x45D9F3B;
-    opcode_hash = ((opcode_hash >> 16) ^ opcode_hash) % arm_decode_cache.size();
+Cpu::ArmHandler Cpu::DecodeArm(Arm opcode, const ArmDecodeTable& decode_table) {
+    const auto& entry = decode_table.entries[ArmDecodeIndex(opcode)];
+    if (entry.handler != nullptr) {
+        return entry.handler;
+    }
 
-    auto& cache_entries = arm_decode_cache[opcode_hash];
-    for (const auto& instr : cache_entries) {
+    for (int i = entry.first_candidate; i < entry.first_candidate + entry.num_candidates; ++i) {
+        const auto instr = decode_table.candidates[i];
         if (instr->Match(opcode)) {
             return instr->impl_func;
         }
     }
 
-    // Opcode not in cache.
-    for (const auto& instr : arm_instructions) {
-        if (instr.Match(opcode)) {
-            cache_entries.push_back(&instr);
-            return instr.impl_func;
+    // Undefined instruction.
+    return decode_table.instructions.back().impl_func;
+}
+
+template <typename T>
+int Cpu::ExecHook(Cpu& cpu, T opcode) {
+    // The PC hasn't moved on from the instruction yet, so it's still two instructions ahead of it.
+    if constexpr (std::is_same_v<T, Thumb>) {
+        cpu.core.hooks.Executed(cpu.regs[pc] - 4);
+        return GetThumbDecodeTable<Cpu>()[opcode >> 6](cpu, opcode);
+    } else {
+        cpu.core.hooks.Executed(cpu.regs[pc] - 8);
+        return DecodeArm(opcode, GetArmDecodeTable())(cpu, opcode);
+    }
+}
+
+void Cpu::HooksChanged() {
+    const bool hooked = core.hooks.ExecHooked();
+    if (hooked == (thumb_decode_table != &GetThumbDecodeTable<Cpu>())) {
+        return;
+    }
+
+    thumb_decode_table = hooked ? &GetHookedThumbDecodeTable() : &GetThumbDecodeTable<Cpu>();
+    arm_decode_table = hooked ? &GetHookedArmDecodeTable() : &GetArmDecodeTable();
+
+    // Throw away everything decoded through the old tables. JIT runs don't execute through handlers at all, so
+    // the JIT sits out while any PC is hooked.
+    if (core.block_cache != nullptr) {
+        core.block_cache->Clear();
+    }
+    if (core.jit != nullptr) {
+        core.jit->Pause(hooked);
+    }
+    DecodePipeline();
+}
+
+void Cpu::DecodePipeline() {
+    for (int i = 0; i < 3; ++i) {
+        if (core.block_cache != nullptr) {
+            thumb_handlers[i] = DecodeThumb(static_cast<Thumb>(pipeline[i]));
+            arm_handlers[i] = DecodeArm(pipeline[i]);
+        } else {
+            thumb_handlers[i] = nullptr;
+            arm_handlers[i] = nullptr;
         }
     }
+}
 
-    // Undefined instruction.
-    return arm_instructions.back().impl_func;
+void Cpu::RomPatched() {
+    if (core.block_cache != nullptr) {
+        core.block_cache->Clear();
+    }
+    if (core.jit != nullptr) {
+        // Flushes the runs without changing whether the JIT is sitting out for PC hooks.
+        core.jit->Pause(core.hooks.ExecHooked());
+    }
 }
 
 bool Cpu::InterruptsEnabled() const {
@@ -195,39 +385,119 @@ bool Cpu::ValidCpuMode(u32 new_mode) const {
 }
 
 void Cpu::CpuModeSwitch(CpuMode new_cpu_mode) {
-    sp_banked[CurrentCpuModeIndex()] = regs[sp];
-    lr_banked[CurrentCpuModeIndex()] = regs[lr];
+    const int old_index = CurrentCpuModeIndex();
+    const int new_index = CpuModeIndex(new_cpu_mode);
+    sp_banked[old_index] = regs[sp];
+    lr_banked[old_index] = regs[lr];
 
-    regs[sp] = sp_banked[CpuModeIndex(new_cpu_mode)];
-    regs[lr] = lr_banked[CpuModeIndex(new_cpu_mode)];
+    regs[sp] = sp_banked[new_index];
+    regs[lr] = lr_banked[new_index];
 
     // Swap R8-R12 with the banked values if switched to or from FIQ mode, unless we're "switching" from FIQ to FIQ.
-    if ((new_cpu_mode == CpuMode::Fiq || CurrentCpuMode() == CpuMode::Fiq) && new_cpu_mode != CurrentCpuMode()) {
+    const int fiq_index = CpuModeIndex(CpuMode::Fiq);
+    if (old_index != new_index && (old_index == fiq_index || new_index == fiq_index)) {
         std::swap_ranges(regs.begin() + 8, regs.begin() + 13, fiq_banked_regs.begin());
     }
 
     cpsr = (cpsr & ~cpu_mode) | static_cast<u32>(new_cpu_mode);
 }
 
+template <typename T>
+int Cpu::FetchOpcode(int slot) {
+    const u32 addr = regs[pc];
+
+    if (core.block_cache != nullptr) {
+        if (const auto op = core.block_cache->Lookup<T>(addr)) {
+            core.access_counters.Add(addr, Common::AccessCounters::Fetch);
+            pipeline[slot] = op->opcode;
+            PipelineHandlers<T>()[slot] = op->handler;
+
+            if (op->fetch_cycles != 0) {
+                // Keep the sequential access tracking identical to an uncached fetch.
+                mem.MakeNextAccessSequential(addr);
+                return op->fetch_cycles;
+            }
+
+            return mem.AccessTime<T>(addr, AccessType::Opcode);
+        }
+    }
+
+    // Without a cached block the opcode is decoded when it executes, so a handler left over from an earlier fetch
+    // must never stay in the slot.
+    PipelineHandlers<T>()[slot] = nullptr;
+    pipeline[slot] = mem.ReadMem<T>(addr, AccessType::Opcode);
+    return mem.AccessTime<T>(addr, AccessType::Opcode);
+}
+
+int Cpu::RunJit(int cycles) {
+    // The instruction about to execute is in pipeline[1], two instructions behind the PC.
+    const Jit::Run* run = core.jit->Lookup(regs[pc] - 4);
+    if (run == nullptr || pipeline[1] != run->first_opcodes[0] || pipeline[2] != run->first_opcodes[1]) {
+        return 0;
+    }
+
+    // The interpreter checks for interrupts and the end of the time slice between instructions, so only take the
+    // run if every instruction before the last one is guaranteed to finish before the next event and slice end.
+    const u64 limit = std::min<u64>(cycles, core.scheduler.CyclesUntilNextEvent());
+    if (static_cast<u64>(run->max_cycles_before_last) >= limit) {
+        return 0;
+    }
+
+    // None of the instructions access memory, so the opcode fetches are the only thing that affects timing.
+    int cycles_taken = 0;
+    core.access_counters.AddRange(regs[pc], 2 * run->length, 2, Common::AccessCounters::Fetch);
+    for (int i = 0; i < run->length; ++i) {
+        const u32 addr = regs[pc] + 2 * i;
+        if (run->fetch_cycles != 0) {
+            mem.MakeNextAccessSequential(addr);
+            cycles_taken += run->fetch_cycles;
+        } else {
+            cycles_taken += mem.AccessTime<Thumb>(addr, AccessType::Opcode);
+        }
+    }
+
+    u32 run_cpsr = Cpsr();
+    run->func(regs.data(), &run_cpsr);
+    SetCpsr(run_cpsr);
+    core.counters.Add(Common::PerfCounters::Instructions, run->length);
+    if (core.code_coverage != nullptr) {
+        // RunFor marked the first instruction already.
+        for (int i = 1; i < run->length; ++i) {
+            MarkCode<Thumb>(regs[pc] - 4 + 2 * i);
+        }
+    }
+
+    regs[pc] += 2 * run->length;
+    pipeline = {{run->pipeline[0], run->pipeline[1], run->pipeline[2]}};
+    thumb_handlers = run->handlers;
+
+    core.UpdateHardware(cycles_taken);
+    return cycles_taken;
+}
+
+template <typename T>
+void Cpu::MarkCode(u32 addr) {
+    const std::size_t slot = mem.CodeSlot<T>(addr);
+    if (slot != Memory::no_code_slot) {
+        core.code_coverage->Mark(slot);
+    }
+}
+
 int Cpu::FlushPipeline() {
     mem.FlushPrefetchBuffer();
 
     int cycles = 0;
     if (ThumbMode()) {
-        pipeline[1] = mem.ReadMem<Thumb>(regs[pc]);
-        cycles += mem.AccessTime<Thumb>(regs[pc], AccessType::Opcode);
+        cycles += FetchOpcode<Thumb>(1);
         regs[pc] += 2;
 
-        pipeline[2] = mem.ReadMem<Thumb>(regs[pc]);
-        cycles += mem.AccessTime<Thumb>(regs[pc], AccessType::Opcode);
+        cycles += FetchOpcode<Thumb>(2);
         regs[pc] += 2;
     } else {
-        pipeline[1] = mem.ReadMem<Arm>(regs[pc]);
-        cycles += mem.AccessTime<Arm>(regs[pc], AccessType::Opcode);
+        cycles += FetchOpcode<Arm>(1);
         regs[pc] += 4;
 
-        pipeline[2] = mem.ReadMem<Arm>(regs[pc]);
-        cycles += mem.AccessTime<Arm>(regs[pc], AccessType::Opcode);
+        cycles += FetchOpcode<Arm>(2);
         regs[pc] += 4;
     }
 
@@ -235,9 +505,158 @@ int Cpu::FlushPipeline() {
     return cycles;
 }
 
+int Cpu::SkipIdleLoop(u32 branch_addr, int cycles) {
+    const u32 target = regs[pc] - (ThumbMode() ? 4 : 8);
+    const u64 now = core.scheduler.Timestamp();
+
+    if (target > branch_addr || branch_addr - target >= max_idle_loop_bytes) {
+        // Forward branches within the loop body don't end the loop, but anything else does.
+        if (target < idle_loop.target || target > idle_loop.branch_addr) {
+            idle_loop = IdleLoop{};
+        }
+        return 0;
+    }
+
+    if (target != idle_loop.target || branch_addr != idle_loop.branch_addr) {
+        // A new loop. Check that its body can't write to memory or leave the loop by any other means.
+        idle_loop.target = target;
+        idle_loop.branch_addr = branch_addr;
+        idle_loop.overridden = target == mem.IdleLoopOverride();
+        idle_loop.candidate = idle_loop.overridden || IdleLoopBodySafe(target, branch_addr);
+        idle_loop.iteration_cycles = 0;
+    } else if (idle_loop.candidate) {
+        const u64 iteration_cycles = now - idle_loop.last_arrival;
+        const bool idle = regs == idle_loop.regs && Cpsr() == idle_loop.cpsr
+                          && iteration_cycles == idle_loop.iteration_cycles
+                          && (!mem.volatile_read || idle_loop.overridden);
+
+        if (idle && !idle_loop.overridden && !mem.io_read && core.watchdog.Armed()
+                && !(InterruptsEnabled() && mem.InterruptEnabled(0x3FFF))
+                && std::none_of(core.dma.cbegin(), core.dma.cend(), [](const Dma& dma) { return dma.DmaEnabled(); })) {
+            // Only an interrupt or a DMA can change what the loop reads, so it will never end.
+            core.watchdog.Hang(fmt::format("an idle loop at 0x{:08X} was entered with interrupts disabled.", target));
+        }
+
+        if (idle && cycles > 0) {
+            // Every iteration until the next event is identical, so skip as many whole iterations as fit.
+            const u64 horizon = std::min<u64>(cycles, core.scheduler.CyclesUntilNextEvent());
+            const int skipped = horizon - horizon % iteration_cycles;
+            if (skipped != 0) {
+                core.UpdateHardware(skipped);
+                idle_loop.last_arrival = now + skipped;
+                mem.volatile_read = false;
+                mem.io_read = false;
+                return skipped;
+            }
+        }
+
+        idle_loop.iteration_cycles = iteration_cycles;
+    }
+
+    idle_loop.regs = regs;
+    idle_loop.cpsr = Cpsr();
+    idle_loop.last_arrival = now;
+    mem.volatile_read = false;
+    mem.io_read = false;
+
+    return 0;
+}
+
+bool Cpu::IdleLoopBodySafe(u32 target, u32 branch_addr) {
+    // Only loops in cartridge ROM and work RAM, where reading the code doesn't have any side effects.
+    if (target < BaseAddr::XRam || (target >= BaseAddr::IO && target < BaseAddr::Rom)
+            || branch_addr >= BaseAddr::Eeprom) {
+        return false;
+    }
+
+    for (u32 addr = target; addr <= branch_addr; addr += ThumbMode() ? 2 : 4) {
+        const bool safe = ThumbMode() ? IdleLoopSafe(static_cast<Thumb>(mem.ReadMem<u16>(addr)))
+                                      : IdleLoopSafe(static_cast<Arm>(mem.ReadMem<u32>(addr)));
+        if (!safe) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Cpu::IdleLoopSafe(Thumb opcode) {
+    if (opcode < 0x4400) {
+        // Shifts, add/subtract, immediate operations, and ALU operations.
+        return true;
+    } else if (opcode < 0x4700) {
+        // High register operations, as long as they don't write the PC. CMP doesn't write anything.
+        const bool cmp = ((opcode >> 8) & 0x3) == 1;
+        const Reg d = ((opcode >> 4) & 0x8) | (opcode & 0x7);
+        return cmp || d != pc;
+    } else if (opcode < 0x4800) {
+        // BX
+        return false;
+    } else if (opcode < 0x5000) {
+        // PC-relative loads.
+        return true;
+    } else if (opcode < 0x6000) {
+        // Register offset transfers. The first three are stores.
+        return ((opcode >> 9) & 0x7) >= 3;
+    } else if (opcode < 0xA000) {
+        // Immediate offset and SP-relative transfers, loads only.
+        return opcode & 0x0800;
+    } else if (opcode < 0xB100) {
+        // ADD Rd, PC/SP and ADD/SUB SP.
+        return true;
+    } else if (opcode < 0xD000) {
+        // PUSH, POP, LDM, and STM.
+        return false;
+    } else if (opcode < 0xE000) {
+        // Conditional branches, but not undefined or SWI.
+        return opcode < 0xDE00;
+    } else {
+        // Unconditional branches, but not BL.
+        return opcode < 0xE800;
+    }
+}
+
+bool Cpu::IdleLoopSafe(Arm opcode) {
+    if ((opcode >> 28) == 0xF) {
+        // Unconditional instructions don't exist on the ARM7TDMI.
+        return false;
+    }
+
+    const Reg d = (opcode >> 12) & 0xF;
+    const bool pre_indexed_load = (opcode & 0x0130'0000) == 0x0110'0000;
+
+    switch ((opcode >> 25) & 0x7) {
+    case 0b000:
+        if ((opcode & 0x90) == 0x90) {
+            // Multiplies and swaps have bits 6-5 clear, halfword transfers don't.
+            return (opcode & 0x60) && pre_indexed_load && d != pc;
+        }
+        [[fallthrough]];
+    case 0b001:
+        if (((opcode >> 23) & 0x3) == 0x2) {
+            // TST, TEQ, CMP, and CMN don't write any registers, but without the S bit they're MRS, MSR, or BX.
+            return opcode & 0x0010'0000;
+        }
+        return d != pc;
+    case 0b011:
+        if (opcode & 0x10) {
+            // Undefined.
+            return false;
+        }
+        [[fallthrough]];
+    case 0b010:
+        return pre_indexed_load && d != pc;
+    case 0b101:
+        // B, but not BL.
+        return !(opcode & 0x0100'0000);
+    default:
+        return false;
+    }
+}
+
 int Cpu::TakeException(CpuMode exception_type) {
     // Save current CPSR and switch to the new CPU mode.
-    spsr[CpuModeIndex(exception_type)] = cpsr;
+    spsr[CpuModeIndex(exception_type)] = Cpsr();
     CpuModeSwitch(exception_type);
 
     // Update the LR with the correct value for the exception type.
@@ -270,7 +689,7 @@ int Cpu::TakeException(CpuMode exception_type) {
         break;
     case CpuMode::Irq:
         regs[pc] = 0x18;
-        last_bios_fetch = 0xE25EF004;
+        IrqTaken();
         break;
     default:
         // There are no abort or FIQ exceptions on the GBA.
@@ -281,6 +700,37 @@ int Cpu::TakeException(CpuMode exception_type) {
     return cycles + FlushPipeline();
 }
 
+int Cpu::TakeIrq() {
+    // FIQ mode can only be entered by writing the CPSR, and leaving it means swapping R8-R12 back.
+    if (CurrentCpuMode() == CpuMode::Fiq) {
+        return TakeException(CpuMode::Irq);
+    }
+
+    // TakeException and CpuModeSwitch fused for the one exception games take every scanline. Nothing else needs
+    // banking on the way into IRQ mode, and IRQ's own LR is overwritten straight away.
+    const int irq_index = CpuModeIndex(CpuMode::Irq);
+    spsr[irq_index] = Cpsr();
+    sp_banked[CurrentCpuModeIndex()] = regs[sp];
+    lr_banked[CurrentCpuModeIndex()] = regs[lr];
+    regs[sp] = sp_banked[irq_index];
+    // The address of the instruction the IRQ occurred on, plus 4.
+    regs[lr] = ThumbMode() ? regs[pc] : regs[pc] - 4;
+    cpsr = (cpsr & ~(cpu_mode | thumb_mode)) | irq_disable | static_cast<u32>(CpuMode::Irq);
+
+    regs[pc] = 0x18;
+    IrqTaken();
+    return FlushPipeline();
+}
+
+void Cpu::IrqTaken() {
+    last_bios_fetch = 0xE25EF004;
+    core.disasm->InterruptTaken(mem.PendingInterruptMask());
+    core.hooks.InterruptTaken(mem.PendingInterruptMask());
+    if (core.tracer != nullptr) {
+        core.tracer->Instant(Common::Tracer::Cpu, "irq taken", core.scheduler.Timestamp(), mem.PendingInterruptMask());
+    }
+}
+
 int Cpu::ReturnFromException(u32 address) {
     if (CurrentCpuMode() == CpuMode::Irq) {
         last_bios_fetch = 0xE55EC002;
@@ -290,7 +740,7 @@ int Cpu::ReturnFromException(u32 address) {
 
     u32 spsr_exception = spsr[CurrentCpuModeIndex()];
     CpuModeSwitch(static_cast<CpuMode>(spsr_exception & cpu_mode));
-    cpsr = spsr_exception;
+    SetCpsr(spsr_exception);
 
     if (ThumbMode()) {
         return Thumb_BranchWritePC(address);
@@ -459,41 +909,23 @@ Cpu::ResultWithCarry Cpu::RotateRightExtend_C(u32 value, u32 carry_in) {
 }
 
 bool Cpu::ConditionPassed(Condition cond) const {
-    switch (cond) {
-    case Condition::Equal:         return GetZero();
-    case Condition::NotEqual:      return !GetZero();
-    case Condition::CarrySet:      return GetCarry();
-    case Condition::CarryClear:    return !GetCarry();
-    case Condition::Minus:         return GetSign();
-    case Condition::Plus:          return !GetSign();
-    case Condition::OverflowSet:   return GetOverflow();
-    case Condition::OverflowClear: return !GetOverflow();
-    case Condition::Higher:        return GetCarry() && !GetZero();
-    case Condition::LowerSame:     return !(GetCarry() && !GetZero());
-    case Condition::GreaterEqual:  return GetSign() == GetOverflow();
-    case Condition::LessThan:      return !(GetSign() == GetOverflow());
-    case Condition::GreaterThan:   return GetSign() == GetOverflow() && !GetZero();
-    case Condition::LessEqual:     return !(GetSign() == GetOverflow() && !GetZero());
-    default:                       return true;
-    }
+    const u32 nzcv = (GetSign() << 3) | (GetZero() << 2) | (GetCarry() << 1) | GetOverflow();
+    return (condition_table[static_cast<u32>(cond)] >> nzcv) & 0x1;
 }
 
 void Cpu::SetAllFlags(ArithResult result) {
-    SetSign(result.value & sign_bit);
-    SetZero(static_cast<u32>(result.value) == 0);
+    flag_n = flag_z = static_cast<u32>(result.value);
     SetCarry(result.value & carry_bit);
     SetOverflow(result.overflow);
 }
 
 void Cpu::SetSignZeroCarryFlags(u32 result, u32 carry) {
-    SetSign(result & sign_bit);
-    SetZero(result == 0);
+    flag_n = flag_z = result;
     SetCarry(carry);
 }
 
 void Cpu::SetSignZeroFlags(u32 result) {
-    SetSign(result & sign_bit);
-    SetZero(result == 0);
+    flag_n = flag_z = result;
 }
 
 void Cpu::ConditionalSetAllFlags(bool set_flags, ArithResult result) {
@@ -536,4 +968,17 @@ int Cpu::MultiplyCycles(u32 operand) {
     return 4;
 }
 
+void Cpu::SerializeState(Common::State& state) {
+    u32 full_cpsr = Cpsr();
+    state.Sync(regs, full_cpsr, spsr, sp_banked, lr_banked, fiq_banked_regs, pipeline, pc_written, halted, dma_active,
+               last_bios_fetch, intr_wait_addr);
+    SetCpsr(full_cpsr);
+
+    if (state.Loading()) {
+        // Redecode the pipeline, and make any idle loop prove itself again.
+        DecodePipeline();
+        idle_loop = IdleLoop{};
+    }
+}
+
 } // End namespace Gba
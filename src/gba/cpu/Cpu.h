@@ -18,12 +18,15 @@
 
 #include <array>
 #include <vector>
-#include <functional>
 #include <tuple>
 
 #include "common/CommonTypes.h"
 #include "common/CommonFuncs.h"
 #include "gba/cpu/CpuDefs.h"
+#include "gba/cpu/BlockCache.h"
+
+namespace Common { class State; }
+namespace Bench { class Kernels; }
 
 namespace Gba {
 
@@ -34,8 +37,11 @@ template<typename T, typename D>
 class Instruction;
 
 class Cpu {
+    friend class BlockCache;
+    friend class Bench::Kernels;
+
 public:
-    Cpu(Memory& _mem, Core& _core);
+    Cpu(Memory& _mem, Core& _core, bool _hle_bios);
     ~Cpu();
 
     // Return type for Instruction impl functions.
@@ -43,11 +49,22 @@ public:
 
     bool dma_active = false;
     u32 last_bios_fetch = 0x0;
+    // Set by sub-frame stepping to end Execute after the current instruction, and cleared again by it.
+    bool stop_requested = false;
 
     int Execute(int cycles);
+    void SerializeState(Common::State& state);
+    // Swaps the decode tables when the first PC hook is added or the last one removed.
+    void HooksChanged();
+    // Throws away all cached and compiled code, which may have been decoded from ROM that cheats have now patched.
+    void RomPatched();
     void Halt() { halted = true; }
+    // Puts the CPU in the state the BIOS leaves it in when it jumps to the cartridge after its intro.
+    void SkipBios();
 
     u32 GetPc() const { return regs[pc]; };
+    u32 GetCpsr() const { return Cpsr(); }
+    const std::array<u32, 16>& GetRegisters() const { return regs; }
     u32 GetPrefetchedOpcode(int i) const { return pipeline[i]; }
 
     bool ThumbMode() const { return cpsr & thumb_mode; }
@@ -67,23 +84,83 @@ private:
     Core& core;
 
     std::array<u32, 16> regs{};
+    // The condition flags are kept apart from the rest of the CPSR, since almost every ALU op sets them and most
+    // are overwritten before anything reads them. N and Z are left as the value they were last set from, and are
+    // only worked out when a condition or a read of the whole CPSR needs them. The NZCV bits of cpsr itself are
+    // stale, so the whole register is read and written through Cpsr() and SetCpsr().
     u32 cpsr = irq_disable | fiq_disable | static_cast<u32>(CpuMode::Svc);
+    u32 flag_n = 0; // N is bit 31.
+    u32 flag_z = 1; // Z is set when this is zero.
+    u32 flag_c = 0;
+    u32 flag_v = 0;
 
     std::array<u32, 16> spsr{};
     std::array<u32, 16> sp_banked{};
     std::array<u32, 16> lr_banked{};
     std::array<u32, 5> fiq_banked_regs{};
 
-    const std::vector<Instruction<Thumb, Cpu>> thumb_instructions;
-    const std::vector<Instruction<Arm, Cpu>> arm_instructions;
-    std::array<const std::function<int(Cpu& cpu, Thumb opcode)> *, 0x400> thumb_decode_table;
-    std::array<std::vector<const Instruction<Arm, Cpu> *>, 0x100> arm_decode_cache;
+    using ThumbHandler = Handler<Thumb>;
+    using ArmHandler = Handler<Arm>;
+
+    // Both decode tables are swapped for ones which send every instruction through ExecHook while any PC is hooked.
+    const std::array<ThumbHandler, 0x400>* thumb_decode_table;
+
+    // ARM instructions are mostly identified by bits 27-20 and 7-4 of the opcode. If those bits aren't enough to
+    // identify the instruction, the handler is null and the opcode is matched against the candidate instructions.
+    struct ArmDecodeEntry {
+        ArmHandler handler = nullptr;
+        u16 first_candidate = 0;
+        u16 num_candidates = 0;
+    };
+    // Built the first time a Cpu is created and shared by every Cpu after it. The hooked table has the hook handler
+    // in every entry.
+    struct ArmDecodeTable {
+        explicit ArmDecodeTable(ArmHandler hook = nullptr);
+
+        InstructionTable<Arm, Cpu> instructions;
+        std::array<ArmDecodeEntry, 0x1000> entries;
+        std::vector<const Instruction<Arm, Cpu>*> candidates;
+    };
+    static const ArmDecodeTable& GetArmDecodeTable();
+    static const ArmDecodeTable& GetHookedArmDecodeTable();
+    static const std::array<ThumbHandler, 0x400>& GetHookedThumbDecodeTable();
+    const ArmDecodeTable* arm_decode_table;
+
+    // Runs the PC hook for the instruction, if it has one, then decodes it through the real tables and executes it.
+    template <typename T>
+    static int ExecHook(Cpu& cpu, T opcode);
 
     std::array<u32, 3> pipeline{};
+    // When the block cache is enabled, these hold the decoded handlers of the opcodes in the pipeline.
+    std::array<ThumbHandler, 3> thumb_handlers{};
+    std::array<ArmHandler, 3> arm_handlers{};
     bool pc_written = false;
 
     bool halted = false;
 
+    // When set, the hottest BIOS calls are run natively instead of stepping through the BIOS.
+    const bool hle_bios;
+    // The address of the IntrWait SWI the CPU is halted on, which runs again once an interrupt has been handled.
+    static constexpr u32 no_intr_wait = 0xFFFF'FFFF;
+    u32 intr_wait_addr = no_intr_wait;
+
+    // A short backward branch which lands on the same register state after the same number of cycles twice in a
+    // row, with nothing but loads from non-volatile memory in between, can't leave the loop until a scheduler
+    // event changes the state of the hardware. So the CPU can skip ahead to the next event, like when halted.
+    struct IdleLoop {
+        u32 branch_addr = 0;
+        u32 target = 0;
+        bool candidate = false;
+        bool overridden = false;
+
+        std::array<u32, 16> regs{};
+        u32 cpsr = 0;
+        u64 last_arrival = 0;
+        u64 iteration_cycles = 0;
+    };
+    IdleLoop idle_loop;
+    static constexpr u32 max_idle_loop_bytes = 32;
+
     // Constants
     static constexpr u64 carry_bit = 0x1'0000'0000, sign_bit = 0x8000'0000;
 
@@ -133,28 +210,83 @@ private:
     bool ValidCpuMode(u32 new_mode) const;
     void CpuModeSwitch(CpuMode new_cpu_mode);
 
+    template <typename T>
+    int FetchOpcode(int slot);
+    int RunJit(int cycles);
+    template <typename T>
+    void MarkCode(u32 addr);
+    template <typename T>
+    std::array<Handler<T>, 3>& PipelineHandlers() {
+        if constexpr (std::is_same_v<T, Thumb>) {
+            return thumb_handlers;
+        } else {
+            return arm_handlers;
+        }
+    }
+
     int FlushPipeline();
 
+    int SkipIdleLoop(u32 branch_addr, int cycles);
+    bool IdleLoopBodySafe(u32 target, u32 branch_addr);
+    static bool IdleLoopSafe(Thumb opcode);
+    static bool IdleLoopSafe(Arm opcode);
+
     int TakeException(CpuMode exception_type);
+    // The same as TakeException(CpuMode::Irq), without the general mode switch.
+    int TakeIrq();
+    void IrqTaken();
     int ReturnFromException(u32 address);
 
+    // Implemented in Bios.cpp. Calls which aren't emulated still go through the BIOS.
+    int SoftwareInterrupt(u32 number);
+    static bool HleBiosCall(u32 number);
+    int BiosIntrWait(bool discard, u16 wanted);
+    int BiosDiv(s32 numerator, s32 denominator);
+    int BiosSqrt();
+    int BiosArcTan();
+    int BiosArcTan2();
+    int BiosCpuSet();
+    int BiosCpuFastSet();
+    int BiosBgAffineSet();
+    int BiosObjAffineSet();
+    int BiosLz77UnComp(bool vram);
+    int BiosHuffUnComp();
+    int BiosRlUnComp(bool vram);
+    int BiosWriteDecompressed(const std::vector<u8>& data, int unit_size);
+
     void LoadInternalCycle(int cycles);
     void InternalCycle(int cycles);
     void StorePrefetch();
 
-    void SetSign(bool val)     { (val) ? (cpsr |= sign_flag)     : (cpsr &= ~sign_flag); }
-    void SetZero(bool val)     { (val) ? (cpsr |= zero_flag)     : (cpsr &= ~zero_flag); }
-    void SetCarry(bool val)    { (val) ? (cpsr |= carry_flag)    : (cpsr &= ~carry_flag); }
-    void SetOverflow(bool val) { (val) ? (cpsr |= overflow_flag) : (cpsr &= ~overflow_flag); }
+    void SetSign(bool val)     { flag_n = (val) ? static_cast<u32>(sign_flag) : 0; }
+    void SetZero(bool val)     { flag_z = !val; }
+    void SetCarry(bool val)    { flag_c = val; }
+    void SetOverflow(bool val) { flag_v = val; }
+
+    u32 GetSign()     const { return flag_n >> 31; }
+    u32 GetZero()     const { return flag_z == 0; }
+    u32 GetCarry()    const { return flag_c; }
+    u32 GetOverflow() const { return flag_v; }
 
-    u32 GetSign()     const { return (cpsr & sign_flag)     >> 31; }
-    u32 GetZero()     const { return (cpsr & zero_flag)     >> 30; }
-    u32 GetCarry()    const { return (cpsr & carry_flag)    >> 29; }
-    u32 GetOverflow() const { return (cpsr & overflow_flag) >> 28; }
+    u32 Cpsr() const {
+        return (cpsr & ~(sign_flag | zero_flag | carry_flag | overflow_flag))
+               | (GetSign() << 31) | (GetZero() << 30) | (GetCarry() << 29) | (GetOverflow() << 28);
+    }
+    void SetCpsr(u32 value) {
+        cpsr = value;
+        SetSign(value & sign_flag);
+        SetZero(value & zero_flag);
+        SetCarry(value & carry_flag);
+        SetOverflow(value & overflow_flag);
+    }
 
-    void PopulateThumbDecodeTable();
-    const std::function<int(Cpu& cpu, Thumb opcode)>& DecodeThumb(Thumb opcode) const;
-    const std::function<int(Cpu& cpu, Arm opcode)>& DecodeArm(Arm opcode);
+    ThumbHandler DecodeThumb(Thumb opcode) const { return (*thumb_decode_table)[opcode >> 6]; }
+    static constexpr std::size_t ArmDecodeIndex(Arm opcode) { return ((opcode >> 16) & 0xFF0) | ((opcode >> 4) & 0xF); }
+    ArmHandler DecodeArm(Arm opcode) const { return DecodeArm(opcode, *arm_decode_table); }
+    static ArmHandler DecodeArm(Arm opcode, const ArmDecodeTable& decode_table);
+    // Refills the pipeline's handler slots. They're only ever filled with a block cache; FetchOpcode clears them
+    // on the uncached path, so without one they stay null and each opcode is decoded when it executes.
+    void DecodePipeline();
 
     // ARM primitives
     static constexpr ResultWithCarry ArmExpandImmediate_C(u32 value) noexcept {
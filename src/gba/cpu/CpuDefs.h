@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include "common/CommonTypes.h"
 
 namespace Gba {
@@ -53,4 +55,18 @@ struct ImmediateShift {
     u32 imm;
 };
 
+template<typename T, typename D>
+class Instruction;
+
+// A view of one of the instruction tables, which are sorted at compile time so nothing is built at startup.
+template<typename T, typename Dispatcher>
+struct InstructionTable {
+    const Instruction<T, Dispatcher>* first;
+    std::size_t size;
+
+    const Instruction<T, Dispatcher>* begin() const { return first; }
+    const Instruction<T, Dispatcher>* end() const { return first + size; }
+    const Instruction<T, Dispatcher>& back() const { return first[size - 1]; }
+};
+
 } // End namespace Gba
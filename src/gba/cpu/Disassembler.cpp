@@ -15,26 +15,39 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <bitset>
+#include <cstring>
+#include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
 
 #include "gba/cpu/Disassembler.h"
+#include "gba/core/Core.h"
+#include "gba/memory/Memory.h"
 #include "gba/cpu/Cpu.h"
 #include "gba/cpu/Instruction.h"
 
 namespace Gba {
 
-Disassembler::Disassembler(LogLevel level, Core& _core)
+Disassembler::Disassembler(LogLevel level, LogOverflow log_overflow, const Common::TraceTrigger& _trigger,
+                           Core& _core)
         : core(_core)
         , thumb_instructions(GetThumbInstructionTable<Disassembler>())
         , arm_instructions(GetArmInstructionTable<Disassembler>())
-        , alt_level(level) {
+        , alt_level(level)
+        , trigger(_trigger)
+        , pre_trigger(trigger.before) {
     // Leave log_stream unopened if logging disabled.
     if (level != LogLevel::None) {
-        log_stream = std::ofstream("log.txt");
+        log_stream.Open("log.txt", log_overflow);
+    }
 
-        if (!log_stream) {
-            throw std::runtime_error("Error when attempting to open ./log.txt for writing.");
-        }
+    if (level == LogLevel::BinaryTrace || level == LogLevel::BinaryRegisters) {
+        // PC, opcode, and CPSR, optionally followed by R0-R15.
+        const std::size_t record_words = (level == LogLevel::BinaryRegisters) ? 19 : 3;
+        binary_trace = std::make_unique<Common::BinaryTrace>("trace.bin", Common::BinaryTrace::System::Gba,
+                                                             record_words);
     }
 }
 
@@ -42,53 +55,199 @@ Disassembler::Disassembler(LogLevel level, Core& _core)
 Disassembler::~Disassembler() = default;
 
 void Disassembler::DisassembleThumb(Thumb opcode, const std::array<u32, 16>& regs, u32 cpsr) {
-    if (log_level == LogLevel::None) {
+    if (log_level == LogLevel::None && !CheckTrigger(opcode, true, regs, cpsr)) {
+        return;
+    } else if (log_level == LogLevel::BinaryTrace || log_level == LogLevel::BinaryRegisters) {
+        WriteBinaryRecord(opcode, regs, cpsr);
+        CaptureLogged();
         return;
     }
 
-    for (const auto& instr : thumb_instructions) {
-        if (instr.Match(opcode)) {
-            fmt::print(log_stream, "0x{:0>8X}, T: {}\n", regs[pc], instr.impl_func(*this, opcode));
-            break;
-        }
-    }
+    fmt::print(log_stream, "0x{:0>8X}, T: {}\n", regs[pc], Disassemble(opcode));
 
     if (log_level == LogLevel::Registers) {
         LogRegisters(regs, cpsr);
     }
+
+    CaptureLogged();
 }
 
 void Disassembler::DisassembleArm(Arm opcode, const std::array<u32, 16>& regs, u32 cpsr) {
-    if (log_level == LogLevel::None) {
+    if (log_level == LogLevel::None && !CheckTrigger(opcode, false, regs, cpsr)) {
+        return;
+    } else if (log_level == LogLevel::BinaryTrace || log_level == LogLevel::BinaryRegisters) {
+        WriteBinaryRecord(opcode, regs, cpsr);
+        CaptureLogged();
         return;
     }
 
-    for (const auto& instr : arm_instructions) {
+    fmt::print(log_stream, "0x{:0>8X}, A: {}\n", regs[pc], Disassemble(opcode));
+
+    if (log_level == LogLevel::Registers) {
+        LogRegisters(regs, cpsr);
+    }
+
+    CaptureLogged();
+}
+
+template<typename T>
+const std::string& Disassembler::Disassemble(T opcode) {
+    // The halves of a Thumb BL look at their neighbours, so their text can't be cached by opcode alone.
+    constexpr bool thumb = std::is_same_v<T, Thumb>;
+    const bool cacheable = !thumb || (opcode & 0xF000) != 0xF000;
+    const u64 key = opcode | (static_cast<u64>(thumb) << 32);
+    if (cacheable) {
+        if (const std::string* text = text_cache.Find(key)) {
+            return *text;
+        }
+    }
+
+    const auto& instructions = [this]() -> const auto& {
+        if constexpr (std::is_same_v<T, Thumb>) {
+            return thumb_instructions;
+        } else {
+            return arm_instructions;
+        }
+    }();
+
+    uncached_text.clear();
+    for (const auto& instr : instructions) {
         if (instr.Match(opcode)) {
-            fmt::print(log_stream, "0x{:0>8X}, A: {}\n", regs[pc], instr.impl_func(*this, opcode));
+            uncached_text = instr.impl_func(*this, opcode);
             break;
         }
     }
 
-    if (log_level == LogLevel::Registers) {
-        LogRegisters(regs, cpsr);
+    return cacheable ? text_cache.Insert(key, uncached_text) : uncached_text;
+}
+
+void Disassembler::DumpProfile(const Common::PcProfiler& profiler) {
+    std::ofstream profile_stream("profile.txt");
+    if (!profile_stream) {
+        throw std::runtime_error("Error when attempting to open ./profile.txt for writing.");
+    }
+
+    const double total = std::max<u64>(profiler.TotalSamples(), 1);
+    for (const auto& entry : profiler.SortedEntries()) {
+        fmt::print(profile_stream, "{:>6.2f}% {:>10} ", entry.samples * 100 / total, entry.samples);
+
+        if (entry.key == Common::PcProfiler::halted_key) {
+            fmt::print(profile_stream, "(halted)\n");
+        } else if (entry.key == Common::PcProfiler::dma_key) {
+            fmt::print(profile_stream, "(dma)\n");
+        } else if (entry.key & Common::PcProfiler::thumb_bit) {
+            fmt::print(profile_stream, "0x{:0>8X}, T: {}\n", entry.key & ~Common::PcProfiler::thumb_bit,
+                       Disassemble(static_cast<Thumb>(entry.opcode)));
+        } else {
+            fmt::print(profile_stream, "0x{:0>8X}, A: {}\n", entry.key, Disassemble(static_cast<Arm>(entry.opcode)));
+        }
+    }
+}
+
+void Disassembler::WriteCoverageReport(const Common::CodeCoverage& coverage, const std::string& path) {
+    std::ofstream report(path);
+    if (!report) {
+        throw std::runtime_error("Error when attempting to open " + path + " for writing.");
     }
+
+    struct Region {
+        const char* name;
+        u32 base_addr;
+        u32 code_offset;
+        u32 size;
+        const u8* data;
+    };
+
+    const GuestRam& ram = core.mem->RamReference();
+    const std::size_t code_bytes = core.mem->CodeBytes();
+    const std::array<Region, 3> regions{{
+        {"EWRAM", BaseAddr::XRam, 0, sizeof(ram.xram), reinterpret_cast<const u8*>(ram.xram.data())},
+        {"IWRAM", BaseAddr::IRam, Memory::iram_code_offset, sizeof(ram.iram),
+         reinterpret_cast<const u8*>(ram.iram.data())},
+        {"ROM", BaseAddr::Rom, Memory::rom_code_offset, static_cast<u32>(code_bytes - Memory::rom_code_offset),
+         reinterpret_cast<const u8*>(core.mem->RomReference().data())},
+    }};
+
+    // Thumb slots are numbered by halfword, and ARM slots by word after all of the Thumb ones.
+    const std::size_t arm_first_slot = code_bytes / 2;
+    const auto thumb_slot = [](u32 code_offset) { return code_offset / 2; };
+    const auto arm_slot = [&](u32 code_offset) { return arm_first_slot + code_offset / 4; };
+
+    for (const Region& region : regions) {
+        const u32 end = region.code_offset + region.size;
+        fmt::print(report, "{:<5}  {} Thumb and {} ARM instructions run, of {} bytes\n", region.name,
+                   coverage.Count(thumb_slot(region.code_offset), thumb_slot(end)),
+                   coverage.Count(arm_slot(region.code_offset), arm_slot(end)), region.size);
+    }
+    fmt::print(report, "\n");
+
+    for (const Region& region : regions) {
+        for (u32 offset = 0; offset < region.size; offset += 2) {
+            const u32 addr = region.base_addr + offset;
+            if (coverage.Marked(thumb_slot(region.code_offset + offset))) {
+                Thumb opcode;
+                std::memcpy(&opcode, region.data + offset, sizeof(opcode));
+                fmt::print(report, "0x{:0>8X}, T: {}\n", addr, Disassemble(opcode));
+            }
+            if (offset % 4 == 0 && offset + 4 <= region.size
+                    && coverage.Marked(arm_slot(region.code_offset + offset))) {
+                Arm opcode;
+                std::memcpy(&opcode, region.data + offset, sizeof(opcode));
+                fmt::print(report, "0x{:0>8X}, A: {}\n", addr, Disassemble(opcode));
+            }
+        }
+    }
+}
+
+void Disassembler::PrintBreak(const std::string& reason) {
+    // LogRegisters writes to the log stream, so point it at stdout for the duration.
+    log_stream.Flush();
+    std::streambuf* const log_buffer = log_stream.rdbuf(std::cout.rdbuf());
+
+    // The executing instruction is two fetches behind the PC.
+    const bool thumb = core.cpu->ThumbMode();
+    const u32 size = thumb ? 2 : 4;
+    const u32 current = core.cpu->GetPc() - 2 * size;
+    fmt::print(log_stream, "Break on {} at 0x{:0>8X}\n", reason, current);
+    for (u32 addr = current - 4 * size; addr != current + 5 * size; addr += size) {
+        const std::string text = thumb ? Disassemble(static_cast<Thumb>(core.mem->ReadMem<u16>(addr)))
+                                       : Disassemble(static_cast<Arm>(core.mem->ReadMem<u32>(addr)));
+        fmt::print(log_stream, "{} 0x{:0>8X}, {}: {}\n", (addr == current) ? '>' : ' ', addr, thumb ? 'T' : 'A', text);
+    }
+    fmt::print(log_stream, "\n");
+    LogRegisters(core.cpu->GetRegisters(), core.cpu->GetCpsr());
+
+    log_stream.flush();
+    log_stream.rdbuf(log_buffer);
 }
 
 void Disassembler::LogRegisters(const std::array<u32, 16>& regs, u32 cpsr) {
+    // Built up in a buffer kept between instructions, and written to the log in one go.
+    register_text.clear();
+    auto out = std::back_inserter(register_text);
     for (int i = 0; i < 13; ++i) {
-        fmt::print(log_stream, "R{:X}=0x{:0>8X}, ", i, regs[i]);
+        fmt::format_to(out, "R{:X}=0x{:0>8X}, ", i, regs[i]);
         if (i == 4 || i == 9) {
-            fmt::print(log_stream, "\n");
+            register_text += '\n';
         }
     }
 
-    fmt::print(log_stream, "SP=0x{:0>8X}, ", regs[sp]);
-    fmt::print(log_stream, "LR=0x{:0>8X}, ", regs[lr]);
-    fmt::print(log_stream, "{}", (cpsr & 0x8000'0000) ? "N" : "");
-    fmt::print(log_stream, "{}", (cpsr & 0x4000'0000) ? "Z" : "");
-    fmt::print(log_stream, "{}", (cpsr & 0x2000'0000) ? "C" : "");
-    fmt::print(log_stream, "{}\n\n", (cpsr & 0x1000'0000) ? "V" : "");
+    fmt::format_to(out, "SP=0x{:0>8X}, LR=0x{:0>8X}, {}{}{}{}\n\n", regs[sp], regs[lr],
+                   (cpsr & 0x8000'0000) ? "N" : "", (cpsr & 0x4000'0000) ? "Z" : "",
+                   (cpsr & 0x2000'0000) ? "C" : "", (cpsr & 0x1000'0000) ? "V" : "");
+    log_stream.write(register_text.data(), register_text.size());
+}
+
+void Disassembler::WriteBinaryRecord(u32 opcode, const std::array<u32, 16>& regs, u32 cpsr) {
+    std::array<u32, Common::BinaryTrace::max_record_words> record;
+    record[0] = regs[pc];
+    record[1] = opcode;
+    record[2] = cpsr;
+    if (log_level == LogLevel::BinaryRegisters) {
+        std::copy(regs.cbegin(), regs.cend(), record.begin() + 3);
+    }
+
+    binary_trace->Write(record);
 }
 
 void Disassembler::LogHalt() {
@@ -99,12 +258,56 @@ void Disassembler::LogHalt() {
     halt_cycles = 0;
 }
 
+bool Disassembler::CheckTrigger(u32 opcode, bool thumb, const std::array<u32, 16>& regs, u32 cpsr) {
+    if (!Armed() || !trigger.WatchesInstructions()) {
+        return false;
+    }
+
+    if (trigger.condition == Common::TraceTrigger::Condition::PcRange && regs[pc] >= trigger.low
+            && regs[pc] <= trigger.high) {
+        StartCapture(fmt::format("PC 0x{:0>8X}", regs[pc]));
+        return true;
+    }
+
+    pre_trigger.Push({opcode, thumb, regs, cpsr});
+    return false;
+}
+
+void Disassembler::StartCapture(const std::string& reason) {
+    std::swap(log_level, alt_level);
+    fmt::print(log_stream, "Trace triggered by {}\n", reason);
+
+    // Replay the instructions leading up to the trigger before counting down the capture window.
+    capture_remaining = 0;
+    pre_trigger.Drain([this](const TraceRecord& record) {
+        if (record.thumb) {
+            DisassembleThumb(static_cast<Thumb>(record.opcode), record.regs, record.cpsr);
+        } else {
+            DisassembleArm(record.opcode, record.regs, record.cpsr);
+        }
+    });
+    capture_remaining = trigger.after;
+}
+
+void Disassembler::CaptureLogged() {
+    if (capture_remaining != 0 && --capture_remaining == 0) {
+        // Rearm for the next trigger.
+        std::swap(log_level, alt_level);
+        fmt::print(log_stream, "Trace window ended\n");
+    }
+}
+
 void Disassembler::SwitchLogLevel() {
     if (log_level == alt_level) {
         return;
     }
 
-    std::swap(log_level, alt_level);
+    if (log_level == LogLevel::None) {
+        StartCapture("hotkey");
+    } else {
+        std::swap(log_level, alt_level);
+        capture_remaining = 0;
+    }
 
     auto LogLevelString = [](LogLevel level) {
         switch (level) {
@@ -114,6 +317,10 @@ void Disassembler::SwitchLogLevel() {
             return "Trace";
         case LogLevel::Registers:
             return "Registers";
+        case LogLevel::BinaryTrace:
+            return "Binary Trace";
+        case LogLevel::BinaryRegisters:
+            return "Binary Registers";
         default:
             return "";
         }
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -25,6 +26,12 @@
 #include "common/CommonTypes.h"
 #include "common/CommonFuncs.h"
 #include "common/CommonEnums.h"
+#include "common/DisasmCache.h"
+#include "common/AsyncLog.h"
+#include "common/BinaryTrace.h"
+#include "common/PcProfiler.h"
+#include "common/CodeCoverage.h"
+#include "common/TraceTrigger.h"
 #include "gba/cpu/CpuDefs.h"
 
 namespace Gba {
@@ -36,7 +43,7 @@ class Instruction;
 
 class Disassembler {
 public:
-    Disassembler(LogLevel level, Core& _core);
+    Disassembler(LogLevel level, LogOverflow log_overflow, const Common::TraceTrigger& _trigger, Core& _core);
     ~Disassembler();
 
     // Return type for Instruction impl functions.
@@ -57,23 +64,78 @@ public:
         fmt::print(log_stream, log_msg, std::forward<Args>(args)...);
     }
 
+    bool LoggingEnabled() const { return log_level != LogLevel::None || (Armed() && trigger.WatchesInstructions()); }
     void IncHaltCycles(int cycles) { halt_cycles += cycles; }
     void LogHalt();
 
     void SwitchLogLevel();
 
+    // Trace trigger checks, called from the memory write, IRQ, and frame paths.
+    void MemoryWritten(u32 addr) {
+        if (trigger.condition == Common::TraceTrigger::Condition::MemWrite && addr >= trigger.low
+                && addr <= trigger.high && Armed()) {
+            StartCapture(fmt::format("write to 0x{:0>8X}", addr));
+        }
+    }
+
+    void InterruptTaken(u32 interrupt_mask) {
+        if (trigger.condition == Common::TraceTrigger::Condition::Irq && (interrupt_mask & trigger.low) && Armed()) {
+            StartCapture(fmt::format("IRQ 0x{:0>4X}", interrupt_mask));
+        }
+    }
+
+    void FrameStarted() {
+        if (trigger.condition == Common::TraceTrigger::Condition::Frame && frame_number++ == trigger.low
+                && Armed()) {
+            StartCapture(fmt::format("frame {}", trigger.low));
+        }
+    }
+
+    // Writes the profile to ./profile.txt, with each sampled instruction disassembled.
+    void DumpProfile(const Common::PcProfiler& profiler);
+    // Writes a summary of the code coverage and every instruction which ran to the file. RAM instructions are
+    // disassembled from what's there now, which may have been overwritten since they ran.
+    void WriteCoverageReport(const Common::CodeCoverage& coverage, const std::string& path);
+    // Prints why the debugger broke, the instructions around the one executing, and the registers to stdout.
+    void PrintBreak(const std::string& reason);
+
 private:
     Core& core;
 
-    const std::vector<Instruction<Thumb, Disassembler>> thumb_instructions;
-    const std::vector<Instruction<Arm, Disassembler>> arm_instructions;
+    const InstructionTable<Thumb, Disassembler> thumb_instructions;
+    const InstructionTable<Arm, Disassembler> arm_instructions;
 
     LogLevel log_level = LogLevel::None;
     LogLevel alt_level;
-    std::ofstream log_stream;
+    Common::AsyncLogStream log_stream;
+    std::unique_ptr<Common::BinaryTrace> binary_trace;
 
     int halt_cycles = 0;
 
+    struct TraceRecord {
+        u32 opcode;
+        bool thumb;
+        std::array<u32, 16> regs;
+        u32 cpsr;
+    };
+
+    // Text keyed by opcode, with bit 32 set for Thumb.
+    Common::DisasmCache text_cache;
+    std::string uncached_text;
+    std::string register_text;
+
+    const Common::TraceTrigger trigger;
+    Common::PreTriggerBuffer<TraceRecord> pre_trigger;
+    std::size_t capture_remaining = 0;
+    u32 frame_number = 0;
+
+    // Armed while a log level is configured but logging is currently off.
+    bool Armed() const { return log_level == LogLevel::None && alt_level != LogLevel::None; }
+    // Returns true if the instruction should be logged.
+    bool CheckTrigger(u32 opcode, bool thumb, const std::array<u32, 16>& regs, u32 cpsr);
+    void StartCapture(const std::string& reason);
+    void CaptureLogged();
+
     static std::string Flags(bool sf) { return (sf) ? "S" : ""; }
     static std::string RegStr(Reg r);
     static std::string ShiftStr(ImmediateShift shift);
@@ -82,6 +144,10 @@ private:
     static std::string StatusReg(bool spsr, u32 mask);
 
     void LogRegisters(const std::array<u32, 16>& regs, u32 cpsr);
+    void WriteBinaryRecord(u32 opcode, const std::array<u32, 16>& regs, u32 cpsr);
+    // The returned text is only valid until the next call.
+    template<typename T>
+    const std::string& Disassemble(T opcode);
 
     // Arm
     std::string AluImm(const char* name, Condition cond, bool sf, Reg n, Reg d, u32 imm);
@@ -14,7 +14,8 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-#include <algorithm>
+#include <tuple>
+#include <utility>
 
 #include "gba/cpu/Instruction.h"
 #include "gba/cpu/Cpu.h"
@@ -22,276 +23,337 @@
 
 namespace Gba {
 
+// An entry in the instruction tables: an instruction layout string and the function that implements it.
+template<typename Impl>
+struct InstrDef {
+    const char* layout;
+    Impl impl;
+};
+
+template<typename Impl>
+InstrDef(const char*, Impl) -> InstrDef<Impl>;
+
 template<typename Dispatcher>
-std::vector<Instruction<Thumb, Dispatcher>> GetThumbInstructionTable() {
-    std::vector<Instruction<Thumb, Dispatcher>> thumb_instructions {
-        {"0100000101mmmddd", &Dispatcher::Thumb_AdcReg},     // ADCS Rdn, Rm
+struct ThumbDefinitions {
+    static constexpr auto table = std::make_tuple(
+        InstrDef{"0100000101mmmddd", &Dispatcher::Thumb_AdcReg},     // ADCS Rdn, Rm
 
-        {"0001110iiinnnddd", &Dispatcher::Thumb_AddImmT1},   // ADDS Rd, Rn, #imm
-        {"00110dddiiiiiiii", &Dispatcher::Thumb_AddImmT2},   // ADDS Rdn, #imm
-        {"0001100mmmnnnddd", &Dispatcher::Thumb_AddRegT1},   // ADDS Rd, Rn, Rm
-        {"01000100dmmmmddd", &Dispatcher::Thumb_AddRegT2},   // ADD Rdn, Rm
-        {"10101dddiiiiiiii", &Dispatcher::Thumb_AddSpImmT1}, // ADD Rd, SP, #imm
-        {"101100000iiiiiii", &Dispatcher::Thumb_AddSpImmT2}, // ADD SP, SP, #imm
-        {"10100dddiiiiiiii", &Dispatcher::Thumb_AddPcImm},   // ADD Rd, PC, #imm
+        InstrDef{"0001110iiinnnddd", &Dispatcher::Thumb_AddImmT1},   // ADDS Rd, Rn, #imm
+        InstrDef{"00110dddiiiiiiii", &Dispatcher::Thumb_AddImmT2},   // ADDS Rdn, #imm
+        InstrDef{"0001100mmmnnnddd", &Dispatcher::Thumb_AddRegT1},   // ADDS Rd, Rn, Rm
+        InstrDef{"01000100dmmmmddd", &Dispatcher::Thumb_AddRegT2},   // ADD Rdn, Rm
+        InstrDef{"10101dddiiiiiiii", &Dispatcher::Thumb_AddSpImmT1}, // ADD Rd, SP, #imm
+        InstrDef{"101100000iiiiiii", &Dispatcher::Thumb_AddSpImmT2}, // ADD SP, SP, #imm
+        InstrDef{"10100dddiiiiiiii", &Dispatcher::Thumb_AddPcImm},   // ADD Rd, PC, #imm
 
-        {"0100000000mmmddd", &Dispatcher::Thumb_AndReg},     // ANDS Rdn, Rm
+        InstrDef{"0100000000mmmddd", &Dispatcher::Thumb_AndReg},     // ANDS Rdn, Rm
 
-        {"00010iiiiimmmddd", &Dispatcher::Thumb_AsrImm},     // ASRS Rd, Rm, #imm
-        {"0100000100mmmddd", &Dispatcher::Thumb_AsrReg},     // ASRS Rdn, Rm
+        InstrDef{"00010iiiiimmmddd", &Dispatcher::Thumb_AsrImm},     // ASRS Rd, Rm, #imm
+        InstrDef{"0100000100mmmddd", &Dispatcher::Thumb_AsrReg},     // ASRS Rdn, Rm
 
-        {"1101cccciiiiiiii", &Dispatcher::Thumb_BT1},        // B<c> label
-        {"11100iiiiiiiiiii", &Dispatcher::Thumb_BT2},        // B label
+        InstrDef{"1101cccciiiiiiii", &Dispatcher::Thumb_BT1},        // B<c> label
+        InstrDef{"11100iiiiiiiiiii", &Dispatcher::Thumb_BT2},        // B label
 
-        {"0100001110mmmddd", &Dispatcher::Thumb_BicReg},     // BICS Rdn, Rm
+        InstrDef{"0100001110mmmddd", &Dispatcher::Thumb_BicReg},     // BICS Rdn, Rm
 
-        {"11110iiiiiiiiiii", &Dispatcher::Thumb_BlH1},       // BL<c> label
-        {"11111iiiiiiiiiii", &Dispatcher::Thumb_BlH2},       // BL<c> label
+        InstrDef{"11110iiiiiiiiiii", &Dispatcher::Thumb_BlH1},       // BL<c> label
+        InstrDef{"11111iiiiiiiiiii", &Dispatcher::Thumb_BlH2},       // BL<c> label
 
-        {"010001110mmmm000", &Dispatcher::Thumb_Bx},         // BX Rm
+        InstrDef{"010001110mmmm000", &Dispatcher::Thumb_Bx},         // BX Rm
 
-        {"0100001011mmmnnn", &Dispatcher::Thumb_CmnReg},     // CMN Rn, Rm
+        InstrDef{"0100001011mmmnnn", &Dispatcher::Thumb_CmnReg},     // CMN Rn, Rm
 
-        {"00101nnniiiiiiii", &Dispatcher::Thumb_CmpImm},     // CMP Rn, #imm
-        {"0100001010mmmnnn", &Dispatcher::Thumb_CmpRegT1},   // CMP Rn, Rm
-        {"01000101nmmmmnnn", &Dispatcher::Thumb_CmpRegT2},   // CMP Rn, Rm
+        InstrDef{"00101nnniiiiiiii", &Dispatcher::Thumb_CmpImm},     // CMP Rn, #imm
+        InstrDef{"0100001010mmmnnn", &Dispatcher::Thumb_CmpRegT1},   // CMP Rn, Rm
+        InstrDef{"01000101nmmmmnnn", &Dispatcher::Thumb_CmpRegT2},   // CMP Rn, Rm
 
-        {"0100000001mmmddd", &Dispatcher::Thumb_EorReg},     // EORS Rdn, Rm
+        InstrDef{"0100000001mmmddd", &Dispatcher::Thumb_EorReg},     // EORS Rdn, Rm
 
-        {"11001nnnrrrrrrrr", &Dispatcher::Thumb_Ldm},        // LDM Rn{!}, rlist
+        InstrDef{"11001nnnrrrrrrrr", &Dispatcher::Thumb_Ldm},        // LDM Rn{!}, rlist
 
-        {"01101iiiiinnnttt", &Dispatcher::Thumb_LdrImm},     // LDR Rt, [Rn, {#imm}]
-        {"10011tttiiiiiiii", &Dispatcher::Thumb_LdrSpImm},   // LDR Rt, [SP, {#imm}]
-        {"01001tttiiiiiiii", &Dispatcher::Thumb_LdrPcImm},   // LDR Rt, [PC, #imm]; Normally "LDR Rt, label".
-        {"0101100mmmnnnttt", &Dispatcher::Thumb_LdrReg},     // LDR Rt, [Rn, Rm]
+        InstrDef{"01101iiiiinnnttt", &Dispatcher::Thumb_LdrImm},     // LDR Rt, [Rn, {#imm}]
+        InstrDef{"10011tttiiiiiiii", &Dispatcher::Thumb_LdrSpImm},   // LDR Rt, [SP, {#imm}]
+        InstrDef{"01001tttiiiiiiii", &Dispatcher::Thumb_LdrPcImm},   // LDR Rt, [PC, #imm]; Normally "LDR Rt, label".
+        InstrDef{"0101100mmmnnnttt", &Dispatcher::Thumb_LdrReg},     // LDR Rt, [Rn, Rm]
 
-        {"01111iiiiinnnttt", &Dispatcher::Thumb_LdrbImm},    // LDRB Rt, [Rn, {#imm}]
-        {"0101110mmmnnnttt", &Dispatcher::Thumb_LdrbReg},    // LDRB Rt, [Rn, Rm]
+        InstrDef{"01111iiiiinnnttt", &Dispatcher::Thumb_LdrbImm},    // LDRB Rt, [Rn, {#imm}]
+        InstrDef{"0101110mmmnnnttt", &Dispatcher::Thumb_LdrbReg},    // LDRB Rt, [Rn, Rm]
 
-        {"10001iiiiinnnttt", &Dispatcher::Thumb_LdrhImm},    // LDRH Rt, [Rn, {#imm}]
-        {"0101101mmmnnnttt", &Dispatcher::Thumb_LdrhReg},    // LDRH Rt, [Rn, Rm]
+        InstrDef{"10001iiiiinnnttt", &Dispatcher::Thumb_LdrhImm},    // LDRH Rt, [Rn, {#imm}]
+        InstrDef{"0101101mmmnnnttt", &Dispatcher::Thumb_LdrhReg},    // LDRH Rt, [Rn, Rm]
 
-        {"0101011mmmnnnttt", &Dispatcher::Thumb_LdrsbReg},   // LDRSB Rt, [Rn, Rm]
-        {"0101111mmmnnnttt", &Dispatcher::Thumb_LdrshReg},   // LDRSH Rt, [Rn, Rm]
+        InstrDef{"0101011mmmnnnttt", &Dispatcher::Thumb_LdrsbReg},   // LDRSB Rt, [Rn, Rm]
+        InstrDef{"0101111mmmnnnttt", &Dispatcher::Thumb_LdrshReg},   // LDRSH Rt, [Rn, Rm]
 
-        {"00000iiiiimmmddd", &Dispatcher::Thumb_LslImm},     // LSLS Rd, Rm, #imm
-        {"0100000010mmmddd", &Dispatcher::Thumb_LslReg},     // LSLS Rdn, Rm
+        InstrDef{"00000iiiiimmmddd", &Dispatcher::Thumb_LslImm},     // LSLS Rd, Rm, #imm
+        InstrDef{"0100000010mmmddd", &Dispatcher::Thumb_LslReg},     // LSLS Rdn, Rm
 
-        {"00001iiiiimmmddd", &Dispatcher::Thumb_LsrImm},     // LSRS Rd, Rm, #imm
-        {"0100000011mmmddd", &Dispatcher::Thumb_LsrReg},     // LSRS Rdn, Rm
+        InstrDef{"00001iiiiimmmddd", &Dispatcher::Thumb_LsrImm},     // LSRS Rd, Rm, #imm
+        InstrDef{"0100000011mmmddd", &Dispatcher::Thumb_LsrReg},     // LSRS Rdn, Rm
 
-        {"00100dddiiiiiiii", &Dispatcher::Thumb_MovImm},     // MOVS Rd, #imm
-        {"01000110dmmmmddd", &Dispatcher::Thumb_MovRegT1},   // MOV Rd, Rm
-        {"0000000000mmmddd", &Dispatcher::Thumb_MovRegT2},   // MOVS Rd, Rm
+        InstrDef{"00100dddiiiiiiii", &Dispatcher::Thumb_MovImm},     // MOVS Rd, #imm
+        InstrDef{"01000110dmmmmddd", &Dispatcher::Thumb_MovRegT1},   // MOV Rd, Rm
+        InstrDef{"0000000000mmmddd", &Dispatcher::Thumb_MovRegT2},   // MOVS Rd, Rm
 
-        {"0100001101nnnddd", &Dispatcher::Thumb_MulReg},     // MULS Rdn, Rm
+        InstrDef{"0100001101nnnddd", &Dispatcher::Thumb_MulReg},     // MULS Rdn, Rm
 
-        {"0100001111mmmddd", &Dispatcher::Thumb_MvnReg},     // MVNS Rdn, Rm
+        InstrDef{"0100001111mmmddd", &Dispatcher::Thumb_MvnReg},     // MVNS Rdn, Rm
 
-        {"0100001100mmmddd", &Dispatcher::Thumb_OrrReg},     // ORRS Rdn, Rm
+        InstrDef{"0100001100mmmddd", &Dispatcher::Thumb_OrrReg},     // ORRS Rdn, Rm
 
-        {"1011110prrrrrrrr", &Dispatcher::Thumb_Pop},        // POP rlist
+        InstrDef{"1011110prrrrrrrr", &Dispatcher::Thumb_Pop},        // POP rlist
 
-        {"1011010mrrrrrrrr", &Dispatcher::Thumb_Push},       // PUSH rlist
+        InstrDef{"1011010mrrrrrrrr", &Dispatcher::Thumb_Push},       // PUSH rlist
 
-        {"0100000111mmmddd", &Dispatcher::Thumb_RorReg},     // RORS Rdn, Rm
+        InstrDef{"0100000111mmmddd", &Dispatcher::Thumb_RorReg},     // RORS Rdn, Rm
 
-        {"0100001001nnnddd", &Dispatcher::Thumb_RsbImm},     // RSBS Rdn, Rm, #0
+        InstrDef{"0100001001nnnddd", &Dispatcher::Thumb_RsbImm},     // RSBS Rdn, Rm, #0
 
-        {"0100000110mmmddd", &Dispatcher::Thumb_SbcReg},     // SBCS Rdn, Rm
+        InstrDef{"0100000110mmmddd", &Dispatcher::Thumb_SbcReg},     // SBCS Rdn, Rm
 
-        {"11000nnnrrrrrrrr", &Dispatcher::Thumb_Stm},        // STM Rn!, rlist
+        InstrDef{"11000nnnrrrrrrrr", &Dispatcher::Thumb_Stm},        // STM Rn!, rlist
 
-        {"01100iiiiinnnttt", &Dispatcher::Thumb_StrImm},     // STR Rt, [Rn, {#imm}]
-        {"10010tttiiiiiiii", &Dispatcher::Thumb_StrSpImm},   // STR Rt, [SP, {#imm}]
-        {"0101000mmmnnnttt", &Dispatcher::Thumb_StrReg},     // STR Rt, [Rn, Rm]
+        InstrDef{"01100iiiiinnnttt", &Dispatcher::Thumb_StrImm},     // STR Rt, [Rn, {#imm}]
+        InstrDef{"10010tttiiiiiiii", &Dispatcher::Thumb_StrSpImm},   // STR Rt, [SP, {#imm}]
+        InstrDef{"0101000mmmnnnttt", &Dispatcher::Thumb_StrReg},     // STR Rt, [Rn, Rm]
 
-        {"01110iiiiinnnttt", &Dispatcher::Thumb_StrbImm},    // STRB Rt, [Rn, {#imm}]
-        {"0101010mmmnnnttt", &Dispatcher::Thumb_StrbReg},    // STRB Rt, [Rn, Rm]
+        InstrDef{"01110iiiiinnnttt", &Dispatcher::Thumb_StrbImm},    // STRB Rt, [Rn, {#imm}]
+        InstrDef{"0101010mmmnnnttt", &Dispatcher::Thumb_StrbReg},    // STRB Rt, [Rn, Rm]
 
-        {"10000iiiiinnnttt", &Dispatcher::Thumb_StrhImm},    // STRH Rt, [Rn, {#imm}]
-        {"0101001mmmnnnttt", &Dispatcher::Thumb_StrhReg},    // STRH Rt, [Rn, Rm]
+        InstrDef{"10000iiiiinnnttt", &Dispatcher::Thumb_StrhImm},    // STRH Rt, [Rn, {#imm}]
+        InstrDef{"0101001mmmnnnttt", &Dispatcher::Thumb_StrhReg},    // STRH Rt, [Rn, Rm]
 
-        {"0001111iiinnnddd", &Dispatcher::Thumb_SubImmT1},   // SUBS Rd, Rn, #imm
-        {"00111dddiiiiiiii", &Dispatcher::Thumb_SubImmT2},   // SUBS Rdn, #imm
-        {"0001101mmmnnnddd", &Dispatcher::Thumb_SubReg},     // SUBS Rd, Rn, Rm
-        {"101100001iiiiiii", &Dispatcher::Thumb_SubSpImm},   // SUB SP, SP, #imm
+        InstrDef{"0001111iiinnnddd", &Dispatcher::Thumb_SubImmT1},   // SUBS Rd, Rn, #imm
+        InstrDef{"00111dddiiiiiiii", &Dispatcher::Thumb_SubImmT2},   // SUBS Rdn, #imm
+        InstrDef{"0001101mmmnnnddd", &Dispatcher::Thumb_SubReg},     // SUBS Rd, Rn, Rm
+        InstrDef{"101100001iiiiiii", &Dispatcher::Thumb_SubSpImm},   // SUB SP, SP, #imm
 
-        {"11011111iiiiiiii", &Dispatcher::Thumb_Swi},        // SWI #imm
+        InstrDef{"11011111iiiiiiii", &Dispatcher::Thumb_Swi},        // SWI #imm
 
-        {"0100001000mmmnnn", &Dispatcher::Thumb_TstReg},     // TST Rn, Rm
+        InstrDef{"0100001000mmmnnn", &Dispatcher::Thumb_TstReg},     // TST Rn, Rm
 
-        {"iiiiiiiiiiiiiiii", &Dispatcher::Thumb_Undefined},  // Undefined
-    };
+        InstrDef{"iiiiiiiiiiiiiiii", &Dispatcher::Thumb_Undefined}   // Undefined
+    );
+};
 
-    std::sort(thumb_instructions.begin(), thumb_instructions.end(), [](const auto& instr1, const auto& instr2) {
-        return instr2.FixedMaskSize() < instr1.FixedMaskSize();
-    });
+template<typename Dispatcher>
+struct ArmDefinitions {
+    static constexpr auto table = std::make_tuple(
+        InstrDef{"cccc0010101Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_AdcImm},        // ADC Rd, Rn, #imm
+        InstrDef{"cccc0000101Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_AdcReg},        // ADC Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000101Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_AdcRegShifted}, // ADC Rd, Rn, Rm, type, Rs
 
-    return thumb_instructions;
-}
+        InstrDef{"cccc0010100Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_AddImm},        // ADD Rd, Rn, #imm
+        InstrDef{"cccc0000100Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_AddReg},        // ADD Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000100Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_AddRegShifted}, // ADD Rd, Rn, Rm, type, Rs
 
-template std::vector<Instruction<Thumb, Cpu>> GetThumbInstructionTable<Cpu>();
-template std::vector<Instruction<Thumb, Disassembler>> GetThumbInstructionTable<Disassembler>();
+        InstrDef{"cccc0010000Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_AndImm},        // AND Rd, Rn, #imm
+        InstrDef{"cccc0000000Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_AndReg},        // AND Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000000Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_AndRegShifted}, // AND Rd, Rn, Rm, type, Rs
 
-template<typename Dispatcher>
-std::vector<Instruction<Arm, Dispatcher>> GetArmInstructionTable() {
-    std::vector<Instruction<Arm, Dispatcher>> arm_instructions {
-        {"cccc0010101Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_AdcImm},        // ADC Rd, Rn, #imm
-        {"cccc0000101Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_AdcReg},        // ADC Rd, Rn, Rm, {shift}
-        {"cccc0000101Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_AdcRegShifted}, // ADC Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc0001101S0000ddddiiiii100mmmm", &Dispatcher::Arm_AsrImm},        // ASR Rd, Rm, #imm
+        InstrDef{"cccc0001101S0000ddddmmmm0101nnnn", &Dispatcher::Arm_AsrReg},        // ASR Rd, Rn, Rm
+
+        InstrDef{"cccc1010iiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_B},             // B label
+
+        InstrDef{"cccc0011110Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_BicImm},        // BIC Rd, Rn, #imm
+        InstrDef{"cccc0001110Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_BicReg},        // BIC Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0001110Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_BicRegShifted}, // BIC Rd, Rn, Rm, type, Rs
+
+        InstrDef{"cccc1011iiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_Bl},            // BL label
 
-        {"cccc0010100Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_AddImm},        // ADD Rd, Rn, #imm
-        {"cccc0000100Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_AddReg},        // ADD Rd, Rn, Rm, {shift}
-        {"cccc0000100Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_AddRegShifted}, // ADD Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc000100101111111111110001mmmm", &Dispatcher::Arm_Bx},            // BX Rm
 
-        {"cccc0010000Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_AndImm},        // AND Rd, Rn, #imm
-        {"cccc0000000Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_AndReg},        // AND Rd, Rn, Rm, {shift}
-        {"cccc0000000Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_AndRegShifted}, // AND Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc1110oooonnnnddddkkkkppp0mmmm", &Dispatcher::Arm_Cdp},           // CDP coproc, opc1, CRd, CRn, CRm, opc2
 
-        {"cccc0001101S0000ddddiiiii100mmmm", &Dispatcher::Arm_AsrImm},        // ASR Rd, Rm, #imm
-        {"cccc0001101S0000ddddmmmm0101nnnn", &Dispatcher::Arm_AsrReg},        // ASR Rd, Rn, Rm
+        InstrDef{"cccc00110111nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_CmnImm},        // CMN Rn, #imm
+        InstrDef{"cccc00010111nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_CmnReg},        // CMN Rn, Rm, {shift}
+        InstrDef{"cccc00010111nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_CmnRegShifted}, // CMN Rn, Rm, type, Rs
 
-        {"cccc1010iiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_B},             // B label
+        InstrDef{"cccc00110101nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_CmpImm},        // CMP Rn, #imm
+        InstrDef{"cccc00010101nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_CmpReg},        // CMP Rn, Rm, {shift}
+        InstrDef{"cccc00010101nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_CmpRegShifted}, // CMP Rn, Rm, type, Rs
 
-        {"cccc0011110Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_BicImm},        // BIC Rd, Rn, #imm
-        {"cccc0001110Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_BicReg},        // BIC Rd, Rn, Rm, {shift}
-        {"cccc0001110Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_BicRegShifted}, // BIC Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc0010001Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_EorImm},        // EOR Rd, Rn, #imm
+        InstrDef{"cccc0000001Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_EorReg},        // EOR Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000001Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_EorRegShifted}, // EOR Rd, Rn, Rm, type, Rs
 
-        {"cccc1011iiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_Bl},            // BL label
+        InstrDef{"cccc110pudw1nnnnddddkkkkiiiiiiii", &Dispatcher::Arm_Ldc},           // LDC coproc, CRd, [Rn, #+/-imm]{!}
 
-        {"cccc000100101111111111110001mmmm", &Dispatcher::Arm_Bx},            // BX Rm
+        InstrDef{"cccc100puew1nnnnrrrrrrrrrrrrrrrr", &Dispatcher::Arm_Ldm},           // LDM{U}{P} Rn{!}, rlist{^}
 
-        {"cccc1110oooonnnnddddkkkkppp0mmmm", &Dispatcher::Arm_Cdp},           // CDP coproc, opc1, CRd, CRn, CRm, opc2
+        InstrDef{"cccc010pu0w1nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_LdrImm},        // LDR Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc011pu0w1nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_LdrReg},        // LDR Rt, [Rn, +/-Rm, {shift}]{!}
 
-        {"cccc00110111nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_CmnImm},        // CMN Rn, #imm
-        {"cccc00010111nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_CmnReg},        // CMN Rn, Rm, {shift}
-        {"cccc00010111nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_CmnRegShifted}, // CMN Rn, Rm, type, Rs
+        InstrDef{"cccc010pu1w1nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_LdrbImm},       // LDRB Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc011pu1w1nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_LdrbReg},       // LDRB Rt, [Rn, +/-Rm, {shift}]{!}
 
-        {"cccc00110101nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_CmpImm},        // CMP Rn, #imm
-        {"cccc00010101nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_CmpReg},        // CMP Rn, Rm, {shift}
-        {"cccc00010101nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_CmpRegShifted}, // CMP Rn, Rm, type, Rs
+        InstrDef{"cccc000pu1w1nnnnttttiiii1011iiii", &Dispatcher::Arm_LdrhImm},       // LDRH Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc000pu0w1nnnntttt00001011mmmm", &Dispatcher::Arm_LdrhReg},       // LDRH Rt, [Rn, +/-Rm]{!}
 
-        {"cccc0010001Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_EorImm},        // EOR Rd, Rn, #imm
-        {"cccc0000001Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_EorReg},        // EOR Rd, Rn, Rm, {shift}
-        {"cccc0000001Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_EorRegShifted}, // EOR Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc000pu1w1nnnnttttiiii1101iiii", &Dispatcher::Arm_LdrsbImm},      // LDRSB Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc000pu0w1nnnntttt00001101mmmm", &Dispatcher::Arm_LdrsbReg},      // LDRSB Rt, [Rn, +/-Rm]{!}
 
-        {"cccc110pudw1nnnnddddkkkkiiiiiiii", &Dispatcher::Arm_Ldc},           // LDC coproc, CRd, [Rn, #+/-imm]{!}
+        InstrDef{"cccc000pu1w1nnnnttttiiii1111iiii", &Dispatcher::Arm_LdrshImm},      // LDRSH Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc000pu0w1nnnntttt00001111mmmm", &Dispatcher::Arm_LdrshReg},      // LDRSH Rt, [Rn, +/-Rm]{!}
 
-        {"cccc100puew1nnnnrrrrrrrrrrrrrrrr", &Dispatcher::Arm_Ldm},           // LDM{U}{P} Rn{!}, rlist{^}
+        InstrDef{"cccc0001101S0000ddddiiiii000mmmm", &Dispatcher::Arm_LslImm},        // LSL Rd, Rm, #imm
+        InstrDef{"cccc0001101S0000ddddmmmm0001nnnn", &Dispatcher::Arm_LslReg},        // LSL Rd, Rn, Rm
 
-        {"cccc010pu0w1nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_LdrImm},        // LDR Rt, [Rn, {#+/-imm}]{!}
-        {"cccc011pu0w1nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_LdrReg},        // LDR Rt, [Rn, +/-Rm, {shift}]{!}
+        InstrDef{"cccc0001101S0000ddddiiiii010mmmm", &Dispatcher::Arm_LsrImm},        // LSR Rd, Rm, #imm
+        InstrDef{"cccc0001101S0000ddddmmmm0011nnnn", &Dispatcher::Arm_LsrReg},        // LSR Rd, Rn, Rm
 
-        {"cccc010pu1w1nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_LdrbImm},       // LDRB Rt, [Rn, {#+/-imm}]{!}
-        {"cccc011pu1w1nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_LdrbReg},       // LDRB Rt, [Rn, +/-Rm, {shift}]{!}
+        InstrDef{"cccc1110ooo0nnnnttttkkkkppp1mmmm", &Dispatcher::Arm_Mcr},           // MCR coproc, opc1, Rt, CRn, CRm, opc2
 
-        {"cccc000pu1w1nnnnttttiiii1011iiii", &Dispatcher::Arm_LdrhImm},       // LDRH Rt, [Rn, {#+/-imm}]{!}
-        {"cccc000pu0w1nnnntttt00001011mmmm", &Dispatcher::Arm_LdrhReg},       // LDRH Rt, [Rn, +/-Rm]{!}
+        InstrDef{"cccc0000001Sddddaaaammmm1001nnnn", &Dispatcher::Arm_MlaReg},        // MLA Rd, Rn, Rm, Ra
 
-        {"cccc000pu1w1nnnnttttiiii1101iiii", &Dispatcher::Arm_LdrsbImm},      // LDRSB Rt, [Rn, {#+/-imm}]{!}
-        {"cccc000pu0w1nnnntttt00001101mmmm", &Dispatcher::Arm_LdrsbReg},      // LDRSB Rt, [Rn, +/-Rm]{!}
+        InstrDef{"cccc0011101S0000ddddiiiiiiiiiiii", &Dispatcher::Arm_MovImm},        // MOV Rd, #imm
+        InstrDef{"cccc0001101S0000dddd00000000mmmm", &Dispatcher::Arm_MovReg},        // MOV Rd, Rm
 
-        {"cccc000pu1w1nnnnttttiiii1111iiii", &Dispatcher::Arm_LdrshImm},      // LDRSH Rt, [Rn, {#+/-imm}]{!}
-        {"cccc000pu0w1nnnntttt00001111mmmm", &Dispatcher::Arm_LdrshReg},      // LDRSH Rt, [Rn, +/-Rm]{!}
+        InstrDef{"cccc1110ooo1nnnnttttkkkkppp1mmmm", &Dispatcher::Arm_Mcr},           // MRC coproc, opc1, Rt, CRn, CRm, opc2
 
-        {"cccc0001101S0000ddddiiiii000mmmm", &Dispatcher::Arm_LslImm},        // LSL Rd, Rm, #imm
-        {"cccc0001101S0000ddddmmmm0001nnnn", &Dispatcher::Arm_LslReg},        // LSL Rd, Rn, Rm
+        InstrDef{"cccc00010r001111dddd000000000000", &Dispatcher::Arm_Mrs},           // MRS Rd, special_reg
 
-        {"cccc0001101S0000ddddiiiii010mmmm", &Dispatcher::Arm_LsrImm},        // LSR Rd, Rm, #imm
-        {"cccc0001101S0000ddddmmmm0011nnnn", &Dispatcher::Arm_LsrReg},        // LSR Rd, Rn, Rm
+        InstrDef{"cccc00110r10mmmm1111iiiiiiiiiiii", &Dispatcher::Arm_MsrImm},        // MSR special_reg, #imm
+        InstrDef{"cccc00010r10mmmm111100000000nnnn", &Dispatcher::Arm_MsrReg},        // MSR special_reg, Rn
 
-        {"cccc1110ooo0nnnnttttkkkkppp1mmmm", &Dispatcher::Arm_Mcr},           // MCR coproc, opc1, Rt, CRn, CRm, opc2
+        InstrDef{"cccc0000000Sdddd0000mmmm1001nnnn", &Dispatcher::Arm_MulReg},        // MUL Rd, Rn, Rm
 
-        {"cccc0000001Sddddaaaammmm1001nnnn", &Dispatcher::Arm_MlaReg},        // MLA Rd, Rn, Rm, Ra
+        InstrDef{"cccc0011111S0000ddddiiiiiiiiiiii", &Dispatcher::Arm_MvnImm},        // MVN Rd, #imm
+        InstrDef{"cccc0001111S0000ddddiiiiiqq0mmmm", &Dispatcher::Arm_MvnReg},        // MVN Rd, Rm, {shift}
+        InstrDef{"cccc0001111S0000ddddssss0qq1mmmm", &Dispatcher::Arm_MvnRegShifted}, // MVN Rd, Rm, type, Rs
 
-        {"cccc0011101S0000ddddiiiiiiiiiiii", &Dispatcher::Arm_MovImm},        // MOV Rd, #imm
-        {"cccc0001101S0000dddd00000000mmmm", &Dispatcher::Arm_MovReg},        // MOV Rd, Rm
+        InstrDef{"cccc0011100Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_OrrImm},        // ORR Rd, Rn, #imm
+        InstrDef{"cccc0001100Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_OrrReg},        // ORR Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0001100Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_OrrRegShifted}, // ORR Rd, Rn, Rm, type, Rs
 
-        {"cccc1110ooo1nnnnttttkkkkppp1mmmm", &Dispatcher::Arm_Mcr},           // MRC coproc, opc1, Rt, CRn, CRm, opc2
+        InstrDef{"cccc100010111101rrrrrrrrrrrrrrrr", &Dispatcher::Arm_PopA1},         // POP rlist
+        InstrDef{"cccc010010011101tttt000000000100", &Dispatcher::Arm_PopA2},         // POP Rt
 
-        {"cccc00010r001111dddd000000000000", &Dispatcher::Arm_Mrs},           // MRS Rd, special_reg
+        InstrDef{"cccc100100101101rrrrrrrrrrrrrrrr", &Dispatcher::Arm_PushA1},        // PUSH rlist
+        InstrDef{"cccc010100101101tttt000000000100", &Dispatcher::Arm_PushA2},        // PUSH Rt
 
-        {"cccc00110r10mmmm1111iiiiiiiiiiii", &Dispatcher::Arm_MsrImm},        // MSR special_reg, #imm
-        {"cccc00010r10mmmm111100000000nnnn", &Dispatcher::Arm_MsrReg},        // MSR special_reg, Rn
+        InstrDef{"cccc0001101S0000ddddiiiii110mmmm", &Dispatcher::Arm_RorImm},        // ROR Rd, Rm, #imm; RRX if imm == 0
+        InstrDef{"cccc0001101S0000ddddmmmm0111nnnn", &Dispatcher::Arm_RorReg},        // ROR Rd, Rn, Rm
 
-        {"cccc0000000Sdddd0000mmmm1001nnnn", &Dispatcher::Arm_MulReg},        // MUL Rd, Rn, Rm
+        InstrDef{"cccc0010011Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_RsbImm},        // RSB Rd, Rn, #imm
+        InstrDef{"cccc0000011Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_RsbReg},        // RSB Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000011Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_RsbRegShifted}, // RSB Rd, Rn, Rm, type, Rs
 
-        {"cccc0011111S0000ddddiiiiiiiiiiii", &Dispatcher::Arm_MvnImm},        // MVN Rd, #imm
-        {"cccc0001111S0000ddddiiiiiqq0mmmm", &Dispatcher::Arm_MvnReg},        // MVN Rd, Rm, {shift}
-        {"cccc0001111S0000ddddssss0qq1mmmm", &Dispatcher::Arm_MvnRegShifted}, // MVN Rd, Rm, type, Rs
+        InstrDef{"cccc0010111Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_RscImm},        // RSC Rd, Rn, #imm
+        InstrDef{"cccc0000111Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_RscReg},        // RSC Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000111Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_RscRegShifted}, // RSC Rd, Rn, Rm, type, Rs
 
-        {"cccc0011100Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_OrrImm},        // ORR Rd, Rn, #imm
-        {"cccc0001100Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_OrrReg},        // ORR Rd, Rn, Rm, {shift}
-        {"cccc0001100Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_OrrRegShifted}, // ORR Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc0010110Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_SbcImm},        // SBC Rd, Rn, #imm
+        InstrDef{"cccc0000110Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_SbcReg},        // SBC Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000110Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_SbcRegShifted}, // SBC Rd, Rn, Rm, type, Rs
 
-        {"cccc100010111101rrrrrrrrrrrrrrrr", &Dispatcher::Arm_PopA1},         // POP rlist
-        {"cccc010010011101tttt000000000100", &Dispatcher::Arm_PopA2},         // POP Rt
+        InstrDef{"cccc0000111Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_SmlalReg},      // SMLAL RdLo, RdHi, Rn, Rm
+        InstrDef{"cccc0000110Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_SmullReg},      // SMULL RdLo, RdHi, Rn, Rm
 
-        {"cccc100100101101rrrrrrrrrrrrrrrr", &Dispatcher::Arm_PushA1},        // PUSH rlist
-        {"cccc010100101101tttt000000000100", &Dispatcher::Arm_PushA2},        // PUSH Rt
+        InstrDef{"cccc110pudw0nnnnddddkkkkiiiiiiii", &Dispatcher::Arm_Ldc},           // STC coproc, CRd, [Rn, #+/-imm]{!}
 
-        {"cccc0001101S0000ddddiiiii110mmmm", &Dispatcher::Arm_RorImm},        // ROR Rd, Rm, #imm; RRX if imm == 0
-        {"cccc0001101S0000ddddmmmm0111nnnn", &Dispatcher::Arm_RorReg},        // ROR Rd, Rn, Rm
+        InstrDef{"cccc100puew0nnnnrrrrrrrrrrrrrrrr", &Dispatcher::Arm_Stm},           // STM{U}{P} Rn{!}, rlist{^}
 
-        {"cccc0010011Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_RsbImm},        // RSB Rd, Rn, #imm
-        {"cccc0000011Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_RsbReg},        // RSB Rd, Rn, Rm, {shift}
-        {"cccc0000011Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_RsbRegShifted}, // RSB Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc010pu0w0nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_StrImm},        // STR Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc011pu0w0nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_StrReg},        // STR Rt, [Rn, +/-Rm, {shift}]{!}
 
-        {"cccc0010111Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_RscImm},        // RSC Rd, Rn, #imm
-        {"cccc0000111Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_RscReg},        // RSC Rd, Rn, Rm, {shift}
-        {"cccc0000111Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_RscRegShifted}, // RSC Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc010pu1w0nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_StrbImm},       // STRB Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc011pu1w0nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_StrbReg},       // STRB Rt, [Rn, +/-Rm, {shift}]{!}
 
-        {"cccc0010110Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_SbcImm},        // SBC Rd, Rn, #imm
-        {"cccc0000110Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_SbcReg},        // SBC Rd, Rn, Rm, {shift}
-        {"cccc0000110Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_SbcRegShifted}, // SBC Rd, Rn, Rm, type, Rs
+        InstrDef{"cccc000pu1w0nnnnttttiiii1011iiii", &Dispatcher::Arm_StrhImm},       // STRH Rt, [Rn, {#+/-imm}]{!}
+        InstrDef{"cccc000pu0w0nnnntttt00001011mmmm", &Dispatcher::Arm_StrhReg},       // STRH Rt, [Rn, +/-Rm]{!}
 
-        {"cccc0000111Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_SmlalReg},      // SMLAL RdLo, RdHi, Rn, Rm
-        {"cccc0000110Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_SmullReg},      // SMULL RdLo, RdHi, Rn, Rm
+        InstrDef{"cccc0010010Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_SubImm},        // SUB Rd, Rn, #imm
+        InstrDef{"cccc0000010Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_SubReg},        // SUB Rd, Rn, Rm, {shift}
+        InstrDef{"cccc0000010Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_SubRegShifted}, // SUB Rd, Rn, Rm, type, Rs
 
-        {"cccc110pudw0nnnnddddkkkkiiiiiiii", &Dispatcher::Arm_Ldc},           // STC coproc, CRd, [Rn, #+/-imm]{!}
+        InstrDef{"cccc1111iiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_Swi},           // SWI #imm
 
-        {"cccc100puew0nnnnrrrrrrrrrrrrrrrr", &Dispatcher::Arm_Stm},           // STM{U}{P} Rn{!}, rlist{^}
+        InstrDef{"cccc00010b00nnnntttt00001001mmmm", &Dispatcher::Arm_SwpReg},        // SWP{B} Rt, Rm, [Rn]
 
-        {"cccc010pu0w0nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_StrImm},        // STR Rt, [Rn, {#+/-imm}]{!}
-        {"cccc011pu0w0nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_StrReg},        // STR Rt, [Rn, +/-Rm, {shift}]{!}
+        InstrDef{"cccc00110011nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_TeqImm},        // TEQ Rn, #imm
+        InstrDef{"cccc00010011nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_TeqReg},        // TEQ Rn, Rm, {shift}
+        InstrDef{"cccc00010011nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_TeqRegShifted}, // TEQ Rn, Rm, type, Rs
 
-        {"cccc010pu1w0nnnnttttiiiiiiiiiiii", &Dispatcher::Arm_StrbImm},       // STRB Rt, [Rn, {#+/-imm}]{!}
-        {"cccc011pu1w0nnnnttttiiiiiqq0mmmm", &Dispatcher::Arm_StrbReg},       // STRB Rt, [Rn, +/-Rm, {shift}]{!}
+        InstrDef{"cccc00110001nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_TstImm},        // TST Rn, #imm
+        InstrDef{"cccc00010001nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_TstReg},        // TST Rn, Rm, {shift}
+        InstrDef{"cccc00010001nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_TstRegShifted}, // TST Rn, Rm, type, Rs
 
-        {"cccc000pu1w0nnnnttttiiii1011iiii", &Dispatcher::Arm_StrhImm},       // STRH Rt, [Rn, {#+/-imm}]{!}
-        {"cccc000pu0w0nnnntttt00001011mmmm", &Dispatcher::Arm_StrhReg},       // STRH Rt, [Rn, +/-Rm]{!}
+        InstrDef{"cccc0000101Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_UmlalReg},      // UMLAL RdLo, RdHi, Rn, Rm
+        InstrDef{"cccc0000100Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_UmullReg},      // UMULL RdLo, RdHi, Rn, Rm
 
-        {"cccc0010010Snnnnddddiiiiiiiiiiii", &Dispatcher::Arm_SubImm},        // SUB Rd, Rn, #imm
-        {"cccc0000010Snnnnddddiiiiiqq0mmmm", &Dispatcher::Arm_SubReg},        // SUB Rd, Rn, Rm, {shift}
-        {"cccc0000010Snnnnddddssss0qq1mmmm", &Dispatcher::Arm_SubRegShifted}, // SUB Rd, Rn, Rm, type, Rs
+        InstrDef{"iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_Undefined}      // Undefined
+    );
+};
 
-        {"cccc1111iiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_Swi},           // SWI #imm
+template<typename T, typename Dispatcher, typename Definitions, std::size_t... Is>
+constexpr std::array<Instruction<T, Dispatcher>, sizeof...(Is)> MakeInstructions(std::index_sequence<Is...>) {
+    std::array<Instruction<T, Dispatcher>, sizeof...(Is)> instructions{{
+        MakeInstruction<T, Dispatcher,
+                        ParseLayout<T>(std::get<Is>(Definitions::table).layout).fixed_mask,
+                        ParseLayout<T>(std::get<Is>(Definitions::table).layout).instr_mask,
+                        ParseLayout<T>(std::get<Is>(Definitions::table).layout).field_lsbs,
+                        std::get<Is>(Definitions::table).impl>()...
+    }};
 
-        {"cccc00010b00nnnntttt00001001mmmm", &Dispatcher::Arm_SwpReg},        // SWP{B} Rt, Rm, [Rn]
+    // Sort the instructions so the ones with the most fixed bits are matched first. This is an insertion sort,
+    // since std::sort isn't constexpr.
+    for (std::size_t i = 1; i < instructions.size(); ++i) {
+        for (std::size_t j = i; j > 0 && instructions[j - 1].FixedMaskSize() < instructions[j].FixedMaskSize(); --j) {
+            const auto temp = instructions[j];
+            instructions[j] = instructions[j - 1];
+            instructions[j - 1] = temp;
+        }
+    }
 
-        {"cccc00110011nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_TeqImm},        // TEQ Rn, #imm
-        {"cccc00010011nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_TeqReg},        // TEQ Rn, Rm, {shift}
-        {"cccc00010011nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_TeqRegShifted}, // TEQ Rn, Rm, type, Rs
+    return instructions;
+}
 
-        {"cccc00110001nnnn0000iiiiiiiiiiii", &Dispatcher::Arm_TstImm},        // TST Rn, #imm
-        {"cccc00010001nnnn0000iiiiiqq0mmmm", &Dispatcher::Arm_TstReg},        // TST Rn, Rm, {shift}
-        {"cccc00010001nnnn0000ssss0qq1mmmm", &Dispatcher::Arm_TstRegShifted}, // TST Rn, Rm, type, Rs
+template<typename T, typename Dispatcher, typename Definitions>
+constexpr auto sorted_instructions = MakeInstructions<T, Dispatcher, Definitions>(
+        std::make_index_sequence<std::tuple_size_v<decltype(Definitions::table)>>{});
 
-        {"cccc0000101Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_UmlalReg},      // UMLAL RdLo, RdHi, Rn, Rm
-        {"cccc0000100Shhhhllllmmmm1001nnnn", &Dispatcher::Arm_UmullReg},      // UMULL RdLo, RdHi, Rn, Rm
+template<typename Dispatcher>
+InstructionTable<Thumb, Dispatcher> GetThumbInstructionTable() {
+    const auto& instructions = sorted_instructions<Thumb, Dispatcher, ThumbDefinitions<Dispatcher>>;
+    return {instructions.data(), instructions.size()};
+}
 
-        {"iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii", &Dispatcher::Arm_Undefined},     // Undefined
-    };
+template<typename Dispatcher>
+InstructionTable<Arm, Dispatcher> GetArmInstructionTable() {
+    const auto& instructions = sorted_instructions<Arm, Dispatcher, ArmDefinitions<Dispatcher>>;
+    return {instructions.data(), instructions.size()};
+}
 
-    std::sort(arm_instructions.begin(), arm_instructions.end(), [](const auto& instr1, const auto& instr2) {
-        return instr2.FixedMaskSize() < instr1.FixedMaskSize();
-    });
+template<typename Dispatcher>
+constexpr std::array<typename Instruction<Thumb, Dispatcher>::Handler, 0x400> MakeThumbDecodeTable() {
+    std::array<typename Instruction<Thumb, Dispatcher>::Handler, 0x400> decode_table{};
+
+    // The lower 6 bits of all Thumb opcodes are variable, so we only need to use the top 10 bits to identify
+    // which instruction implementation to use.
+    for (std::size_t i = 0; i < decode_table.size(); ++i) {
+        for (const auto& instr : sorted_instructions<Thumb, Dispatcher, ThumbDefinitions<Dispatcher>>) {
+            if (instr.Match(static_cast<Thumb>(i << 6))) {
+                decode_table[i] = instr.impl_func;
+                break;
+            }
+        }
+    }
+
+    return decode_table;
+}
 
-    return arm_instructions;
+template<typename Dispatcher>
+const std::array<typename Instruction<Thumb, Dispatcher>::Handler, 0x400>& GetThumbDecodeTable() {
+    static constexpr auto decode_table = MakeThumbDecodeTable<Dispatcher>();
+    return decode_table;
 }
 
-template std::vector<Instruction<Arm, Cpu>> GetArmInstructionTable<Cpu>();
-template std::vector<Instruction<Arm, Disassembler>> GetArmInstructionTable<Disassembler>();
+template InstructionTable<Thumb, Cpu> GetThumbInstructionTable<Cpu>();
+template InstructionTable<Thumb, Disassembler> GetThumbInstructionTable<Disassembler>();
+template InstructionTable<Arm, Cpu> GetArmInstructionTable<Cpu>();
+template InstructionTable<Arm, Disassembler> GetArmInstructionTable<Disassembler>();
+template const std::array<Instruction<Thumb, Cpu>::Handler, 0x400>& GetThumbDecodeTable<Cpu>();
 
 } // End namespace Gba
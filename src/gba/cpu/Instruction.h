@@ -18,8 +18,6 @@
 
 #include <vector>
 #include <array>
-#include <string>
-#include <functional>
 #include <utility>
 
 #include "common/CommonTypes.h"
@@ -31,81 +29,128 @@ namespace Gba {
 class Cpu;
 class Disassembler;
 
-template<typename T, typename Dispatcher>
-class Instruction {
-public:
-    template<typename... Args>
-    Instruction(const char* instr_layout, typename Dispatcher::ReturnType(Dispatcher::* impl)(Args...)) {
-        const auto fields = CreateMasks<sizeof...(Args)>(instr_layout);
-        impl_func = GetImplFunction(impl, fields, std::index_sequence_for<Args...>{});
-    }
-
-    std::function<typename Dispatcher::ReturnType(Dispatcher& dis, T opcode)> impl_func;
-
-    bool Match(T opcode) const { return (opcode & fixed_mask) == instr_mask; }
-    std::size_t FixedMaskSize() const { return Popcount(fixed_mask); }
-
-private:
-    static constexpr auto num_bits = sizeof(T) * 8;
-
+// An instruction layout string describes each bit of an opcode, starting from the most significant bit. '0' and
+// '1' are fixed bits used to identify the instruction, and runs of any other character are operand fields, which
+// are passed to the implementation function in order.
+template<typename T>
+struct InstrLayout {
     T fixed_mask = 0;
     T instr_mask = 0;
+    // The lowest bit of each operand field, so adjacent fields can be told apart.
+    T field_lsbs = 0;
+};
 
-    struct FieldMask {
-        T mask;
-        int shift;
-    };
+template<typename T>
+constexpr InstrLayout<T> ParseLayout(const char* instr_layout) {
+    constexpr int num_bits = sizeof(T) * 8;
+    InstrLayout<T> layout;
 
-    template<std::size_t N>
-    std::array<FieldMask, N> CreateMasks(const std::string& instr_layout) {
-        char last_bit = '0';
-        T current_mask = 0;
-        std::array<FieldMask, N> fields;
-        int field_index = 0;
-
-        for (std::size_t i = 0; i < instr_layout.size(); ++i) {
-            const char bit = instr_layout[i];
-            const int shift = num_bits - 1 - i;
-            const T bit_mask = 1 << shift;
-
-            if (bit != last_bit && last_bit != '0' && last_bit != '1') {
-                fields[field_index++] = {current_mask, shift + 1};
-                current_mask = 0;
-            }
+    for (int i = 0; i < num_bits; ++i) {
+        const char bit = instr_layout[i];
+        const T bit_mask = static_cast<T>(T{1} << (num_bits - 1 - i));
 
-            if (bit == '1' || bit == '0') {
-                fixed_mask |= bit_mask;
+        if (bit == '1' || bit == '0') {
+            layout.fixed_mask |= bit_mask;
 
-                if (bit == '1') {
-                    instr_mask |= bit_mask;
-                }
-            } else {
-                current_mask |= bit_mask;
+            if (bit == '1') {
+                layout.instr_mask |= bit_mask;
             }
-
-            last_bit = bit;
+        } else if (instr_layout[i + 1] != bit) {
+            layout.field_lsbs |= bit_mask;
         }
+    }
+
+    return layout;
+}
+
+template<typename T>
+struct FieldMask {
+    T mask = 0;
+    int shift = 0;
+};
 
-        if (current_mask != 0) {
-            fields[field_index++] = {current_mask, 0};
+template<typename T, std::size_t N>
+constexpr std::array<FieldMask<T>, N> GetFieldMasks(T fixed_mask, T field_lsbs) {
+    constexpr int num_bits = sizeof(T) * 8;
+    std::array<FieldMask<T>, N> fields{};
+    std::size_t field_index = 0;
+
+    for (int shift = num_bits - 1; shift >= 0 && field_index < N; --shift) {
+        const T bit_mask = static_cast<T>(T{1} << shift);
+        if (fixed_mask & bit_mask) {
+            continue;
         }
 
-        return fields;
+        fields[field_index].mask |= bit_mask;
+
+        if (field_lsbs & bit_mask) {
+            fields[field_index++].shift = shift;
+        }
     }
 
-    template<typename... Args, std::size_t... Is>
-    auto GetImplFunction(typename Dispatcher::ReturnType(Dispatcher::* impl)(Args...),
-                         const std::array<FieldMask, sizeof...(Args)>& fields,
-                         std::index_sequence<Is...>) {
-        return [impl, fields](Dispatcher& dis, T opcode) -> typename Dispatcher::ReturnType {
-            return (dis.*impl)(static_cast<Args>((opcode & fields[Is].mask) >> fields[Is].shift)...);
-        };
+    return fields;
+}
+
+template<typename ReturnType, typename Dispatcher, typename... Args>
+constexpr auto GetArgIndices(ReturnType(Dispatcher::*)(Args...)) {
+    return std::index_sequence_for<Args...>{};
+}
+
+// Returns a handler which calls the implementation function with each operand field extracted from the opcode.
+// The field masks and the implementation function are template arguments, so each instruction gets its own
+// handler with the operand extraction inlined.
+template<typename T, T fixed_mask, T field_lsbs, auto impl, typename Dispatcher, typename... Args, std::size_t... Is>
+constexpr auto GetHandler(typename Dispatcher::ReturnType(Dispatcher::*)(Args...), std::index_sequence<Is...>) {
+    return [](Dispatcher& dis, T opcode) -> typename Dispatcher::ReturnType {
+        constexpr auto fields = GetFieldMasks<T, sizeof...(Args)>(fixed_mask, field_lsbs);
+        return (dis.*impl)(static_cast<Args>((opcode & fields[Is].mask) >> fields[Is].shift)...);
+    };
+}
+
+template<typename T, typename Dispatcher>
+class Instruction {
+public:
+    using Handler = typename Dispatcher::ReturnType(*)(Dispatcher& dis, T opcode);
+
+    constexpr Instruction() = default;
+    constexpr Instruction(InstrLayout<T> layout, Handler impl)
+            : impl_func(impl)
+            , fixed_mask(layout.fixed_mask)
+            , instr_mask(layout.instr_mask) {}
+
+    Handler impl_func = nullptr;
+
+    constexpr bool Match(T opcode) const { return (opcode & fixed_mask) == instr_mask; }
+    // Only compares the bits of the opcode which are set in the given mask.
+    constexpr bool Match(T opcode, T mask) const { return (opcode & fixed_mask & mask) == (instr_mask & mask); }
+    // Returns true if the instruction has no fixed bits in the given mask.
+    constexpr bool MatchesAll(T mask) const { return (fixed_mask & mask) == 0; }
+    constexpr std::size_t FixedMaskSize() const {
+        std::size_t size = 0;
+        for (T mask = fixed_mask; mask != 0; mask &= mask - 1) {
+            ++size;
+        }
+        return size;
     }
+
+private:
+    T fixed_mask = 0;
+    T instr_mask = 0;
 };
 
+template<typename T, typename Dispatcher, T fixed_mask, T instr_mask, T field_lsbs, auto impl>
+constexpr Instruction<T, Dispatcher> MakeInstruction() {
+    return {{fixed_mask, instr_mask, field_lsbs},
+            GetHandler<T, fixed_mask, field_lsbs, impl, Dispatcher>(impl, GetArgIndices(impl))};
+}
+
 template<typename Dispatcher>
-std::vector<Instruction<Thumb, Dispatcher>> GetThumbInstructionTable();
+InstructionTable<Thumb, Dispatcher> GetThumbInstructionTable();
+template<typename Dispatcher>
+InstructionTable<Arm, Dispatcher> GetArmInstructionTable();
+
+// Maps the top 10 bits of a Thumb opcode to its handler. This table is built at compile time.
 template<typename Dispatcher>
-std::vector<Instruction<Arm, Dispatcher>> GetArmInstructionTable();
+const std::array<typename Instruction<Thumb, Dispatcher>::Handler, 0x400>& GetThumbDecodeTable();
 
 } // End namespace Gba
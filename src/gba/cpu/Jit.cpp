@@ -0,0 +1,580 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "gba/cpu/Jit.h"
+
+namespace Gba {
+
+namespace {
+
+// Host registers. R8 holds a pointer to the guest registers and R9 holds a pointer to the CPSR for the whole run.
+enum HostReg : u8 {Eax = 0, Ecx = 1, Edx = 2};
+
+// ALU opcodes in their "reg, r/m32" form. The "eax, imm32" form is the same opcode plus 2.
+enum AluOp : u8 {Add = 0x03,
+                 Or  = 0x0B,
+                 Adc = 0x13,
+                 Sbb = 0x1B,
+                 And = 0x23,
+                 Sub = 0x2B,
+                 Xor = 0x33,
+                 Cmp = 0x3B};
+
+constexpr u32 nz_flags   = 0xC000'0000;
+constexpr u32 nzc_flags  = 0xE000'0000;
+constexpr u32 nzcv_flags = 0xF000'0000;
+constexpr u32 carry_flag = 0x2000'0000;
+
+class Emitter {
+public:
+    std::vector<u8> code;
+
+    void Byte(u8 value) { code.push_back(value); }
+    void Word(u32 value) {
+        for (int i = 0; i < 4; ++i) {
+            Byte(value >> (8 * i));
+        }
+    }
+
+    void Prologue() {
+#if defined(_WIN32)
+        // mov r8, rcx; mov r9, rdx
+        Bytes({0x49, 0x89, 0xC8, 0x49, 0x89, 0xD1});
+#else
+        // mov r8, rdi; mov r9, rsi
+        Bytes({0x49, 0x89, 0xF8, 0x49, 0x89, 0xF1});
+#endif
+    }
+
+    void Ret() { Byte(0xC3); }
+
+    // mov host, [r8 + 4 * guest]
+    void LoadReg(HostReg host, Reg guest) { Bytes({0x41, 0x8B, ModRmDisp8(host), GuestDisp(guest)}); }
+    // mov [r8 + 4 * guest], host
+    void StoreReg(Reg guest, HostReg host) { Bytes({0x41, 0x89, ModRmDisp8(host), GuestDisp(guest)}); }
+    // op eax, [r8 + 4 * guest]
+    void AluReg(AluOp op, Reg guest) { Bytes({0x41, op, ModRmDisp8(Eax), GuestDisp(guest)}); }
+    // op eax, imm32
+    void AluImm(AluOp op, u32 imm) { Byte(op + 2); Word(imm); }
+
+    // mov eax, imm32
+    void MovImm(u32 imm) { Byte(0xB8); Word(imm); }
+    // and eax, ecx
+    void AndEcx() { Bytes({0x21, 0xC8}); }
+    // test eax, eax
+    void Test() { Bytes({0x85, 0xC0}); }
+    // not host
+    void Not(HostReg host) { Bytes({0xF7, static_cast<u8>(0xD0 | host)}); }
+    // neg eax
+    void Neg() { Bytes({0xF7, 0xD8}); }
+    // shl/shr/sar eax, imm8
+    void Shl(u8 amount) { Bytes({0xC1, 0xE0, amount}); }
+    void Shr(u8 amount) { Bytes({0xC1, 0xE8, amount}); }
+    void Sar(u8 amount) { Bytes({0xC1, 0xF8, amount}); }
+
+    // Load the guest carry flag into the host carry flag, inverting it for subtraction.
+    void LoadCarry(bool borrow) {
+        // bt dword [r9], 29
+        Bytes({0x41, 0x0F, 0xBA, 0x21, 29});
+        if (borrow) {
+            // cmc
+            Byte(0xF5);
+        }
+    }
+
+    // Write the host flags of the last ALU operation to the guest CPSR. ARM's carry flag is the inverse of the
+    // x86 borrow flag after a subtraction.
+    void StoreFlags(u32 written, bool borrow) {
+        // pushfq; pop rax
+        Bytes({0x9C, 0x58});
+
+        // Sign and zero are bits 7 and 6 of RFLAGS: mov ecx, eax; and ecx, 0xC0; shl ecx, 24
+        Bytes({0x89, 0xC1, 0x81, 0xE1});
+        Word(0xC0);
+        Bytes({0xC1, 0xE1, 24});
+
+        if (written & carry_flag) {
+            // Carry is bit 0: mov edx, eax; and edx, 1; (xor edx, 1); shl edx, 29; or ecx, edx
+            Bytes({0x89, 0xC2, 0x83, 0xE2, 0x01});
+            if (borrow) {
+                Bytes({0x83, 0xF2, 0x01});
+            }
+            Bytes({0xC1, 0xE2, 29, 0x09, 0xD1});
+        }
+
+        if (written & ~nzc_flags) {
+            // Overflow is bit 11: shr eax, 11; and eax, 1; shl eax, 28; or ecx, eax
+            Bytes({0xC1, 0xE8, 11, 0x83, 0xE0, 0x01, 0xC1, 0xE0, 28, 0x09, 0xC1});
+        }
+
+        // mov edx, [r9]; and edx, ~written; or edx, ecx; mov [r9], edx
+        Bytes({0x41, 0x8B, 0x11, 0x81, 0xE2});
+        Word(~written);
+        Bytes({0x09, 0xCA, 0x41, 0x89, 0x11});
+    }
+
+private:
+    void Bytes(std::initializer_list<u8> values) { code.insert(code.end(), values); }
+
+    static u8 ModRmDisp8(HostReg host) { return 0x40 | (host << 3); }
+    static u8 GuestDisp(Reg guest) { return guest * 4; }
+};
+
+// How one Thumb instruction reads and writes the guest flags.
+struct FlagUsage {
+    u32 written;
+    bool reads_carry;
+};
+
+FlagUsage GetFlagUsage(Thumb opcode) {
+    if ((opcode & 0xF800) == 0x0000) {
+        // LSL #0 doesn't touch the carry flag.
+        return {((opcode >> 6) & 0x1F) ? nzc_flags : nz_flags, false};
+    } else if ((opcode & 0xE000) == 0x0000) {
+        return {((opcode & 0x1800) == 0x1800) ? nzcv_flags : nzc_flags, false};
+    } else if ((opcode & 0xE000) == 0x2000) {
+        return {((opcode & 0x1800) == 0x0000) ? nz_flags : nzcv_flags, false};
+    } else if ((opcode & 0xFC00) == 0x4000) {
+        switch ((opcode >> 6) & 0xF) {
+        case 0x5:
+        case 0x6:
+            return {nzcv_flags, true};
+        case 0x9:
+        case 0xA:
+        case 0xB:
+            return {nzcv_flags, false};
+        default:
+            return {nz_flags, false};
+        }
+    } else if ((opcode & 0xFF00) == 0x4500) {
+        return {nzcv_flags, false};
+    } else {
+        // Hi register MOV and ADD, and the SP/PC-relative adds don't set flags.
+        return {0, false};
+    }
+}
+
+void EmitInstruction(Emitter& e, Thumb opcode, bool store_flags) {
+    const Reg low_d = opcode & 0x7;
+    const Reg low_m = (opcode >> 3) & 0x7;
+    const u32 wanted = store_flags ? GetFlagUsage(opcode).written : 0;
+
+    const auto Flags = [&e, wanted](bool borrow) {
+        if (wanted != 0) {
+            e.StoreFlags(wanted, borrow);
+        }
+    };
+
+    if ((opcode & 0xE000) == 0x0000 && (opcode & 0x1800) != 0x1800) {
+        // LSL/LSR/ASR Rd, Rm, #imm
+        const u8 imm = (opcode >> 6) & 0x1F;
+        e.LoadReg(Eax, low_m);
+        switch ((opcode >> 11) & 0x3) {
+        case 0:
+            if (imm == 0) {
+                e.Test();
+            } else {
+                e.Shl(imm);
+            }
+            break;
+        case 1:
+            e.Shr(imm);
+            break;
+        default:
+            e.Sar(imm);
+            break;
+        }
+        e.StoreReg(low_d, Eax);
+        Flags(false);
+    } else if ((opcode & 0xF800) == 0x1800) {
+        // ADD/SUB Rd, Rn, Rm or #imm3
+        const Reg m = (opcode >> 6) & 0x7;
+        const bool sub = opcode & 0x0200;
+        e.LoadReg(Eax, low_m);
+        if (opcode & 0x0400) {
+            e.AluImm(sub ? Sub : Add, m);
+        } else {
+            e.AluReg(sub ? Sub : Add, m);
+        }
+        e.StoreReg(low_d, Eax);
+        Flags(sub);
+    } else if ((opcode & 0xE000) == 0x2000) {
+        // MOV/CMP/ADD/SUB Rd, #imm8
+        const Reg d = (opcode >> 8) & 0x7;
+        const u32 imm = opcode & 0xFF;
+        switch ((opcode >> 11) & 0x3) {
+        case 0:
+            e.MovImm(imm);
+            e.Test();
+            e.StoreReg(d, Eax);
+            Flags(false);
+            break;
+        case 1:
+            e.LoadReg(Eax, d);
+            e.AluImm(Cmp, imm);
+            Flags(true);
+            break;
+        case 2:
+            e.LoadReg(Eax, d);
+            e.AluImm(Add, imm);
+            e.StoreReg(d, Eax);
+            Flags(false);
+            break;
+        default:
+            e.LoadReg(Eax, d);
+            e.AluImm(Sub, imm);
+            e.StoreReg(d, Eax);
+            Flags(true);
+            break;
+        }
+    } else if ((opcode & 0xFC00) == 0x4000) {
+        // Data processing Rdn, Rm
+        switch ((opcode >> 6) & 0xF) {
+        case 0x0:
+            e.LoadReg(Eax, low_d);
+            e.AluReg(And, low_m);
+            e.StoreReg(low_d, Eax);
+            Flags(false);
+            break;
+        case 0x1:
+            e.LoadReg(Eax, low_d);
+            e.AluReg(Xor, low_m);
+            e.StoreReg(low_d, Eax);
+            Flags(false);
+            break;
+        case 0x5:
+            e.LoadReg(Eax, low_d);
+            e.LoadCarry(false);
+            e.AluReg(Adc, low_m);
+            e.StoreReg(low_d, Eax);
+            Flags(false);
+            break;
+        case 0x6:
+            e.LoadReg(Eax, low_d);
+            e.LoadCarry(true);
+            e.AluReg(Sbb, low_m);
+            e.StoreReg(low_d, Eax);
+            Flags(true);
+            break;
+        case 0x8:
+            e.LoadReg(Eax, low_d);
+            e.AluReg(And, low_m);
+            Flags(false);
+            break;
+        case 0x9:
+            e.LoadReg(Eax, low_m);
+            e.Neg();
+            e.StoreReg(low_d, Eax);
+            Flags(true);
+            break;
+        case 0xA:
+            e.LoadReg(Eax, low_d);
+            e.AluReg(Cmp, low_m);
+            Flags(true);
+            break;
+        case 0xB:
+            e.LoadReg(Eax, low_d);
+            e.AluReg(Add, low_m);
+            Flags(false);
+            break;
+        case 0xC:
+            e.LoadReg(Eax, low_d);
+            e.AluReg(Or, low_m);
+            e.StoreReg(low_d, Eax);
+            Flags(false);
+            break;
+        case 0xE:
+            e.LoadReg(Eax, low_d);
+            e.LoadReg(Ecx, low_m);
+            e.Not(Ecx);
+            e.AndEcx();
+            e.StoreReg(low_d, Eax);
+            Flags(false);
+            break;
+        default:
+            // MVN, the only remaining supported operation.
+            e.LoadReg(Eax, low_m);
+            e.Not(Eax);
+            e.Test();
+            e.StoreReg(low_d, Eax);
+            Flags(false);
+            break;
+        }
+    } else if ((opcode & 0xFC00) == 0x4400) {
+        // ADD/CMP/MOV with high registers
+        const Reg d = ((opcode >> 4) & 0x8) | low_d;
+        const Reg m = (opcode >> 3) & 0xF;
+        switch ((opcode >> 8) & 0x3) {
+        case 0:
+            e.LoadReg(Eax, d);
+            e.AluReg(Add, m);
+            e.StoreReg(d, Eax);
+            break;
+        case 1:
+            e.LoadReg(Eax, d);
+            e.AluReg(Cmp, m);
+            Flags(true);
+            break;
+        default:
+            e.LoadReg(Eax, m);
+            e.StoreReg(d, Eax);
+            break;
+        }
+    } else if ((opcode & 0xF800) == 0xA800) {
+        // ADD Rd, SP, #imm
+        e.LoadReg(Eax, sp);
+        e.AluImm(Add, (opcode & 0xFF) << 2);
+        e.StoreReg((opcode >> 8) & 0x7, Eax);
+    } else {
+        // ADD/SUB SP, SP, #imm
+        e.LoadReg(Eax, sp);
+        e.AluImm((opcode & 0x0080) ? Sub : Add, (opcode & 0x7F) << 2);
+        e.StoreReg(sp, Eax);
+    }
+}
+
+} // End anonymous namespace
+
+Jit::Jit(BlockCache& _block_cache)
+        : block_cache(_block_cache) {
+#if !defined(__x86_64__) && !defined(_M_X64)
+    throw std::runtime_error("The JIT is only available on x86-64 hosts.");
+#endif
+
+#if defined(_WIN32)
+    code_buffer = static_cast<u8*>(VirtualAlloc(nullptr, code_buffer_size, MEM_COMMIT | MEM_RESERVE,
+                                                PAGE_EXECUTE_READWRITE));
+    if (code_buffer == nullptr) {
+        throw std::runtime_error("Failed to allocate executable memory for the JIT.");
+    }
+#else
+    void* buffer = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (buffer == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate executable memory for the JIT.");
+    }
+    code_buffer = static_cast<u8*>(buffer);
+#endif
+
+    block_cache.code_invalidated = [this](u32 addr, u32 bytes) { InvalidateRange(addr, bytes); };
+}
+
+Jit::~Jit() {
+    block_cache.code_invalidated = [](u32, u32) {};
+
+#if defined(_WIN32)
+    VirtualFree(code_buffer, 0, MEM_RELEASE);
+#else
+    munmap(code_buffer, code_buffer_size);
+#endif
+}
+
+const Jit::Run* Jit::Lookup(u32 addr) {
+    if (!BlockCache::Cacheable(addr)) {
+        return nullptr;
+    }
+
+    const u32 canonical_addr = BlockCache::CanonicalAddr(addr);
+    Entry& entry = GetEntry(canonical_addr);
+    if (entry.run != nullptr || entry.hits == not_compilable) {
+        return entry.run;
+    }
+
+    if (++entry.hits < hot_threshold) {
+        return nullptr;
+    }
+
+    // Compiling may flush the code buffer along with every page, so look the entry up again afterwards.
+    const Run* run = Compile(addr);
+    Entry& new_entry = GetEntry(canonical_addr);
+    new_entry.run = run;
+    if (run == nullptr) {
+        new_entry.hits = not_compilable;
+    }
+
+    return run;
+}
+
+void Jit::InvalidateRange(u32 addr, u32 bytes) {
+    const auto it = pages.find(addr & BlockCache::page_mask);
+    if (it == pages.end()) {
+        return;
+    }
+
+    // A run fetches from its first opcode up to two past its last, and a start which couldn't be compiled was
+    // judged on its first two opcodes. Entries which are still counting hits don't depend on the code.
+    const u32 offset = addr & ~BlockCache::page_mask;
+    const u32 max_reach = 2 * (max_run_length + 2);
+    auto& entries = it->second->entries;
+    for (u32 i = (offset > max_reach) ? (offset - max_reach) / 2 : 0; i <= (offset + bytes - 1) / 2; ++i) {
+        Entry& entry = entries[i];
+        if (entry.run == nullptr && entry.hits != not_compilable) {
+            continue;
+        }
+
+        const int length = (entry.run != nullptr) ? entry.run->length : 0;
+        if (2 * i + 2 * (length + 2) > offset) {
+            entry = Entry{};
+        }
+    }
+}
+
+Jit::Entry& Jit::GetEntry(u32 canonical_addr) {
+    auto& page = pages[canonical_addr & BlockCache::page_mask];
+    if (page == nullptr) {
+        page = std::make_unique<Page>();
+    }
+
+    return page->entries[(canonical_addr & ~BlockCache::page_mask) / sizeof(Thumb)];
+}
+
+const Jit::Run* Jit::Compile(u32 addr) {
+    if (paused) {
+        return nullptr;
+    }
+
+    const u32 page_addr = addr & BlockCache::page_mask;
+
+    // The opcode fetched before each instruction executes is two instructions ahead of it, and all of them need
+    // to be on the same page so that the run gets invalidated along with them.
+    std::vector<Thumb> opcodes;
+    for (u32 instr_addr = addr; opcodes.size() < max_run_length; instr_addr += 2) {
+        if (((instr_addr + 4) & BlockCache::page_mask) != page_addr) {
+            break;
+        }
+
+        const Thumb opcode = block_cache.Lookup<Thumb>(instr_addr)->opcode;
+        if (!Supported(opcode)) {
+            break;
+        }
+
+        opcodes.push_back(opcode);
+    }
+
+    const int length = opcodes.size();
+    if (length < 2) {
+        return nullptr;
+    }
+
+    auto run = std::make_unique<Run>();
+    run->length = length;
+    run->first_opcodes = {{opcodes[0], opcodes[1]}};
+
+    const u32 last_addr = addr + 2 * (length - 1);
+    for (int i = 0; i < 3; ++i) {
+        const auto op = block_cache.Lookup<Thumb>(last_addr + 2 * i);
+        run->pipeline[i] = op->opcode;
+        run->handlers[i] = op->handler;
+    }
+
+    run->fetch_cycles = block_cache.Lookup<Thumb>(addr + 4)->fetch_cycles;
+    const int max_fetch_cycles = (run->fetch_cycles != 0) ? run->fetch_cycles : max_rom_fetch_cycles;
+    run->max_cycles_before_last = max_fetch_cycles * (length - 1);
+
+    // Only store flags which aren't overwritten before the end of the run or read by ADC/SBC.
+    std::vector<bool> store_flags(length);
+    u32 live_flags = nzcv_flags;
+    for (int i = length - 1; i >= 0; --i) {
+        const FlagUsage usage = GetFlagUsage(opcodes[i]);
+        store_flags[i] = usage.written & live_flags;
+        live_flags &= ~usage.written;
+        if (usage.reads_carry) {
+            live_flags |= carry_flag;
+        }
+    }
+
+    Emitter emitter;
+    emitter.Prologue();
+    for (int i = 0; i < length; ++i) {
+        EmitInstruction(emitter, opcodes[i], store_flags[i]);
+    }
+    emitter.Ret();
+
+    if (code_offset + emitter.code.size() > code_buffer_size) {
+        Flush();
+    }
+
+    u8* func = code_buffer + code_offset;
+    std::memcpy(func, emitter.code.data(), emitter.code.size());
+    code_offset += emitter.code.size();
+
+    run->func = reinterpret_cast<RunFunc>(func);
+    runs.push_back(std::move(run));
+
+    return runs.back().get();
+}
+
+void Jit::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("jit", sizeof(Jit) + pages.size() * sizeof(Page) + runs.size() * sizeof(Run));
+    // The code buffer is only reserved up front, so just the part that's been written to is resident.
+    report.Add("jit", code_offset);
+}
+
+void Jit::Pause(bool pause) {
+    // Runs marked as not compilable while paused are forgotten as well.
+    Flush();
+    paused = pause;
+}
+
+void Jit::Flush() {
+    pages.clear();
+    runs.clear();
+    code_offset = 0;
+}
+
+bool Jit::Supported(Thumb opcode) {
+    if ((opcode & 0xE000) == 0x0000) {
+        // LSR #32 and ASR #32 are encoded with a zero immediate, and x86 can't shift by 32.
+        const bool long_shift = (opcode & 0x1800) != 0x0000 && (opcode & 0x1800) != 0x1800
+                             && ((opcode >> 6) & 0x1F) == 0;
+        return !long_shift;
+    } else if ((opcode & 0xE000) == 0x2000) {
+        return true;
+    } else if ((opcode & 0xFC00) == 0x4000) {
+        // Register shifts, RORs and MULs take internal cycles.
+        switch ((opcode >> 6) & 0xF) {
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x7:
+        case 0xD:
+            return false;
+        default:
+            return true;
+        }
+    } else if ((opcode & 0xFC00) == 0x4400) {
+        // Hi register operations can't involve the PC, and BX always does.
+        const Reg d = ((opcode >> 4) & 0x8) | (opcode & 0x7);
+        const Reg m = (opcode >> 3) & 0xF;
+        return ((opcode >> 8) & 0x3) != 0x3 && d != pc && m != pc;
+    } else if ((opcode & 0xF800) == 0xA800) {
+        return true;
+    } else {
+        return (opcode & 0xFF00) == 0xB000;
+    }
+}
+
+} // End namespace Gba
@@ -0,0 +1,109 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "common/CommonTypes.h"
+#include "common/MemoryReport.h"
+#include "gba/cpu/CpuDefs.h"
+#include "gba/cpu/BlockCache.h"
+
+namespace Gba {
+
+// Translates hot runs of Thumb data processing instructions into x86-64. A run can't touch memory, the PC, or the
+// CPU mode, so the interpreter only has to account for the opcode fetches around it. Everything else, including
+// all ARM code, goes through the cached interpreter.
+class Jit {
+public:
+    explicit Jit(BlockCache& _block_cache);
+    ~Jit();
+
+    // The generated code is x86-64, so other hosts stick to the cached interpreter.
+#if defined(__x86_64__) || defined(_M_X64)
+    static constexpr bool host_supported = true;
+#else
+    static constexpr bool host_supported = false;
+#endif
+
+    using RunFunc = void(*)(u32* regs, u32* cpsr);
+
+    struct Run {
+        RunFunc func;
+        int length;
+
+        // Fetch timing of every opcode fetched by the run, or 0 if it has to be determined by Memory::AccessTime.
+        int fetch_cycles;
+        // An upper bound on the number of cycles taken before the last instruction of the run executes.
+        int max_cycles_before_last;
+
+        // The opcodes and handlers in the pipeline after the run, with the last executed instruction first.
+        std::array<Thumb, 3> pipeline;
+        std::array<Handler<Thumb>, 3> handlers;
+
+        // The first two opcodes executed by the run, which must match what's already in the pipeline.
+        std::array<Thumb, 2> first_opcodes;
+    };
+
+    // Returns the run starting at the given address if it has been compiled, otherwise counts the execution
+    // towards compiling it. The address is that of the instruction about to execute.
+    const Run* Lookup(u32 addr);
+
+    // Throws away the runs which fetch any of the given canonical addresses. The range must not cross a page.
+    void InvalidateRange(u32 addr, u32 bytes);
+    // Throws away every run, and compiles no more until unpaused.
+    void Pause(bool pause);
+
+    void ReportMemory(Common::MemoryReport& report) const;
+
+private:
+    BlockCache& block_cache;
+
+    struct Entry {
+        const Run* run = nullptr;
+        u16 hits = 0;
+    };
+
+    struct Page {
+        std::array<Entry, BlockCache::page_size / sizeof(Thumb)> entries{};
+    };
+
+    std::unordered_map<u32, std::unique_ptr<Page>> pages;
+    std::vector<std::unique_ptr<Run>> runs;
+
+    u8* code_buffer = nullptr;
+    std::size_t code_offset = 0;
+    bool paused = false;
+
+    static constexpr std::size_t code_buffer_size = 8 * 1024 * 1024;
+    static constexpr u16 hot_threshold = 16;
+    static constexpr u16 not_compilable = 0xFFFF;
+    static constexpr int max_run_length = 64;
+    // The slowest possible 16-bit ROM fetch, with 8 wait states.
+    static constexpr int max_rom_fetch_cycles = 9;
+
+    Entry& GetEntry(u32 canonical_addr);
+    const Run* Compile(u32 addr);
+    void Flush();
+
+    static bool Supported(Thumb opcode);
+};
+
+} // End namespace Gba
@@ -14,6 +14,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <array>
 #include <bitset>
 #include <cassert>
 
@@ -379,14 +380,15 @@ int Cpu::Thumb_Ldm(Reg n, u32 reg_list) {
     u32 addr = regs[n];
 
     // One internal cycle to transfer the last loaded value to the destination register.
-    int cycles = 1;
+    // Reads are aligned.
+    std::array<u32, 8> data;
+    const int count = rlist.count();
+    int cycles = 1 + mem.ReadBlock(addr, data.data(), count);
+    addr += 4 * count;
 
-    for (Reg i = 0; i < 8; ++i) {
+    for (Reg i = 0, j = 0; i < 8; ++i) {
         if (rlist[i]) {
-            // Reads are aligned.
-            regs[i] = mem.ReadMem<u32>(addr);
-            cycles += mem.AccessTime<u32>(addr);
-            addr += 4;
+            regs[i] = data[j++];
         }
     }
 
@@ -487,14 +489,15 @@ int Cpu::Thumb_Pop(bool p, u32 reg_list) {
     u32 addr = regs[sp];
 
     // One internal cycle to transfer the last loaded value to the destination register.
-    int cycles = 1;
+    // Reads are aligned.
+    std::array<u32, 8> data;
+    const int count = rlist.count();
+    int cycles = 1 + mem.ReadBlock(addr, data.data(), count);
+    addr += 4 * count;
 
-    for (Reg i = 0; i < 8; ++i) {
+    for (Reg i = 0, j = 0; i < 8; ++i) {
         if (rlist[i]) {
-            // Reads are aligned.
-            regs[i] = mem.ReadMem<u32>(addr);
-            cycles += mem.AccessTime<u32>(addr);
-            addr += 4;
+            regs[i] = data[j++];
         }
     }
 
@@ -519,22 +522,20 @@ int Cpu::Thumb_Push(bool m, u32 reg_list) {
     if (m) {
         regs[sp] -= 4;
     }
-    u32 addr = regs[sp];
+    const u32 addr = regs[sp];
 
-    int cycles = 0;
+    // Writes are always aligned.
+    std::array<u32, 9> data;
+    int count = 0;
     for (Reg i = 0; i < 8; ++i) {
         if (rlist[i]) {
-            // Writes are always aligned.
-            mem.WriteMem(addr, regs[i]);
-            cycles += mem.AccessTime<u32>(addr);
-            addr += 4;
+            data[count++] = regs[i];
         }
     }
-
     if (m) {
-        mem.WriteMem(addr, regs[lr]);
-        cycles += mem.AccessTime<u32>(addr);
+        data[count++] = regs[lr];
     }
+    const int cycles = mem.WriteBlock(addr, data.data(), count);
 
     StorePrefetch();
 
@@ -545,24 +546,24 @@ int Cpu::Thumb_Stm(Reg n, u32 reg_list) {
     assert(Popcount(reg_list) != 0); // Unpredictable
 
     const std::bitset<8> rlist{reg_list};
-    u32 addr = regs[n];
+    const u32 addr = regs[n];
 
-    int cycles = 0;
+    // Writes are always aligned.
+    std::array<u32, 8> data;
+    int count = 0;
     for (Reg i = 0; i < 8; ++i) {
         if (rlist[i]) {
-            // Writes are always aligned.
             if (i == n && n != LowestSetBit(reg_list)) {
                 // Store the new Rn value if it's not the first register in the list.
-                mem.WriteMem(addr, static_cast<u32>(regs[n] + 4 * rlist.count()));
+                data[count++] = regs[n] + 4 * rlist.count();
             } else {
-                mem.WriteMem(addr, regs[i]);
+                data[count++] = regs[i];
             }
-            cycles += mem.AccessTime<u32>(addr);
-            addr += 4;
         }
     }
+    const int cycles = mem.WriteBlock(addr, data.data(), count);
 
-    regs[n] = addr;
+    regs[n] = addr + 4 * count;
 
     StorePrefetch();
 
@@ -626,8 +627,8 @@ int Cpu::Thumb_StrhReg(Reg m, Reg n, Reg t) {
 }
 
 // Misc
-int Cpu::Thumb_Swi(u32) {
-    return TakeException(CpuMode::Svc);
+int Cpu::Thumb_Swi(u32 imm) {
+    return SoftwareInterrupt(imm);
 }
 
 int Cpu::Thumb_Undefined(u16) {
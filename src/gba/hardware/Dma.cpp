@@ -15,14 +15,25 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
+#include <cstring>
 
 #include "gba/hardware/Dma.h"
 #include "gba/core/Core.h"
 #include "gba/memory/Memory.h"
 #include "gba/cpu/Cpu.h"
+#include "gba/audio/Audio.h"
+#include "common/Tracer.h"
 
 namespace Gba {
 
+namespace {
+
+Common::Tracer::Track TraceTrack(int id) {
+    return static_cast<Common::Tracer::Track>(Common::Tracer::Dma0 + id);
+}
+
+} // End anonymous namespace
+
 Dma::Dma(int _id, Core& _core)
         : id(_id)
         , core(_core) {
@@ -81,10 +92,16 @@ void Dma::Trigger(Timing event) {
     }
 }
 
-int Dma::Run() {
+int Dma::Run(int cycle_limit) {
+    const auto bench_timer = core.bench.Time(Common::BenchStats::Dma);
+
     int cycles_taken = 0;
 
     if (starting) {
+        if (core.tracer != nullptr) {
+            core.tracer->Begin(TraceTrack(id), "dma", core.scheduler.Timestamp());
+        }
+
         // Two I-cycles to start the transfer.
         cycles_taken = 2;
 
@@ -104,8 +121,22 @@ int Dma::Run() {
         }
     }
 
+    if (remaining_chunks > 1 && cycles_taken < cycle_limit) {
+        if (TransferWidth() == 2) {
+            cycles_taken += Burst<u16>(cycle_limit - cycles_taken);
+        } else {
+            cycles_taken += Burst<u32>(cycle_limit - cycles_taken);
+        }
+    }
+
     if (--remaining_chunks == 0) {
         // The transfer has finished.
+        if (core.tracer != nullptr) {
+            // The end is stamped with the cycle the transfer would finish on, since the time taken isn't added
+            // to the timestamp until Run returns.
+            core.tracer->End(TraceTrack(id), "dma", core.scheduler.Timestamp() + cycles_taken);
+        }
+
         if (InterruptEnabled()) {
             core.mem->RequestInterrupt(Interrupt::Dma0 << id);
         }
@@ -145,7 +176,7 @@ int Dma::Run() {
 template<typename T>
 int Dma::Transfer(bool sequential) {
     if (!bad_source) {
-        core.mem->transfer_reg = core.mem->ReadMem<T>(source, true);
+        core.mem->transfer_reg = core.mem->ReadMem<T>(source, AccessType::Dma);
         if (sizeof(T) == sizeof(u16)) {
             core.mem->transfer_reg |= core.mem->transfer_reg << 16;
         }
@@ -192,6 +223,107 @@ int Dma::Transfer(bool sequential) {
     return cycles;
 }
 
+template<typename T>
+int Dma::Burst(int cycle_budget) {
+    if (FifoTimingEnabled()) {
+        return FifoBurst(cycle_budget);
+    }
+
+    // Only plain memory can be copied in bulk, since nothing else can observe the individual transfers. Writes
+    // to IO in particular could start a higher priority DMA.
+    const bool rom_source = source >= BaseAddr::Rom && source < BaseAddr::SRam;
+    if (bad_source || (!rom_source && SourceControl() != Increment)
+            || (DestControl() != Increment && DestControl() != Reload)) {
+        return 0;
+    }
+
+    u32 source_bytes, dest_bytes;
+    const u8* source_ptr = core.mem->DmaSourcePointer(source, source_bytes);
+    u8* dest_ptr = core.mem->DmaDestPointer(dest, dest_bytes);
+    if (source_ptr == nullptr || dest_ptr == nullptr) {
+        return 0;
+    }
+
+    // Every access after the first is sequential, so each chunk takes the same time as long as neither address
+    // leaves its page. AccessTime has no side effects for DMA accesses besides updating the last address.
+    const int chunk_cycles = core.mem->AccessTime<T>(source, AccessType::Dma, true)
+                             + core.mem->AccessTime<T>(dest, AccessType::Dma, true);
+
+    // Stop at the first chunk that would start after the cycle budget ends, which is where the interpreter would
+    // service the next event.
+    u32 chunks = std::min({static_cast<u32>(remaining_chunks - 1),
+                           static_cast<u32>((cycle_budget + chunk_cycles - 1) / chunk_cycles),
+                           source_bytes / static_cast<u32>(sizeof(T)),
+                           dest_bytes / static_cast<u32>(sizeof(T))});
+    const u32 bytes = chunks * sizeof(T);
+
+    if (source_ptr < dest_ptr + bytes && dest_ptr < source_ptr + bytes) {
+        // Overlapping copies depend on the transfer order.
+        chunks = 0;
+    }
+
+    if (chunks == 0) {
+        core.mem->MakeNextAccessSequential(dest - sizeof(T));
+        return 0;
+    }
+
+    std::memcpy(dest_ptr, source_ptr, bytes);
+    core.mem->DmaBlockWritten(dest, bytes);
+    core.access_counters.AddRange(source, bytes, sizeof(T), Common::AccessCounters::DmaRead);
+    core.access_counters.AddRange(dest, bytes, sizeof(T), Common::AccessCounters::DmaWrite);
+
+    T last_chunk;
+    std::memcpy(&last_chunk, source_ptr + bytes - sizeof(T), sizeof(T));
+    core.mem->transfer_reg = last_chunk;
+    if (sizeof(T) == sizeof(u16)) {
+        core.mem->transfer_reg |= core.mem->transfer_reg << 16;
+    }
+
+    source += bytes;
+    dest += bytes;
+    remaining_chunks -= chunks;
+    core.mem->MakeNextAccessSequential(dest - sizeof(T));
+
+    return chunks * chunk_cycles;
+}
+
+int Dma::FifoBurst(int cycle_budget) {
+    // Sound DMAs refill the fifo with the same handful of words thousands of times a second. Writing the fifo has
+    // no side effects besides filling it, so the words can go straight into it, as long as they come from plain
+    // memory.
+    const bool rom_source = source >= BaseAddr::Rom && source < BaseAddr::SRam;
+    if (bad_source || !(WritingToFifo(0) || WritingToFifo(1)) || (!rom_source && SourceControl() != Increment)) {
+        return 0;
+    }
+
+    u32 source_bytes;
+    const u8* source_ptr = core.mem->DmaSourcePointer(source, source_bytes);
+    if (source_ptr == nullptr) {
+        return 0;
+    }
+
+    // The fifo address doesn't change, so every chunk takes the same time, like a burst to memory.
+    const int chunk_cycles = core.mem->AccessTime<u32>(source, AccessType::Dma, true)
+                             + core.mem->AccessTime<u32>(dest, AccessType::Dma, true);
+    const u32 chunks = std::min({static_cast<u32>(remaining_chunks - 1),
+                                 static_cast<u32>((cycle_budget + chunk_cycles - 1) / chunk_cycles),
+                                 source_bytes / 4});
+    if (chunks == 0) {
+        return 0;
+    }
+
+    const u32 bytes = chunks * 4;
+    core.audio->fifos[WritingToFifo(0) ? 0 : 1].WriteBlock(reinterpret_cast<const s8*>(source_ptr), bytes);
+    std::memcpy(&core.mem->transfer_reg, source_ptr + bytes - 4, 4);
+    core.access_counters.AddRange(source, bytes, 4, Common::AccessCounters::DmaRead);
+    core.access_counters.Add(dest, Common::AccessCounters::DmaWrite, chunks);
+
+    source += bytes;
+    remaining_chunks -= chunks;
+
+    return chunks * chunk_cycles;
+}
+
 void Dma::ReloadWordCount() {
     if (FifoTimingEnabled()) {
         remaining_chunks = 4;
@@ -205,4 +337,9 @@ void Dma::ReloadWordCount() {
     starting = true;
 }
 
+void Dma::SerializeState(Common::State& state) {
+    state.Sync(source_l, source_h, dest_l, dest_h, word_count, control, source, dest, remaining_chunks, bad_source,
+               paused, starting);
+}
+
 } // End namespace Gba
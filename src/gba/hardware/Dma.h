@@ -40,11 +40,15 @@ public:
                        HBlank    = 2,
                        Special   = 3};
 
-    int Run();
+    // Runs at least one chunk of the transfer, and keeps going in bulk while the chunks start before the cycle
+    // limit and only touch plain memory.
+    int Run(int cycle_limit);
 
     void WriteControl(const u16 data, const u16 mask);
     bool Active() const { return DmaEnabled() && !paused; }
+    bool DmaEnabled() const { return control & 0x8000; }
     void Trigger(Timing event);
+    void SerializeState(Common::State& state);
     bool WritingToFifo(int f) const { return dest == FIFO_A_L + 4 * f; }
 
 private:
@@ -62,6 +66,9 @@ private:
     void ReloadWordCount();
     template<typename T>
     int Transfer(bool sequential);
+    template<typename T>
+    int Burst(int cycle_budget);
+    int FifoBurst(int cycle_budget);
 
     void DisableDma() { control &= ~0x8000; }
     bool FifoTimingEnabled() const { return StartTiming() == Timing::Special && (id == 1 || id == 2); }
@@ -78,7 +85,6 @@ private:
     bool DrqEnabled() const { return control & 0x0800; }
     Timing StartTiming() const { return static_cast<Timing>((control >> 12) & 0x3); }
     bool InterruptEnabled() const { return control & 0x4000; }
-    bool DmaEnabled() const { return control & 0x8000; }
 };
 
 } // End namespace Gba
@@ -73,4 +73,8 @@ void Keypad::Press(Button button, bool pressed) {
     }
 }
 
+void Keypad::SerializeState(Common::State& state) {
+    state.Sync(input, control, already_requested, was_unset);
+}
+
 } // End namespace Gba
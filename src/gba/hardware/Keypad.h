@@ -43,6 +43,7 @@ public:
 
     void CheckKeypadInterrupt();
     void Press(Button button, bool pressed);
+    void SerializeState(Common::State& state);
 
 private:
     Core& core;
@@ -26,6 +26,10 @@ namespace Gba {
 Rtc::Rtc(Core& _core)
         : core(_core) {}
 
+void Rtc::SerializeState(Common::State& state) {
+    state.Sync(transfer_state, command_state, reg_being_accessed, serial_bitstream, control, date_time, bits_read);
+}
+
 u16 Rtc::UpdateState(u16 data, bool write) {
     if (ChipSelectLow(data)) {
         if (!serial_bitstream.empty()) {
@@ -274,8 +278,8 @@ u8 Rtc::GetSerialBitstreamByte(int byte_index) const {
 }
 
 void Rtc::UpdateTime() {
-    const std::time_t current_time = std::time(nullptr);
-    const std::tm* local_date_time = std::localtime(&current_time);
+    const std::tm calendar_time = core.rtc_source.CalendarTime();
+    const std::tm* local_date_time = &calendar_time;
 
     date_time[TimeReg::Year]    = ConvertToBcd(local_date_time->tm_year - 100);
     date_time[TimeReg::Month]   = ConvertToBcd(local_date_time->tm_mon + 1);
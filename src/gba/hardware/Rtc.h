@@ -35,6 +35,7 @@ public:
                     CS  = 0x04};
 
     u16 UpdateState(u16 data, bool write);
+    void SerializeState(Common::State& state);
 
 private:
     enum class TransferState {Ready,
@@ -0,0 +1,221 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <array>
+
+#include "gba/hardware/Serial.h"
+#include "gba/core/Core.h"
+#include "gba/memory/Memory.h"
+#include "common/LinkCable.h"
+
+namespace Gba {
+
+namespace {
+
+// A multiplayer transfer is a start bit, 16 data bits and a stop bit from each of the two GBAs, at one of four
+// baud rates.
+constexpr std::array<int, 4> multiplayer_cycles{{16777216 / 9600 * 36, 16777216 / 38400 * 36,
+                                                 16777216 / 57600 * 36, 16777216 / 115200 * 36}};
+
+} // End anonymous namespace
+
+Serial::Serial(Core& _core, const Common::LinkSettings& link_settings)
+        : core(_core)
+        , link(Common::LinkPort::Open(link_settings)) {}
+
+// Needed to declare std::unique_ptr with forward-declared type in the header file.
+Serial::~Serial() = default;
+
+void Serial::ConnectLink(std::unique_ptr<Common::LinkPort> port) {
+    link = std::move(port);
+    PollLink();
+}
+
+Serial::Mode Serial::CurrentMode() const {
+    if (mode & 0x8000) {
+        return Mode::Other;
+    }
+
+    switch ((control >> 12) & 0x3) {
+    case 0:
+        return Mode::Normal8;
+    case 1:
+        return Mode::Normal32;
+    case 2:
+        return Mode::Multiplayer;
+    default:
+        return Mode::Other;
+    }
+}
+
+bool Serial::IsChild() const {
+    // The SI terminal floats high with nothing plugged in, which is how a child sees it.
+    return link == nullptr || link->Id() != 0;
+}
+
+u16 Serial::MultiplayerStatus() const {
+    if (link == nullptr) {
+        return siocnt_child;
+    }
+
+    // Both GBAs are ready, and the ID is the same as the link port's.
+    return (IsChild() ? siocnt_child : 0) | 0x0008 | (link->Id() << 4);
+}
+
+void Serial::WriteControl(u16 data, u16 mask) {
+    const bool was_active = control & siocnt_start;
+    control.Write(data, mask);
+
+    if (CurrentMode() == Mode::Multiplayer) {
+        // The terminal states, ID and error flag are read-only, and only the parent can start a transfer.
+        control = (control & ~siocnt_multi_status) | MultiplayerStatus();
+        if (IsChild()) {
+            control = (control & ~siocnt_start) | (was_active ? siocnt_start : 0);
+        }
+    }
+
+    if (!was_active && (control & siocnt_start)) {
+        StartTransfer();
+    } else if (was_active && !(control & siocnt_start)) {
+        core.scheduler.Unschedule(Event::Serial);
+    }
+}
+
+void Serial::StartTransfer() {
+    u32 out;
+    int cycles;
+    switch (CurrentMode()) {
+    case Mode::Normal8:
+    case Mode::Normal32:
+        if (!(control & siocnt_internal_clock)) {
+            // Waits for the other side to clock the transfer.
+            return;
+        }
+
+        if (CurrentMode() == Mode::Normal8) {
+            out = send & 0xFF;
+            cycles = 8;
+        } else {
+            out = data0 | (data1 << 16);
+            cycles = 32;
+        }
+        // 2MHz or 256KHz.
+        cycles *= (control & siocnt_fast_clock) ? 8 : 64;
+        break;
+    case Mode::Multiplayer:
+        out = send;
+        cycles = multiplayer_cycles[control & 0x3];
+        break;
+    default:
+        return;
+    }
+
+    if (link != nullptr) {
+        link->StartTransfer(out, core.scheduler.Timestamp());
+    }
+    core.scheduler.ScheduleIn(Event::Serial, cycles);
+}
+
+void Serial::FinishTransfer() {
+    core.scheduler.Unschedule(Event::Serial);
+
+    const u32 in = (link != nullptr) ? link->FinishTransfer() : Common::LinkPort::disconnected;
+    switch (CurrentMode()) {
+    case Mode::Normal8:
+        send = (send & 0xFF00) | (in & 0xFF);
+        break;
+    case Mode::Normal32:
+        data0 = in & 0xFFFF;
+        data1 = in >> 16;
+        break;
+    case Mode::Multiplayer:
+        data0 = send;
+        data1 = in & 0xFFFF;
+        data2 = 0xFFFF;
+        data3 = 0xFFFF;
+        break;
+    default:
+        break;
+    }
+
+    TransferDone();
+}
+
+void Serial::PollLink() {
+    if (link == nullptr) {
+        // Unscheduling would also move the event's sync time, which goes in savestates.
+        if (core.scheduler.Deadline(Event::LinkPoll) != Scheduler::never) {
+            core.scheduler.Unschedule(Event::LinkPoll);
+        }
+        return;
+    }
+
+    const u64 timestamp = core.scheduler.Timestamp();
+    while (link->RequestDue(timestamp)) {
+        ReceiveTransfer();
+    }
+
+    // If the other side has started a transfer we haven't reached yet, check again right when we do, so it lands
+    // at the same point in our timeline as in theirs.
+    core.scheduler.Schedule(Event::LinkPoll, std::min(link->NextRequestTime(), timestamp + link_poll_cycles));
+}
+
+void Serial::ReceiveTransfer() {
+    const Mode current_mode = CurrentMode();
+    if ((current_mode == Mode::Normal8 || current_mode == Mode::Normal32)
+            && (control & (siocnt_start | siocnt_internal_clock)) == siocnt_start) {
+        if (current_mode == Mode::Normal8) {
+            send = (send & 0xFF00) | (link->AnswerRequest(send & 0xFF) & 0xFF);
+        } else {
+            const u32 in = link->AnswerRequest(data0 | (data1 << 16));
+            data0 = in & 0xFFFF;
+            data1 = in >> 16;
+        }
+    } else if (current_mode == Mode::Multiplayer && IsChild()) {
+        data0 = link->AnswerRequest(send) & 0xFFFF;
+        data1 = send;
+        data2 = 0xFFFF;
+        data3 = 0xFFFF;
+    } else {
+        // Nothing on our side is listening, so the other side reads all 1s.
+        link->AnswerRequest(Common::LinkPort::disconnected);
+        return;
+    }
+
+    TransferDone();
+}
+
+void Serial::TransferDone() {
+    control &= ~siocnt_start;
+    if (control & siocnt_irq_enable) {
+        core.mem->RequestInterrupt(Interrupt::Serial);
+    }
+}
+
+void Serial::SerializeState(Common::State& state) {
+    state.Sync(data0, data1, data2, data3, control, send, mode, joybus_control, joybus_recv_l, joybus_recv_h,
+               joybus_trans_l, joybus_trans_h, joybus_status);
+
+    // The link cable isn't part of the state, so whether we poll it depends on this instance rather than the one
+    // that saved the state. The scheduler has already been loaded by now.
+    if (state.Loading()) {
+        PollLink();
+    }
+}
+
+} // End namespace Gba
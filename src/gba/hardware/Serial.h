@@ -14,18 +14,30 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+
 #pragma once
 
+#include <memory>
+
 #include "common/CommonTypes.h"
 #include "gba/memory/IOReg.h"
 
+namespace Common {
+class LinkPort;
+struct LinkSettings;
+} // End namespace Common
+
 namespace Gba {
 
 class Core;
 
+// Normal mode transfers, in both lengths, and multiplayer mode with two GBAs go over the link cable. Without one,
+// transfers on the internal clock still complete, reading all 1s. UART, general-purpose and JOY bus modes only
+// have their registers.
 class Serial {
 public:
-    explicit Serial(Core&) {}
+    Serial(Core& _core, const Common::LinkSettings& link_settings);
+    ~Serial();
 
     IOReg data0          = {0x0000, 0xFFFF, 0xFFFF};
     IOReg data1          = {0x0000, 0xFFFF, 0xFFFF};
@@ -48,8 +60,41 @@ public:
     static constexpr u16 joystat_trans     = 0x8;
     static constexpr u16 joystat_recv      = 0x2;
 
+    void WriteControl(u16 data, u16 mask);
+    // Runs once a transfer on our clock has finished shifting.
+    void FinishTransfer();
+    // Answers transfers started by the other side once we've reached their timestamp, and schedules the next check.
+    // Unschedules itself if there's no link cable.
+    void PollLink();
+
+    // Replaces whatever the link cable was connected to before.
+    void ConnectLink(std::unique_ptr<Common::LinkPort> port);
+
+    void SerializeState(Common::State& state);
+
 private:
-    //Core& core;
+    Core& core;
+    // Only present while a link cable is connected.
+    std::unique_ptr<Common::LinkPort> link;
+
+    enum class Mode {Normal8, Normal32, Multiplayer, Other};
+
+    static constexpr u16 siocnt_internal_clock = 0x0001;
+    static constexpr u16 siocnt_fast_clock     = 0x0002;
+    static constexpr u16 siocnt_child          = 0x0004;
+    static constexpr u16 siocnt_multi_status   = 0x007C;
+    static constexpr u16 siocnt_start          = 0x0080;
+    static constexpr u16 siocnt_irq_enable     = 0x4000;
+
+    // How often to check for transfers from the other side when none are known to be coming.
+    static constexpr int link_poll_cycles = 1024;
+
+    Mode CurrentMode() const;
+    bool IsChild() const;
+    u16 MultiplayerStatus() const;
+    void StartTransfer();
+    void ReceiveTransfer();
+    void TransferDone();
 };
 
 } // End namespace Gba
@@ -14,10 +14,13 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+
 #include "gba/hardware/Timer.h"
 #include "gba/core/Core.h"
 #include "gba/memory/Memory.h"
 #include "gba/audio/Audio.h"
+#include "common/CommonFuncs.h"
 
 namespace Gba {
 
@@ -32,42 +35,33 @@ Timer::Timer(int _id, Core& _core)
 }
 
 void Timer::Tick(int cycles) {
-    while (delay > 0 && cycles > 0) {
-        delay -= 1;
-        cycles -= 1;
-        timer_clock += 1;
-    }
-
-    if (cycles_per_tick == 1) {
-        while (cycles > 0) {
-            const int remaining_ticks = 0x1'0000 - counter;
-            if (remaining_ticks > cycles) {
-                timer_clock += cycles;
-                counter += cycles;
-                return;
-            }
-
-            // Set the counter so it overflows in CounterTick().
-            counter += remaining_ticks - 1;
-            cycles -= remaining_ticks;
-            timer_clock += remaining_ticks;
-
-            CounterTick();
+    const int delay_cycles = std::min(delay, cycles);
+    delay -= delay_cycles;
+    cycles -= delay_cycles;
+    timer_clock += delay_cycles;
+
+    // The prescaler is shared with the system clock, so the counter ticks whenever the clock crosses a multiple of
+    // cycles_per_tick. Only overflows have side effects, so the counter jumps straight from one to the next.
+    const int tick_shift = Popcount(cycles_per_tick - 1);
+    const u64 end_clock = timer_clock + cycles;
+    int ticks = (end_clock >> tick_shift) - (timer_clock >> tick_shift);
+
+    while (ticks > 0) {
+        const int remaining_ticks = 0x1'0000 - counter;
+        if (remaining_ticks > ticks) {
+            counter += ticks;
+            break;
         }
-    } else {
-        while (cycles > 0) {
-            const int remaining_cycles = cycles_per_tick - (timer_clock & (cycles_per_tick - 1));
-            if (remaining_cycles > cycles) {
-                timer_clock += cycles;
-                return;
-            }
 
-            timer_clock += remaining_cycles;
-            cycles -= remaining_cycles;
+        // Set the counter so it overflows in CounterTick(), on the tick where it actually happens.
+        counter += remaining_ticks - 1;
+        ticks -= remaining_ticks;
+        timer_clock = ((timer_clock >> tick_shift) + remaining_ticks) << tick_shift;
 
-            CounterTick();
-        }
+        CounterTick();
     }
+
+    timer_clock = end_clock;
 }
 
 void Timer::CounterTick() {
@@ -79,6 +73,8 @@ void Timer::CounterTick() {
         }
 
         if (id < 3 && core.timers[id + 1].TimerEnabled() && core.timers[id + 1].CascadeEnabled()) {
+            // Cascading timers aren't synced by the scheduler, so bring their clock up to date before ticking.
+            core.timers[id + 1].timer_clock = timer_clock;
             core.timers[id + 1].CounterTick();
         }
 
@@ -92,8 +88,27 @@ void Timer::CounterTick() {
     }
 }
 
+void Timer::Sync() {
+    // The timer clock advances with the system clock whether or not the timer is running, so it always holds the
+    // timestamp of the last sync.
+    const u64 timestamp = core.scheduler.Timestamp();
+    if (TimerNotRunning()) {
+        timer_clock = timestamp;
+    } else {
+        Tick(timestamp - timer_clock);
+    }
+}
+
+void Timer::ScheduleNextEvent() {
+    if (TimerNotRunning()) {
+        core.scheduler.Unschedule(TimerEvent(id));
+    } else {
+        core.scheduler.ScheduleIn(TimerEvent(id), NextEvent());
+    }
+}
+
 void Timer::WriteControl(const u16 data, const u16 mask) {
-    Tick(core.timer_cycle_counter[id]);
+    Sync();
 
     const bool was_stopped = !TimerEnabled();
     control.Write(data, mask);
@@ -113,32 +128,29 @@ void Timer::WriteControl(const u16 data, const u16 mask) {
         cycles_per_tick = 16 << (2 * prescaler_select);
     }
 
-    core.timer_cycle_counter[id] = 0;
-    core.next_timer_event_cycles[id] = NextEvent();
+    ScheduleNextEvent();
 
     if (id < 2) {
         for (int f = 0; f < 2; ++f) {
             if (id == core.audio->FifoTimerSelect(f)) {
-                core.audio->Update(core.audio_cycle_counter);
-                core.audio_cycle_counter = 0;
-                core.next_audio_event_cycles = NextEvent();
+                // The audio hardware schedules itself around the FIFO timers, so it needs to be resynced.
+                core.audio->Sync();
+                break;
             }
         }
     }
 }
 
 u16 Timer::ReadCounter() {
-    Tick(core.timer_cycle_counter[id]);
-    core.timer_cycle_counter[id] = 0;
-    core.next_timer_event_cycles[id] = NextEvent();
+    Sync();
+    ScheduleNextEvent();
 
     return counter;
 }
 
 void Timer::WriteReload(const u16 data, const u16 mask) {
-    Tick(core.timer_cycle_counter[id]);
-    core.timer_cycle_counter[id] = 0;
-    core.next_timer_event_cycles[id] = NextEvent();
+    Sync();
+    ScheduleNextEvent();
 
     reload.Write(data, mask);
 }
@@ -161,4 +173,8 @@ int Timer::NextEvent() const {
     }
 }
 
+void Timer::SerializeState(Common::State& state) {
+    state.Sync(counter, reload, control, timer_clock, delay, cycles_per_tick);
+}
+
 } // End namespace Gba
@@ -35,8 +35,10 @@ public:
 
     void Tick(int cycles);
     void CounterTick();
-    void InactiveTick(int cycles) { timer_clock += cycles; }
+    void Sync();
+    void ScheduleNextEvent();
     int NextEvent() const;
+    void SerializeState(Common::State& state);
 
     u16 ReadCounter();
     void WriteReload(const u16 data, const u16 mask);
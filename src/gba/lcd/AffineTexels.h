@@ -0,0 +1,96 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+
+#include "common/CommonTypes.h"
+#include "common/Simd.h"
+
+namespace Gba {
+
+// Steps the texture coordinates of an affine background or sprite across eight screen pixels at a time. The
+// coordinates are 24.8 fixed point, and each screen pixel moves them by (dx, dy).
+class AffineTexels {
+public:
+    static constexpr int lanes = 8;
+
+    AffineTexels(s32 x, s32 y, s32 dx, s32 dy)
+            : x_lo(Vec::FromLanes({{x, x + dx, x + 2 * dx, x + 3 * dx}}))
+            , x_hi(x_lo + Vec::Splat(4 * dx))
+            , y_lo(Vec::FromLanes({{y, y + dy, y + 2 * dy, y + 3 * dy}}))
+            , y_hi(y_lo + Vec::Splat(4 * dy))
+            , step_x(Vec::Splat(lanes * dx))
+            , step_y(Vec::Splat(lanes * dy)) {}
+
+    // The texel coordinates of the current eight pixels, and whether each one lies inside the texture.
+    alignas(16) std::array<s32, lanes> tex_x;
+    alignas(16) std::array<s32, lanes> tex_y;
+    alignas(16) std::array<s32, lanes> in_bounds;
+
+    // Fills in the texel coordinates of the next eight pixels, offset by (offset_x, offset_y). The texture
+    // dimensions must be powers of two. If wrap is set, the coordinates wrap around the texture instead of
+    // going out of bounds.
+    void Next(int offset_x, int offset_y, int width, int height, bool wrap) {
+        Store(tex_x, x_lo, x_hi, offset_x, width, wrap);
+        Store(tex_y, y_lo, y_hi, offset_y, height, wrap);
+
+        if (wrap) {
+            in_bounds.fill(-1);
+        } else {
+            // A texel is out of bounds if either coordinate has any bits set above the texture dimension, which
+            // also catches negative coordinates.
+            for (int i = 0; i < lanes; i += 4) {
+                const Vec outside = (Vec::Load(tex_x.data() + i) & Vec::Splat(~(width - 1)))
+                                    | (Vec::Load(tex_y.data() + i) & Vec::Splat(~(height - 1)));
+                (outside == Vec::Zero()).Store(in_bounds.data() + i);
+            }
+        }
+
+        x_lo = x_lo + step_x;
+        x_hi = x_hi + step_x;
+        y_lo = y_lo + step_y;
+        y_hi = y_hi + step_y;
+    }
+
+private:
+    using Vec = Common::Simd::S32x4;
+
+    Vec x_lo;
+    Vec x_hi;
+    Vec y_lo;
+    Vec y_hi;
+    const Vec step_x;
+    const Vec step_y;
+
+    static void Store(std::array<s32, lanes>& coords, Vec lo, Vec hi, int offset, int size, bool wrap) {
+        const Vec offset_vec = Vec::Splat(offset);
+        lo = ShiftRight(lo, 8) + offset_vec;
+        hi = ShiftRight(hi, 8) + offset_vec;
+
+        if (wrap) {
+            const Vec mask = Vec::Splat(size - 1);
+            lo = lo & mask;
+            hi = hi & mask;
+        }
+
+        lo.Store(coords.data());
+        hi.Store(coords.data() + 4);
+    }
+};
+
+} // End namespace Gba
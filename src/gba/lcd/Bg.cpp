@@ -18,15 +18,35 @@
 
 #include "gba/lcd/Bg.h"
 #include "gba/lcd/Lcd.h"
+#include "gba/lcd/AffineTexels.h"
 
 namespace Gba {
 
+void Bg::SerializeState(Common::State& state) {
+    state.Sync(control, scroll_x, scroll_y, affine_a, affine_b, affine_c, affine_d, offset_x_l, offset_x_h,
+               offset_y_l, offset_y_h, enable_delay, ref_point_x, ref_point_y);
+    // Lines inside a vertical mosaic block reuse the line drawn at its top.
+    state.Sync(scanline);
+
+    if (state.Loading()) {
+        // Force the tile map row to be read again.
+        previous_row_num = 0xFF;
+        dirty = true;
+        map_layout = -1;
+    }
+}
+
+void Bg::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("bg_map_cache", map_pixels);
+    report.Add("bg_map_cache", map_cells);
+}
+
 bool Bg::Enabled() const {
     return (lcd.control & (0x100 << id)) && enable_delay == 0;
 }
 
 void Bg::ReadTileMapRow() {
-    int row_num = (scroll_y + lcd.vcount) / 8;
+    int row_num = (scroll_y + lcd.draw_line) / 8;
     if (ScreenSize() < 2) {
         row_num %= 32;
     } else {
@@ -40,15 +60,15 @@ void Bg::ReadTileMapRow() {
 
     previous_row_num = row_num;
     dirty = false;
-    tiles.clear();
+    int num_tiles = 0;
 
     // Get a row of map entries from the specified screenblock.
-    auto ReadRowMap = [this, row_num = row_num % 32](int screenblock) {
+    auto ReadRowMap = [this, &num_tiles, row_num = row_num % 32](int screenblock) {
         const int map_addr = (MapBase() + row_num * 64 + 0x800 * screenblock) / 2;
         const int tile_bytes = SinglePalette() ? 64 : 32;
 
         for (int i = map_addr; i < map_addr + 32; ++i) {
-            tiles.emplace_back(lcd.vram[i], TileBase(), tile_bytes);
+            tiles[num_tiles++] = BgTile(lcd.vram[i], TileBase(), tile_bytes);
         }
     };
 
@@ -83,113 +103,164 @@ void Bg::ReadTileMapRow() {
 }
 
 void Bg::DrawRegularScanline() {
-    if (Mosaic() && lcd.vcount % lcd.MosaicBgV() != 0) {
+    if (Mosaic() && lcd.draw_line % lcd.MosaicBgV() != 0) {
         // Reuse the previous scanline.
         return;
     }
 
-    ReadTileMapRow();
+    if (lcd.LineCacheEnabled()) {
+        DrawFromMapCache();
+    } else {
+        ReadTileMapRow();
 
-    const int pixel_row = (scroll_y + lcd.vcount) % 8;
+        const int pixel_row = (scroll_y + lcd.draw_line) % 8;
 
-    const int horizontal_tiles = (ScreenSize() & 0x1) ? 64 : 32;
-    int tile_index = (scroll_x / 8) % horizontal_tiles;
-    int start_offset = scroll_x % 8;
+        const int horizontal_tiles = (ScreenSize() & 0x1) ? 64 : 32;
+        int tile_index = (scroll_x / 8) % horizontal_tiles;
+        int start_offset = scroll_x % 8;
 
-    int scanline_index = 0;
-    while (scanline_index < Lcd::h_pixels) {
-        const auto& tile = tiles[tile_index];
-        tile_index = (tile_index + 1) % horizontal_tiles;
-        const int flip_row = tile.v_flip ? (7 - pixel_row) : pixel_row;
-
-        const std::array<u16, 8> pixel_colours = lcd.GetTilePixels(tile.tile_addr, SinglePalette(), tile.h_flip,
-                                                                   flip_row, tile.palette, 0);
-
-        // The first and last tiles may be partially scrolled off-screen.
-        const int end_offset = std::min(Lcd::h_pixels - scanline_index, 8);
-        for (int i = start_offset; i < end_offset; ++i) {
-            if (Mosaic() && scanline_index % lcd.MosaicBgH() != 0) {
-                scanline[scanline_index] = scanline[scanline_index - (scanline_index % lcd.MosaicBgH())];
-            } else {
-                scanline[scanline_index] = pixel_colours[i];
+        int scanline_index = 0;
+        while (scanline_index < Lcd::h_pixels) {
+            const auto& tile = tiles[tile_index];
+            tile_index = (tile_index + 1) % horizontal_tiles;
+            const int flip_row = tile.v_flip ? (7 - pixel_row) : pixel_row;
+
+            // The first and last tiles may be partially scrolled off-screen.
+            const int end_offset = std::min(Lcd::h_pixels - scanline_index, 8);
+            lcd.DecodeTileRow(scanline.data() + scanline_index, tile.tile_addr, SinglePalette(), tile.h_flip,
+                              flip_row, tile.palette, 0, start_offset, end_offset);
+
+            scanline_index += end_offset - start_offset;
+            start_offset = 0;
+        }
+    }
+
+    if (Mosaic() && lcd.MosaicBgH() > 1) {
+        // Each block of pixels repeats the first pixel of the block.
+        const int mosaic_h = lcd.MosaicBgH();
+        for (int i = 0; i < Lcd::h_pixels; ++i) {
+            if (i % mosaic_h != 0) {
+                scanline[i] = scanline[i - i % mosaic_h];
             }
+        }
+    }
+}
 
-            scanline_index += 1;
+void Bg::DrawFromMapCache() {
+    if (map_pixels.empty()) {
+        map_pixels.resize(map_pixels_wide * map_pixels_wide);
+        map_cells.resize(map_cells_wide * map_cells_wide);
+    }
+
+    if ((control & map_layout_mask) != map_layout) {
+        for (auto& cell : map_cells) {
+            cell.decoded = false;
+        }
+        map_row_generations.fill(unchecked_row);
+        map_layout = control & map_layout_mask;
+    }
+
+    const int map_width = (ScreenSize() & 0x1) ? 512 : 256;
+    const int map_height = (ScreenSize() & 0x2) ? 512 : 256;
+    const int map_y = (scroll_y + lcd.draw_line) % map_height;
+
+    // Rows are only checked again once something in VRAM has changed since they were last drawn.
+    const u64 vram_generation = lcd.VramGeneration();
+    if (map_row_generations[map_y / 8] != vram_generation) {
+        UpdateMapRow(map_y / 8, map_width / 8);
+        map_row_generations[map_y / 8] = vram_generation;
+    }
+
+    // The line wraps around to the left edge of the map at most once.
+    const u8* map_row = map_pixels.data() + map_y * map_pixels_wide;
+    const int start_x = scroll_x % map_width;
+    const int first_run = std::min(Lcd::h_pixels, map_width - start_x);
+    auto resolve = [this](const u8* indices, u16* dest, int count) {
+        for (int i = 0; i < count; ++i) {
+            dest[i] = (indices[i] == 0) ? Lcd::alpha_bit : lcd.pram[indices[i]] & 0x7FFF;
+        }
+    };
+
+    resolve(map_row + start_x, scanline.data(), first_run);
+    resolve(map_row, scanline.data() + first_run, Lcd::h_pixels - first_run);
+}
+
+void Bg::UpdateMapRow(int cell_row, int cells_wide) {
+    const bool single_palette = SinglePalette();
+    const int tile_bytes = single_palette ? 64 : 32;
+
+    for (int cell_col = 0; cell_col < cells_wide; ++cell_col) {
+        // Maps wider or taller than 32 tiles are made of 32x32 screenblocks, laid out left to right, then down.
+        const int screenblock = (cell_row / 32) * (cells_wide / 32) + cell_col / 32;
+        const int map_addr = MapBase() + 0x800 * screenblock + (cell_row % 32) * 64 + (cell_col % 32) * 2;
+        const u16 entry = lcd.vram[map_addr / 2];
+        const BgTile tile{entry, TileBase(), tile_bytes};
+        const u32 tile_generation = lcd.TileGeneration(tile.tile_addr, single_palette);
+
+        auto& cell = map_cells[cell_row * map_cells_wide + cell_col];
+        if (cell.decoded && cell.entry == entry && cell.tile_generation == tile_generation) {
+            continue;
+        }
+        cell = MapCell{entry, tile_generation, true};
+
+        u8* dest = map_pixels.data() + cell_row * 8 * map_pixels_wide + cell_col * 8;
+        for (int row = 0; row < 8; ++row, dest += map_pixels_wide) {
+            const u8* indices = lcd.TileRowIndices(tile.tile_addr, single_palette, tile.v_flip ? 7 - row : row);
+            for (int i = 0; i < 8; ++i) {
+                // 4bpp indices are moved into their palette bank here, so drawing needs one PRAM lookup per pixel.
+                const u8 index = indices[tile.h_flip ? 7 - i : i];
+                dest[i] = (index == 0 || single_palette) ? index : tile.palette * 16 + index;
+            }
         }
-        start_offset = 0;
     }
 }
 
 void Bg::DrawAffineScanline() {
     // Affine parameters.
     const int pa = SignExtend<u32>(affine_a, 16);
-    const int pb = SignExtend<u32>(affine_b, 16);
     const int pc = SignExtend<u32>(affine_c, 16);
-    const int pd = SignExtend<u32>(affine_d, 16);
 
     const int bg_tile_width = 16 << ScreenSize();
     const int bg_pixel_width = bg_tile_width * 8;
 
-    int scanline_index = 0;
-    while (scanline_index < Lcd::h_pixels) {
-        int tex_x = (pa * scanline_index + ref_point_x) >> 8;
-        int tex_y = (pc * scanline_index + ref_point_y) >> 8;
-
-        if (tex_x >= bg_pixel_width || tex_x < 0 || tex_y >= bg_pixel_width || tex_y < 0) {
-            if (WrapAround()) {
-                tex_x %= bg_pixel_width;
-                tex_y %= bg_pixel_width;
-
-                if (tex_x < 0) {
-                    tex_x += bg_pixel_width;
-                }
-                if (tex_y < 0) {
-                    tex_y += bg_pixel_width;
-                }
-            } else {
+    // Affine backgrounds can only use single-palette mode.
+    constexpr int tile_bytes = 64;
+
+    AffineTexels texels{ref_point_x, ref_point_y, pa, pc};
+    for (int scanline_index = 0; scanline_index < Lcd::h_pixels; scanline_index += AffineTexels::lanes) {
+        texels.Next(0, 0, bg_pixel_width, bg_pixel_width, WrapAround());
+
+        for (int i = 0; i < AffineTexels::lanes; ++i) {
+            if (!texels.in_bounds[i]) {
                 // Out-of-bounds texels are transparent.
-                scanline[scanline_index++] = Lcd::alpha_bit;
+                scanline[scanline_index + i] = Lcd::alpha_bit;
                 continue;
             }
-        }
 
-        const int tile_row = tex_y / 8;
-        const int tile_index = tile_row * bg_tile_width + tex_x / 8;
+            const int tex_x = texels.tex_x[i];
+            const int tex_y = texels.tex_y[i];
 
-        const int map_addr = MapBase() + tile_index;
-        int hi_shift = 8 * (map_addr & 0x1);
+            const int map_addr = MapBase() + (tex_y / 8) * bg_tile_width + tex_x / 8;
+            const u8 tile_num = (lcd.vram[map_addr / 2] >> (8 * (map_addr & 0x1))) & 0xFF;
 
-        const u8 tile_num = (lcd.vram[map_addr / 2] >> hi_shift) & 0xFF;
-
-        // Affine backgrounds can only use single-palette mode.
-        constexpr int tile_bytes = 64;
-        const int tile_addr = TileBase() + tile_num * tile_bytes;
-
-        const int pixel_row = tex_y % 8;
-        const int pixel_addr = tile_addr + pixel_row * 8 + tex_x % 8;
-        hi_shift = 8 * (pixel_addr & 0x1);
-
-        const u8 palette_entry = (lcd.vram[pixel_addr / 2] >> hi_shift) & 0xFF;
-        if (palette_entry == 0) {
-            // Palette entry 0 is transparent.
-            scanline[scanline_index] = Lcd::alpha_bit;
-        } else {
-            scanline[scanline_index] = lcd.pram[palette_entry] & 0x7FFF;
+            const int pixel_addr = TileBase() + tile_num * tile_bytes + (tex_y % 8) * 8 + tex_x % 8;
+            const u8 palette_entry = (lcd.vram[pixel_addr / 2] >> (8 * (pixel_addr & 0x1))) & 0xFF;
+            if (palette_entry == 0) {
+                // Palette entry 0 is transparent.
+                scanline[scanline_index + i] = Lcd::alpha_bit;
+            } else {
+                scanline[scanline_index + i] = lcd.pram[palette_entry] & 0x7FFF;
+            }
         }
-
-        scanline_index += 1;
     }
 
-    ref_point_x += pb;
-    ref_point_y += pd;
+    AdvanceReferencePoints();
 }
 
 void Bg::DrawBitmapScanline(int bg_mode, int base_addr) {
     // Affine parameters.
     const int pa = SignExtend<u32>(affine_a, 16);
-    const int pb = SignExtend<u32>(affine_b, 16);
     const int pc = SignExtend<u32>(affine_c, 16);
-    const int pd = SignExtend<u32>(affine_d, 16);
 
     int scanline_index = 0;
     while (scanline_index < Lcd::h_pixels) {
@@ -224,8 +295,49 @@ void Bg::DrawBitmapScanline(int bg_mode, int base_addr) {
         }
     }
 
-    ref_point_x += pb;
-    ref_point_y += pd;
+    AdvanceReferencePoints();
+}
+
+bool Bg::DrawDirectBitmapScanline(u16* line, int bg_mode, int base_addr) {
+    const int pa = SignExtend<u32>(affine_a, 16);
+    const int pc = SignExtend<u32>(affine_c, 16);
+
+    // Each screen pixel maps to the next texel in the same row only if the matrix is the identity in x, and the
+    // row starts at the left edge of the bitmap.
+    const int tex_y = ref_point_y >> 8;
+    const int bitmap_height = (bg_mode == 5) ? 128 : Lcd::v_pixels;
+    if (pa != 0x100 || pc != 0 || (ref_point_x >> 8) != 0 || tex_y < 0 || tex_y >= bitmap_height) {
+        return false;
+    }
+
+    if (bg_mode == 3) {
+        const u16* row = lcd.vram.data() + tex_y * Lcd::h_pixels;
+        for (int i = 0; i < Lcd::h_pixels; ++i) {
+            line[i] = row[i] & 0x7FFF;
+        }
+    } else if (bg_mode == 4) {
+        // Palette entry 0 is transparent, which shows the backdrop, and the backdrop is palette entry 0 anyway.
+        const u8* row = reinterpret_cast<const u8*>(lcd.vram.data()) + base_addr + tex_y * Lcd::h_pixels;
+        for (int i = 0; i < Lcd::h_pixels; ++i) {
+            line[i] = lcd.pram[row[i]] & 0x7FFF;
+        }
+    } else {
+        // Mode 5 bitmaps are only 160 pixels wide, and the backdrop shows to the right of them.
+        constexpr int bitmap_width = 160;
+        const u16* row = lcd.vram.data() + base_addr + tex_y * bitmap_width;
+        for (int i = 0; i < bitmap_width; ++i) {
+            line[i] = row[i] & 0x7FFF;
+        }
+        std::fill(line + bitmap_width, line + Lcd::h_pixels, lcd.pram[0] & 0x7FFF);
+    }
+
+    AdvanceReferencePoints();
+    return true;
+}
+
+void Bg::AdvanceReferencePoints() {
+    ref_point_x += SignExtend<u32>(affine_b, 16);
+    ref_point_y += SignExtend<u32>(affine_d, 16);
 }
 
 } // End namespace Gba
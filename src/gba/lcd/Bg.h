@@ -21,6 +21,7 @@
 
 #include "common/CommonTypes.h"
 #include "common/CommonFuncs.h"
+#include "common/MemoryReport.h"
 #include "gba/memory/IOReg.h"
 #include "gba/memory/MemDefs.h"
 
@@ -29,16 +30,17 @@ namespace Gba {
 class Lcd;
 
 struct BgTile {
+    BgTile() = default;
     BgTile(u16 map_entry, int tile_base, int tile_bytes)
             : tile_addr(tile_base + (map_entry & 0x3FF) * tile_bytes)
             , h_flip(map_entry & 0x400)
             , v_flip(map_entry & 0x800)
             , palette(map_entry >> 12) {}
 
-    int tile_addr;
-    bool h_flip;
-    bool v_flip;
-    u16 palette;
+    int tile_addr = 0;
+    bool h_flip = false;
+    bool v_flip = false;
+    u16 palette = 0;
 };
 
 class Bg {
@@ -79,23 +81,58 @@ public:
     void DrawRegularScanline();
     void DrawAffineScanline();
     void DrawBitmapScanline(int bg_mode, int base_addr);
+    // Writes an untransformed bitmap row straight to the screen line, or returns false if the row is rotated,
+    // scaled or shifted.
+    bool DrawDirectBitmapScanline(u16* line, int bg_mode, int base_addr);
+    // The reference points move down by one line after every affine or bitmap scanline, drawn or not.
+    void AdvanceReferencePoints();
 
     void LatchReferencePointX() { ref_point_x = SignExtend((static_cast<u32>(offset_x_h) << 16) | offset_x_l, 28); }
     void LatchReferencePointY() { ref_point_y = SignExtend((static_cast<u32>(offset_y_h) << 16) | offset_y_l, 28); }
 
     bool Enabled() const;
+    s32 RefPointX() const { return ref_point_x; }
+    s32 RefPointY() const { return ref_point_y; }
     int Priority() const { return control & 0x3; }
+    bool Mosaic() const { return control & 0x40; }
     bool SinglePalette() const { return control & 0x80; }
 
     void DumpBg() const;
 
+    void ReportMemory(Common::MemoryReport& report) const;
+
+    void SerializeState(Common::State& state);
+
 private:
     const Lcd& lcd;
 
-    std::vector<BgTile> tiles;
-
-    s32 ref_point_x;
-    s32 ref_point_y;
+    // The map entries for the current tile row, which is up to 64 tiles wide.
+    std::array<BgTile, 64> tiles;
+
+    s32 ref_point_x = 0;
+    s32 ref_point_y = 0;
+
+    // With the line cache enabled, the whole map is kept decoded to PRAM indices (0 for transparent), up to
+    // 512x512 pixels, so a line is a wrapped copy of one map row. Each cell remembers the map entry and tile write
+    // count it was decoded from, and each row of cells is checked against them again after any VRAM write.
+    struct MapCell {
+        u16 entry = 0;
+        u32 tile_generation = 0;
+        bool decoded = false;
+    };
+
+    static constexpr int map_pixels_wide = 512;
+    static constexpr int map_cells_wide = map_pixels_wide / 8;
+    static constexpr u64 unchecked_row = ~0ull;
+    std::vector<u8> map_pixels;
+    std::vector<MapCell> map_cells;
+    std::array<u64, map_cells_wide> map_row_generations;
+    // The control bits that change what every cell decodes to: the tile base, palette mode, map base and size.
+    static constexpr u16 map_layout_mask = 0xDF8C;
+    int map_layout = -1;
+
+    void DrawFromMapCache();
+    void UpdateMapRow(int cell_row, int cells_wide);
 
     void ReadTileMapRow();
 
@@ -105,7 +142,6 @@ private:
 
     // Control flags
     int TileBase() const { return ((control >> 2) & 0x3) * 16 * kbyte; }
-    bool Mosaic() const { return control & 0x40; }
     int MapBase() const { return ((control >> 8) & 0x1F) * 2 * kbyte; }
     bool WrapAround() const { return control & 0x2000; }
 
@@ -23,7 +23,10 @@
 
 namespace Gba {
 
-void Lcd::DumpDebugInfo() const {
+void Lcd::DumpDebugInfo() {
+    // The render thread may still be using the tile cache.
+    SyncRender();
+
     for (const Bg& bg : bgs) {
         bg.DumpBg();
     }
@@ -44,6 +47,9 @@ void Lcd::DumpSprites() const {
     std::vector<u16> sprite_buffer;
     for (std::size_t s = 0; s < sprites.size(); ++s) {
         const auto& sprite = sprites[s];
+        if (sprite_first_line[s] == sprite_end_line[s]) {
+            continue;
+        }
 
         sprite_buffer.resize(sprite.pixel_width * sprite.pixel_height);
 
@@ -70,7 +76,7 @@ void Lcd::DumpSprites() const {
                 int tile_addr = sprite.tile_base_addr + tile_index * sprite.tile_bytes;
                 if (ObjMapping2D()) {
                     const int h = tile_index / sprite.tile_width;
-                    tile_addr += h * sprite.tile_bytes * ((sprite.single_palette ? 16 : 32) - sprite.tile_width);
+                    tile_addr += h * sprite.row_stride_2d;
                 }
                 tile_index += tile_direction;
 
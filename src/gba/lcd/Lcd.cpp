@@ -16,25 +16,102 @@
 
 #include <algorithm>
 #include <stdexcept>
+#include <utility>
 
 #include "gba/lcd/Lcd.h"
 #include "gba/lcd/Bg.h"
+#include "gba/lcd/AffineTexels.h"
 #include "gba/core/Core.h"
 #include "gba/memory/Memory.h"
 #include "gba/hardware/Dma.h"
+#include "common/Simd.h"
+#include "common/Tracer.h"
 
 namespace Gba {
 
-Lcd::Lcd(const std::vector<u16>& _pram, const std::vector<u16>& _vram, const std::vector<u32>& _oam, Core& _core)
+namespace {
+
+// The scanline compositor works on eight pixels at a time, one in each 16-bit lane of a vector.
+using Lanes = Common::Simd::U16x8;
+constexpr int lane_pixels = 8;
+
+Lanes LaneMask(bool condition) { return Lanes::Splat(condition ? 0xFFFF : 0x0000); }
+
+Lanes LayerBitSet(Lanes layer_masks, Lanes bit) { return (layer_masks & bit) == bit; }
+
+// Extracts one 5-bit colour channel from each BGR555 pixel.
+Lanes ExtractChannel(Lanes pixels, int channel) { return ShiftRight(pixels, channel * 5) & Lanes::Splat(0x1F); }
+
+Lanes PlaceChannel(Lanes channels, int channel) { return ShiftLeft(channels, channel * 5); }
+
+// The coefficients are in 1/16ths, and already clamped to 16.
+Lanes BlendLanes(Lanes pixels1, Lanes pixels2, Lanes first_alpha, Lanes second_alpha) {
+    Lanes result = Lanes::Zero();
+    for (int c = 0; c < 3; ++c) {
+        const Lanes blended = ExtractChannel(pixels1, c) * first_alpha + ExtractChannel(pixels2, c) * second_alpha;
+        const Lanes saturated = Min(ShiftRight(blended, 4), Lanes::Splat(31));
+        result = result | PlaceChannel(saturated, c);
+    }
+
+    return result;
+}
+
+Lanes BrightenLanes(Lanes pixels, Lanes intensity) {
+    Lanes result = Lanes::Zero();
+    for (int c = 0; c < 3; ++c) {
+        const Lanes channel = ExtractChannel(pixels, c);
+        const Lanes increase = ShiftRight((Lanes::Splat(31) - channel) * intensity, 4);
+        result = result | PlaceChannel(channel + increase, c);
+    }
+
+    return result;
+}
+
+Lanes DarkenLanes(Lanes pixels, Lanes intensity) {
+    const Lanes scale = Lanes::Splat(16) - intensity;
+    Lanes result = Lanes::Zero();
+    for (int c = 0; c < 3; ++c) {
+        const Lanes darkened = ShiftRight(ExtractChannel(pixels, c) * scale, 4);
+        result = result | PlaceChannel(darkened, c);
+    }
+
+    return result;
+}
+
+} // End anonymous namespace
+
+Lcd::Lcd(const GuestRam& ram, Core& _core, bool threaded, bool _line_cache)
         : bgs{{0, *this}, {1, *this}, {2, *this}, {3, *this}}
-        , pram(_pram)
-        , vram(_vram)
-        , oam(_oam)
+        , pram(ram.pram)
+        , vram(ram.vram)
+        , oam(ram.oam)
         , core(_core)
-        , back_buffer(h_pixels * v_pixels, 0x7FFF) {}
+        , back_buffer(h_pixels * v_pixels, 0x7FFF)
+        , back_frame(back_buffer.data())
+        , tiles_4bpp(tile_blocks)
+        , tiles_8bpp(tile_blocks)
+        , sprites(num_sprites, Sprite{0, 0})
+        , line_cache(_line_cache) {
+
+    tile_dirty_4bpp.fill(true);
+    tile_dirty_8bpp.fill(true);
+    sprite_dirty.fill(true);
+
+    if (threaded) {
+        render_thread = std::thread{&Lcd::RenderLoop, this};
+    }
+}
 
-// Needed to declare std::vector with forward-declared type in the header file.
-Lcd::~Lcd() = default;
+Lcd::~Lcd() {
+    if (render_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock{render_mutex};
+            quit_render = true;
+        }
+        render_cv.notify_one();
+        render_thread.join();
+    }
+}
 
 void Lcd::Update(int cycles) {
     int updated_cycles = scanline_cycles + cycles;
@@ -47,11 +124,30 @@ void Lcd::Update(int cycles) {
 
         // Trigger the HBlank and Video Capture DMAs, if any are pending.
         if (vcount < 160) {
-            DrawScanline();
+            if (core.tracer != nullptr) {
+                core.tracer->Begin(Common::Tracer::Lcd, "scanline", core.scheduler.Timestamp());
+            }
+
+            if (skip_frame) {
+                SkipScanline();
+            } else if (render_thread.joinable()) {
+                core.counters.Add(Common::PerfCounters::Scanlines);
+                QueueScanline();
+            } else {
+                core.counters.Add(Common::PerfCounters::Scanlines);
+                draw_line = vcount;
+                DrawScanline();
+            }
+
+            if (core.tracer != nullptr) {
+                core.tracer->End(Common::Tracer::Lcd, "scanline", core.scheduler.Timestamp());
+            }
 
             for (auto& dma : core.dma) {
                 dma.Trigger(Dma::Timing::HBlank);
             }
+
+            core.hooks.HBlankStarted(vcount);
         }
 
         if (vcount > 1 && vcount < 162) {
@@ -68,7 +164,8 @@ void Lcd::Update(int cycles) {
         status &= ~hblank_flag;
 
         if (++vcount == 160) {
-            // Begin vblank.
+            // Begin vblank. The whole frame has to be drawn before the buffers are swapped.
+            SyncRender();
             status |= vblank_flag;
 
             if (VBlankIrqEnabled()) {
@@ -84,7 +181,13 @@ void Lcd::Update(int cycles) {
                 bgs[b].LatchReferencePointY();
             }
 
-            core.SwapBuffers(back_buffer);
+            // The front buffer keeps the last drawn frame if this one was skipped.
+            if (!skip_frame) {
+                back_frame = core.SwapBuffers(back_frame, back_buffer);
+                back_signatures.swap(front_signatures);
+            }
+            skip_frame = core.SkipNextFrame();
+            core.hooks.VBlankStarted();
         } else if (vcount == 227) {
             // Vblank flag is unset one scanline before vblank ends.
             status &= ~vblank_flag;
@@ -102,11 +205,65 @@ void Lcd::Update(int cycles) {
         } else {
             status &= ~vcount_flag;
         }
+
+        core.hooks.LineStarted(vcount);
     }
 
     scanline_cycles = updated_cycles;
 }
 
+void Lcd::QueueScanline() {
+    {
+        std::lock_guard<std::mutex> lock{render_mutex};
+        // Queued scanlines are always consecutive, since the queue is drained before anything else can happen.
+        if (queued_lines.load(std::memory_order_relaxed) == 0) {
+            next_render_line = vcount;
+        }
+        queued_lines.fetch_add(1, std::memory_order_relaxed);
+    }
+    render_cv.notify_one();
+}
+
+void Lcd::RenderLoop() {
+    std::unique_lock<std::mutex> lock{render_mutex};
+    while (true) {
+        render_cv.wait(lock, [this] { return quit_render || queued_lines.load(std::memory_order_relaxed) != 0; });
+        if (quit_render) {
+            return;
+        }
+
+        draw_line = next_render_line;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            DrawScanline();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if (error && !render_error) {
+            render_error = error;
+        }
+
+        ++next_render_line;
+        if (queued_lines.fetch_sub(1, std::memory_order_release) == 1) {
+            render_done_cv.notify_all();
+        }
+    }
+}
+
+void Lcd::WaitForRender() {
+    std::unique_lock<std::mutex> lock{render_mutex};
+    render_done_cv.wait(lock, [this] { return queued_lines.load(std::memory_order_relaxed) == 0; });
+
+    // Errors from the render thread are rethrown on the emulator thread.
+    if (render_error) {
+        std::rethrow_exception(std::exchange(render_error, nullptr));
+    }
+}
+
 void Lcd::WriteControl(const u16 data, const u16 mask) {
     const std::array<bool, 4> was_disabled{{!bgs[0].Enabled(), !bgs[1].Enabled(),
                                             !bgs[2].Enabled(), !bgs[3].Enabled()}};
@@ -123,6 +280,17 @@ void Lcd::WriteControl(const u16 data, const u16 mask) {
     }
 }
 
+void Lcd::WriteBlendAlpha(const u16 data, const u16 mask) {
+    blend_alpha.Write(data, mask);
+    first_alpha = FirstAlpha();
+    second_alpha = SecondAlpha();
+}
+
+void Lcd::WriteBlendFade(const u16 data, const u16 mask) {
+    blend_fade.Write(data, mask);
+    intensity = Intensity();
+}
+
 int Lcd::NextEvent() const {
     if (scanline_cycles < 960) {
         return 960 - scanline_cycles;
@@ -134,9 +302,25 @@ int Lcd::NextEvent() const {
 }
 
 void Lcd::DrawScanline() {
+    const auto bench_timer = core.bench.Time(Common::BenchStats::Lcd);
+
+    if (line_cache) {
+        // Lines under vertical mosaic are always drawn, and get no signature so they're never reused either.
+        const u64 signature = BgVerticalMosaic() ? 0 : LineSignature();
+        if (signature != 0 && signature == back_signatures[draw_line]) {
+            // The back buffer already holds this line, but the state carried between scanlines still advances.
+            ++lines_reused;
+            SkipScanline();
+            return;
+        }
+
+        back_signatures[draw_line] = signature;
+        ++lines_drawn;
+    }
+
     if (ForcedBlank()) {
         // Scanlines are drawn white when forced blank is enabled.
-        std::fill_n(back_buffer.begin() + vcount * h_pixels, h_pixels, 0x7FFF);
+        std::fill_n(back_frame + draw_line * h_pixels, h_pixels, 0x7FFF);
         return;
     }
 
@@ -153,126 +337,253 @@ void Lcd::DrawScanline() {
         bg_dirty = false;
     }
 
+    u16* const line = back_frame + draw_line * h_pixels;
+
+    // With only BG2 visible in a bitmap mode and no effects, the bitmap goes straight into the back buffer.
+    const bool plain_bitmap = BgMode() >= 3 && BgMode() <= 5 && bgs[2].Enabled() && NoWinEnabled()
+                              && BlendMode() == Effect::None && (!ObjEnabled() || num_drawn_sprites == 0);
+    if (plain_bitmap && bgs[2].DrawDirectBitmapScanline(line, BgMode(), DisplayFrame1() ? 0xA000 : 0)) {
+        TickEnableDelays();
+        return;
+    }
+
     const auto priorities{DrawBackgrounds()};
 
     // The first palette entry is the backdrop colour.
-    std::fill_n(back_buffer.begin() + vcount * h_pixels, h_pixels, pram[0] & 0x7FFF);
-    std::array<PixelInfo, 240> pixel_info{};
+    std::fill_n(line, h_pixels, pram[0] & 0x7FFF);
+
+    UpdateWindowLayers();
+
+    // The scanline is composited eight pixels at a time, with one pixel in each 16-bit lane. Per-pixel conditions
+    // are kept as lane masks, which are 0xFFFF where the condition holds and 0 where it doesn't.
+    const Lanes blend_window_bit = Lanes::Splat(blend_window_layer);
+
+    const Lanes zero = Lanes::Zero();
+    const Lanes alpha_bits = Lanes::Splat(alpha_bit);
 
     // If alpha blending is enabled, or if semi-transparent sprites are present, calculate the highest first target
-    // layer and second target layer for each pixel.
+    // layer for each pixel. Layer 5 is the backdrop.
+    alignas(16) std::array<u16, h_pixels> highest_first_targets;
+    highest_first_targets.fill(5);
+
+    // Sprite pixels only belong to the priority level they're drawn at.
+    auto sprite_pixels = [&](int i, int priority) {
+        const Lanes at_priority = Lanes::Load(sprite_priorities.data() + i) == Lanes::Splat(priority);
+        return Lanes::Load(sprite_line.data() + i) | AndNot(at_priority, alpha_bits);
+    };
+
+    auto find_first_targets = [&](const u16* layer_pixels, int layer_id, int sprite_priority) {
+        const bool sprite = sprite_priority >= 0;
+        const Lanes layer_vec = Lanes::Splat(layer_id);
+        const Lanes first_target = LaneMask(IsFirstTarget(layer_id));
+
+        for (int i = 0; i < h_pixels; i += lane_pixels) {
+            const Lanes layer_pixel = sprite ? sprite_pixels(i, sprite_priority) : Lanes::Load(layer_pixels + i);
+            const Lanes opaque = (layer_pixel & alpha_bits) == zero;
+            Lanes is_first_target = first_target;
+            if (sprite) {
+                is_first_target = is_first_target | Lanes::Load(semi_transparent_masks.data() + i);
+            }
+
+            const Lanes highest = Lanes::Load(highest_first_targets.data() + i);
+            Select(opaque & is_first_target, layer_vec, highest).Store(highest_first_targets.data() + i);
+        }
+    };
+
     if (BlendMode() == Effect::AlphaBlend || semi_transparent_used) {
         // Inspect each enabled background, starting with the lowest priority level.
         for (int p = 3; p >= 0; --p) {
             for (const auto& bg : priorities[p]) {
-                for (int i = 0; i < h_pixels; ++i) {
-                    if ((bg->scanline[i] & alpha_bit) == 0 && IsFirstTarget(bg->id)) {
-                        pixel_info[i].highest_first_target = bg->id;
-                    }
-                }
+                find_first_targets(bg->scanline.data(), bg->id, -1);
             }
 
-            if (ObjEnabled() && sprite_scanline_used[p]) {
-                // There is only one sprite layer, even though each sprite can have varying priorities. When
-                // calculating blending effects, the GBA only considers the highest priority sprite on each pixel.
-                for (int i = 0; i < h_pixels; ++i) {
-                    if ((sprite_scanlines[p][i] & alpha_bit) == 0
-                            && (IsFirstTarget(4) || (sprite_flags[i] & semi_transparent_flag))) {
-                        pixel_info[i].highest_first_target = 4;
-                    }
-                }
+            if (ObjEnabled() && sprite_priority_used[p]) {
+                find_first_targets(sprite_line.data(), 4, p);
             }
         }
     }
 
-    for (int w = 0; w < 2; ++w) {
-        windows[w].IsOnThisScanline(WinEnabled(w), vcount);
-    }
+    // Whether the last layer drawn on each pixel is a first target, a second target, or the sprite layer.
+    alignas(16) std::array<u16, h_pixels> last_first_targets;
+    alignas(16) std::array<u16, h_pixels> last_second_targets;
+    alignas(16) std::array<u16, h_pixels> last_sprites;
+    last_first_targets.fill(IsFirstTarget(5) ? 0xFFFF : 0x0000);
+    last_second_targets.fill(IsSecondTarget(5) ? 0xFFFF : 0x0000);
+    last_sprites.fill(0x0000);
+
+    const Lanes alpha_blend = LaneMask(BlendMode() == Effect::AlphaBlend);
+    const Lanes first_alpha_vec = Lanes::Splat(first_alpha);
+    const Lanes second_alpha_vec = Lanes::Splat(second_alpha);
+
+    auto draw_layer = [&](const u16* layer_pixels, int layer_id, int sprite_priority) {
+        const bool sprite = sprite_priority >= 0;
+        const Lanes layer_vec = Lanes::Splat(layer_id);
+        const Lanes first_target = LaneMask(IsFirstTarget(layer_id));
+        const Lanes second_target = LaneMask(IsSecondTarget(layer_id));
+        const Lanes sprite_layer = LaneMask(sprite);
+        const Lanes window_bit = Lanes::Splat(1 << layer_id);
+
+        for (int i = 0; i < h_pixels; i += lane_pixels) {
+            const Lanes layer_pixel = sprite ? sprite_pixels(i, sprite_priority) : Lanes::Load(layer_pixels + i);
+            const Lanes buffer_pixel = Lanes::Load(line + i);
+            const Lanes semi_transparent = Lanes::Load(semi_transparent_masks.data() + i);
+            const Lanes window_layers = Lanes::Load(window_layer_masks.data() + i);
+
+            const Lanes drawn = ((layer_pixel & alpha_bits) == zero) & LayerBitSet(window_layers, window_bit);
+
+            Lanes blends = sprite ? (alpha_blend | semi_transparent) : alpha_blend;
+            blends = blends & drawn;
+            blends = blends & (Lanes::Load(highest_first_targets.data() + i) == layer_vec);
+            blends = blends & Lanes::Load(last_second_targets.data() + i);
+            blends = blends & LayerBitSet(window_layers, blend_window_bit);
+
+            const Lanes blended = BlendLanes(layer_pixel, buffer_pixel, first_alpha_vec, second_alpha_vec);
+            Select(blends, blended, Select(drawn, layer_pixel, buffer_pixel)).Store(line + i);
+
+            if (sprite) {
+                // If a semi-transparent sprite blends, no other blending effects can occur on this pixel. So if a
+                // sprite pixel doesn't blend, we remove the semi-transparent flag (if present) so fade effects can
+                // be applied later.
+                AndNot(AndNot(blends, drawn), semi_transparent).Store(semi_transparent_masks.data() + i);
+            }
+
+            Select(drawn, first_target, Lanes::Load(last_first_targets.data() + i))
+                .Store(last_first_targets.data() + i);
+            Select(drawn, second_target, Lanes::Load(last_second_targets.data() + i))
+                .Store(last_second_targets.data() + i);
+            Select(drawn, sprite_layer, Lanes::Load(last_sprites.data() + i)).Store(last_sprites.data() + i);
+        }
+    };
 
     // Draw the scanlines from each enabled background, starting with the lowest priority level.
-    std::array<int, 3> channels;
     for (int p = 3; p >= 0; --p) {
         for (const auto& bg : priorities[p]) {
-            for (int i = 0; i < h_pixels; ++i) {
-                if ((bg->scanline[i] & alpha_bit) == 0 && IsWithinWindow(bg->id, i)) {
-                    auto& buffer_pixel = back_buffer[vcount * h_pixels + i];
+            draw_layer(bg->scanline.data(), bg->id, -1);
+        }
 
-                    if (BlendMode() == Effect::AlphaBlend
-                            && pixel_info[i].highest_first_target == bg->id
-                            && IsSecondTarget(pixel_info[i].last_layer)
-                            && IsWithinWindow(5, i)) {
-                        for (int j = 0; j < 3; ++j) {
-                            int channel_target1 = (bg->scanline[i] >> (5 * j)) & 0x1F;
-                            int channel_target2 = (buffer_pixel >> (5 * j)) & 0x1F;
+        if (ObjEnabled() && sprite_priority_used[p]) {
+            // Draw sprites of the same priority level.
+            draw_layer(sprite_line.data(), 4, p);
+        }
+    }
 
-                            channels[j] = Blend(channel_target1, channel_target2);
-                        }
+    if (BlendMode() == Effect::Brighten || BlendMode() == Effect::Darken) {
+        const Lanes intensity_vec = Lanes::Splat(intensity);
+
+        for (int i = 0; i < h_pixels; i += lane_pixels) {
+            const Lanes sprite_blended = Lanes::Load(last_sprites.data() + i)
+                                         & Lanes::Load(semi_transparent_masks.data() + i);
+            const Lanes last_first_target = Lanes::Load(last_first_targets.data() + i);
+            const Lanes fades = AndNot(sprite_blended, last_first_target)
+                                & LayerBitSet(Lanes::Load(window_layer_masks.data() + i), blend_window_bit);
+
+            const Lanes buffer_pixel = Lanes::Load(line + i);
+            const Lanes faded = (BlendMode() == Effect::Brighten) ? BrightenLanes(buffer_pixel, intensity_vec)
+                                                                   : DarkenLanes(buffer_pixel, intensity_vec);
+            Select(fades, faded, buffer_pixel).Store(line + i);
+        }
+    }
 
-                        buffer_pixel = (channels[2] << 10) | (channels[1] << 5) | channels[0];
-                    } else {
-                        buffer_pixel = bg->scanline[i];
-                    }
+    TickEnableDelays();
+}
 
-                    pixel_info[i].last_layer = bg->id;
-                }
+void Lcd::SkipScanline() {
+    if (ForcedBlank()) {
+        return;
+    }
+
+    // No pixels are generated, but the state that DrawScanline carries between scanlines still has to advance.
+    switch (BgMode()) {
+    case 1:
+    case 3:
+    case 4:
+    case 5:
+        if (bgs[2].Enabled()) {
+            bgs[2].AdvanceReferencePoints();
+        }
+        break;
+    case 2:
+        for (int b = 2; b < 4; ++b) {
+            if (bgs[b].Enabled()) {
+                bgs[b].AdvanceReferencePoints();
             }
         }
+        break;
+    default:
+        break;
+    }
 
-        if (ObjEnabled() && sprite_scanline_used[p]) {
-            // Draw sprites of the same priority level.
-            for (int i = 0; i < h_pixels; ++i) {
-                if ((sprite_scanlines[p][i] & alpha_bit) == 0 && IsWithinWindow(4, i)) {
-                    auto& buffer_pixel = back_buffer[vcount * h_pixels + i];
-
-                    if ((BlendMode() == Effect::AlphaBlend || (sprite_flags[i] & semi_transparent_flag))
-                            && pixel_info[i].highest_first_target == 4
-                            && IsSecondTarget(pixel_info[i].last_layer)
-                            && IsWithinWindow(5, i)) {
-                        for (int j = 0; j < 3; ++j) {
-                            int channel_target1 = (sprite_scanlines[p][i] >> (5 * j)) & 0x1F;
-                            int channel_target2 = (buffer_pixel >> (5 * j)) & 0x1F;
+    TickEnableDelays();
+}
 
-                            channels[j] = Blend(channel_target1, channel_target2);
-                        }
+u64 Lcd::LineSignature() const {
+    // FNV-1a, one word at a time.
+    u64 hash = 0xCBF2'9CE4'8422'2325;
+    const auto mix = [&hash](u64 value) {
+        hash ^= value;
+        hash *= 0x100'0000'01B3;
+    };
+
+    mix(control);
+    mix(winin);
+    mix(winout);
+    for (const auto& window : windows) {
+        mix(window.width);
+        mix(window.height);
+    }
+    mix(mosaic);
+    mix(blend_control);
+    mix(blend_alpha);
+    mix(blend_fade);
+
+    for (const auto& bg : bgs) {
+        mix(bg.Enabled());
+        mix(bg.control);
+        mix(bg.scroll_x);
+        mix(bg.scroll_y);
+        mix(bg.affine_a);
+        mix(bg.affine_b);
+        mix(bg.affine_c);
+        mix(bg.affine_d);
+        mix(static_cast<u32>(bg.RefPointX()));
+        mix(static_cast<u32>(bg.RefPointY()));
+    }
 
-                        buffer_pixel = (channels[2] << 10) | (channels[1] << 5) | channels[0];
-                    } else {
-                        buffer_pixel = sprite_scanlines[p][i];
+    mix(bg_vram_generation);
+    mix(bg_pram_generation);
 
-                        // If a semi-transparent sprite blends, no other blending effects can occur on this pixel.
-                        // So if a sprite pixel doesn't blend, we remove the semi-transparent flag (if present) so
-                        // fade effects can be applied later.
-                        sprite_flags[i] &= ~semi_transparent_flag;
-                    }
+    // Bitmaps extend into the lower half of the sprite VRAM.
+    if (BgMode() >= 3) {
+        mix(obj_vram_generation);
+    }
 
-                    pixel_info[i].last_layer = 4;
-                }
-            }
-        }
+    if (ObjEnabled()) {
+        mix(obj_vram_generation);
+        mix(obj_pram_generation);
+        mix(oam_generation);
     }
 
-    if (BlendMode() == Effect::Brighten || BlendMode() == Effect::Darken) {
-        for (int i = 0; i < h_pixels; ++i) {
-            if (IsFirstTarget(pixel_info[i].last_layer)
-                    && !(pixel_info[i].last_layer == 4 && (sprite_flags[i] & semi_transparent_flag))
-                    && IsWithinWindow(5, i)) {
-                auto& buffer_pixel = back_buffer[vcount * h_pixels + i];
+    return (hash == 0) ? 1 : hash;
+}
+
+bool Lcd::BgVerticalMosaic() const {
+    return MosaicBgV() > 1 && std::any_of(bgs.cbegin(), bgs.cend(), [](const Bg& bg) {
+        return bg.Enabled() && bg.Mosaic();
+    });
+}
 
-                if (BlendMode() == Effect::Brighten) {
-                    for (int j = 0; j < 3; ++j) {
-                        channels[j] = Brighten((buffer_pixel >> (5 * j)) & 0x1F);
-                    }
-                } else if (BlendMode() == Effect::Darken) {
-                    for (int j = 0; j < 3; ++j) {
-                        channels[j] = Darken((buffer_pixel >> (5 * j)) & 0x1F);
-                    }
-                }
+float Lcd::TakeLineReuseRatio() {
+    SyncRender();
 
-                buffer_pixel = (channels[2] << 10) | (channels[1] << 5) | channels[0];
-            }
-        }
-    }
+    const u32 total_lines = lines_drawn + lines_reused;
+    const float ratio = (total_lines == 0) ? 0.0f : static_cast<float>(lines_reused) / total_lines;
+    lines_drawn = 0;
+    lines_reused = 0;
 
+    return ratio;
+}
+
+void Lcd::TickEnableDelays() {
     for (auto& bg : bgs) {
         if (bg.enable_delay > 0) {
             bg.enable_delay -= 1;
@@ -351,38 +662,50 @@ std::array<std::vector<const Bg*>, 4> Lcd::DrawBackgrounds() {
     return priorities;
 }
 
-bool Lcd::IsWithinWindow(int layer_id, int x) const {
+void Lcd::UpdateWindowLayers() {
     if (NoWinEnabled()) {
-        return true;
+        window_layer_masks.fill(all_window_layers);
+        return;
     }
 
-    if (windows[0].Contains(x)) {
-        return winin & (1 << layer_id);
-    } else if (windows[1].Contains(x)) {
-        return (winin >> 8) & (1 << layer_id);
-    } else if (ObjWinEnabled() && (sprite_flags[x] & obj_window_flag)) {
-        return (winout >> 8) & (1 << layer_id);
-    } else {
-        return winout & (1 << layer_id);
+    // Each window overrides the ones below it, so fill them in from lowest to highest priority.
+    window_layer_masks.fill(winout & all_window_layers);
+
+    if (ObjWinEnabled()) {
+        const u16 obj_window_layers = (winout >> 8) & all_window_layers;
+        const Lanes obj_window_vec = Lanes::Splat(obj_window_layers);
+        for (int i = 0; i < h_pixels; i += lane_pixels) {
+            Select(Lanes::Load(obj_window_masks.data() + i), obj_window_vec,
+                   Lanes::Load(window_layer_masks.data() + i)).Store(window_layer_masks.data() + i);
+        }
+    }
+
+    for (int w = 1; w >= 0; --w) {
+        windows[w].IsOnThisScanline(WinEnabled(w), draw_line);
+        if (!windows[w].on_this_scanline) {
+            continue;
+        }
+
+        const u16 layers = (winin >> (8 * w)) & all_window_layers;
+        const int left = std::min(windows[w].Left(), h_pixels);
+        const int right = std::min(windows[w].Right(), h_pixels);
+        if (windows[w].Right() >= windows[w].Left()) {
+            std::fill(window_layer_masks.begin() + left, window_layer_masks.begin() + right, layers);
+        } else {
+            // The window wraps around the side of the screen.
+            std::fill(window_layer_masks.begin() + left, window_layer_masks.end(), layers);
+            std::fill(window_layer_masks.begin(), window_layer_masks.begin() + right, layers);
+        }
     }
 }
 
 void Lcd::ReadOam() {
-    // Only update our sprite objects if OAM has been written to.
+    // Only rebuild the sprites whose OAM entries have been written to.
     if (oam_dirty) {
-        sprites.clear();
-
-        // Get all enabled, potentially onscreen sprites.
-        for (std::size_t i = 0; i < oam.size(); i += 2) {
-            if (!Sprite::Disabled(oam[i])) {
-                int y_pos = oam[i] & 0xFF;
-                int pixel_height = Sprite::Height(oam[i]);
-                if (y_pos + pixel_height > 0xFF) {
-                    y_pos -= 0x100;
-                }
-                if (y_pos < 160) {
-                    sprites.emplace_back(oam[i], oam[i + 1]);
-                }
+        for (int s = 0; s < num_sprites; ++s) {
+            if (sprite_dirty[s]) {
+                IndexSprite(s);
+                sprite_dirty[s] = false;
             }
         }
 
@@ -393,9 +716,12 @@ void Lcd::ReadOam() {
     // to render. The maximum rendering time is reduced if HBlank Interval Free is set.
     const int max_render_cycles = HBlankFree() ? 954 : 1210;
     int render_cycles_needed = 0;
-    for (auto& sprite : sprites) {
-        sprite.drawn = false;
-        if (sprite.y_pos <= vcount && vcount < sprite.y_pos + sprite.pixel_height) {
+    num_drawn_sprites = 0;
+    for (std::size_t w = 0; w < line_sprites[draw_line].size(); ++w) {
+        for (u64 mask = line_sprites[draw_line][w]; mask != 0; mask &= mask - 1) {
+            const int s = w * 64 + __builtin_ctzll(mask);
+            const Sprite& sprite = sprites[s];
+
             // All sprites, including offscreen ones, contribute to rendering time.
             if (sprite.affine) {
                 render_cycles_needed += sprite.pixel_width * 2 + 10;
@@ -405,42 +731,65 @@ void Lcd::ReadOam() {
 
             // Don't draw any more sprites once we run out of rendering cycles.
             if (render_cycles_needed > max_render_cycles) {
-                continue;
+                return;
             }
 
             // Only onscreen sprites will actually be drawn.
             // In bitmap BG modes, attempts to use sprite tiles < 512 are not displayed.
             if (sprite.x_pos < h_pixels && sprite.x_pos + sprite.pixel_width >= 0
                     && (BgMode() < 3 || sprite.tile_num >= 512)) {
-                sprite.drawn = true;
+                drawn_sprites[num_drawn_sprites++] = s;
             }
         }
     }
 }
 
+void Lcd::IndexSprite(int s) {
+    const SpriteMask::value_type bit = 1ull << (s % 64);
+    const std::size_t word = s / 64;
+
+    for (int line = sprite_first_line[s]; line < sprite_end_line[s]; ++line) {
+        line_sprites[line][word] &= ~bit;
+    }
+
+    const u32 attr1 = oam[s * 2];
+    sprites[s] = Sprite{attr1, oam[s * 2 + 1]};
+
+    // Disabled sprites aren't on any scanline.
+    if (Sprite::Disabled(attr1)) {
+        sprite_first_line[s] = 0;
+        sprite_end_line[s] = 0;
+        return;
+    }
+
+    sprite_first_line[s] = std::clamp<int>(sprites[s].y_pos, 0, v_pixels);
+    sprite_end_line[s] = std::clamp<int>(sprites[s].y_pos + sprites[s].pixel_height, 0, v_pixels);
+
+    for (int line = sprite_first_line[s]; line < sprite_end_line[s]; ++line) {
+        line_sprites[line][word] |= bit;
+    }
+}
+
 void Lcd::DrawSprites() {
-    // Only clear used sprite scanlines.
-    for (int s = 0; s < 4; ++s) {
-        if (sprite_scanline_used[s]) {
-            std::fill(sprite_scanlines[s].begin(), sprite_scanlines[s].end(), 0x8000);
-            sprite_scanline_used[s] = false;
-        }
+    // Only clear the sprite line if the last one drew anything.
+    if (std::any_of(sprite_priority_used.cbegin(), sprite_priority_used.cend(), [](bool used) { return used; })) {
+        sprite_line.fill(alpha_bit);
+        sprite_priorities.fill(no_sprite_priority);
+        sprite_priority_used.fill(false);
     }
 
     if (semi_transparent_used || obj_window_used) {
-        std::fill(sprite_flags.begin(), sprite_flags.end(), 0);
+        semi_transparent_masks.fill(0x0000);
+        obj_window_masks.fill(0x0000);
         semi_transparent_used = false;
         obj_window_used = false;
     }
 
-    for (int s = sprites.size() - 1; s >= 0; --s) {
-        const auto& sprite = sprites[s];
-
-        if (!sprite.drawn) {
-            continue;
-        }
+    // Lower-numbered sprites are drawn on top of higher-numbered ones.
+    for (int i = num_drawn_sprites - 1; i >= 0; --i) {
+        const auto& sprite = sprites[drawn_sprites[i]];
 
-        sprite_scanline_used[sprite.priority] = true;
+        sprite_priority_used[sprite.priority] = true;
 
         if (sprite.affine) {
             DrawAffineSprite(sprite);
@@ -451,12 +800,12 @@ void Lcd::DrawSprites() {
 }
 
 void Lcd::DrawRegularSprite(const Sprite& sprite) {
-    int tile_row = (vcount - sprite.y_pos) / 8;
-    int pixel_row = (vcount - sprite.y_pos) % 8;
+    int tile_row = (draw_line - sprite.y_pos) / 8;
+    int pixel_row = (draw_line - sprite.y_pos) % 8;
 
-    if (sprite.mosaic && vcount % MosaicObjV() != 0) {
-        tile_row = (vcount - vcount % MosaicObjV() - sprite.y_pos) / 8;
-        pixel_row = (vcount - vcount % MosaicObjV() - sprite.y_pos) % 8;
+    if (sprite.mosaic && draw_line % MosaicObjV() != 0) {
+        tile_row = (draw_line - draw_line % MosaicObjV() - sprite.y_pos) / 8;
+        pixel_row = (draw_line - draw_line % MosaicObjV() - sprite.y_pos) % 8;
 
         if (tile_row < 0 || pixel_row < 0) {
             return;
@@ -495,7 +844,7 @@ void Lcd::DrawRegularSprite(const Sprite& sprite) {
         int tile_addr = sprite.tile_base_addr + tile_index * sprite.tile_bytes;
         if (ObjMapping2D()) {
             const int h = tile_index / sprite.tile_width;
-            tile_addr += h * sprite.tile_bytes * ((sprite.single_palette ? 16 : 32) - sprite.tile_width);
+            tile_addr += h * sprite.row_stride_2d;
         }
         tile_index += tile_direction;
 
@@ -504,19 +853,22 @@ void Lcd::DrawRegularSprite(const Sprite& sprite) {
 
         // The first and last tiles may be partially scrolled off-screen.
         const int end_offset = std::min(h_pixels - scanline_index, 8);
+        if (start_offset == 0 && end_offset == 8 && !sprite.mosaic) {
+            DrawSpriteTileRow(sprite, pixel_colours.data(), scanline_index);
+            scanline_index += 8;
+            continue;
+        }
+
         for (int i = start_offset; i < end_offset; ++i) {
             if (sprite.mosaic && scanline_index % MosaicObjH() != 0) {
-                pixel_colours[i] = sprite_scanlines[sprite.priority][scanline_index - (scanline_index % MosaicObjH())];
+                // Repeat this sprite's pixel at the start of the mosaic block, if it's still on top there.
+                const int block_start = scanline_index - (scanline_index % MosaicObjH());
+                pixel_colours[i] = (sprite_priorities[block_start] == sprite.priority) ? sprite_line[block_start]
+                                                                                      : alpha_bit;
             }
 
             if ((pixel_colours[i] & alpha_bit) == 0) {
-                if (ObjWinEnabled() && sprite.mode == Sprite::Mode::ObjWindow) {
-                    sprite_flags[scanline_index] |= obj_window_flag;
-                    obj_window_used = true;
-                } else {
-                    sprite_scanlines[sprite.priority][scanline_index] = pixel_colours[i];
-                    UpdateSpritePixel(sprite, scanline_index);
-                }
+                DrawSpritePixel(sprite, pixel_colours[i], scanline_index);
             }
 
             scanline_index += 1;
@@ -532,7 +884,7 @@ void Lcd::DrawAffineSprite(const Sprite& sprite) {
     const int sprite_centre_x = tex_centre_x + sprite.x_pos;
     const int sprite_centre_y = tex_centre_y + sprite.y_pos;
 
-    int scanline_index = std::max(sprite.x_pos, 0);
+    const int first_sprite_pixel = std::max<int>(sprite.x_pos, 0);
     const int last_sprite_pixel = std::min(sprite.x_pos + sprite.pixel_width, 240);
 
     // Affine parameters.
@@ -541,202 +893,226 @@ void Lcd::DrawAffineSprite(const Sprite& sprite) {
     const int pc = static_cast<s32>(oam[sprite.affine_select * 8 + 5]) >> 16;
     const int pd = static_cast<s32>(oam[sprite.affine_select * 8 + 7]) >> 16;
 
-    const int sprite_y = vcount - sprite_centre_y;
-    const int pb_sprite_y = pb * sprite_y;
-    const int pd_sprite_y = pd * sprite_y;
+    const int sprite_x = first_sprite_pixel - sprite_centre_x;
+    const int sprite_y = draw_line - sprite_centre_y;
 
-    while (scanline_index < last_sprite_pixel) {
-        const int sprite_x = scanline_index - sprite_centre_x;
+    // Double size sprites draw the normal size texture in the middle of a doubled area.
+    const int tex_width = sprite.double_size ? sprite.pixel_width / 2 : sprite.pixel_width;
+    const int tex_height = sprite.double_size ? sprite.pixel_height / 2 : sprite.pixel_height;
+    const int tex_offset_x = tex_centre_x - (sprite.double_size ? sprite.pixel_width / 4 : 0);
+    const int tex_offset_y = tex_centre_y - (sprite.double_size ? sprite.pixel_height / 4 : 0);
 
-        int tex_x = ((pa * sprite_x + pb_sprite_y) >> 8) + tex_centre_x;
-        int tex_y = ((pc * sprite_x + pd_sprite_y) >> 8) + tex_centre_y;
+    AffineTexels texels{pa * sprite_x + pb * sprite_y, pc * sprite_x + pd * sprite_y, pa, pc};
+    for (int lane_base = first_sprite_pixel; lane_base < last_sprite_pixel; lane_base += AffineTexels::lanes) {
+        texels.Next(tex_offset_x, tex_offset_y, tex_width, tex_height, false);
 
-        if (sprite.double_size) {
-            tex_x -= sprite.pixel_width / 4;
-            tex_y -= sprite.pixel_height / 4;
-        }
+        const int num_lanes = std::min(AffineTexels::lanes, last_sprite_pixel - lane_base);
+        for (int i = 0; i < num_lanes; ++i) {
+            if (!texels.in_bounds[i]) {
+                continue;
+            }
 
-        if (tex_x >= sprite.pixel_width || tex_x < 0 || tex_y >= sprite.pixel_height || tex_y < 0) {
-            scanline_index += 1;
-            continue;
-        } else if (sprite.double_size && (tex_x >= sprite.pixel_width / 2 || tex_y >= sprite.pixel_height / 2)) {
-            scanline_index += 1;
-            continue;
-        }
+            const int scanline_index = lane_base + i;
+            const int tex_x = texels.tex_x[i];
+            const int tex_y = texels.tex_y[i];
 
-        const int tile_row = tex_y / 8;
-        const int pixel_row = tex_y % 8;
-        const int tile_index = tile_row * sprite.tile_width + tex_x / 8;
+            const int tile_row = tex_y / 8;
+            const int pixel_row = tex_y % 8;
+            const int tile_index = tile_row * sprite.tile_width + tex_x / 8;
 
-        int tile_addr = sprite.tile_base_addr + tile_index * sprite.tile_bytes;
-        if (ObjMapping2D()) {
-            const int h = tile_index / sprite.tile_width;
-            tile_addr += h * sprite.tile_bytes * ((sprite.single_palette ? 16 : 32) - sprite.tile_width);
-        }
+            int tile_addr = sprite.tile_base_addr + tile_index * sprite.tile_bytes;
+            if (ObjMapping2D()) {
+                const int h = tile_index / sprite.tile_width;
+                tile_addr += h * sprite.row_stride_2d;
+            }
 
-        u8 palette_entry;
-        if (sprite.single_palette) {
-            // Each tile byte specifies the 8-bit palette index for a pixel.
-            const int pixel_addr = tile_addr + pixel_row * 8 + tex_x % 8;
-            const int hi_shift = 8 * (pixel_addr & 0x1);
+            u8 palette_entry;
+            if (sprite.single_palette) {
+                // Each tile byte specifies the 8-bit palette index for a pixel.
+                const int pixel_addr = tile_addr + pixel_row * 8 + tex_x % 8;
+                const int hi_shift = 8 * (pixel_addr & 0x1);
 
-            palette_entry = (vram[pixel_addr / 2] >> hi_shift) & 0xFF;
-        } else {
-            const int pixel_addr = tile_addr + pixel_row * 4 + (tex_x % 8) / 2;
-            const int hi_shift = 8 * (pixel_addr & 0x1);
+                palette_entry = (vram[pixel_addr / 2] >> hi_shift) & 0xFF;
+            } else {
+                const int pixel_addr = tile_addr + pixel_row * 4 + (tex_x % 8) / 2;
+                const int hi_shift = 8 * (pixel_addr & 0x1);
 
-            // The lower 4 bits are the palette index for even pixels, and the upper 4 bits are for odd pixels.
-            const int odd_shift = 4 * ((tex_x % 8) & 0x1);
-            palette_entry = (vram[pixel_addr / 2] >> (hi_shift + odd_shift)) & 0xF;
-        }
+                // The lower 4 bits are the palette index for even pixels, and the upper 4 bits are for odd pixels.
+                const int odd_shift = 4 * ((tex_x % 8) & 0x1);
+                palette_entry = (vram[pixel_addr / 2] >> (hi_shift + odd_shift)) & 0xF;
+            }
 
-        if (palette_entry != 0) {
-            // Palette entry 0 is transparent.
-            if (ObjWinEnabled() && sprite.mode == Sprite::Mode::ObjWindow) {
-                sprite_flags[scanline_index] |= obj_window_flag;
-                obj_window_used = true;
-            } else {
-                sprite_scanlines[sprite.priority][scanline_index] = pram[256 + sprite.palette * 16 + palette_entry] & 0x7FFF;
-                UpdateSpritePixel(sprite, scanline_index);
+            if (palette_entry != 0) {
+                // Palette entry 0 is transparent.
+                DrawSpritePixel(sprite, pram[256 + sprite.palette * 16 + palette_entry] & 0x7FFF, scanline_index);
             }
         }
-
-        scanline_index += 1;
     }
 }
 
-void Lcd::UpdateSpritePixel(const Sprite& sprite, int scanline_index) {
-    // Erase sprite pixels at a lower priority than this one, since we only have one object plane.
-    for (int j = sprite.priority + 1; j < 4; ++j) {
-        sprite_scanlines[j][scanline_index] |= alpha_bit;
+void Lcd::DrawSpritePixel(const Sprite& sprite, u16 colour, int scanline_index) {
+    if (ObjWinEnabled() && sprite.mode == Sprite::Mode::ObjWindow) {
+        obj_window_masks[scanline_index] = 0xFFFF;
+        obj_window_used = true;
+        return;
     }
 
-    if (sprite.mode == Sprite::Mode::SemiTransparent) {
-        sprite_flags[scanline_index] |= semi_transparent_flag;
-        semi_transparent_used = true;
-    } else {
-        // The semi-transparent flag must be cleared if a non-semi-transparent sprite is drawn on top
-        // of a semi-transparent one.
-        sprite_flags[scanline_index] &= ~semi_transparent_flag;
+    // Sprites are drawn from the highest OAM index down, so a sprite replaces the one on top unless that one has a
+    // higher priority level.
+    if (sprite.priority > sprite_priorities[scanline_index]) {
+        return;
     }
-}
 
-int Sprite::Height(u32 attr1) {
-    Shape shape = Sprite::GetShape(attr1);
-    int size = Sprite::GetSize(attr1);
+    sprite_line[scanline_index] = colour;
+    sprite_priorities[scanline_index] = sprite.priority;
 
-    int pixel_height;
-    switch (shape) {
-    case Shape::Square:
-        // 8, 16, 32, 64
-        pixel_height = 8 << size;
-        break;
-    case Shape::Horizontal:
-        // 8, 8, 16, 32
-        if (size > 0) {
-            size -= 1;
-        }
-        pixel_height = 8 << size;
-        break;
-    case Shape::Vertical:
-        // 16, 32, 32, 64
-        if (size > 1) {
-            size -= 1;
-        }
-        pixel_height = 16 << size;
-        break;
-    default:
-        return 0;
-    }
-
-    if (DoubleSize(attr1)) {
-        return pixel_height * 2;
-    } else {
-        return pixel_height;
-    }
+    // A sprite drawn over a semi-transparent one takes its flag away.
+    const bool semi_transparent = sprite.mode == Sprite::Mode::SemiTransparent;
+    semi_transparent_masks[scanline_index] = semi_transparent ? 0xFFFF : 0x0000;
+    semi_transparent_used |= semi_transparent;
 }
 
-int Sprite::Width(u32 attr1) {
-    Shape shape = Sprite::GetShape(attr1);
-    int size = Sprite::GetSize(attr1);
+void Lcd::DrawSpriteTileRow(const Sprite& sprite, const u16* colours, int scanline_index) {
+    // The same as DrawSpritePixel for each pixel, with the transparent pixels and the pixels under a higher
+    // priority sprite masked out.
+    const Lanes pixels = Lanes::Load(colours);
+    const Lanes opaque = (pixels & Lanes::Splat(alpha_bit)) == Lanes::Zero();
 
-    int pixel_width;
-    switch (shape) {
-    case Shape::Square:
-        // 8, 16, 32, 64
-        pixel_width = 8 << size;
-        break;
-    case Shape::Horizontal:
-        // 16, 32, 32, 64
-        if (size > 1) {
-            size -= 1;
-        }
-        pixel_width = 16 << size;
-        break;
-    case Shape::Vertical:
-        // 8, 8, 16, 32
-        if (size > 0) {
-            size -= 1;
-        }
-        pixel_width = 8 << size;
-        break;
-    default:
-        return 0;
+    if (ObjWinEnabled() && sprite.mode == Sprite::Mode::ObjWindow) {
+        u16* obj_window = obj_window_masks.data() + scanline_index;
+        (Lanes::Load(obj_window) | opaque).Store(obj_window);
+        obj_window_used = true;
+        return;
     }
 
-    if (DoubleSize(attr1)) {
-        return pixel_width * 2;
-    } else {
-        return pixel_width;
-    }
+    const Lanes priority = Lanes::Splat(sprite.priority);
+    const Lanes priorities_below = Lanes::Load(sprite_priorities.data() + scanline_index);
+    const Lanes drawn = opaque & (Min(priority, priorities_below) == priority);
+
+    Select(drawn, pixels, Lanes::Load(sprite_line.data() + scanline_index)).Store(sprite_line.data() + scanline_index);
+    Select(drawn, priority, priorities_below).Store(sprite_priorities.data() + scanline_index);
+
+    const bool semi_transparent = sprite.mode == Sprite::Mode::SemiTransparent;
+    Select(drawn, LaneMask(semi_transparent), Lanes::Load(semi_transparent_masks.data() + scanline_index))
+        .Store(semi_transparent_masks.data() + scanline_index);
+    semi_transparent_used |= semi_transparent;
 }
 
 std::array<u16, 8> Lcd::GetTilePixels(int tile_addr, bool single_palette, bool h_flip,
                                       int pixel_row, int palette, int base) const {
     std::array<u16, 8> pixel_colours;
+    DecodeTileRow(pixel_colours.data(), tile_addr, single_palette, h_flip, pixel_row, palette, base, 0, 8);
+    return pixel_colours;
+}
 
-    if (single_palette) {
-        // Each tile byte specifies the 8-bit palette index for a pixel.
-        // We read two bytes at a time from VRAM.
-        for (int i = 0; i < 4; ++i) {
-            const int pixel_addr = tile_addr + pixel_row * 8 + i * 2;
-            const u16 vram_entry = vram[pixel_addr / 2];
+void Lcd::DecodeTileRow(u16* dest, int tile_addr, bool single_palette, bool h_flip, int pixel_row, int palette,
+                        int base, int first, int last) const {
+    const u8* palette_indices = TileRowIndices(tile_addr, single_palette, pixel_row);
 
-            for (int j = 0; j < 2; ++j) {
-                const u8 palette_entry = (vram_entry >> (j * 8)) & 0xFF;
-                if (palette_entry == 0) {
-                    // Palette entry 0 is transparent.
-                    pixel_colours[i * 2 + j] = alpha_bit;
-                } else {
-                    pixel_colours[i * 2 + j] = pram[base + palette_entry] & 0x7FFF;
-                }
-            }
+    // 4-bit palette indices select a colour within one of the 16 palette banks.
+    const u16* colours = pram.data() + (single_palette ? base : base + palette * 16);
+
+    // Palette entry 0 is transparent. The flip is hoisted out of the loop so each loop is a straight run of lookups.
+    if (h_flip) {
+        for (int i = first; i < last; ++i) {
+            const u8 palette_entry = palette_indices[7 - i];
+            *dest++ = (palette_entry == 0) ? alpha_bit : colours[palette_entry] & 0x7FFF;
         }
     } else {
-        // Each tile byte specifies the 4-bit palette indices for two pixels.
-        // The lower 4 bits are the palette index for even pixels, and the upper 4 bits are for odd pixels.
-        // We read two bytes at a time from VRAM.
-        for (int i = 0; i < 2; ++i) {
-            const int pixel_addr = tile_addr + pixel_row * 4 + i * 2;
-            const u16 vram_entry = vram[pixel_addr / 2];
+        for (int i = first; i < last; ++i) {
+            const u8 palette_entry = palette_indices[i];
+            *dest++ = (palette_entry == 0) ? alpha_bit : colours[palette_entry] & 0x7FFF;
+        }
+    }
+}
+
+const u8* Lcd::TileRowIndices(int tile_addr, bool single_palette, int pixel_row) const {
+    const std::size_t block = tile_addr / tile_block_bytes;
+    if (block >= tile_blocks) {
+        // Tiles past the end of VRAM are transparent.
+        static constexpr std::array<u8, 8> transparent_row{};
+        return transparent_row.data();
+    }
+
+    auto& tiles = single_palette ? tiles_8bpp : tiles_4bpp;
+    auto& tile_dirty = single_palette ? tile_dirty_8bpp : tile_dirty_4bpp;
 
-            for (int j = 0; j < 4; ++j) {
-                const u8 palette_entry = (vram_entry >> (j * 4)) & 0xF;
-                if (palette_entry == 0) {
-                    // Palette entry 0 is transparent.
-                    pixel_colours[i * 4 + j] = alpha_bit;
-                } else {
-                    pixel_colours[i * 4 + j] = pram[base + palette * 16 + palette_entry] & 0x7FFF;
-                }
+    if (tile_dirty[block]) {
+        auto& tile = tiles[block];
+        if (single_palette) {
+            // Each tile byte specifies the 8-bit palette index for a pixel.
+            for (std::size_t i = 0; i < tile.size(); ++i) {
+                tile[i] = VramByte(tile_addr + i);
+            }
+        } else {
+            // Each tile byte specifies the 4-bit palette indices for two pixels.
+            // The lower 4 bits are the palette index for even pixels, and the upper 4 bits are for odd pixels.
+            for (std::size_t i = 0; i < tile.size() / 2; ++i) {
+                const u8 tile_byte = VramByte(tile_addr + i);
+                tile[i * 2] = tile_byte & 0xF;
+                tile[i * 2 + 1] = tile_byte >> 4;
             }
         }
+
+        tile_dirty[block] = false;
     }
 
-    if (h_flip) {
-        std::reverse(pixel_colours.begin(), pixel_colours.end());
+    return tiles[block].data() + pixel_row * 8;
+}
+
+u8 Lcd::VramByte(std::size_t addr) const {
+    if (addr / 2 >= vram.size()) {
+        // The last 8bpp tiles extend past the end of VRAM.
+        return 0;
     }
 
-    return pixel_colours;
+    return vram[addr / 2] >> (8 * (addr & 0x1));
+}
+
+void Lcd::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("lcd", sizeof(Lcd));
+    report.Add("lcd", bgs);
+    for (const auto& bg : bgs) {
+        bg.ReportMemory(report);
+    }
+    report.Add("lcd", sprites);
+    report.Add("frame_buffers", back_buffer);
+    report.Add("tile_cache", tiles_4bpp);
+    report.Add("tile_cache", tiles_8bpp);
+}
+
+void Lcd::SerializeState(Common::State& state) {
+    SyncRender();
+
+    state.Sync(control, green_swap, status, vcount, draw_line, winin, winout, mosaic, blend_control, blend_alpha,
+               blend_fade, windows);
+    for (auto& bg : bgs) {
+        state.Sync(bg);
+    }
+
+    if (state.Loading()) {
+        // Loaded into the LCD's own buffer, as the frontend may hold on to any memory it lent.
+        back_frame = back_buffer.data();
+    }
+    state.SyncContents(back_frame, back_buffer.size());
+    state.Sync(skip_frame, scanline_cycles, first_alpha, second_alpha, intensity);
+
+    if (state.Loading()) {
+        // All of video memory may have changed, so throw away everything decoded from it.
+        tile_dirty_4bpp.fill(true);
+        tile_dirty_8bpp.fill(true);
+        sprite_dirty.fill(true);
+        oam_dirty = true;
+        bg_dirty = true;
+
+        back_signatures.fill(0);
+        front_signatures.fill(0);
+        ++bg_vram_generation;
+        ++obj_vram_generation;
+        ++bg_pram_generation;
+        ++obj_pram_generation;
+        ++oam_generation;
+    }
 }
 
 } // End namespace Gba
@@ -16,12 +16,23 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 
 #include "common/CommonTypes.h"
 #include "common/CommonFuncs.h"
+#include "common/SaveState.h"
+#include "common/MemoryReport.h"
 #include "gba/memory/IOReg.h"
+#include "gba/memory/MemDefs.h"
+
+namespace Bench { class Kernels; }
 
 namespace Gba {
 
@@ -50,17 +61,18 @@ public:
             , tile_width(pixel_width / ((affine && double_size) ? 16 : 8))
             , tile_height(pixel_height / ((affine && double_size) ? 16 : 8))
             , tile_bytes(single_palette ? 64 : 32)
-            , tile_base_addr(sprite_vram_base + tile_num * 32) {
+            , tile_base_addr(sprite_vram_base + tile_num * 32)
+            , row_stride_2d(tile_bytes * ((single_palette ? 16 : 32) - tile_width)) {
 
         if (y_pos + pixel_height > 0xFF) {
             y_pos -= 0x100;
         }
     }
 
-    enum class Mode {Normal          = 0,
-                     SemiTransparent = 1,
-                     ObjWindow       = 2,
-                     Prohibited      = 3};
+    enum class Mode : u8 {Normal          = 0,
+                          SemiTransparent = 1,
+                          ObjWindow       = 2,
+                          Prohibited      = 3};
 
     enum class Shape {Square     = 0,
                       Horizontal = 1,
@@ -69,7 +81,9 @@ public:
 
     static constexpr int sprite_vram_base = 0x1'0000;
 
-    int y_pos;
+    // Rebuilt for every OAM write, and read for every sprite on every scanline, so the fields are kept small enough
+    // for all 128 sprites to fit in 4KB.
+    s16 y_pos;
     bool affine;
     bool disable;
     bool double_size;
@@ -77,32 +91,43 @@ public:
     bool mosaic;
     bool single_palette;
 
-    int x_pos;
-    int affine_select;
+    s16 x_pos;
+    u8 affine_select;
     bool h_flip;
     bool v_flip;
 
-    int tile_num;
-    int priority;
-    int palette;
-
-    int pixel_width;
-    int pixel_height;
-    int tile_width;
-    int tile_height;
+    u16 tile_num;
+    u8 priority;
+    u8 palette;
 
-    int tile_bytes;
-    int tile_base_addr;
+    // Double size sprites are at most 128 pixels across.
+    u8 pixel_width;
+    u8 pixel_height;
+    u8 tile_width;
+    u8 tile_height;
 
-    bool drawn = false;
+    u8 tile_bytes;
+    u32 tile_base_addr;
+    // The bytes to skip between rows of tiles in 2D mapping mode, past the tiles of the rest of the 32x32 tile block.
+    u16 row_stride_2d;
 
     static bool Disabled(u32 attr1) { return (attr1 & 0x200) && !(attr1 & 0x100); }
     static Shape GetShape(u32 attr1) { return static_cast<Shape>((attr1 >> 14) & 0x3); }
     static int GetSize(u32 attr1) { return (attr1 >> 30) & 0x3; }
     static bool DoubleSize(u32 attr1) { return (attr1 & 0x200) && (attr1 & 0x100); }
 
-    static int Height(u32 attr1);
-    static int Width(u32 attr1);
+    // Indexed by shape, then size. Prohibited shapes have no pixels.
+    static constexpr std::array<std::array<u8, 4>, 4> shape_widths{{{8, 16, 32, 64}, {16, 32, 32, 64},
+                                                                    {8, 8, 16, 32}, {0, 0, 0, 0}}};
+    static constexpr std::array<std::array<u8, 4>, 4> shape_heights{{{8, 16, 32, 64}, {8, 8, 16, 32},
+                                                                     {16, 32, 32, 64}, {0, 0, 0, 0}}};
+
+    static int Height(u32 attr1) {
+        return shape_heights[static_cast<int>(GetShape(attr1))][GetSize(attr1)] << DoubleSize(attr1);
+    }
+    static int Width(u32 attr1) {
+        return shape_widths[static_cast<int>(GetShape(attr1))][GetSize(attr1)] << DoubleSize(attr1);
+    }
 };
 
 class Window {
@@ -121,34 +146,22 @@ public:
         on_this_scanline = enabled && y >= Top() && y < Bottom();
     }
 
-    bool Contains(int x) const {
-        if (!on_this_scanline) {
-            return false;
-        }
-
-        if (Right() >= Left()) {
-            return x >= Left() && x < Right();
-        } else {
-            // The window wraps around the side of the screen.
-            return x >= Left() || x < Right();
-        }
-    }
-};
-
-struct PixelInfo {
-    u8 last_layer = 5;
-    u8 highest_first_target = 5;
+    void SerializeState(Common::State& state) { state.Sync(width, height, on_this_scanline); }
 };
 
 class Lcd {
+    friend class Bench::Kernels;
+
 public:
-    Lcd(const std::vector<u16>& _pram, const std::vector<u16>& _vram, const std::vector<u32>& _oam, Core& _core);
+    Lcd(const GuestRam& ram, Core& _core, bool threaded, bool line_cache);
     ~Lcd();
 
     IOReg control       = {0x0000, 0xFFF7, 0xFFF7};
     IOReg green_swap    = {0x0000, 0x0001, 0x0001};
     IOReg status        = {0x0000, 0xFF3F, 0xFF38};
     IOReg vcount        = {0x0000, 0x00FF, 0x0000};
+    // The scanline being drawn, which lags behind vcount while the render thread catches up.
+    int draw_line = 0;
 
     IOReg winin         = {0x0000, 0x3F3F, 0x3F3F};
     IOReg winout        = {0x0000, 0x3F3F, 0x3F3F};
@@ -161,12 +174,11 @@ public:
     std::vector<Bg> bgs;
     std::array<Window, 2> windows;
 
-    const std::vector<u16>& pram;
-    const std::vector<u16>& vram;
-    const std::vector<u32>& oam;
+    const decltype(GuestRam::pram)& pram;
+    const decltype(GuestRam::vram)& vram;
+    const decltype(GuestRam::oam)& oam;
 
     bool bg_dirty = true;
-    bool oam_dirty = true;
 
     static constexpr int h_pixels = 240;
     static constexpr int v_pixels = 160;
@@ -174,14 +186,88 @@ public:
 
     void Update(int cycles);
     void WriteControl(const u16 data, const u16 mask);
+    void WriteBlendAlpha(const u16 data, const u16 mask);
+    void WriteBlendFade(const u16 data, const u16 mask);
     int NextEvent() const;
+    bool ForcedBlank() const { return control & 0x80; }
+    void SerializeState(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
+
+    // In threaded mode, scanlines are queued at HBlank and drawn by the render thread while the CPU runs ahead.
+    // Anything that changes the video state a queued scanline would see has to call this first.
+    void SyncRender() {
+        if (queued_lines.load(std::memory_order_acquire) != 0) {
+            WaitForRender();
+        }
+    }
 
-    void DumpDebugInfo() const;
+    void DumpDebugInfo();
     void DumpSprites() const;
     void DumpTileset(int base, bool single_palette) const;
 
     std::array<u16, 8> GetTilePixels(int tile_addr, bool single_palette, bool h_flip,
                                      int pixel_row, int palette, int base) const;
+    // Writes pixels first to last - 1 of a tile row straight to dest, with pixel first going to dest[0].
+    void DecodeTileRow(u16* dest, int tile_addr, bool single_palette, bool h_flip, int pixel_row, int palette,
+                       int base, int first, int last) const;
+    // The palette indices of one row of a tile, decoded the next time they're asked for after a write to the tile.
+    const u8* TileRowIndices(int tile_addr, bool single_palette, int pixel_row) const;
+    // Changes whenever any byte of the tile at tile_addr is written. Tiles past the end of VRAM never change.
+    u32 TileGeneration(int tile_addr, bool single_palette) const {
+        const std::size_t block = tile_addr / tile_block_bytes;
+        const std::size_t end_block = std::min(block + (single_palette ? 2 : 1), tile_blocks);
+        u32 generation = 0;
+        for (std::size_t b = block; b < end_block; ++b) {
+            generation += tile_generations[b];
+        }
+        return generation;
+    }
+    // Changes whenever any of VRAM is written.
+    u64 VramGeneration() const { return bg_vram_generation + obj_vram_generation; }
+
+    // Called with the offset into OAM of every write, to rebuild the sprites that overlap it.
+    void OamWritten(u32 oam_addr, u32 bytes) {
+        for (u32 s = oam_addr / sprite_bytes; s <= (oam_addr + bytes - 1) / sprite_bytes; ++s) {
+            sprite_dirty[s] = true;
+        }
+        oam_dirty = true;
+        ++oam_generation;
+    }
+
+    // Called with the offset into PRAM of every write.
+    void PramWritten(u32 pram_addr) {
+        if (pram_addr < obj_pram_base) {
+            ++bg_pram_generation;
+        } else {
+            ++obj_pram_generation;
+        }
+    }
+
+    bool LineCacheEnabled() const { return line_cache; }
+    // The fraction of scanlines since the last call that were reused from the previous frame.
+    float TakeLineReuseRatio();
+
+    // Called with the offset into VRAM of every write, to throw away the decoded tiles that overlap it.
+    void VramWritten(u32 vram_addr, u32 bytes) {
+        if (vram_addr < Sprite::sprite_vram_base) {
+            ++bg_vram_generation;
+        } else {
+            ++obj_vram_generation;
+        }
+
+        const std::size_t first_block = vram_addr / tile_block_bytes;
+        const std::size_t last_block = (vram_addr + bytes - 1) / tile_block_bytes;
+        for (std::size_t block = first_block; block <= last_block; ++block) {
+            tile_dirty_4bpp[block] = true;
+            tile_dirty_8bpp[block] = true;
+            ++tile_generations[block];
+        }
+
+        // 8bpp tiles are two blocks long, so the tile starting in the previous block overlaps this one.
+        if (first_block > 0) {
+            tile_dirty_8bpp[first_block - 1] = true;
+        }
+    }
 
     // Mosaic flags
     int MosaicBgH() const { return (mosaic & 0xF) + 1; }
@@ -191,42 +277,125 @@ private:
     Core& core;
 
     std::vector<u16> back_buffer;
+    // Where the frame is being drawn, which is either buffer of the core's or memory lent by the frontend.
+    u16* back_frame;
+    // Decided at the start of each frame. Skipped frames keep their timing, but nothing is drawn.
+    bool skip_frame = false;
 
     int scanline_cycles = 0;
 
+    // Tiles decoded to palette indices, for every 32-byte aligned tile address in VRAM. A tile's colours depend on
+    // the palette as well, so they're resolved from PRAM each time the tile is drawn.
+    static constexpr std::size_t tile_block_bytes = 32;
+    static constexpr std::size_t tile_blocks = 96 * kbyte / tile_block_bytes;
+    using TileIndices = std::array<u8, 64>;
+    mutable std::vector<TileIndices> tiles_4bpp;
+    mutable std::vector<TileIndices> tiles_8bpp;
+    mutable std::array<bool, tile_blocks> tile_dirty_4bpp;
+    mutable std::array<bool, tile_blocks> tile_dirty_8bpp;
+    // Write counts for each block, which only go up.
+    std::array<u32, tile_blocks> tile_generations{};
+
+    u8 VramByte(std::size_t addr) const;
+
+    // Decoded sprites for every OAM entry. Only the entries that have been written to are rebuilt.
+    static constexpr int num_sprites = 128;
+    static constexpr u32 sprite_bytes = 8;
     std::vector<Sprite> sprites;
-    std::array<std::array<u16, 240>, 4> sprite_scanlines;
-    std::array<bool, 4> sprite_scanline_used{{true, true, true, true}};
-    std::array<u8, 240> sprite_flags;
-    static constexpr u8 semi_transparent_flag = 0x1;
-    static constexpr u8 obj_window_flag = 0x2;
+    std::array<bool, num_sprites> sprite_dirty;
+    bool oam_dirty = true;
+
+    // The sprites overlapping each scanline, as bitmasks of OAM indices so they can be visited in OAM order.
+    // Each sprite's range of lines is kept so it can be removed from them when it changes.
+    using SpriteMask = std::array<u64, num_sprites / 64>;
+    std::array<SpriteMask, v_pixels> line_sprites{};
+    std::array<int, num_sprites> sprite_first_line{};
+    std::array<int, num_sprites> sprite_end_line{};
+
+    // The sprites on the current scanline which will be drawn, in OAM order.
+    std::array<int, num_sprites> drawn_sprites;
+    int num_drawn_sprites = 0;
+
+    // With the line cache enabled, each drawn line records a hash of everything that affects its output, and is
+    // left as it is in the back buffer if the same line of the next frame drawn into that buffer hashes the same.
+    // A signature of 0 means the line hasn't been drawn. The signatures follow their buffers when they're swapped.
+    // Video memory is tracked with generation counts, which only go up.
+    const bool line_cache;
+    std::array<u64, v_pixels> back_signatures{};
+    std::array<u64, v_pixels> front_signatures{};
+    static constexpr u32 obj_pram_base = 0x200;
+    u64 bg_vram_generation = 0;
+    u64 obj_vram_generation = 0;
+    u64 bg_pram_generation = 0;
+    u64 obj_pram_generation = 0;
+    u64 oam_generation = 0;
+    u32 lines_drawn = 0;
+    u32 lines_reused = 0;
+
+    u64 LineSignature() const;
+    // Lines under a BG's vertical mosaic repeat the BG's last drawn scanline, which a reused line never drew.
+    bool BgVerticalMosaic() const;
+
+    // There's one sprite layer. Each pixel holds the colour of the sprite on top (the alpha bit where there's none)
+    // and the priority level it's drawn at, with no_sprite_priority below all of them. Whether the sprite on top is
+    // semi-transparent, and whether an OBJ window sprite covers the pixel, are kept as lane masks.
+    static constexpr u16 no_sprite_priority = 4;
+    alignas(16) std::array<u16, h_pixels> sprite_line{};
+    alignas(16) std::array<u16, h_pixels> sprite_priorities{};
+    alignas(16) std::array<u16, h_pixels> semi_transparent_masks{};
+    alignas(16) std::array<u16, h_pixels> obj_window_masks{};
+    std::array<bool, 4> sprite_priority_used{{true, true, true, true}};
     bool semi_transparent_used = true;
     bool obj_window_used = true;
 
     void DrawScanline();
+    void SkipScanline();
+    void TickEnableDelays();
+
+    std::thread render_thread;
+    std::mutex render_mutex;
+    std::condition_variable render_cv;
+    std::condition_variable render_done_cv;
+    std::atomic<int> queued_lines{0};
+    int next_render_line = 0;
+    bool quit_render = false;
+    std::exception_ptr render_error;
+
+    void QueueScanline();
+    void RenderLoop();
+    void WaitForRender();
     std::array<std::vector<const Bg*>, 4> DrawBackgrounds();
 
     void ReadOam();
+    void IndexSprite(int s);
     void DrawSprites();
     void DrawRegularSprite(const Sprite& sprite);
     void DrawAffineSprite(const Sprite& sprite);
-    void UpdateSpritePixel(const Sprite& sprite, int scanline_index);
+    void DrawSpritePixel(const Sprite& sprite, u16 colour, int scanline_index);
+    // Draws a whole tile row of a regular sprite, with the alpha bit set on its transparent pixels.
+    void DrawSpriteTileRow(const Sprite& sprite, const u16* colours, int scanline_index);
 
-    bool IsWithinWindow(int layer_id, int x) const;
+    // The layers enabled by the windows on each pixel of the current scanline, with one bit per layer. Layer 4 is
+    // the sprites, and bit 5 enables blending effects.
+    std::array<u16, 240> window_layer_masks;
+    static constexpr u16 all_window_layers = 0x3F;
+    static constexpr u16 blend_window_layer = 0x20;
+    void UpdateWindowLayers();
 
     bool IsFirstTarget(int target) const { return (FirstTargets() >> target) & 0x1; }
     bool IsSecondTarget(int target) const { return (SecondTargets() >> target) & 0x1; }
 
-    int Brighten(int t) const { return t + (31.0 - t) * Intensity(); }
-    int Darken(int t) const { return t * (1.0 - Intensity()); }
-    int Blend(int t1, int t2) const { return std::min(t1 * FirstAlpha() + t2 * SecondAlpha(), 31.0); }
+    // Blending coefficients in 1/16ths, clamped to 16. Only updated when BLDALPHA and BLDY are written.
+    u32 first_alpha = 0;
+    u32 second_alpha = 0;
+    u32 intensity = 0;
+
 
     // Control flags
     int BgMode() const { return control & 0x7; }
     bool DisplayFrame1() const { return control & 0x10; }
     bool HBlankFree() const { return control & 0x20; }
     bool ObjMapping2D() const { return !(control & 0x40); }
-    bool ForcedBlank() const { return control & 0x80; }
     bool ObjEnabled() const { return control & 0x1000; }
     bool WinEnabled(int win_id) const { return control & (0x2000 << win_id); }
     bool ObjWinEnabled() const { return control & 0x8000; }
@@ -254,10 +423,10 @@ private:
     Effect BlendMode() const { return static_cast<Effect>((blend_control >> 6) & 0x3); }
     int SecondTargets() const { return (blend_control >> 8) & 0x3F; }
 
-    double FirstAlpha() const { return std::min(static_cast<double>(blend_alpha & 0x1F) / 16.0, 1.0); }
-    double SecondAlpha() const { return std::min(static_cast<double>((blend_alpha >> 8) & 0x1F) / 16.0, 1.0); }
+    u32 FirstAlpha() const { return std::min(blend_alpha & 0x1F, 16); }
+    u32 SecondAlpha() const { return std::min((blend_alpha >> 8) & 0x1F, 16); }
 
-    double Intensity() const { return std::min(static_cast<double>(blend_fade & 0x1F) / 16.0, 1.0); }
+    u32 Intensity() const { return std::min(blend_fade & 0x1F, 16); }
 };
 
 } // End namespace Gba
@@ -21,7 +21,7 @@
 
 namespace Gba {
 
-bool Memory::CheckNintendoLogo(const std::vector<u8>& rom_header) noexcept {
+bool Memory::CheckNintendoLogo(const Common::RomVector<u8>& rom_header) noexcept {
     // Calculate the FNV-1a hash of the region in the ROM header where the Nintendo logo is supposed to be (0x4-0x9F)
     // and compare it to a precalculated hash of the expected logo.
     static constexpr u32 logo_hash = 0xAF665756;
@@ -30,7 +30,10 @@ bool Memory::CheckNintendoLogo(const std::vector<u8>& rom_header) noexcept {
     return header_logo_hash == logo_hash;
 }
 
-void Memory::CheckHeader(const std::vector<u16>& rom_header) {
+void Memory::CheckHeader(const Common::RomVector<u16>& rom_header) {
+    // The header is read front to back before anything else touches the ROM.
+    Common::AdviseRom(rom_header, 0xC0, Common::RomAdvice::Sequential);
+
     // Fixed value check. All GBA games must have 0x96 stored at 0xB2.
     if (rom_header[0xB2 / 2] != 0x96) {
         fmt::print("WARNING: Fixed value does not match. This ROM would not run on a GBA!\n");
@@ -47,6 +50,9 @@ void Memory::CheckHeader(const std::vector<u16>& rom_header) {
     if (checksum != (rom_header[0xBD / 2] >> 8)) {
         fmt::print("WARNING: Header checksum does not match. This ROM would not run on a GBA!\n");
     }
+
+    // Games jump around the ROM from here on.
+    Common::AdviseRom(rom_header, 0xC0, Common::RomAdvice::Normal);
 }
 
 } // End namespace Gba
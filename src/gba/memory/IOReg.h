@@ -17,6 +17,7 @@
 #pragma once
 
 #include "common/CommonTypes.h"
+#include "common/SaveState.h"
 
 namespace Gba {
 
@@ -31,6 +32,9 @@ struct IOReg {
     }
     constexpr void Clear(u16 data) { v &= ~(data & write_mask); }
 
+    // The masks never change, so only the value is saved.
+    void SerializeState(Common::State& state) { state.Sync(v); }
+
     // Copy constructor. This is defaulted because we want the copy constructor to copy all fields for the
     // other operator overloads in this file that depend on it.
     constexpr IOReg(const IOReg&) = default;
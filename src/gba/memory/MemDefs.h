@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <array>
+
 #include "common/CommonTypes.h"
 
 namespace Gba {
@@ -58,6 +60,15 @@ enum BaseAddr {Bios   = 0x0000'0000,
                Max    = 0x1000'0000};
 }
 
+// All of the fixed-size guest memory, allocated as one block per instance. Each region starts on its own cache line.
+struct GuestRam {
+    alignas(64) std::array<u16, 256 * kbyte / sizeof(u16)> xram;
+    alignas(64) std::array<u32, 32 * kbyte / sizeof(u32)> iram;
+    alignas(64) std::array<u16, kbyte / sizeof(u16)> pram;
+    alignas(64) std::array<u16, 96 * kbyte / sizeof(u16)> vram;
+    alignas(64) std::array<u32, kbyte / sizeof(u32)> oam;
+};
+
 enum IOAddr : u32 {DISPCNT     = 0x0400'0000,
                    GREENSWAP   = 0x0400'0002,
                    DISPSTAT    = 0x0400'0004,
@@ -15,10 +15,14 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 
 #include "gba/memory/Memory.h"
 #include "gba/core/Core.h"
 #include "gba/cpu/Cpu.h"
+#include "gba/cpu/BlockCache.h"
+#include "gba/cpu/Disassembler.h"
 #include "gba/lcd/Lcd.h"
 #include "gba/lcd/Bg.h"
 #include "gba/audio/Audio.h"
@@ -27,66 +31,94 @@
 #include "gba/hardware/Keypad.h"
 #include "gba/hardware/Serial.h"
 #include "gba/hardware/Rtc.h"
+#include "common/Tracer.h"
 
 namespace Gba {
 
-Memory::Memory(const std::vector<u32>& _bios, const std::vector<u16>& _rom, const std::string& _save_path, Core& _core)
+Memory::Memory(const std::vector<u32>& _bios, const Common::RomVector<u16>& _rom, const std::string& _save_path,
+               const Common::SaveSettings& save_settings, Common::HugePages huge_pages, Core& _core,
+               bool _ideal_prefetch)
         : core(_core)
         , bios(_bios)
-        , xram(xram_size / sizeof(u16))
-        , iram(iram_size / sizeof(u32))
-        , pram(pram_size / sizeof(u16))
-        , vram(vram_size / sizeof(u16))
-        , oam(oam_size / sizeof(u32))
+        , ram(Common::MakePagePtr<GuestRam>(huge_pages))
+        , xram(ram->xram)
+        , iram(ram->iram)
+        , pram(ram->pram)
+        , vram(ram->vram)
+        , oam(ram->oam)
         , rom(_rom)
+        , save_map((save_settings.mapped && !_save_path.empty())
+                   ? std::make_shared<Common::MappedSaveFile>(_save_path, save_settings) : nullptr)
+        , sram(Common::SaveAllocator<u8>(save_map))
+        , eeprom(Common::SaveAllocator<u64>(save_map))
+        , ideal_prefetch(_ideal_prefetch)
         , rom_size(rom.size() * 2)
         , rtc(nullptr)
-        , save_path(_save_path) {
+        , save_path(_save_path)
+        , save_type_cache_path(!_save_path.empty() ? save_settings.type_cache_path : "")
+        , read_pages(num_pages, nullptr)
+        , write_pages(num_pages, nullptr) {
 
     CheckHardwareOverrides();
     ReadSaveFile();
     UpdateWaitStates();
+    BuildPageTables();
+
+    if (save_settings.flush_interval != 0 && save_map == nullptr && !save_path.empty()) {
+        save_flusher = std::make_unique<Common::SaveFlusher>(save_path, save_settings.flush_interval);
+    }
 }
 
 Memory::~Memory() {
+    // Finish any background write first, so it can't land on top of the final one.
+    save_flusher.reset();
     WriteSaveFile();
+    UpdateSaveTypeCache();
+}
+
+void Memory::RequestInterrupt(u16 intr) {
+    intr_flags |= intr;
+    UpdateIrqLine();
+    if (core.tracer != nullptr) {
+        core.tracer->Instant(Common::Tracer::Cpu, "irq raise", core.scheduler.Timestamp(), intr);
+    }
 }
 
 // Bus width 16.
 template <>
-u32 Memory::ReadRegion(const std::vector<u16>& region, const u32 region_mask, const u32 addr) const {
+u32 Memory::ReadRegion(const u16* region, const u32 region_mask, const u32 addr) const {
     // Unaligned accesses are word-aligned.
     const u32 region_addr = ((addr & region_mask) / sizeof(u16)) & ~0x1;
     return region[region_addr] | (region[region_addr + 1] << 16);
 }
 
 template <>
-u16 Memory::ReadRegion(const std::vector<u16>& region, const u32 region_mask, const u32 addr) const {
+u16 Memory::ReadRegion(const u16* region, const u32 region_mask, const u32 addr) const {
     const u32 region_addr = (addr & region_mask) / sizeof(u16);
     return region[region_addr];
 }
 
 template <>
-u8 Memory::ReadRegion(const std::vector<u16>& region, const u32 region_mask, const u32 addr) const {
+u8 Memory::ReadRegion(const u16* region, const u32 region_mask, const u32 addr) const {
     const u32 region_addr = (addr & region_mask) / sizeof(u16);
     return region[region_addr] >> (8 * (addr & 0x1));
 }
 
 // Bus width 32.
 template <>
-u32 Memory::ReadRegion(const std::vector<u32>& region, const u32 region_mask, const u32 addr) const {
+u32 Memory::ReadRegion(const u32* region, const u32 region_mask, const u32 addr) const {
     const u32 region_addr = (addr & region_mask) / sizeof(u32);
     return region[region_addr];
 }
 
 template <>
-u16 Memory::ReadRegion(const std::vector<u32>& region, const u32 region_mask, const u32 addr) const {
+u16 Memory::ReadRegion(const u32* region, const u32 region_mask, const u32 addr) const {
     const u32 region_addr = (addr & region_mask) / sizeof(u32);
     return region[region_addr] >> (8 * (addr & 0x2));
 }
 
 template <>
-u8 Memory::ReadRegion(const std::vector<u32>& region, const u32 region_mask, const u32 addr) const {
+u8 Memory::ReadRegion(const u32* region, const u32 region_mask, const u32 addr) const {
     const u32 region_addr = (addr & region_mask) / sizeof(u32);
     return region[region_addr] >> (8 * (addr & 0x3));
 }
@@ -96,7 +128,7 @@ T Memory::ReadBios(const u32 addr) const {
     // The BIOS region is not mirrored, and can only be read if the PC is currently within the BIOS.
     if (addr < bios_size) {
         if (core.cpu->GetPc() < bios_size) {
-            return ReadRegion<T>(bios, bios_addr_mask, addr);
+            return ReadRegion<T>(bios.data(), bios_addr_mask, addr);
         } else {
             return core.cpu->last_bios_fetch;
         }
@@ -111,15 +143,37 @@ template <> u16 Memory::ReadIO(const u32 addr) const;
 template <> u8 Memory::ReadIO(const u32 addr) const;
 
 template <typename T>
-T Memory::ReadMem(const u32 addr, bool dma) {
+T Memory::ReadMem(const u32 addr, AccessType access_type) {
+    using Common::AccessCounters;
+    core.access_counters.Add(addr, (access_type == AccessType::Opcode) ? AccessCounters::Fetch
+                                   : (access_type == AccessType::Dma) ? AccessCounters::DmaRead
+                                   : AccessCounters::Read);
+
+    const u32 page = addr >> page_shift;
+    if (page < num_pages && read_pages[page] != nullptr) {
+        // Unaligned accesses are aligned to the access width, the same as in ReadRegion.
+        T value;
+        std::memcpy(&value, read_pages[page] + (addr & (page_size - sizeof(T))), sizeof(T));
+        return value;
+    }
+
+    core.access_counters.Add(addr, AccessCounters::SlowPath);
+
     switch (GetRegion(addr)) {
     case Region::Bios:
         return ReadBios<T>(addr);
     case Region::XRam:
+        // Only reached for pages with read hooks, which the page table leaves out.
+        core.hooks.Read(Common::Hooks::Wram, addr & xram_addr_mask & ~(sizeof(T) - 1), sizeof(T));
         return ReadXRam<T>(addr);
     case Region::IRam:
+        core.hooks.Read(Common::Hooks::FastRam, addr & iram_addr_mask & ~(sizeof(T) - 1), sizeof(T));
         return ReadIRam<T>(addr);
     case Region::IO:
+        if (VolatileIOAddr(addr)) {
+            volatile_read = true;
+        }
+        io_read = true;
         return ReadIO<T>(addr);
     case Region::PRam:
         return ReadPRam<T>(addr);
@@ -149,7 +203,7 @@ T Memory::ReadMem(const u32 addr, bool dma) {
         return ReadRom<T>(addr);
     case Region::Eeprom:
         if (save_type == SaveType::Eeprom && EepromAddr(addr)) {
-            if (dma && eeprom_ready) {
+            if (access_type == AccessType::Dma && eeprom_ready) {
                 if (eeprom_read_pos < 4) {
                     static constexpr std::array<u16, 4> eeprom_read_warmup{{0, 1, 1, 1}};
                     return eeprom_read_warmup[eeprom_read_pos++];
@@ -191,13 +245,13 @@ T Memory::ReadMem(const u32 addr, bool dma) {
     }
 }
 
-template u8 Memory::ReadMem<u8>(const u32 addr, bool dma);
-template u16 Memory::ReadMem<u16>(const u32 addr, bool dma);
-template u32 Memory::ReadMem<u32>(const u32 addr, bool dma);
+template u8 Memory::ReadMem<u8>(const u32 addr, AccessType access_type);
+template u16 Memory::ReadMem<u16>(const u32 addr, AccessType access_type);
+template u32 Memory::ReadMem<u32>(const u32 addr, AccessType access_type);
 
 // Bus width 16.
 template <>
-void Memory::WriteRegion(std::vector<u16>& region, const u32 region_mask, const u32 addr, const u32 data) {
+void Memory::WriteRegion(u16* region, const u32 region_mask, const u32 addr, const u32 data) {
     // 32 bit writes must be aligned.
     const u32 region_addr = ((addr & region_mask) / sizeof(u16)) & ~0x1;
 
@@ -206,14 +260,14 @@ void Memory::WriteRegion(std::vector<u16>& region, const u32 region_mask, const
 }
 
 template <>
-void Memory::WriteRegion(std::vector<u16>& region, const u32 region_mask, const u32 addr, const u16 data) {
+void Memory::WriteRegion(u16* region, const u32 region_mask, const u32 addr, const u16 data) {
     const u32 region_addr = (addr & region_mask) / sizeof(u16);
 
     region[region_addr] = data;
 }
 
 template <>
-void Memory::WriteRegion(std::vector<u16>& region, const u32 region_mask, const u32 addr, const u8 data) {
+void Memory::WriteRegion(u16* region, const u32 region_mask, const u32 addr, const u8 data) {
     const u32 region_addr = (addr & region_mask) / sizeof(u16);
 
     const u32 hi_shift = 8 * (addr & 0x1);
@@ -222,14 +276,14 @@ void Memory::WriteRegion(std::vector<u16>& region, const u32 region_mask, const
 
 // Bus width 32.
 template <>
-void Memory::WriteRegion(std::vector<u32>& region, const u32 region_mask, const u32 addr, const u32 data) {
+void Memory::WriteRegion(u32* region, const u32 region_mask, const u32 addr, const u32 data) {
     const u32 region_addr = (addr & region_mask) / sizeof(u32);
 
     region[region_addr] = data;
 }
 
 template <>
-void Memory::WriteRegion(std::vector<u32>& region, const u32 region_mask, const u32 addr, const u16 data) {
+void Memory::WriteRegion(u32* region, const u32 region_mask, const u32 addr, const u16 data) {
     const u32 region_addr = (addr & region_mask) / sizeof(u32);
 
     const u32 hi_shift = 8 * (addr & 0x2);
@@ -237,27 +291,38 @@ void Memory::WriteRegion(std::vector<u32>& region, const u32 region_mask, const
 }
 
 template <>
-void Memory::WriteRegion(std::vector<u32>& region, const u32 region_mask, const u32 addr, const u8 data) {
+void Memory::WriteRegion(u32* region, const u32 region_mask, const u32 addr, const u8 data) {
     const u32 region_addr = (addr & region_mask) / sizeof(u32);
 
     const u32 hi_shift = 8 * (addr & 0x3);
     region[region_addr] = (region[region_addr] & ~(0xFF << hi_shift)) | (data << hi_shift);
 }
 
+template <typename T>
+void Memory::WritePRam(const u32 addr, const T data) {
+    core.lcd->SyncRender();
+    WriteRegion(pram.data(), pram_addr_mask, addr, data);
+    core.lcd->PramWritten(addr & pram_addr_mask);
+}
+
 template <typename T>
 void Memory::WriteVRam(const u32 addr, const T data) {
+    core.lcd->SyncRender();
     if (addr & 0x0001'0000) {
-        WriteRegion(vram, vram_addr_mask2, addr, data);
+        WriteRegion(vram.data(), vram_addr_mask2, addr, data);
+        core.lcd->VramWritten(addr & vram_addr_mask2, sizeof(T));
     } else {
-        WriteRegion(vram, vram_addr_mask1, addr, data);
+        WriteRegion(vram.data(), vram_addr_mask1, addr, data);
         core.lcd->bg_dirty = true;
+        core.lcd->VramWritten(addr & vram_addr_mask1, sizeof(T));
     }
 }
 
 template <typename T>
 void Memory::WriteOam(const u32 addr, const T data) {
-    WriteRegion(oam, oam_addr_mask, addr, data);
-    core.lcd->oam_dirty = true;
+    core.lcd->SyncRender();
+    WriteRegion(oam.data(), oam_addr_mask, addr, data);
+    core.lcd->OamWritten(addr & oam_addr_mask, sizeof(T));
 }
 
 // Specializing 8-bit writes to video memory.
@@ -286,15 +351,39 @@ template <> void Memory::WriteGpio(const u32 addr, u8 data, u16 mask);
 
 template <typename T>
 void Memory::WriteMem(const u32 addr, const T data, bool dma) {
+    core.disasm->MemoryWritten(addr);
+    core.access_counters.Add(addr, dma ? Common::AccessCounters::DmaWrite : Common::AccessCounters::Write);
+
+    const u32 page = addr >> page_shift;
+    if (page < num_pages && write_pages[page] != nullptr) {
+        std::memcpy(write_pages[page] + (addr & (page_size - sizeof(T))), &data, sizeof(T));
+
+        // Only EWRAM and IWRAM are writable through the page table.
+        if (core.block_cache != nullptr) {
+            core.block_cache->CodeWritten(addr, sizeof(T));
+        }
+        return;
+    }
+
+    core.access_counters.Add(addr, Common::AccessCounters::SlowPath);
     switch (GetRegion(addr)) {
     case Region::Bios:
         // Read only.
         break;
     case Region::XRam:
+        // Only reached for pages with write hooks, which the page table leaves out.
         WriteXRam(addr, data);
+        if (core.block_cache != nullptr) {
+            core.block_cache->CodeWritten(addr, sizeof(T));
+        }
+        core.hooks.Written(Common::Hooks::Wram, addr & xram_addr_mask & ~(sizeof(T) - 1), sizeof(T));
         break;
     case Region::IRam:
         WriteIRam(addr, data);
+        if (core.block_cache != nullptr) {
+            core.block_cache->CodeWritten(addr, sizeof(T));
+        }
+        core.hooks.Written(Common::Hooks::FastRam, addr & iram_addr_mask & ~(sizeof(T) - 1), sizeof(T));
         break;
     case Region::IO:
         WriteIO(addr, data);
@@ -324,7 +413,7 @@ void Memory::WriteMem(const u32 addr, const T data, bool dma) {
             }
 
             if (save_type == SaveType::Eeprom && eeprom_ready) {
-                eeprom_bitstream.push_back(data & 0x1);
+                PushEepromBit(data & 0x1);
             }
         }
         break;
@@ -359,87 +448,249 @@ int Memory::AccessTime(const u32 addr, AccessType access_type, bool force_sequen
     const bool sequential = force_sequential || (addr - last_addr) <= 4;
     last_addr = addr;
 
-    const auto RomTime = [this, sequential, access_type](int i) -> int {
-        int access_cycles;
-        if (sequential) {
-            access_cycles = wait_state_s[i] << u32_access;
+    const u32 region = std::min(addr >> 24, num_timing_regions - 1);
+    int access_cycles = access_timings[region][sizeof(T) / 2][sequential];
+
+    const bool rom_region = region >= static_cast<u32>(Region::Rom0_l) && region <= static_cast<u32>(Region::Eeprom);
+    if (rom_region && access_type == AccessType::Opcode && PrefetchEnabled()) {
+        if (ideal_prefetch) {
+            return sequential ? 1 << u32_access : access_cycles;
+        } else if (prefetched_opcodes > 0) {
+            prefetched_opcodes -= 1;
+            return 1 << u32_access;
         } else {
-            access_cycles = wait_state_n[i] + wait_state_s[i] * u32_access;
+            int free_cycles = std::min(access_cycles - (1 << u32_access), prefetch_cycles);
+            access_cycles -= free_cycles;
+            prefetch_cycles -= free_cycles;
         }
+    }
 
-        if (PrefetchEnabled() && access_type == AccessType::Opcode) {
-            if (prefetched_opcodes > 0) {
-                prefetched_opcodes -= 1;
-                return 1 << u32_access;
-            } else {
-                int free_cycles = std::min(access_cycles - (1 << u32_access), prefetch_cycles);
-                access_cycles -= free_cycles;
-                prefetch_cycles -= free_cycles;
+    // Data accesses made while running from ROM give the prefetcher time to fetch ahead.
+    if (access_type == AccessType::Normal && PrefetchEnabled() && core.cpu->GetPc() >= BaseAddr::Rom
+            && (addr < BaseAddr::Rom || addr >= BaseAddr::Max)) {
+        RunPrefetch(access_cycles);
+    }
+
+    return access_cycles;
+}
+
+template int Memory::AccessTime<u8>(const u32 addr, AccessType access_type, bool force_sequential);
+template int Memory::AccessTime<u16>(const u32 addr, AccessType access_type, bool force_sequential);
+template int Memory::AccessTime<u32>(const u32 addr, AccessType access_type, bool force_sequential);
+
+void Memory::BuildPageTables() {
+    // The memory vectors are never resized, so pointers into them stay valid. Like the rest of the memory code,
+    // reading them through byte pointers assumes a little-endian host.
+    // Pages holding a hooked address are left out of the table for that kind of access.
+    const auto MapMirrored = [this](u32 base, u32 region_size, u8* data, Common::Hooks::Region region) {
+        for (u32 addr = base; addr < base + 16 * mbyte; addr += page_size) {
+            const u32 offset = addr & (region_size - 1);
+            const u32 size = std::min(page_size, region_size);
+            const bool read_hooked = core.hooks.ReadsHooked(region, offset, size);
+            const bool write_hooked = core.hooks.WritesHooked(region, offset, size);
+            read_pages[addr >> page_shift] = read_hooked ? nullptr : data + offset;
+            write_pages[addr >> page_shift] = write_hooked ? nullptr : data + offset;
+        }
+    };
+
+    MapMirrored(BaseAddr::XRam, xram_size, reinterpret_cast<u8*>(xram.data()), Common::Hooks::Wram);
+    MapMirrored(BaseAddr::IRam, iram_size, reinterpret_cast<u8*>(iram.data()), Common::Hooks::FastRam);
+
+    // VRAM writes mark the backgrounds as dirty and 8-bit writes are special, so it's only mapped for reads.
+    // The upper 32KB is mirrored twice within each 128KB.
+    for (u32 addr = BaseAddr::VRam; addr < BaseAddr::Oam; addr += page_size) {
+        const u32 vram_addr = addr & ((addr & 0x0001'0000) ? vram_addr_mask2 : vram_addr_mask1);
+        read_pages[addr >> page_shift] = reinterpret_cast<const u8*>(vram.data()) + vram_addr;
+    }
+
+    // ROM pages past the end of the ROM read as zero, so leave them to ReadRom. EEPROM reads are never mapped.
+    const u8* rom_data = reinterpret_cast<const u8*>(rom.data());
+    for (u32 addr = BaseAddr::Rom; addr < BaseAddr::Eeprom; addr += page_size) {
+        const u32 rom_addr = addr & rom_addr_mask;
+        if (rom_addr + page_size <= rom_size) {
+            read_pages[addr >> page_shift] = rom_data + rom_addr;
+            if (!patched_rom_pages.empty()) {
+                const auto patched = patched_rom_pages.find(rom_addr);
+                if (patched != patched_rom_pages.end()) {
+                    read_pages[addr >> page_shift] = patched->second.data();
+                }
             }
         }
+    }
 
-        return access_cycles;
-    };
+    if (gpio_present) {
+        // The GPIO registers are in the first page of ROM.
+        read_pages[BaseAddr::Rom >> page_shift] = nullptr;
+    }
+}
+
+void Memory::PatchRom(const std::vector<Common::Cheat>& patches) {
+    patched_rom_pages.clear();
+    const u8* rom_data = reinterpret_cast<const u8*>(rom.data());
+    for (const auto& patch : patches) {
+        const u32 rom_addr = patch.addr & rom_addr_mask;
+        const u32 page_addr = rom_addr & ~(page_size - 1);
+        if (page_addr >= rom_size) {
+            continue;
+        }
+
+        // A partial page at the end of the ROM is padded out, since the bytes past the end still read as zero.
+        auto& page = patched_rom_pages[page_addr];
+        if (page.empty()) {
+            page.assign(page_size, 0);
+            std::copy_n(rom_data + page_addr, std::min(page_size, rom_size - page_addr), page.begin());
+        }
+        std::memcpy(page.data() + (rom_addr - page_addr), &patch.value, patch.size);
+    }
+
+    BuildPageTables();
+}
+
+const u8* Memory::DmaSourcePointer(u32 addr, u32& contiguous_bytes) const {
+    const u32 page = addr >> page_shift;
+    if (page < num_pages && read_pages[page] != nullptr) {
+        contiguous_bytes = page_size - (addr & (page_size - 1));
+        return read_pages[page] + (addr & (page_size - 1));
+    }
 
-    int access_cycles;
     switch (GetRegion(addr)) {
-    case Region::Bios:
-        access_cycles = 1;
-        break;
+    case Region::PRam:
+        contiguous_bytes = pram_size - (addr & pram_addr_mask);
+        return reinterpret_cast<const u8*>(pram.data()) + (addr & pram_addr_mask);
+    case Region::Oam:
+        contiguous_bytes = oam_size - (addr & oam_addr_mask);
+        return reinterpret_cast<const u8*>(oam.data()) + (addr & oam_addr_mask);
+    default:
+        return nullptr;
+    }
+}
+
+u8* Memory::DmaDestPointer(u32 addr, u32& contiguous_bytes) {
+    const u32 page = addr >> page_shift;
+    if (page < num_pages && write_pages[page] != nullptr) {
+        contiguous_bytes = page_size - (addr & (page_size - 1));
+        return write_pages[page] + (addr & (page_size - 1));
+    }
+
+    const Region region = GetRegion(addr);
+    if (region == Region::PRam || region == Region::VRam || region == Region::Oam) {
+        // The caller writes through the pointer straight away.
+        core.lcd->SyncRender();
+    }
+
+    switch (region) {
+    case Region::PRam:
+        contiguous_bytes = pram_size - (addr & pram_addr_mask);
+        return reinterpret_cast<u8*>(pram.data()) + (addr & pram_addr_mask);
+    case Region::VRam: {
+        // Stop at the page boundary, the same as the VRAM read pages, so the upper 32KB mirror is never crossed.
+        const u32 vram_addr = addr & ((addr & 0x0001'0000) ? vram_addr_mask2 : vram_addr_mask1);
+        contiguous_bytes = page_size - (addr & (page_size - 1));
+        return reinterpret_cast<u8*>(vram.data()) + vram_addr;
+    }
+    case Region::Oam:
+        contiguous_bytes = oam_size - (addr & oam_addr_mask);
+        return reinterpret_cast<u8*>(oam.data()) + (addr & oam_addr_mask);
+    default:
+        return nullptr;
+    }
+}
+
+int Memory::ReadBlock(u32 addr, u32* data, int count) {
+    const u32 page = addr >> page_shift;
+    const u32 offset = addr & (page_size - 4);
+    if (page < num_pages && read_pages[page] != nullptr && offset + 4 * count <= page_size) {
+        core.access_counters.AddRange(addr, 4 * count, 4, Common::AccessCounters::Read);
+        std::memcpy(data, read_pages[page] + offset, 4 * count);
+        return BlockAccessTime(addr, count);
+    }
+
+    int cycles = 0;
+    for (int i = 0; i < count; ++i, addr += 4) {
+        data[i] = ReadMem<u32>(addr);
+        cycles += AccessTime<u32>(addr);
+    }
+
+    return cycles;
+}
+
+int Memory::WriteBlock(u32 addr, const u32* data, int count) {
+    const u32 page = addr >> page_shift;
+    const u32 offset = addr & (page_size - 4);
+    if (page < num_pages && write_pages[page] != nullptr && offset + 4 * count <= page_size) {
+        for (int i = 0; i < count; ++i) {
+            core.disasm->MemoryWritten(addr + 4 * i);
+        }
+        core.access_counters.AddRange(addr, 4 * count, 4, Common::AccessCounters::Write);
+        std::memcpy(write_pages[page] + offset, data, 4 * count);
+        DmaBlockWritten(addr, 4 * count);
+        return BlockAccessTime(addr, count);
+    }
+
+    int cycles = 0;
+    for (int i = 0; i < count; ++i, addr += 4) {
+        WriteMem(addr, data[i]);
+        cycles += AccessTime<u32>(addr);
+    }
+
+    return cycles;
+}
+
+int Memory::BlockAccessTime(u32 addr, int count) {
+    // POP {PC} loads nothing through here.
+    if (count == 0) {
+        return 0;
+    }
+
+    int cycles = AccessTime<u32>(addr);
+    if (PrefetchEnabled() && core.cpu->GetPc() >= BaseAddr::Rom) {
+        // The prefetcher advances by at most one opcode per access, so the accesses can't be lumped together.
+        for (int i = 1; i < count; ++i) {
+            cycles += AccessTime<u32>(addr + 4 * i);
+        }
+        return cycles;
+    }
+
+    // Every access after the first is sequential, and they're all in the same region.
+    const u32 region = std::min(addr >> 24, num_timing_regions - 1);
+    cycles += (count - 1) * access_timings[region][2][1];
+    last_addr = addr + 4 * (count - 1);
+
+    return cycles;
+}
+
+void Memory::DmaBlockWritten(u32 addr, u32 bytes) {
+    switch (GetRegion(addr)) {
     case Region::XRam:
-        access_cycles = 3 << u32_access;
-        break;
     case Region::IRam:
-        access_cycles = 1;
+        if (core.block_cache != nullptr) {
+            for (u32 code_addr = addr; code_addr < addr + bytes;) {
+                const u32 end = std::min(addr + bytes, (code_addr & BlockCache::page_mask) + BlockCache::page_size);
+                core.block_cache->CodeWritten(code_addr, end - code_addr);
+                code_addr = end;
+            }
+        }
         break;
-    case Region::IO:
-        // Despite being 16 bits wide, 32-bit accesses to IO registers do not incur an extra wait state.
-        // Apparently the 16-bit registers are packaged together in pairs.
-        access_cycles = 1;
+    case Region::VRam:
+        if ((addr & 0x0001'0000) == 0) {
+            core.lcd->bg_dirty = true;
+        }
+
+        // DMA bursts stop at page boundaries, so the written range never crosses a VRAM mirror.
+        core.lcd->VramWritten(addr & ((addr & 0x0001'0000) ? vram_addr_mask2 : vram_addr_mask1), bytes);
         break;
     case Region::PRam:
-        access_cycles = 1 << u32_access;
-        break;
-    case Region::VRam:
-        access_cycles = 1 << u32_access;
+        core.lcd->PramWritten(addr & pram_addr_mask);
+        core.lcd->PramWritten((addr + bytes - 1) & pram_addr_mask);
         break;
     case Region::Oam:
-        access_cycles = 1;
-        break;
-    case Region::Rom0_l:
-    case Region::Rom0_h:
-        access_cycles = RomTime(0);
-        break;
-    case Region::Rom1_l:
-    case Region::Rom1_h:
-        access_cycles = RomTime(1);
-        break;
-    case Region::Rom2_l:
-    case Region::Eeprom:
-        access_cycles = RomTime(2);
-        break;
-    case Region::SRam_l:
-    case Region::SRam_h:
-        access_cycles = wait_state_sram;
+        core.lcd->OamWritten(addr & oam_addr_mask, bytes);
         break;
     default:
-        access_cycles = 1;
         break;
     }
-
-    if (PrefetchEnabled() && core.cpu->GetPc() >= BaseAddr::Rom
-                          && (addr < BaseAddr::Rom || addr >= BaseAddr::Max)
-                          && access_type == AccessType::Normal) {
-        RunPrefetch(access_cycles);
-    }
-
-    return access_cycles;
 }
 
-template int Memory::AccessTime<u8>(const u32 addr, AccessType access_type, bool force_sequential);
-template int Memory::AccessTime<u16>(const u32 addr, AccessType access_type, bool force_sequential);
-template int Memory::AccessTime<u32>(const u32 addr, AccessType access_type, bool force_sequential);
-
 void Memory::UpdateWaitStates() {
     auto WaitStates = [this](int shift) {
         u16 mask = 0x3 << shift;
@@ -457,43 +708,79 @@ void Memory::UpdateWaitStates() {
     wait_state_s[1] = 1 + ((waitcnt & 0x080) ? 1 : 4);
     wait_state_n[2] = 1 + WaitStates(8);
     wait_state_s[2] = 1 + ((waitcnt & 0x400) ? 1 : 8);
+
+    for (u32 region = 0; region < num_timing_regions; ++region) {
+        for (int width = 0; width < 3; ++width) {
+            const int u32_access = (width == 2) ? 1 : 0;
+
+            for (int sequential = 0; sequential < 2; ++sequential) {
+                const auto RomTime = [this, u32_access, sequential](int i) {
+                    if (sequential) {
+                        return wait_state_s[i] << u32_access;
+                    } else {
+                        return wait_state_n[i] + wait_state_s[i] * u32_access;
+                    }
+                };
+
+                int access_cycles;
+                switch (static_cast<Region>(region)) {
+                case Region::XRam:
+                    access_cycles = 3 << u32_access;
+                    break;
+                case Region::PRam:
+                case Region::VRam:
+                    access_cycles = 1 << u32_access;
+                    break;
+                case Region::Rom0_l:
+                case Region::Rom0_h:
+                    access_cycles = RomTime(0);
+                    break;
+                case Region::Rom1_l:
+                case Region::Rom1_h:
+                    access_cycles = RomTime(1);
+                    break;
+                case Region::Rom2_l:
+                case Region::Eeprom:
+                    access_cycles = RomTime(2);
+                    break;
+                case Region::SRam_l:
+                case Region::SRam_h:
+                    access_cycles = wait_state_sram;
+                    break;
+                default:
+                    // BIOS, IWRAM, OAM, and IO are all single cycle. Despite being 16 bits wide, 32-bit accesses
+                    // to IO registers do not incur an extra wait state. Apparently the 16-bit registers are
+                    // packaged together in pairs.
+                    access_cycles = 1;
+                    break;
+                }
+
+                access_timings[region][width][sequential] = access_cycles;
+            }
+        }
+    }
 }
 
 void Memory::RunPrefetch(int cycles) {
+    // Ideal prefetching doesn't keep track of the buffer.
+    if (ideal_prefetch) {
+        return;
+    }
+
     prefetch_cycles += cycles;
 
-    int wait_states;
-    switch (GetRegion(core.cpu->GetPc())) {
-    case Region::Rom0_l:
-    case Region::Rom0_h:
-        wait_states = wait_state_s[0];
-        break;
-    case Region::Rom1_l:
-    case Region::Rom1_h:
-        wait_states = wait_state_s[1];
-        break;
-    case Region::Rom2_l:
-    case Region::Eeprom:
-        wait_states = wait_state_s[2];
-        break;
-    default:
+    const u32 region = std::min(core.cpu->GetPc() >> 24, num_timing_regions - 1);
+    if (region < static_cast<u32>(Region::Rom0_l) || region > static_cast<u32>(Region::Eeprom)) {
         throw std::runtime_error("Ran prefetch while the PC is not in ROM.");
-        break;
     }
 
-    wait_states -= 1;
-
-    if (core.cpu->ThumbMode()) {
-        if (prefetch_cycles >= wait_states) {
-            prefetched_opcodes = std::min(prefetched_opcodes + 1, 8);
-            prefetch_cycles -= wait_states;
-        }
-    } else {
-        wait_states *= 2;
-        if (prefetch_cycles >= wait_states) {
-            prefetched_opcodes = std::min(prefetched_opcodes + 1, 4);
-            prefetch_cycles -= wait_states;
-        }
+    // Prefetching an opcode takes the wait states of a sequential fetch of it, which are already in the access
+    // time table.
+    const bool thumb = core.cpu->ThumbMode();
+    const int wait_states = (thumb) ? access_timings[region][1][1] - 1 : access_timings[region][2][1] - 2;
+    if (prefetch_cycles >= wait_states) {
+        prefetched_opcodes = std::min(prefetched_opcodes + 1, (thumb) ? 8 : 4);
+        prefetch_cycles -= wait_states;
     }
 }
 
@@ -564,9 +851,30 @@ u8 Memory::ReadIO(const u32 addr) const {
     return ReadIO<u16>(addr) >> (8 * (addr & 0x1));
 }
 
+template <>
+u16 Memory::ReadIO(const u32 addr) const {
+    const u32 index = (addr - BaseAddr::IO) >> 1;
+    if (index >= io_table_size) {
+        return ReadOpenBus();
+    }
+
+    const IOReadEntry& entry = io_reads[index];
+    if (entry.reg != nullptr) {
+        return entry.reg->Read();
+    }
+
+    return entry.handler(*this, addr);
+}
+
 template <>
 void Memory::WriteIO(const u32 addr, const u32 data, const u16) {
     // 32 bit writes must be aligned.
+    const u32 index = (addr - BaseAddr::IO) >> 2;
+    if (index < io_word_writes.size() && io_word_writes[index] != nullptr) {
+        io_word_writes[index](*this, addr & ~0x3, data);
+        return;
+    }
+
     WriteIO<u16>(addr & ~0x3, data);
     WriteIO<u16>((addr & ~0x3) + 2, data >> 16);
 }
@@ -578,503 +886,300 @@ void Memory::WriteIO(const u32 addr, const u8 data, const u16) {
 }
 
 template <>
-u16 Memory::ReadIO(const u32 addr) const {
-    switch (addr & ~0x1) {
-    case DISPCNT:
-        return core.lcd->control.Read();
-    case GREENSWAP:
-        return core.lcd->green_swap.Read();
-    case DISPSTAT:
-        return core.lcd->status.Read();
-    case VCOUNT:
-        return core.lcd->vcount.Read();
-    case BG0CNT:
-        return core.lcd->bgs[0].control.Read();
-    case BG1CNT:
-        return core.lcd->bgs[1].control.Read();
-    case BG2CNT:
-        return core.lcd->bgs[2].control.Read();
-    case BG3CNT:
-        return core.lcd->bgs[3].control.Read();
-    case WININ:
-        return core.lcd->winin.Read();
-    case WINOUT:
-        return core.lcd->winout.Read();
-    case BLDCNT:
-        return core.lcd->blend_control.Read();
-    case BLDALPHA:
-        return core.lcd->blend_alpha.Read();
-    case SOUND1CNT_L:
-        return core.audio->square1.ReadSweepGba();
-    case SOUND1CNT_H:
-        return core.audio->square1.ReadDutyAndEnvelopeGba();
-    case SOUND1CNT_X:
-        return core.audio->square1.ReadResetGba();
-    case INVALID_66:
-        return 0x0000;
-    case SOUND2CNT_L:
-        return core.audio->square2.ReadDutyAndEnvelopeGba();
-    case SOUND2CNT_H:
-        return core.audio->square2.ReadResetGba();
-    case INVALID_6E:
-        return 0x0000;
-    case SOUND3CNT_L:
-        return core.audio->wave.ReadSweepGba();
-    case SOUND3CNT_H:
-        return core.audio->wave.ReadDutyAndEnvelopeGba();
-    case SOUND3CNT_X:
-        return core.audio->wave.ReadResetGba();
-    case INVALID_76:
-        return 0x0000;
-    case SOUND4CNT_L:
-        return core.audio->noise.ReadDutyAndEnvelopeGba();
-    case INVALID_7A:
-        return 0x0000;
-    case SOUND4CNT_H:
-        return core.audio->noise.ReadResetGba();
-    case INVALID_7E:
-        return 0x0000;
-    case SOUNDCNT_L:
-        return core.audio->psg_control.Read();
-    case SOUNDCNT_H:
-        return core.audio->fifo_control.Read();
-    case SOUNDCNT_X:
-        return core.audio->ReadSoundOn();
-    case INVALID_86:
-        return 0x0000;
-    case SOUNDBIAS:
-        return core.audio->soundbias.Read();
-    case INVALID_8A:
-        return 0x0000;
-    case WAVE_RAM0_L:
-    case WAVE_RAM0_H:
-    case WAVE_RAM1_L:
-    case WAVE_RAM1_H:
-    case WAVE_RAM2_L:
-    case WAVE_RAM2_H:
-    case WAVE_RAM3_L:
-    case WAVE_RAM3_H: {
-        const u32 wave_ram_addr = addr - WAVE_RAM0_L + core.audio->wave.AccessibleBankOffset();
-        return core.audio->wave_ram[wave_ram_addr] | (core.audio->wave_ram[wave_ram_addr + 1] << 8);
+void Memory::WriteIO(const u32 addr, const u16 data, const u16 mask) {
+    const u32 index = (addr - BaseAddr::IO) >> 1;
+    if (index >= io_table_size) {
+        return;
     }
-    case DMA0CNT_L:
-        return 0x0000;
-    case DMA0CNT_H:
-        return core.dma[0].control.Read();
-    case DMA1CNT_L:
-        return 0x0000;
-    case DMA1CNT_H:
-        return core.dma[1].control.Read();
-    case DMA2CNT_L:
-        return 0x0000;
-    case DMA2CNT_H:
-        return core.dma[2].control.Read();
-    case DMA3CNT_L:
-        return 0x0000;
-    case DMA3CNT_H:
-        return core.dma[3].control.Read();
-    case TM0CNT_L:
-        return core.timers[0].ReadCounter();
-    case TM0CNT_H:
-        return core.timers[0].control.Read();
-    case TM1CNT_L:
-        return core.timers[1].ReadCounter();
-    case TM1CNT_H:
-        return core.timers[1].control.Read();
-    case TM2CNT_L:
-        return core.timers[2].ReadCounter();
-    case TM2CNT_H:
-        return core.timers[2].control.Read();
-    case TM3CNT_L:
-        return core.timers[3].ReadCounter();
-    case TM3CNT_H:
-        return core.timers[3].control.Read();
-    case SIOMULTI0:
-        return core.serial->data0.Read();
-    case SIOMULTI1:
-        return core.serial->data1.Read();
-    case SIOMULTI2:
-        return core.serial->data2.Read();
-    case SIOMULTI3:
-        return core.serial->data3.Read();
-    case SIOCNT:
-        return core.serial->control.Read();
-    case SIOMLTSEND:
-        return core.serial->send.Read();
-    case KEYINPUT:
-        return core.keypad->input.Read();
-    case KEYCNT:
-        return core.keypad->control.Read();
-    case RCNT:
-        return core.serial->mode.Read();
-    case JOYCNT:
-        return core.serial->joybus_control.Read();
-    case JOYRECV_L:
-        core.serial->joybus_status &= ~Serial::joystat_recv;
-        return core.serial->joybus_recv_l.Read();
-    case JOYRECV_H:
-        core.serial->joybus_status &= ~Serial::joystat_recv;
-        return core.serial->joybus_recv_h.Read();
-    case JOYTRANS_L:
-        return core.serial->joybus_trans_l.Read();
-    case JOYTRANS_H:
-        return core.serial->joybus_trans_h.Read();
-    case JOYSTAT:
-        return core.serial->joybus_status.Read();
-    case IE:
-        return intr_enable.Read();
-    case IF:
-        return intr_flags.Read();
-    case WAITCNT:
-        return waitcnt.Read();
-    case IME:
-        return master_enable.Read();
-    case HALTCNT:
-        return haltcnt.Read();
-    default:
-        return ReadOpenBus();
+
+    if ((addr & ~0x1) <= BLDY) {
+        // Don't change the LCD registers under scanlines that are still waiting to be drawn.
+        core.lcd->SyncRender();
+    }
+
+    const IOWriteEntry& entry = io_writes[index];
+    if (entry.reg != nullptr) {
+        entry.reg->Write(data, mask);
+    } else if (entry.handler != nullptr) {
+        entry.handler(*this, addr, data, mask);
     }
 }
 
-template <>
-void Memory::WriteIO(const u32 addr, const u16 data, const u16 mask) {
-    switch (addr & ~0x1) {
-    case DISPCNT:
-        core.lcd->WriteControl(data, mask);
-        break;
-    case GREENSWAP:
-        core.lcd->green_swap.Write(data, mask);
-        break;
-    case DISPSTAT:
-        core.lcd->status.Write(data, mask);
-        break;
-    case BG0CNT:
-        core.lcd->bgs[0].control.Write(data, mask);
-        core.lcd->bgs[0].dirty = true;
-        break;
-    case BG1CNT:
-        core.lcd->bgs[1].control.Write(data, mask);
-        core.lcd->bgs[1].dirty = true;
-        break;
-    case BG2CNT:
-        core.lcd->bgs[2].control.Write(data, mask);
-        core.lcd->bgs[2].dirty = true;
-        break;
-    case BG3CNT:
-        core.lcd->bgs[3].control.Write(data, mask);
-        core.lcd->bgs[3].dirty = true;
-        break;
-    case BG0HOFS:
-        core.lcd->bgs[0].scroll_x.Write(data, mask);
-        break;
-    case BG0VOFS:
-        core.lcd->bgs[0].scroll_y.Write(data, mask);
-        break;
-    case BG1HOFS:
-        core.lcd->bgs[1].scroll_x.Write(data, mask);
-        break;
-    case BG1VOFS:
-        core.lcd->bgs[1].scroll_y.Write(data, mask);
-        break;
-    case BG2HOFS:
-        core.lcd->bgs[2].scroll_x.Write(data, mask);
-        break;
-    case BG2VOFS:
-        core.lcd->bgs[2].scroll_y.Write(data, mask);
-        break;
-    case BG3HOFS:
-        core.lcd->bgs[3].scroll_x.Write(data, mask);
-        break;
-    case BG3VOFS:
-        core.lcd->bgs[3].scroll_y.Write(data, mask);
-        break;
-    case BG2PA:
-        core.lcd->bgs[2].affine_a.Write(data, mask);
-        break;
-    case BG2PB:
-        core.lcd->bgs[2].affine_b.Write(data, mask);
-        break;
-    case BG2PC:
-        core.lcd->bgs[2].affine_c.Write(data, mask);
-        break;
-    case BG2PD:
-        core.lcd->bgs[2].affine_d.Write(data, mask);
-        break;
-    case BG2X_L:
-        core.lcd->bgs[2].offset_x_l.Write(data, mask);
-        core.lcd->bgs[2].LatchReferencePointX();
-        break;
-    case BG2X_H:
-        core.lcd->bgs[2].offset_x_h.Write(data, mask);
-        core.lcd->bgs[2].LatchReferencePointX();
-        break;
-    case BG2Y_L:
-        core.lcd->bgs[2].offset_y_l.Write(data, mask);
-        core.lcd->bgs[2].LatchReferencePointY();
-        break;
-    case BG2Y_H:
-        core.lcd->bgs[2].offset_y_h.Write(data, mask);
-        core.lcd->bgs[2].LatchReferencePointY();
-        break;
-    case BG3PA:
-        core.lcd->bgs[3].affine_a.Write(data, mask);
-        break;
-    case BG3PB:
-        core.lcd->bgs[3].affine_b.Write(data, mask);
-        break;
-    case BG3PC:
-        core.lcd->bgs[3].affine_c.Write(data, mask);
-        break;
-    case BG3PD:
-        core.lcd->bgs[3].affine_d.Write(data, mask);
-        break;
-    case BG3X_L:
-        core.lcd->bgs[3].offset_x_l.Write(data, mask);
-        core.lcd->bgs[3].LatchReferencePointX();
-        break;
-    case BG3X_H:
-        core.lcd->bgs[3].offset_x_h.Write(data, mask);
-        core.lcd->bgs[3].LatchReferencePointX();
-        break;
-    case BG3Y_L:
-        core.lcd->bgs[3].offset_y_l.Write(data, mask);
-        core.lcd->bgs[3].LatchReferencePointY();
-        break;
-    case BG3Y_H:
-        core.lcd->bgs[3].offset_y_h.Write(data, mask);
-        core.lcd->bgs[3].LatchReferencePointY();
-        break;
-    case WIN0H:
-        core.lcd->windows[0].width.Write(data, mask);
-        break;
-    case WIN1H:
-        core.lcd->windows[1].width.Write(data, mask);
-        break;
-    case WIN0V:
-        core.lcd->windows[0].height.Write(data, mask);
-        break;
-    case WIN1V:
-        core.lcd->windows[1].height.Write(data, mask);
-        break;
-    case WININ:
-        core.lcd->winin.Write(data, mask);
-        break;
-    case WINOUT:
-        core.lcd->winout.Write(data, mask);
-        break;
-    case MOSAIC:
-        core.lcd->mosaic.Write(data, mask);
-        break;
-    case BLDCNT:
-        core.lcd->blend_control.Write(data, mask);
-        break;
-    case BLDALPHA:
-        core.lcd->blend_alpha.Write(data, mask);
-        break;
-    case BLDY:
-        core.lcd->blend_fade.Write(data, mask);
-        break;
-    case SOUND1CNT_L:
-    case SOUND1CNT_H:
-    case SOUND1CNT_X:
-    case SOUND2CNT_L:
-    case SOUND2CNT_H:
-    case SOUND3CNT_L:
-    case SOUND3CNT_H:
-    case SOUND3CNT_X:
-    case SOUND4CNT_L:
-    case SOUND4CNT_H:
-    case SOUNDCNT_L:
-    case SOUNDCNT_H:
-    case SOUNDCNT_X:
-    case SOUNDBIAS:
-    case WAVE_RAM0_L:
-    case WAVE_RAM0_H:
-    case WAVE_RAM1_L:
-    case WAVE_RAM1_H:
-    case WAVE_RAM2_L:
-    case WAVE_RAM2_H:
-    case WAVE_RAM3_L:
-    case WAVE_RAM3_H:
-        core.audio->WriteSoundRegs(addr, data, mask);
-        break;
-    case FIFO_A_L:
-    case FIFO_A_H:
-        core.audio->fifos[0].Write(data, mask);
-        break;
-    case FIFO_B_L:
-    case FIFO_B_H:
-        core.audio->fifos[1].Write(data, mask);
-        break;
-    case DMA0SAD_L:
-        core.dma[0].source_l.Write(data, mask);
-        break;
-    case DMA0SAD_H:
-        core.dma[0].source_h.Write(data, mask);
-        break;
-    case DMA0DAD_L:
-        core.dma[0].dest_l.Write(data, mask);
-        break;
-    case DMA0DAD_H:
-        core.dma[0].dest_h.Write(data, mask);
-        break;
-    case DMA0CNT_L:
-        core.dma[0].word_count.Write(data, mask);
-        break;
-    case DMA0CNT_H:
-        core.dma[0].WriteControl(data, mask);
-        break;
-    case DMA1SAD_L:
-        core.dma[1].source_l.Write(data, mask);
-        break;
-    case DMA1SAD_H:
-        core.dma[1].source_h.Write(data, mask);
-        break;
-    case DMA1DAD_L:
-        core.dma[1].dest_l.Write(data, mask);
-        break;
-    case DMA1DAD_H:
-        core.dma[1].dest_h.Write(data, mask);
-        break;
-    case DMA1CNT_L:
-        core.dma[1].word_count.Write(data, mask);
-        break;
-    case DMA1CNT_H:
-        core.dma[1].WriteControl(data, mask);
-        break;
-    case DMA2SAD_L:
-        core.dma[2].source_l.Write(data, mask);
-        break;
-    case DMA2SAD_H:
-        core.dma[2].source_h.Write(data, mask);
-        break;
-    case DMA2DAD_L:
-        core.dma[2].dest_l.Write(data, mask);
-        break;
-    case DMA2DAD_H:
-        core.dma[2].dest_h.Write(data, mask);
-        break;
-    case DMA2CNT_L:
-        core.dma[2].word_count.Write(data, mask);
-        break;
-    case DMA2CNT_H:
-        core.dma[2].WriteControl(data, mask);
-        break;
-    case DMA3SAD_L:
-        core.dma[3].source_l.Write(data, mask);
-        break;
-    case DMA3SAD_H:
-        core.dma[3].source_h.Write(data, mask);
-        break;
-    case DMA3DAD_L:
-        core.dma[3].dest_l.Write(data, mask);
-        break;
-    case DMA3DAD_H:
-        core.dma[3].dest_h.Write(data, mask);
-        break;
-    case DMA3CNT_L:
-        core.dma[3].word_count.Write(data, mask);
-        break;
-    case DMA3CNT_H:
-        core.dma[3].WriteControl(data, mask);
-        break;
-    case TM0CNT_L:
-        core.timers[0].WriteReload(data, mask);
-        break;
-    case TM0CNT_H:
-        core.timers[0].WriteControl(data, mask);
-        break;
-    case TM1CNT_L:
-        core.timers[1].WriteReload(data, mask);
-        break;
-    case TM1CNT_H:
-        core.timers[1].WriteControl(data, mask);
-        break;
-    case TM2CNT_L:
-        core.timers[2].WriteReload(data, mask);
-        break;
-    case TM2CNT_H:
-        core.timers[2].WriteControl(data, mask);
-        break;
-    case TM3CNT_L:
-        core.timers[3].WriteReload(data, mask);
-        break;
-    case TM3CNT_H:
-        core.timers[3].WriteControl(data, mask);
-        break;
-    case SIOMULTI0:
-        core.serial->data0.Write(data, mask);
-        break;
-    case SIOMULTI1:
-        core.serial->data1.Write(data, mask);
-        break;
-    case SIOMULTI2:
-        core.serial->data2.Write(data, mask);
-        break;
-    case SIOMULTI3:
-        core.serial->data3.Write(data, mask);
-        break;
-    case SIOCNT:
-        core.serial->control.Write(data, mask);
-        break;
-    case SIOMLTSEND:
-        core.serial->send.Write(data, mask);
-        break;
-    case KEYCNT:
-        core.keypad->control.Write(data, mask);
-        break;
-    case RCNT:
-        core.serial->mode.Write(data, mask);
-        break;
-    case JOYCNT:
+void Memory::PopulateIOTables() {
+    auto read = [this](u32 addr, const IOReg& reg) { io_reads[(addr - BaseAddr::IO) >> 1] = {&reg, nullptr}; };
+    auto read_handler = [this](u32 addr, IOReadHandler handler) {
+        io_reads[(addr - BaseAddr::IO) >> 1] = {nullptr, handler};
+    };
+    auto write = [this](u32 addr, IOReg& reg) { io_writes[(addr - BaseAddr::IO) >> 1] = {&reg, nullptr}; };
+    auto write_handler = [this](u32 addr, IOWriteHandler handler) {
+        io_writes[(addr - BaseAddr::IO) >> 1] = {nullptr, handler};
+    };
+    auto word_write_handler = [this](u32 addr, IOWordWriteHandler handler) {
+        io_word_writes[(addr - BaseAddr::IO) >> 2] = handler;
+    };
+
+    // Anything not filled in below reads as open bus and ignores writes.
+    for (auto& entry : io_reads) {
+        entry = {nullptr, [](const Memory& mem, u32) -> u16 { return mem.ReadOpenBus(); }};
+    }
+    const IOReadHandler read_zero = [](const Memory&, u32) -> u16 { return 0x0000; };
+
+    Lcd& lcd = *core.lcd;
+    read(DISPCNT, lcd.control);
+    write_handler(DISPCNT, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.lcd->WriteControl(data, mask); });
+    read(GREENSWAP, lcd.green_swap);
+    write(GREENSWAP, lcd.green_swap);
+    read(DISPSTAT, lcd.status);
+    write(DISPSTAT, lcd.status);
+    read(VCOUNT, lcd.vcount);
+
+    for (int i = 0; i < 4; ++i) {
+        Bg& bg = lcd.bgs[i];
+        read(BG0CNT + 2 * i, bg.control);
+        write_handler(BG0CNT + 2 * i, [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            Bg& _bg = mem.core.lcd->bgs[((addr & ~0x1) - BG0CNT) / 2];
+            _bg.control.Write(data, mask);
+            _bg.dirty = true;
+        });
+        write(BG0HOFS + 4 * i, bg.scroll_x);
+        write(BG0VOFS + 4 * i, bg.scroll_y);
+    }
+
+    for (int i = 2; i < 4; ++i) {
+        Bg& bg = lcd.bgs[i];
+        const u32 base = BG2PA + (i - 2) * (BG3PA - BG2PA);
+        write(base + (BG2PA - BG2PA), bg.affine_a);
+        write(base + (BG2PB - BG2PA), bg.affine_b);
+        write(base + (BG2PC - BG2PA), bg.affine_c);
+        write(base + (BG2PD - BG2PA), bg.affine_d);
+        write_handler(base + (BG2X_L - BG2PA), [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            Bg& _bg = mem.core.lcd->bgs[((addr & ~0x1) < BG3PA) ? 2 : 3];
+            _bg.offset_x_l.Write(data, mask);
+            _bg.LatchReferencePointX();
+        });
+        write_handler(base + (BG2X_H - BG2PA), [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            Bg& _bg = mem.core.lcd->bgs[((addr & ~0x1) < BG3PA) ? 2 : 3];
+            _bg.offset_x_h.Write(data, mask);
+            _bg.LatchReferencePointX();
+        });
+        write_handler(base + (BG2Y_L - BG2PA), [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            Bg& _bg = mem.core.lcd->bgs[((addr & ~0x1) < BG3PA) ? 2 : 3];
+            _bg.offset_y_l.Write(data, mask);
+            _bg.LatchReferencePointY();
+        });
+        write_handler(base + (BG2Y_H - BG2PA), [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            Bg& _bg = mem.core.lcd->bgs[((addr & ~0x1) < BG3PA) ? 2 : 3];
+            _bg.offset_y_h.Write(data, mask);
+            _bg.LatchReferencePointY();
+        });
+    }
+
+    write(WIN0H, lcd.windows[0].width);
+    write(WIN1H, lcd.windows[1].width);
+    write(WIN0V, lcd.windows[0].height);
+    write(WIN1V, lcd.windows[1].height);
+    read(WININ, lcd.winin);
+    write(WININ, lcd.winin);
+    read(WINOUT, lcd.winout);
+    write(WINOUT, lcd.winout);
+    write(MOSAIC, lcd.mosaic);
+    read(BLDCNT, lcd.blend_control);
+    write(BLDCNT, lcd.blend_control);
+    read(BLDALPHA, lcd.blend_alpha);
+    write_handler(BLDALPHA, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.lcd->WriteBlendAlpha(data, mask); });
+    write_handler(BLDY, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.lcd->WriteBlendFade(data, mask); });
+
+    Audio& audio = *core.audio;
+    read_handler(SOUND1CNT_L, [](const Memory& mem, u32) -> u16 { return mem.core.audio->square1.ReadSweepGba(); });
+    read_handler(SOUND1CNT_H, [](const Memory& mem, u32) -> u16 {
+        return mem.core.audio->square1.ReadDutyAndEnvelopeGba();
+    });
+    read_handler(SOUND1CNT_X, [](const Memory& mem, u32) -> u16 { return mem.core.audio->square1.ReadResetGba(); });
+    read_handler(INVALID_66, read_zero);
+    read_handler(SOUND2CNT_L, [](const Memory& mem, u32) -> u16 {
+        return mem.core.audio->square2.ReadDutyAndEnvelopeGba();
+    });
+    read_handler(SOUND2CNT_H, [](const Memory& mem, u32) -> u16 { return mem.core.audio->square2.ReadResetGba(); });
+    read_handler(INVALID_6E, read_zero);
+    read_handler(SOUND3CNT_L, [](const Memory& mem, u32) -> u16 { return mem.core.audio->wave.ReadSweepGba(); });
+    read_handler(SOUND3CNT_H, [](const Memory& mem, u32) -> u16 {
+        return mem.core.audio->wave.ReadDutyAndEnvelopeGba();
+    });
+    read_handler(SOUND3CNT_X, [](const Memory& mem, u32) -> u16 { return mem.core.audio->wave.ReadResetGba(); });
+    read_handler(INVALID_76, read_zero);
+    read_handler(SOUND4CNT_L, [](const Memory& mem, u32) -> u16 {
+        return mem.core.audio->noise.ReadDutyAndEnvelopeGba();
+    });
+    read_handler(INVALID_7A, read_zero);
+    read_handler(SOUND4CNT_H, [](const Memory& mem, u32) -> u16 { return mem.core.audio->noise.ReadResetGba(); });
+    read_handler(INVALID_7E, read_zero);
+    read(SOUNDCNT_L, audio.psg_control);
+    read(SOUNDCNT_H, audio.fifo_control);
+    read_handler(SOUNDCNT_X, [](const Memory& mem, u32) -> u16 { return mem.core.audio->ReadSoundOn(); });
+    read_handler(INVALID_86, read_zero);
+    read(SOUNDBIAS, audio.soundbias);
+    read_handler(INVALID_8A, read_zero);
+
+    for (u32 addr : {SOUND1CNT_L, SOUND1CNT_H, SOUND1CNT_X, SOUND2CNT_L, SOUND2CNT_H, SOUND3CNT_L, SOUND3CNT_H,
+                     SOUND3CNT_X, SOUND4CNT_L, SOUND4CNT_H, SOUNDCNT_L, SOUNDCNT_H, SOUNDCNT_X, SOUNDBIAS}) {
+        write_handler(addr, [](Memory& mem, u32 _addr, u16 data, u16 mask) {
+            mem.core.audio->WriteSoundRegs(_addr, data, mask);
+        });
+    }
+
+    for (u32 addr = WAVE_RAM0_L; addr <= WAVE_RAM3_H; addr += 2) {
+        read_handler(addr, [](const Memory& mem, u32 _addr) -> u16 {
+            const Audio& _audio = *mem.core.audio;
+            const u32 wave_ram_addr = _addr - WAVE_RAM0_L + _audio.wave.AccessibleBankOffset();
+            return _audio.wave_ram[wave_ram_addr] | (_audio.wave_ram[wave_ram_addr + 1] << 8);
+        });
+        write_handler(addr, [](Memory& mem, u32 _addr, u16 data, u16 mask) {
+            mem.core.audio->WriteSoundRegs(_addr, data, mask);
+        });
+    }
+
+    write_handler(FIFO_A_L, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.audio->fifos[0].Write(data, mask); });
+    write_handler(FIFO_A_H, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.audio->fifos[0].Write(data, mask); });
+    write_handler(FIFO_B_L, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.audio->fifos[1].Write(data, mask); });
+    write_handler(FIFO_B_H, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.audio->fifos[1].Write(data, mask); });
+    word_write_handler(FIFO_A_L, [](Memory& mem, u32, u32 data) {
+        mem.core.audio->fifos[0].Write(data, 0xFFFF);
+        mem.core.audio->fifos[0].Write(data >> 16, 0xFFFF);
+    });
+    word_write_handler(FIFO_B_L, [](Memory& mem, u32, u32 data) {
+        mem.core.audio->fifos[1].Write(data, 0xFFFF);
+        mem.core.audio->fifos[1].Write(data >> 16, 0xFFFF);
+    });
+
+    for (int i = 0; i < 4; ++i) {
+        Dma& dma = core.dma[i];
+        const u32 base = DMA0SAD_L + i * (DMA1SAD_L - DMA0SAD_L);
+        write(base + (DMA0SAD_L - DMA0SAD_L), dma.source_l);
+        write(base + (DMA0SAD_H - DMA0SAD_L), dma.source_h);
+        write(base + (DMA0DAD_L - DMA0SAD_L), dma.dest_l);
+        write(base + (DMA0DAD_H - DMA0SAD_L), dma.dest_h);
+        read_handler(base + (DMA0CNT_L - DMA0SAD_L), read_zero);
+        write(base + (DMA0CNT_L - DMA0SAD_L), dma.word_count);
+        read(base + (DMA0CNT_H - DMA0SAD_L), dma.control);
+        write_handler(base + (DMA0CNT_H - DMA0SAD_L), [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            mem.core.dma[((addr & ~0x1) - DMA0SAD_L) / (DMA1SAD_L - DMA0SAD_L)].WriteControl(data, mask);
+        });
+        word_write_handler(base + (DMA0SAD_L - DMA0SAD_L), [](Memory& mem, u32 addr, u32 data) {
+            Dma& _dma = mem.core.dma[(addr - DMA0SAD_L) / (DMA1SAD_L - DMA0SAD_L)];
+            _dma.source_l.Write(data);
+            _dma.source_h.Write(data >> 16);
+        });
+        word_write_handler(base + (DMA0DAD_L - DMA0SAD_L), [](Memory& mem, u32 addr, u32 data) {
+            Dma& _dma = mem.core.dma[(addr - DMA0SAD_L) / (DMA1SAD_L - DMA0SAD_L)];
+            _dma.dest_l.Write(data);
+            _dma.dest_h.Write(data >> 16);
+        });
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        Timer& timer = core.timers[i];
+        const u32 base = TM0CNT_L + i * (TM1CNT_L - TM0CNT_L);
+        read_handler(base, [](const Memory& mem, u32 addr) -> u16 {
+            return mem.core.timers[((addr & ~0x1) - TM0CNT_L) / 4].ReadCounter();
+        });
+        write_handler(base, [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            mem.core.timers[((addr & ~0x1) - TM0CNT_L) / 4].WriteReload(data, mask);
+        });
+        read(base + 2, timer.control);
+        write_handler(base + 2, [](Memory& mem, u32 addr, u16 data, u16 mask) {
+            mem.core.timers[((addr & ~0x1) - TM0CNT_L) / 4].WriteControl(data, mask);
+        });
+    }
+
+    Serial& serial = *core.serial;
+    read(SIOMULTI0, serial.data0);
+    write(SIOMULTI0, serial.data0);
+    read(SIOMULTI1, serial.data1);
+    write(SIOMULTI1, serial.data1);
+    read(SIOMULTI2, serial.data2);
+    write(SIOMULTI2, serial.data2);
+    read(SIOMULTI3, serial.data3);
+    write(SIOMULTI3, serial.data3);
+    read(SIOCNT, serial.control);
+    write_handler(SIOCNT, [](Memory& mem, u32, u16 data, u16 mask) { mem.core.serial->WriteControl(data, mask); });
+    read(SIOMLTSEND, serial.send);
+    write(SIOMLTSEND, serial.send);
+
+    read_handler(KEYINPUT, [](const Memory& mem, u32) -> u16 {
+        mem.core.LatchInput();
+        return mem.core.keypad->input.Read();
+    });
+    read(KEYCNT, core.keypad->control);
+    write(KEYCNT, core.keypad->control);
+
+    read(RCNT, serial.mode);
+    write(RCNT, serial.mode);
+    read(JOYCNT, serial.joybus_control);
+    write_handler(JOYCNT, [](Memory& mem, u32, u16 data, u16 mask) {
         // Bits 0-2 of JOYCNT behave like IF. The IRQ enable bit is normally writeable.
-        core.serial->joybus_control.Clear(data & Serial::joycnt_ack_mask);
-        core.serial->joybus_control.Write(data & Serial::joycnt_irq_enable, mask);
-        break;
-    case JOYRECV_L:
-        core.serial->joybus_recv_l.Write(data, mask);
-        break;
-    case JOYRECV_H:
-        core.serial->joybus_recv_h.Write(data, mask);
-        break;
-    case JOYTRANS_L:
-        core.serial->joybus_trans_l.Write(data, mask);
-        core.serial->joybus_status |= Serial::joystat_trans;
-        break;
-    case JOYTRANS_H:
-        core.serial->joybus_trans_h.Write(data, mask);
-        core.serial->joybus_status |= Serial::joystat_trans;
-        break;
-    case JOYSTAT:
-        core.serial->joybus_status.Write(data, mask);
-        break;
-    case IE:
-        intr_enable.Write(data, mask);
-        break;
-    case IF:
+        mem.core.serial->joybus_control.Clear(data & Serial::joycnt_ack_mask);
+        mem.core.serial->joybus_control.Write(data & Serial::joycnt_irq_enable, mask);
+    });
+    read_handler(JOYRECV_L, [](const Memory& mem, u32) -> u16 {
+        mem.core.serial->joybus_status &= ~Serial::joystat_recv;
+        return mem.core.serial->joybus_recv_l.Read();
+    });
+    write(JOYRECV_L, serial.joybus_recv_l);
+    read_handler(JOYRECV_H, [](const Memory& mem, u32) -> u16 {
+        mem.core.serial->joybus_status &= ~Serial::joystat_recv;
+        return mem.core.serial->joybus_recv_h.Read();
+    });
+    write(JOYRECV_H, serial.joybus_recv_h);
+    read(JOYTRANS_L, serial.joybus_trans_l);
+    write_handler(JOYTRANS_L, [](Memory& mem, u32, u16 data, u16 mask) {
+        mem.core.serial->joybus_trans_l.Write(data, mask);
+        mem.core.serial->joybus_status |= Serial::joystat_trans;
+    });
+    read(JOYTRANS_H, serial.joybus_trans_h);
+    write_handler(JOYTRANS_H, [](Memory& mem, u32, u16 data, u16 mask) {
+        mem.core.serial->joybus_trans_h.Write(data, mask);
+        mem.core.serial->joybus_status |= Serial::joystat_trans;
+    });
+    read(JOYSTAT, serial.joybus_status);
+    write(JOYSTAT, serial.joybus_status);
+
+    read(IE, intr_enable);
+    write_handler(IE, [](Memory& mem, u32, u16 data, u16 mask) {
+        mem.intr_enable.Write(data, mask);
+        mem.UpdateIrqLine();
+    });
+    read(IF, intr_flags);
+    write_handler(IF, [](Memory& mem, u32, u16 data, u16 mask) {
         // Writing "1" to a bit in IF clears that bit.
-        intr_flags.Clear(data);
-        break;
-    case WAITCNT:
-        waitcnt.Write(data, mask);
-        UpdateWaitStates();
-        break;
-    case IME:
-        master_enable.Write(data, mask);
-        break;
-    case HALTCNT:
-        haltcnt.Write(data, mask);
+        mem.intr_flags.Clear(data);
+        mem.UpdateIrqLine();
+        if (mem.core.tracer != nullptr) {
+            mem.core.tracer->Instant(Common::Tracer::Cpu, "irq ack", mem.core.scheduler.Timestamp(), data & mask);
+        }
+    });
+    read(WAITCNT, waitcnt);
+    write_handler(WAITCNT, [](Memory& mem, u32, u16 data, u16 mask) {
+        mem.waitcnt.Write(data, mask);
+        mem.UpdateWaitStates();
+    });
+    read(IME, master_enable);
+    write(IME, master_enable);
+    read(HALTCNT, haltcnt);
+    write_handler(HALTCNT, [](Memory& mem, u32, u16 data, u16 mask) {
+        mem.haltcnt.Write(data, mask);
         if ((mask & 0xFF00) == 0xFF00 && (data & 0x8000) == 0) {
-            if (master_enable == 0 && intr_enable == 0) {
+            if (mem.intr_enable == 0 && mem.core.watchdog.Enabled()) {
+                mem.core.watchdog.Hang("halt mode was entered with no interrupts enabled.");
+            } else if (mem.master_enable == 0 && mem.intr_enable == 0) {
                 throw std::runtime_error("The CPU has hung: halt mode entered with interrupts disabled.");
             }
 
-            core.cpu->Halt();
+            mem.core.cpu->Halt();
+            if (mem.core.tracer != nullptr) {
+                mem.core.tracer->Begin(Common::Tracer::Cpu, "halt", mem.core.scheduler.Timestamp());
+            }
         }
-        break;
-    default:
-        break;
-    }
+    });
 }
 
 u32 Memory::ReadOpenBus() const {
@@ -1121,4 +1226,44 @@ u32 Memory::ReadOpenBus() const {
     }
 }
 
+void Memory::ReportMemory(Common::MemoryReport& report) const {
+    report.Add("memory", sizeof(Memory));
+    report.Add("guest_ram", sizeof(GuestRam));
+    report.Add("page_tables", read_pages);
+    report.Add("page_tables", write_pages);
+    report.Add("save", sram);
+    report.Add("save", eeprom);
+    report.AddShared("bios", bios.size() * sizeof(u32));
+    report.AddShared("rom", rom.size() * sizeof(u16));
+}
+
+void Memory::SerializeState(Common::State& state) {
+    // The page tables point into the guest RAM, so it's loaded in place.
+    state.SyncContents(xram);
+    state.SyncContents(iram);
+    state.SyncContents(pram);
+    state.SyncContents(vram);
+    state.SyncContents(oam);
+    state.Sync(sram, eeprom);
+
+    state.Sync(transfer_reg, volatile_read, last_addr, prefetch_cycles, prefetched_opcodes);
+    state.Sync(intr_enable, intr_flags, waitcnt, master_enable, haltcnt, gpio_data, gpio_direction, gpio_readable);
+    UpdateIrqLine();
+
+    state.Sync(save_type, eeprom_addr_len, eeprom_stream_high, eeprom_stream_low, eeprom_stream_size);
+    state.Sync(eeprom_ready, eeprom_read_pos, eeprom_read_buffer);
+    state.Sync(flash_state, last_flash_cmd, sram_addr_mask, flash_id_mode, chip_id, bank_num);
+    // Field by field, so the struct's padding never reaches the state.
+    state.Sync(pending_save_op.type, pending_save_op.addr, pending_save_op.data);
+
+    if (rtc_present) {
+        state.Sync(*rtc);
+    }
+
+    if (state.Loading()) {
+        UpdateWaitStates();
+        save_dirty.MarkAll();
+    }
+}
+
 } // End namespace Gba
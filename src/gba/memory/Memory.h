@@ -19,11 +19,17 @@
 #include <vector>
 #include <array>
 #include <string>
-#include <functional>
 #include <memory>
+#include <unordered_map>
 
 #include "common/CommonTypes.h"
 #include "common/CommonFuncs.h"
+#include "common/SaveFlusher.h"
+#include "common/MappedSave.h"
+#include "common/MappedRom.h"
+#include "common/PageAlloc.h"
+#include "common/MemoryReport.h"
+#include "common/Cheats.h"
 #include "gba/memory/IOReg.h"
 #include "gba/memory/MemDefs.h"
 
@@ -34,18 +40,36 @@ class Rtc;
 
 class Memory {
 public:
-    Memory(const std::vector<u32>& _bios, const std::vector<u16>& _rom, const std::string& _save_path, Core& _core);
+    Memory(const std::vector<u32>& _bios, const Common::RomVector<u16>& _rom, const std::string& _save_path,
+           const Common::SaveSettings& save_settings, Common::HugePages huge_pages, Core& _core, bool _ideal_prefetch);
     ~Memory();
 
     u32 transfer_reg = 0x0;
+    // Set by reads of registers whose value can change between scheduler events, for idle loop detection.
+    bool volatile_read = false;
+    // Set by reads of any register. An idle loop which reads none can only be left by an interrupt or a DMA.
+    bool io_read = false;
 
     template <typename T>
-    T ReadMem(const u32 addr, bool dma = false);
+    T ReadMem(const u32 addr, AccessType access_type = AccessType::Normal);
     template <typename T>
     void WriteMem(const u32 addr, const T data, bool dma = false);
     template <typename T>
     int AccessTime(const u32 addr, AccessType access_type = AccessType::Normal, bool force_sequential = false);
 
+    // Plain memory that DMA can copy in bulk. Returns null if the address has to go through ReadMem/WriteMem,
+    // otherwise sets contiguous_bytes to the number of bytes starting at the address that the pointer covers.
+    const u8* DmaSourcePointer(u32 addr, u32& contiguous_bytes) const;
+    u8* DmaDestPointer(u32 addr, u32& contiguous_bytes);
+    // Applies the side effects of the writes to a block copied through DmaDestPointer.
+    void DmaBlockWritten(u32 addr, u32 bytes);
+
+    // Consecutive word accesses for LDM/STM and PUSH/POP. Returns the access time, and behaves exactly like a
+    // ReadMem/WriteMem and AccessTime per word, but transfers the whole block at once when it's in one page of
+    // plain memory.
+    int ReadBlock(u32 addr, u32* data, int count);
+    int WriteBlock(u32 addr, const u32* data, int count);
+
     void MakeNextAccessSequential(u32 addr) { last_addr = addr; }
     void MakeNextAccessNonsequential() { last_addr = 0; }
     bool LastAccessWasInRom() const { return last_addr >= BaseAddr::Rom; }
@@ -55,35 +79,91 @@ public:
     void FlushPrefetchBuffer() { prefetch_cycles = 0; prefetched_opcodes = 0; last_addr = 0; }
 
     bool InterruptMasterEnable() const { return master_enable.v; }
-    bool PendingInterrupts() const { return intr_flags & intr_enable; }
-    void RequestInterrupt(u16 intr) { intr_flags |= intr; };
+    bool PendingInterrupts() const { return irq_line; }
+    u16 PendingInterruptMask() const { return intr_flags & intr_enable; }
+    void RequestInterrupt(u16 intr);
     bool InterruptEnabled(u16 intr) const { return intr_enable & intr; };
 
     bool EepromAddr(u32 addr) const { return rom_size <= 16 * mbyte || addr >= 0x0DFF'FF00; }
     void ParseEepromCommand();
 
-    void DelayedSaveOp(int cycles);
-
-    const std::vector<u16>& PramReference() const { return pram; }
-    const std::vector<u16>& VramReference() const { return vram; }
-    const std::vector<u32>& OamReference() const { return oam; }
+    void DelayedSaveOp();
+    // Called once per frame. Hands the save pages written since the last flush to the background writer.
+    void FlushSaveData();
+    u64 SaveFlushes() const { return save_flusher ? save_flusher->Flushes() : 0; }
+
+    void SerializeState(Common::State& state);
+    void ReportMemory(Common::MemoryReport& report) const;
+
+    // The branch target of an idle loop that the CPU should skip without proving it's idle, or 0 if none.
+    u32 IdleLoopOverride() const { return idle_loop_override; }
+
+    // Code coverage slots: one for a Thumb instruction at each halfword of EWRAM, IWRAM and ROM, in that order,
+    // then one for an ARM instruction at each word of them, so a report knows which way to disassemble them. Code
+    // running from the BIOS, VRAM or anywhere else isn't covered.
+    static constexpr std::size_t no_code_slot = ~std::size_t{0};
+    static constexpr u32 iram_code_offset = 256 * kbyte;
+    static constexpr u32 rom_code_offset = iram_code_offset + 32 * kbyte;
+    std::size_t CodeSlots() const { return CodeBytes() / 2 + CodeBytes() / 4; }
+    std::size_t CodeBytes() const { return rom_code_offset + rom_size; }
+    template <typename T>
+    std::size_t CodeSlot(u32 addr) const {
+        constexpr unsigned int shift = (sizeof(T) == 2) ? 1 : 2;
+        const std::size_t first_slot = (sizeof(T) == 2) ? 0 : CodeBytes() / 2;
+        switch (addr >> 24) {
+        case BaseAddr::XRam >> 24:
+            return first_slot + ((addr & (256 * kbyte - 1)) >> shift);
+        case BaseAddr::IRam >> 24:
+            return first_slot + ((iram_code_offset + (addr & (32 * kbyte - 1))) >> shift);
+        case 0x8:
+        case 0x9:
+        case 0xA:
+        case 0xB:
+        case 0xC:
+        case 0xD:
+            if ((addr & rom_addr_mask) < rom_size) {
+                return first_slot + ((rom_code_offset + (addr & rom_addr_mask)) >> shift);
+            }
+            return no_code_slot;
+        default:
+            return no_code_slot;
+        }
+    }
 
-    static bool CheckNintendoLogo(const std::vector<u8>& rom_header) noexcept;
-    static void CheckHeader(const std::vector<u16>& rom_header);
+    const GuestRam& RamReference() const { return *ram; }
+    // Writers must call DmaBlockWritten afterwards, to throw away code cached from the RAM they overwrote.
+    GuestRam& RamReference() { return *ram; }
+    const Common::RomVector<u16>& RomReference() const { return rom; }
+    // Points the IO dispatch tables at the registers of the other hardware, once it has all been constructed.
+    void PopulateIOTables();
+    // Rebuilds the page tables, leaving out the RAM pages with access hooks so those accesses reach the checks in
+    // ReadMem and WriteMem.
+    void HooksChanged() { BuildPageTables(); }
+    // Replaces the cheats' ROM patches, and maps in copies of the ROM pages they touch with the patches applied.
+    // The pages that can't be mapped, the first one when it holds GPIO registers and a partial one at the end of
+    // the ROM, have their patches applied by ReadRom instead.
+    void PatchRom(const std::vector<Common::Cheat>& patches);
+
+    static bool CheckNintendoLogo(const Common::RomVector<u8>& rom_header) noexcept;
+    static void CheckHeader(const Common::RomVector<u16>& rom_header);
 
 private:
     Core& core;
 
     const std::vector<u32>& bios;
-    std::vector<u16> xram;
-    std::vector<u32> iram;
-    std::vector<u16> pram;
-    std::vector<u16> vram;
-    std::vector<u32> oam;
-    const std::vector<u16>& rom;
-    std::vector<u8> sram;
-    std::vector<u64> eeprom;
-
+    const Common::PagePtr<GuestRam> ram;
+    decltype(GuestRam::xram)& xram;
+    decltype(GuestRam::iram)& iram;
+    decltype(GuestRam::pram)& pram;
+    decltype(GuestRam::vram)& vram;
+    decltype(GuestRam::oam)& oam;
+    const Common::RomVector<u16>& rom;
+    // Only present when saves are memory-mapped, in which case sram and eeprom live in the save file.
+    std::shared_ptr<Common::MappedSaveFile> save_map;
+    Common::SaveVector<u8> sram;
+    Common::SaveVector<u64> eeprom;
+
+    const bool ideal_prefetch;
     u32 last_addr = 0x0;
     int prefetch_cycles = 0;
     int prefetched_opcodes = 0;
@@ -92,6 +172,13 @@ private:
     std::array<int, 3> wait_state_s;
     int wait_state_sram;
 
+    // Access times indexed by region, access width (8, 16, or 32 bits), and whether the access is sequential.
+    // Addresses past the end of the memory map share the last row.
+    static constexpr u32 num_timing_regions = 17;
+    std::array<std::array<std::array<int, 2>, 3>, num_timing_regions> access_timings;
+
+    int BlockAccessTime(u32 addr, int count);
+
     const unsigned int rom_size;
     u32 rom_addr_mask;
 
@@ -99,8 +186,14 @@ private:
     bool rtc_present = false;
     std::unique_ptr<Rtc> rtc;
 
+    u32 idle_loop_override = 0;
+
     IOReg intr_enable = {0x0000, 0x3FFF, 0x3FFF};
     IOReg intr_flags = {0x0000, 0x3FFF, 0x3FFF};
+    // Whether IF & IE is non-zero, which the CPU checks before every instruction. It's only recomputed when either
+    // register changes.
+    bool irq_line = false;
+    void UpdateIrqLine() { irq_line = intr_flags & intr_enable; }
     IOReg waitcnt = {0x0000, 0x5FFF, 0x5FFF};
     IOReg master_enable = {0x0000, 0x0001, 0x0001};
     IOReg haltcnt = {0x0000, 0x0001, 0x8001};
@@ -109,6 +202,25 @@ private:
     IOReg gpio_direction = {0x0000, 0x000F, 0x000F};
     IOReg gpio_readable = {0x0000, 0x0001, 0x0001};
 
+    // IO accesses are dispatched through tables with an entry for each halfword below 0x0400'0400. Registers
+    // with no side effects point straight at their IOReg, and the rest have a handler. A 32-bit write to a pair of
+    // registers which are usually written together gets its own handler, and is otherwise split in two.
+    using IOReadHandler = u16 (*)(const Memory& mem, u32 addr);
+    using IOWriteHandler = void (*)(Memory& mem, u32 addr, u16 data, u16 mask);
+    using IOWordWriteHandler = void (*)(Memory& mem, u32 addr, u32 data);
+    struct IOReadEntry {
+        const IOReg* reg = nullptr;
+        IOReadHandler handler = nullptr;
+    };
+    struct IOWriteEntry {
+        IOReg* reg = nullptr;
+        IOWriteHandler handler = nullptr;
+    };
+    static constexpr u32 io_table_size = 0x200;
+    std::array<IOReadEntry, io_table_size> io_reads{};
+    std::array<IOWriteEntry, io_table_size> io_writes{};
+    std::array<IOWordWriteHandler, io_table_size / 2> io_word_writes{};
+
     enum GpioAddr : u32 {Data      = 0x0800'00C4,
                          Direction = 0x0800'00C6,
                          Control   = 0x0800'00C8};
@@ -158,30 +270,52 @@ private:
     static constexpr int flash_write_cycles  = 300; // 17.9us
 
     SaveType save_type = SaveType::Unknown;
-    const std::string& save_path;
+    const std::string save_path;
+    // Only set when the game is being saved to a file.
+    const std::string save_type_cache_path;
+    std::string cached_save_type;
+    // Byte offsets into sram, or into eeprom viewed as bytes, depending on the save type.
+    Common::DirtyPages save_dirty;
+    // Only present when periodic flushing is enabled and the game is being saved to a regular file.
+    std::unique_ptr<Common::SaveFlusher> save_flusher;
 
     int eeprom_addr_len = 0;
-    std::vector<u8> eeprom_bitstream;
+    // The bits of the command being sent to the EEPROM, shifted in at the bottom of the low word as the DMA writes
+    // them. Commands are at most 81 bits long, so longer streams only keep their size, to be rejected.
+    u64 eeprom_stream_high = 0;
+    u64 eeprom_stream_low = 0;
+    int eeprom_stream_size = 0;
     u16 eeprom_ready = 0x1;
     int eeprom_read_pos = 64;
     u64 eeprom_read_buffer = 0x0;
 
     FlashState flash_state = FlashState::NotStarted;
     FlashCmd last_flash_cmd = FlashCmd::None;
-    u32 sram_addr_mask;
+    u32 sram_addr_mask = 0;
     bool flash_id_mode = false;
     FlashId chip_id = FlashId::Panasonic;
     int bank_num = 0;
 
-    struct DelayedOp {
-        DelayedOp(int _cycles, std::function<void()> _action)
-                : cycles(_cycles)
-                , action(std::move(_action)) {}
-
-        int cycles;
-        std::function<void()> action;
+    // Plain RAM and ROM pages are accessed straight through these tables. A null entry means the page has to go
+    // through the region handlers, either because accesses have side effects or because it's smaller than a page.
+    static constexpr int page_shift = 14;
+    static constexpr u32 page_size = 1 << page_shift;
+    static constexpr std::size_t num_pages = BaseAddr::Max >> page_shift;
+    std::vector<const u8*> read_pages;
+    std::vector<u8*> write_pages;
+    // Patched copies of the ROM pages touched by cheats, keyed by their offset into the ROM.
+    std::unordered_map<u32, std::vector<u8>> patched_rom_pages;
+
+    // The save chip operation that completes when the SaveOp event fires. It's kept as plain data rather than a
+    // callback so it can go in savestates.
+    enum class SaveOpType {None, EepromReady, FlashWrite, FlashEraseSector, FlashEraseChip};
+    struct PendingSaveOp {
+        SaveOpType type = SaveOpType::None;
+        u32 addr = 0;
+        u8 data = 0;
     };
-    DelayedOp delayed_op{0, [](){}};
+    PendingSaveOp pending_save_op;
+    void ScheduleSaveOp(int cycles, PendingSaveOp op);
 
     enum class Region {Bios   = 0x0,
                        XRam   = 0x2,
@@ -225,45 +359,53 @@ private:
     }
 
     template <typename AccessWidth, typename BusWidth>
-    AccessWidth ReadRegion(const std::vector<BusWidth>& region, const u32 region_mask, const u32 addr) const;
+    AccessWidth ReadRegion(const BusWidth* region, const u32 region_mask, const u32 addr) const;
     template <typename AccessWidth, typename BusWidth>
-    void WriteRegion(std::vector<BusWidth>& region, const u32 region_mask, const u32 addr, const AccessWidth data);
+    void WriteRegion(BusWidth* region, const u32 region_mask, const u32 addr, const AccessWidth data);
 
     template <typename T>
     T ReadBios(const u32 addr) const;
     template <typename T>
-    T ReadXRam(const u32 addr) const { return ReadRegion<T>(xram, xram_addr_mask, addr); }
+    T ReadXRam(const u32 addr) const { return ReadRegion<T>(xram.data(), xram_addr_mask, addr); }
     template <typename T>
-    T ReadIRam(const u32 addr) const { return ReadRegion<T>(iram, iram_addr_mask, addr); }
+    T ReadIRam(const u32 addr) const { return ReadRegion<T>(iram.data(), iram_addr_mask, addr); }
     template <typename T>
     T ReadIO(const u32 addr) const;
     template <typename T>
-    T ReadPRam(const u32 addr) const { return ReadRegion<T>(pram, pram_addr_mask, addr); }
+    T ReadPRam(const u32 addr) const { return ReadRegion<T>(pram.data(), pram_addr_mask, addr); }
     template <typename T>
     T ReadVRam(const u32 addr) const {
-        return ReadRegion<T>(vram, (addr & 0x0001'0000) ? vram_addr_mask2 : vram_addr_mask1, addr);
+        return ReadRegion<T>(vram.data(), (addr & 0x0001'0000) ? vram_addr_mask2 : vram_addr_mask1, addr);
     }
     template <typename T>
-    T ReadOam(const u32 addr) const { return ReadRegion<T>(oam, oam_addr_mask, addr); }
+    T ReadOam(const u32 addr) const { return ReadRegion<T>(oam.data(), oam_addr_mask, addr); }
     template <typename T>
     T ReadRom(const u32 addr) const {
-        if ((addr & rom_addr_mask) < rom_size) {
-            return ReadRegion<T>(rom, rom_addr_mask, addr);
-        } else {
+        const u32 rom_addr = addr & rom_addr_mask;
+        if (rom_addr >= rom_size) {
             return 0;
         }
+
+        if (!patched_rom_pages.empty()) {
+            const auto patched = patched_rom_pages.find(rom_addr & ~(page_size - 1));
+            if (patched != patched_rom_pages.cend()) {
+                return ReadRegion<T>(reinterpret_cast<const u16*>(patched->second.data()), page_size - 1, addr);
+            }
+        }
+
+        return ReadRegion<T>(rom.data(), rom_addr_mask, addr);
     }
     template <typename T>
     T ReadSRam(const u32 addr) const { return sram[bank_num * flash_size + (addr & sram_addr_mask)] * 0x0101'0101; }
 
     template <typename T>
-    void WriteXRam(const u32 addr, const T data) { WriteRegion(xram, xram_addr_mask, addr, data); }
+    void WriteXRam(const u32 addr, const T data) { WriteRegion(xram.data(), xram_addr_mask, addr, data); }
     template <typename T>
-    void WriteIRam(const u32 addr, const T data) { WriteRegion(iram, iram_addr_mask, addr, data); }
+    void WriteIRam(const u32 addr, const T data) { WriteRegion(iram.data(), iram_addr_mask, addr, data); }
     template <typename T>
     void WriteIO(const u32 addr, const T data, const u16 mask = 0xFFFF);
     template <typename T>
-    void WritePRam(const u32 addr, const T data) { WriteRegion(pram, pram_addr_mask, addr, data); }
+    void WritePRam(const u32 addr, const T data);
     template <typename T>
     void WriteVRam(const u32 addr, const T data);
     template <typename T>
@@ -272,26 +414,48 @@ private:
     void WriteGpio(const u32 addr, const T data, const u16 mask = 0xFFFF);
     template <typename T>
     void WriteSRam(const u32 addr, const T data) {
-        sram[bank_num * flash_size + (addr & sram_addr_mask)] = RotateRight(data, (addr & (sizeof(T) - 1)) * 8);
+        const u32 offset = bank_num * flash_size + (addr & sram_addr_mask);
+        sram[offset] = RotateRight(data, (addr & (sizeof(T) - 1)) * 8);
+        save_dirty.Mark(offset);
     }
     template <typename T>
     void WriteFlash(const u32 addr, const T data);
 
+    void BuildPageTables();
     void UpdateWaitStates();
     u32 ReadOpenBus() const;
 
     void ReadSaveFile();
     void WriteSaveFile() const;
     void CheckHardwareOverrides();
+    void LoadCachedSaveType();
+    void UpdateSaveTypeCache() const;
+    std::string SaveTypeCacheEntry() const;
+    std::string RomHashString() const;
     void InitOverrideSaveType();
     void InitSRam();
     void InitFlash();
+    void PushEepromBit(u16 bit) {
+        eeprom_stream_high = (eeprom_stream_high << 1) | (eeprom_stream_low >> 63);
+        eeprom_stream_low = (eeprom_stream_low << 1) | bit;
+        ++eeprom_stream_size;
+    }
+    // Returns count bits of the stream, starting from the bit sent at position first. The count can be up to 64.
+    u64 EepromStreamBits(int first, int count) const;
+    void ClearEepromStream() { eeprom_stream_size = 0; }
     u16 ParseEepromAddr(int stream_size, bool read_request);
     void InitEeprom(int stream_size, int non_addr_bits);
 
     void UpdateGpioDirections();
     void UpdateGpioReadable();
     static constexpr bool InGpioAddrRange(u32 addr) { return (addr & 0xFFFF'FFF1) == 0x0800'00C0; }
+
+    // Timers and audio are brought up to date whenever they're read, and serial transfers run on their own clock.
+    static constexpr bool VolatileIOAddr(u32 addr) {
+        const u32 io_addr = addr & 0x00FF'FFFF;
+        return (io_addr >= 0x060 && io_addr < 0x0B0) || (io_addr >= 0x100 && io_addr < 0x130)
+               || (io_addr >= 0x134 && io_addr < 0x200);
+    }
 };
 
 } // End namespace Gba
@@ -17,29 +17,73 @@
 #include <stdexcept>
 #include <fstream>
 #include <filesystem>
-#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <sstream>
+#include <string>
+#include <string_view>
 #include <fmt/format.h>
 
+#include "common/Hash.h"
 #include "gba/memory/Memory.h"
 #include "gba/core/Core.h"
 #include "gba/cpu/Disassembler.h"
 #include "gba/hardware/Rtc.h"
-#include "emu/ParseOptions.h"
 
 namespace Gba {
 
+namespace {
+
+template<typename T>
+struct GameCodeEntry {
+    std::string_view game_code;
+    T value;
+};
+
+// Sorts a list of per-game overrides at compile time so it can be binary searched. This is an insertion sort,
+// since std::sort isn't constexpr.
+template<typename T, std::size_t N>
+constexpr std::array<GameCodeEntry<T>, N> SortByGameCode(const GameCodeEntry<T> (&entries)[N]) {
+    std::array<GameCodeEntry<T>, N> sorted{};
+    for (std::size_t i = 0; i < N; ++i) {
+        std::size_t j = i;
+        for (; j > 0 && entries[i].game_code < sorted[j - 1].game_code; --j) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = entries[i];
+    }
+
+    return sorted;
+}
+
+template<typename T, std::size_t N>
+const T* FindGameCode(const std::array<GameCodeEntry<T>, N>& table, std::string_view game_code) {
+    const auto iter = std::lower_bound(table.cbegin(), table.cend(), game_code,
+                                       [](const auto& entry, std::string_view code) {
+        return entry.game_code < code;
+    });
+
+    return (iter != table.cend() && iter->game_code == game_code) ? &iter->value : nullptr;
+}
+
+} // End anonymous namespace
+
 void Memory::ReadSaveFile() {
     std::ifstream save_file(save_path);
     if (!save_file) {
         // Save file doesn't exist.
+        if (save_type == SaveType::Unknown) {
+            LoadCachedSaveType();
+        }
+
         if (save_type != SaveType::Unknown) {
-            // We have a manual override for this game's save type.
+            // We have a manual override for this game's save type, or it was detected on an earlier boot.
             InitOverrideSaveType();
         }
         return;
     }
 
-    Emu::CheckPathIsRegularFile(save_path);
+    Common::CheckPathIsRegularFile(save_path);
 
     const auto save_size = std::filesystem::file_size(save_path);
 
@@ -48,14 +92,18 @@ void Memory::ReadSaveFile() {
 
         save_type = SaveType::SRam;
         sram.resize(save_size);
-        save_file.read(reinterpret_cast<char*>(sram.data()), save_size);
+        if (save_map == nullptr) {
+            save_file.read(reinterpret_cast<char*>(sram.data()), save_size);
+        }
         sram_addr_mask = sram_size - 1;
     } else if (save_size == 8 * kbyte || save_size == 512) {
         fmt::print("Found EEPROM save\n");
 
         save_type = SaveType::Eeprom;
         eeprom.resize(save_size / sizeof(u64));
-        save_file.read(reinterpret_cast<char*>(eeprom.data()), save_size);
+        if (save_map == nullptr) {
+            save_file.read(reinterpret_cast<char*>(eeprom.data()), save_size);
+        }
 
         if (save_size == 8 * kbyte) {
             eeprom_addr_len = 14;
@@ -67,7 +115,9 @@ void Memory::ReadSaveFile() {
 
         save_type = SaveType::Flash;
         sram.resize(save_size);
-        save_file.read(reinterpret_cast<char*>(sram.data()), save_size);
+        if (save_map == nullptr) {
+            save_file.read(reinterpret_cast<char*>(sram.data()), save_size);
+        }
         sram_addr_mask = flash_size - 1;
 
         if (save_size == flash_size * 2) {
@@ -82,21 +132,42 @@ void Memory::ReadSaveFile() {
 }
 
 void Memory::WriteSaveFile() const {
-    if (save_type == SaveType::Unknown || save_type == SaveType::None) {
+    // Benchmarks run without a save path, so every run starts from the same state.
+    if (save_type == SaveType::Unknown || save_type == SaveType::None || save_path.empty()) {
         return;
     }
 
-    std::ofstream save_file(save_path);
-
-    if (!save_file) {
-        fmt::print("Error: could not open {} to write save file to disk.\n", save_path);
-    } else {
+    if (save_map != nullptr) {
+        // A savestate can leave the save smaller than the file, e.g. before EEPROM size detection.
+        save_map->Sync(true);
         if (save_type == SaveType::SRam || save_type == SaveType::Flash) {
-            save_file.write(reinterpret_cast<const char*>(sram.data()), sram.size());
+            save_map->Truncate(sram.size());
         } else if (save_type == SaveType::Eeprom) {
-            save_file.write(reinterpret_cast<const char*>(eeprom.data()), eeprom.size() * sizeof(u64));
+            save_map->Truncate(eeprom.size() * sizeof(u64));
         }
-        save_file.flush();
+    } else if (save_type == SaveType::SRam || save_type == SaveType::Flash) {
+        Common::WriteFileAtomic(save_path, sram.data(), sram.size());
+    } else if (save_type == SaveType::Eeprom) {
+        Common::WriteFileAtomic(save_path, reinterpret_cast<const u8*>(eeprom.data()), eeprom.size() * sizeof(u64));
+    }
+}
+
+void Memory::FlushSaveData() {
+    if (save_map != nullptr) {
+        save_map->FrameDone(save_dirty);
+        return;
+    }
+
+    if (save_flusher == nullptr || !save_dirty.Any() || !save_flusher->FlushDue()) {
+        return;
+    }
+
+    if (save_type == SaveType::SRam || save_type == SaveType::Flash) {
+        save_flusher->Update(sram.data(), sram.size(), save_dirty);
+    } else if (save_type == SaveType::Eeprom) {
+        save_flusher->Update(reinterpret_cast<const u8*>(eeprom.data()), eeprom.size() * sizeof(u64), save_dirty);
+    } else {
+        save_dirty.Clear();
     }
 }
 
@@ -116,12 +187,32 @@ void Memory::InitFlash() {
     sram_addr_mask = flash_size - 1;
 }
 
-void Memory::DelayedSaveOp(int cycles) {
-    if (delayed_op.cycles > 0) {
-        delayed_op.cycles -= cycles;
-        if (delayed_op.cycles <= 0) {
-            delayed_op.action();
-        }
+void Memory::ScheduleSaveOp(int cycles, PendingSaveOp op) {
+    pending_save_op = op;
+    core.scheduler.ScheduleIn(Event::SaveOp, cycles);
+}
+
+void Memory::DelayedSaveOp() {
+    const PendingSaveOp op = pending_save_op;
+    pending_save_op = {};
+
+    switch (op.type) {
+    case SaveOpType::EepromReady:
+        eeprom_ready = 1;
+        break;
+    case SaveOpType::FlashWrite:
+        WriteSRam(op.addr, op.data);
+        break;
+    case SaveOpType::FlashEraseSector:
+        std::fill_n(sram.begin() + bank_num * flash_size + (op.addr & 0x0000'F000), 0x1000, 0xFF);
+        save_dirty.MarkRange(bank_num * flash_size + (op.addr & 0x0000'F000), 0x1000);
+        break;
+    case SaveOpType::FlashEraseChip:
+        std::fill(sram.begin(), sram.end(), 0xFF);
+        save_dirty.MarkAll();
+        break;
+    default:
+        break;
     }
 }
 
@@ -143,28 +234,28 @@ void Memory::ParseEepromCommand() {
         return;
     }
 
-    const auto stream_size = eeprom_bitstream.size();
+    const int stream_size = eeprom_stream_size;
     if (!eeprom_ready || stream_size < 9) {
         if (!eeprom_ready) {
             core.disasm->LogAlways("ParseEepromCommand when eeprom not ready\n");
         } else {
             core.disasm->LogAlways("ParseEepromCommand when stream size too small: {}\n", stream_size);
         }
-        eeprom_bitstream.clear();
+        ClearEepromStream();
         return;
     }
 
-    if (eeprom_bitstream[0] != 1) {
+    if (EepromStreamBits(0, 1) != 1) {
         // Malformed request type.
         core.disasm->LogAlways("First bit of bitstream not 1.\n");
-        eeprom_bitstream.clear();
+        ClearEepromStream();
         return;
     }
 
-    const bool read_request = eeprom_bitstream[1] == 1;
+    const bool read_request = EepromStreamBits(1, 1) == 1;
     const u16 eeprom_addr = ParseEepromAddr(stream_size, read_request);
     if (eeprom_addr == 0xFFFF) {
-        eeprom_bitstream.clear();
+        ClearEepromStream();
         return;
     }
 
@@ -177,22 +268,34 @@ void Memory::ParseEepromCommand() {
         }
         eeprom_read_pos = 0;
     } else if (eeprom_addr <= 0x3FF) {
-        // OOB EEPROM writes are ignored.
-        u64 value = 0;
-        for (int i = 0; i < 64; ++i) {
-            // Values are written MSBit first.
-            value |= static_cast<u64>(eeprom_bitstream[i + 2 + eeprom_addr_len]) << (63 - i);
-        }
+        // OOB EEPROM writes are ignored. Values are written MSBit first.
+        const u64 value = EepromStreamBits(2 + eeprom_addr_len, 64);
 
         // We store the EEPROM data as big-endian for compatibility with mGBA.
         eeprom[eeprom_addr] = ByteSwap64(value);
+        save_dirty.Mark(eeprom_addr * sizeof(u64));
         eeprom_ready = 0;
-        delayed_op = {eeprom_write_cycles, [this]() {
-            eeprom_ready = 1;
-        }};
+        ScheduleSaveOp(eeprom_write_cycles, {SaveOpType::EepromReady});
     }
 
-    eeprom_bitstream.clear();
+    ClearEepromStream();
+}
+
+u64 Memory::EepromStreamBits(int first, int count) const {
+    // The shift from the bottom of the stream to the last bit requested.
+    const int shift = eeprom_stream_size - first - count;
+    const u64 mask = (count == 64) ? ~0ull : (1ull << count) - 1;
+
+    if (shift >= 128) {
+        // These bits were shifted out of an overlong stream.
+        return 0;
+    } else if (shift >= 64) {
+        return (eeprom_stream_high >> (shift - 64)) & mask;
+    } else if (shift == 0) {
+        return eeprom_stream_low & mask;
+    } else {
+        return ((eeprom_stream_low >> shift) | (eeprom_stream_high << (64 - shift))) & mask;
+    }
 }
 
 u16 Memory::ParseEepromAddr(int stream_size, bool read_request) {
@@ -205,17 +308,12 @@ u16 Memory::ParseEepromAddr(int stream_size, bool read_request) {
     if (stream_size != non_addr_bits + eeprom_addr_len) {
         // Invalid size.
         core.disasm->LogAlways("Invalid bitstream size: {}.\n", stream_size);
-        eeprom_bitstream.clear();
+        ClearEepromStream();
         return 0xFFFF;
     }
 
-    u16 eeprom_addr = 0;
-    for (int i = 0; i < eeprom_addr_len; ++i) {
-        // The EEPROM address is written MSB first.
-        eeprom_addr |= static_cast<u16>(eeprom_bitstream[i + 2]) << (eeprom_addr_len - 1 - i);
-    }
-
-    return eeprom_addr;
+    // The EEPROM address is written MSB first.
+    return EepromStreamBits(2, eeprom_addr_len);
 }
 
 void Memory::InitEeprom(int stream_size, int non_addr_bits) {
@@ -239,9 +337,9 @@ void Memory::WriteFlash(const u32 addr, const T data) {
     switch (flash_state) {
     case FlashState::Command:
         if (last_flash_cmd == FlashCmd::Write) {
-            delayed_op = {flash_write_cycles, [this, addr, data]() {
-                WriteSRam(addr, data);
-            }};
+            // Rotate the byte into place now, like WriteSRam would for this access width.
+            const u8 byte = RotateRight(data, (addr & (sizeof(T) - 1)) * 8);
+            ScheduleSaveOp(flash_write_cycles, {SaveOpType::FlashWrite, addr, byte});
         } else if (last_flash_cmd == FlashCmd::BankSwitch) {
             if (sram.size() == flash_size * 2) {
                 bank_num = data & 0x1;
@@ -271,9 +369,7 @@ void Memory::WriteFlash(const u32 addr, const T data) {
 
     case FlashState::Ready:
         if (last_flash_cmd == FlashCmd::Erase && data == FlashCmd::EraseSector) {
-            delayed_op = {flash_erase_cycles, [this, addr]() {
-                std::fill_n(sram.begin() + bank_num * flash_size + (addr & 0x0000'F000), 0x1000, 0xFF);
-            }};
+            ScheduleSaveOp(flash_erase_cycles, {SaveOpType::FlashEraseSector, addr});
 
             flash_state = FlashState::NotStarted;
         } else if (addr == FlashAddr::Command1) {
@@ -290,9 +386,7 @@ void Memory::WriteFlash(const u32 addr, const T data) {
                 break;
             case EraseChip:
                 if (last_flash_cmd == FlashCmd::Erase) {
-                    delayed_op = {flash_erase_cycles, [this]() {
-                        std::fill(sram.begin(), sram.end(), 0xFF);
-                    }};
+                    ScheduleSaveOp(flash_erase_cycles, {SaveOpType::FlashEraseChip});
                 }
                 break;
             case EraseSector:
@@ -329,6 +423,11 @@ void Memory::InitOverrideSaveType() {
         break;
     case SaveType::Eeprom:
         fmt::print("EEPROM override\n");
+
+        // The size is only known if it came from the save type cache.
+        if (eeprom_addr_len != 0) {
+            eeprom.resize((eeprom_addr_len == 14) ? 0x400 : 0x40);
+        }
         break;
     case SaveType::Flash:
         fmt::print("64KB Flash override\n");
@@ -352,10 +451,86 @@ void Memory::InitOverrideSaveType() {
     }
 }
 
+void Memory::LoadCachedSaveType() {
+    if (save_type_cache_path.empty()) {
+        return;
+    }
+
+    std::ifstream cache_file(save_type_cache_path);
+    const std::string rom_hash = RomHashString();
+    std::string line;
+    while (std::getline(cache_file, line)) {
+        std::istringstream line_stream{line};
+        std::string hash, type;
+        std::size_t size;
+        if (!(line_stream >> hash >> type >> size) || hash != rom_hash) {
+            continue;
+        }
+
+        if (type == "sram" && size == sram_size) {
+            save_type = SaveType::SRam;
+        } else if (type == "flash" && size == flash_size) {
+            save_type = SaveType::Flash;
+        } else if (type == "flash" && size == flash_size * 2) {
+            save_type = SaveType::Flash128;
+        } else if (type == "eeprom" && (size == 0 || size == 512 || size == 8 * kbyte)) {
+            // A size of 0 means the game never accessed the EEPROM, so its size couldn't be detected.
+            save_type = SaveType::Eeprom;
+            eeprom_addr_len = (size == 8 * kbyte) ? 14 : (size == 512) ? 6 : 0;
+        } else {
+            fmt::print("Ignoring invalid save type cache entry: {}\n", line);
+            return;
+        }
+
+        cached_save_type = type + " " + std::to_string(size);
+        fmt::print("Save type found in cache\n");
+        return;
+    }
+}
+
+void Memory::UpdateSaveTypeCache() const {
+    const std::string entry = SaveTypeCacheEntry();
+    if (save_type_cache_path.empty() || entry.empty() || entry == cached_save_type) {
+        return;
+    }
+
+    // Rewrite the whole file, replacing any old entry for this ROM.
+    const std::string rom_hash = RomHashString();
+    std::string contents;
+    std::ifstream cache_file(save_type_cache_path);
+    std::string line;
+    while (std::getline(cache_file, line)) {
+        if (line.compare(0, rom_hash.size() + 1, rom_hash + " ") != 0) {
+            contents += line + "\n";
+        }
+    }
+    contents += rom_hash + " " + entry + "\n";
+
+    Common::WriteFileAtomic(save_type_cache_path, reinterpret_cast<const u8*>(contents.data()), contents.size());
+}
+
+std::string Memory::SaveTypeCacheEntry() const {
+    switch (save_type) {
+    case SaveType::SRam:
+        return "sram " + std::to_string(sram.size());
+    case SaveType::Flash:
+        return "flash " + std::to_string(sram.size());
+    case SaveType::Eeprom:
+        return "eeprom " + std::to_string(eeprom.size() * sizeof(u64));
+    default:
+        // Unknown, or an override says the game has no save memory.
+        return "";
+    }
+}
+
+std::string Memory::RomHashString() const {
+    return fmt::format("{:016X}", Common::XxHash64::Hash(rom.data(), rom_size));
+}
+
 void Memory::CheckHardwareOverrides() {
     // Credit goes to mGBA for this list of save overrides. As of January 2020, the original can be found here:
     // https://github.com/mgba-emu/mgba/blob/master/src/gba/overrides.c
-    const std::unordered_map<std::string, Overrides> overrides {
+    static constexpr auto overrides = SortByGameCode<Overrides>({
         // Advance Wars
         {"AWRE", {SaveType::Flash, Device_None}},
         {"AWRP", {SaveType::Flash, Device_None}},
@@ -526,17 +701,16 @@ void Memory::CheckHardwareOverrides() {
 
         // Aging cartridge
         {"TCHK", {SaveType::Eeprom, Device_None}},
-    };
+    });
 
     // Read the game code from the ROM header and see if it's in our list of overrides.
-    const std::string game_code{reinterpret_cast<const char*>(rom.data()) + 0xAC, 4};
+    const std::string_view game_code{reinterpret_cast<const char*>(rom.data()) + 0xAC, 4};
 
-    const auto override_iter = overrides.find(game_code);
-    if (override_iter != overrides.end()) {
-        const Overrides game_overrides = override_iter->second;
-        save_type = game_overrides.save_type;
+    const Overrides* game_overrides = FindGameCode(overrides, game_code);
+    if (game_overrides != nullptr) {
+        save_type = game_overrides->save_type;
 
-        if (game_overrides.devices & Device_Rtc) {
+        if (game_overrides->devices & Device_Rtc) {
             gpio_present = true;
             rtc_present = true;
             rtc = std::make_unique<Rtc>(core);
@@ -544,6 +718,28 @@ void Memory::CheckHardwareOverrides() {
         }
     }
 
+    // Also from mGBA, idle loops which the idle loop detector can't prove are idle on its own.
+    static constexpr auto idle_loop_overrides = SortByGameCode<u32>({
+        // Advance Wars
+        {"AWRE", 0x0803'8810},
+        {"AWRP", 0x0803'8810},
+
+        // Advance Wars 2: Black Hole Rising
+        {"AW2E", 0x0803'6E08},
+        {"AW2P", 0x0803'719C},
+
+        // Super Mario Advance 3
+        {"A3AJ", 0x0800'2B9C},
+        {"A3AE", 0x0800'2B9C},
+        {"A3AP", 0x0800'2BB0},
+    });
+
+    const u32* idle_loop = FindGameCode(idle_loop_overrides, game_code);
+    if (idle_loop != nullptr) {
+        idle_loop_override = *idle_loop;
+        fmt::print("Idle loop override found\n");
+    }
+
     if (game_code[0] == 'F') {
         // In Classic NES Series games, the ROM contents are mirrored throughout the ROM region.
         rom_addr_mask = rom_size - 1;
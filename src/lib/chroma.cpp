@@ -0,0 +1,1119 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "lib/chroma.h"
+#include "common/CommonTypes.h"
+#include "common/CommonEnums.h"
+#include "common/Cheats.h"
+#include "common/Hash.h"
+#include "common/MappedRom.h"
+#include "common/PageAlloc.h"
+#include "common/RamDelta.h"
+#include "common/RamSearch.h"
+#include "common/Coverage.h"
+#include "common/TraceTrigger.h"
+#include "common/Rewind.h"
+#include "common/Movie.h"
+#include "common/SaveFlusher.h"
+#include "common/Screenshot.h"
+#include "common/AvRecorder.h"
+#include "common/LinkCable.h"
+#include "common/Netplay.h"
+#include "common/RtcSource.h"
+#include "common/Metrics.h"
+#include "common/PerfSettings.h"
+#include "common/ParallelFor.h"
+#include "common/StepTarget.h"
+#include "gb/core/Enums.h"
+#include "gb/core/GameBoy.h"
+#include "gb/hardware/Serial.h"
+#include "gb/memory/CartridgeHeader.h"
+#include "gb/memory/Memory.h"
+#include "gba/core/Core.h"
+#include "gba/memory/Memory.h"
+#include "gba/hardware/Serial.h"
+#include "emu/Frontend.h"
+
+namespace {
+
+// Hands the core's output back to the caller instead of presenting it, and turns the caller's button mask into
+// input events. There's nothing to pace or pause, so the core runs exactly as many frames as it's asked to.
+class LibraryFrontend : public Emu::Frontend {
+public:
+    void RenderFrame(const u16* fb_ptr, bool new_frame) noexcept override {
+        frame = fb_ptr;
+        frame_changed = frame_changed || new_frame;
+        pixels_stale = pixels_stale || new_frame;
+    }
+    void ToggleFullscreen() noexcept override {}
+
+    void PushBackAudio(const std::array<s16, 1600>& sample_buffer) noexcept override {
+        samples.insert(samples.end(), sample_buffer.cbegin(), sample_buffer.cend());
+    }
+    void UnpauseAudio() noexcept override {}
+    void PauseAudio() noexcept override {}
+
+    void RegisterCallback(Emu::InputEvent event, std::function<void(bool)> callback) override {
+        input_callbacks[static_cast<int>(event)] = std::move(callback);
+    }
+    void PollEvents() override {
+        for (int i = 0; i < Emu::button_count; ++i) {
+            const bool press = (next_buttons >> i) & 1;
+            if (press != ((held_buttons >> i) & 1)) {
+                input_callbacks[static_cast<int>(Emu::ButtonFromIndex(i))](press);
+            }
+        }
+        held_buttons = next_buttons;
+    }
+    void WaitForEvents() noexcept override {}
+
+    void UpdateFrameTimes(float, float, const std::string&) override {}
+
+    // Called before each frame. The samples of the previous frame are dropped.
+    void StartFrame(u16 buttons) {
+        next_buttons = buttons;
+        samples.clear();
+        frame_changed = false;
+    }
+
+    const u16* frame = nullptr;
+    // Whether the frame changed during the last step.
+    bool frame_changed = false;
+    // Whether the frame changed since it was last converted by chroma_get_pixels.
+    bool pixels_stale = true;
+    std::vector<s16> samples;
+
+private:
+    u16 held_buttons = 0;
+    u16 next_buttons = 0;
+
+    std::array<std::function<void(bool)>, Emu::input_event_count> input_callbacks;
+};
+
+Common::SaveSettings NoFlushSaveSettings() {
+    Common::SaveSettings settings;
+    settings.flush_interval = 0;
+    return settings;
+}
+
+// Everything the embedded cores run with. The cores are given no save path, so nothing touches the disk.
+struct LibrarySettings {
+    Common::TraceTrigger trace_trigger;
+    Common::RewindSettings rewind_settings;
+    Common::MovieSettings movie_settings;
+    Common::SaveSettings save_settings = NoFlushSaveSettings();
+    Common::ScreenshotSettings screenshot_settings;
+    Common::RecordSettings record_settings;
+    Common::LinkSettings link_settings;
+    Common::NetplaySettings netplay_settings;
+    // The cartridge clocks run on emulated time from a fixed date, so every instance of a game sees the same time.
+    Common::RtcSettings rtc_settings{true, Common::RtcSettings::reproducible_epoch};
+};
+
+// Every chroma_rom made from the same bytes shares one copy of them, so running many instances of a game, even ones
+// created separately with chroma_create, only keeps one ROM and one BIOS in memory. On NUMA hosts, each node gets a
+// copy of its own, written by the thread creating the ROM there, so instances on every node read it from local
+// memory. The cache only holds weak references, so a buffer is freed once the last ROM and instance using it are
+// destroyed.
+template<typename Buffer>
+class BufferCache {
+public:
+    std::shared_ptr<const Buffer> Get(const void* data, std::size_t size,
+                                      const typename Buffer::allocator_type& allocator = {}) {
+        using T = typename Buffer::value_type;
+        const std::size_t bytes = size / sizeof(T) * sizeof(T);
+        const u64 hash = Common::XxHash64::Hash(data, bytes);
+        const int node = Common::CurrentNumaNode();
+
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto range = buffers.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            std::shared_ptr<const Buffer> buffer = it->second.buffer.lock();
+            if (buffer != nullptr && it->second.node == node && buffer->size() * sizeof(T) == bytes
+                    && std::memcmp(buffer->data(), data, bytes) == 0) {
+                return buffer;
+            }
+        }
+
+        for (auto it = buffers.begin(); it != buffers.end();) {
+            it = it->second.buffer.expired() ? buffers.erase(it) : std::next(it);
+        }
+
+        auto buffer = std::make_shared<Buffer>(bytes / sizeof(T), allocator);
+        std::memcpy(buffer->data(), data, bytes);
+        buffers.emplace(hash, Entry{node, buffer});
+
+        return buffer;
+    }
+
+private:
+    struct Entry {
+        int node;
+        std::weak_ptr<const Buffer> buffer;
+    };
+
+    std::mutex mutex;
+    std::unordered_multimap<u64, Entry> buffers;
+};
+
+BufferCache<Common::RomVector<u8>> gb_rom_cache;
+BufferCache<Common::RomVector<u16>> gba_rom_cache;
+BufferCache<std::vector<u32>> bios_cache;
+
+std::atomic<Common::HugePages> library_huge_pages{Common::HugePages::Off};
+std::atomic<int> library_watchdog_frames{0};
+std::mutex library_perf_mutex;
+Common::PerfSettings library_perf_settings;
+
+Common::PerfSettings LibraryPerfSettings() {
+    std::lock_guard<std::mutex> lock{library_perf_mutex};
+    return library_perf_settings;
+}
+
+template<typename T>
+Common::RomAllocator<T> LibraryRomAllocator() {
+    const Common::HugePages huge_pages = library_huge_pages.load();
+    if (huge_pages == Common::HugePages::Off) {
+        return {};
+    }
+
+    return Common::RomAllocator<T>(std::make_shared<Common::MappedRomFile>(huge_pages));
+}
+
+} // End anonymous namespace
+
+struct chroma_rom {
+    // Only one of these is used, depending on the system.
+    std::shared_ptr<const Common::RomVector<u8>> gb_rom;
+    std::shared_ptr<const Common::RomVector<u16>> gba_rom;
+    std::shared_ptr<const std::vector<u32>> bios;
+};
+
+struct chroma_instance {
+    LibraryFrontend frontend;
+    LibrarySettings settings;
+
+    // The cores keep references to the ROM and BIOS, so they're declared before the cores.
+    chroma_rom rom;
+    Gb::Console console = Gb::Console::Default;
+    std::unique_ptr<Gb::CartridgeHeader> cart_header;
+
+    std::unique_ptr<Gb::GameBoy> gameboy;
+    std::unique_ptr<Gba::Core> gba_core;
+
+    std::vector<u8> state_buffer;
+    // Saved by chroma_save_host_state.
+    std::vector<u8> host_buffer;
+
+    // The last frame converted by chroma_get_pixels, and its format.
+    std::vector<u8> pixels;
+    Common::PixelFormat pixels_format = Common::PixelFormat::Bgr555;
+
+    // The settings the cores were created with, so they're created the same way again after hibernating.
+    Common::PerfSettings perf_settings;
+    // Only held while hibernating, in place of the cores.
+    // The savestate followed by the host state, compressed together.
+    std::vector<u8> hibernated_state;
+    std::size_t hibernated_state_size = 0;
+    std::size_t hibernated_host_size = 0;
+    std::vector<Common::Cheat> hibernated_cheats;
+};
+
+struct chroma_vec {
+    chroma_vec(std::size_t count, unsigned int num_threads);
+
+    std::vector<std::unique_ptr<chroma_instance, decltype(&chroma_destroy)>> instances;
+    Common::ParallelFor pool;
+
+    int width = 0, height = 0;
+    Common::PixelFormat format = Common::PixelFormat::Bgr555;
+    std::vector<u8> frames;
+
+    // The arguments of the current step. The task is built once, so stepping doesn't allocate.
+    const u16* step_buttons = nullptr;
+    int step_frames = 0;
+    std::function<void(std::size_t)> step_task;
+
+    void StepInstance(std::size_t index);
+    void CopyFrame(std::size_t index);
+};
+
+struct chroma_search {
+    const chroma_instance* instance;
+    chroma_memory region;
+    Common::RamSearch search;
+};
+
+chroma_vec::chroma_vec(std::size_t count, unsigned int num_threads)
+        : pool(num_threads)
+        , step_task([this](std::size_t index) { StepInstance(index); }) {
+    instances.reserve(count);
+}
+
+void chroma_vec::StepInstance(std::size_t index) {
+    chroma_instance* instance = instances[index].get();
+    chroma_step(instance, step_buttons[index], step_frames);
+
+    // Each instance copies its own frame out, so the copies are spread over the threads as well. A frame which is
+    // the same as the one already in the buffer isn't copied again.
+    if (instance->frontend.frame_changed) {
+        CopyFrame(index);
+    }
+}
+
+void chroma_vec::CopyFrame(std::size_t index) {
+    const u16* frame = instances[index]->frontend.frame;
+    if (frame != nullptr) {
+        const std::size_t frame_size = width * height;
+        const std::size_t pixel_bytes = Common::BytesPerPixel(format);
+        Common::ConvertPixels(frame, frame_size, format, frames.data() + index * frame_size * pixel_bytes);
+    }
+}
+
+namespace {
+
+bool ValidPixelFormat(chroma_pixel_format format) {
+    return format == CHROMA_PIXEL_BGR555 || format == CHROMA_PIXEL_RGB888 || format == CHROMA_PIXEL_XRGB8888
+           || format == CHROMA_PIXEL_GRAY8;
+}
+
+} // End anonymous namespace
+
+namespace {
+
+Common::Hooks& InstanceHooks(chroma_instance* instance) {
+    return (instance->gba_core != nullptr) ? instance->gba_core->hooks : instance->gameboy->hooks;
+}
+
+std::unique_ptr<Common::Coverage>& InstanceCoverage(const chroma_instance* instance) {
+    return (instance->gba_core != nullptr) ? instance->gba_core->coverage : instance->gameboy->coverage;
+}
+
+void HooksChanged(chroma_instance* instance) {
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->HooksChanged();
+    } else {
+        instance->gameboy->HooksChanged();
+    }
+}
+
+} // End anonymous namespace
+
+extern "C" {
+
+void chroma_set_huge_pages(chroma_huge_pages mode) {
+    library_huge_pages = static_cast<Common::HugePages>(mode);
+}
+
+void chroma_set_watchdog(int blank_frames) {
+    library_watchdog_frames = std::max(blank_frames, 0);
+}
+
+void chroma_set_cpu_mode(chroma_cpu_mode mode) {
+    std::lock_guard<std::mutex> lock{library_perf_mutex};
+    library_perf_settings.exec_mode = static_cast<ExecMode>(mode);
+}
+
+void chroma_set_profile(chroma_profile profile) {
+    std::lock_guard<std::mutex> lock{library_perf_mutex};
+    library_perf_settings = Common::PerfSettings::ForProfile(static_cast<Common::PerfProfile>(profile));
+}
+
+void chroma_set_fixed_point_audio(int enabled) {
+    std::lock_guard<std::mutex> lock{library_perf_mutex};
+    AudioFilter& filter = library_perf_settings.audio_filter;
+    if (enabled && filter == AudioFilter::Iir) {
+        filter = AudioFilter::FixedIir;
+    } else if (!enabled && filter == AudioFilter::FixedIir) {
+        filter = AudioFilter::Iir;
+    }
+}
+
+chroma_rom* chroma_rom_create(const void* rom, size_t rom_size, const void* bios, size_t bios_size) {
+    // 32MB is the largest possible GBA game, and the DMG Nintendo logo ends at 0x134.
+    if (rom == nullptr || rom_size > 0x2000000 || rom_size < 0x134) {
+        return nullptr;
+    }
+
+    const u8* rom_bytes = static_cast<const u8*>(rom);
+    const Common::RomVector<u8> rom_header(rom_bytes, rom_bytes + 0x134);
+
+    try {
+        auto shared_rom = std::make_unique<chroma_rom>();
+
+        if (Gba::Memory::CheckNintendoLogo(rom_header)) {
+            if (bios == nullptr || bios_size != 0x4000) {
+                return nullptr;
+            }
+
+            shared_rom->gba_rom = gba_rom_cache.Get(rom, rom_size, LibraryRomAllocator<u16>());
+            shared_rom->bios = bios_cache.Get(bios, bios_size);
+        } else if (Gb::CartridgeHeader::CheckNintendoLogo(Gb::Console::CGB, rom_header)) {
+            // 32KB is the smallest possible GB game.
+            if (rom_size < 0x8000) {
+                return nullptr;
+            }
+
+            shared_rom->gb_rom = gb_rom_cache.Get(rom, rom_size, LibraryRomAllocator<u8>());
+        } else {
+            return nullptr;
+        }
+
+        return shared_rom.release();
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+void chroma_rom_destroy(chroma_rom* rom) {
+    delete rom;
+}
+
+namespace {
+
+void CreateCore(chroma_instance& instance) {
+    const LibrarySettings& settings = instance.settings;
+    const Common::PerfSettings& perf_settings = instance.perf_settings;
+    const chroma_rom& rom = instance.rom;
+
+    if (rom.gba_rom != nullptr) {
+        instance.gba_core = std::make_unique<Gba::Core>(instance.frontend, *rom.bios, *rom.gba_rom, "",
+                                                        LogLevel::None, LogOverflow::Block, perf_settings.exec_mode,
+                                                        perf_settings.audio_filter, 0, false, perf_settings.line_cache,
+                                                        perf_settings.hle_bios, 0, 0, "", settings.trace_trigger,
+                                                        settings.rewind_settings, 0, settings.movie_settings,
+                                                        settings.save_settings, settings.screenshot_settings,
+                                                        settings.record_settings, settings.link_settings,
+                                                        settings.netplay_settings, settings.rtc_settings,
+                                                        library_huge_pages.load(), Common::MetricsSettings{},
+                                                        Common::WatchdogSettings{library_watchdog_frames.load()},
+                                                        perf_settings.ideal_prefetch, perf_settings.skip_bios);
+    } else {
+        instance.cart_header = std::make_unique<Gb::CartridgeHeader>(instance.console, *rom.gb_rom, false);
+        instance.gameboy = std::make_unique<Gb::GameBoy>(instance.console, *instance.cart_header, instance.frontend,
+                                                         "", *rom.gb_rom, perf_settings.audio_filter, LogLevel::None,
+                                                         LogOverflow::Block, 0, 0, 0, settings.trace_trigger,
+                                                         settings.rewind_settings, 0, settings.movie_settings,
+                                                         settings.save_settings, settings.screenshot_settings,
+                                                         settings.record_settings, settings.link_settings,
+                                                         settings.netplay_settings, settings.rtc_settings,
+                                                         Common::MetricsSettings{},
+                                                         Common::WatchdogSettings{library_watchdog_frames.load()},
+                                                         perf_settings.exec_mode, perf_settings.gb_renderer, false);
+    }
+}
+
+} // End anonymous namespace
+
+chroma_instance* chroma_create_from_rom(const chroma_rom* rom) {
+    try {
+        auto instance = std::make_unique<chroma_instance>();
+        instance->perf_settings = LibraryPerfSettings();
+        instance->rom = *rom;
+        CreateCore(*instance);
+
+        return instance.release();
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+chroma_instance* chroma_create(const void* rom, size_t rom_size, const void* bios, size_t bios_size) {
+    const std::unique_ptr<chroma_rom, decltype(&chroma_rom_destroy)> shared_rom{
+        chroma_rom_create(rom, rom_size, bios, bios_size), &chroma_rom_destroy};
+    if (shared_rom == nullptr) {
+        return nullptr;
+    }
+
+    return chroma_create_from_rom(shared_rom.get());
+}
+
+void chroma_destroy(chroma_instance* instance) {
+    delete instance;
+}
+
+chroma_system chroma_get_system(const chroma_instance* instance) {
+    // Still answers while hibernating, when there's no core.
+    return (instance->rom.gba_rom != nullptr) ? CHROMA_SYSTEM_GBA : CHROMA_SYSTEM_GB;
+}
+
+const char* chroma_get_hang(const chroma_instance* instance) {
+    const Common::Watchdog& watchdog = (instance->gba_core != nullptr) ? instance->gba_core->watchdog
+                                                                       : instance->gameboy->watchdog;
+    return watchdog.Tripped() ? watchdog.Reason().c_str() : nullptr;
+}
+
+void chroma_run_frame(chroma_instance* instance, uint16_t buttons) {
+    if (chroma_get_hang(instance) != nullptr) {
+        return;
+    }
+    instance->frontend.StartFrame(buttons);
+
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->RunFrame();
+    } else {
+        instance->gameboy->RunFrame();
+    }
+}
+
+void chroma_step(chroma_instance* instance, uint16_t buttons, int frames) {
+    if (chroma_get_hang(instance) != nullptr) {
+        return;
+    }
+    instance->frontend.StartFrame(buttons);
+
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->RunFrames(frames);
+    } else {
+        instance->gameboy->RunFrames(frames);
+    }
+}
+
+uint64_t chroma_get_cycle(const chroma_instance* instance) {
+    return (instance->gba_core != nullptr) ? instance->gba_core->scheduler.Timestamp() : instance->gameboy->timestamp;
+}
+
+void chroma_run_until(chroma_instance* instance, uint16_t buttons, uint64_t cycle) {
+    if (chroma_get_hang(instance) != nullptr) {
+        return;
+    }
+    instance->frontend.StartFrame(buttons);
+
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->RunUntil(cycle);
+    } else {
+        instance->gameboy->RunUntil(cycle);
+    }
+}
+
+int chroma_run_until_event(chroma_instance* instance, uint16_t buttons, chroma_event event, uint32_t value,
+                           uint64_t max_cycles) {
+    if (event < CHROMA_EVENT_VBLANK || event > CHROMA_EVENT_PC) {
+        return -1;
+    }
+    if (chroma_get_hang(instance) != nullptr) {
+        return 0;
+    }
+    instance->frontend.StartFrame(buttons);
+
+    // The events are in the same order as the step target types.
+    const Common::StepTarget target{static_cast<Common::StepTarget::Type>(event), value};
+    const bool reached = (instance->gba_core != nullptr) ? instance->gba_core->RunUntilEvent(target, max_cycles)
+                                                         : instance->gameboy->RunUntilEvent(target, max_cycles);
+    return reached;
+}
+
+const uint16_t* chroma_get_framebuffer(const chroma_instance* instance, int* width, int* height) {
+    const bool gba = instance->gba_core != nullptr;
+    if (width != nullptr) {
+        *width = gba ? 240 : 160;
+    }
+    if (height != nullptr) {
+        *height = gba ? 160 : 144;
+    }
+
+    return instance->frontend.frame;
+}
+
+int chroma_frame_changed(const chroma_instance* instance) {
+    return instance->frontend.frame_changed;
+}
+
+const void* chroma_get_pixels(chroma_instance* instance, chroma_pixel_format format, int* width, int* height) {
+    const u16* frame = chroma_get_framebuffer(instance, width, height);
+    if (frame == nullptr || !ValidPixelFormat(format)) {
+        return nullptr;
+    }
+
+    const auto pixel_format = static_cast<Common::PixelFormat>(format);
+    if (pixel_format == Common::PixelFormat::Bgr555) {
+        return frame;
+    }
+
+    if (instance->frontend.pixels_stale || instance->pixels_format != pixel_format) {
+        const bool gba = instance->gba_core != nullptr;
+        const std::size_t frame_size = gba ? 240 * 160 : 160 * 144;
+        instance->pixels.resize(frame_size * Common::BytesPerPixel(pixel_format));
+        Common::ConvertPixels(frame, frame_size, pixel_format, instance->pixels.data());
+        instance->pixels_format = pixel_format;
+        instance->frontend.pixels_stale = false;
+    }
+
+    return instance->pixels.data();
+}
+
+const int16_t* chroma_get_audio(const chroma_instance* instance, size_t* count) {
+    *count = instance->frontend.samples.size() / 2;
+    return instance->frontend.samples.data();
+}
+
+const uint8_t* chroma_get_memory(const chroma_instance* instance, chroma_memory region, size_t* size) {
+    if (region == CHROMA_MEMORY_CART_RAM) {
+        if (instance->gba_core != nullptr) {
+            *size = 0;
+            return nullptr;
+        }
+
+        const Common::SaveVector<u8>& ram = instance->gameboy->mem->ExtRamReference();
+        *size = ram.size();
+        return ram.data();
+    }
+
+    if (instance->gba_core != nullptr) {
+        const Gba::GuestRam& ram = instance->gba_core->mem->RamReference();
+        if (region == CHROMA_MEMORY_WRAM) {
+            *size = sizeof(ram.xram);
+            return reinterpret_cast<const u8*>(ram.xram.data());
+        } else {
+            *size = sizeof(ram.iram);
+            return reinterpret_cast<const u8*>(ram.iram.data());
+        }
+    } else {
+        const std::vector<u8>& ram = (region == CHROMA_MEMORY_WRAM) ? instance->gameboy->mem->WramReference()
+                                                                    : instance->gameboy->mem->HramReference();
+        *size = ram.size();
+        return ram.data();
+    }
+}
+
+int chroma_write_memory(chroma_instance* instance, chroma_memory region, size_t offset, const void* data,
+                        size_t size) {
+    std::size_t region_size;
+    chroma_get_memory(instance, region, &region_size);
+    if (region == CHROMA_MEMORY_CART_RAM || offset > region_size || size > region_size - offset) {
+        return -1;
+    }
+
+    const u8* bytes = static_cast<const u8*>(data);
+    if (instance->gba_core != nullptr) {
+        // Copied straight into RAM, so write hooks aren't called, and then treated like a DMA, which takes care of
+        // the code cached from RAM.
+        Gba::GuestRam& ram = instance->gba_core->mem->RamReference();
+        u8* dest = (region == CHROMA_MEMORY_WRAM) ? reinterpret_cast<u8*>(ram.xram.data())
+                                                  : reinterpret_cast<u8*>(ram.iram.data());
+        std::memcpy(dest + offset, bytes, size);
+        const u32 base = (region == CHROMA_MEMORY_WRAM) ? Gba::BaseAddr::XRam : Gba::BaseAddr::IRam;
+        instance->gba_core->mem->DmaBlockWritten(base + offset, size);
+    } else {
+        std::vector<u8>& ram = (region == CHROMA_MEMORY_WRAM) ? instance->gameboy->mem->WramReference()
+                                                              : instance->gameboy->mem->HramReference();
+        std::memcpy(ram.data() + offset, bytes, size);
+    }
+
+    return 0;
+}
+
+const uint8_t* chroma_get_serial_output(const chroma_instance* instance, size_t* size) {
+    if (instance->gba_core != nullptr) {
+        *size = 0;
+        return nullptr;
+    } else {
+        const std::vector<u8>& sent_bytes = instance->gameboy->serial.SentBytes();
+        *size = sent_bytes.size();
+        return sent_bytes.data();
+    }
+}
+
+void chroma_set_frame_hook(chroma_instance* instance, chroma_frame_hook hook, void* user_data) {
+    if (hook == nullptr) {
+        InstanceHooks(instance).frame_ended = nullptr;
+    } else {
+        InstanceHooks(instance).frame_ended = [instance, hook, user_data] { hook(instance, user_data); };
+    }
+}
+
+void chroma_add_exec_hook(chroma_instance* instance, uint32_t pc, chroma_exec_hook hook, void* user_data) {
+    InstanceHooks(instance).exec[pc] = [instance, hook, user_data](u32 hook_pc) { hook(instance, hook_pc, user_data); };
+    HooksChanged(instance);
+}
+
+void chroma_remove_exec_hook(chroma_instance* instance, uint32_t pc) {
+    InstanceHooks(instance).exec.erase(pc);
+    HooksChanged(instance);
+}
+
+int chroma_add_write_hook(chroma_instance* instance, chroma_memory region, size_t offset, chroma_write_hook hook,
+                          void* user_data) {
+    std::size_t region_size;
+    chroma_get_memory(instance, region, &region_size);
+    if (region == CHROMA_MEMORY_CART_RAM || offset >= region_size) {
+        return -1;
+    }
+
+    InstanceHooks(instance).writes[region][offset] = [instance, region, hook, user_data](u32 hook_offset) {
+        hook(instance, region, hook_offset, user_data);
+    };
+    HooksChanged(instance);
+    return 0;
+}
+
+void chroma_remove_write_hook(chroma_instance* instance, chroma_memory region, size_t offset) {
+    if (region == CHROMA_MEMORY_CART_RAM) {
+        return;
+    }
+
+    InstanceHooks(instance).writes[region].erase(offset);
+    HooksChanged(instance);
+}
+
+int chroma_set_cheats(chroma_instance* instance, const char* codes) {
+    try {
+        const std::vector<std::string> lines = Common::SplitCheatCodes(codes);
+        if (instance->gba_core != nullptr) {
+            instance->gba_core->SetCheats(Common::DecodeGbaCheats(lines));
+        } else {
+            instance->gameboy->SetCheats(Common::DecodeGbCheats(lines));
+        }
+    } catch (const std::runtime_error&) {
+        return -1;
+    }
+
+    return 0;
+}
+
+chroma_search* chroma_search_create(const chroma_instance* instance, chroma_memory region, unsigned int width,
+                                    int aligned) {
+    if (width != 1 && width != 2 && width != 4) {
+        return nullptr;
+    }
+
+    std::size_t size;
+    const u8* ram = chroma_get_memory(instance, region, &size);
+    return new chroma_search{instance, region, Common::RamSearch{ram, size, width, aligned != 0}};
+}
+
+void chroma_search_destroy(chroma_search* search) {
+    delete search;
+}
+
+// chroma_compare is in the same order as RamSearch::Compare.
+size_t chroma_search_narrow(chroma_search* search, chroma_compare compare) {
+    std::size_t size;
+    const u8* ram = chroma_get_memory(search->instance, search->region, &size);
+    return search->search.Narrow(ram, static_cast<Common::RamSearch::Compare>(compare));
+}
+
+size_t chroma_search_narrow_value(chroma_search* search, chroma_compare compare, uint32_t value) {
+    std::size_t size;
+    const u8* ram = chroma_get_memory(search->instance, search->region, &size);
+    return search->search.Narrow(ram, static_cast<Common::RamSearch::Compare>(compare), value);
+}
+
+size_t chroma_search_get_candidates(const chroma_search* search, uint32_t* offsets, size_t max_count) {
+    const std::vector<u32> candidates = search->search.Candidates(max_count);
+    std::copy(candidates.cbegin(), candidates.cend(), offsets);
+    return search->search.Count();
+}
+
+int chroma_stream_ram_deltas(chroma_instance* instance, const char* path, int compress) {
+    try {
+        if (instance->gba_core != nullptr) {
+            instance->gba_core->ram_deltas.reset();
+            if (path != nullptr) {
+                instance->gba_core->StreamRamDeltas(path, compress != 0);
+            }
+        } else {
+            instance->gameboy->ram_deltas.reset();
+            if (path != nullptr) {
+                instance->gameboy->StreamRamDeltas(path, compress != 0);
+            }
+        }
+    } catch (const std::runtime_error&) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void chroma_set_coverage(chroma_instance* instance, int enable) {
+    auto& coverage = InstanceCoverage(instance);
+    if (enable == 0) {
+        coverage.reset();
+    } else if (coverage == nullptr) {
+        coverage = std::make_unique<Common::Coverage>();
+    }
+}
+
+void chroma_clear_coverage(chroma_instance* instance) {
+    if (auto& coverage = InstanceCoverage(instance)) {
+        coverage->Clear();
+    }
+}
+
+const uint8_t* chroma_get_coverage(const chroma_instance* instance, size_t* size) {
+    const auto& coverage = InstanceCoverage(instance);
+    if (size != nullptr) {
+        *size = (coverage != nullptr) ? Common::Coverage::map_size : 0;
+    }
+
+    return (coverage != nullptr) ? coverage->Map().data() : nullptr;
+}
+
+void chroma_enable_code_coverage(chroma_instance* instance) {
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->EnableCodeCoverage();
+    } else {
+        instance->gameboy->EnableCodeCoverage();
+    }
+}
+
+int chroma_write_coverage_report(chroma_instance* instance, const char* path) {
+    try {
+        if (instance->gba_core != nullptr && instance->gba_core->code_coverage != nullptr) {
+            instance->gba_core->WriteCoverageReport(path);
+        } else if (instance->gba_core == nullptr && instance->gameboy->code_coverage != nullptr) {
+            instance->gameboy->WriteCoverageReport(path);
+        } else {
+            return -1;
+        }
+    } catch (const std::runtime_error&) {
+        return -1;
+    }
+
+    return 0;
+}
+
+uint64_t chroma_get_frame_hash(const chroma_instance* instance) {
+    if (instance->gba_core != nullptr) {
+        return instance->gba_core->output_hash.FrameHash();
+    } else {
+        return instance->gameboy->output_hash.FrameHash();
+    }
+}
+
+uint64_t chroma_get_audio_hash(const chroma_instance* instance) {
+    if (instance->gba_core != nullptr) {
+        return instance->gba_core->output_hash.AudioHash();
+    } else {
+        return instance->gameboy->output_hash.AudioHash();
+    }
+}
+
+size_t chroma_save_state(chroma_instance* instance, void* buffer, size_t buffer_size) {
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->SaveState(instance->state_buffer);
+    } else {
+        instance->gameboy->SaveState(instance->state_buffer);
+    }
+
+    const std::size_t state_size = instance->state_buffer.size();
+    if (buffer != nullptr && buffer_size >= state_size) {
+        std::memcpy(buffer, instance->state_buffer.data(), state_size);
+    }
+
+    return state_size;
+}
+
+int chroma_load_state(chroma_instance* instance, const void* buffer, size_t size) {
+    const u8* bytes = static_cast<const u8*>(buffer);
+    instance->state_buffer.assign(bytes, bytes + size);
+
+    // The frame handed out last may be the LCD's back buffer, which the state has just overwritten, so the frame
+    // is taken again from the loaded core.
+    try {
+        if (instance->gba_core != nullptr) {
+            instance->gba_core->LoadState(instance->state_buffer);
+            instance->frontend.frame = instance->gba_core->FrontFrame();
+        } else {
+            instance->gameboy->LoadState(instance->state_buffer);
+            instance->frontend.frame = instance->gameboy->FrontFrame();
+        }
+    } catch (const std::exception&) {
+        return -1;
+    }
+
+    instance->frontend.pixels_stale = true;
+    return 0;
+}
+
+size_t chroma_save_host_state(chroma_instance* instance, void* buffer, size_t buffer_size) {
+    if (instance->gba_core != nullptr) {
+        instance->gba_core->SaveHostState(instance->host_buffer);
+    } else {
+        instance->gameboy->SaveHostState(instance->host_buffer);
+    }
+
+    const std::size_t state_size = instance->host_buffer.size();
+    if (buffer != nullptr && buffer_size >= state_size) {
+        std::memcpy(buffer, instance->host_buffer.data(), state_size);
+    }
+
+    return state_size;
+}
+
+int chroma_load_host_state(chroma_instance* instance, const void* buffer, size_t size) {
+    const u8* bytes = static_cast<const u8*>(buffer);
+    instance->host_buffer.assign(bytes, bytes + size);
+
+    try {
+        if (instance->gba_core != nullptr) {
+            instance->gba_core->LoadHostState(instance->host_buffer);
+        } else {
+            instance->gameboy->LoadHostState(instance->host_buffer);
+        }
+    } catch (const std::exception&) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int chroma_copy_state(chroma_instance* dst, chroma_instance* src) {
+    if (dst == src) {
+        return 0;
+    }
+    if (chroma_get_system(dst) != chroma_get_system(src)) {
+        return -1;
+    }
+
+    // The source's buffer is reused for every copy, so cloning the same instance over and over doesn't allocate.
+    try {
+        if (src->gba_core != nullptr) {
+            src->gba_core->SaveState(src->state_buffer);
+            dst->gba_core->LoadState(src->state_buffer);
+            dst->frontend.frame = dst->gba_core->FrontFrame();
+        } else {
+            src->gameboy->SaveState(src->state_buffer);
+            dst->gameboy->LoadState(src->state_buffer);
+            dst->frontend.frame = dst->gameboy->FrontFrame();
+        }
+    } catch (const std::exception&) {
+        return -1;
+    }
+
+    dst->frontend.pixels_stale = true;
+    return 0;
+}
+
+chroma_instance* chroma_clone(chroma_instance* instance) {
+    std::unique_ptr<chroma_instance, decltype(&chroma_destroy)> clone{chroma_create_from_rom(&instance->rom),
+                                                                      &chroma_destroy};
+    if (clone == nullptr || chroma_copy_state(clone.get(), instance) != 0) {
+        return nullptr;
+    }
+
+    if (instance->gba_core != nullptr) {
+        clone->gba_core->SetCheats(instance->gba_core->Cheats());
+    } else {
+        clone->gameboy->SetCheats(instance->gameboy->Cheats());
+    }
+
+    return clone.release();
+}
+
+int chroma_hibernate(chroma_instance* instance) {
+    if (chroma_is_hibernating(instance)) {
+        return 0;
+    }
+
+    try {
+        // The host state goes along with the savestate, so the instance wakes with the same audio and frame timing
+        // as if it had never stopped.
+        chroma_save_state(instance, nullptr, 0);
+        chroma_save_host_state(instance, nullptr, 0);
+        std::vector<u8> state = instance->state_buffer;
+        state.insert(state.end(), instance->host_buffer.cbegin(), instance->host_buffer.cend());
+
+        std::vector<u8> compressed(compressBound(state.size()));
+        uLongf compressed_size = compressed.size();
+        if (compress2(compressed.data(), &compressed_size, state.data(), state.size(), Z_BEST_SPEED) != Z_OK) {
+            return -1;
+        }
+        compressed.resize(compressed_size);
+        compressed.shrink_to_fit();
+
+        instance->hibernated_cheats = (instance->gba_core != nullptr) ? instance->gba_core->Cheats()
+                                                                      : instance->gameboy->Cheats();
+        instance->hibernated_state = std::move(compressed);
+        instance->hibernated_state_size = instance->state_buffer.size();
+        instance->hibernated_host_size = instance->host_buffer.size();
+    } catch (const std::exception&) {
+        return -1;
+    }
+
+    instance->gba_core.reset();
+    instance->gameboy.reset();
+    instance->cart_header.reset();
+    instance->state_buffer = std::vector<u8>{};
+    instance->host_buffer = std::vector<u8>{};
+    instance->pixels = std::vector<u8>{};
+    instance->frontend.frame = nullptr;
+    instance->frontend.samples = std::vector<s16>{};
+
+    return 0;
+}
+
+int chroma_wake(chroma_instance* instance) {
+    if (!chroma_is_hibernating(instance)) {
+        return 0;
+    }
+
+    try {
+        std::vector<u8> state(instance->hibernated_state_size + instance->hibernated_host_size);
+        uLongf state_size = state.size();
+        if (uncompress(state.data(), &state_size, instance->hibernated_state.data(),
+                       instance->hibernated_state.size()) != Z_OK || state_size != state.size()) {
+            return -1;
+        }
+        const auto host_begin = state.cbegin() + instance->hibernated_state_size;
+        instance->state_buffer.assign(state.cbegin(), host_begin);
+        instance->host_buffer.assign(host_begin, state.cend());
+
+        CreateCore(*instance);
+        if (instance->gba_core != nullptr) {
+            instance->gba_core->LoadState(instance->state_buffer);
+            instance->gba_core->LoadHostState(instance->host_buffer);
+            instance->gba_core->SetCheats(instance->hibernated_cheats);
+            instance->frontend.frame = instance->gba_core->FrontFrame();
+        } else {
+            instance->gameboy->LoadState(instance->state_buffer);
+            instance->gameboy->LoadHostState(instance->host_buffer);
+            instance->gameboy->SetCheats(instance->hibernated_cheats);
+            instance->frontend.frame = instance->gameboy->FrontFrame();
+        }
+    } catch (const std::exception&) {
+        // Stay hibernating, so the caller can try again or destroy the instance.
+        instance->gba_core.reset();
+        instance->gameboy.reset();
+        instance->cart_header.reset();
+        return -1;
+    }
+
+    instance->frontend.pixels_stale = true;
+    instance->hibernated_state = std::vector<u8>{};
+    instance->hibernated_cheats.clear();
+
+    return 0;
+}
+
+int chroma_is_hibernating(const chroma_instance* instance) {
+    return instance->gba_core == nullptr && instance->gameboy == nullptr;
+}
+
+int chroma_link(chroma_instance* first, chroma_instance* second) {
+    if (first == second || chroma_get_system(first) != chroma_get_system(second)) {
+        return -1;
+    }
+
+    auto ports = Common::LinkPort::CreateLocalPair();
+    if (first->gba_core != nullptr) {
+        first->gba_core->serial->ConnectLink(std::move(ports.first));
+        second->gba_core->serial->ConnectLink(std::move(ports.second));
+    } else {
+        first->gameboy->serial.ConnectLink(std::move(ports.first));
+        second->gameboy->serial.ConnectLink(std::move(ports.second));
+    }
+
+    return 0;
+}
+
+chroma_vec* chroma_vec_create(const chroma_rom* rom, size_t count, unsigned int num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    // There's no point in more threads than instances.
+    num_threads = std::min<std::size_t>(num_threads, std::max<std::size_t>(count, 1));
+
+    try {
+        auto vec = std::make_unique<chroma_vec>(count, num_threads);
+        for (std::size_t i = 0; i < count; ++i) {
+            vec->instances.emplace_back(chroma_create_from_rom(rom), &chroma_destroy);
+            if (vec->instances.back() == nullptr) {
+                return nullptr;
+            }
+        }
+
+        const bool gba = rom->gba_rom != nullptr;
+        vec->width = gba ? 240 : 160;
+        vec->height = gba ? 160 : 144;
+        vec->frames.resize(count * vec->width * vec->height * sizeof(u16));
+
+        return vec.release();
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+void chroma_vec_destroy(chroma_vec* vec) {
+    delete vec;
+}
+
+chroma_instance* chroma_vec_get_instance(chroma_vec* vec, size_t index) {
+    return vec->instances[index].get();
+}
+
+void chroma_vec_step(chroma_vec* vec, const uint16_t* buttons, int frames) {
+    vec->step_buttons = buttons;
+    vec->step_frames = frames;
+    vec->pool.Run(vec->instances.size(), vec->step_task);
+}
+
+const uint16_t* chroma_vec_get_frames(const chroma_vec* vec, int* width, int* height) {
+    if (width != nullptr) {
+        *width = vec->width;
+    }
+    if (height != nullptr) {
+        *height = vec->height;
+    }
+
+    if (vec->format != Common::PixelFormat::Bgr555) {
+        return nullptr;
+    }
+
+    return reinterpret_cast<const uint16_t*>(vec->frames.data());
+}
+
+int chroma_vec_set_pixel_format(chroma_vec* vec, chroma_pixel_format format) {
+    if (!ValidPixelFormat(format)) {
+        return -1;
+    }
+
+    vec->format = static_cast<Common::PixelFormat>(format);
+    vec->frames.assign(vec->instances.size() * vec->width * vec->height * Common::BytesPerPixel(vec->format), 0);
+    for (std::size_t i = 0; i < vec->instances.size(); ++i) {
+        vec->CopyFrame(i);
+    }
+
+    return 0;
+}
+
+const void* chroma_vec_get_pixels(const chroma_vec* vec, int* width, int* height) {
+    if (width != nullptr) {
+        *width = vec->width;
+    }
+    if (height != nullptr) {
+        *height = vec->height;
+    }
+
+    return vec->frames.data();
+}
+
+} // extern "C"
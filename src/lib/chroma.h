@@ -0,0 +1,365 @@
+/* This file is a part of Chroma.
+ * Copyright (C) 2018 Matthew Murray
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* C interface to the GB and GBA cores, for embedding them in other programs. Instances share nothing, so any
+ * number of them can run at once, each on its own thread. A single instance must only be used by one thread at a
+ * time. Nothing is written to disk: there's no save file, and savestates go through caller-owned buffers. */
+
+#ifndef CHROMA_H
+#define CHROMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chroma_instance chroma_instance;
+
+typedef enum {
+    CHROMA_SYSTEM_GB,
+    CHROMA_SYSTEM_GBA
+} chroma_system;
+
+/* Button masks for chroma_run_frame. The bit order matches input movies. */
+enum {
+    CHROMA_BUTTON_UP     = 1 << 0,
+    CHROMA_BUTTON_LEFT   = 1 << 1,
+    CHROMA_BUTTON_DOWN   = 1 << 2,
+    CHROMA_BUTTON_RIGHT  = 1 << 3,
+    CHROMA_BUTTON_A      = 1 << 4,
+    CHROMA_BUTTON_B      = 1 << 5,
+    CHROMA_BUTTON_L      = 1 << 6,
+    CHROMA_BUTTON_R      = 1 << 7,
+    CHROMA_BUTTON_START  = 1 << 8,
+    CHROMA_BUTTON_SELECT = 1 << 9
+};
+
+/* Audio is interleaved stereo at this rate. */
+#define CHROMA_SAMPLE_RATE 48000
+
+typedef enum {
+    CHROMA_HUGE_PAGES_OFF,
+    CHROMA_HUGE_PAGES_TRANSPARENT,
+    CHROMA_HUGE_PAGES_EXPLICIT
+} chroma_huge_pages;
+
+/* Backs the ROMs and the GBA RAM of instances created after this call with huge pages, which cuts down on TLB
+ * misses when many instances run at once. Transparent lets the kernel use them where it can, and explicit takes
+ * them from the pool reserved through vm.nr_hugepages, or falls back to transparent if it's empty. Off by default. */
+void chroma_set_huge_pages(chroma_huge_pages mode);
+
+/* Watches instances created after this call for games which have hung for good: halted with no interrupts enabled,
+ * stuck in a loop which only an interrupt could end while interrupts are disabled, or with the screen off for
+ * blank_frames frames in a row. A hung instance stops running, and chroma_get_hang says why. 0 turns the watchdog
+ * off, which is the default. */
+void chroma_set_watchdog(int blank_frames);
+
+typedef enum {
+    CHROMA_CPU_INTERPRETER,
+    CHROMA_CPU_CACHED,
+    CHROMA_CPU_JIT
+} chroma_cpu_mode;
+
+/* Runs instances created after this call with the given CPU execution mode, over the one picked by the profile.
+ * The cached mode decodes blocks of instructions once and runs them from then on, and the JIT also compiles hot GBA
+ * Thumb code and Game Boy register arithmetic on x86-64 hosts. Every mode gives the same results. The interpreter is
+ * the default. */
+void chroma_set_cpu_mode(chroma_cpu_mode mode);
+
+typedef enum {
+    CHROMA_PROFILE_ACCURATE,
+    CHROMA_PROFILE_BALANCED,
+    CHROMA_PROFILE_FAST
+} chroma_profile;
+
+/* Picks the accuracy and speed trade-offs of instances created after this call, as with --accuracy in the
+ * frontend. Accurate is the default. Balanced runs the cached CPU mode, blip audio and the GBA line cache. Fast runs
+ * the JIT with no audio, the scanline Game Boy renderer, the GBA BIOS calls natively, an ideal GBA prefetch
+ * buffer and no GBA boot intro, so games may run differently from the other profiles. Instances never draw or mix
+ * audio on a separate thread, since they already run on the caller's. Resets the CPU mode set by
+ * chroma_set_cpu_mode. */
+void chroma_set_profile(chroma_profile profile);
+
+/* Mixes the audio of instances created after this call through a fixed point version of the IIR filter, if the
+ * profile uses the IIR filter, so the audio and its hash are the same on every host. The float filter's output can
+ * differ slightly between hosts. Reset by chroma_set_profile. */
+void chroma_set_fixed_point_audio(int enabled);
+
+typedef struct chroma_rom chroma_rom;
+
+/* Copies a ROM, and the BIOS it runs with, so any number of instances can share them. The system is detected from
+ * the ROM header. GBA games need the 16KB GBA BIOS, which is ignored for GB games. Returns NULL if the ROM or BIOS
+ * isn't valid. Instances keep what they need, so the ROM can be destroyed while they're still running. ROMs and
+ * BIOSes with the same contents are only copied once per process, however many times they're created, or once per
+ * NUMA node on hosts with several, going by the node of the calling thread. */
+chroma_rom* chroma_rom_create(const void* rom, size_t rom_size, const void* bios, size_t bios_size);
+void chroma_rom_destroy(chroma_rom* rom);
+
+/* Creates an instance running the given ROM from power on. Returns NULL if the cartridge can't be emulated. */
+chroma_instance* chroma_create_from_rom(const chroma_rom* rom);
+/* Shorthand for creating an instance from a ROM which isn't shared. */
+chroma_instance* chroma_create(const void* rom, size_t rom_size, const void* bios, size_t bios_size);
+void chroma_destroy(chroma_instance* instance);
+
+chroma_system chroma_get_system(const chroma_instance* instance);
+
+/* Why the watchdog stopped the instance, or NULL if it's still running. Once it's hung, chroma_run_frame and
+ * chroma_step do nothing, and the framebuffer keeps the frame the game hung on. */
+const char* chroma_get_hang(const chroma_instance* instance);
+
+/* Runs one frame with the given buttons held. */
+void chroma_run_frame(chroma_instance* instance, uint16_t buttons);
+/* Runs a number of frames with the given buttons held, for repeating an action over several frames. Only the last
+ * few frames are drawn, and the audio covers all of them. Nothing is allocated once the audio buffer has grown to
+ * fit the longest step. */
+void chroma_step(chroma_instance* instance, uint16_t buttons, int frames);
+
+/* Sub-frame stepping, for acting partway through a frame, e.g. on a particular scanline, without running whole
+ * frames and rewinding. Each call runs with the given buttons held, and a frame it leaves partway through is finished
+ * by the next call or chroma_run_frame. The framebuffer holds the last finished frame, and the audio covers the
+ * frames which finished during the call. Savestates don't record how far into its frame they were saved. */
+typedef enum {
+    /* Stops once the frame is finished, as vblank starts. */
+    CHROMA_EVENT_VBLANK,
+    /* Stops as any visible line enters hblank. */
+    CHROMA_EVENT_HBLANK,
+    /* Stops as the line given as the value starts, counting vblank lines too. */
+    CHROMA_EVENT_SCANLINE,
+    /* Stops once the CPU jumps to the handler of an interrupt in the value's IF bit mask, or of any interrupt for 0. */
+    CHROMA_EVENT_IRQ,
+    /* Stops once the instruction at the address given as the value has run. This makes every instruction go through
+     * the interpreter for the call, like chroma_add_exec_hook. */
+    CHROMA_EVENT_PC
+} chroma_event;
+
+/* Cycles emulated since power on: GB T-cycles, twice as many per second in CGB double speed, or GBA CPU cycles.
+ * Loading a savestate puts back the count it was saved with. */
+uint64_t chroma_get_cycle(const chroma_instance* instance);
+/* Runs until the cycle count reaches the cycle, or a few cycles past it, since instructions and DMA transfers aren't
+ * split. Does nothing if it's already there. */
+void chroma_run_until(chroma_instance* instance, uint16_t buttons, uint64_t cycle);
+/* Runs until the event, or for at most max_cycles. Events which happen during an instruction or DMA transfer stop
+ * right after it. Returns 1 if the event was reached, 0 if not, or -1 for an unknown event. */
+int chroma_run_until_event(chroma_instance* instance, uint16_t buttons, chroma_event event, uint32_t value,
+                           uint64_t max_cycles);
+
+/* The last frame as BGR555 pixels, 160x144 for GB games and 240x160 for GBA games. NULL before the first frame.
+ * Only valid until the next call to chroma_run_frame. */
+const uint16_t* chroma_get_framebuffer(const chroma_instance* instance, int* width, int* height);
+/* 1 if the frame changed during the last chroma_run_frame or chroma_step, or 0 if it's the same as the one before,
+ * e.g. on a static menu or text box, so callers can skip converting, uploading or copying it again. */
+int chroma_frame_changed(const chroma_instance* instance);
+
+typedef enum {
+    /* uint16_t per pixel, the same as chroma_get_framebuffer. */
+    CHROMA_PIXEL_BGR555,
+    /* 3 bytes per pixel, red first. */
+    CHROMA_PIXEL_RGB888,
+    /* uint32_t per pixel, 0x00RRGGBB in host byte order. */
+    CHROMA_PIXEL_XRGB8888,
+    /* 1 byte of BT.601 luma per pixel. */
+    CHROMA_PIXEL_GRAY8
+} chroma_pixel_format;
+
+/* The last frame in the given format, row by row with no padding. NULL before the first frame or for an unknown
+ * format. Each pixel is converted with a single lookup in a table of every colour, and a frame is only converted
+ * again once it changes or another format is asked for. Only valid until the next call to chroma_run_frame,
+ * chroma_step or chroma_get_pixels. */
+const void* chroma_get_pixels(chroma_instance* instance, chroma_pixel_format format, int* width, int* height);
+
+/* The audio produced by the last frame. Count is the number of stereo sample pairs. Only valid until the next call
+ * to chroma_run_frame. */
+const int16_t* chroma_get_audio(const chroma_instance* instance, size_t* count);
+
+typedef enum {
+    /* GB: WRAM, 8KB or 32KB with every CGB bank. GBA: the 256KB on-board WRAM at 0x02000000. */
+    CHROMA_MEMORY_WRAM,
+    /* GB: HRAM at 0xFF80. GBA: the 32KB on-chip WRAM at 0x03000000. */
+    CHROMA_MEMORY_FAST_RAM,
+    /* GB: the cartridge's external RAM, every bank, which is empty if it has none. Always empty for GBA games. It
+     * can be read and searched, but not written or hooked. */
+    CHROMA_MEMORY_CART_RAM
+} chroma_memory;
+
+/* A read-only view of guest RAM, for inspecting game state without copying it. GBA RAM is in host byte order,
+ * which is little endian like the GBA on every host Chroma runs on. The view changes as the game runs, and stays
+ * valid for the life of the instance. */
+const uint8_t* chroma_get_memory(const chroma_instance* instance, chroma_memory region, size_t* size);
+/* Copies bytes into guest RAM, starting at the given offset into the region, for changing game state from outside
+ * the game. Code the GBA CPU modes had cached from the overwritten RAM is thrown away. Returns 0 on success, or -1 if
+ * the bytes don't fit in the region or it's cartridge RAM. */
+int chroma_write_memory(chroma_instance* instance, chroma_memory region, size_t offset, const void* data,
+                        size_t size);
+
+/* Every byte a GB game has sent over the serial port since power on, up to 64KB, for test ROMs which report their
+ * results that way. Always empty for GBA games. Only valid until the next call to chroma_run_frame. */
+const uint8_t* chroma_get_serial_output(const chroma_instance* instance, size_t* size);
+
+/* Hooks call back into a script at exact points in the emulation, for when the state at the end of each step isn't
+ * enough. They're called on the thread stepping the instance, and can read and write its memory, but mustn't step,
+ * load a state into, destroy, or change the hooks of the instance. Hooks aren't copied by chroma_clone, and an
+ * instance with none costs nothing extra to run. */
+typedef void (*chroma_frame_hook)(chroma_instance* instance, void* user_data);
+typedef void (*chroma_exec_hook)(chroma_instance* instance, uint32_t pc, void* user_data);
+typedef void (*chroma_write_hook)(chroma_instance* instance, chroma_memory region, size_t offset, void* user_data);
+
+/* Called at the end of every frame, including each frame of a chroma_step. The framebuffer is only updated at the
+ * end of the step. A NULL hook removes it. */
+void chroma_set_frame_hook(chroma_instance* instance, chroma_frame_hook hook, void* user_data);
+/* Called just before the instruction at the given address runs, replacing any hook already there. A GBA ARM
+ * instruction whose condition fails doesn't run. While any address is hooked, every instruction goes through the
+ * interpreter, so this is far slower than running with no PC hooks. */
+void chroma_add_exec_hook(chroma_instance* instance, uint32_t pc, chroma_exec_hook hook, void* user_data);
+void chroma_remove_exec_hook(chroma_instance* instance, uint32_t pc);
+/* Called after each write by the game which covers the byte at the given offset into the region, replacing any hook
+ * already there. Only writes to the hooked 4KB (GB) or 16KB (GBA) pages are slowed down. chroma_write_memory
+ * doesn't call write hooks. Returns 0 on success, or -1 if the offset is outside the region or it's cartridge RAM. */
+int chroma_add_write_hook(chroma_instance* instance, chroma_memory region, size_t offset, chroma_write_hook hook,
+                          void* user_data);
+void chroma_remove_write_hook(chroma_instance* instance, chroma_memory region, size_t offset);
+
+/* Replaces the active cheats with the codes in the string, one per line: Game Genie and GameShark codes for GB, and
+ * GameShark, Action Replay v1/v2 and unencrypted CodeBreaker codes for GBA. An empty string turns cheats off. ROM
+ * patches take effect straight away, and RAM writes at the start of every frame. Returns 0 on success, or -1 if any
+ * code can't be decoded, in which case the old cheats stay active. */
+int chroma_set_cheats(chroma_instance* instance, const char* codes);
+
+typedef struct chroma_search chroma_search;
+
+typedef enum {
+    CHROMA_COMPARE_EQUAL,
+    CHROMA_COMPARE_NOT_EQUAL,
+    CHROMA_COMPARE_LESS,
+    CHROMA_COMPARE_GREATER,
+    CHROMA_COMPARE_LESS_EQUAL,
+    CHROMA_COMPARE_GREATER_EQUAL
+} chroma_compare;
+
+/* Finds where a game keeps a value, e.g. the number of lives, by narrowing down the candidate offsets into a RAM
+ * region between frames. Values are width (1, 2 or 4) bytes, little endian and unsigned, and with aligned set only
+ * offsets which are multiples of the width are searched. The search starts with every offset as a candidate and a
+ * snapshot of the region, and must be destroyed before the instance. Returns NULL if the width isn't valid. */
+chroma_search* chroma_search_create(const chroma_instance* instance, chroma_memory region, unsigned int width,
+                                    int aligned);
+void chroma_search_destroy(chroma_search* search);
+/* Keeps the candidates whose current value compares true against their value in the last snapshot (e.g.
+ * CHROMA_COMPARE_GREATER keeps the ones which went up), or against the given value, and then takes a new snapshot.
+ * Returns the number of candidates left. */
+size_t chroma_search_narrow(chroma_search* search, chroma_compare compare);
+size_t chroma_search_narrow_value(chroma_search* search, chroma_compare compare, uint32_t value);
+/* Copies up to max_count candidate offsets into offsets, in ascending order, and returns the total number of
+ * candidates. */
+size_t chroma_search_get_candidates(const chroma_search* search, uint32_t* offsets, size_t max_count);
+
+/* Writes the 64-byte lines of guest RAM which changed to the file at the end of every frame, in the format described
+ * in src/common/RamDelta.h, optionally compressing each frame with zlib on another thread. A NULL path stops the
+ * stream. Returns 0 on success, or -1 if the file can't be opened. */
+int chroma_stream_ram_deltas(chroma_instance* instance, const char* path, int compress);
+
+/* Guest code coverage, for fuzzers: a map of 8-bit hit counters, one per hashed edge between consecutive
+ * instructions, as described in src/common/Coverage.h. While it's on, every instruction goes through the
+ * interpreter. Turning it on starts from an empty map, and chroma_clear_coverage empties it again, e.g. before each
+ * input. The map isn't part of savestates, and isn't copied by chroma_clone. */
+void chroma_set_coverage(chroma_instance* instance, int enable);
+void chroma_clear_coverage(chroma_instance* instance);
+/* The map, or NULL if coverage is off. Only valid until coverage is turned off. */
+const uint8_t* chroma_get_coverage(const chroma_instance* instance, size_t* size);
+
+/* Records which guest instructions run from now on, for QA: a bit for each place an instruction can start in ROM and
+ * RAM, set the first time one runs there. Unlike chroma_set_coverage, it keeps the block cache and JIT, which mark
+ * whole blocks as they're entered. Once on, it stays on. */
+void chroma_enable_code_coverage(chroma_instance* instance);
+/* Writes how many instructions have run from each region, and a disassembly of each of them, to the file. Returns 0
+ * on success, or -1 if code coverage is off or the file can't be written. */
+int chroma_write_coverage_report(chroma_instance* instance, const char* path);
+
+/* 64-bit hashes of the output, which are far cheaper to compare against a known good run than frames or samples.
+ * The frame hash covers the last frame, and the audio hash covers every sample since power on, including those
+ * before a loaded savestate was saved. */
+uint64_t chroma_get_frame_hash(const chroma_instance* instance);
+uint64_t chroma_get_audio_hash(const chroma_instance* instance);
+
+/* Saves a savestate into the buffer, and returns its size. Nothing is written if the buffer is too small, so
+ * passing a NULL buffer gives the size to allocate. */
+size_t chroma_save_state(chroma_instance* instance, void* buffer, size_t buffer_size);
+/* Returns 0 on success, or -1 if the buffer doesn't hold a valid savestate for this instance. */
+int chroma_load_state(chroma_instance* instance, const void* buffer, size_t size);
+
+/* Savestates leave out the host's side of an instance: how far through a frame it is, and the history of its audio
+ * resampler and filters. Saving this along with a state, and loading it after the state, resumes the instance exactly
+ * as it would have carried on, with the same frame and audio hashes. Without it, a loaded state plays the same game
+ * but may end its frames a few cycles off, and its audio hash goes its own way. Same conventions as the calls above. */
+size_t chroma_save_host_state(chroma_instance* instance, void* buffer, size_t buffer_size);
+int chroma_load_host_state(chroma_instance* instance, const void* buffer, size_t size);
+
+/* Copies the whole state of one instance into another of the same ROM, without going through a caller buffer. Like
+ * chroma_clone, it costs one save and one load of the whole state, however little of it differs between the two.
+ * Returns 0 on success, or -1 if the instances aren't running the same game. */
+int chroma_copy_state(chroma_instance* dst, chroma_instance* src);
+/* Creates a new instance in the same state as the given one, sharing its ROM, e.g. for exploring several inputs from
+ * one point in a game, with the same cheats. Returns NULL on failure. A link cable isn't carried over. */
+chroma_instance* chroma_clone(chroma_instance* instance);
+
+/* Hibernates an idle instance: its state is compressed into a small buffer and its emulated hardware is freed,
+ * leaving only the instance's own small bookkeeping and the compressed state. The ROM stays shared. While
+ * hibernating, only chroma_wake, chroma_is_hibernating, chroma_get_system and chroma_destroy may be called on it.
+ * Cheats and the host state are carried across, so the frame and audio hashes carry on as if it had never stopped;
+ * hooks, coverage, RAM delta streams and link cables aren't. Returns 0 on success, or -1 if the state
+ * couldn't be compressed, in which case the instance keeps running. */
+int chroma_hibernate(chroma_instance* instance);
+/* Brings a hibernated instance back exactly where it left off, with the same settings it was created with, which
+ * usually takes a few milliseconds. Does nothing if it isn't hibernating. Returns -1 if the cores can't be created
+ * again, in which case it stays hibernating. */
+int chroma_wake(chroma_instance* instance);
+int chroma_is_hibernating(const chroma_instance* instance);
+
+/* Connects a link cable between two instances of the same system, replacing any cable either had before. The first
+ * is the parent in GBA multiplayer mode. Linked instances wait on each other at every transfer, so each must run on
+ * its own thread, and give up on the other after a second without an answer. Returns -1 if the systems differ. */
+int chroma_link(chroma_instance* first, chroma_instance* second);
+
+typedef struct chroma_vec chroma_vec;
+
+/* A set of instances of the same ROM which are stepped together on a pool of threads, for running many copies of a
+ * game at once. num_threads includes the calling thread, and 0 uses one per host thread. Returns NULL if the
+ * instances can't be created. */
+chroma_vec* chroma_vec_create(const chroma_rom* rom, size_t count, unsigned int num_threads);
+void chroma_vec_destroy(chroma_vec* vec);
+
+/* The instances stay owned by the vec, and can be used with the functions above between steps. */
+chroma_instance* chroma_vec_get_instance(chroma_vec* vec, size_t index);
+
+/* Calls chroma_step on every instance, with buttons[i] held on instance i, and blocks until all are done. */
+void chroma_vec_step(chroma_vec* vec, const uint16_t* buttons, int frames);
+
+/* The last frame of every instance, one after the other in instance order, in the format of chroma_get_framebuffer.
+ * The buffer is allocated once, and is only valid until the next call to chroma_vec_step. NULL if the vec has been
+ * set to another pixel format. */
+const uint16_t* chroma_vec_get_frames(const chroma_vec* vec, int* width, int* height);
+/* Switches the frames of the vec to another pixel format, BGR555 by default. Each instance converts its frame
+ * straight into the vec's buffer as it finishes a step, instead of copying it. Returns -1 for an unknown format. */
+int chroma_vec_set_pixel_format(chroma_vec* vec, chroma_pixel_format format);
+/* The last frame of every instance in the vec's pixel format, laid out like chroma_vec_get_frames. */
+const void* chroma_vec_get_pixels(const chroma_vec* vec, int* width, int* height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHROMA_H */
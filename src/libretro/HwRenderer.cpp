@@ -0,0 +1,80 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdexcept>
+#include <fmt/format.h>
+
+#include "libretro/HwRenderer.h"
+
+namespace Libretro {
+
+HwRenderer::HwRenderer(GetProcAddress get_proc_address, int _width, int _height, int _scale, bool gba,
+                       Emu::GlScaler scaler, bool colour_correction)
+        : width(_width)
+        , height(_height)
+        , scale(_scale)
+        , gl(std::make_unique<Emu::GlFunctions>()) {
+
+    const char* missing_function = gl->Load(get_proc_address);
+    if (missing_function != nullptr) {
+        throw std::runtime_error(fmt::format("OpenGL 3.3 is required, but {} is missing.", missing_function));
+    }
+
+    program = Emu::CreateFrameProgram(*gl, width, height, scaler, gba, colour_correction);
+    gl->UseProgram(program);
+    gl->Uniform1i(gl->GetUniformLocation(program, "frame"), 0);
+    output_size_uniform = gl->GetUniformLocation(program, "output_size");
+
+    gl->GenVertexArrays(1, &vertex_array);
+
+    gl->GenTextures(1, &texture);
+    gl->BindTexture(GL_TEXTURE_2D, texture);
+    const GLint filter = (scaler == Emu::GlScaler::Sharp) ? GL_LINEAR : GL_NEAREST;
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Red is in the low bits of a BGR555 pixel, which is the order GL's reversed 1555 format expects.
+    gl->TexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
+                   nullptr);
+}
+
+HwRenderer::~HwRenderer() {
+    gl->DeleteTextures(1, &texture);
+    gl->DeleteVertexArrays(1, &vertex_array);
+    gl->DeleteProgram(program);
+}
+
+void HwRenderer::Draw(const u16* pixels, std::uintptr_t framebuffer) {
+    // The frontend shares the context, so none of the state set up earlier can be relied on.
+    gl->ActiveTexture(GL_TEXTURE0);
+    gl->BindTexture(GL_TEXTURE_2D, texture);
+    if (pixels != nullptr) {
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        gl->PixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        gl->TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
+    }
+
+    gl->BindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+    gl->Viewport(0, 0, OutputWidth(), OutputHeight());
+    gl->UseProgram(program);
+    gl->Uniform2f(output_size_uniform, OutputWidth(), OutputHeight());
+    gl->BindVertexArray(vertex_array);
+    gl->DrawArrays(GL_TRIANGLES, 0, 3);
+    gl->BindVertexArray(0);
+}
+
+} // End namespace Libretro
@@ -0,0 +1,59 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "common/CommonTypes.h"
+#include "emu/GlCommon.h"
+
+namespace Libretro {
+
+// Draws frames into the libretro frontend's framebuffer, scaled up on the GPU with the same shader as the frontend's
+// OpenGL presenter. Must only be used while the frontend's context is current, which it is from context_reset until
+// context_destroy and during retro_run.
+class HwRenderer {
+public:
+    using ProcAddress = void (*)();
+    using GetProcAddress = ProcAddress (*)(const char*);
+
+    // Throws std::runtime_error if the context doesn't have OpenGL 3.3 or the shaders can't be built.
+    HwRenderer(GetProcAddress get_proc_address, int _width, int _height, int _scale, bool gba,
+               Emu::GlScaler scaler, bool colour_correction);
+    ~HwRenderer();
+
+    int OutputWidth() const { return width * scale; }
+    int OutputHeight() const { return height * scale; }
+
+    // Uploads the frame, unless pixels is nullptr, and draws the last frame uploaded into the framebuffer.
+    void Draw(const u16* pixels, std::uintptr_t framebuffer);
+
+private:
+    const int width;
+    const int height;
+    const int scale;
+
+    std::unique_ptr<Emu::GlFunctions> gl;
+
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    GLuint texture = 0;
+    GLint output_size_uniform = -1;
+};
+
+} // End namespace Libretro
@@ -0,0 +1,462 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <libretro.h>
+
+#include "common/CommonTypes.h"
+#include "lib/chroma.h"
+#include "libretro/HwRenderer.h"
+
+// A libretro core built on the C API. It only uses the parts of libretro which save the frontend work: frames which
+// didn't change are duped instead of being sent again, audio goes out a frame at a time, savestates are a single
+// copy out of the core for the frontend's run-ahead and rewind, and the GPU scaler draws straight into the
+// frontend's framebuffer.
+
+namespace {
+
+retro_environment_t environ_cb = nullptr;
+retro_video_refresh_t video_cb = nullptr;
+retro_audio_sample_batch_t audio_batch_cb = nullptr;
+retro_input_poll_t input_poll_cb = nullptr;
+retro_input_state_t input_state_cb = nullptr;
+retro_log_printf_t log_cb = nullptr;
+
+// The cores mix 800 stereo samples a frame.
+constexpr double frames_per_second = CHROMA_SAMPLE_RATE / 800.0;
+
+constexpr std::array<std::pair<unsigned, u16>, 10> button_map{{
+    {RETRO_DEVICE_ID_JOYPAD_UP, CHROMA_BUTTON_UP},
+    {RETRO_DEVICE_ID_JOYPAD_LEFT, CHROMA_BUTTON_LEFT},
+    {RETRO_DEVICE_ID_JOYPAD_DOWN, CHROMA_BUTTON_DOWN},
+    {RETRO_DEVICE_ID_JOYPAD_RIGHT, CHROMA_BUTTON_RIGHT},
+    {RETRO_DEVICE_ID_JOYPAD_A, CHROMA_BUTTON_A},
+    {RETRO_DEVICE_ID_JOYPAD_B, CHROMA_BUTTON_B},
+    {RETRO_DEVICE_ID_JOYPAD_L, CHROMA_BUTTON_L},
+    {RETRO_DEVICE_ID_JOYPAD_R, CHROMA_BUTTON_R},
+    {RETRO_DEVICE_ID_JOYPAD_START, CHROMA_BUTTON_START},
+    {RETRO_DEVICE_ID_JOYPAD_SELECT, CHROMA_BUTTON_SELECT},
+}};
+
+struct Session {
+    chroma_rom* rom = nullptr;
+    chroma_instance* instance = nullptr;
+    int width = 0;
+    int height = 0;
+
+    // Read once when the game is loaded.
+    bool can_dupe = false;
+    bool input_bitmasks = false;
+
+    // The software path converts frames to RGB565, or to 0RGB1555 for frontends without it.
+    bool rgb565 = true;
+    std::vector<u16> converted_frame;
+
+    // Only used by the GPU scaler, which needs a restart to turn on or off.
+    int gpu_scale = 0;
+    Emu::GlScaler gpu_scaler = Emu::GlScaler::Integer;
+    bool colour_correction = false;
+    retro_hw_render_callback hw_render{};
+    std::unique_ptr<Libretro::HwRenderer> renderer;
+    // A new renderer's texture is empty, and the frontend's last frame went with the old context, so the current
+    // frame has to be uploaded even if it hasn't changed.
+    bool renderer_empty = false;
+
+    // The size of the first savestate, which the frontend sizes its buffers from.
+    std::size_t state_size = 0;
+
+    std::vector<std::string> cheats;
+} session;
+
+void Log(retro_log_level level, const std::string& message) {
+    if (log_cb != nullptr) {
+        log_cb(level, "%s\n", message.c_str());
+    } else {
+        std::fprintf(stderr, "%s\n", message.c_str());
+    }
+}
+
+std::string Variable(const char* key, const std::string& fallback) {
+    retro_variable variable{key, nullptr};
+    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &variable) && variable.value != nullptr) {
+        return variable.value;
+    }
+    return fallback;
+}
+
+std::vector<u8> ReadBios() {
+    const char* system_dir = nullptr;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &system_dir) || system_dir == nullptr) {
+        return {};
+    }
+
+    std::ifstream bios_file{std::string{system_dir} + "/gba_bios.bin", std::ios::binary};
+    if (!bios_file) {
+        return {};
+    }
+    return {std::istreambuf_iterator<char>{bios_file}, {}};
+}
+
+void ApplyProfile() {
+    const std::string accuracy = Variable("chroma_accuracy", "accurate");
+    if (accuracy == "fast") {
+        chroma_set_profile(CHROMA_PROFILE_FAST);
+    } else if (accuracy == "balanced") {
+        chroma_set_profile(CHROMA_PROFILE_BALANCED);
+    } else {
+        chroma_set_profile(CHROMA_PROFILE_ACCURATE);
+    }
+}
+
+void ReadGpuOptions() {
+    const std::string scale = Variable("chroma_gpu_scale", "off");
+    session.gpu_scale = (scale == "off") ? 0 : std::clamp(std::atoi(scale.c_str()), 1, 8);
+
+    const std::string filter = Variable("chroma_gpu_filter", "nearest");
+    session.gpu_scaler = (filter == "lcd") ? Emu::GlScaler::Lcd : Emu::GlScaler::Integer;
+    session.colour_correction = Variable("chroma_colour_correction", "off") == "on";
+}
+
+void ContextReset() {
+    try {
+        session.renderer = std::make_unique<Libretro::HwRenderer>(session.hw_render.get_proc_address, session.width,
+                                                                  session.height, session.gpu_scale,
+                                                                  chroma_get_system(session.instance)
+                                                                          == CHROMA_SYSTEM_GBA,
+                                                                  session.gpu_scaler, session.colour_correction);
+        session.renderer_empty = true;
+    } catch (const std::runtime_error& e) {
+        Log(RETRO_LOG_ERROR, e.what());
+        session.renderer.reset();
+    }
+}
+
+void ContextDestroy() {
+    session.renderer.reset();
+}
+
+bool SetUpHwRender() {
+    session.hw_render = retro_hw_render_callback{};
+    session.hw_render.context_type = RETRO_HW_CONTEXT_OPENGL_CORE;
+    session.hw_render.version_major = 3;
+    session.hw_render.version_minor = 3;
+    session.hw_render.context_reset = ContextReset;
+    session.hw_render.context_destroy = ContextDestroy;
+    session.hw_render.bottom_left_origin = true;
+    return environ_cb(RETRO_ENVIRONMENT_SET_HW_RENDER, &session.hw_render);
+}
+
+u16 PollButtons() {
+    u16 buttons = 0;
+    if (session.input_bitmasks) {
+        const auto mask = static_cast<u16>(input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK));
+        for (const auto& [retro_id, chroma_button] : button_map) {
+            if ((mask >> retro_id) & 1) {
+                buttons |= chroma_button;
+            }
+        }
+    } else {
+        for (const auto& [retro_id, chroma_button] : button_map) {
+            if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, retro_id)) {
+                buttons |= chroma_button;
+            }
+        }
+    }
+    return buttons;
+}
+
+void ConvertFrame(const u16* frame) {
+    const std::size_t pixels = static_cast<std::size_t>(session.width) * session.height;
+    if (session.rgb565) {
+        std::transform(frame, frame + pixels, session.converted_frame.begin(), [](u16 bgr) {
+            const u16 red = bgr & 0x1F;
+            const u16 green = (bgr >> 5) & 0x1F;
+            const u16 blue = (bgr >> 10) & 0x1F;
+            // Green gets a sixth bit, copied from its top bit so full intensity stays full.
+            return static_cast<u16>((red << 11) | (green << 6) | ((green >> 4) << 5) | blue);
+        });
+    } else {
+        std::transform(frame, frame + pixels, session.converted_frame.begin(), [](u16 bgr) {
+            return static_cast<u16>(((bgr & 0x1F) << 10) | (bgr & 0x03E0) | ((bgr >> 10) & 0x1F));
+        });
+    }
+}
+
+void PresentFrame(bool video_enabled) {
+    const bool changed = chroma_frame_changed(session.instance);
+    const u16* frame = chroma_get_framebuffer(session.instance, nullptr, nullptr);
+
+    if (session.hw_render.context_type != RETRO_HW_CONTEXT_NONE) {
+        if (session.renderer == nullptr || frame == nullptr) {
+            video_cb(nullptr, session.width * session.gpu_scale, session.height * session.gpu_scale, 0);
+            return;
+        }
+        const bool upload = changed || session.renderer_empty;
+        if ((!upload || !video_enabled) && session.can_dupe) {
+            video_cb(nullptr, session.renderer->OutputWidth(), session.renderer->OutputHeight(), 0);
+            return;
+        }
+        session.renderer->Draw(upload ? frame : nullptr, session.hw_render.get_current_framebuffer());
+        session.renderer_empty = false;
+        video_cb(RETRO_HW_FRAME_BUFFER_VALID, session.renderer->OutputWidth(), session.renderer->OutputHeight(), 0);
+        return;
+    }
+
+    if (frame == nullptr || ((!changed || !video_enabled) && session.can_dupe)) {
+        video_cb(nullptr, session.width, session.height, session.width * sizeof(u16));
+        return;
+    }
+    if (changed) {
+        ConvertFrame(frame);
+    }
+    video_cb(session.converted_frame.data(), session.width, session.height, session.width * sizeof(u16));
+}
+
+void SendAudio() {
+    std::size_t frames = 0;
+    const s16* samples = chroma_get_audio(session.instance, &frames);
+    // The frontend may take fewer frames than it's given, in which case the rest are sent again.
+    while (frames != 0) {
+        const std::size_t sent = std::min(audio_batch_cb(samples, frames), frames);
+        if (sent == 0) {
+            break;
+        }
+        samples += sent * 2;
+        frames -= sent;
+    }
+}
+
+// Returns false if any of the codes can't be decoded, in which case the old cheats stay active.
+bool ApplyCheats() {
+    std::string codes;
+    for (const std::string& cheat : session.cheats) {
+        if (!cheat.empty()) {
+            codes += cheat + '\n';
+        }
+    }
+    return chroma_set_cheats(session.instance, codes.c_str()) == 0;
+}
+
+void DestroySession() {
+    session.renderer.reset();
+    if (session.instance != nullptr) {
+        chroma_destroy(session.instance);
+        session.instance = nullptr;
+    }
+    if (session.rom != nullptr) {
+        chroma_rom_destroy(session.rom);
+        session.rom = nullptr;
+    }
+    session.hw_render = retro_hw_render_callback{};
+    session.cheats.clear();
+}
+
+} // End anonymous namespace
+
+void retro_set_environment(retro_environment_t cb) {
+    environ_cb = cb;
+
+    static const retro_variable variables[] = {
+        {"chroma_accuracy", "Accuracy (restart); accurate|balanced|fast"},
+        {"chroma_gpu_scale", "GPU scaling (restart); off|2|3|4|5|6"},
+        {"chroma_gpu_filter", "GPU scaling filter (restart); nearest|lcd"},
+        {"chroma_colour_correction", "GPU colour correction (restart); off|on"},
+        {nullptr, nullptr},
+    };
+    environ_cb(RETRO_ENVIRONMENT_SET_VARIABLES, const_cast<retro_variable*>(variables));
+
+    retro_log_callback logging{};
+    if (environ_cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging)) {
+        log_cb = logging.log;
+    }
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb) { video_cb = cb; }
+// Audio only goes out in batches.
+void retro_set_audio_sample(retro_audio_sample_t) {}
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) { audio_batch_cb = cb; }
+void retro_set_input_poll(retro_input_poll_t cb) { input_poll_cb = cb; }
+void retro_set_input_state(retro_input_state_t cb) { input_state_cb = cb; }
+void retro_set_controller_port_device(unsigned, unsigned) {}
+
+void retro_init() {}
+void retro_deinit() {}
+
+unsigned retro_api_version() {
+    return RETRO_API_VERSION;
+}
+
+void retro_get_system_info(retro_system_info* info) {
+    *info = retro_system_info{};
+    info->library_name = "Chroma";
+    info->library_version = "0.1";
+    info->valid_extensions = "gb|gbc|gba";
+    info->need_fullpath = false;
+    info->block_extract = false;
+}
+
+void retro_get_system_av_info(retro_system_av_info* info) {
+    const int scale = (session.hw_render.context_type != RETRO_HW_CONTEXT_NONE) ? session.gpu_scale : 1;
+    *info = retro_system_av_info{};
+    info->geometry.base_width = session.width * scale;
+    info->geometry.base_height = session.height * scale;
+    info->geometry.max_width = session.width * scale;
+    info->geometry.max_height = session.height * scale;
+    info->geometry.aspect_ratio = static_cast<float>(session.width) / session.height;
+    info->timing.fps = frames_per_second;
+    info->timing.sample_rate = CHROMA_SAMPLE_RATE;
+}
+
+bool retro_load_game(const retro_game_info* game) {
+    if (game == nullptr || game->data == nullptr) {
+        return false;
+    }
+
+    ApplyProfile();
+    ReadGpuOptions();
+
+    const std::vector<u8> bios = ReadBios();
+    session.rom = chroma_rom_create(game->data, game->size, bios.empty() ? nullptr : bios.data(), bios.size());
+    if (session.rom == nullptr) {
+        Log(RETRO_LOG_ERROR, bios.empty() ? "Couldn't load the ROM. GBA games need gba_bios.bin in the system "
+                                            "directory."
+                                          : "Couldn't load the ROM.");
+        return false;
+    }
+    session.instance = chroma_create_from_rom(session.rom);
+    if (session.instance == nullptr) {
+        Log(RETRO_LOG_ERROR, "This cartridge can't be emulated.");
+        DestroySession();
+        return false;
+    }
+    chroma_get_framebuffer(session.instance, &session.width, &session.height);
+
+    bool can_dupe = false;
+    session.can_dupe = environ_cb(RETRO_ENVIRONMENT_GET_CAN_DUPE, &can_dupe) && can_dupe;
+    session.input_bitmasks = environ_cb(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, nullptr);
+
+    if (session.gpu_scale != 0 && !SetUpHwRender()) {
+        Log(RETRO_LOG_WARN, "The frontend can't provide an OpenGL 3.3 context, so frames are scaled on the CPU.");
+        session.hw_render = retro_hw_render_callback{};
+    }
+    if (session.hw_render.context_type == RETRO_HW_CONTEXT_NONE) {
+        retro_pixel_format format = RETRO_PIXEL_FORMAT_RGB565;
+        session.rgb565 = environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format);
+        session.converted_frame.assign(static_cast<std::size_t>(session.width) * session.height, 0x0000);
+    }
+
+    session.state_size = chroma_save_state(session.instance, nullptr, 0);
+    return true;
+}
+
+bool retro_load_game_special(unsigned, const retro_game_info*, size_t) {
+    return false;
+}
+
+void retro_unload_game() {
+    DestroySession();
+}
+
+void retro_reset() {
+    chroma_instance* instance = chroma_create_from_rom(session.rom);
+    if (instance == nullptr) {
+        Log(RETRO_LOG_ERROR, "Couldn't power the game back on.");
+        return;
+    }
+
+    chroma_destroy(session.instance);
+    session.instance = instance;
+    ApplyCheats();
+}
+
+void retro_run() {
+    input_poll_cb();
+    chroma_run_frame(session.instance, PollButtons());
+
+    // Bit 0 is video and bit 1 is audio. The frontend turns them off for the frames run-ahead throws away.
+    int av_enable = 3;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable)) {
+        av_enable = 3;
+    }
+
+    PresentFrame(av_enable & 1);
+    if (av_enable & 2) {
+        SendAudio();
+    }
+}
+
+unsigned retro_get_region() {
+    return RETRO_REGION_NTSC;
+}
+
+size_t retro_serialize_size() {
+    return session.state_size;
+}
+
+bool retro_serialize(void* data, size_t size) {
+    return chroma_save_state(session.instance, data, size) <= size;
+}
+
+bool retro_unserialize(const void* data, size_t size) {
+    return chroma_load_state(session.instance, data, size) == 0;
+}
+
+void retro_cheat_reset() {
+    session.cheats.clear();
+    chroma_set_cheats(session.instance, "");
+}
+
+void retro_cheat_set(unsigned index, bool enabled, const char* code) {
+    if (session.cheats.size() <= index) {
+        session.cheats.resize(index + 1);
+    }
+    // Frontends join the lines of a multi-line code with '+'.
+    std::string lines = enabled ? code : "";
+    std::replace(lines.begin(), lines.end(), '+', '\n');
+    session.cheats[index] = lines;
+
+    if (!ApplyCheats()) {
+        Log(RETRO_LOG_WARN, "Couldn't decode cheat " + std::string{code});
+        session.cheats[index].clear();
+    }
+}
+
+void* retro_get_memory_data(unsigned id) {
+    if (session.instance == nullptr || id != RETRO_MEMORY_SYSTEM_RAM) {
+        return nullptr;
+    }
+    // Exposed for achievements and cheat searches, which only read it.
+    std::size_t size = 0;
+    return const_cast<u8*>(chroma_get_memory(session.instance, CHROMA_MEMORY_WRAM, &size));
+}
+
+size_t retro_get_memory_size(unsigned id) {
+    if (session.instance == nullptr || id != RETRO_MEMORY_SYSTEM_RAM) {
+        return 0;
+    }
+    std::size_t size = 0;
+    chroma_get_memory(session.instance, CHROMA_MEMORY_WRAM, &size);
+    return size;
+}
@@ -0,0 +1,387 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <fmt/format.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "server/ControlServer.h"
+#include "common/Hash.h"
+#include "common/Socket.h"
+
+namespace Server {
+
+class RequestReader {
+public:
+    explicit RequestReader(const std::vector<u8>& _request)
+            : request(_request) {}
+
+    bool Done() const { return position == request.size(); }
+    std::size_t Position() const { return position; }
+
+    template<typename T>
+    T Take() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, TakeBytes(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    const u8* TakeBytes(std::size_t size) {
+        if (size > request.size() - position) {
+            throw std::runtime_error("The request ends partway through a command.");
+        }
+
+        const u8* bytes = request.data() + position;
+        position += size;
+        return bytes;
+    }
+
+private:
+    const std::vector<u8>& request;
+    std::size_t position = 0;
+};
+
+class ResponseWriter {
+public:
+    template<typename T>
+    void Put(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        PutBytes(&value, sizeof(T));
+    }
+
+    void PutBytes(const void* data, std::size_t size) {
+        const u8* bytes = static_cast<const u8*>(data);
+        response.insert(response.end(), bytes, bytes + size);
+    }
+
+    // Fills in a value which was reserved before its contents were known.
+    template<typename T>
+    void PutAt(std::size_t position, T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        std::memcpy(response.data() + position, &value, sizeof(T));
+    }
+
+    std::vector<u8> response;
+};
+
+namespace {
+
+// Anything bigger than this is taken as a broken client rather than allocated.
+constexpr u32 max_request_bytes = 64 * 1024 * 1024;
+constexpr std::size_t delta_block_bytes = 4096;
+
+std::vector<u8> ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error("Error when attempting to open " + path);
+    }
+
+    return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+chroma_memory TakeRegion(RequestReader& reader) {
+    const u8 region = reader.Take<u8>();
+    if (region > CHROMA_MEMORY_FAST_RAM) {
+        throw std::runtime_error(fmt::format("Invalid memory region: {}", region));
+    }
+
+    return static_cast<chroma_memory>(region);
+}
+
+} // End anonymous namespace
+
+ControlServer::ControlServer(std::vector<u8> _bios, int _hibernate_seconds)
+        : bios(std::move(_bios))
+        , hibernate_seconds(_hibernate_seconds) {}
+
+void ControlServer::Run(const std::string& socket_path) {
+    const int listen_fd = Common::ListenOnUnixSocket(socket_path, 1);
+    fmt::print("Listening on {}.\n", socket_path);
+
+    while (true) {
+        WaitForRequest(listen_fd);
+        const int socket_fd = accept(listen_fd, nullptr, nullptr);
+        if (socket_fd < 0) {
+            continue;
+        }
+
+        ServeClient(socket_fd);
+        close(socket_fd);
+    }
+}
+
+void ControlServer::ServeClient(int socket_fd) {
+    std::vector<u8> request;
+    while (true) {
+        WaitForRequest(socket_fd);
+        u32 request_bytes;
+        if (!Common::ReceiveAll(socket_fd, &request_bytes, sizeof(request_bytes))
+                || request_bytes > max_request_bytes) {
+            return;
+        }
+
+        request.resize(request_bytes);
+        if (!Common::ReceiveAll(socket_fd, request.data(), request.size())) {
+            return;
+        }
+
+        const std::vector<u8> response = RunRequest(request);
+        const u32 response_bytes = response.size();
+        if (!Common::SendAll(socket_fd, &response_bytes, sizeof(response_bytes))
+                || !Common::SendAll(socket_fd, response.data(), response.size())) {
+            return;
+        }
+    }
+}
+
+void ControlServer::WaitForRequest(int socket_fd) {
+    if (hibernate_seconds == 0 || instance == nullptr || chroma_is_hibernating(instance.get())) {
+        return;
+    }
+
+    pollfd poll_fd{socket_fd, POLLIN, 0};
+    if (poll(&poll_fd, 1, hibernate_seconds * 1000) == 0) {
+        // If it fails, the game carries on as it was.
+        chroma_hibernate(instance.get());
+    }
+}
+
+std::vector<u8> ControlServer::RunRequest(const std::vector<u8>& request) {
+    RequestReader reader{request};
+    ResponseWriter writer;
+
+    while (!reader.Done()) {
+        // The status is filled in once the command has run.
+        const std::size_t status_position = writer.response.size();
+        writer.Put<u8>(0);
+
+        try {
+            const auto command = static_cast<Command>(reader.Take<u8>());
+            if (command != Command::LoadRom && instance == nullptr) {
+                throw std::runtime_error("No ROM has been loaded.");
+            }
+            if (command != Command::LoadRom && instance != nullptr && chroma_wake(instance.get()) != 0) {
+                throw std::runtime_error("The game couldn't be woken from hibernation.");
+            }
+
+            switch (command) {
+            case Command::LoadRom: {
+                const u32 path_length = reader.Take<u32>();
+                const u8* path_bytes = reader.TakeBytes(path_length);
+                const std::string path(path_bytes, path_bytes + path_length);
+                const std::vector<u8> rom = ReadFile(path);
+
+                instance.reset(chroma_create(rom.data(), rom.size(), bios.data(), bios.size()));
+                if (instance == nullptr) {
+                    throw std::runtime_error(path + " is neither a GB or GBA game, or it's a GBA game with no BIOS.");
+                }
+                buttons = 0;
+                saved_state.clear();
+                loaded_state.clear();
+                frames_stepped = 0;
+                step_seconds = 0.0;
+                writer.Put<u8>(chroma_get_system(instance.get()));
+                break;
+            }
+            case Command::SetButtons:
+                buttons = reader.Take<u16>();
+                break;
+            case Command::Step: {
+                const u32 frames = reader.Take<u32>();
+                if (frames == 0 || frames > 0x7FFF'FFFF) {
+                    throw std::runtime_error(fmt::format("Invalid number of frames to step: {}", frames));
+                }
+
+                const auto start_time = std::chrono::steady_clock::now();
+                chroma_step(instance.get(), buttons, frames);
+                step_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+                frames_stepped += frames;
+                writer.Put<u8>(chroma_get_hang(instance.get()) != nullptr);
+                break;
+            }
+            case Command::SaveState: {
+                state_buffer.resize(chroma_save_state(instance.get(), nullptr, 0));
+                chroma_save_state(instance.get(), state_buffer.data(), state_buffer.size());
+                writer.Put<u32>(state_buffer.size());
+                writer.PutBytes(state_buffer.data(), state_buffer.size());
+                saved_state.swap(state_buffer);
+                break;
+            }
+            case Command::LoadState: {
+                const u32 state_size = reader.Take<u32>();
+                const u8* state = reader.TakeBytes(state_size);
+                if (chroma_load_state(instance.get(), state, state_size) != 0) {
+                    throw std::runtime_error("The savestate isn't valid for this game.");
+                }
+                loaded_state.assign(state, state + state_size);
+                break;
+            }
+            case Command::ReadMemory: {
+                const chroma_memory region = TakeRegion(reader);
+                const u32 offset = reader.Take<u32>();
+                const u32 size = reader.Take<u32>();
+
+                std::size_t region_size;
+                const u8* ram = chroma_get_memory(instance.get(), region, &region_size);
+                if (offset > region_size || size > region_size - offset) {
+                    throw std::runtime_error(fmt::format("Can't read {} bytes at offset {:#x} of a {} byte region.",
+                                                         size, offset, region_size));
+                }
+                writer.PutBytes(ram + offset, size);
+                break;
+            }
+            case Command::WriteMemory: {
+                const chroma_memory region = TakeRegion(reader);
+                const u32 offset = reader.Take<u32>();
+                const u32 size = reader.Take<u32>();
+                const u8* bytes = reader.TakeBytes(size);
+                if (chroma_write_memory(instance.get(), region, offset, bytes, size) != 0) {
+                    throw std::runtime_error(fmt::format("Can't write {} bytes at offset {:#x} of the region.",
+                                                         size, offset));
+                }
+                break;
+            }
+            case Command::GetHashes:
+                writer.Put<u64>(chroma_get_frame_hash(instance.get()));
+                writer.Put<u64>(chroma_get_audio_hash(instance.get()));
+                break;
+            case Command::GetFrame: {
+                int width, height;
+                const u16* frame = chroma_get_framebuffer(instance.get(), &width, &height);
+                writer.Put<u16>(width);
+                writer.Put<u16>(height);
+                if (frame != nullptr) {
+                    writer.PutBytes(frame, width * height * sizeof(u16));
+                } else {
+                    // Nothing has been drawn before the first step.
+                    writer.response.resize(writer.response.size() + width * height * sizeof(u16), 0);
+                }
+                break;
+            }
+            case Command::GetAudio: {
+                std::size_t count;
+                const s16* samples = chroma_get_audio(instance.get(), &count);
+                writer.Put<u32>(count);
+                writer.PutBytes(samples, count * 2 * sizeof(s16));
+                break;
+            }
+            case Command::GetMetrics:
+                writer.Put<u64>(frames_stepped);
+                writer.Put<double>(step_seconds);
+                break;
+            case Command::SaveDelta:
+                SaveDelta(writer);
+                break;
+            case Command::LoadDelta:
+                LoadDelta(reader);
+                break;
+            default:
+                throw std::runtime_error(fmt::format("Invalid command: {}", static_cast<int>(command)));
+            }
+        } catch (const std::exception& e) {
+            // Drop whatever the failed command had written, and skip the rest of the request.
+            writer.response.resize(status_position);
+            const std::string message{e.what()};
+            writer.Put<u8>(1);
+            writer.Put<u32>(message.size());
+            writer.PutBytes(message.data(), message.size());
+            break;
+        }
+    }
+
+    return std::move(writer.response);
+}
+
+void ControlServer::SaveDelta(ResponseWriter& writer) {
+    if (saved_state.empty()) {
+        throw std::runtime_error("A delta needs a state saved before it to be taken against.");
+    }
+
+    state_buffer.resize(chroma_save_state(instance.get(), nullptr, 0));
+    chroma_save_state(instance.get(), state_buffer.data(), state_buffer.size());
+
+    // The length and block count are filled in once the changed blocks have been found.
+    const std::size_t length_position = writer.response.size();
+    writer.Put<u32>(0);
+    writer.Put<u64>(Common::XxHash64::Hash(saved_state.data(), saved_state.size()));
+    writer.Put<u32>(state_buffer.size());
+    const std::size_t count_position = writer.response.size();
+    writer.Put<u32>(0);
+
+    u32 block_count = 0;
+    for (std::size_t offset = 0; offset < state_buffer.size(); offset += delta_block_bytes) {
+        const std::size_t size = std::min(delta_block_bytes, state_buffer.size() - offset);
+        if (offset + size <= saved_state.size()
+                && std::memcmp(state_buffer.data() + offset, saved_state.data() + offset, size) == 0) {
+            continue;
+        }
+
+        writer.Put<u32>(offset / delta_block_bytes);
+        writer.PutBytes(state_buffer.data() + offset, size);
+        ++block_count;
+    }
+
+    writer.PutAt<u32>(length_position, writer.response.size() - length_position - sizeof(u32));
+    writer.PutAt<u32>(count_position, block_count);
+    saved_state.swap(state_buffer);
+}
+
+void ControlServer::LoadDelta(RequestReader& reader) {
+    const u32 delta_size = reader.Take<u32>();
+    const std::size_t delta_start = reader.Position();
+    const u64 base_hash = reader.Take<u64>();
+    const u32 state_size = reader.Take<u32>();
+    const u32 block_count = reader.Take<u32>();
+    if (loaded_state.empty() || base_hash != Common::XxHash64::Hash(loaded_state.data(), loaded_state.size())) {
+        throw std::runtime_error("The delta wasn't taken against the last state loaded.");
+    }
+
+    // The delta is applied to a copy, so a bad one leaves the last state loaded as it was.
+    state_buffer.assign(loaded_state.cbegin(), loaded_state.cbegin() + std::min<std::size_t>(state_size,
+                                                                                            loaded_state.size()));
+    state_buffer.resize(state_size, 0);
+    for (u32 i = 0; i < block_count; ++i) {
+        const std::size_t offset = static_cast<std::size_t>(reader.Take<u32>()) * delta_block_bytes;
+        if (offset >= state_buffer.size()) {
+            throw std::runtime_error(fmt::format("Delta block at offset {:#x} is past the end of the state.", offset));
+        }
+
+        const std::size_t size = std::min(delta_block_bytes, state_buffer.size() - offset);
+        std::memcpy(state_buffer.data() + offset, reader.TakeBytes(size), size);
+    }
+
+    if (reader.Position() - delta_start != delta_size) {
+        throw std::runtime_error("The delta's length doesn't match its contents.");
+    }
+    if (chroma_load_state(instance.get(), state_buffer.data(), state_buffer.size()) != 0) {
+        throw std::runtime_error("The savestate isn't valid for this game.");
+    }
+    loaded_state.swap(state_buffer);
+}
+
+} // End namespace Server
@@ -0,0 +1,119 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/CommonTypes.h"
+#include "lib/chroma.h"
+
+namespace Server {
+
+// The control protocol, over a stream socket. Every value is in host byte order, which is little endian on every
+// host Chroma runs on.
+//
+// A request is a u32 byte count followed by any number of commands, which are run in order, so one round trip can
+// set the buttons, step, and fetch an observation. Each command is a u8 opcode followed by its arguments. The
+// response is a u32 byte count followed by one result per command run. A result is a u8 status followed by the
+// command's data if the status is 0, or by a u32 length and an error message if it's 1, in which case the rest
+// of the request is skipped.
+//
+//     opcode           arguments                             data
+//     1  LoadRom       u32 length, path                      u8 chroma_system
+//     2  SetButtons    u16 buttons, as in chroma_run_frame   -
+//     3  Step          u32 frames                            u8 1 if the game has hung, otherwise 0
+//     4  SaveState     -                                     u32 length, savestate
+//     5  LoadState     u32 length, savestate                 -
+//     6  ReadMemory    u8 chroma_memory, u32 offset, u32 n   n bytes
+//     7  WriteMemory   u8 chroma_memory, u32 offset, u32 n,  -
+//                      n bytes
+//     8  GetHashes     -                                     u64 frame hash, u64 audio hash
+//     9  GetFrame      -                                     u16 width, u16 height, BGR555 pixels
+//     10 GetAudio      -                                     u32 stereo samples, s16 samples of the last step
+//     11 GetMetrics    -                                     u64 frames stepped, f64 seconds spent stepping
+//     12 SaveDelta     -                                     u32 length, state delta
+//     13 LoadDelta     u32 length, state delta               -
+//
+// The buttons stay held until they're set again. Loading a ROM releases them and resets the metrics.
+//
+// A state delta is the savestate split into 4 KiB blocks, holding only the blocks which changed since the last
+// state this server saved with SaveState or SaveDelta. It's u64 hash of that state, u32 length of the new state,
+// u32 block count, then each block's u32 index followed by its bytes, which are cut short at the end of the state.
+// LoadDelta applies it to the last state loaded with LoadState or LoadDelta, which must be the one it was taken
+// against, and loads the result.
+//
+// With --hibernate-after, a game which gets no requests for that long is hibernated with chroma_hibernate, so an idle
+// server holds little more than its compressed state, and it's woken by the next command. The frame survives this,
+// but the audio of the last step doesn't.
+//
+// Deltas let a running game move to another server with only a short pause. The source's SaveState is loaded on
+// the target while the source carries on stepping, and then deltas are carried across until they're small. The
+// last delta is taken once the source stops stepping, and the game resumes on the target after loading it.
+enum class Command : u8 {LoadRom = 1,
+                         SetButtons,
+                         Step,
+                         SaveState,
+                         LoadState,
+                         ReadMemory,
+                         WriteMemory,
+                         GetHashes,
+                         GetFrame,
+                         GetAudio,
+                         GetMetrics,
+                         SaveDelta,
+                         LoadDelta};
+
+class RequestReader;
+class ResponseWriter;
+
+// Runs one instance at a time for clients on a Unix socket, one client after another. The instance outlives the
+// client, so a script can reconnect and carry on where it left off.
+class ControlServer {
+public:
+    // Hibernates the game after this many seconds without a request, or never if it's 0.
+    ControlServer(std::vector<u8> _bios, int _hibernate_seconds);
+
+    // Serves clients until the process is killed. Throws std::runtime_error if the socket can't be opened.
+    [[noreturn]] void Run(const std::string& socket_path);
+
+    // Runs every command in a request, and returns the response without its byte count.
+    std::vector<u8> RunRequest(const std::vector<u8>& request);
+
+private:
+    const std::vector<u8> bios;
+    const int hibernate_seconds;
+    std::unique_ptr<chroma_instance, decltype(&chroma_destroy)> instance{nullptr, &chroma_destroy};
+    u16 buttons = 0;
+    u64 frames_stepped = 0;
+    double step_seconds = 0.0;
+    std::vector<u8> state_buffer;
+    // What the next delta is taken against on this side, and applied to on the other.
+    std::vector<u8> saved_state;
+    std::vector<u8> loaded_state;
+
+    void ServeClient(int socket_fd);
+    // Waits for the socket to become readable, hibernating the game if that takes long enough.
+    void WaitForRequest(int socket_fd);
+    // The commands for moving a game between servers, which are described above.
+    void SaveDelta(ResponseWriter& writer);
+    void LoadDelta(RequestReader& reader);
+};
+
+} // End namespace Server
@@ -0,0 +1,125 @@
+// This file is a part of Chroma.
+// Copyright (C) 2018 Matthew Murray
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+#include "common/CommonTypes.h"
+#include "server/ControlServer.h"
+
+namespace {
+
+void DisplayHelp() {
+    fmt::print("Usage: chroma-server [options] <socket path>\n\n");
+    fmt::print("Runs a game under the control of another process, through commands sent over a Unix socket.\n");
+    fmt::print("The protocol is described in src/server/ControlServer.h.\n\n");
+    fmt::print("Options:\n");
+    fmt::print("  -h                            display help\n");
+    fmt::print("  --bios [path]                 GBA BIOS (default: gba_bios.bin)\n");
+    fmt::print("  --accuracy [accurate, balanced, fast]\n");
+    fmt::print("                                accuracy and speed trade-offs, as in chroma (default: accurate)\n");
+    fmt::print("  --cpu [interpreter, cached, jit]\n");
+    fmt::print("                                CPU execution mode, which doesn't change the results (default:\n");
+    fmt::print("                                the profile's)\n");
+    fmt::print("  --hibernate-after [seconds]   free the game's memory, keeping only its compressed state, after\n");
+    fmt::print("                                this long without a request (default: never)\n");
+}
+
+std::vector<u8> LoadBios(const std::string& bios_path) {
+    std::ifstream bios_file(bios_path, std::ios_base::binary);
+    if (!bios_file) {
+        // GB games don't need it, and loading a GBA game reports the missing BIOS on its own.
+        return {};
+    }
+
+    return std::vector<u8>(std::istreambuf_iterator<char>(bios_file), std::istreambuf_iterator<char>());
+}
+
+} // End anonymous namespace
+
+int main(int argc, char** argv) {
+    const std::vector<std::string> tokens(argv + 1, argv + argc);
+    if (tokens.empty() || std::find(tokens.cbegin(), tokens.cend(), "-h") != tokens.cend()) {
+        DisplayHelp();
+        return 1;
+    }
+
+    std::string bios_path = "gba_bios.bin";
+    chroma_profile profile = CHROMA_PROFILE_ACCURATE;
+    std::optional<chroma_cpu_mode> cpu_mode;
+    int hibernate_seconds = 0;
+    try {
+        for (std::size_t i = 0; i + 1 < tokens.size(); ++i) {
+            if (tokens[i] == "--bios" && i + 2 < tokens.size()) {
+                bios_path = tokens[++i];
+            } else if (tokens[i] == "--cpu" && i + 2 < tokens.size()) {
+                const std::string& mode = tokens[++i];
+                if (mode == "interpreter") {
+                    cpu_mode = CHROMA_CPU_INTERPRETER;
+                } else if (mode == "cached") {
+                    cpu_mode = CHROMA_CPU_CACHED;
+                } else if (mode == "jit") {
+                    cpu_mode = CHROMA_CPU_JIT;
+                } else {
+                    throw std::invalid_argument("Invalid CPU execution mode specified: " + mode);
+                }
+            } else if (tokens[i] == "--accuracy" && i + 2 < tokens.size()) {
+                const std::string& name = tokens[++i];
+                if (name == "accurate") {
+                    profile = CHROMA_PROFILE_ACCURATE;
+                } else if (name == "balanced") {
+                    profile = CHROMA_PROFILE_BALANCED;
+                } else if (name == "fast") {
+                    profile = CHROMA_PROFILE_FAST;
+                } else {
+                    throw std::invalid_argument("Invalid accuracy profile specified: " + name);
+                }
+            } else if (tokens[i] == "--hibernate-after" && i + 2 < tokens.size()) {
+                hibernate_seconds = std::stoi(tokens[++i]);
+                if (hibernate_seconds < 1 || hibernate_seconds > 86400) {
+                    throw std::invalid_argument("Invalid hibernation delay specified: " + tokens[i]);
+                }
+            } else {
+                throw std::invalid_argument("Invalid option: " + tokens[i]);
+            }
+        }
+    } catch (const std::logic_error& e) {
+        // Covers the exceptions from std::stoi as well.
+        fmt::print("{}\n\n", e.what());
+        DisplayHelp();
+        return 1;
+    }
+
+    // The CPU mode overrides the profile's, whichever order they were given in.
+    chroma_set_profile(profile);
+    if (cpu_mode) {
+        chroma_set_cpu_mode(*cpu_mode);
+    }
+
+    try {
+        Server::ControlServer{LoadBios(bios_path), hibernate_seconds}.Run(tokens.back());
+    } catch (const std::exception& e) {
+        fmt::print("{}\n", e.what());
+        return 1;
+    }
+}